@@ -13,11 +13,27 @@
 #include <stdio.h>
 #include <string.h>
 #include "CrackleCommandLine.h"
+#include "CrackleBatch.h"
+#include "CrackleExtract.h"
+#include "CracklePlan.h"
+#include "CrackleSimulate.h"
+#include "DiskImageDelta.h"
+#include "DiskImageInterleave.h"
 #include "NibbleDiskImage.h"
 #include "BlockDiskImage.h"
 
 
-static DiskImage* allocateDiskImageObject(CrackleCommandLine* pCommandLine);
+static DiskImage* allocateDiskImageObject(CrackleImageFormat imageFormat);
+static int runMultipleImages(CrackleCommandLine* pCommandLine);
+static int runBatch(CrackleCommandLine* pCommandLine);
+static void reportBatchResults(CrackleBatch* pBatch);
+static void reportBatchStats(CrackleStatsFormat statsFormat, CrackleBatch* pBatch);
+static int runExtract(CrackleCommandLine* pCommandLine);
+static int runApplyDelta(CrackleCommandLine* pCommandLine);
+static int runPlan(CrackleCommandLine* pCommandLine);
+static int runTuneInterleave(CrackleCommandLine* pCommandLine);
+static int runSimulate(CrackleCommandLine* pCommandLine);
+static void reportStats(CrackleStatsFormat statsFormat, const DiskImageStats* pStats);
 int main(int argc, const char** argv)
 {
     int                returnValue = 0;
@@ -28,9 +44,48 @@ int main(int argc, const char** argv)
     __try
     {
         commandLine = CrackleCommandLine_Init(argc-1, argv+1);
-        pDiskImage = allocateDiskImageObject(&commandLine);
+    }
+    __catch
+    {
+        printf("image build failed.\n");
+        return 1;
+    }
+    if (commandLine.pBatchFilename)
+        return runBatch(&commandLine);
+    if (commandLine.pExtractFilename)
+        return runExtract(&commandLine);
+    if (commandLine.pApplyDeltaFilename)
+        return runApplyDelta(&commandLine);
+    if (commandLine.pPlanFilename)
+        return runPlan(&commandLine);
+    if (commandLine.tuneInterleave)
+        return runTuneInterleave(&commandLine);
+    if (commandLine.pSimulateFilename)
+        return runSimulate(&commandLine);
+    if (commandLine.imageFormatCount > 1 || commandLine.sideCount > 0)
+        return runMultipleImages(&commandLine);
+    
+    __try
+    {
+        pDiskImage = allocateDiskImageObject(commandLine.imageFormat);
+        if (commandLine.pBundleFilename)
+            DiskImage_OpenBundle(pDiskImage, commandLine.pBundleFilename);
+        if (commandLine.pManifestFilename)
+            DiskImage_ReadManifest(pDiskImage, commandLine.pManifestFilename);
+        if (commandLine.updateImage)
+            DiskImage_ReadImageForUpdate(pDiskImage, commandLine.pOutputImageFilename);
+        else if (!commandLine.pDeltaFromFilename)
+            DiskImage_MapOutputImage(pDiskImage, commandLine.pOutputImageFilename);
         DiskImage_ProcessScriptFile(pDiskImage, commandLine.pScriptFilename);
-        DiskImage_WriteImage(pDiskImage, commandLine.pOutputImageFilename);
+        if (commandLine.pDeltaFromFilename)
+            DiskImage_WriteDelta(pDiskImage, commandLine.pDeltaFromFilename, commandLine.pOutputImageFilename);
+        else if (commandLine.updateImage)
+            DiskImage_UpdateImage(pDiskImage, commandLine.pOutputImageFilename);
+        else
+            DiskImage_WriteImage(pDiskImage, commandLine.pOutputImageFilename);
+        if (commandLine.pManifestFilename)
+            DiskImage_WriteManifest(pDiskImage, commandLine.pManifestFilename);
+        reportStats(commandLine.statsFormat, DiskImage_GetStats(pDiskImage));
     }
     __catch
     {
@@ -43,12 +98,232 @@ int main(int argc, const char** argv)
     return returnValue;
 }
 
-static DiskImage* allocateDiskImageObject(CrackleCommandLine* pCommandLine)
+static DiskImage* allocateDiskImageObject(CrackleImageFormat imageFormat)
 {
-    if (pCommandLine->imageFormat == FORMAT_NIB_5_25)
+    if (imageFormat == FORMAT_NIB_5_25)
         return (DiskImage*) NibbleDiskImage_Create();
-    else if (pCommandLine->imageFormat == FORMAT_HDV_3_5)
+    else if (imageFormat == FORMAT_HDV_3_5)
         return (DiskImage*) BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
     else
         return NULL;
 }
+
+static int runMultipleImages(CrackleCommandLine* pCommandLine)
+{
+    int            returnValue = 0;
+    DiskImage*     apDiskImages[CRACKLE_COMMAND_LINE_MAX_IMAGES];
+    DiskImageStats totalStats;
+    size_t         imageCount = pCommandLine->sideCount ? pCommandLine->sideCount : pCommandLine->imageFormatCount;
+    size_t         i;
+    
+    memset(apDiskImages, 0, sizeof(apDiskImages));
+    memset(&totalStats, 0, sizeof(totalStats));
+    __try
+    {
+        for (i = 0 ; i < imageCount ; i++)
+        {
+            apDiskImages[i] = allocateDiskImageObject(pCommandLine->imageFormats[pCommandLine->sideCount ? 0 : i]);
+            DiskImage_MapOutputImage(apDiskImages[i], pCommandLine->apOutputImageFilenames[i]);
+        }
+        if (pCommandLine->pBundleFilename)
+            DiskImage_OpenBundle(apDiskImages[0], pCommandLine->pBundleFilename);
+        if (pCommandLine->sideCount)
+            DiskImage_ProcessScriptFileForSides(apDiskImages, pCommandLine->sides, imageCount, 
+                                                pCommandLine->pScriptFilename);
+        else
+            DiskImage_ProcessScriptFileForImages(apDiskImages, imageCount, pCommandLine->pScriptFilename);
+        for (i = 0 ; i < imageCount ; i++)
+        {
+            DiskImage_WriteImage(apDiskImages[i], pCommandLine->apOutputImageFilenames[i]);
+            DiskImageStats_Add(&totalStats, DiskImage_GetStats(apDiskImages[i]));
+        }
+        reportStats(pCommandLine->statsFormat, &totalStats);
+    }
+    __catch
+    {
+        for (i = 0 ; i < imageCount ; i++)
+            printf("%s image build failed.\n", pCommandLine->apOutputImageFilenames[i]);
+        returnValue = 1;
+    }
+    
+    for (i = 0 ; i < imageCount ; i++)
+        DiskImage_Free(apDiskImages[i]);
+    
+    return returnValue;
+}
+
+static int runBatch(CrackleCommandLine* pCommandLine)
+{
+    int           returnValue = 0;
+    CrackleBatch* pBatch = NULL;
+    
+    __try
+    {
+        pBatch = CrackleBatch_Create(NULL, pCommandLine->pBatchFilename);
+        if (pCommandLine->pBundleFilename)
+            CrackleBatch_OpenBundle(pBatch, pCommandLine->pBundleFilename);
+        CrackleBatch_Run(pBatch);
+        reportBatchResults(pBatch);
+        reportBatchStats(pCommandLine->statsFormat, pBatch);
+        returnValue = pBatch->failedCount ? 1 : 0;
+    }
+    __catch
+    {
+        printf("%s batch build failed.\n", pCommandLine->pBatchFilename);
+        returnValue = 1;
+    }
+    
+    CrackleBatch_Free(pBatch);
+    
+    return returnValue;
+}
+
+static void reportBatchResults(CrackleBatch* pBatch)
+{
+    size_t i;
+    
+    for (i = 0 ; i < pBatch->imageCount ; i++)
+    {
+        CrackleBatchImage* pImage = &pBatch->pImages[i];
+        
+        if (pImage->exceptionCode != noException)
+            printf("%s image build failed.\n", pImage->pOutputImageFilename);
+        else if (pImage->scriptErrorCount > 0)
+            printf("%s image built with %u script errors.\n", pImage->pOutputImageFilename, pImage->scriptErrorCount);
+    }
+    printf("Built %lu of %lu images without errors in %.3f seconds (%.3f seconds summed across the images).\n",
+           (unsigned long)(pBatch->imageCount - pBatch->failedCount),
+           (unsigned long)pBatch->imageCount,
+           pBatch->elapsedSeconds,
+           CrackleBatch_GetTotalBuildSeconds(pBatch));
+}
+
+static void reportBatchStats(CrackleStatsFormat statsFormat, CrackleBatch* pBatch)
+{
+    DiskImageStats totalStats;
+    size_t         i;
+    
+    memset(&totalStats, 0, sizeof(totalStats));
+    for (i = 0 ; i < pBatch->imageCount ; i++)
+        DiskImageStats_Add(&totalStats, DiskImage_GetStats(pBatch->pImages[i].pDiskImage));
+    reportStats(statsFormat, &totalStats);
+}
+
+static int runExtract(CrackleCommandLine* pCommandLine)
+{
+    int             returnValue = 0;
+    CrackleExtract* pExtract = NULL;
+    
+    __try
+    {
+        pExtract = CrackleExtract_Create(NULL, pCommandLine->pExtractFilename);
+        CrackleExtract_Decode(pExtract);
+        CrackleExtract_ReportStatus(pExtract);
+        printf("Decoded %lu bytes in %.3f seconds (%.1f MB/s).\n",
+               (unsigned long)pExtract->image.bufferSize,
+               pExtract->elapsedSeconds,
+               pExtract->elapsedSeconds > 0.0 ? pExtract->image.bufferSize / pExtract->elapsedSeconds / 1e6 : 0.0);
+        if (pCommandLine->pExtractOutputFilename)
+            CrackleExtract_WriteLogicalData(pExtract, NULL, pCommandLine->pExtractOutputFilename);
+        returnValue = pExtract->badTrackCount ? 1 : 0;
+    }
+    __catch
+    {
+        printf("%s extract failed.\n", pCommandLine->pExtractFilename);
+        returnValue = 1;
+    }
+    
+    CrackleExtract_Free(pExtract);
+    
+    return returnValue;
+}
+
+static int runApplyDelta(CrackleCommandLine* pCommandLine)
+{
+    int            returnValue = 0;
+    DiskImageDelta delta;
+    
+    memset(&delta, 0, sizeof(delta));
+    __try
+    {
+        DiskImageDelta_Read(&delta, NULL, pCommandLine->pApplyDeltaFilename);
+        DiskImageDelta_ApplyToImageFile(&delta, NULL, pCommandLine->pOutputImageFilename);
+    }
+    __catch
+    {
+        printf("%s image patch failed.\n", pCommandLine->pOutputImageFilename);
+        returnValue = 1;
+    }
+    
+    DiskImageDelta_Free(&delta);
+    
+    return returnValue;
+}
+
+static int runPlan(CrackleCommandLine* pCommandLine)
+{
+    int          returnValue = 0;
+    CracklePlan* pPlan = NULL;
+    
+    __try
+    {
+        pPlan = CracklePlan_Create(NULL, pCommandLine->pPlanFilename);
+        if (pCommandLine->pBundleFilename)
+            CracklePlan_OpenBundle(pPlan, pCommandLine->pBundleFilename);
+        CracklePlan_Run(pPlan);
+        CracklePlan_WriteScript(pPlan, pCommandLine->pScriptFilename);
+        CracklePlan_ReportSeeks(pPlan);
+    }
+    __catch
+    {
+        printf("%s plan failed.\n", pCommandLine->pPlanFilename);
+        returnValue = 1;
+    }
+    
+    CracklePlan_Free(pPlan);
+    
+    return returnValue;
+}
+
+static int runTuneInterleave(CrackleCommandLine* pCommandLine)
+{
+    DiskImageInterleaveTuning tuning = DiskImageInterleave_Tune(pCommandLine->cyclesPerSector);
+    
+    DiskImageInterleave_PrintTuning(&tuning);
+    
+    return 0;
+}
+
+static int runSimulate(CrackleCommandLine* pCommandLine)
+{
+    int              returnValue = 0;
+    CrackleSimulate* pSimulate = NULL;
+    
+    __try
+    {
+        pSimulate = CrackleSimulate_Create(NULL, pCommandLine->pSimulateFilename, pCommandLine->pOutputImageFilename);
+        CrackleSimulate_Run(pSimulate);
+        CrackleSimulate_ReportTimes(pSimulate);
+        if (CrackleSimulate_IsOverBudget(pSimulate))
+            returnValue = 1;
+    }
+    __catch
+    {
+        printf("%s simulation failed.\n", pCommandLine->pSimulateFilename);
+        returnValue = 1;
+    }
+    
+    CrackleSimulate_Free(pSimulate);
+    
+    return returnValue;
+}
+
+static void reportStats(CrackleStatsFormat statsFormat, const DiskImageStats* pStats)
+{
+    if (statsFormat == STATS_TEXT)
+        DiskImageStats_PrintText(pStats);
+    else if (statsFormat == STATS_JSON)
+        DiskImageStats_PrintJson(pStats);
+    else
+        DiskImageStats_PrintCompression(pStats);
+}
@@ -0,0 +1,793 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Measures crackle's throughput on synthetic workloads which are generated in a MemoryVfs so that the host's file
+   system doesn't skew the results.  Each benchmark is run several times and its fastest run is kept.  The results can
+   be written out as CSV and compared against a baseline from an earlier run. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "CrackleBatch.h"
+#include "NibbleDiskImage.h"
+#include "BlockDiskImage.h"
+#include "MemoryVfs.h"
+#include "TextFile.h"
+#include "ParseCSV.h"
+#include "util.h"
+
+
+#define BENCH_OBJECT_SIZE           (64 * 1024)
+#define BENCH_BLOCK_INSERT_COUNT    4096
+#define BENCH_DEFAULT_ITERATIONS    5
+#define BENCH_DEFAULT_TOLERANCE     50.0
+#define BENCH_MAX_RESULTS           32
+#define BENCH_RW18_TRACK_BYTES      (DISK_IMAGE_TRACKS_PER_SIDE * DISK_IMAGE_RW18_BYTES_PER_TRACK)
+#define BENCH_RWTS16_TRACK_BYTES    (DISK_IMAGE_TRACKS_PER_SIDE * NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK * \
+                                     DISK_IMAGE_BYTES_PER_SECTOR)
+
+static const char g_objectFilename[] = "bench.obj";
+static const char g_blockScript[] = "block.script";
+static const char g_rwts16Script[] = "rwts16.script";
+static const char g_rw18Script[] = "rw18.script";
+static const char g_rw18Side1Script[] = "rw18_side1.script";
+static const char g_sidesScript[] = "sides.script";
+static const char g_batchFilename[] = "bench.batch";
+
+
+typedef struct BenchOptions
+{
+    const char*  pOutputFilename;
+    const char*  pBaselineFilename;
+    unsigned int iterations;
+    double       tolerancePercent;
+} BenchOptions;
+
+typedef struct BenchResult
+{
+    const char* pName;
+    double      seconds;
+    double      megabytesPerSecond;
+} BenchResult;
+
+typedef double (*BenchFunction)(MemoryVfs* pVfs);
+
+typedef struct Benchmark
+{
+    const char*   pName;
+    BenchFunction pRun;
+    size_t        bytesPerRun;
+} Benchmark;
+
+
+static double runScriptParse(MemoryVfs* pVfs);
+static double runBlockBuild(MemoryVfs* pVfs);
+static double runRWTS16Build(MemoryVfs* pVfs);
+static double runRW18PartialBuild(MemoryVfs* pVfs);
+static double runRW18PartialUpdate(MemoryVfs* pVfs);
+static double runRWTS16Encode(MemoryVfs* pVfs);
+static double runRW18Encode(MemoryVfs* pVfs);
+static double runRWTS16Decode(MemoryVfs* pVfs);
+static double runRW18Decode(MemoryVfs* pVfs);
+static double runSerialSides(MemoryVfs* pVfs);
+static double runFanOutSides(MemoryVfs* pVfs);
+static double runSerialBatch(MemoryVfs* pVfs);
+static double runConcurrentBatch(MemoryVfs* pVfs);
+
+static const Benchmark g_benchmarks[] =
+{
+    { "script_parse",         runScriptParse,       0 },
+    { "block_build",          runBlockBuild,        BLOCK_DISK_IMAGE_3_5_DISK_SIZE },
+    { "rwts16_build",         runRWTS16Build,       NIBBLE_DISK_IMAGE_SIZE },
+    { "rw18_partial_build",   runRW18PartialBuild,  NIBBLE_DISK_IMAGE_SIZE },
+    { "rw18_partial_update",  runRW18PartialUpdate, NIBBLE_DISK_IMAGE_SIZE },
+    { "rwts16_encode",        runRWTS16Encode,      BENCH_RWTS16_TRACK_BYTES },
+    { "rw18_encode",          runRW18Encode,        BENCH_RW18_TRACK_BYTES },
+    { "rwts16_decode",        runRWTS16Decode,      BENCH_RWTS16_TRACK_BYTES },
+    { "rw18_decode",          runRW18Decode,        BENCH_RW18_TRACK_BYTES },
+    { "sides_serial",         runSerialSides,       2 * NIBBLE_DISK_IMAGE_SIZE },
+    { "sides_fan_out",        runFanOutSides,       2 * NIBBLE_DISK_IMAGE_SIZE },
+    { "batch_serial",         runSerialBatch,       2 * NIBBLE_DISK_IMAGE_SIZE + BLOCK_DISK_IMAGE_3_5_DISK_SIZE },
+    { "batch_concurrent",     runConcurrentBatch,   2 * NIBBLE_DISK_IMAGE_SIZE + BLOCK_DISK_IMAGE_3_5_DISK_SIZE }
+};
+
+
+static void        displayUsage(void);
+static int         parseCommandLine(BenchOptions* pOptions, int argc, const char** argv);
+static MemoryVfs*  createWorkloads(void);
+static void        runBenchmarks(MemoryVfs* pVfs, const BenchOptions* pOptions, BenchResult* pResults);
+static void        writeResults(const char* pFilename, const BenchResult* pResults, size_t resultCount);
+static int         compareWithBaseline(const char*        pBaselineFilename,
+                                       const BenchResult* pResults,
+                                       size_t             resultCount,
+                                       double             tolerancePercent);
+int main(int argc, const char** argv)
+{
+    BenchOptions options;
+    BenchResult  results[ARRAYSIZE(g_benchmarks)];
+    MemoryVfs*   pVfs = NULL;
+    int          returnValue = 0;
+
+    if (!parseCommandLine(&options, argc - 1, argv + 1))
+    {
+        displayUsage();
+        return 1;
+    }
+
+    __try
+    {
+        pVfs = createWorkloads();
+        runBenchmarks(pVfs, &options, results);
+        if (options.pOutputFilename)
+            writeResults(options.pOutputFilename, results, ARRAYSIZE(results));
+        if (options.pBaselineFilename)
+            returnValue = compareWithBaseline(options.pBaselineFilename, results, ARRAYSIZE(results),
+                                              options.tolerancePercent);
+    }
+    __catch
+    {
+        fprintf(stderr, "error: Benchmark failed with exception %d." LINE_ENDING, getExceptionCode());
+        returnValue = 1;
+    }
+    Vfs_Free((Vfs*)pVfs);
+
+    return returnValue;
+}
+
+static void displayUsage(void)
+{
+    printf("Usage: cracklebench [--iterations count] [--output results.csv]\n"
+           "                    [--baseline baseline.csv] [--tolerance percent]\n"
+           "Where: --iterations sets how many times each benchmark is run.  The fastest\n"
+           "           run is reported.  Defaults to %u.\n"
+           "       --output writes the results to a CSV file which can later be used as\n"
+           "           a baseline.\n"
+           "       --baseline compares the results against an earlier --output file and\n"
+           "           exits with 1 if any benchmark is slower by more than the tolerance.\n"
+           "       --tolerance is the percentage a benchmark can be slower than its\n"
+           "           baseline before it counts as a regression.  Defaults to %.0f.\n",
+           BENCH_DEFAULT_ITERATIONS, BENCH_DEFAULT_TOLERANCE);
+}
+
+static int parseCommandLine(BenchOptions* pOptions, int argc, const char** argv)
+{
+    memset(pOptions, 0, sizeof(*pOptions));
+    pOptions->iterations = BENCH_DEFAULT_ITERATIONS;
+    pOptions->tolerancePercent = BENCH_DEFAULT_TOLERANCE;
+
+    while (argc >= 2)
+    {
+        if (0 == strcasecmp(argv[0], "--iterations"))
+            pOptions->iterations = (unsigned int)strtoul(argv[1], NULL, 0);
+        else if (0 == strcasecmp(argv[0], "--output"))
+            pOptions->pOutputFilename = argv[1];
+        else if (0 == strcasecmp(argv[0], "--baseline"))
+            pOptions->pBaselineFilename = argv[1];
+        else if (0 == strcasecmp(argv[0], "--tolerance"))
+            pOptions->tolerancePercent = strtod(argv[1], NULL);
+        else
+            return 0;
+        argc -= 2;
+        argv += 2;
+    }
+
+    return argc == 0 && pOptions->iterations > 0 && pOptions->tolerancePercent >= 0.0;
+}
+
+
+static double getSeconds(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (double)now.tv_sec + (double)now.tv_usec / 1000000.0;
+}
+
+
+static void  addObjectFile(MemoryVfs* pVfs);
+static FILE* openScript(MemoryVfs* pVfs, const char* pFilename);
+static void  closeScript(FILE* pStream);
+static void  writeBlockLines(FILE* pStream);
+static void  writeRWTS16Lines(FILE* pStream);
+static void  writeRW18Lines(FILE* pStream, unsigned int side);
+static void  buildImageFiles(MemoryVfs* pVfs);
+static MemoryVfs* createWorkloads(void)
+{
+    /* The scripts are:
+         block.script - Thousands of BLOCK lines which wrap around the whole 3.5" image a couple of times.
+         rwts16.script - One RWTS16 line for every sector of a 5.25" disk.
+         rw18.script - One RW18 line for every page of every track so that each track is built up from many partial
+                       inserts.  rw18_side1.script does the same for the second side and sides.script holds both
+                       sides. */
+    MemoryVfs* pVfs = NULL;
+    FILE*      pStream = NULL;
+
+    __try
+    {
+        pVfs = MemoryVfs_Create();
+        addObjectFile(pVfs);
+
+        pStream = openScript(pVfs, g_blockScript);
+        writeBlockLines(pStream);
+        closeScript(pStream);
+
+        pStream = openScript(pVfs, g_rwts16Script);
+        writeRWTS16Lines(pStream);
+        closeScript(pStream);
+
+        pStream = openScript(pVfs, g_rw18Script);
+        writeRW18Lines(pStream, DISK_IMAGE_RW18_SIDE_0);
+        closeScript(pStream);
+
+        pStream = openScript(pVfs, g_rw18Side1Script);
+        writeRW18Lines(pStream, DISK_IMAGE_RW18_SIDE_1);
+        closeScript(pStream);
+
+        pStream = openScript(pVfs, g_sidesScript);
+        writeRW18Lines(pStream, DISK_IMAGE_RW18_SIDE_0);
+        writeRW18Lines(pStream, DISK_IMAGE_RW18_SIDE_1);
+        closeScript(pStream);
+
+        pStream = openScript(pVfs, g_batchFilename);
+        fprintf(pStream, "nib_5.25,%s,batch0.nib\n"
+                         "nib_5.25,%s,batch1.nib\n"
+                         "hdv_3.5,%s,batch2.hdv\n",
+                g_rwts16Script, g_rw18Script, g_blockScript);
+        closeScript(pStream);
+
+        buildImageFiles(pVfs);
+    }
+    __catch
+    {
+        Vfs_Free((Vfs*)pVfs);
+        __rethrow;
+    }
+
+    return pVfs;
+}
+
+static void addObjectFile(MemoryVfs* pVfs)
+{
+    static unsigned char object[BENCH_OBJECT_SIZE];
+    unsigned int         seed = 1;
+    size_t               i;
+
+    for (i = 0 ; i < sizeof(object) ; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        object[i] = (unsigned char)(seed >> 16);
+    }
+    MemoryVfs_AddFile(pVfs, g_objectFilename, object, sizeof(object));
+}
+
+static FILE* openScript(MemoryVfs* pVfs, const char* pFilename)
+{
+    FILE* pStream = Vfs_OpenStream((Vfs*)pVfs, pFilename);
+
+    if (!pStream)
+        __throw(fileOpenException);
+    return pStream;
+}
+
+static void closeScript(FILE* pStream)
+{
+    int isBad = ferror(pStream);
+
+    if (0 != fclose(pStream) || isBad)
+        __throw(fileException);
+}
+
+static void writeBlockLines(FILE* pStream)
+{
+    unsigned int i;
+
+    for (i = 0 ; i < BENCH_BLOCK_INSERT_COUNT ; i++)
+    {
+        fprintf(pStream, "BLOCK,%s,%u,%u,%u\n",
+                g_objectFilename,
+                (i * DISK_IMAGE_BLOCK_SIZE) % BENCH_OBJECT_SIZE,
+                DISK_IMAGE_BLOCK_SIZE,
+                (i * 7) % BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    }
+}
+
+static void writeRWTS16Lines(FILE* pStream)
+{
+    unsigned int track;
+    unsigned int sector;
+
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+    {
+        for (sector = 0 ; sector < NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK ; sector++)
+        {
+            unsigned int offset = (track * NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK + sector) *
+                                  DISK_IMAGE_BYTES_PER_SECTOR;
+
+            fprintf(pStream, "RWTS16,%s,%u,%u,%u,%u\n",
+                    g_objectFilename, offset % BENCH_OBJECT_SIZE, DISK_IMAGE_BYTES_PER_SECTOR, track, sector);
+        }
+    }
+}
+
+static void writeRW18Lines(FILE* pStream, unsigned int side)
+{
+    /* Pages are inserted in reverse order so that no insert lines up with the start of its track. */
+    unsigned int track;
+    unsigned int page;
+
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+    {
+        for (page = DISK_IMAGE_RW18_PAGES_PER_TRACK ; page-- > 0 ; )
+        {
+            unsigned int offset = (track * DISK_IMAGE_RW18_PAGES_PER_TRACK + page) * DISK_IMAGE_PAGE_SIZE;
+
+            fprintf(pStream, "RW18,%s,%u,%u,0x%02x,%u,%u\n",
+                    g_objectFilename, offset % BENCH_OBJECT_SIZE, DISK_IMAGE_PAGE_SIZE,
+                    side, track, page * DISK_IMAGE_PAGE_SIZE);
+        }
+    }
+}
+
+static void buildImage(MemoryVfs* pVfs, DiskImage* pDiskImage, const char* pScriptFilename, const char* pImageFilename);
+static void buildImageFiles(MemoryVfs* pVfs)
+{
+    /* The decode and update benchmarks start from these images. */
+    buildImage(pVfs, (DiskImage*)NibbleDiskImage_Create(), g_rwts16Script, "rwts16.nib");
+    buildImage(pVfs, (DiskImage*)NibbleDiskImage_Create(), g_rw18Script, "rw18.nib");
+}
+
+static void validateNoScriptErrors(DiskImage* pDiskImage);
+static void buildImage(MemoryVfs* pVfs, DiskImage* pDiskImage, const char* pScriptFilename, const char* pImageFilename)
+{
+    __try
+    {
+        DiskImage_SetVfs(pDiskImage, (Vfs*)pVfs);
+        DiskImage_MapOutputImage(pDiskImage, pImageFilename);
+        DiskImage_ProcessScriptFile(pDiskImage, pScriptFilename);
+        validateNoScriptErrors(pDiskImage);
+        DiskImage_WriteImage(pDiskImage, pImageFilename);
+    }
+    __catch
+    {
+        DiskImage_Free(pDiskImage);
+        __rethrow;
+    }
+    DiskImage_Free(pDiskImage);
+}
+
+static void validateNoScriptErrors(DiskImage* pDiskImage)
+{
+    if (DiskImage_GetScriptErrorCount(pDiskImage) > 0)
+        __throw(invalidArgumentException);
+}
+
+
+static void runBenchmarks(MemoryVfs* pVfs, const BenchOptions* pOptions, BenchResult* pResults)
+{
+    size_t i;
+
+    printf("%-22s %12s %12s\n", "benchmark", "seconds", "MB/s");
+    for (i = 0 ; i < ARRAYSIZE(g_benchmarks) ; i++)
+    {
+        const Benchmark* pBenchmark = &g_benchmarks[i];
+        BenchResult*     pResult = &pResults[i];
+        unsigned int     iteration;
+
+        pResult->pName = pBenchmark->pName;
+        pResult->seconds = 0.0;
+        for (iteration = 0 ; iteration < pOptions->iterations ; iteration++)
+        {
+            double seconds = pBenchmark->pRun(pVfs);
+
+            if (iteration == 0 || seconds < pResult->seconds)
+                pResult->seconds = seconds;
+        }
+        pResult->megabytesPerSecond = 0.0;
+        if (pBenchmark->bytesPerRun > 0 && pResult->seconds > 0.0)
+            pResult->megabytesPerSecond = (double)pBenchmark->bytesPerRun / (1024.0 * 1024.0) / pResult->seconds;
+        printf("%-22s %12.6f %12.2f\n", pResult->pName, pResult->seconds, pResult->megabytesPerSecond);
+    }
+}
+
+static double runScriptParse(MemoryVfs* pVfs)
+{
+    /* Prefetching parses every line of the script and reads its object but doesn't insert anything. */
+    DiskImage* pDiskImage = (DiskImage*)BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    double     startTime;
+    double     elapsedTime;
+
+    __try
+    {
+        DiskImage_SetVfs(pDiskImage, (Vfs*)pVfs);
+        startTime = getSeconds();
+        DiskImage_PrefetchScriptObjects(pDiskImage, g_blockScript);
+        DiskImage_PrefetchScriptObjects(pDiskImage, g_rwts16Script);
+        DiskImage_PrefetchScriptObjects(pDiskImage, g_rw18Script);
+        elapsedTime = getSeconds() - startTime;
+    }
+    __catch
+    {
+        DiskImage_Free(pDiskImage);
+        __rethrow;
+    }
+    DiskImage_Free(pDiskImage);
+
+    return elapsedTime;
+}
+
+static double timeBuild(MemoryVfs* pVfs, DiskImage* pDiskImage, const char* pScriptFilename, const char* pImageFilename)
+{
+    double startTime = getSeconds();
+
+    buildImage(pVfs, pDiskImage, pScriptFilename, pImageFilename);
+    return getSeconds() - startTime;
+}
+
+static double runBlockBuild(MemoryVfs* pVfs)
+{
+    return timeBuild(pVfs, (DiskImage*)BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT),
+                     g_blockScript, "block.hdv");
+}
+
+static double runRWTS16Build(MemoryVfs* pVfs)
+{
+    return timeBuild(pVfs, (DiskImage*)NibbleDiskImage_Create(), g_rwts16Script, "build.nib");
+}
+
+static double runRW18PartialBuild(MemoryVfs* pVfs)
+{
+    return timeBuild(pVfs, (DiskImage*)NibbleDiskImage_Create(), g_rw18Script, "build.nib");
+}
+
+static double runRW18PartialUpdate(MemoryVfs* pVfs)
+{
+    /* Every track of the image being updated already holds RW18 data, so the first insert into each track has to
+       decode it before the track can be modified and encoded again. */
+    DiskImage*  pDiskImage = (DiskImage*)NibbleDiskImage_Create();
+    size_t      imageSize = 0;
+    const void* pImage = MemoryVfs_GetFileData(pVfs, "rw18.nib", &imageSize);
+    double      startTime;
+    double      elapsedTime;
+
+    __try
+    {
+        MemoryVfs_AddFile(pVfs, "update.nib", pImage, imageSize);
+        DiskImage_SetVfs(pDiskImage, (Vfs*)pVfs);
+        startTime = getSeconds();
+        DiskImage_ReadImageForUpdate(pDiskImage, "update.nib");
+        DiskImage_ProcessScriptFile(pDiskImage, g_rw18Script);
+        validateNoScriptErrors(pDiskImage);
+        DiskImage_UpdateImage(pDiskImage, "update.nib");
+        elapsedTime = getSeconds() - startTime;
+    }
+    __catch
+    {
+        DiskImage_Free(pDiskImage);
+        __rethrow;
+    }
+    DiskImage_Free(pDiskImage);
+
+    return elapsedTime;
+}
+
+static const unsigned char* getObjectData(MemoryVfs* pVfs)
+{
+    size_t objectSize = 0;
+
+    return MemoryVfs_GetFileData(pVfs, g_objectFilename, &objectSize);
+}
+
+static double timeEncode(MemoryVfs* pVfs, DiskImageInsertionType type, unsigned int insertCount, unsigned int length);
+static double runRWTS16Encode(MemoryVfs* pVfs)
+{
+    return timeEncode(pVfs, DISK_IMAGE_INSERTION_RWTS16,
+                      DISK_IMAGE_TRACKS_PER_SIDE * NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK,
+                      DISK_IMAGE_BYTES_PER_SECTOR);
+}
+
+static double runRW18Encode(MemoryVfs* pVfs)
+{
+    return timeEncode(pVfs, DISK_IMAGE_INSERTION_RW18, DISK_IMAGE_TRACKS_PER_SIDE, DISK_IMAGE_RW18_BYTES_PER_TRACK);
+}
+
+static double timeEncode(MemoryVfs* pVfs, DiskImageInsertionType type, unsigned int insertCount, unsigned int length)
+{
+    /* Inserts the data directly, skipping the script engine, and then fetches the image pointer to force every dirty
+       track to be nibblized. */
+    NibbleDiskImage*     pNibbleImage = NibbleDiskImage_Create();
+    const unsigned char* pObject = getObjectData(pVfs);
+    DiskImageInsert      insert;
+    unsigned int         i;
+    double               startTime;
+    double               elapsedTime;
+
+    memset(&insert, 0, sizeof(insert));
+    insert.type = type;
+    insert.length = length;
+    insert.side = DISK_IMAGE_RW18_SIDE_0;
+    __try
+    {
+        startTime = getSeconds();
+        for (i = 0 ; i < insertCount ; i++)
+        {
+            insert.sourceOffset = (i * DISK_IMAGE_PAGE_SIZE) % (BENCH_OBJECT_SIZE - length);
+            if (type == DISK_IMAGE_INSERTION_RW18)
+            {
+                insert.track = i;
+            }
+            else
+            {
+                insert.track = i / NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK;
+                insert.sector = i % NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK;
+            }
+            NibbleDiskImage_InsertData(pNibbleImage, pObject, &insert);
+        }
+        NibbleDiskImage_GetImagePointer(pNibbleImage);
+        elapsedTime = getSeconds() - startTime;
+    }
+    __catch
+    {
+        DiskImage_Free((DiskImage*)pNibbleImage);
+        __rethrow;
+    }
+    DiskImage_Free((DiskImage*)pNibbleImage);
+
+    return elapsedTime;
+}
+
+static double timeDecode(MemoryVfs* pVfs, const char* pImageFilename, NibbleDiskImageTrackFormat expectedFormat);
+static double runRWTS16Decode(MemoryVfs* pVfs)
+{
+    return timeDecode(pVfs, "rwts16.nib", NIBBLE_TRACK_RWTS16);
+}
+
+static double runRW18Decode(MemoryVfs* pVfs)
+{
+    return timeDecode(pVfs, "rw18.nib", NIBBLE_TRACK_RW18);
+}
+
+static double timeDecode(MemoryVfs* pVfs, const char* pImageFilename, NibbleDiskImageTrackFormat expectedFormat)
+{
+    static unsigned char       trackData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+    NibbleDiskImageTrackStatus status;
+    size_t                     imageSize = 0;
+    const unsigned char*       pImage = MemoryVfs_GetFileData(pVfs, pImageFilename, &imageSize);
+    unsigned int               track;
+    double                     startTime = getSeconds();
+    double                     elapsedTime;
+
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+    {
+        NibbleDiskImage_DecodeTrack(pImage + track * NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK, track, trackData, &status);
+        if (status.format != expectedFormat || status.badSectors != 0)
+            __throw(badTrackException);
+    }
+    elapsedTime = getSeconds() - startTime;
+
+    return elapsedTime;
+}
+
+static double runSerialSides(MemoryVfs* pVfs)
+{
+    return timeBuild(pVfs, (DiskImage*)NibbleDiskImage_Create(), g_rw18Script, "side0.nib") +
+           timeBuild(pVfs, (DiskImage*)NibbleDiskImage_Create(), g_rw18Side1Script, "side1.nib");
+}
+
+static double runFanOutSides(MemoryVfs* pVfs)
+{
+    /* Builds the same two images as runSerialSides() but from a single parse of one script. */
+    static const unsigned int sides[] = { DISK_IMAGE_RW18_SIDE_0, DISK_IMAGE_RW18_SIDE_1 };
+    static const char*        imageFilenames[] = { "side0.nib", "side1.nib" };
+    DiskImage*                images[2] = { NULL, NULL };
+    double                    startTime = getSeconds();
+    size_t                    i;
+
+    __try
+    {
+        for (i = 0 ; i < ARRAYSIZE(images) ; i++)
+        {
+            images[i] = (DiskImage*)NibbleDiskImage_Create();
+            DiskImage_SetVfs(images[i], (Vfs*)pVfs);
+            DiskImage_MapOutputImage(images[i], imageFilenames[i]);
+        }
+        DiskImage_ProcessScriptFileForSides(images, sides, ARRAYSIZE(images), g_sidesScript);
+        for (i = 0 ; i < ARRAYSIZE(images) ; i++)
+        {
+            validateNoScriptErrors(images[i]);
+            DiskImage_WriteImage(images[i], imageFilenames[i]);
+        }
+    }
+    __catch
+    {
+        DiskImage_Free(images[0]);
+        DiskImage_Free(images[1]);
+        __rethrow;
+    }
+    DiskImage_Free(images[0]);
+    DiskImage_Free(images[1]);
+
+    return getSeconds() - startTime;
+}
+
+static double runSerialBatch(MemoryVfs* pVfs)
+{
+    /* Builds the images from the batch file one after the other, the way separate crackle runs would. */
+    return timeBuild(pVfs, (DiskImage*)NibbleDiskImage_Create(), g_rwts16Script, "batch0.nib") +
+           timeBuild(pVfs, (DiskImage*)NibbleDiskImage_Create(), g_rw18Script, "batch1.nib") +
+           timeBuild(pVfs, (DiskImage*)BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT),
+                     g_blockScript, "batch2.hdv");
+}
+
+static double runConcurrentBatch(MemoryVfs* pVfs)
+{
+    CrackleBatch* pBatch = NULL;
+    double        elapsedSeconds;
+
+    __try
+    {
+        pBatch = CrackleBatch_Create((Vfs*)pVfs, g_batchFilename);
+        CrackleBatch_Run(pBatch);
+        if (pBatch->failedCount > 0)
+            __throw(invalidArgumentException);
+        elapsedSeconds = pBatch->elapsedSeconds;
+    }
+    __catch
+    {
+        CrackleBatch_Free(pBatch);
+        __rethrow;
+    }
+    CrackleBatch_Free(pBatch);
+
+    return elapsedSeconds;
+}
+
+
+static void writeResults(const char* pFilename, const BenchResult* pResults, size_t resultCount)
+{
+    FILE*  pFile = fopen(pFilename, "w");
+    size_t i;
+
+    if (!pFile)
+    {
+        fprintf(stderr, "error: Failed to create %s results file." LINE_ENDING, pFilename);
+        __throw(fileOpenException);
+    }
+    fprintf(pFile, "benchmark,seconds,megabytesPerSecond\n");
+    for (i = 0 ; i < resultCount ; i++)
+        fprintf(pFile, "%s,%.6f,%.2f\n", pResults[i].pName, pResults[i].seconds, pResults[i].megabytesPerSecond);
+    if (0 != fclose(pFile))
+        __throw(fileException);
+}
+
+
+typedef struct BaselineEntry
+{
+    char   name[64];
+    double seconds;
+} BaselineEntry;
+
+static size_t readBaseline(const char* pBaselineFilename, BaselineEntry* pEntries, size_t maxEntries);
+static const BaselineEntry* findBaselineEntry(const BaselineEntry* pEntries, size_t entryCount, const char* pName);
+static int compareWithBaseline(const char*        pBaselineFilename,
+                               const BenchResult* pResults,
+                               size_t             resultCount,
+                               double             tolerancePercent)
+{
+    BaselineEntry entries[BENCH_MAX_RESULTS];
+    size_t        entryCount = readBaseline(pBaselineFilename, entries, ARRAYSIZE(entries));
+    unsigned int  regressionCount = 0;
+    size_t        i;
+
+    printf("\n%-22s %12s %12s %9s\n", "benchmark", "seconds", "baseline", "change");
+    for (i = 0 ; i < resultCount ; i++)
+    {
+        const BenchResult*   pResult = &pResults[i];
+        const BaselineEntry* pEntry = findBaselineEntry(entries, entryCount, pResult->pName);
+        double               changePercent;
+        int                  isRegression;
+
+        if (!pEntry || pEntry->seconds <= 0.0)
+        {
+            printf("%-22s %12.6f %12s\n", pResult->pName, pResult->seconds, "-");
+            continue;
+        }
+        changePercent = (pResult->seconds - pEntry->seconds) * 100.0 / pEntry->seconds;
+        isRegression = changePercent > tolerancePercent;
+        regressionCount += isRegression;
+        printf("%-22s %12.6f %12.6f %+8.1f%%%s\n",
+               pResult->pName, pResult->seconds, pEntry->seconds, changePercent, isRegression ? " REGRESSION" : "");
+    }
+    if (regressionCount > 0)
+    {
+        fprintf(stderr, "error: %u benchmark%s slower than %s by more than %.0f%%." LINE_ENDING,
+                regressionCount, regressionCount == 1 ? " is" : "s are", pBaselineFilename, tolerancePercent);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parseBaselineLine(ParseCSV* pParser, const SizedString* pLine, BaselineEntry* pEntry);
+static size_t readBaseline(const char* pBaselineFilename, BaselineEntry* pEntries, size_t maxEntries)
+{
+    SizedString baselineFilename = SizedString_InitFromString(pBaselineFilename);
+    TextFile*   pTextFile = NULL;
+    ParseCSV*   pParser = NULL;
+    size_t      entryCount = 0;
+
+    __try
+    {
+        pTextFile = TextFile_CreateFromFile(NULL, &baselineFilename, NULL);
+        pParser = ParseCSV_Create();
+        while (!TextFile_IsEndOfFile(pTextFile) && entryCount < maxEntries)
+        {
+            SizedString nextLine = TextFile_GetNextLine(pTextFile);
+
+            if (parseBaselineLine(pParser, &nextLine, &pEntries[entryCount]))
+                entryCount++;
+        }
+    }
+    __catch
+    {
+        if (getExceptionCode() == fileOpenException)
+            fprintf(stderr, "error: Failed to open %s baseline file." LINE_ENDING, pBaselineFilename);
+    }
+    ParseCSV_Free(pParser);
+    TextFile_Free(pTextFile);
+    if (getExceptionCode() != noException)
+        __rethrow;
+
+    return entryCount;
+}
+
+static int parseBaselineLine(ParseCSV* pParser, const SizedString* pLine, BaselineEntry* pEntry)
+{
+    /* The header line and anything else without a numeric seconds field is skipped. */
+    const SizedString* pFields;
+    char               secondsText[32];
+    char*              pEnd = NULL;
+
+    if (SizedString_strlen(pLine) == 0)
+        return 0;
+    ParseCSV_Parse(pParser, pLine);
+    pFields = ParseCSV_FieldPointers(pParser);
+    if (ParseCSV_FieldCount(pParser) < 2 ||
+        pFields[0].stringLength >= sizeof(pEntry->name) ||
+        pFields[1].stringLength == 0 ||
+        pFields[1].stringLength >= sizeof(secondsText))
+    {
+        return 0;
+    }
+
+    memcpy(secondsText, pFields[1].pString, pFields[1].stringLength);
+    secondsText[pFields[1].stringLength] = '\0';
+    pEntry->seconds = strtod(secondsText, &pEnd);
+    if (*pEnd != '\0')
+        return 0;
+    memcpy(pEntry->name, pFields[0].pString, pFields[0].stringLength);
+    pEntry->name[pFields[0].stringLength] = '\0';
+
+    return 1;
+}
+
+static const BaselineEntry* findBaselineEntry(const BaselineEntry* pEntries, size_t entryCount, const char* pName)
+{
+    size_t i;
+
+    for (i = 0 ; i < entryCount ; i++)
+    {
+        if (0 == strcmp(pEntries[i].name, pName))
+            return &pEntries[i];
+    }
+
+    return NULL;
+}
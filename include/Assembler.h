@@ -14,6 +14,8 @@
 #define _ASSEMBLER_H_
 
 #include "try_catch.h"
+#include "Vfs.h"
+#include "BinaryBuffer.h"
 
 
 typedef struct AssemblerInitParams
@@ -21,6 +23,12 @@ typedef struct AssemblerInitParams
     const char* pListFilename;
     const char* pPutDirectories;
     const char* pOutputDirectory;
+    const char* pBundleFilename;
+    Vfs*        pVfs;
+    int         streamListing;
+    /* When set, objects from SAV/USR directives are handed to this handler instead of being written to files. */
+    BinaryBufferObjectHandler objectHandler;
+    void*                     pObjectHandlerContext;
 } AssemblerInitParams;
 
 typedef struct Assembler Assembler;
@@ -33,6 +41,8 @@ __throws Assembler* Assembler_CreateFromFile(const char* pSourceFilename, const
          void       Assembler_Run(Assembler* pThis);
          unsigned int Assembler_GetErrorCount(Assembler* pThis);
          unsigned int Assembler_GetWarningCount(Assembler* pThis);
+         unsigned int Assembler_GetWrittenFileCount(Assembler* pThis);
+         unsigned int Assembler_GetSkippedFileCount(Assembler* pThis);
 
 
 #endif /* _ASSEMBLER_H_ */
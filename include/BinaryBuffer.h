@@ -15,6 +15,7 @@
 
 #include "try_catch.h"
 #include "SizedString.h"
+#include "Vfs.h"
 
 
 #define BINARY_BUFFER_SAV_SIGNATURE     "SAV\x1a"
@@ -40,8 +41,19 @@ typedef struct RW18SavFileHeader
 
 typedef struct BinaryBuffer BinaryBuffer;
 
+typedef struct BinaryBufferObject
+{
+    const char*          pFilename;
+    const void*          pHeader;
+    size_t               headerLength;
+    const unsigned char* pData;
+    size_t               dataLength;
+} BinaryBufferObject;
+
+typedef void (*BinaryBufferObjectHandler)(void* pContext, const BinaryBufferObject* pObject);
+
 
-__throws BinaryBuffer* BinaryBuffer_Create(size_t bufferSize);
+__throws BinaryBuffer* BinaryBuffer_Create(size_t segmentSize);
          void          BinaryBuffer_Free(BinaryBuffer* pThis);
          
 __throws unsigned char* BinaryBuffer_Alloc(BinaryBuffer* pThis, size_t bytesToAllocate);
@@ -61,6 +73,19 @@ __throws void           BinaryBuffer_QueueRW18WriteToFile(BinaryBuffer*  pThis,
                                                           unsigned short side,
                                                           unsigned short track,
                                                           unsigned short offset);
-__throws void           BinaryBuffer_ProcessWriteFileQueue(BinaryBuffer* pThis);
+__throws void           BinaryBuffer_ProcessWriteFileQueue(BinaryBuffer* pThis, Vfs* pVfs);
+__throws void           BinaryBuffer_StageWriteFileQueue(BinaryBuffer* pThis, Vfs* pVfs);
+__throws void           BinaryBuffer_CommitStagedFiles(BinaryBuffer* pThis);
+         void           BinaryBuffer_DiscardStagedFiles(BinaryBuffer* pThis);
+__throws void           BinaryBuffer_ProcessWriteFileQueueToBundle(BinaryBuffer* pThis, 
+                                                                   Vfs*          pVfs, 
+                                                                   const char*   pBundleFilename);
+__throws void           BinaryBuffer_ProcessWriteFileQueueToHandler(BinaryBuffer*             pThis, 
+                                                                    BinaryBufferObjectHandler handler, 
+                                                                    void*                     pContext);
+__throws int            BinaryBuffer_WriteObjectToFile(Vfs* pVfs, const BinaryBufferObject* pObject);
+         void           BinaryBuffer_ReleaseWrittenSegments(BinaryBuffer* pThis);
+         unsigned int   BinaryBuffer_GetWrittenFileCount(BinaryBuffer* pThis);
+         unsigned int   BinaryBuffer_GetSkippedFileCount(BinaryBuffer* pThis);
 
 #endif /* _BINARY_BUFFER_H_ */
@@ -13,8 +13,8 @@
 #ifndef _BYTE_BUFFER_H_
 #define _BYTE_BUFFER_H_
 
-#include <stdio.h>
 #include "try_catch.h"
+#include "Vfs.h"
 
 typedef struct ByteBuffer
 {
@@ -26,8 +26,8 @@ typedef struct ByteBuffer
 __throws void ByteBuffer_Allocate(ByteBuffer* pThis, unsigned int bufferSize);
          void ByteBuffer_Free(ByteBuffer* pThis);
 
-__throws void ByteBuffer_WriteToFile(ByteBuffer* pThis, FILE* pFile);
-__throws void ByteBuffer_ReadFromFile(ByteBuffer* pThis, FILE* pFile);
-__throws void ByteBuffer_ReadPartialFromFile(ByteBuffer* pThis, unsigned int bytesToRead, FILE* pFile);
+__throws void ByteBuffer_WriteToFile(ByteBuffer* pThis, Vfs* pVfs, VfsFile* pFile);
+__throws void ByteBuffer_ReadFromFile(ByteBuffer* pThis, Vfs* pVfs, VfsFile* pFile);
+__throws void ByteBuffer_ReadPartialFromFile(ByteBuffer* pThis, unsigned int bytesToRead, Vfs* pVfs, VfsFile* pFile);
 
 #endif /* _BYTE_BUFFER_H_ */
@@ -0,0 +1,57 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Builds each of the images listed in a crackle --batch file.  Every non-blank line of the batch file which doesn't
+   start with '#' has the form:
+       image_format,scriptFilename,outputImageFilename
+   The images are built concurrently on the ThreadPool and all read their objects from one shared cache.  An image
+   counts as failed if it threw or if any of its script lines reported an error. */
+#ifndef _CRACKLE_BATCH_H_
+#define _CRACKLE_BATCH_H_
+
+#include "try_catch.h"
+#include "CrackleCommandLine.h"
+#include "DiskImage.h"
+#include "Vfs.h"
+
+
+typedef struct CrackleBatchImage
+{
+    DiskImage*         pDiskImage;
+    char*              pScriptFilename;
+    char*              pOutputImageFilename;
+    CrackleImageFormat imageFormat;
+    int                exceptionCode;
+    unsigned int       scriptErrorCount;
+    double             buildSeconds;
+} CrackleBatchImage;
+
+
+typedef struct CrackleBatch
+{
+    Vfs*                  pVfs;
+    DiskImageObjectCache* pObjectCache;
+    CrackleBatchImage*    pImages;
+    size_t                imageCount;
+    size_t                failedCount;
+    double                elapsedSeconds;
+} CrackleBatch;
+
+
+__throws CrackleBatch* CrackleBatch_Create(Vfs* pVfs, const char* pBatchFilename);
+         void          CrackleBatch_Free(CrackleBatch* pThis);
+
+__throws void          CrackleBatch_OpenBundle(CrackleBatch* pThis, const char* pBundleFilename);
+         void          CrackleBatch_Run(CrackleBatch* pThis);
+         double        CrackleBatch_GetTotalBuildSeconds(CrackleBatch* pThis);
+
+#endif /* _CRACKLE_BATCH_H_ */
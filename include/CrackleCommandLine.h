@@ -24,11 +24,52 @@ typedef enum CrackleImageFormat
 } CrackleImageFormat;
 
 
+typedef enum CrackleStatsFormat
+{
+    STATS_NONE = 0,
+    STATS_TEXT,
+    STATS_JSON
+} CrackleStatsFormat;
+
+
+#define CRACKLE_COMMAND_LINE_MAX_IMAGES 4
+
+
+/* --format can be given more than once, with one outputImageFilename for each, to build several images from one run
+   of the script.  imageFormat and pOutputImageFilename are always the first of these pairs.  --sides instead builds a
+   nib_5.25 image for each of the listed RW18 sides, with one outputImageFilename for each side.  --extract decodes
+   pExtractFilename rather than building an image and the optional pExtractOutputFilename receives its contents.
+   --delta-from writes a delta against pDeltaFromFilename to pOutputImageFilename instead of the image itself and
+   --apply-delta patches pOutputImageFilename with pApplyDeltaFilename.  --stats sets statsFormat to report the build's
+   DiskImageStats, summed across the images when there is more than one.  --plan lays out the objects of the
+   pPlanFilename load sequence on RW18 tracks and writes the resulting script to pScriptFilename.  --tune-interleave
+   sets tuneInterleave and recommends an RWTS16 interleave for a loader which spends cyclesPerSector on each sector.
+   --simulate estimates how long it takes to read the pSimulateFilename read trace from the pOutputImageFilename
+   image. */
 typedef struct CrackleCommandLine
 {
     const char*        pScriptFilename;
     const char*        pOutputImageFilename;
+    const char*        pBundleFilename;
+    const char*        pManifestFilename;
+    const char*        pBatchFilename;
+    const char*        pExtractFilename;
+    const char*        pExtractOutputFilename;
+    const char*        pDeltaFromFilename;
+    const char*        pApplyDeltaFilename;
+    const char*        pPlanFilename;
+    const char*        pSimulateFilename;
+    const char*        apOutputImageFilenames[CRACKLE_COMMAND_LINE_MAX_IMAGES];
+    CrackleImageFormat imageFormats[CRACKLE_COMMAND_LINE_MAX_IMAGES];
+    unsigned int       sides[CRACKLE_COMMAND_LINE_MAX_IMAGES];
     CrackleImageFormat imageFormat;
+    CrackleStatsFormat statsFormat;
+    size_t             imageFormatCount;
+    size_t             outputImageCount;
+    size_t             sideCount;
+    unsigned int       cyclesPerSector;
+    int                updateImage;
+    int                tuneInterleave;
 } CrackleCommandLine;
 
 
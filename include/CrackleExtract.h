@@ -0,0 +1,49 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Decodes an existing image back into its logical contents for crackle --extract.  A .nib image is decoded into
+   DISK_IMAGE_RW18_BYTES_PER_TRACK bytes for each track, with RWTS16 sector n at page n of its track, and a status is
+   kept for each track.  The blocks of a .hdv image are already logical so they are just checked for use.
+   elapsedSeconds is the time taken by CrackleExtract_Decode() so that its speed can be compared to that of the disk
+   the image was read from. */
+#ifndef _CRACKLE_EXTRACT_H_
+#define _CRACKLE_EXTRACT_H_
+
+#include "try_catch.h"
+#include "CrackleCommandLine.h"
+#include "ByteBuffer.h"
+#include "NibbleDiskImage.h"
+#include "Vfs.h"
+
+
+typedef struct CrackleExtract
+{
+    ByteBuffer                 image;
+    unsigned char*             pLogicalData;
+    const char*                pImageFilename;
+    size_t                     logicalSize;
+    CrackleImageFormat         imageFormat;
+    unsigned int               badTrackCount;
+    unsigned int               usedBlockCount;
+    double                     elapsedSeconds;
+    NibbleDiskImageTrackStatus trackStatus[DISK_IMAGE_TRACKS_PER_SIDE];
+} CrackleExtract;
+
+
+__throws CrackleExtract* CrackleExtract_Create(Vfs* pVfs, const char* pImageFilename);
+         void            CrackleExtract_Free(CrackleExtract* pThis);
+
+         void            CrackleExtract_Decode(CrackleExtract* pThis);
+         void            CrackleExtract_ReportStatus(CrackleExtract* pThis);
+__throws void            CrackleExtract_WriteLogicalData(CrackleExtract* pThis, Vfs* pVfs, const char* pFilename);
+
+#endif /* _CRACKLE_EXTRACT_H_ */
@@ -0,0 +1,86 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Lays out the objects of a game's load sequence on RW18 tracks for crackle --plan.  Every non-blank line of the load
+   sequence file which doesn't start with '#' has one of these forms:
+       SIDES,side[,side]...
+       TRACKS,firstTrack,lastTrack
+       LOAD,objectFilename[,objectFilename]...
+   Each LOAD line is one step of the sequence and the objects on it are co-loaded, so the planner is free to order
+   them and the loader reads them in disk order.  Objects are placed page aligned in the order they are first loaded,
+   sweeping forward from firstTrack of the first side, and only move on to the next side when the current one is
+   full.  Within a step the remainder of a partially filled track is topped up with the largest object which fits and
+   the rest of the step then carries on across the track boundary, unless skipping the remainder would keep the step
+   from touching that track at all without making it end on a later track.  The estimate replays the sequence with the head starting at track 0, where the boot loader is read,
+   counting one step for each track moved to reach an object and each track crossed while reading it. */
+#ifndef _CRACKLE_PLAN_H_
+#define _CRACKLE_PLAN_H_
+
+#include "try_catch.h"
+#include "DiskImage.h"
+#include "Vfs.h"
+
+
+#define CRACKLE_PLAN_MAX_SIDES 3
+
+
+typedef struct CracklePlanObject
+{
+    char*        pFilename;
+    unsigned int length;
+    unsigned int lineNumber;
+    unsigned int sideIndex;
+    unsigned int track;
+    unsigned int intraTrackOffset;
+    int          isPlaced;
+} CracklePlanObject;
+
+
+typedef struct CracklePlanLoad
+{
+    size_t       firstObjectIndex;
+    size_t       objectIndexCount;
+    unsigned int lineNumber;
+} CracklePlanLoad;
+
+
+typedef struct CracklePlan
+{
+    Vfs*               pVfs;
+    DiskImage*         pDiskImage;
+    const char*        pSequenceFilename;
+    CracklePlanObject* pObjects;
+    size_t*            pObjectIndices;
+    CracklePlanLoad*   pLoads;
+    size_t             objectCount;
+    size_t             objectIndexCount;
+    size_t             loadCount;
+    unsigned int       sides[CRACKLE_PLAN_MAX_SIDES];
+    size_t             sideCount;
+    unsigned int       firstTrack;
+    unsigned int       lastTrack;
+    unsigned int       tracksUsed;
+    unsigned int       partialTrackCount;
+    unsigned int       trackSteps;
+    unsigned int       sideChanges;
+} CracklePlan;
+
+
+__throws CracklePlan* CracklePlan_Create(Vfs* pVfs, const char* pSequenceFilename);
+         void         CracklePlan_Free(CracklePlan* pThis);
+
+__throws void         CracklePlan_OpenBundle(CracklePlan* pThis, const char* pBundleFilename);
+__throws void         CracklePlan_Run(CracklePlan* pThis);
+__throws void         CracklePlan_WriteScript(CracklePlan* pThis, const char* pScriptFilename);
+         void         CracklePlan_ReportSeeks(CracklePlan* pThis);
+
+#endif /* _CRACKLE_PLAN_H_ */
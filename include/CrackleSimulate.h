@@ -0,0 +1,91 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Estimates how long the Disk II takes to load a game from a .nib image for crackle --simulate, so that a change of
+   disk layout can be checked against a load time budget.  Every non-blank line of the read trace which doesn't start
+   with '#' has one of these forms:
+       RWTS16,track,sector|*
+       RW18,side,track,page|*
+       STEP,microseconds
+       SETTLE,microseconds
+       ROTATION,microseconds
+       PROCESS,microseconds
+       BUDGET,microseconds
+   RWTS16 sectors are physical sector numbers and an RW18 page is read along with the other two pages of its sector.
+   The sectors of a * line are read in whichever order they pass under the head.  STEP is the time taken to move the
+   head one quarter track, SETTLE is the time it then waits before reading, ROTATION is the time for one revolution of
+   the disk, and BUDGET is the load time which CrackleSimulate_IsOverBudget() checks against.  These apply to the whole
+   trace, with the last line of each type winning.  PROCESS is the time the loader spends on each sector after reading
+   it, during which the disk keeps turning, and applies to the reads which follow it.
+
+   The head starts on track 0 with the start of each track under it.  Each nibble takes ROTATION / 6656 to pass under
+   the head, so the gaps of sync bytes which NibbleDiskImage writes between sectors are timed along with the sectors
+   themselves.  Reading a sector starts at its address field prolog and ends after its data field epilog. */
+#ifndef _CRACKLE_SIMULATE_H_
+#define _CRACKLE_SIMULATE_H_
+
+#include "try_catch.h"
+#include "CrackleExtract.h"
+#include "Vfs.h"
+
+
+#define CRACKLE_SIMULATE_DEFAULT_STEP_US     1500
+#define CRACKLE_SIMULATE_DEFAULT_SETTLE_US   10000
+#define CRACKLE_SIMULATE_DEFAULT_ROTATION_US 200000
+
+
+typedef struct CrackleSimulateRead
+{
+    unsigned int track;
+    unsigned int sectorMask;
+    unsigned int processUs;
+} CrackleSimulateRead;
+
+
+/* Where the simulated time went, in nanoseconds. */
+typedef struct CrackleSimulateTimes
+{
+    unsigned long long stepNs;
+    unsigned long long settleNs;
+    unsigned long long waitNs;
+    unsigned long long readNs;
+    unsigned long long processNs;
+} CrackleSimulateTimes;
+
+
+typedef struct CrackleSimulate
+{
+    Vfs*                 pVfs;
+    CrackleExtract*      pExtract;
+    const char*          pTraceFilename;
+    CrackleSimulateRead* pReads;
+    size_t               readCount;
+    unsigned int         stepUs;
+    unsigned int         settleUs;
+    unsigned int         rotationUs;
+    unsigned int         budgetUs;
+    unsigned int         quarterTrackSteps;
+    unsigned int         sectorsRead;
+    CrackleSimulateTimes totalTimes;
+    CrackleSimulateTimes trackTimes[DISK_IMAGE_TRACKS_PER_SIDE];
+} CrackleSimulate;
+
+
+__throws CrackleSimulate*   CrackleSimulate_Create(Vfs* pVfs, const char* pTraceFilename, const char* pImageFilename);
+         void               CrackleSimulate_Free(CrackleSimulate* pThis);
+
+         void               CrackleSimulate_Run(CrackleSimulate* pThis);
+         unsigned long long CrackleSimulate_GetTotalNs(const CrackleSimulateTimes* pTimes);
+         int                CrackleSimulate_IsOverBudget(CrackleSimulate* pThis);
+         void               CrackleSimulate_ReportTimes(CrackleSimulate* pThis);
+
+#endif /* _CRACKLE_SIMULATE_H_ */
@@ -14,6 +14,8 @@
 #define _DISK_IMAGE_H_
 
 #include "try_catch.h"
+#include "Vfs.h"
+#include "DiskImageStats.h"
 
 
 #define DISK_IMAGE_BYTES_PER_SECTOR       256
@@ -27,9 +29,11 @@
 #define DISK_IMAGE_RW18_SIDE_2            0x79
 #define DISK_IMAGE_RW18_PAGES_PER_TRACK   18
 #define DISK_IMAGE_RW18_BYTES_PER_TRACK   (DISK_IMAGE_RW18_PAGES_PER_TRACK * DISK_IMAGE_PAGE_SIZE)
+#define DISK_IMAGE_BUNDLE_PREFIX          "bundle:"
 
 
-typedef struct DiskImage DiskImage;
+typedef struct DiskImage            DiskImage;
+typedef struct DiskImageObjectCache DiskImageObjectCache;
 
 
 typedef enum DiskImageInsertionType
@@ -67,17 +71,41 @@ typedef struct DiskImageInsert
 
 
          void      DiskImage_Free(DiskImage* pThis);
+         void      DiskImage_SetVfs(DiskImage* pThis, Vfs* pVfs);
+__throws void      DiskImage_OpenBundle(DiskImage* pThis, const char* pBundleFilename);
 
 __throws void      DiskImage_ProcessScriptFile(DiskImage* pThis, const char*  pScriptFilename);
 __throws void      DiskImage_ProcessScript(DiskImage* pThis, char* pScriptText);
+__throws void      DiskImage_ProcessScriptFileForImages(DiskImage** ppImages, size_t imageCount, const char* pScriptFilename);
+__throws void      DiskImage_ProcessScriptFileForSides(DiskImage**         ppImages,
+                                                       const unsigned int* pSides,
+                                                       size_t              imageCount,
+                                                       const char*         pScriptFilename);
+
+__throws void      DiskImage_PrefetchScriptObjects(DiskImage* pThis, const char* pScriptFilename);
+__throws DiskImageObjectCache* DiskImage_DetachObjectCache(DiskImage* pThis);
+         void      DiskImage_ShareObjectCache(DiskImage* pThis, const DiskImageObjectCache* pObjectCache);
+         void      DiskImageObjectCache_Free(DiskImageObjectCache* pThis);
 
 __throws void      DiskImage_ReadObjectFile(DiskImage* pThis, const char* pFilename);
 __throws void      DiskImage_UpdateImageTableFile(DiskImage* pThis, unsigned short newImageTableAddress);
 __throws void      DiskImage_InsertObjectFile(DiskImage* pThis, DiskImageInsert* pInsert);
+__throws void      DiskImage_InsertData(DiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
 
+__throws void      DiskImage_MapOutputImage(DiskImage* pThis, const char* pImageFilename);
 __throws void      DiskImage_WriteImage(DiskImage* pThis, const char* pImageFilename);
 
+__throws void      DiskImage_ReadImageForUpdate(DiskImage* pThis, const char* pImageFilename);
+__throws void      DiskImage_UpdateImage(DiskImage* pThis, const char* pImageFilename);
+__throws void      DiskImage_WriteDelta(DiskImage* pThis, const char* pBaseImageFilename, const char* pDeltaFilename);
+__throws void      DiskImage_ReadManifest(DiskImage* pThis, const char* pManifestFilename);
+__throws void      DiskImage_WriteManifest(DiskImage* pThis, const char* pManifestFilename);
+
+         unsigned int   DiskImage_GetScriptErrorCount(DiskImage* pThis);
+         const DiskImageStats* DiskImage_GetStats(DiskImage* pThis);
+         unsigned int   DiskImage_GetObjectFileLength(DiskImage* pThis);
          unsigned char* DiskImage_GetImagePointer(DiskImage* pThis);
          size_t         DiskImage_GetImageSize(DiskImage* pThis);
+         const char*    DiskImage_GetMappedTempFilename(DiskImage* pThis);
 
 #endif /* _DISK_IMAGE_H_ */
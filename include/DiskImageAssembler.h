@@ -0,0 +1,40 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Assembles source files straight into a disk image.  Output from USR directives is inserted into the image at the
+   side, track and offset given by the directive without being written to an intermediate file while SAV output,
+   which has no location in the image, is still written out to its object file.  Nothing is inserted or written
+   unless the whole source assembles without errors. */
+#ifndef _DISK_IMAGE_ASSEMBLER_H_
+#define _DISK_IMAGE_ASSEMBLER_H_
+
+#include "try_catch.h"
+#include "Assembler.h"
+#include "DiskImage.h"
+
+
+typedef struct DiskImageAssemblerResults
+{
+    unsigned int errorCount;
+    unsigned int warningCount;
+    unsigned int insertedObjectCount;
+    unsigned int savedObjectCount;
+    unsigned int skippedObjectCount;
+} DiskImageAssemblerResults;
+
+
+__throws void DiskImageAssembler_AssembleFile(DiskImage*                 pDiskImage, 
+                                              const char*                pSourceFilename, 
+                                              const AssemblerInitParams* pParams,
+                                              DiskImageAssemblerResults* pResults);
+
+#endif /* _DISK_IMAGE_ASSEMBLER_H_ */
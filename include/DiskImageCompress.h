@@ -0,0 +1,41 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* LZ compression for script lines with the compress flag.  The compressed stream is a series of tokens which the
+   6502 decompressor in asm/unlz.S expands straight into place:
+       $00             End of the stream.
+       $01 - $7f       That many literal bytes follow the token.
+       $80 - $ff       Copy (token & $7f) + 3 bytes from the output, starting the little endian 16-bit distance which
+                       follows the token back from the current output position.  The copy can overlap its own output.
+   The format is byte aligned and has no header so that the decompressor is small and fast. */
+#ifndef _DISK_IMAGE_COMPRESS_H_
+#define _DISK_IMAGE_COMPRESS_H_
+
+#include "try_catch.h"
+#include "ByteBuffer.h"
+
+
+#define DISK_IMAGE_COMPRESS_MAX_LITERALS 0x7f
+#define DISK_IMAGE_COMPRESS_MIN_MATCH    3
+#define DISK_IMAGE_COMPRESS_MAX_MATCH    (0x7f + DISK_IMAGE_COMPRESS_MIN_MATCH)
+#define DISK_IMAGE_COMPRESS_MAX_DISTANCE 0xffff
+
+
+         unsigned int DiskImageCompress_GetMaxCompressedSize(unsigned int inputSize);
+__throws unsigned int DiskImageCompress_Compress(ByteBuffer*          pOutput, 
+                                                 const unsigned char* pInput, 
+                                                 unsigned int         inputSize);
+__throws unsigned int DiskImageCompress_Decompress(ByteBuffer*          pOutput, 
+                                                   const unsigned char* pInput, 
+                                                   unsigned int         inputSize);
+
+#endif /* _DISK_IMAGE_COMPRESS_H_ */
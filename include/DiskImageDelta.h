@@ -0,0 +1,69 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Binary patch which turns one build of an image into the next so that only the bytes which changed have to be moved
+   around.  A delta file starts with a DiskImageDeltaHeader and is followed by runCount DiskImageDeltaRun records,
+   each immediately followed by the length bytes of new data for that run.  A run never crosses from one region
+   (track of a nibble image or block of a block image) into the next.  baseHash and imageHash are the
+   DiskImageManifest_Hash() of the whole image before and after the delta is applied so that it can't be applied to
+   the wrong image. */
+#ifndef _DISK_IMAGE_DELTA_H_
+#define _DISK_IMAGE_DELTA_H_
+
+#include "try_catch.h"
+#include "Vfs.h"
+
+
+#define DISK_IMAGE_DELTA_SIGNATURE "SND\x1a"
+
+
+typedef struct DiskImageDeltaHeader
+{
+    char               signature[4];
+    unsigned int       imageSize;
+    unsigned int       regionSize;
+    unsigned int       runCount;
+    unsigned long long baseHash;
+    unsigned long long imageHash;
+} DiskImageDeltaHeader;
+
+typedef struct DiskImageDeltaRun
+{
+    unsigned int   region;
+    unsigned short offset;
+    unsigned short length;
+} DiskImageDeltaRun;
+
+
+/* pRuns holds the run records and their data exactly as they are laid out in the delta file. */
+typedef struct DiskImageDelta
+{
+    DiskImageDeltaHeader header;
+    unsigned char*       pRuns;
+    size_t               runsSize;
+    size_t               allocatedSize;
+    size_t               changedByteCount;
+} DiskImageDelta;
+
+
+         void DiskImageDelta_Free(DiskImageDelta* pThis);
+__throws void DiskImageDelta_Compute(DiskImageDelta*      pThis,
+                                     const unsigned char* pBaseImage,
+                                     const unsigned char* pImage,
+                                     unsigned int         imageSize,
+                                     unsigned int         regionSize);
+__throws void DiskImageDelta_Read(DiskImageDelta* pThis, Vfs* pVfs, const char* pFilename);
+__throws void DiskImageDelta_Write(DiskImageDelta* pThis, Vfs* pVfs, const char* pFilename);
+__throws void DiskImageDelta_Apply(DiskImageDelta* pThis, unsigned char* pImage, unsigned int imageSize);
+__throws void DiskImageDelta_ApplyToImageFile(DiskImageDelta* pThis, Vfs* pVfs, const char* pImageFilename);
+
+#endif /* _DISK_IMAGE_DELTA_H_ */
@@ -0,0 +1,74 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Maps the logical RWTS16 sectors named in a script onto the physical sectors written to the track.  Physical sector n
+   is always the nth sector around the track and carries n in its address field, so an interleave only changes which
+   data ends up in each physical sector.  An interleave is given as one of:
+       identity - logical sector n is physical sector n (the default).
+       dos3.3   - the order used by DOS 3.3's RWTS.
+       prodos   - the order used by ProDOS.
+       skew:n   - each logical sector is placed n physical sectors after the one before it, moving on to the next
+                  free physical sector whenever that one is already taken.  skew:1 is identity and skew:2 is prodos.
+       16 hex digits - the physical sector for each logical sector in turn, such as 0db97531eca8642f.
+
+   The tuner simulates a loader which reads the logical sectors of a track in order and then spends cyclesPerSector
+   6502 cycles on each before looking for the next one.  A nibble passes under the head every 32 cycles.  The
+   simulation starts as the first logical sector's address field arrives, so every skew sees the same initial
+   rotational latency, and sums the cycles spent waiting for each of the following sectors to come around. */
+#ifndef _DISK_IMAGE_INTERLEAVE_H_
+#define _DISK_IMAGE_INTERLEAVE_H_
+
+#include "try_catch.h"
+#include "SizedString.h"
+
+
+#define DISK_IMAGE_INTERLEAVE_SECTORS           16
+#define DISK_IMAGE_INTERLEAVE_CYCLES_PER_NIBBLE 32
+#define DISK_IMAGE_INTERLEAVE_SKEW_COUNT        (DISK_IMAGE_INTERLEAVE_SECTORS - 1)
+#define DISK_IMAGE_INTERLEAVE_FORMAT_SIZE       (DISK_IMAGE_INTERLEAVE_SECTORS + 1)
+
+
+typedef struct DiskImageInterleave
+{
+    unsigned char physicalSectors[DISK_IMAGE_INTERLEAVE_SECTORS];
+} DiskImageInterleave;
+
+
+typedef struct DiskImageInterleaveTiming
+{
+    unsigned int skew;
+    unsigned int trackCycles;
+    unsigned int waitCycles;
+} DiskImageInterleaveTiming;
+
+
+/* timings[i] is for skew i + 1 and bestIndex is the one with the fewest trackCycles. */
+typedef struct DiskImageInterleaveTuning
+{
+    DiskImageInterleaveTiming        timings[DISK_IMAGE_INTERLEAVE_SKEW_COUNT];
+    unsigned int                     bestIndex;
+    unsigned int                     cyclesPerSector;
+} DiskImageInterleaveTuning;
+
+
+         void DiskImageInterleave_InitIdentity(DiskImageInterleave* pThis);
+__throws void DiskImageInterleave_InitSkew(DiskImageInterleave* pThis, unsigned int skew);
+__throws void DiskImageInterleave_Parse(DiskImageInterleave* pThis, const SizedString* pSpec);
+         int  DiskImageInterleave_IsIdentity(const DiskImageInterleave* pThis);
+         void DiskImageInterleave_Format(const DiskImageInterleave* pThis, char* pBuffer);
+
+         DiskImageInterleaveTiming DiskImageInterleave_Simulate(const DiskImageInterleave* pThis, 
+                                                                unsigned int               cyclesPerSector);
+         DiskImageInterleaveTuning DiskImageInterleave_Tune(unsigned int cyclesPerSector);
+         void DiskImageInterleave_PrintTuning(const DiskImageInterleaveTuning* pTuning);
+
+#endif /* _DISK_IMAGE_INTERLEAVE_H_ */
@@ -0,0 +1,52 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Record of every object insertion made by a script, along with a hash of the data each one inserted and of the image
+   it produced.  crackle --manifest keeps one next to the output image so that a later --update run can tell which
+   tracks/blocks could have changed and only re-run the script lines which touch them. */
+#ifndef _DISK_IMAGE_MANIFEST_H_
+#define _DISK_IMAGE_MANIFEST_H_
+
+#include "DiskImage.h"
+#include "Vfs.h"
+
+
+typedef struct DiskImageManifestEntry
+{
+    DiskImageInsert    insert;
+    unsigned long long dataHash;
+} DiskImageManifestEntry;
+
+
+typedef struct DiskImageManifest
+{
+    DiskImageManifestEntry* pEntries;
+    size_t                  entryCount;
+    size_t                  allocatedCount;
+    unsigned long long      imageHash;
+} DiskImageManifest;
+
+
+#define DISK_IMAGE_MANIFEST_HASH_SEED 0xcbf29ce484222325ULL
+
+
+         void               DiskImageManifest_Free(DiskImageManifest* pThis);
+__throws void               DiskImageManifest_AddEntry(DiskImageManifest*     pThis,
+                                                       const DiskImageInsert* pInsert,
+                                                       const unsigned char*   pObjectData);
+__throws void               DiskImageManifest_Read(DiskImageManifest* pThis, Vfs* pVfs, const char* pFilename);
+__throws void               DiskImageManifest_Write(DiskImageManifest* pThis, Vfs* pVfs, const char* pFilename);
+
+         unsigned long long DiskImageManifest_Hash(unsigned long long hash, const void* pData, size_t dataSize);
+         unsigned long long DiskImageManifest_HashEntry(unsigned long long hash, const DiskImageManifestEntry* pEntry);
+
+#endif /* _DISK_IMAGE_MANIFEST_H_ */
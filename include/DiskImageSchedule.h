@@ -0,0 +1,55 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Works out which of a script's insertions can be made concurrently.  Each insertion is described by two half open
+   intervals: the image regions (tracks or blocks) which it touches and the bytes which it writes.  Insertions whose
+   region intervals overlap, directly or through a chain of other insertions, are placed in the same group and keep
+   their script order within it so that later lines still overwrite earlier ones.  Different groups touch disjoint
+   regions so they can be made in any order.
+   
+   The byte intervals are indexed by an interval tree to find, for each insertion, the latest earlier insertion whose
+   bytes it overwrites.  pOverwrites[i] is that insertion's index or DISK_IMAGE_SCHEDULE_NO_OVERWRITE. */
+#ifndef _DISK_IMAGE_SCHEDULE_H_
+#define _DISK_IMAGE_SCHEDULE_H_
+
+#include <stddef.h>
+#include "try_catch.h"
+
+
+#define DISK_IMAGE_SCHEDULE_NO_OVERWRITE ((size_t)~0)
+
+
+typedef struct DiskImageInterval
+{
+    unsigned long long start;
+    unsigned long long end;
+} DiskImageInterval;
+
+
+/* The insertion indices of group g are pOrder[pGroupStarts[g]] up to, but not including, pOrder[pGroupStarts[g + 1]]. */
+typedef struct DiskImageSchedule
+{
+    size_t* pOrder;
+    size_t* pGroupStarts;
+    size_t* pOverwrites;
+    size_t  insertionCount;
+    size_t  groupCount;
+} DiskImageSchedule;
+
+
+__throws void DiskImageSchedule_Build(DiskImageSchedule*       pThis,
+                                      const DiskImageInterval* pRegions,
+                                      const DiskImageInterval* pSpans,
+                                      size_t                   insertionCount);
+         void DiskImageSchedule_Free(DiskImageSchedule* pThis);
+
+#endif /* _DISK_IMAGE_SCHEDULE_H_ */
@@ -0,0 +1,51 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Counters and timers gathered while an image is built so that crackle --stats can show where a slow build spends
+   its time.  Object reads are only counted when a file (or bundle item) is actually loaded, so objectReferences beyond
+   objectFilesRead were satisfied from the object cache.  rw18TrackMerges counts the RW18 tracks which had to be
+   decoded from the image before a partial insert could be merged into them.  The parse time excludes the object I/O
+   and encode time spent while the script was being run.  The track read counts for compressed inserts are estimates
+   of how many tracks the loader has to read for the data before and after compression. */
+#ifndef _DISK_IMAGE_STATS_H_
+#define _DISK_IMAGE_STATS_H_
+
+
+typedef struct DiskImageStats
+{
+    unsigned long long objectBytesRead;
+    unsigned long long imageBytesWritten;
+    unsigned long long compressedInputBytes;
+    unsigned long long compressedOutputBytes;
+    unsigned int       scriptLineCount;
+    unsigned int       objectFilesRead;
+    unsigned int       objectReferences;
+    unsigned int       rw18TrackMerges;
+    unsigned int       rwts16SectorsEncoded;
+    unsigned int       rw18TracksEncoded;
+    unsigned int       compressedInserts;
+    unsigned int       uncompressedTrackReads;
+    unsigned int       compressedTrackReads;
+    double             parseSeconds;
+    double             objectReadSeconds;
+    double             encodeSeconds;
+    double             writeSeconds;
+} DiskImageStats;
+
+
+double DiskImageStats_GetSeconds(void);
+void   DiskImageStats_Add(DiskImageStats* pTotal, const DiskImageStats* pStats);
+void   DiskImageStats_PrintText(const DiskImageStats* pThis);
+void   DiskImageStats_PrintJson(const DiskImageStats* pThis);
+void   DiskImageStats_PrintCompression(const DiskImageStats* pThis);
+
+#endif /* _DISK_IMAGE_STATS_H_ */
@@ -15,6 +15,8 @@
 #define _FILE_FAILURE_INJECT_H_
 
 #include <stdio.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 /* Pointer to file I/O routines which can intercepted by this module. */
 extern FILE*  (*hook_fopen)(const char* filename, const char* mode);
@@ -22,6 +24,10 @@ extern int    (*hook_fseek)(FILE* stream, long offset, int whence);
 extern long   (*hook_ftell)(FILE* stream);
 extern size_t (*hook_fwrite)(const void* ptr, size_t size, size_t nitems, FILE* stream);
 extern size_t (*hook_fread)(void* ptr, size_t size, size_t nitems, FILE* stream);
+extern ssize_t (*hook_read)(int fildes, void* buf, size_t nbyte);
+extern off_t  (*hook_lseek)(int fildes, off_t offset, int whence);
+extern ssize_t (*hook_writev)(int fildes, const struct iovec* iov, int iovcnt);
+extern int    (*hook_rename)(const char* oldPath, const char* newPath);
 
 void fopenFail(FILE* pFailureReturn);
 void fopenRestore(void);
@@ -40,6 +46,20 @@ void freadFail(size_t failureReturn);
 void freadToFail(int readToFail);
 void freadRestore(void);
 
+void readFail(ssize_t failureReturn);
+void readToFail(int readToFail);
+void readRestore(void);
+
+void lseekSetFailureCode(off_t failureReturn);
+void lseekSetCallsBeforeFailure(int callCountToAllowBeforeFailing);
+void lseekRestore(void);
+
+void writevFail(ssize_t failureReturn);
+void writevRestore(void);
+
+void renameFail(int failureReturn);
+void renameRestore(void);
+
 
 #ifdef CODE_UNDER_TEST
 
@@ -49,6 +69,10 @@ void freadRestore(void);
 #define ftell  hook_ftell
 #define fwrite hook_fwrite
 #define fread  hook_fread
+#define read   hook_read
+#define lseek  hook_lseek
+#define writev hook_writev
+#define rename hook_rename
 
 #endif /* CODE_UNDER_TEST */
 
@@ -47,6 +47,7 @@ struct LineInfo
     int                     indentation;
     unsigned int            lineNumber;
     unsigned int            flags;
+    unsigned int            forwardReferenceCount;
     unsigned short          address;
     unsigned short          equValue;
 };
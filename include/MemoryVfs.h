@@ -0,0 +1,29 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Vfs backend which keeps all files in RAM so that whole projects can be assembled and imaged without touching the
+   host's file system.  Filenames are matched without regard to case, just like FileOpen(). */
+#ifndef _MEMORY_VFS_H_
+#define _MEMORY_VFS_H_
+
+#include "Vfs.h"
+
+
+typedef struct MemoryVfs MemoryVfs;
+
+
+__throws MemoryVfs*  MemoryVfs_Create(void);
+__throws void        MemoryVfs_AddFile(MemoryVfs* pThis, const char* pFilename, const void* pData, size_t dataSize);
+         const void* MemoryVfs_GetFileData(MemoryVfs* pThis, const char* pFilename, size_t* pDataSize);
+         size_t      MemoryVfs_GetFileCount(MemoryVfs* pThis);
+
+#endif /* _MEMORY_VFS_H_ */
@@ -28,6 +28,32 @@
 typedef struct NibbleDiskImage NibbleDiskImage;
 
 
+typedef enum NibbleDiskImageTrackFormat
+{
+    NIBBLE_TRACK_EMPTY,
+    NIBBLE_TRACK_RWTS16,
+    NIBBLE_TRACK_RW18,
+    NIBBLE_TRACK_UNKNOWN
+} NibbleDiskImageTrackFormat;
+
+
+/* Result of decoding one track with NibbleDiskImage_DecodeTrack().  Each sector found sets its bit in either
+   goodSectors or badSectors, using the sector number from its address field.  Address fields which couldn't be decoded
+   at all, or which belong to the other format, are only counted.  side is the RW18 bundle id of the track.  For each
+   good sector, sectorStarts[] is the nibble offset within the track of its address field prolog and sectorEnds[] is
+   the offset just past its data field epilog. */
+typedef struct NibbleDiskImageTrackStatus
+{
+    NibbleDiskImageTrackFormat format;
+    unsigned int               side;
+    unsigned int               goodSectors;
+    unsigned int               badSectors;
+    unsigned int               badAddressFieldCount;
+    unsigned short             sectorStarts[NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK];
+    unsigned short             sectorEnds[NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK];
+} NibbleDiskImageTrackStatus;
+
+
 __throws NibbleDiskImage* NibbleDiskImage_Create(void);
 
 __throws void             NibbleDiskImage_ProcessScriptFile(NibbleDiskImage* pThis, const char* pScriptFilename);
@@ -48,5 +74,9 @@ __throws void             NibbleDiskImage_ReadRW18Track(NibbleDiskImage* pThis,
                                                         unsigned int side,
                                                         unsigned char* pTrackData,
                                                         size_t trackDataSize);
+         void             NibbleDiskImage_DecodeTrack(const unsigned char*        pTrackNibbles,
+                                                      unsigned int                track,
+                                                      unsigned char*              pTrackData,
+                                                      NibbleDiskImageTrackStatus* pStatus);
 
 #endif /* _NIBBLE_DISK_IMAGE_H_ */
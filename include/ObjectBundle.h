@@ -0,0 +1,61 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Object bundles hold every object file saved by one snap run in a single file so that crackle can map it once
+   instead of opening each object file separately.  A bundle starts with an ObjectBundleHeader followed by entryCount
+   ObjectBundleEntry index records and then the payloads.  Each payload is the complete object file, including its
+   SAV or USR header, and is followed by zero padding which rounds its data up to a whole disk block so that it can be
+   inserted in place without a copy. */
+#ifndef _OBJECT_BUNDLE_H_
+#define _OBJECT_BUNDLE_H_
+
+#include "try_catch.h"
+#include "Vfs.h"
+
+
+#define OBJECT_BUNDLE_SIGNATURE     "SNB\x1a"
+#define OBJECT_BUNDLE_NAME_LENGTH   64
+#define OBJECT_BUNDLE_PADDING_SIZE  512
+
+
+typedef struct ObjectBundleHeader
+{
+    char         signature[4];
+    unsigned int entryCount;
+} ObjectBundleHeader;
+
+typedef struct ObjectBundleEntry
+{
+    char         name[OBJECT_BUNDLE_NAME_LENGTH];
+    unsigned int offset;
+    unsigned int length;
+    unsigned int paddedLength;
+} ObjectBundleEntry;
+
+typedef struct ObjectBundleItem
+{
+    const unsigned char* pData;
+    unsigned int         length;
+    unsigned int         paddedLength;
+} ObjectBundleItem;
+
+
+typedef struct ObjectBundle ObjectBundle;
+
+
+__throws ObjectBundle* ObjectBundle_Open(Vfs* pVfs, const char* pFilename);
+         void          ObjectBundle_Free(ObjectBundle* pThis);
+
+         int           ObjectBundle_Find(ObjectBundle* pThis, const char* pName, ObjectBundleItem* pItem);
+         unsigned int  ObjectBundle_GetEntryCount(ObjectBundle* pThis);
+
+#endif /* _OBJECT_BUNDLE_H_ */
@@ -0,0 +1,34 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#ifndef _SNAPNCRACKLE_COMMANDLINE_H_
+#define _SNAPNCRACKLE_COMMANDLINE_H_
+
+#include "try_catch.h"
+#include "Assembler.h"
+#include "CrackleCommandLine.h"
+
+
+typedef struct SnapNCrackleCommandLine
+{
+    const char**        ppSourceFilenames;
+    size_t              sourceFileCount;
+    const char*         pScriptFilename;
+    const char*         pOutputImageFilename;
+    CrackleImageFormat  imageFormat;
+    AssemblerInitParams assemblerInitParams;
+} SnapNCrackleCommandLine;
+
+
+__throws void SnapNCrackleCommandLine_Init(SnapNCrackleCommandLine* pThis, int argc, const char** argv);
+
+#endif /* _SNAPNCRACKLE_COMMANDLINE_H_ */
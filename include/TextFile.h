@@ -15,6 +15,7 @@
 
 #include "try_catch.h"
 #include "SizedString.h"
+#include "Vfs.h"
 
 typedef struct TextFile TextFile;
 
@@ -23,6 +24,10 @@ __throws TextFile*    TextFile_CreateFromString(const char* pText);
 __throws TextFile*    TextFile_CreateFromFile(const SizedString* pDirectoryName, 
                                               const SizedString* pFilename, 
                                               const char*        pFilenameSuffix);
+__throws TextFile*    TextFile_CreateFromVfs(Vfs*               pVfs,
+                                             const SizedString* pDirectoryName, 
+                                             const SizedString* pFilename, 
+                                             const char*        pFilenameSuffix);
 __throws TextFile*    TextFile_CreateFromTextFile(const TextFile* pTextFile);
          void         TextFile_Free(TextFile* pThis);
          void         TextFile_Reset(TextFile* pThis);
@@ -0,0 +1,36 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Runs independent work items across a set of worker threads. */
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <stddef.h>
+
+#define THREAD_POOL_MAX_THREADS 64
+
+/* Called once for each work item index.  Callbacks run concurrently so they must only touch state owned by their
+   item, must catch any exceptions they throw, and shouldn't allocate memory or log output.  The last rule is only
+   there because the malloc and printf test spies aren't thread safe, so a callback which must allocate or log can
+   still be used as long as its tests set a thread count of 1. */
+typedef void (*ThreadPoolCallback)(void* pContext, size_t itemIndex);
+
+/* Worker threads are started the first time a run needs them and then wait for later runs, so a run doesn't pay to
+   create and join threads.  A ThreadPool_Run() made from a callback of a run which used extra threads runs its items
+   one after the other on the calling thread rather than waking workers of its own.  Other than that, runs must only
+   be started from one thread at a time. */
+
+void   ThreadPool_SetThreadCount(size_t threadCount);
+size_t ThreadPool_GetThreadCount(void);
+void   ThreadPool_Run(size_t itemCount, ThreadPoolCallback pCallback, void* pContext);
+
+#endif /* _THREAD_POOL_H_ */
@@ -0,0 +1,73 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Virtual file system used by the assembler and disk imager for all file access.  A NULL Vfs pointer can be passed
+   into any of these routines to select the POSIX file system.  Failures are reported the same way as the stdio
+   routines they replace: NULL handles, short reads/writes, non-zero results from rename/remove, and -1 sizes.
+   Vfs_GetFileSize() leaves the file positioned at its start, Vfs_SeekFile() positions it at an absolute offset and
+   returns non-zero on failure, and streams are closed with fclose().  Vfs_CopyFileMode() gives the second file the
+   permission bits of the first so that a temporary file renamed over it keeps them.  It does nothing, successfully,
+   when the first file doesn't exist. */
+#ifndef _VFS_H_
+#define _VFS_H_
+
+#include <stdio.h>
+#include "try_catch.h"
+
+
+typedef struct Vfs     Vfs;
+typedef struct VfsFile VfsFile;
+
+
+typedef struct VfsBuffer
+{
+    const void* pData;
+    size_t      size;
+} VfsBuffer;
+
+
+typedef struct VfsVTable
+{
+    void     (*freeObject)(void* pThis);
+    VfsFile* (*openFile)(void* pThis, const char* pFilename, const char* pMode);
+    void     (*closeFile)(void* pThis, VfsFile* pFile);
+    long     (*getFileSize)(void* pThis, VfsFile* pFile);
+    size_t   (*readFile)(void* pThis, VfsFile* pFile, void* pBuffer, size_t bytesToRead);
+    size_t   (*writeFile)(void* pThis, VfsFile* pFile, const VfsBuffer* pBuffers, size_t bufferCount);
+    int      (*seekFile)(void* pThis, VfsFile* pFile, long offset);
+    int      (*copyFileMode)(void* pThis, const char* pFromFilename, const char* pToFilename);
+    int      (*renameFile)(void* pThis, const char* pOldFilename, const char* pNewFilename);
+    int      (*removeFile)(void* pThis, const char* pFilename);
+    FILE*    (*openStream)(void* pThis, const char* pFilename);
+} VfsVTable;
+
+
+struct Vfs
+{
+    VfsVTable* pVTable;
+};
+
+
+void     Vfs_Free(Vfs* pThis);
+
+VfsFile* Vfs_OpenFile(Vfs* pThis, const char* pFilename, const char* pMode);
+void     Vfs_CloseFile(Vfs* pThis, VfsFile* pFile);
+long     Vfs_GetFileSize(Vfs* pThis, VfsFile* pFile);
+size_t   Vfs_ReadFile(Vfs* pThis, VfsFile* pFile, void* pBuffer, size_t bytesToRead);
+size_t   Vfs_WriteFile(Vfs* pThis, VfsFile* pFile, const VfsBuffer* pBuffers, size_t bufferCount);
+int      Vfs_SeekFile(Vfs* pThis, VfsFile* pFile, long offset);
+int      Vfs_CopyFileMode(Vfs* pThis, const char* pFromFilename, const char* pToFilename);
+int      Vfs_RenameFile(Vfs* pThis, const char* pOldFilename, const char* pNewFilename);
+int      Vfs_RemoveFile(Vfs* pThis, const char* pFilename);
+FILE*    Vfs_OpenStream(Vfs* pThis, const char* pFilename);
+
+#endif /* _VFS_H_ */
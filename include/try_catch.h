@@ -38,6 +38,7 @@
 #define invalidArgumentCountException       19
 #define encounteredCommentException         20
 #define badTrackException                   21
+#define sideNotBuiltException               22
 
 
 #ifndef __debugbreak
@@ -52,8 +53,9 @@ typedef struct ExceptionHandler
 } ExceptionHandler;
 
 
-extern ExceptionHandler* g_pExceptionHandlers;
-extern int               g_exceptionCode;
+/* Each thread has its own handler chain and exception code so that worker threads can use __try/__catch too. */
+extern __thread ExceptionHandler* g_pExceptionHandlers;
+extern __thread int               g_exceptionCode;
 
 
 /* On Linux, it is possible that __try and __catch are already defined. */
@@ -0,0 +1,451 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "MemoryVfs.h"
+#include "VfsTest.h"
+#include "util.h"
+
+
+typedef struct MemoryVfsEntry
+{
+    struct MemoryVfsEntry* pNext;
+    char*                  pFilename;
+    unsigned char*         pData;
+    size_t                 size;
+    size_t                 allocatedSize;
+} MemoryVfsEntry;
+
+typedef struct MemoryVfsHandle
+{
+    MemoryVfs*      pVfs;
+    MemoryVfsEntry* pEntry;
+    size_t          offset;
+} MemoryVfsHandle;
+
+struct MemoryVfs
+{
+    Vfs             super;
+    pthread_mutex_t mutex;
+    MemoryVfsEntry* pHead;
+};
+
+
+static void     freeObject(void* pThis);
+static VfsFile* openFile(void* pThis, const char* pFilename, const char* pMode);
+static void     closeFile(void* pThis, VfsFile* pFile);
+static long     getFileSize(void* pThis, VfsFile* pFile);
+static size_t   readFile(void* pThis, VfsFile* pFile, void* pBuffer, size_t bytesToRead);
+static size_t   writeFile(void* pThis, VfsFile* pFile, const VfsBuffer* pBuffers, size_t bufferCount);
+static int      seekFile(void* pThis, VfsFile* pFile, long offset);
+static int      copyFileMode(void* pThis, const char* pFromFilename, const char* pToFilename);
+static int      renameFile(void* pThis, const char* pOldFilename, const char* pNewFilename);
+static int      removeFile(void* pThis, const char* pFilename);
+static FILE*    openStream(void* pThis, const char* pFilename);
+VfsVTable MemoryVfsVTable =
+{
+    freeObject,
+    openFile,
+    closeFile,
+    getFileSize,
+    readFile,
+    writeFile,
+    seekFile,
+    copyFileMode,
+    renameFile,
+    removeFile,
+    openStream
+};
+
+
+__throws MemoryVfs* MemoryVfs_Create(void)
+{
+    MemoryVfs* pThis = allocateAndZero(sizeof(*pThis));
+    pThis->super.pVTable = &MemoryVfsVTable;
+    pthread_mutex_init(&pThis->mutex, NULL);
+    return pThis;
+}
+
+
+static void freeEntry(MemoryVfsEntry* pEntry);
+static void freeObject(void* pThis)
+{
+    MemoryVfs*      pMemoryVfs = (MemoryVfs*)pThis;
+    MemoryVfsEntry* pEntry = pMemoryVfs->pHead;
+    
+    while (pEntry)
+    {
+        MemoryVfsEntry* pNext = pEntry->pNext;
+        freeEntry(pEntry);
+        pEntry = pNext;
+    }
+    pthread_mutex_destroy(&pMemoryVfs->mutex);
+    free(pMemoryVfs);
+}
+
+static void freeEntry(MemoryVfsEntry* pEntry)
+{
+    free(pEntry->pData);
+    free(pEntry->pFilename);
+    free(pEntry);
+}
+
+
+static MemoryVfsEntry* findEntry(MemoryVfs* pThis, const char* pFilename);
+static MemoryVfsEntry* findOrCreateEntry(MemoryVfs* pThis, const char* pFilename);
+static VfsFile* openFile(void* pThis, const char* pFilename, const char* pMode)
+{
+    /* Handles can be opened from worker threads so failures are returned as NULL rather than thrown. */
+    MemoryVfs*       pMemoryVfs = (MemoryVfs*)pThis;
+    MemoryVfsHandle* pHandle = NULL;
+    MemoryVfsEntry*  pEntry = NULL;
+    
+    pthread_mutex_lock(&pMemoryVfs->mutex);
+    if (pMode[0] == 'r')
+        pEntry = findEntry(pMemoryVfs, pFilename);
+    else if (pMode[0] == 'w')
+        pEntry = findOrCreateEntry(pMemoryVfs, pFilename);
+    if (pEntry)
+        pHandle = malloc(sizeof(*pHandle));
+    if (pHandle)
+    {
+        if (pMode[0] == 'w')
+            pEntry->size = 0;
+        pHandle->pVfs = pMemoryVfs;
+        pHandle->pEntry = pEntry;
+        pHandle->offset = 0;
+    }
+    pthread_mutex_unlock(&pMemoryVfs->mutex);
+    
+    return (VfsFile*)pHandle;
+}
+
+static MemoryVfsEntry* findEntry(MemoryVfs* pThis, const char* pFilename)
+{
+    MemoryVfsEntry* pEntry = pThis->pHead;
+    
+    while (pEntry && 0 != strcasecmp(pEntry->pFilename, pFilename))
+        pEntry = pEntry->pNext;
+    return pEntry;
+}
+
+static MemoryVfsEntry* findOrCreateEntry(MemoryVfs* pThis, const char* pFilename)
+{
+    MemoryVfsEntry* pEntry = findEntry(pThis, pFilename);
+    size_t          filenameSize = strlen(pFilename) + 1;
+    
+    if (pEntry)
+        return pEntry;
+    
+    pEntry = malloc(sizeof(*pEntry));
+    if (!pEntry)
+        return NULL;
+    memset(pEntry, 0, sizeof(*pEntry));
+    pEntry->pFilename = malloc(filenameSize);
+    if (!pEntry->pFilename)
+    {
+        free(pEntry);
+        return NULL;
+    }
+    memcpy(pEntry->pFilename, pFilename, filenameSize);
+    pEntry->pNext = pThis->pHead;
+    pThis->pHead = pEntry;
+    
+    return pEntry;
+}
+
+
+static void closeFile(void* pThis, VfsFile* pFile)
+{
+    free(pFile);
+}
+
+
+static long getFileSize(void* pThis, VfsFile* pFile)
+{
+    MemoryVfs*       pMemoryVfs = (MemoryVfs*)pThis;
+    MemoryVfsHandle* pHandle = (MemoryVfsHandle*)pFile;
+    long             fileSize;
+    
+    pthread_mutex_lock(&pMemoryVfs->mutex);
+    fileSize = (long)pHandle->pEntry->size;
+    pHandle->offset = 0;
+    pthread_mutex_unlock(&pMemoryVfs->mutex);
+    
+    return fileSize;
+}
+
+
+static size_t readFile(void* pThis, VfsFile* pFile, void* pBuffer, size_t bytesToRead)
+{
+    MemoryVfs*       pMemoryVfs = (MemoryVfs*)pThis;
+    MemoryVfsHandle* pHandle = (MemoryVfsHandle*)pFile;
+    size_t           bytesLeft;
+    
+    pthread_mutex_lock(&pMemoryVfs->mutex);
+    bytesLeft = pHandle->offset < pHandle->pEntry->size ? pHandle->pEntry->size - pHandle->offset : 0;
+    if (bytesToRead > bytesLeft)
+        bytesToRead = bytesLeft;
+    if (bytesToRead > 0)
+        memcpy(pBuffer, pHandle->pEntry->pData + pHandle->offset, bytesToRead);
+    pHandle->offset += bytesToRead;
+    pthread_mutex_unlock(&pMemoryVfs->mutex);
+    
+    return bytesToRead;
+}
+
+
+static int growEntry(MemoryVfsEntry* pEntry, size_t sizeNeeded);
+static size_t writeFile(void* pThis, VfsFile* pFile, const VfsBuffer* pBuffers, size_t bufferCount)
+{
+    MemoryVfs*       pMemoryVfs = (MemoryVfs*)pThis;
+    MemoryVfsHandle* pHandle = (MemoryVfsHandle*)pFile;
+    MemoryVfsEntry*  pEntry = pHandle->pEntry;
+    size_t           bytesToWrite = 0;
+    size_t           bytesWritten = 0;
+    size_t           i;
+    
+    for (i = 0 ; i < bufferCount ; i++)
+        bytesToWrite += pBuffers[i].size;
+
+    pthread_mutex_lock(&pMemoryVfs->mutex);
+    if (growEntry(pEntry, pHandle->offset + bytesToWrite))
+    {
+        if (pHandle->offset > pEntry->size)
+            memset(pEntry->pData + pEntry->size, 0, pHandle->offset - pEntry->size);
+        for (i = 0 ; i < bufferCount ; i++)
+        {
+            memcpy(pEntry->pData + pHandle->offset, pBuffers[i].pData, pBuffers[i].size);
+            pHandle->offset += pBuffers[i].size;
+        }
+        if (pHandle->offset > pEntry->size)
+            pEntry->size = pHandle->offset;
+        bytesWritten = bytesToWrite;
+    }
+    pthread_mutex_unlock(&pMemoryVfs->mutex);
+    
+    return bytesWritten;
+}
+
+static int growEntry(MemoryVfsEntry* pEntry, size_t sizeNeeded)
+{
+    size_t         newSize = pEntry->allocatedSize ? pEntry->allocatedSize : 256;
+    unsigned char* pRealloc;
+    
+    if (sizeNeeded <= pEntry->allocatedSize)
+        return TRUE;
+    while (newSize < sizeNeeded)
+        newSize *= 2;
+    pRealloc = realloc(pEntry->pData, newSize);
+    if (!pRealloc)
+        return FALSE;
+    pEntry->pData = pRealloc;
+    pEntry->allocatedSize = newSize;
+    return TRUE;
+}
+
+
+static int seekFile(void* pThis, VfsFile* pFile, long offset)
+{
+    MemoryVfs*       pMemoryVfs = (MemoryVfs*)pThis;
+    MemoryVfsHandle* pHandle = (MemoryVfsHandle*)pFile;
+    
+    if (offset < 0)
+        return -1;
+    pthread_mutex_lock(&pMemoryVfs->mutex);
+    pHandle->offset = (size_t)offset;
+    pthread_mutex_unlock(&pMemoryVfs->mutex);
+    
+    return 0;
+}
+
+
+static int copyFileMode(void* pThis, const char* pFromFilename, const char* pToFilename)
+{
+    /* Memory files have no permission bits. */
+    return 0;
+}
+
+
+static MemoryVfsEntry** findEntryLink(MemoryVfs* pThis, const char* pFilename);
+static int renameFile(void* pThis, const char* pOldFilename, const char* pNewFilename)
+{
+    MemoryVfs*       pMemoryVfs = (MemoryVfs*)pThis;
+    MemoryVfsEntry** ppNewLink;
+    MemoryVfsEntry*  pOldEntry;
+    size_t           filenameSize = strlen(pNewFilename) + 1;
+    char*            pFilenameCopy = malloc(filenameSize);
+    int              result = -1;
+    
+    if (!pFilenameCopy)
+        return -1;
+    memcpy(pFilenameCopy, pNewFilename, filenameSize);
+    
+    pthread_mutex_lock(&pMemoryVfs->mutex);
+    pOldEntry = findEntry(pMemoryVfs, pOldFilename);
+    if (pOldEntry)
+    {
+        ppNewLink = findEntryLink(pMemoryVfs, pNewFilename);
+        if (ppNewLink && *ppNewLink != pOldEntry)
+        {
+            MemoryVfsEntry* pReplacedEntry = *ppNewLink;
+            *ppNewLink = pReplacedEntry->pNext;
+            freeEntry(pReplacedEntry);
+        }
+        free(pOldEntry->pFilename);
+        pOldEntry->pFilename = pFilenameCopy;
+        pFilenameCopy = NULL;
+        result = 0;
+    }
+    pthread_mutex_unlock(&pMemoryVfs->mutex);
+    free(pFilenameCopy);
+    
+    return result;
+}
+
+static MemoryVfsEntry** findEntryLink(MemoryVfs* pThis, const char* pFilename)
+{
+    MemoryVfsEntry** ppLink = &pThis->pHead;
+    
+    while (*ppLink)
+    {
+        if (0 == strcasecmp((*ppLink)->pFilename, pFilename))
+            return ppLink;
+        ppLink = &(*ppLink)->pNext;
+    }
+    return NULL;
+}
+
+
+static int removeFile(void* pThis, const char* pFilename)
+{
+    MemoryVfs*       pMemoryVfs = (MemoryVfs*)pThis;
+    MemoryVfsEntry** ppLink;
+    int              result = -1;
+    
+    pthread_mutex_lock(&pMemoryVfs->mutex);
+    ppLink = findEntryLink(pMemoryVfs, pFilename);
+    if (ppLink)
+    {
+        MemoryVfsEntry* pEntry = *ppLink;
+        *ppLink = pEntry->pNext;
+        freeEntry(pEntry);
+        result = 0;
+    }
+    pthread_mutex_unlock(&pMemoryVfs->mutex);
+    
+    return result;
+}
+
+
+static FILE*   openCustomStream(VfsFile* pFile);
+static ssize_t writeToStream(void* pvHandle, const char* pBuffer, size_t bufferSize);
+static int     closeStream(void* pvHandle);
+static FILE* openStream(void* pThis, const char* pFilename)
+{
+    /* The list file is written with fprintf() so hand back a stdio stream whose output lands in the memory file. */
+    VfsFile* pFile = openFile(pThis, pFilename, "wb");
+    FILE*    pStream;
+    
+    if (!pFile)
+        return NULL;
+    pStream = openCustomStream(pFile);
+    if (!pStream)
+        closeFile(pThis, pFile);
+    return pStream;
+}
+
+#ifdef __APPLE__
+static int writeToFunopenStream(void* pvHandle, const char* pBuffer, int bufferSize)
+{
+    return (int)writeToStream(pvHandle, pBuffer, (size_t)bufferSize);
+}
+
+static FILE* openCustomStream(VfsFile* pFile)
+{
+    return funopen(pFile, NULL, writeToFunopenStream, NULL, closeStream);
+}
+#else
+static FILE* openCustomStream(VfsFile* pFile)
+{
+    static const cookie_io_functions_t streamFunctions = { NULL, writeToStream, NULL, closeStream };
+    
+    return fopencookie(pFile, "w", streamFunctions);
+}
+#endif /* __APPLE__ */
+
+static ssize_t writeToStream(void* pvHandle, const char* pBuffer, size_t bufferSize)
+{
+    MemoryVfsHandle* pHandle = (MemoryVfsHandle*)pvHandle;
+    VfsBuffer        buffer = { pBuffer, bufferSize };
+    
+    return (ssize_t)writeFile(pHandle->pVfs, (VfsFile*)pHandle, &buffer, 1);
+}
+
+static int closeStream(void* pvHandle)
+{
+    MemoryVfsHandle* pHandle = (MemoryVfsHandle*)pvHandle;
+    
+    closeFile(pHandle->pVfs, (VfsFile*)pHandle);
+    return 0;
+}
+
+
+__throws void MemoryVfs_AddFile(MemoryVfs* pThis, const char* pFilename, const void* pData, size_t dataSize)
+{
+    VfsBuffer buffer = { pData, dataSize };
+    VfsFile*  pFile = openFile(pThis, pFilename, "wb");
+    size_t    bytesWritten;
+    
+    if (!pFile)
+        __throw(outOfMemoryException);
+    bytesWritten = writeFile(pThis, pFile, &buffer, 1);
+    closeFile(pThis, pFile);
+    if (bytesWritten != dataSize)
+        __throw(outOfMemoryException);
+}
+
+
+const void* MemoryVfs_GetFileData(MemoryVfs* pThis, const char* pFilename, size_t* pDataSize)
+{
+    static const unsigned char emptyFile[1];
+    MemoryVfsEntry*            pEntry;
+    const void*                pData = NULL;
+    
+    pthread_mutex_lock(&pThis->mutex);
+    pEntry = findEntry(pThis, pFilename);
+    if (pEntry)
+    {
+        pData = pEntry->pData ? pEntry->pData : emptyFile;
+        *pDataSize = pEntry->size;
+    }
+    pthread_mutex_unlock(&pThis->mutex);
+    
+    return pData;
+}
+
+
+size_t MemoryVfs_GetFileCount(MemoryVfs* pThis)
+{
+    MemoryVfsEntry* pEntry;
+    size_t          fileCount = 0;
+    
+    pthread_mutex_lock(&pThis->mutex);
+    for (pEntry = pThis->pHead ; pEntry ; pEntry = pEntry->pNext)
+        fileCount++;
+    pthread_mutex_unlock(&pThis->mutex);
+    
+    return fileCount;
+}
@@ -0,0 +1,176 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ObjectBundle.h"
+#include "PosixVfs.h"
+#include "ObjectBundleTest.h"
+#include "util.h"
+
+
+struct ObjectBundle
+{
+    const unsigned char*     pBase;
+    const ObjectBundleEntry* pEntries;
+    void*                    pMapping;
+    unsigned char*           pBuffer;
+    size_t                   size;
+    unsigned int             entryCount;
+};
+
+
+static int  isPosixVfs(Vfs* pVfs);
+static void mapBundleFile(ObjectBundle* pThis, const char* pFilename);
+static void readBundleFile(ObjectBundle* pThis, Vfs* pVfs, const char* pFilename);
+static void validateBundle(ObjectBundle* pThis);
+__throws ObjectBundle* ObjectBundle_Open(Vfs* pVfs, const char* pFilename)
+{
+    ObjectBundle* pThis = NULL;
+    
+    __try
+    {
+        pThis = allocateAndZero(sizeof(*pThis));
+        if (isPosixVfs(pVfs))
+            mapBundleFile(pThis, pFilename);
+        else
+            readBundleFile(pThis, pVfs, pFilename);
+        validateBundle(pThis);
+    }
+    __catch
+    {
+        ObjectBundle_Free(pThis);
+        __rethrow;
+    }
+    
+    return pThis;
+}
+
+static int isPosixVfs(Vfs* pVfs)
+{
+    return pVfs == NULL || pVfs == PosixVfs_Get();
+}
+
+static void mapBundleFile(ObjectBundle* pThis, const char* pFilename)
+{
+    /* The whole bundle is mapped read-only with a single mmap() call and payloads are then handed out in place. */
+    FILE*       pFile;
+    struct stat fileStats;
+    void*       pMapping = MAP_FAILED;
+    
+    pFile = fopen(pFilename, "rb");
+    if (!pFile)
+        __throw(fileOpenException);
+    if (0 == fstat(fileno(pFile), &fileStats) && fileStats.st_size > 0)
+        pMapping = mmap(NULL, fileStats.st_size, PROT_READ, MAP_PRIVATE, fileno(pFile), 0);
+    fclose(pFile);
+    if (pMapping == MAP_FAILED)
+        __throw(fileException);
+    
+    pThis->pMapping = pMapping;
+    pThis->pBase = pMapping;
+    pThis->size = fileStats.st_size;
+}
+
+static void readBundleFile(ObjectBundle* pThis, Vfs* pVfs, const char* pFilename)
+{
+    VfsFile* pFile;
+    long     fileSize;
+    
+    pFile = Vfs_OpenFile(pVfs, pFilename, "rb");
+    if (!pFile)
+        __throw(fileOpenException);
+    __try
+    {
+        fileSize = Vfs_GetFileSize(pVfs, pFile);
+        if (fileSize <= 0)
+            __throw(fileException);
+        pThis->pBuffer = allocateAndZero(fileSize);
+        if ((size_t)fileSize != Vfs_ReadFile(pVfs, pFile, pThis->pBuffer, fileSize))
+            __throw(fileException);
+    }
+    __catch
+    {
+        Vfs_CloseFile(pVfs, pFile);
+        __rethrow;
+    }
+    Vfs_CloseFile(pVfs, pFile);
+    
+    pThis->pBase = pThis->pBuffer;
+    pThis->size = fileSize;
+}
+
+static void validateBundle(ObjectBundle* pThis)
+{
+    const ObjectBundleHeader* pHeader = (const ObjectBundleHeader*)pThis->pBase;
+    unsigned int              i;
+    
+    if (pThis->size < sizeof(*pHeader) || 0 != memcmp(pHeader->signature, OBJECT_BUNDLE_SIGNATURE, 4))
+        __throw(fileException);
+    if (pHeader->entryCount > (pThis->size - sizeof(*pHeader)) / sizeof(ObjectBundleEntry))
+        __throw(fileException);
+    
+    pThis->entryCount = pHeader->entryCount;
+    pThis->pEntries = (const ObjectBundleEntry*)(pHeader + 1);
+    for (i = 0 ; i < pThis->entryCount ; i++)
+    {
+        const ObjectBundleEntry* pEntry = &pThis->pEntries[i];
+        
+        if (pEntry->name[sizeof(pEntry->name) - 1] != '\0' ||
+            pEntry->paddedLength < pEntry->length ||
+            pEntry->offset > pThis->size ||
+            pEntry->paddedLength > pThis->size - pEntry->offset)
+        {
+            __throw(fileException);
+        }
+    }
+}
+
+
+void ObjectBundle_Free(ObjectBundle* pThis)
+{
+    if (!pThis)
+        return;
+    
+    if (pThis->pMapping)
+        munmap(pThis->pMapping, pThis->size);
+    free(pThis->pBuffer);
+    free(pThis);
+}
+
+
+int ObjectBundle_Find(ObjectBundle* pThis, const char* pName, ObjectBundleItem* pItem)
+{
+    unsigned int i;
+    
+    for (i = 0 ; i < pThis->entryCount ; i++)
+    {
+        const ObjectBundleEntry* pEntry = &pThis->pEntries[i];
+        
+        if (0 == strcasecmp(pEntry->name, pName))
+        {
+            pItem->pData = pThis->pBase + pEntry->offset;
+            pItem->length = pEntry->length;
+            pItem->paddedLength = pEntry->paddedLength;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+unsigned int ObjectBundle_GetEntryCount(ObjectBundle* pThis)
+{
+    return pThis->entryCount;
+}
@@ -0,0 +1,170 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "PosixVfs.h"
+#include "VfsTest.h"
+#include "util.h"
+
+
+static void     freeObject(void* pThis);
+static VfsFile* openFile(void* pThis, const char* pFilename, const char* pMode);
+static void     closeFile(void* pThis, VfsFile* pFile);
+static long     getFileSize(void* pThis, VfsFile* pFile);
+static size_t   readFile(void* pThis, VfsFile* pFile, void* pBuffer, size_t bytesToRead);
+static size_t   writeFile(void* pThis, VfsFile* pFile, const VfsBuffer* pBuffers, size_t bufferCount);
+static int      seekFile(void* pThis, VfsFile* pFile, long offset);
+static int      copyFileMode(void* pThis, const char* pFromFilename, const char* pToFilename);
+static int      renameFile(void* pThis, const char* pOldFilename, const char* pNewFilename);
+static int      removeFile(void* pThis, const char* pFilename);
+static FILE*    openStream(void* pThis, const char* pFilename);
+VfsVTable PosixVfsVTable =
+{
+    freeObject,
+    openFile,
+    closeFile,
+    getFileSize,
+    readFile,
+    writeFile,
+    seekFile,
+    copyFileMode,
+    renameFile,
+    removeFile,
+    openStream
+};
+
+static Vfs g_posixVfs = { &PosixVfsVTable };
+
+
+Vfs* PosixVfs_Get(void)
+{
+    return &g_posixVfs;
+}
+
+
+static void freeObject(void* pThis)
+{
+    /* The POSIX file system is a static singleton so there is nothing to free. */
+}
+
+
+static VfsFile* openFile(void* pThis, const char* pFilename, const char* pMode)
+{
+    /* stdio is only used to open and close the file.  All reads, writes and seeks go straight to its descriptor so
+       that nothing is ever buffered by stdio or positioned behind its back. */
+    return (VfsFile*)fopen(pFilename, pMode);
+}
+
+
+static void closeFile(void* pThis, VfsFile* pFile)
+{
+    fclose((FILE*)pFile);
+}
+
+
+static long getFileSize(void* pThis, VfsFile* pFile)
+{
+    int   fileDescriptor = fileno((FILE*)pFile);
+    off_t fileSize;
+    
+    fileSize = lseek(fileDescriptor, 0, SEEK_END);
+    if (fileSize < 0)
+        return -1;
+    if (lseek(fileDescriptor, 0, SEEK_SET) != 0)
+        return -1;
+    return (long)fileSize;
+}
+
+
+static size_t readFile(void* pThis, VfsFile* pFile, void* pBuffer, size_t bytesToRead)
+{
+    int    fileDescriptor = fileno((FILE*)pFile);
+    size_t bytesRead = 0;
+    
+    while (bytesRead < bytesToRead)
+    {
+        ssize_t result = read(fileDescriptor, (char*)pBuffer + bytesRead, bytesToRead - bytesRead);
+        if (result <= 0)
+            break;
+        bytesRead += (size_t)result;
+    }
+    return bytesRead;
+}
+
+
+static size_t writeFile(void* pThis, VfsFile* pFile, const VfsBuffer* pBuffers, size_t bufferCount)
+{
+    /* Gather the buffers into as few writev() calls as possible rather than copying them into one. */
+    struct iovec writeVector[16];
+    size_t       bytesWritten = 0;
+    
+    while (bufferCount > 0)
+    {
+        size_t  vectorCount = bufferCount < ARRAYSIZE(writeVector) ? bufferCount : ARRAYSIZE(writeVector);
+        size_t  bytesToWrite = 0;
+        ssize_t result;
+        size_t  i;
+        
+        for (i = 0 ; i < vectorCount ; i++)
+        {
+            writeVector[i].iov_base = (void*)pBuffers[i].pData;
+            writeVector[i].iov_len = pBuffers[i].size;
+            bytesToWrite += pBuffers[i].size;
+        }
+        result = writev(fileno((FILE*)pFile), writeVector, (int)vectorCount);
+        if (result < 0)
+            break;
+        bytesWritten += (size_t)result;
+        if ((size_t)result != bytesToWrite)
+            break;
+        pBuffers += vectorCount;
+        bufferCount -= vectorCount;
+    }
+    return bytesWritten;
+}
+
+
+static int seekFile(void* pThis, VfsFile* pFile, long offset)
+{
+    return lseek(fileno((FILE*)pFile), offset, SEEK_SET) == (off_t)offset ? 0 : -1;
+}
+
+
+static int copyFileMode(void* pThis, const char* pFromFilename, const char* pToFilename)
+{
+    struct stat fromStat;
+    
+    if (0 != stat(pFromFilename, &fromStat))
+        return 0;
+    return chmod(pToFilename, fromStat.st_mode & 07777);
+}
+
+
+static int renameFile(void* pThis, const char* pOldFilename, const char* pNewFilename)
+{
+    return rename(pOldFilename, pNewFilename);
+}
+
+
+static int removeFile(void* pThis, const char* pFilename)
+{
+    return remove(pFilename);
+}
+
+
+static FILE* openStream(void* pThis, const char* pFilename)
+{
+    return fopen(pFilename, "wb");
+}
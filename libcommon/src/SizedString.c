@@ -290,9 +290,7 @@ char SizedString_EnumNext(const SizedString* pString, const char** ppEnumerator)
 
 size_t SizedString_EnumRemaining(const SizedString* pString, const char* pEnumerator)
 {
-    int charsEnumerated = pEnumerator - pString->pString;
-    
-    if (charsEnumerated < 0)
+    if (pEnumerator < pString->pString)
         return 0;
-    return pString->stringLength - (size_t)charsEnumerated;
+    return pString->stringLength - (size_t)(pEnumerator - pString->pString);
 }
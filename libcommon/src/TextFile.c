@@ -88,15 +88,24 @@ __throws static char* allocateStringAndCopyMergedFilename(const SizedString* pDi
 }
 
 
-static FILE* openFile(const char* pFilename);
-static long getTextLength(FILE* pFile);
-static char* allocateTextBuffer(long textLength);
-static void readFileContentIntoTextBuffer(char* pTextBuffer, long fileSize, FILE* pFile);
 __throws TextFile* TextFile_CreateFromFile(const SizedString* pDirectory, 
                                            const SizedString* pFilename, 
                                            const char*        pFilenameSuffix)
 {
-    FILE*     pFile = NULL;
+    return TextFile_CreateFromVfs(NULL, pDirectory, pFilename, pFilenameSuffix);
+}
+
+
+static VfsFile* openFile(Vfs* pVfs, const char* pFilename);
+static long getTextLength(Vfs* pVfs, VfsFile* pFile);
+static char* allocateTextBuffer(long textLength);
+static void readFileContentIntoTextBuffer(Vfs* pVfs, char* pTextBuffer, long fileSize, VfsFile* pFile);
+__throws TextFile* TextFile_CreateFromVfs(Vfs*               pVfs,
+                                          const SizedString* pDirectory, 
+                                          const SizedString* pFilename, 
+                                          const char*        pFilenameSuffix)
+{
+    VfsFile*  pFile = NULL;
     long      textLength = -1;
     TextFile* pThis = NULL;
     
@@ -104,52 +113,42 @@ __throws TextFile* TextFile_CreateFromFile(const SizedString* pDirectory,
     {
         pThis = allocateAndZero(sizeof(*pThis));
         pThis->pFilename = allocateStringAndCopyMergedFilename(pDirectory, pFilename, pFilenameSuffix);
-        pFile = openFile(pThis->pFilename);
-        textLength = getTextLength(pFile);
+        pFile = openFile(pVfs, pThis->pFilename);
+        textLength = getTextLength(pVfs, pFile);
         pThis->pFileBuffer = allocateTextBuffer(textLength);
         pThis->pEnd = pThis->pFileBuffer + textLength;
-        readFileContentIntoTextBuffer(pThis->pFileBuffer, textLength, pFile);
+        readFileContentIntoTextBuffer(pVfs, pThis->pFileBuffer, textLength, pFile);
         initObject(pThis, pThis->pFileBuffer);
     }
     __catch
     {
         TextFile_Free(pThis);
-        if (pFile)
-            fclose(pFile);
+        Vfs_CloseFile(pVfs, pFile);
         __rethrow;
     }
     
-    fclose(pFile);
+    Vfs_CloseFile(pVfs, pFile);
     return pThis;
 }
 
-static FILE* openFile(const char* pFilename)
+static VfsFile* openFile(Vfs* pVfs, const char* pFilename)
 {
-    FILE* pFile = NULL;
+    VfsFile* pFile = NULL;
     
-    pFile = fopen(pFilename, "rb");
+    pFile = Vfs_OpenFile(pVfs, pFilename, "rb");
     if (!pFile)
         __throw(fileOpenException);
     return pFile;
 }
 
-static long getTextLength(FILE* pFile)
+static long getTextLength(Vfs* pVfs, VfsFile* pFile)
 {
     long fileSize;
-    int  result;
     
-    result = fseek(pFile, 0, SEEK_END);
-    if (result != 0)
-        __throw(fileException);
-        
-    fileSize = ftell(pFile);
+    fileSize = Vfs_GetFileSize(pVfs, pFile);
     if (fileSize == -1)
         __throw(fileException);
         
-    result = fseek(pFile, 0, SEEK_SET);
-    if (result != 0)
-        __throw(fileException);
-        
     return fileSize;
 }
 
@@ -164,12 +163,12 @@ static char* allocateTextBuffer(long textLength)
     return pTextBuffer;
 }
 
-static void readFileContentIntoTextBuffer(char* pTextBuffer, long fileSize, FILE* pFile)
+static void readFileContentIntoTextBuffer(Vfs* pVfs, char* pTextBuffer, long fileSize, VfsFile* pFile)
 {
-    int result;
+    size_t result;
     
-    result = fread(pTextBuffer, 1, fileSize, pFile);
-    if (result != fileSize)
+    result = Vfs_ReadFile(pVfs, pFile, pTextBuffer, fileSize);
+    if (result != (size_t)fileSize)
         __throw(fileException);
 }
 
@@ -0,0 +1,183 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "ThreadPool.h"
+
+
+typedef struct ThreadPoolWork
+{
+    ThreadPoolCallback pCallback;
+    void*              pContext;
+    size_t             itemCount;
+    size_t             nextItem;
+    size_t             workersWanted;
+    size_t             workersJoined;
+    size_t             workersFinished;
+} ThreadPoolWork;
+
+
+static size_t          g_threadCount;
+static __thread int     g_isPoolWorker;
+static pthread_mutex_t  g_poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   g_workPosted = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   g_workerFinished = PTHREAD_COND_INITIALIZER;
+static ThreadPoolWork*  g_pPostedWork;
+static size_t           g_workerCount;
+
+
+void ThreadPool_SetThreadCount(size_t threadCount)
+{
+    g_threadCount = threadCount > THREAD_POOL_MAX_THREADS ? THREAD_POOL_MAX_THREADS : threadCount;
+}
+
+
+static size_t getOnlineProcessorCount(void);
+size_t ThreadPool_GetThreadCount(void)
+{
+    size_t processorCount;
+    
+    if (g_threadCount)
+        return g_threadCount;
+    processorCount = getOnlineProcessorCount();
+    return processorCount > THREAD_POOL_MAX_THREADS ? THREAD_POOL_MAX_THREADS : processorCount;
+}
+
+static size_t getOnlineProcessorCount(void)
+{
+    long processorCount = sysconf(_SC_NPROCESSORS_ONLN);
+    return processorCount < 1 ? 1 : (size_t)processorCount;
+}
+
+
+static size_t startWorkers(size_t workerCount);
+static void   postWork(ThreadPoolWork* pWork);
+static void   waitForJoinedWorkers(ThreadPoolWork* pWork);
+static void   runWorkItemsUntilNoneLeft(ThreadPoolWork* pWork);
+static void   runWorkItemsAsPoolWorker(ThreadPoolWork* pWork);
+void ThreadPool_Run(size_t itemCount, ThreadPoolCallback pCallback, void* pContext)
+{
+    size_t         threadCount = ThreadPool_GetThreadCount();
+    ThreadPoolWork work;
+    
+    memset(&work, 0, sizeof(work));
+    work.pCallback = pCallback;
+    work.pContext = pContext;
+    work.itemCount = itemCount;
+    
+    /* A run started from within the items of another multi-threaded run already has the other workers keeping the
+       processors busy so its items are just run on the calling worker.  The workers only take one run at a time so
+       it couldn't be handed to them anyway. */
+    if (g_isPoolWorker)
+    {
+        runWorkItemsUntilNoneLeft(&work);
+        return;
+    }
+    
+    /* The calling thread is one of the workers so only use extra threads when there is enough work for them. */
+    if (threadCount > itemCount)
+        threadCount = itemCount;
+    work.workersWanted = threadCount > 1 ? startWorkers(threadCount - 1) : 0;
+    if (work.workersWanted == 0)
+    {
+        runWorkItemsUntilNoneLeft(&work);
+        return;
+    }
+    
+    postWork(&work);
+    runWorkItemsAsPoolWorker(&work);
+    waitForJoinedWorkers(&work);
+}
+
+static void* workerThread(void* pvUnused);
+static size_t startWorkers(size_t workerCount)
+{
+    /* Workers are only started the first time a run needs them and then wait for later runs.  If a thread can't be
+       started then the run just makes do with the workers it already has. */
+    pthread_t      thread;
+    pthread_attr_t attributes;
+    
+    if (g_workerCount >= workerCount)
+        return workerCount;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    while (g_workerCount < workerCount && 0 == pthread_create(&thread, &attributes, workerThread, NULL))
+        g_workerCount++;
+    pthread_attr_destroy(&attributes);
+    
+    return g_workerCount;
+}
+
+static int canJoinPostedWork(void);
+static void* workerThread(void* pvUnused)
+{
+    g_isPoolWorker = 1;
+    pthread_mutex_lock(&g_poolMutex);
+    for (;;)
+    {
+        ThreadPoolWork* pWork;
+        
+        while (!canJoinPostedWork())
+            pthread_cond_wait(&g_workPosted, &g_poolMutex);
+        pWork = g_pPostedWork;
+        pWork->workersJoined++;
+        pthread_mutex_unlock(&g_poolMutex);
+        
+        runWorkItemsUntilNoneLeft(pWork);
+        
+        pthread_mutex_lock(&g_poolMutex);
+        pWork->workersFinished++;
+        pthread_cond_signal(&g_workerFinished);
+    }
+    return NULL;
+}
+
+static int canJoinPostedWork(void)
+{
+    return g_pPostedWork && g_pPostedWork->workersJoined < g_pPostedWork->workersWanted;
+}
+
+static void postWork(ThreadPoolWork* pWork)
+{
+    pthread_mutex_lock(&g_poolMutex);
+    g_pPostedWork = pWork;
+    pthread_cond_broadcast(&g_workPosted);
+    pthread_mutex_unlock(&g_poolMutex);
+}
+
+static void waitForJoinedWorkers(ThreadPoolWork* pWork)
+{
+    /* Once the calling thread runs out of items the work is withdrawn so that no more workers join it.  Only the
+       workers which already joined need to be waited for. */
+    pthread_mutex_lock(&g_poolMutex);
+    g_pPostedWork = NULL;
+    while (pWork->workersFinished < pWork->workersJoined)
+        pthread_cond_wait(&g_workerFinished, &g_poolMutex);
+    pthread_mutex_unlock(&g_poolMutex);
+}
+
+static void runWorkItemsAsPoolWorker(ThreadPoolWork* pWork)
+{
+    g_isPoolWorker = 1;
+    runWorkItemsUntilNoneLeft(pWork);
+    g_isPoolWorker = 0;
+}
+
+static void runWorkItemsUntilNoneLeft(ThreadPoolWork* pWork)
+{
+    size_t itemIndex;
+    
+    while ((itemIndex = __sync_fetch_and_add(&pWork->nextItem, 1)) < pWork->itemCount)
+        pWork->pCallback(pWork->pContext, itemIndex);
+}
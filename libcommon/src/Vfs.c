@@ -0,0 +1,100 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include "Vfs.h"
+#include "PosixVfs.h"
+
+
+static Vfs* vfsOrDefault(Vfs* pThis)
+{
+    return pThis ? pThis : PosixVfs_Get();
+}
+
+
+void Vfs_Free(Vfs* pThis)
+{
+    if (!pThis)
+        return;
+    pThis->pVTable->freeObject(pThis);
+}
+
+
+VfsFile* Vfs_OpenFile(Vfs* pThis, const char* pFilename, const char* pMode)
+{
+    pThis = vfsOrDefault(pThis);
+    return pThis->pVTable->openFile(pThis, pFilename, pMode);
+}
+
+
+void Vfs_CloseFile(Vfs* pThis, VfsFile* pFile)
+{
+    if (!pFile)
+        return;
+    pThis = vfsOrDefault(pThis);
+    pThis->pVTable->closeFile(pThis, pFile);
+}
+
+
+long Vfs_GetFileSize(Vfs* pThis, VfsFile* pFile)
+{
+    pThis = vfsOrDefault(pThis);
+    return pThis->pVTable->getFileSize(pThis, pFile);
+}
+
+
+size_t Vfs_ReadFile(Vfs* pThis, VfsFile* pFile, void* pBuffer, size_t bytesToRead)
+{
+    pThis = vfsOrDefault(pThis);
+    return pThis->pVTable->readFile(pThis, pFile, pBuffer, bytesToRead);
+}
+
+
+size_t Vfs_WriteFile(Vfs* pThis, VfsFile* pFile, const VfsBuffer* pBuffers, size_t bufferCount)
+{
+    pThis = vfsOrDefault(pThis);
+    return pThis->pVTable->writeFile(pThis, pFile, pBuffers, bufferCount);
+}
+
+
+int Vfs_SeekFile(Vfs* pThis, VfsFile* pFile, long offset)
+{
+    pThis = vfsOrDefault(pThis);
+    return pThis->pVTable->seekFile(pThis, pFile, offset);
+}
+
+
+int Vfs_CopyFileMode(Vfs* pThis, const char* pFromFilename, const char* pToFilename)
+{
+    pThis = vfsOrDefault(pThis);
+    return pThis->pVTable->copyFileMode(pThis, pFromFilename, pToFilename);
+}
+
+
+int Vfs_RenameFile(Vfs* pThis, const char* pOldFilename, const char* pNewFilename)
+{
+    pThis = vfsOrDefault(pThis);
+    return pThis->pVTable->renameFile(pThis, pOldFilename, pNewFilename);
+}
+
+
+int Vfs_RemoveFile(Vfs* pThis, const char* pFilename)
+{
+    pThis = vfsOrDefault(pThis);
+    return pThis->pVTable->removeFile(pThis, pFilename);
+}
+
+
+FILE* Vfs_OpenStream(Vfs* pThis, const char* pFilename)
+{
+    pThis = vfsOrDefault(pThis);
+    return pThis->pVTable->openStream(pThis, pFilename);
+}
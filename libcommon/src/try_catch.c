@@ -13,5 +13,5 @@
 /* Very rough exception handling like macros for C. */
 #include "try_catch.h"
 
-ExceptionHandler* g_pExceptionHandlers;
-int               g_exceptionCode;
+__thread ExceptionHandler* g_pExceptionHandlers;
+__thread int               g_exceptionCode;
@@ -0,0 +1,222 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "ObjectBundle.h"
+    #include "MemoryVfs.h"
+    #include "MallocFailureInject.h"
+    #include "FileFailureInject.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+static const char g_bundleFilename[] = "ObjectBundleTest.bundle";
+
+
+TEST_GROUP(ObjectBundle)
+{
+    ObjectBundle*    m_pBundle;
+    MemoryVfs*       m_pMemoryVfs;
+    ObjectBundleItem m_item;
+    unsigned char    m_bundle[sizeof(ObjectBundleHeader) + 2 * sizeof(ObjectBundleEntry) + 2 * 16];
+    size_t           m_bundleSize;
+    
+    void setup()
+    {
+        clearExceptionCode();
+        m_pBundle = NULL;
+        m_pMemoryVfs = NULL;
+        memset(&m_item, 0, sizeof(m_item));
+        buildBundle();
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        fopenRestore();
+        ObjectBundle_Free(m_pBundle);
+        Vfs_Free((Vfs*)m_pMemoryVfs);
+        remove(g_bundleFilename);
+    }
+    
+    void buildBundle()
+    {
+        ObjectBundleHeader* pHeader = (ObjectBundleHeader*)m_bundle;
+        ObjectBundleEntry*  pEntries = (ObjectBundleEntry*)(pHeader + 1);
+        unsigned int        payloadOffset = sizeof(*pHeader) + 2 * sizeof(*pEntries);
+        
+        memset(m_bundle, 0, sizeof(m_bundle));
+        memcpy(pHeader->signature, OBJECT_BUNDLE_SIGNATURE, sizeof(pHeader->signature));
+        pHeader->entryCount = 2;
+        strcpy(pEntries[0].name, "FIRST.SAV");
+        pEntries[0].offset = payloadOffset;
+        pEntries[0].length = 3;
+        pEntries[0].paddedLength = 16;
+        memcpy(m_bundle + payloadOffset, "\x01\x02\x03", 3);
+        strcpy(pEntries[1].name, "second.sav");
+        pEntries[1].offset = payloadOffset + 16;
+        pEntries[1].length = 2;
+        pEntries[1].paddedLength = 16;
+        memcpy(m_bundle + payloadOffset + 16, "\xfe\xff", 2);
+        m_bundleSize = sizeof(m_bundle);
+    }
+    
+    ObjectBundleEntry* entry(size_t index)
+    {
+        return (ObjectBundleEntry*)(m_bundle + sizeof(ObjectBundleHeader)) + index;
+    }
+    
+    void writeBundleFile()
+    {
+        FILE* pFile = fopen(g_bundleFilename, "wb");
+        CHECK(pFile != NULL);
+        LONGS_EQUAL(m_bundleSize, fwrite(m_bundle, 1, m_bundleSize, pFile));
+        fclose(pFile);
+    }
+    
+    void validateOpenFailsWith(int expectedException)
+    {
+        writeBundleFile();
+        __try_and_catch( m_pBundle = ObjectBundle_Open(NULL, g_bundleFilename) );
+        POINTERS_EQUAL(NULL, m_pBundle);
+        LONGS_EQUAL(expectedException, getExceptionCode());
+        clearExceptionCode();
+    }
+    
+    void validateItem(const char* pName, const void* pExpectedData, unsigned int expectedLength)
+    {
+        CHECK_TRUE(ObjectBundle_Find(m_pBundle, pName, &m_item));
+        LONGS_EQUAL(expectedLength, m_item.length);
+        LONGS_EQUAL(16, m_item.paddedLength);
+        CHECK(0 == memcmp(pExpectedData, m_item.pData, expectedLength));
+    }
+};
+
+
+TEST(ObjectBundle, FailToOpenMissingBundle)
+{
+    __try_and_catch( m_pBundle = ObjectBundle_Open(NULL, g_bundleFilename) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(ObjectBundle, FailFOpenOfBundle)
+{
+    writeBundleFile();
+    fopenFail(NULL);
+    __try_and_catch( m_pBundle = ObjectBundle_Open(NULL, g_bundleFilename) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(ObjectBundle, FailAllocationOfBundleObject)
+{
+    writeBundleFile();
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( m_pBundle = ObjectBundle_Open(NULL, g_bundleFilename) );
+    LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(ObjectBundle, FailToOpenEmptyBundle)
+{
+    m_bundleSize = 0;
+    validateOpenFailsWith(fileException);
+}
+
+TEST(ObjectBundle, FailToOpenBundleWithInvalidSignature)
+{
+    m_bundle[0] = 'X';
+    validateOpenFailsWith(fileException);
+}
+
+TEST(ObjectBundle, FailToOpenBundleWithTruncatedIndex)
+{
+    m_bundleSize = sizeof(ObjectBundleHeader) + sizeof(ObjectBundleEntry);
+    validateOpenFailsWith(fileException);
+}
+
+TEST(ObjectBundle, FailToOpenBundleWithPayloadPastEndOfFile)
+{
+    entry(1)->paddedLength = 17;
+    validateOpenFailsWith(fileException);
+}
+
+TEST(ObjectBundle, FailToOpenBundleWithPaddingShorterThanPayload)
+{
+    entry(0)->paddedLength = 2;
+    validateOpenFailsWith(fileException);
+}
+
+TEST(ObjectBundle, FailToOpenBundleWithUnterminatedName)
+{
+    memset(entry(0)->name, 'A', sizeof(entry(0)->name));
+    validateOpenFailsWith(fileException);
+}
+
+TEST(ObjectBundle, MapBundleAndFindEntries)
+{
+    writeBundleFile();
+    m_pBundle = ObjectBundle_Open(NULL, g_bundleFilename);
+    LONGS_EQUAL(2, ObjectBundle_GetEntryCount(m_pBundle));
+    validateItem("FIRST.SAV", "\x01\x02\x03", 3);
+    validateItem("second.sav", "\xfe\xff", 2);
+}
+
+TEST(ObjectBundle, FindEntriesWithoutRegardToCase)
+{
+    writeBundleFile();
+    m_pBundle = ObjectBundle_Open(NULL, g_bundleFilename);
+    validateItem("first.sav", "\x01\x02\x03", 3);
+    validateItem("SECOND.SAV", "\xfe\xff", 2);
+}
+
+TEST(ObjectBundle, FailToFindMissingEntry)
+{
+    writeBundleFile();
+    m_pBundle = ObjectBundle_Open(NULL, g_bundleFilename);
+    CHECK_FALSE(ObjectBundle_Find(m_pBundle, "third.sav", &m_item));
+}
+
+TEST(ObjectBundle, ReadBundleFromMemoryVfs)
+{
+    m_pMemoryVfs = MemoryVfs_Create();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_bundleFilename, m_bundle, m_bundleSize);
+    m_pBundle = ObjectBundle_Open((Vfs*)m_pMemoryVfs, g_bundleFilename);
+    validateItem("FIRST.SAV", "\x01\x02\x03", 3);
+    validateItem("second.sav", "\xfe\xff", 2);
+    POINTERS_EQUAL(NULL, fopen(g_bundleFilename, "rb"));
+}
+
+TEST(ObjectBundle, FailToReadMissingBundleFromMemoryVfs)
+{
+    m_pMemoryVfs = MemoryVfs_Create();
+    __try_and_catch( m_pBundle = ObjectBundle_Open((Vfs*)m_pMemoryVfs, g_bundleFilename) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(ObjectBundle, FailToReadInvalidBundleFromMemoryVfs)
+{
+    m_pMemoryVfs = MemoryVfs_Create();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_bundleFilename, m_bundle, sizeof(ObjectBundleHeader) - 1);
+    __try_and_catch( m_pBundle = ObjectBundle_Open((Vfs*)m_pMemoryVfs, g_bundleFilename) );
+    LONGS_EQUAL(fileException, getExceptionCode());
+    clearExceptionCode();
+}
@@ -15,6 +15,7 @@
 extern "C"
 {
     #include "TextFile.h"
+    #include "MemoryVfs.h"
     #include "MallocFailureInject.h"
     #include "FileFailureInject.h"
     #include "util.h"
@@ -253,41 +254,32 @@ TEST(TextFile, FailFOpen)
     clearExceptionCode();
 }
 
-TEST(TextFile, FailFSeekToEOF)
+TEST(TextFile, FailSeekToEOF)
 {
     createTestFile("\n\r");
-    fseekSetFailureCode(-1);
-    fseekSetCallsBeforeFailure(0);
+    lseekSetFailureCode(-1);
+    lseekSetCallsBeforeFailure(0);
     __try_and_catch( m_pTextFile = TextFile_CreateFromFile(NULL, toSizedString(tempFilename), NULL) );
-    fseekRestore();
+    lseekRestore();
     validateExceptionThrown(fileException);
 }
 
-TEST(TextFile, FailFSeekBackToStart)
+TEST(TextFile, FailSeekBackToStart)
 {
     createTestFile("\n\r");
-    fseekSetFailureCode(-1);
-    fseekSetCallsBeforeFailure(1);
+    lseekSetFailureCode(-1);
+    lseekSetCallsBeforeFailure(1);
     __try_and_catch( m_pTextFile = TextFile_CreateFromFile(NULL, toSizedString(tempFilename), NULL) );
-    fseekRestore();
+    lseekRestore();
     validateExceptionThrown(fileException);
 }
 
-TEST(TextFile, FailFTell)
+TEST(TextFile, FailRead)
 {
     createTestFile("\n\r");
-    ftellFail(-1);
+    readFail(-1);
     __try_and_catch( m_pTextFile = TextFile_CreateFromFile(NULL, toSizedString(tempFilename), NULL) );
-    ftellRestore();
-    validateExceptionThrown(fileException);
-}
-
-TEST(TextFile, FailFRead)
-{
-    createTestFile("\n\r");
-    freadFail(0);
-    __try_and_catch( m_pTextFile = TextFile_CreateFromFile(NULL, toSizedString(tempFilename), NULL) );
-    freadRestore();
+    readRestore();
     validateExceptionThrown(fileException);
 }
 
@@ -443,3 +435,32 @@ TEST(TextFile, AdvanceBaseFileToNonDerivedFileShouldThrow)
     LONGS_EQUAL(invalidArgumentException, getExceptionCode());
     clearExceptionCode();
 }
+
+TEST(TextFile, CreateFromMemoryVfs)
+{
+    static const char text[] = "Line 1\nLine 2\n";
+    SizedString       directory = SizedString_InitFromString("dir");
+    MemoryVfs*        pVfs = MemoryVfs_Create();
+
+    MemoryVfs_AddFile(pVfs, "dir" SLASH_STR "file.s", text, sizeof(text) - 1);
+    m_pTextFile = TextFile_CreateFromVfs((Vfs*)pVfs, &directory, toSizedString("file"), ".s");
+    Vfs_Free((Vfs*)pVfs);
+
+    STRCMP_EQUAL("dir" SLASH_STR "file.s", TextFile_GetFilename(m_pTextFile));
+    SizedString line = TextFile_GetNextLine(m_pTextFile);
+    CHECK(0 == SizedString_strcmp(&line, "Line 1"));
+    line = TextFile_GetNextLine(m_pTextFile);
+    CHECK(0 == SizedString_strcmp(&line, "Line 2"));
+    validateEndOfFileForNextLine();
+}
+
+TEST(TextFile, FailToOpenMissingFileInMemoryVfs)
+{
+    MemoryVfs* pVfs = MemoryVfs_Create();
+
+    __try_and_catch( m_pTextFile = TextFile_CreateFromVfs((Vfs*)pVfs, NULL, toSizedString("missing.s"), NULL) );
+    Vfs_Free((Vfs*)pVfs);
+    POINTERS_EQUAL(NULL, m_pTextFile);
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
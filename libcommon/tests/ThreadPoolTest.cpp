@@ -0,0 +1,190 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "ThreadPool.h"
+    #include "try_catch.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+#define ITEM_COUNT 1000
+
+#define NESTED_ITEM_COUNT 4
+
+#define BARRIER_THREAD_COUNT 8
+
+static unsigned int g_itemCounts[ITEM_COUNT];
+static int          g_exceptionCodes[ITEM_COUNT];
+static pthread_t    g_outerThreads[NESTED_ITEM_COUNT];
+static pthread_t    g_innerThreads[NESTED_ITEM_COUNT][NESTED_ITEM_COUNT];
+static size_t       g_arrivedCount;
+static __thread int g_itemsRunOnThisThread;
+
+
+static void countItem(void* pContext, size_t itemIndex)
+{
+    __sync_fetch_and_add(&g_itemCounts[itemIndex], 1);
+}
+
+static void throwAndCatchInItem(void* pContext, size_t itemIndex)
+{
+    __try
+    {
+        __throw((int)(itemIndex % 2 ? fileException : invalidArgumentException));
+    }
+    __catch
+    {
+        g_exceptionCodes[itemIndex] = getExceptionCode();
+        clearExceptionCode();
+    }
+}
+
+static void recordInnerThread(void* pContext, size_t itemIndex)
+{
+    size_t outerIndex = *(size_t*)pContext;
+
+    g_innerThreads[outerIndex][itemIndex] = pthread_self();
+    __sync_fetch_and_add(&g_itemCounts[outerIndex * NESTED_ITEM_COUNT + itemIndex], 1);
+}
+
+static void runNestedItems(void* pContext, size_t itemIndex)
+{
+    g_outerThreads[itemIndex] = pthread_self();
+    ThreadPool_Run(NESTED_ITEM_COUNT, recordInnerThread, &itemIndex);
+}
+
+static void recordEarlierItemsOnThreadOnceAllArrive(void* pContext, size_t itemIndex)
+{
+    /* No item finishes until one has started on every thread so each item is run on a different thread. */
+    g_itemCounts[itemIndex] = g_itemsRunOnThisThread++;
+    __sync_fetch_and_add(&g_arrivedCount, 1);
+    while (__sync_fetch_and_add(&g_arrivedCount, 0) < BARRIER_THREAD_COUNT)
+        sched_yield();
+}
+
+
+TEST_GROUP(ThreadPool)
+{
+    void setup()
+    {
+        clearExceptionCode();
+        memset(g_itemCounts, 0, sizeof(g_itemCounts));
+        memset(g_exceptionCodes, 0, sizeof(g_exceptionCodes));
+        g_arrivedCount = 0;
+    }
+
+    void teardown()
+    {
+        ThreadPool_SetThreadCount(0);
+        LONGS_EQUAL(noException, getExceptionCode());
+    }
+    
+    void validateEachItemRunOnce(size_t itemCount)
+    {
+        for (size_t i = 0 ; i < ITEM_COUNT ; i++)
+            LONGS_EQUAL((i < itemCount ? 1 : 0), g_itemCounts[i]);
+    }
+};
+
+
+TEST(ThreadPool, DefaultThreadCountIsAtLeastOne)
+{
+    CHECK(ThreadPool_GetThreadCount() >= 1);
+    CHECK(ThreadPool_GetThreadCount() <= (size_t)THREAD_POOL_MAX_THREADS);
+}
+
+TEST(ThreadPool, SetThreadCount)
+{
+    ThreadPool_SetThreadCount(3);
+    LONGS_EQUAL(3, ThreadPool_GetThreadCount());
+}
+
+TEST(ThreadPool, SetThreadCountIsLimitedToMaximum)
+{
+    ThreadPool_SetThreadCount(THREAD_POOL_MAX_THREADS + 1);
+    LONGS_EQUAL(THREAD_POOL_MAX_THREADS, ThreadPool_GetThreadCount());
+}
+
+TEST(ThreadPool, RunNoItems)
+{
+    ThreadPool_Run(0, countItem, NULL);
+    validateEachItemRunOnce(0);
+}
+
+TEST(ThreadPool, RunEachItemOnceOnSingleThread)
+{
+    ThreadPool_SetThreadCount(1);
+    ThreadPool_Run(ITEM_COUNT, countItem, NULL);
+    validateEachItemRunOnce(ITEM_COUNT);
+}
+
+TEST(ThreadPool, RunEachItemOnceOnManyThreads)
+{
+    ThreadPool_SetThreadCount(8);
+    ThreadPool_Run(ITEM_COUNT, countItem, NULL);
+    validateEachItemRunOnce(ITEM_COUNT);
+}
+
+TEST(ThreadPool, RunFewerItemsThanThreads)
+{
+    ThreadPool_SetThreadCount(8);
+    ThreadPool_Run(3, countItem, NULL);
+    validateEachItemRunOnce(3);
+}
+
+TEST(ThreadPool, ExceptionsThrownOnWorkerThreadsStayOnThatThread)
+{
+    ThreadPool_SetThreadCount(8);
+    ThreadPool_Run(ITEM_COUNT, throwAndCatchInItem, NULL);
+    for (size_t i = 0 ; i < ITEM_COUNT ; i++)
+        LONGS_EQUAL((i % 2 ? fileException : invalidArgumentException), g_exceptionCodes[i]);
+    POINTERS_EQUAL(NULL, g_pExceptionHandlers);
+}
+
+TEST(ThreadPool, NestedRunsStayOnTheirWorkerThread)
+{
+    ThreadPool_SetThreadCount(8);
+    ThreadPool_Run(NESTED_ITEM_COUNT, runNestedItems, NULL);
+    validateEachItemRunOnce(NESTED_ITEM_COUNT * NESTED_ITEM_COUNT);
+    for (size_t i = 0 ; i < NESTED_ITEM_COUNT ; i++)
+    {
+        for (size_t j = 0 ; j < NESTED_ITEM_COUNT ; j++)
+            CHECK_TRUE(pthread_equal(g_outerThreads[i], g_innerThreads[i][j]));
+    }
+}
+
+TEST(ThreadPool, LaterRunsReuseTheSameWorkerThreads)
+{
+    ThreadPool_SetThreadCount(BARRIER_THREAD_COUNT);
+    ThreadPool_Run(BARRIER_THREAD_COUNT, recordEarlierItemsOnThreadOnceAllArrive, NULL);
+    g_arrivedCount = 0;
+    ThreadPool_Run(BARRIER_THREAD_COUNT, recordEarlierItemsOnThreadOnceAllArrive, NULL);
+    for (size_t i = 0 ; i < BARRIER_THREAD_COUNT ; i++)
+        CHECK(g_itemCounts[i] >= 1);
+}
+
+TEST(ThreadPool, RunNestedInSingleItemRunCanStillUseManyThreads)
+{
+    ThreadPool_SetThreadCount(8);
+    ThreadPool_Run(1, runNestedItems, NULL);
+    validateEachItemRunOnce(NESTED_ITEM_COUNT);
+}
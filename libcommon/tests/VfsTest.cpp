@@ -0,0 +1,454 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include <sys/stat.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "Vfs.h"
+    #include "PosixVfs.h"
+    #include "MemoryVfs.h"
+    #include "MallocFailureInject.h"
+    #include "FileFailureInject.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+static const char g_testFilename[] = "VfsTest.bin";
+static const char g_renamedFilename[] = "VfsTestRenamed.bin";
+static const char g_testData[] = "0123456789";
+
+
+TEST_GROUP(Vfs)
+{
+    Vfs*       m_pVfs;
+    MemoryVfs* m_pMemoryVfs;
+    VfsFile*   m_pFile;
+    FILE*      m_pStream;
+    char       m_buffer[64];
+    
+    void setup()
+    {
+        clearExceptionCode();
+        m_pVfs = NULL;
+        m_pMemoryVfs = NULL;
+        m_pFile = NULL;
+        m_pStream = NULL;
+        memset(m_buffer, 0, sizeof(m_buffer));
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        writevRestore();
+        if (m_pStream)
+            fclose(m_pStream);
+        Vfs_CloseFile(m_pVfs, m_pFile);
+        Vfs_Free(m_pVfs);
+        remove(g_testFilename);
+        remove(g_renamedFilename);
+    }
+    
+    void createMemoryVfs()
+    {
+        m_pMemoryVfs = MemoryVfs_Create();
+        m_pVfs = (Vfs*)m_pMemoryVfs;
+    }
+    
+    void writeFile(const char* pFilename, const void* pData, size_t dataSize)
+    {
+        VfsBuffer buffer = { pData, dataSize };
+        
+        m_pFile = Vfs_OpenFile(m_pVfs, pFilename, "wb");
+        CHECK(NULL != m_pFile);
+        LONGS_EQUAL(dataSize, Vfs_WriteFile(m_pVfs, m_pFile, &buffer, 1));
+        closeFile();
+    }
+    
+    void validateFileContent(const char* pFilename, const void* pExpected, size_t expectedSize)
+    {
+        CHECK(expectedSize <= sizeof(m_buffer));
+        m_pFile = Vfs_OpenFile(m_pVfs, pFilename, "rb");
+        CHECK(NULL != m_pFile);
+        LONGS_EQUAL((long)expectedSize, Vfs_GetFileSize(m_pVfs, m_pFile));
+        LONGS_EQUAL(expectedSize, Vfs_ReadFile(m_pVfs, m_pFile, m_buffer, sizeof(m_buffer)));
+        CHECK(0 == memcmp(pExpected, m_buffer, expectedSize));
+        closeFile();
+    }
+    
+    void closeFile()
+    {
+        Vfs_CloseFile(m_pVfs, m_pFile);
+        m_pFile = NULL;
+    }
+    
+    void validateFileDoesNotExist(const char* pFilename)
+    {
+        m_pFile = Vfs_OpenFile(m_pVfs, pFilename, "rb");
+        POINTERS_EQUAL(NULL, m_pFile);
+    }
+    
+    void validateMemoryFileData(const char* pFilename, const char* pExpected)
+    {
+        size_t      dataSize = 0;
+        const void* pData = MemoryVfs_GetFileData(m_pMemoryVfs, pFilename, &dataSize);
+        
+        CHECK(NULL != pData);
+        LONGS_EQUAL(strlen(pExpected), dataSize);
+        CHECK(0 == memcmp(pExpected, pData, dataSize));
+    }
+};
+
+
+TEST(Vfs, NullVfsSelectsPosixFileSystem)
+{
+    writeFile(g_testFilename, g_testData, sizeof(g_testData));
+    
+    FILE* pFile = fopen(g_testFilename, "rb");
+    CHECK(NULL != pFile);
+    LONGS_EQUAL(sizeof(g_testData), fread(m_buffer, 1, sizeof(m_buffer), pFile));
+    fclose(pFile);
+    STRCMP_EQUAL(g_testData, m_buffer);
+}
+
+TEST(Vfs, FreeNullAndPosixVfsAreNoOps)
+{
+    Vfs_Free(NULL);
+    Vfs_Free(PosixVfs_Get());
+}
+
+TEST(Vfs, PosixOpenNonExistentFileForRead)
+{
+    validateFileDoesNotExist(g_testFilename);
+}
+
+TEST(Vfs, PosixGatherWriteAndReadBack)
+{
+    VfsBuffer buffers[3] = { { "012", 3 }, { "", 0 }, { "3456789", 8 } };
+    
+    m_pFile = Vfs_OpenFile(m_pVfs, g_testFilename, "wb");
+    LONGS_EQUAL(sizeof(g_testData), Vfs_WriteFile(m_pVfs, m_pFile, buffers, ARRAYSIZE(buffers)));
+    closeFile();
+    
+    validateFileContent(g_testFilename, g_testData, sizeof(g_testData));
+}
+
+TEST(Vfs, PosixFailGatherWrite)
+{
+    VfsBuffer buffer = { g_testData, sizeof(g_testData) };
+    
+    m_pFile = Vfs_OpenFile(m_pVfs, g_testFilename, "wb");
+    writevFail(-1);
+    LONGS_EQUAL(0, Vfs_WriteFile(m_pVfs, m_pFile, &buffer, 1));
+}
+
+TEST(Vfs, PosixSeekAndOverwriteInPlace)
+{
+    VfsBuffer buffer = { "ab", 2 };
+    
+    writeFile(g_testFilename, g_testData, 10);
+    m_pFile = Vfs_OpenFile(m_pVfs, g_testFilename, "r+b");
+    LONGS_EQUAL(0, Vfs_SeekFile(m_pVfs, m_pFile, 4));
+    LONGS_EQUAL(2, Vfs_WriteFile(m_pVfs, m_pFile, &buffer, 1));
+    closeFile();
+    
+    validateFileContent(g_testFilename, "0123ab6789", 10);
+}
+
+TEST(Vfs, PosixReadThenSeekAndOverwriteSeveralPlacesInLargeFile)
+{
+    static unsigned char data[3 * 4096];
+    static unsigned char expected[sizeof(data)];
+    VfsBuffer            buffer = { "ab", 2 };
+    
+    memset(data, '.', sizeof(data));
+    memcpy(expected, data, sizeof(expected));
+    memcpy(expected + 100, "ab", 2);
+    memcpy(expected + 6000, "ab", 2);
+    writeFile(g_testFilename, data, sizeof(data));
+    m_pFile = Vfs_OpenFile(m_pVfs, g_testFilename, "r+b");
+    LONGS_EQUAL(sizeof(data), Vfs_ReadFile(m_pVfs, m_pFile, data, sizeof(data)));
+    LONGS_EQUAL(0, Vfs_SeekFile(m_pVfs, m_pFile, 100));
+    LONGS_EQUAL(2, Vfs_WriteFile(m_pVfs, m_pFile, &buffer, 1));
+    LONGS_EQUAL(0, Vfs_SeekFile(m_pVfs, m_pFile, 6000));
+    LONGS_EQUAL(2, Vfs_WriteFile(m_pVfs, m_pFile, &buffer, 1));
+    closeFile();
+    
+    m_pFile = Vfs_OpenFile(m_pVfs, g_testFilename, "rb");
+    LONGS_EQUAL(sizeof(data), Vfs_ReadFile(m_pVfs, m_pFile, data, sizeof(data) + 1));
+    CHECK(0 == memcmp(expected, data, sizeof(data)));
+}
+
+TEST(Vfs, PosixFailSeek)
+{
+    writeFile(g_testFilename, g_testData, 10);
+    m_pFile = Vfs_OpenFile(m_pVfs, g_testFilename, "r+b");
+    lseekSetFailureCode(-1);
+    lseekSetCallsBeforeFailure(0);
+    CHECK(0 != Vfs_SeekFile(m_pVfs, m_pFile, 4));
+    lseekRestore();
+}
+
+TEST(Vfs, PosixRenameAndRemove)
+{
+    writeFile(g_testFilename, g_testData, sizeof(g_testData));
+    LONGS_EQUAL(0, Vfs_RenameFile(m_pVfs, g_testFilename, g_renamedFilename));
+    validateFileDoesNotExist(g_testFilename);
+    validateFileContent(g_renamedFilename, g_testData, sizeof(g_testData));
+    LONGS_EQUAL(0, Vfs_RemoveFile(m_pVfs, g_renamedFilename));
+    validateFileDoesNotExist(g_renamedFilename);
+}
+
+TEST(Vfs, PosixCopyFileMode)
+{
+    struct stat fileStat;
+    
+    writeFile(g_testFilename, g_testData, sizeof(g_testData));
+    writeFile(g_renamedFilename, g_testData, sizeof(g_testData));
+    LONGS_EQUAL(0, chmod(g_testFilename, 0604));
+    LONGS_EQUAL(0, Vfs_CopyFileMode(m_pVfs, g_testFilename, g_renamedFilename));
+    LONGS_EQUAL(0, stat(g_renamedFilename, &fileStat));
+    LONGS_EQUAL(0604, fileStat.st_mode & 07777);
+}
+
+TEST(Vfs, PosixCopyFileModeFromMissingFileLeavesModeAlone)
+{
+    struct stat fileStat;
+    
+    writeFile(g_renamedFilename, g_testData, sizeof(g_testData));
+    LONGS_EQUAL(0, chmod(g_renamedFilename, 0640));
+    LONGS_EQUAL(0, Vfs_CopyFileMode(m_pVfs, g_testFilename, g_renamedFilename));
+    LONGS_EQUAL(0, stat(g_renamedFilename, &fileStat));
+    LONGS_EQUAL(0640, fileStat.st_mode & 07777);
+}
+
+TEST(Vfs, PosixFailCopyFileModeToMissingFile)
+{
+    writeFile(g_testFilename, g_testData, sizeof(g_testData));
+    CHECK(0 != Vfs_CopyFileMode(m_pVfs, g_testFilename, g_renamedFilename));
+}
+
+TEST(Vfs, MemoryVfsCreateStartsEmpty)
+{
+    createMemoryVfs();
+    LONGS_EQUAL(0, MemoryVfs_GetFileCount(m_pMemoryVfs));
+    validateFileDoesNotExist(g_testFilename);
+}
+
+TEST(Vfs, MemoryVfsFailCreate)
+{
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( createMemoryVfs() );
+    LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+    POINTERS_EQUAL(NULL, m_pVfs);
+    clearExceptionCode();
+}
+
+TEST(Vfs, MemoryVfsWriteAndReadBackWithoutTouchingDisk)
+{
+    createMemoryVfs();
+    writeFile(g_testFilename, g_testData, sizeof(g_testData));
+    validateFileContent(g_testFilename, g_testData, sizeof(g_testData));
+    LONGS_EQUAL(1, MemoryVfs_GetFileCount(m_pMemoryVfs));
+    
+    POINTERS_EQUAL(NULL, fopen(g_testFilename, "rb"));
+}
+
+TEST(Vfs, MemoryVfsGatherWriteGrowsFile)
+{
+    char      largeData[1000];
+    VfsBuffer buffers[2] = { { g_testData, 10 }, { largeData, sizeof(largeData) } };
+    size_t    dataSize = 0;
+    
+    memset(largeData, 0xa5, sizeof(largeData));
+    createMemoryVfs();
+    m_pFile = Vfs_OpenFile(m_pVfs, g_testFilename, "wb");
+    LONGS_EQUAL(10 + sizeof(largeData), Vfs_WriteFile(m_pVfs, m_pFile, buffers, ARRAYSIZE(buffers)));
+    closeFile();
+    
+    const unsigned char* pData = (const unsigned char*)MemoryVfs_GetFileData(m_pMemoryVfs, g_testFilename, &dataSize);
+    LONGS_EQUAL(10 + sizeof(largeData), dataSize);
+    CHECK(0 == memcmp(g_testData, pData, 10));
+    CHECK(0 == memcmp(largeData, pData + 10, sizeof(largeData)));
+}
+
+TEST(Vfs, MemoryVfsFailGrowingFile)
+{
+    VfsBuffer buffer = { g_testData, sizeof(g_testData) };
+    
+    createMemoryVfs();
+    m_pFile = Vfs_OpenFile(m_pVfs, g_testFilename, "wb");
+    MallocFailureInject_FailAllocation(1);
+    LONGS_EQUAL(0, Vfs_WriteFile(m_pVfs, m_pFile, &buffer, 1));
+}
+
+TEST(Vfs, MemoryVfsFailAllocationsDuringOpen)
+{
+    createMemoryVfs();
+    for (int i = 1 ; i <= 3 ; i++)
+    {
+        MallocFailureInject_FailAllocation(i);
+        POINTERS_EQUAL(NULL, Vfs_OpenFile(m_pVfs, g_testFilename, "wb"));
+    }
+    MallocFailureInject_Restore();
+}
+
+TEST(Vfs, MemoryVfsOpenForWriteTruncatesExistingFile)
+{
+    createMemoryVfs();
+    writeFile(g_testFilename, g_testData, sizeof(g_testData));
+    writeFile(g_testFilename, "ab", 2);
+    validateFileContent(g_testFilename, "ab", 2);
+    LONGS_EQUAL(1, MemoryVfs_GetFileCount(m_pMemoryVfs));
+}
+
+TEST(Vfs, MemoryVfsSeekAndOverwriteInPlace)
+{
+    VfsBuffer buffer = { "ab", 2 };
+    
+    createMemoryVfs();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_testFilename, g_testData, 10);
+    m_pFile = Vfs_OpenFile(m_pVfs, g_testFilename, "r+b");
+    LONGS_EQUAL(0, Vfs_SeekFile(m_pVfs, m_pFile, 4));
+    LONGS_EQUAL(2, Vfs_WriteFile(m_pVfs, m_pFile, &buffer, 1));
+    closeFile();
+    
+    validateMemoryFileData(g_testFilename, "0123ab6789");
+}
+
+TEST(Vfs, MemoryVfsSeekPastEndOfFileZeroFillsGapOnWrite)
+{
+    VfsBuffer buffer = { "ab", 2 };
+    
+    createMemoryVfs();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_testFilename, g_testData, 2);
+    m_pFile = Vfs_OpenFile(m_pVfs, g_testFilename, "r+b");
+    LONGS_EQUAL(0, Vfs_SeekFile(m_pVfs, m_pFile, 4));
+    LONGS_EQUAL(2, Vfs_WriteFile(m_pVfs, m_pFile, &buffer, 1));
+    closeFile();
+    
+    validateFileContent(g_testFilename, "01\0\0ab", 6);
+}
+
+TEST(Vfs, MemoryVfsFailNegativeSeek)
+{
+    createMemoryVfs();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_testFilename, g_testData, 10);
+    m_pFile = Vfs_OpenFile(m_pVfs, g_testFilename, "rb");
+    CHECK(0 != Vfs_SeekFile(m_pVfs, m_pFile, -1));
+}
+
+TEST(Vfs, MemoryVfsFilenamesAreCaseInsensitive)
+{
+    createMemoryVfs();
+    MemoryVfs_AddFile(m_pMemoryVfs, "SOURCE.S", g_testData, sizeof(g_testData));
+    validateFileContent("source.s", g_testData, sizeof(g_testData));
+}
+
+TEST(Vfs, MemoryVfsShortReadAtEndOfFile)
+{
+    createMemoryVfs();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_testFilename, g_testData, 4);
+    m_pFile = Vfs_OpenFile(m_pVfs, g_testFilename, "rb");
+    LONGS_EQUAL(3, Vfs_ReadFile(m_pVfs, m_pFile, m_buffer, 3));
+    LONGS_EQUAL(1, Vfs_ReadFile(m_pVfs, m_pFile, m_buffer, 3));
+    LONGS_EQUAL(0, Vfs_ReadFile(m_pVfs, m_pFile, m_buffer, 3));
+    LONGS_EQUAL(4, Vfs_GetFileSize(m_pVfs, m_pFile));
+    LONGS_EQUAL(3, Vfs_ReadFile(m_pVfs, m_pFile, m_buffer, 3));
+}
+
+TEST(Vfs, MemoryVfsFailAddFile)
+{
+    createMemoryVfs();
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( MemoryVfs_AddFile(m_pMemoryVfs, g_testFilename, g_testData, sizeof(g_testData)) );
+    LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(Vfs, MemoryVfsGetDataOfEmptyAndMissingFiles)
+{
+    size_t dataSize = 1;
+    
+    createMemoryVfs();
+    POINTERS_EQUAL(NULL, MemoryVfs_GetFileData(m_pMemoryVfs, g_testFilename, &dataSize));
+    MemoryVfs_AddFile(m_pMemoryVfs, g_testFilename, NULL, 0);
+    CHECK(NULL != MemoryVfs_GetFileData(m_pMemoryVfs, g_testFilename, &dataSize));
+    LONGS_EQUAL(0, dataSize);
+}
+
+TEST(Vfs, MemoryVfsRenameReplacesExistingFile)
+{
+    createMemoryVfs();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_testFilename, g_testData, sizeof(g_testData));
+    MemoryVfs_AddFile(m_pMemoryVfs, g_renamedFilename, "old", 3);
+    LONGS_EQUAL(0, Vfs_RenameFile(m_pVfs, g_testFilename, g_renamedFilename));
+    LONGS_EQUAL(1, MemoryVfs_GetFileCount(m_pMemoryVfs));
+    validateFileDoesNotExist(g_testFilename);
+    validateFileContent(g_renamedFilename, g_testData, sizeof(g_testData));
+}
+
+TEST(Vfs, MemoryVfsFailRename)
+{
+    createMemoryVfs();
+    LONGS_EQUAL(-1, Vfs_RenameFile(m_pVfs, g_testFilename, g_renamedFilename));
+    MemoryVfs_AddFile(m_pMemoryVfs, g_testFilename, g_testData, sizeof(g_testData));
+    MallocFailureInject_FailAllocation(1);
+    LONGS_EQUAL(-1, Vfs_RenameFile(m_pVfs, g_testFilename, g_renamedFilename));
+    MallocFailureInject_Restore();
+    validateFileContent(g_testFilename, g_testData, sizeof(g_testData));
+}
+
+TEST(Vfs, MemoryVfsCopyFileModeDoesNothing)
+{
+    createMemoryVfs();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_testFilename, g_testData, sizeof(g_testData));
+    LONGS_EQUAL(0, Vfs_CopyFileMode(m_pVfs, g_testFilename, g_renamedFilename));
+    LONGS_EQUAL(1, MemoryVfs_GetFileCount(m_pMemoryVfs));
+}
+
+TEST(Vfs, MemoryVfsRemoveFile)
+{
+    createMemoryVfs();
+    LONGS_EQUAL(-1, Vfs_RemoveFile(m_pVfs, g_testFilename));
+    MemoryVfs_AddFile(m_pMemoryVfs, g_renamedFilename, "a", 1);
+    MemoryVfs_AddFile(m_pMemoryVfs, g_testFilename, g_testData, sizeof(g_testData));
+    LONGS_EQUAL(0, Vfs_RemoveFile(m_pVfs, g_renamedFilename));
+    LONGS_EQUAL(1, MemoryVfs_GetFileCount(m_pMemoryVfs));
+    validateFileDoesNotExist(g_renamedFilename);
+    validateFileContent(g_testFilename, g_testData, sizeof(g_testData));
+}
+
+TEST(Vfs, MemoryVfsStreamOutputLandsInMemoryFile)
+{
+    createMemoryVfs();
+    m_pStream = Vfs_OpenStream(m_pVfs, g_testFilename);
+    CHECK(NULL != m_pStream);
+    fputs("Hello ", m_pStream);
+    fputs("World", m_pStream);
+    fclose(m_pStream);
+    m_pStream = NULL;
+    
+    validateMemoryFileData(g_testFilename, "Hello World");
+}
+
+TEST(Vfs, MemoryVfsFailOpenStream)
+{
+    createMemoryVfs();
+    MallocFailureInject_FailAllocation(1);
+    POINTERS_EQUAL(NULL, Vfs_OpenStream(m_pVfs, g_testFilename));
+}
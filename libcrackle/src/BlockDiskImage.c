@@ -27,11 +27,15 @@ struct BlockDiskImage
 
 
 static void freeObject(void* pThis);
-static void insertData(void* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
+static void insertData(void* pThis, const unsigned char* pData, DiskImageInsert* pInsert, DiskImageStats* pStats);
+static void flushImage(void* pThis);
+static void getInsertRegions(void* pThis, DiskImageInsert* pInsert, unsigned int* pFirstRegion, unsigned int* pLastRegion);
 struct DiskImageVTable BlockDiskImageVTable = 
 { 
     freeObject,
-    insertData 
+    insertData,
+    flushImage,
+    getInsertRegions
 };
 
 
@@ -42,7 +46,7 @@ __throws BlockDiskImage* BlockDiskImage_Create(unsigned int blockCount)
     __try
     {
         pThis = allocateAndZero(sizeof(*pThis));
-        DiskImage_Init(&pThis->super, &BlockDiskImageVTable, blockCount * DISK_IMAGE_BLOCK_SIZE);
+        DiskImage_Init(&pThis->super, &BlockDiskImageVTable, blockCount * DISK_IMAGE_BLOCK_SIZE, DISK_IMAGE_BLOCK_SIZE);
     }
     __catch
     {
@@ -59,6 +63,12 @@ static void freeObject(void* pThis)
 }
 
 
+static void flushImage(void* pThis)
+{
+    /* Blocks are copied straight into the image as they are inserted so there is nothing left to encode. */
+}
+
+
 __throws void BlockDiskImage_ProcessScriptFile(BlockDiskImage* pThis, const char* pScriptFilename)
 {
     DiskImage_ProcessScriptFile(&pThis->super, pScriptFilename);
@@ -89,7 +99,7 @@ __throws void BlockDiskImage_InsertObjectFile(BlockDiskImage* pThis, DiskImageIn
 }
 
 
-static void insertData(void* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
+static void insertData(void* pThis, const unsigned char* pData, DiskImageInsert* pInsert, DiskImageStats* pStats)
 {
     BlockDiskImage_InsertData((BlockDiskImage*)pThis, pData, pInsert);
 }
@@ -192,6 +202,26 @@ static unsigned int calculateSourceOffset(DiskImageInsert* pInsert)
 }
 
 
+static void getInsertRegions(void* pThis, DiskImageInsert* pInsert, unsigned int* pFirstRegion, unsigned int* pLastRegion)
+{
+    /* Each block is a region.  The insertion is validated the same way as insertData() would. */
+    DiskImageInsert insert = *pInsert;
+    unsigned int    startOffset;
+    
+    if (insert.type == DISK_IMAGE_INSERTION_RW18)
+    {
+        validateRW18InsertionProperties(pInsert);
+        insert = convertRW18SideTrackSectorToBlockAndOffset(pInsert);
+    }
+    validateOffsetTypeIsBlock(&insert);
+    validateImageOffsets((BlockDiskImage*)pThis, &insert);
+    
+    startOffset = calculateSourceOffset(&insert);
+    *pFirstRegion = insert.block;
+    *pLastRegion = insert.length ? (startOffset + insert.length - 1) / DISK_IMAGE_BLOCK_SIZE : insert.block;
+}
+
+
 __throws void BlockDiskImage_WriteImage(BlockDiskImage* pThis, const char* pImageFilename)
 {
     DiskImage_WriteImage(&pThis->super, pImageFilename);
@@ -42,28 +42,29 @@ void ByteBuffer_Free(ByteBuffer* pThis)
 }
 
 
-__throws void ByteBuffer_WriteToFile(ByteBuffer* pThis, FILE* pFile)
+__throws void ByteBuffer_WriteToFile(ByteBuffer* pThis, Vfs* pVfs, VfsFile* pFile)
 {
-    size_t bytesWritten = fwrite(pThis->pBuffer, 1, pThis->bufferSize, pFile);
+    VfsBuffer buffer = { pThis->pBuffer, pThis->bufferSize };
+    size_t    bytesWritten = Vfs_WriteFile(pVfs, pFile, &buffer, 1);
     if (bytesWritten != pThis->bufferSize)
         __throw(fileException);
 }
 
 
-__throws void ByteBuffer_ReadFromFile(ByteBuffer* pThis, FILE* pFile)
+__throws void ByteBuffer_ReadFromFile(ByteBuffer* pThis, Vfs* pVfs, VfsFile* pFile)
 {
-    ByteBuffer_ReadPartialFromFile(pThis, pThis->bufferSize, pFile);
+    ByteBuffer_ReadPartialFromFile(pThis, pThis->bufferSize, pVfs, pFile);
 }
 
 
-__throws void ByteBuffer_ReadPartialFromFile(ByteBuffer* pThis, unsigned int bytesToRead, FILE* pFile)
+__throws void ByteBuffer_ReadPartialFromFile(ByteBuffer* pThis, unsigned int bytesToRead, Vfs* pVfs, VfsFile* pFile)
 {
     size_t bytesRead;
     
     if (bytesToRead > pThis->bufferSize)
         __throw(invalidArgumentException);
         
-    bytesRead = fread(pThis->pBuffer, 1, bytesToRead, pFile);
+    bytesRead = Vfs_ReadFile(pVfs, pFile, pThis->pBuffer, bytesToRead);
     if (bytesRead != bytesToRead)
         __throw(fileException);
 }
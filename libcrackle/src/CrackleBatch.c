@@ -0,0 +1,334 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include <sys/time.h>
+#include "CrackleBatch.h"
+#include "CrackleBatchTest.h"
+#include "NibbleDiskImage.h"
+#include "BlockDiskImage.h"
+#include "TextFile.h"
+#include "ParseCSV.h"
+#include "ThreadPool.h"
+#include "util.h"
+
+
+#define LOG_ERROR(pBATCHFILENAME, LINENUMBER, FORMAT, ...) fprintf(stderr, \
+                                                                   "%s:%u: error: " FORMAT LINE_ENDING, \
+                                                                   pBATCHFILENAME, \
+                                                                   LINENUMBER, \
+                                                                   __VA_ARGS__)
+
+
+static void parseBatchFile(CrackleBatch* pThis, const char* pBatchFilename);
+static void createDiskImages(CrackleBatch* pThis);
+__throws CrackleBatch* CrackleBatch_Create(Vfs* pVfs, const char* pBatchFilename)
+{
+    CrackleBatch* pThis = NULL;
+
+    __try
+    {
+        pThis = allocateAndZero(sizeof(*pThis));
+        pThis->pVfs = pVfs;
+        parseBatchFile(pThis, pBatchFilename);
+        createDiskImages(pThis);
+    }
+    __catch
+    {
+        CrackleBatch_Free(pThis);
+        __rethrow;
+    }
+
+    return pThis;
+}
+
+static int  isBlankOrComment(const SizedString* pLine);
+static void parseBatchLine(CrackleBatch*      pThis,
+                           ParseCSV*          pParser,
+                           const SizedString* pLine,
+                           const char*        pBatchFilename,
+                           unsigned int       lineNumber);
+static CrackleImageFormat parseImageFormat(const SizedString* pFormat);
+static CrackleBatchImage* addImage(CrackleBatch* pThis);
+static void parseBatchFile(CrackleBatch* pThis, const char* pBatchFilename)
+{
+    /* Every line is checked before any error is thrown so that all of the problems in the batch file are reported
+       at once. */
+    SizedString  batchFilename = SizedString_InitFromString(pBatchFilename);
+    TextFile*    pTextFile = NULL;
+    ParseCSV*    pParser = NULL;
+    unsigned int errorCount = 0;
+
+    __try
+    {
+        pTextFile = TextFile_CreateFromVfs(pThis->pVfs, NULL, &batchFilename, NULL);
+        pParser = ParseCSV_Create();
+        while (!TextFile_IsEndOfFile(pTextFile))
+        {
+            SizedString nextLine = TextFile_GetNextLine(pTextFile);
+
+            if (isBlankOrComment(&nextLine))
+                continue;
+            __try
+            {
+                parseBatchLine(pThis, pParser, &nextLine, pBatchFilename, TextFile_GetLineNumber(pTextFile));
+            }
+            __catch
+            {
+                if (getExceptionCode() == outOfMemoryException)
+                    __rethrow;
+                clearExceptionCode();
+                errorCount++;
+            }
+        }
+        if (errorCount > 0)
+            __throw(invalidArgumentException);
+    }
+    __catch
+    {
+        if (getExceptionCode() == fileOpenException)
+            fprintf(stderr, "error: Failed to open %s batch file." LINE_ENDING, pBatchFilename);
+    }
+    ParseCSV_Free(pParser);
+    TextFile_Free(pTextFile);
+    if (getExceptionCode() != noException)
+        __rethrow;
+}
+
+static int isBlankOrComment(const SizedString* pLine)
+{
+    return SizedString_strlen(pLine) == 0 || pLine->pString[0] == '#';
+}
+
+static void parseBatchLine(CrackleBatch*      pThis,
+                           ParseCSV*          pParser,
+                           const SizedString* pLine,
+                           const char*        pBatchFilename,
+                           unsigned int       lineNumber)
+{
+    const SizedString* pFields;
+    CrackleBatchImage* pImage;
+    CrackleImageFormat imageFormat;
+
+    ParseCSV_Parse(pParser, pLine);
+    pFields = ParseCSV_FieldPointers(pParser);
+    if (ParseCSV_FieldCount(pParser) != 3)
+    {
+        LOG_ERROR(pBatchFilename, lineNumber, "%s",
+                  "Line should be of the form image_format,scriptFilename,outputImageFilename.");
+        __throw(invalidArgumentCountException);
+    }
+    imageFormat = parseImageFormat(&pFields[0]);
+    if (imageFormat == FORMAT_UNKNOWN)
+    {
+        LOG_ERROR(pBatchFilename, lineNumber, "%.*s isn't a recognized image format of nib_5.25 or hdv_3.5.",
+                  pFields[0].stringLength, pFields[0].pString);
+        __throw(invalidArgumentException);
+    }
+
+    pImage = addImage(pThis);
+    pImage->imageFormat = imageFormat;
+    pImage->pScriptFilename = SizedString_strdup(&pFields[1]);
+    pImage->pOutputImageFilename = SizedString_strdup(&pFields[2]);
+}
+
+static CrackleImageFormat parseImageFormat(const SizedString* pFormat)
+{
+    if (0 == SizedString_strcasecmp(pFormat, "nib_5.25"))
+        return FORMAT_NIB_5_25;
+    else if (0 == SizedString_strcasecmp(pFormat, "hdv_3.5"))
+        return FORMAT_HDV_3_5;
+    else
+        return FORMAT_UNKNOWN;
+}
+
+static CrackleBatchImage* addImage(CrackleBatch* pThis)
+{
+    CrackleBatchImage* pRealloc = realloc(pThis->pImages, (pThis->imageCount + 1) * sizeof(*pRealloc));
+    CrackleBatchImage* pImage;
+
+    if (!pRealloc)
+        __throw(outOfMemoryException);
+    pThis->pImages = pRealloc;
+    pImage = &pThis->pImages[pThis->imageCount++];
+    memset(pImage, 0, sizeof(*pImage));
+
+    return pImage;
+}
+
+static DiskImage* createDiskImage(CrackleImageFormat imageFormat);
+static void createDiskImages(CrackleBatch* pThis)
+{
+    size_t i;
+
+    for (i = 0 ; i < pThis->imageCount ; i++)
+    {
+        CrackleBatchImage* pImage = &pThis->pImages[i];
+
+        pImage->pDiskImage = createDiskImage(pImage->imageFormat);
+        DiskImage_SetVfs(pImage->pDiskImage, pThis->pVfs);
+    }
+}
+
+static DiskImage* createDiskImage(CrackleImageFormat imageFormat)
+{
+    if (imageFormat == FORMAT_NIB_5_25)
+        return (DiskImage*) NibbleDiskImage_Create();
+    else
+        return (DiskImage*) BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+}
+
+
+void CrackleBatch_Free(CrackleBatch* pThis)
+{
+    size_t i;
+
+    if (!pThis)
+        return;
+
+    for (i = 0 ; i < pThis->imageCount ; i++)
+    {
+        CrackleBatchImage* pImage = &pThis->pImages[i];
+
+        DiskImage_Free(pImage->pDiskImage);
+        free(pImage->pScriptFilename);
+        free(pImage->pOutputImageFilename);
+    }
+    free(pThis->pImages);
+    DiskImageObjectCache_Free(pThis->pObjectCache);
+    free(pThis);
+}
+
+
+__throws void CrackleBatch_OpenBundle(CrackleBatch* pThis, const char* pBundleFilename)
+{
+    size_t i;
+
+    for (i = 0 ; i < pThis->imageCount ; i++)
+        DiskImage_OpenBundle(pThis->pImages[i].pDiskImage, pBundleFilename);
+}
+
+
+static double getSeconds(void);
+static void   prefetchObjectsForAllScripts(CrackleBatch* pThis);
+static void   shareObjectCacheWithAllImages(CrackleBatch* pThis);
+static void   buildImage(void* pvBatch, size_t imageIndex);
+static void   countFailedImages(CrackleBatch* pThis);
+void CrackleBatch_Run(CrackleBatch* pThis)
+{
+    /* The object files for every script are read up front into a cache which the images then only ever read from
+       while they are built concurrently.  Objects which fail to prefetch are read (and any error reported) by the
+       image which needs them.  Unlike most ThreadPool callbacks, buildImage() allocates and logs, so tests run it
+       with a single thread to keep the malloc and printf spies safe. */
+    double startTime = getSeconds();
+
+    if (pThis->imageCount > 0)
+    {
+        prefetchObjectsForAllScripts(pThis);
+        shareObjectCacheWithAllImages(pThis);
+    }
+    ThreadPool_Run(pThis->imageCount, buildImage, pThis);
+    countFailedImages(pThis);
+    pThis->elapsedSeconds = getSeconds() - startTime;
+}
+
+static double getSeconds(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (double)now.tv_sec + (double)now.tv_usec / 1000000.0;
+}
+
+static void prefetchObjectsForAllScripts(CrackleBatch* pThis)
+{
+    DiskImage* pDiskImage = pThis->pImages[0].pDiskImage;
+    size_t     i;
+
+    for (i = 0 ; i < pThis->imageCount ; i++)
+    {
+        __try
+        {
+            DiskImage_PrefetchScriptObjects(pDiskImage, pThis->pImages[i].pScriptFilename);
+        }
+        __catch
+        {
+            clearExceptionCode();
+        }
+    }
+}
+
+static void shareObjectCacheWithAllImages(CrackleBatch* pThis)
+{
+    /* If the cache can't be detached then the prefetched objects just stay with the first image. */
+    size_t i;
+
+    __try
+    {
+        pThis->pObjectCache = DiskImage_DetachObjectCache(pThis->pImages[0].pDiskImage);
+    }
+    __catch
+    {
+        clearExceptionCode();
+        return;
+    }
+
+    for (i = 0 ; i < pThis->imageCount ; i++)
+        DiskImage_ShareObjectCache(pThis->pImages[i].pDiskImage, pThis->pObjectCache);
+}
+
+static void buildImage(void* pvBatch, size_t imageIndex)
+{
+    CrackleBatch*      pThis = (CrackleBatch*)pvBatch;
+    CrackleBatchImage* pImage = &pThis->pImages[imageIndex];
+    double             startTime = getSeconds();
+
+    __try
+    {
+        DiskImage_MapOutputImage(pImage->pDiskImage, pImage->pOutputImageFilename);
+        DiskImage_ProcessScriptFile(pImage->pDiskImage, pImage->pScriptFilename);
+        DiskImage_WriteImage(pImage->pDiskImage, pImage->pOutputImageFilename);
+    }
+    __catch
+    {
+        pImage->exceptionCode = getExceptionCode();
+        clearExceptionCode();
+    }
+    pImage->scriptErrorCount = DiskImage_GetScriptErrorCount(pImage->pDiskImage);
+    pImage->buildSeconds = getSeconds() - startTime;
+}
+
+static void countFailedImages(CrackleBatch* pThis)
+{
+    size_t i;
+
+    pThis->failedCount = 0;
+    for (i = 0 ; i < pThis->imageCount ; i++)
+    {
+        CrackleBatchImage* pImage = &pThis->pImages[i];
+
+        if (pImage->exceptionCode != noException || pImage->scriptErrorCount > 0)
+            pThis->failedCount++;
+    }
+}
+
+
+double CrackleBatch_GetTotalBuildSeconds(CrackleBatch* pThis)
+{
+    double totalSeconds = 0.0;
+    size_t i;
+
+    for (i = 0 ; i < pThis->imageCount ; i++)
+        totalSeconds += pThis->pImages[i].buildSeconds;
+
+    return totalSeconds;
+}
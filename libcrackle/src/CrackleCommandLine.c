@@ -12,8 +12,10 @@
 */
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "CrackleCommandLine.h"
 #include "CrackleCommandLineTest.h"
+#include "DiskImage.h"
 #include "version.h"
 
 static void displayCopyrightNotice(void)
@@ -25,17 +27,105 @@ static void displayCopyrightNotice(void)
 
 static void displayUsage(void)
 {
-    printf("Usage: crackle --format image_format scriptFilename outputImageFilename\n\n"
+    printf("Usage: crackle --format image_format [--bundle bundleFilename]\n"
+           "               [--update] [--manifest manifestFilename]\n"
+           "               scriptFilename outputImageFilename\n"
+           "       crackle --format image_format [--format image_format]...\n"
+           "               [--bundle bundleFilename]\n"
+           "               scriptFilename outputImageFilename...\n"
+           "       crackle --format nib_5.25 --sides side[,side]...\n"
+           "               [--bundle bundleFilename]\n"
+           "               scriptFilename outputImageFilename...\n"
+           "       crackle --batch batchFilename [--bundle bundleFilename]\n"
+           "       crackle --extract imageFilename [outputFilename]\n"
+           "       crackle --format image_format --delta-from previousImageFilename\n"
+           "               [--bundle bundleFilename]\n"
+           "               scriptFilename deltaFilename\n"
+           "       crackle --apply-delta deltaFilename imageFilename\n"
+           "       crackle --plan loadSequenceFilename [--bundle bundleFilename]\n"
+           "               scriptFilename\n"
+           "       crackle --tune-interleave cyclesPerSector\n"
+           "       crackle --simulate traceFilename imageFilename\n"
+           "       Any of the builds above can also be given --stats text|json.\n\n"
            "Where: --format image_format indicates the type outputImage is to be\n"
            "         created.  image_format can be one of:\n"
            "           nib_5.25 - creates a .nib nibble image for a 5 1/4\" disk.\n"
            "           hdv_3.5 - creates a .HDV block image for a 3 1/2\" disk.\n"
+           "         Up to 4 formats can be given, each with its own\n"
+           "         outputImageFilename in the same order.  The script is then\n"
+           "         only parsed once for all of the images.\n"
+           "       --sides side[,side]... builds a nib_5.25 image for each of the\n"
+           "         listed RW18 sides (0xa9, 0xad, 0x79), each with its own\n"
+           "         outputImageFilename in the same order.  RW18 lines go to the\n"
+           "         image for their side and other lines go to the first image.\n"
+           "       --bundle bundleFilename is an object bundle written by snap's\n"
+           "         --bundle option.  Script lines can then use bundle:name as the\n"
+           "         objectFilename to insert the named object from the bundle.\n"
+           "       --update patches an existing outputImageFilename in place, only\n"
+           "         rewriting the tracks/blocks which differ from the new build.\n"
+           "       --manifest manifestFilename records each insertion made by the\n"
+           "         script.  When used with --update, script lines which only\n"
+           "         touch tracks/blocks unchanged since the manifest was written\n"
+           "         are skipped.\n"
+           "       --batch batchFilename builds every image listed in batchFilename\n"
+           "         concurrently, reading each object file only once.  Each line\n"
+           "         of the batch file has the form:\n"
+           "           image_format,scriptFilename,outputImageFilename\n"
+           "       --extract imageFilename decodes every track of a .nib image, or\n"
+           "         every block of a .hdv image, and reports any which fail to\n"
+           "         decode.  The decoded contents are written to outputFilename\n"
+           "         if given, with 4608 bytes per .nib track.  RWTS16 physical\n"
+           "         sector n is at offset n * 256 of its track.\n"
+           "       --delta-from previousImageFilename writes deltaFilename with\n"
+           "         just the bytes which differ between previousImageFilename and\n"
+           "         the newly built image, instead of writing the image itself.\n"
+           "       --apply-delta deltaFilename patches imageFilename in place with\n"
+           "         a delta written by --delta-from.  imageFilename must be the\n"
+           "         previousImageFilename that the delta was computed from.\n"
+           "       --plan loadSequenceFilename assigns an RW18 side, track, and\n"
+           "         offset to each object in the order the game loads them so\n"
+           "         as to keep head seeks and partly used tracks to a minimum.\n"
+           "         The placements are written to scriptFilename and the\n"
+           "         estimated head travel is reported.  Each line of the load\n"
+           "         sequence has one of these forms:\n"
+           "           SIDES,side[,side]...\n"
+           "           TRACKS,firstTrack,lastTrack\n"
+           "           LOAD,objectFilename[,objectFilename]...\n"
+           "       --tune-interleave cyclesPerSector simulates a loader which\n"
+           "         reads an RWTS16 track in logical sector order, spending\n"
+           "         cyclesPerSector 6502 cycles on each sector, and recommends\n"
+           "         the skew which wastes the least time waiting for sectors.\n"
+           "       --simulate traceFilename estimates how long the Disk II takes\n"
+           "         to make the reads listed in traceFilename from the .nib\n"
+           "         imageFilename, reporting the time spent stepping, settling,\n"
+           "         waiting for sectors, reading, and processing.  It fails if\n"
+           "         the trace's BUDGET is exceeded.  Each line of the trace has\n"
+           "         one of these forms, with times in microseconds:\n"
+           "           RWTS16,track,sector|*\n"
+           "           RW18,side,track,page|*\n"
+           "           STEP,usPerQuarterTrack (default 1500)\n"
+           "           SETTLE,us (default 10000)\n"
+           "           ROTATION,us (default 200000)\n"
+           "           PROCESS,usPerSector (default 0)\n"
+           "           BUDGET,us\n"
+           "       --stats text|json reports how many objects were read, tracks\n"
+           "         and sectors encoded, and bytes written, along with the time\n"
+           "         spent parsing the script, reading objects, encoding, and\n"
+           "         writing.  json is meant to be tracked by scripts.\n"
            "       scriptFilename is the name of the input script to be used\n"
            "         for placing data in the image file.  Each line should meet\n"
            "         one of these formats:\n"
-           "           BLOCK,objectFilename,startOffset,length,block[,intraBlockOffset]\n"
-           "           RWTS16,objectFilename,startOffset,length,track,sector\n"
-           "           RW18,objectFilename,startOffset,length,side,track,intraTrackOffset[,imageTableAddress]\n"
+           "           BLOCK,objectFilename,startOffset,length,block[,intraBlockOffset][,compress]\n"
+           "           RWTS16,objectFilename,startOffset,length,track,sector[,interleave][,compress]\n"
+           "           RW18,objectFilename,startOffset,length,side,track,intraTrackOffset[,imageTableAddress][,compress]\n"
+           "           INTERLEAVE,interleave\n"
+           "         RWTS16 sectors are logical sectors which are mapped onto\n"
+           "         physical sectors by the line's interleave, or else by the\n"
+           "         last INTERLEAVE line.  interleave can be identity (the\n"
+           "         default), dos3.3, prodos, skew:n for n of 1 - 15, or 16\n"
+           "         hex digits giving the physical sector of each logical sector.\n"
+           "         compress stores the slice compressed, to be expanded by the\n"
+           "         6502 decompressor in asm/unlz.S.\n"
            "       outputImageFilename is the name of the image to be created by\n"
            "           this tool.\n\n");
 }
@@ -45,6 +135,10 @@ static int parseArgument(CrackleCommandLine* pThis, int argc, const char** ppArg
 static int hasDoubleDashPrefix(const char* pArgument);
 static int parseFlagArgument(CrackleCommandLine* pThis, int argc, const char** ppArgs);
 static void parseFormat(CrackleCommandLine* pThis, int argc, const char* pFormat);
+static void parseSides(CrackleCommandLine* pThis, int argc, const char* pSides);
+static void parseStats(CrackleCommandLine* pThis, int argc, const char* pStatsFormat);
+static void parseCyclesPerSector(CrackleCommandLine* pThis, int argc, const char* pCycles);
+static void parseStringParameter(const char** ppDestField, int argc, const char* pSourceArgument);
 static int parseFilenameArgument(CrackleCommandLine* pThis, int argc, const char* pArgument);
 static void throwIfRequiredArgumentNotSpecified(CrackleCommandLine* pThis);
 
@@ -95,6 +189,66 @@ static int parseFlagArgument(CrackleCommandLine* pThis, int argc, const char** p
         parseFormat(pThis, argc - 1, ppArgs[1]);
         return 2;
     }
+    else if (0 == strcasecmp(*ppArgs, "--sides"))
+    {
+        parseSides(pThis, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--bundle"))
+    {
+        parseStringParameter(&pThis->pBundleFilename, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--manifest"))
+    {
+        parseStringParameter(&pThis->pManifestFilename, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--batch"))
+    {
+        parseStringParameter(&pThis->pBatchFilename, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--extract"))
+    {
+        parseStringParameter(&pThis->pExtractFilename, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--delta-from"))
+    {
+        parseStringParameter(&pThis->pDeltaFromFilename, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--apply-delta"))
+    {
+        parseStringParameter(&pThis->pApplyDeltaFilename, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--plan"))
+    {
+        parseStringParameter(&pThis->pPlanFilename, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--simulate"))
+    {
+        parseStringParameter(&pThis->pSimulateFilename, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--stats"))
+    {
+        parseStats(pThis, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--tune-interleave"))
+    {
+        parseCyclesPerSector(pThis, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    else if (0 == strcasecmp(*ppArgs, "--update"))
+    {
+        pThis->updateImage = 1;
+        return 1;
+    }
     else
     {
         __throw(invalidArgumentException);
@@ -103,16 +257,95 @@ static int parseFlagArgument(CrackleCommandLine* pThis, int argc, const char** p
 
 static void parseFormat(CrackleCommandLine* pThis, int argc, const char* pFormat)
 {
-    if (argc < 1)
+    CrackleImageFormat imageFormat;
+    
+    if (argc < 1 || pThis->imageFormatCount >= CRACKLE_COMMAND_LINE_MAX_IMAGES)
         __throw(invalidArgumentException);
     if (0 == strcasecmp(pFormat, "nib_5.25"))
-        pThis->imageFormat = FORMAT_NIB_5_25;
+        imageFormat = FORMAT_NIB_5_25;
     else if (0 == strcasecmp(pFormat, "hdv_3.5"))
-        pThis->imageFormat = FORMAT_HDV_3_5;
+        imageFormat = FORMAT_HDV_3_5;
+    else
+        __throw(invalidArgumentException);
+    
+    pThis->imageFormats[pThis->imageFormatCount++] = imageFormat;
+    pThis->imageFormat = pThis->imageFormats[0];
+}
+
+static void parseStats(CrackleCommandLine* pThis, int argc, const char* pStatsFormat)
+{
+    if (argc < 1)
+        __throw(invalidArgumentException);
+    if (0 == strcasecmp(pStatsFormat, "text"))
+        pThis->statsFormat = STATS_TEXT;
+    else if (0 == strcasecmp(pStatsFormat, "json"))
+        pThis->statsFormat = STATS_JSON;
     else
         __throw(invalidArgumentException);
 }
 
+static void parseCyclesPerSector(CrackleCommandLine* pThis, int argc, const char* pCycles)
+{
+    char*         pEnd = NULL;
+    unsigned long cyclesPerSector;
+    
+    if (argc < 1)
+        __throw(invalidArgumentException);
+    cyclesPerSector = strtoul(pCycles, &pEnd, 0);
+    if (pEnd == pCycles || *pEnd != '\0' || cyclesPerSector > 1000000)
+        __throw(invalidArgumentException);
+    pThis->cyclesPerSector = (unsigned int)cyclesPerSector;
+    pThis->tuneInterleave = 1;
+}
+
+static int isValidRW18Side(unsigned long side);
+static int isSideAlreadyListed(CrackleCommandLine* pThis, unsigned long side);
+static void parseSides(CrackleCommandLine* pThis, int argc, const char* pSides)
+{
+    const char* pCurr = pSides;
+    
+    if (argc < 1 || pThis->sideCount > 0)
+        __throw(invalidArgumentException);
+    for (;;)
+    {
+        char*         pEnd = NULL;
+        unsigned long side = strtoul(pCurr, &pEnd, 0);
+        
+        if (pEnd == pCurr || !isValidRW18Side(side) || isSideAlreadyListed(pThis, side))
+            __throw(invalidArgumentException);
+        pThis->sides[pThis->sideCount++] = (unsigned int)side;
+        if (*pEnd == '\0')
+            break;
+        if (*pEnd != ',')
+            __throw(invalidArgumentException);
+        pCurr = pEnd + 1;
+    }
+}
+
+static int isValidRW18Side(unsigned long side)
+{
+    return side == DISK_IMAGE_RW18_SIDE_0 || side == DISK_IMAGE_RW18_SIDE_1 || side == DISK_IMAGE_RW18_SIDE_2;
+}
+
+static int isSideAlreadyListed(CrackleCommandLine* pThis, unsigned long side)
+{
+    size_t i;
+    
+    for (i = 0 ; i < pThis->sideCount ; i++)
+    {
+        if (pThis->sides[i] == side)
+            return 1;
+    }
+    return 0;
+}
+
+static void parseStringParameter(const char** ppDestField, int argc, const char* pSourceArgument)
+{
+    if (argc < 1)
+        __throw(invalidArgumentException);
+    *ppDestField = pSourceArgument;
+}
+
 static int parseFilenameArgument(CrackleCommandLine* pThis, int argc, const char* pArgument)
 {
     if (!pThis->pScriptFilename)
@@ -120,9 +353,10 @@ static int parseFilenameArgument(CrackleCommandLine* pThis, int argc, const char
         pThis->pScriptFilename = pArgument;
         return 1;
     }
-    else if (!pThis->pOutputImageFilename)
+    else if (pThis->outputImageCount < CRACKLE_COMMAND_LINE_MAX_IMAGES)
     {
-        pThis->pOutputImageFilename = pArgument;
+        pThis->apOutputImageFilenames[pThis->outputImageCount++] = pArgument;
+        pThis->pOutputImageFilename = pThis->apOutputImageFilenames[0];
         return 1;
     }
     else
@@ -133,6 +367,82 @@ static int parseFilenameArgument(CrackleCommandLine* pThis, int argc, const char
 
 static void throwIfRequiredArgumentNotSpecified(CrackleCommandLine* pThis)
 {
-    if (!pThis->pScriptFilename || !pThis->pOutputImageFilename || pThis->imageFormat == FORMAT_UNKNOWN)
+    if (pThis->tuneInterleave)
+    {
+        /* The simulation doesn't read or write any files. */
+        if (pThis->pScriptFilename || pThis->imageFormat != FORMAT_UNKNOWN || pThis->pBundleFilename ||
+            pThis->pBatchFilename || pThis->pExtractFilename || pThis->pDeltaFromFilename || 
+            pThis->pApplyDeltaFilename || pThis->pPlanFilename || pThis->pManifestFilename || pThis->updateImage ||
+            pThis->sideCount || pThis->statsFormat != STATS_NONE || pThis->pSimulateFilename)
+            __throw(invalidArgumentException);
+        return;
+    }
+    if (pThis->pSimulateFilename)
+    {
+        /* The only filename argument allowed is the image to be read. */
+        if (!pThis->pScriptFilename || pThis->outputImageCount || pThis->imageFormat != FORMAT_UNKNOWN || 
+            pThis->pBatchFilename || pThis->pExtractFilename || pThis->pDeltaFromFilename || 
+            pThis->pApplyDeltaFilename || pThis->pPlanFilename || pThis->pBundleFilename || 
+            pThis->pManifestFilename || pThis->updateImage || pThis->sideCount || pThis->statsFormat != STATS_NONE)
+            __throw(invalidArgumentException);
+        pThis->pOutputImageFilename = pThis->pScriptFilename;
+        pThis->pScriptFilename = NULL;
+        return;
+    }
+    if (pThis->pPlanFilename)
+    {
+        /* The only filename argument allowed is the script to be written. */
+        if (!pThis->pScriptFilename || pThis->outputImageCount || pThis->imageFormat != FORMAT_UNKNOWN ||
+            pThis->pBatchFilename || pThis->pExtractFilename || pThis->pDeltaFromFilename || 
+            pThis->pApplyDeltaFilename || pThis->pManifestFilename || pThis->updateImage || pThis->sideCount || 
+            pThis->statsFormat != STATS_NONE)
+            __throw(invalidArgumentException);
+        return;
+    }
+    if (pThis->pApplyDeltaFilename)
+    {
+        /* The only filename argument allowed is the image to be patched. */
+        if (!pThis->pScriptFilename || pThis->outputImageCount || pThis->imageFormat != FORMAT_UNKNOWN || 
+            pThis->pBatchFilename || pThis->pExtractFilename || pThis->pDeltaFromFilename || pThis->pBundleFilename || 
+            pThis->pManifestFilename || pThis->updateImage || pThis->sideCount || pThis->statsFormat != STATS_NONE)
+            __throw(invalidArgumentException);
+        pThis->pOutputImageFilename = pThis->pScriptFilename;
+        pThis->pScriptFilename = NULL;
+        return;
+    }
+    if (pThis->pDeltaFromFilename && 
+        (pThis->pBatchFilename || pThis->pExtractFilename || pThis->pManifestFilename || pThis->updateImage || 
+         pThis->sideCount || pThis->imageFormatCount > 1))
+        __throw(invalidArgumentException);
+    if (pThis->pExtractFilename)
+    {
+        /* The only filename argument allowed is where the decoded contents are to be written. */
+        if (pThis->outputImageCount || pThis->imageFormat != FORMAT_UNKNOWN || pThis->pBatchFilename ||
+            pThis->pBundleFilename || pThis->pManifestFilename || pThis->updateImage || pThis->sideCount ||
+            pThis->statsFormat != STATS_NONE)
+            __throw(invalidArgumentException);
+        pThis->pExtractOutputFilename = pThis->pScriptFilename;
+        pThis->pScriptFilename = NULL;
+        return;
+    }
+    if (pThis->pBatchFilename)
+    {
+        /* Everything but the bundle comes from the batch file itself. */
+        if (pThis->pScriptFilename || pThis->imageFormat != FORMAT_UNKNOWN || 
+            pThis->pManifestFilename || pThis->updateImage || pThis->sideCount)
+            __throw(invalidArgumentException);
+        return;
+    }
+    if (pThis->sideCount > 0)
+    {
+        /* There is one outputImageFilename for each side rather than for each format. */
+        if (!pThis->pScriptFilename || pThis->imageFormatCount != 1 || pThis->imageFormat != FORMAT_NIB_5_25 ||
+            pThis->outputImageCount != pThis->sideCount || pThis->pManifestFilename || pThis->updateImage)
+            __throw(invalidArgumentException);
+        return;
+    }
+    if (!pThis->pScriptFilename || pThis->imageFormatCount == 0 || pThis->outputImageCount != pThis->imageFormatCount)
+        __throw(invalidArgumentException);
+    if (pThis->imageFormatCount > 1 && (pThis->pManifestFilename || pThis->updateImage))
         __throw(invalidArgumentException);
 }
@@ -0,0 +1,243 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include <sys/time.h>
+#include "CrackleExtract.h"
+#include "CrackleExtractTest.h"
+#include "ThreadPool.h"
+#include "util.h"
+
+
+static void readImageFile(CrackleExtract* pThis, Vfs* pVfs, const char* pImageFilename);
+static void determineImageFormat(CrackleExtract* pThis);
+__throws CrackleExtract* CrackleExtract_Create(Vfs* pVfs, const char* pImageFilename)
+{
+    CrackleExtract* pThis = NULL;
+
+    __try
+    {
+        pThis = allocateAndZero(sizeof(*pThis));
+        pThis->pImageFilename = pImageFilename;
+        readImageFile(pThis, pVfs, pImageFilename);
+        determineImageFormat(pThis);
+    }
+    __catch
+    {
+        CrackleExtract_Free(pThis);
+        __rethrow;
+    }
+
+    return pThis;
+}
+
+static void readImageFile(CrackleExtract* pThis, Vfs* pVfs, const char* pImageFilename)
+{
+    VfsFile* pFile = NULL;
+    long     fileSize;
+
+    __try
+    {
+        pFile = Vfs_OpenFile(pVfs, pImageFilename, "rb");
+        if (!pFile)
+            __throw(fileOpenException);
+        fileSize = Vfs_GetFileSize(pVfs, pFile);
+        if (fileSize <= 0)
+            __throw(fileException);
+        ByteBuffer_Allocate(&pThis->image, fileSize);
+        ByteBuffer_ReadFromFile(&pThis->image, pVfs, pFile);
+    }
+    __catch
+    {
+        if (getExceptionCode() == fileOpenException)
+            fprintf(stderr, "error: Failed to open %s image file." LINE_ENDING, pImageFilename);
+        else if (getExceptionCode() == fileException)
+            fprintf(stderr, "error: Failed to read %s image file." LINE_ENDING, pImageFilename);
+    }
+    Vfs_CloseFile(pVfs, pFile);
+    if (getExceptionCode() != noException)
+        __rethrow;
+}
+
+static void determineImageFormat(CrackleExtract* pThis)
+{
+    /* The format comes from the size of the image since neither .nib nor .hdv files have a header. */
+    if (pThis->image.bufferSize == NIBBLE_DISK_IMAGE_SIZE)
+    {
+        pThis->imageFormat = FORMAT_NIB_5_25;
+        pThis->logicalSize = DISK_IMAGE_TRACKS_PER_SIDE * DISK_IMAGE_RW18_BYTES_PER_TRACK;
+        pThis->pLogicalData = allocateAndZero(pThis->logicalSize);
+    }
+    else if (pThis->image.bufferSize % DISK_IMAGE_BLOCK_SIZE == 0)
+    {
+        pThis->imageFormat = FORMAT_HDV_3_5;
+        pThis->logicalSize = pThis->image.bufferSize;
+        pThis->pLogicalData = pThis->image.pBuffer;
+    }
+    else
+    {
+        fprintf(stderr, "error: %s isn't a .nib or .hdv image." LINE_ENDING, pThis->pImageFilename);
+        __throw(fileException);
+    }
+}
+
+
+void CrackleExtract_Free(CrackleExtract* pThis)
+{
+    if (!pThis)
+        return;
+
+    if (pThis->pLogicalData != pThis->image.pBuffer)
+        free(pThis->pLogicalData);
+    ByteBuffer_Free(&pThis->image);
+    free(pThis);
+}
+
+
+static double getSeconds(void);
+static void decodeTrack(void* pvExtract, size_t track);
+static int  hasTrackFailed(const NibbleDiskImageTrackStatus* pStatus);
+static int  isBlockUsed(const unsigned char* pBlock);
+void CrackleExtract_Decode(CrackleExtract* pThis)
+{
+    /* Each track is decoded into its own slice of pLogicalData so they can all be decoded concurrently. */
+    double startTime = getSeconds();
+    size_t i;
+
+    pThis->badTrackCount = 0;
+    pThis->usedBlockCount = 0;
+    if (pThis->imageFormat == FORMAT_NIB_5_25)
+    {
+        ThreadPool_Run(DISK_IMAGE_TRACKS_PER_SIDE, decodeTrack, pThis);
+        for (i = 0 ; i < DISK_IMAGE_TRACKS_PER_SIDE ; i++)
+        {
+            if (hasTrackFailed(&pThis->trackStatus[i]))
+                pThis->badTrackCount++;
+        }
+    }
+    else
+    {
+        for (i = 0 ; i < pThis->logicalSize ; i += DISK_IMAGE_BLOCK_SIZE)
+        {
+            if (isBlockUsed(pThis->pLogicalData + i))
+                pThis->usedBlockCount++;
+        }
+    }
+    pThis->elapsedSeconds = getSeconds() - startTime;
+}
+
+static double getSeconds(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (double)now.tv_sec + (double)now.tv_usec / 1000000.0;
+}
+
+static void decodeTrack(void* pvExtract, size_t track)
+{
+    CrackleExtract* pThis = (CrackleExtract*)pvExtract;
+
+    NibbleDiskImage_DecodeTrack(pThis->image.pBuffer + track * NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK,
+                                (unsigned int)track,
+                                pThis->pLogicalData + track * DISK_IMAGE_RW18_BYTES_PER_TRACK,
+                                &pThis->trackStatus[track]);
+}
+
+static int hasTrackFailed(const NibbleDiskImageTrackStatus* pStatus)
+{
+    return pStatus->format == NIBBLE_TRACK_UNKNOWN || pStatus->badSectors || pStatus->badAddressFieldCount;
+}
+
+static int isBlockUsed(const unsigned char* pBlock)
+{
+    size_t i;
+
+    for (i = 0 ; i < DISK_IMAGE_BLOCK_SIZE ; i++)
+    {
+        if (pBlock[i])
+            return TRUE;
+    }
+    return FALSE;
+}
+
+
+static void reportTrackStatus(unsigned int track, const NibbleDiskImageTrackStatus* pStatus);
+static unsigned int countBits(unsigned int bits);
+void CrackleExtract_ReportStatus(CrackleExtract* pThis)
+{
+    unsigned int track;
+
+    if (pThis->imageFormat == FORMAT_HDV_3_5)
+    {
+        printf("%s: %u of %lu blocks in use.\n",
+               pThis->pImageFilename, pThis->usedBlockCount,
+               (unsigned long)(pThis->logicalSize / DISK_IMAGE_BLOCK_SIZE));
+        return;
+    }
+
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+        reportTrackStatus(track, &pThis->trackStatus[track]);
+    printf("%s: %u of %u tracks failed to decode.\n",
+           pThis->pImageFilename, pThis->badTrackCount, DISK_IMAGE_TRACKS_PER_SIDE);
+}
+
+static void reportTrackStatus(unsigned int track, const NibbleDiskImageTrackStatus* pStatus)
+{
+    switch (pStatus->format)
+    {
+    case NIBBLE_TRACK_EMPTY:
+        return;
+    case NIBBLE_TRACK_UNKNOWN:
+        printf("Track %2u: unrecognized nibbles.\n", track);
+        return;
+    case NIBBLE_TRACK_RWTS16:
+        printf("Track %2u: RWTS16, %u good sectors", track, countBits(pStatus->goodSectors));
+        break;
+    case NIBBLE_TRACK_RW18:
+    default:
+        printf("Track %2u: RW18 side 0x%02x, %u good sectors", track, pStatus->side, countBits(pStatus->goodSectors));
+        break;
+    }
+    if (pStatus->badSectors)
+        printf(", bad sectors 0x%04x", pStatus->badSectors);
+    if (pStatus->badAddressFieldCount)
+        printf(", %u bad address fields", pStatus->badAddressFieldCount);
+    printf(".\n");
+}
+
+static unsigned int countBits(unsigned int bits)
+{
+    unsigned int count = 0;
+
+    while (bits)
+    {
+        bits &= bits - 1;
+        count++;
+    }
+    return count;
+}
+
+
+__throws void CrackleExtract_WriteLogicalData(CrackleExtract* pThis, Vfs* pVfs, const char* pFilename)
+{
+    VfsFile*  pFile = Vfs_OpenFile(pVfs, pFilename, "wb");
+    VfsBuffer buffer = { pThis->pLogicalData, pThis->logicalSize };
+    size_t    bytesWritten;
+
+    if (!pFile)
+        __throw(fileOpenException);
+    bytesWritten = Vfs_WriteFile(pVfs, pFile, &buffer, 1);
+    Vfs_CloseFile(pVfs, pFile);
+    if (bytesWritten != pThis->logicalSize)
+        __throw(fileException);
+}
@@ -0,0 +1,701 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include <limits.h>
+#include "CracklePlan.h"
+#include "CracklePlanTest.h"
+#include "NibbleDiskImage.h"
+#include "TextFile.h"
+#include "ParseCSV.h"
+#include "util.h"
+
+
+#define LOG_ERROR(pSEQUENCEFILENAME, LINENUMBER, FORMAT, ...) fprintf(stderr, \
+                                                                      "%s:%u: error: " FORMAT LINE_ENDING, \
+                                                                      pSEQUENCEFILENAME, \
+                                                                      LINENUMBER, \
+                                                                      __VA_ARGS__)
+
+#define DEFAULT_FIRST_TRACK 1
+
+
+typedef struct PlanCursor
+{
+    unsigned int sideIndex;
+    unsigned int track;
+    unsigned int offset;
+} PlanCursor;
+
+
+static void parseSequenceFile(CracklePlan* pThis);
+__throws CracklePlan* CracklePlan_Create(Vfs* pVfs, const char* pSequenceFilename)
+{
+    CracklePlan* pThis = NULL;
+
+    __try
+    {
+        pThis = allocateAndZero(sizeof(*pThis));
+        pThis->pVfs = pVfs;
+        pThis->pSequenceFilename = pSequenceFilename;
+        pThis->sides[0] = DISK_IMAGE_RW18_SIDE_0;
+        pThis->sideCount = 1;
+        pThis->firstTrack = DEFAULT_FIRST_TRACK;
+        pThis->lastTrack = DISK_IMAGE_TRACKS_PER_SIDE - 1;
+        pThis->pDiskImage = (DiskImage*)NibbleDiskImage_Create();
+        DiskImage_SetVfs(pThis->pDiskImage, pVfs);
+        parseSequenceFile(pThis);
+    }
+    __catch
+    {
+        CracklePlan_Free(pThis);
+        __rethrow;
+    }
+
+    return pThis;
+}
+
+static int  isBlankOrComment(const SizedString* pLine);
+static void parseSequenceLine(CracklePlan* pThis, ParseCSV* pParser, const SizedString* pLine, unsigned int lineNumber);
+static void parseSidesLine(CracklePlan*       pThis,
+                           const SizedString* pFields,
+                           size_t             fieldCount,
+                           unsigned int       lineNumber);
+static void parseTracksLine(CracklePlan*       pThis,
+                            const SizedString* pFields,
+                            size_t             fieldCount,
+                            unsigned int       lineNumber);
+static void parseLoadLine(CracklePlan*       pThis,
+                          const SizedString* pFields,
+                          size_t             fieldCount,
+                          unsigned int       lineNumber);
+static void parseSequenceFile(CracklePlan* pThis)
+{
+    /* Every line is checked before any error is thrown so that all of the problems in the load sequence are reported
+       at once. */
+    SizedString  sequenceFilename = SizedString_InitFromString(pThis->pSequenceFilename);
+    TextFile*    pTextFile = NULL;
+    ParseCSV*    pParser = NULL;
+    unsigned int errorCount = 0;
+
+    __try
+    {
+        pTextFile = TextFile_CreateFromVfs(pThis->pVfs, NULL, &sequenceFilename, NULL);
+        pParser = ParseCSV_Create();
+        while (!TextFile_IsEndOfFile(pTextFile))
+        {
+            SizedString nextLine = TextFile_GetNextLine(pTextFile);
+
+            if (isBlankOrComment(&nextLine))
+                continue;
+            __try
+            {
+                parseSequenceLine(pThis, pParser, &nextLine, TextFile_GetLineNumber(pTextFile));
+            }
+            __catch
+            {
+                if (getExceptionCode() == outOfMemoryException)
+                    __rethrow;
+                clearExceptionCode();
+                errorCount++;
+            }
+        }
+        if (errorCount > 0)
+            __throw(invalidArgumentException);
+    }
+    __catch
+    {
+        if (getExceptionCode() == fileOpenException)
+            fprintf(stderr, "error: Failed to open %s load sequence file." LINE_ENDING, pThis->pSequenceFilename);
+    }
+    ParseCSV_Free(pParser);
+    TextFile_Free(pTextFile);
+    if (getExceptionCode() != noException)
+        __rethrow;
+}
+
+static int isBlankOrComment(const SizedString* pLine)
+{
+    return SizedString_strlen(pLine) == 0 || pLine->pString[0] == '#';
+}
+
+static void parseSequenceLine(CracklePlan* pThis, ParseCSV* pParser, const SizedString* pLine, unsigned int lineNumber)
+{
+    const SizedString* pFields;
+    size_t             fieldCount;
+
+    ParseCSV_Parse(pParser, pLine);
+    pFields = ParseCSV_FieldPointers(pParser);
+    fieldCount = ParseCSV_FieldCount(pParser);
+    if (0 == SizedString_strcasecmp(&pFields[0], "load"))
+    {
+        parseLoadLine(pThis, pFields, fieldCount, lineNumber);
+    }
+    else if (0 == SizedString_strcasecmp(&pFields[0], "sides"))
+    {
+        parseSidesLine(pThis, pFields, fieldCount, lineNumber);
+    }
+    else if (0 == SizedString_strcasecmp(&pFields[0], "tracks"))
+    {
+        parseTracksLine(pThis, pFields, fieldCount, lineNumber);
+    }
+    else
+    {
+        LOG_ERROR(pThis->pSequenceFilename, lineNumber,
+                  "%.*s isn't a recognized load sequence line of LOAD, SIDES, or TRACKS.",
+                  pFields[0].stringLength, pFields[0].pString);
+        __throw(invalidArgumentException);
+    }
+}
+
+static int parseNumberField(const SizedString* pField, unsigned int* pValue);
+static int isValidRW18Side(unsigned int side);
+static void parseSidesLine(CracklePlan*       pThis,
+                           const SizedString* pFields,
+                           size_t             fieldCount,
+                           unsigned int       lineNumber)
+{
+    unsigned int sides[CRACKLE_PLAN_MAX_SIDES];
+    size_t       i;
+    size_t       j;
+
+    if (fieldCount < 2 || fieldCount > CRACKLE_PLAN_MAX_SIDES + 1)
+    {
+        LOG_ERROR(pThis->pSequenceFilename, lineNumber, "%s", "Line should be of the form SIDES,side[,side]...");
+        __throw(invalidArgumentCountException);
+    }
+    for (i = 1 ; i < fieldCount ; i++)
+    {
+        unsigned int side = 0;
+
+        if (!parseNumberField(&pFields[i], &side) || !isValidRW18Side(side))
+        {
+            LOG_ERROR(pThis->pSequenceFilename, lineNumber,
+                      "%.*s specifies an invalid side.  Must be 0xa9, 0xad, 0x79.",
+                      pFields[i].stringLength, pFields[i].pString);
+            __throw(invalidSideException);
+        }
+        for (j = 0 ; j < i - 1 ; j++)
+        {
+            if (sides[j] == side)
+            {
+                LOG_ERROR(pThis->pSequenceFilename, lineNumber, "0x%02x side is listed more than once.", side);
+                __throw(invalidSideException);
+            }
+        }
+        sides[i - 1] = side;
+    }
+
+    memcpy(pThis->sides, sides, (fieldCount - 1) * sizeof(sides[0]));
+    pThis->sideCount = fieldCount - 1;
+}
+
+static int parseNumberField(const SizedString* pField, unsigned int* pValue)
+{
+    const char* pEnd = NULL;
+
+    *pValue = SizedString_strtoul(pField, &pEnd, 0);
+    return pField->stringLength > 0 && pEnd == pField->pString + pField->stringLength;
+}
+
+static int isValidRW18Side(unsigned int side)
+{
+    return side == DISK_IMAGE_RW18_SIDE_0 || side == DISK_IMAGE_RW18_SIDE_1 || side == DISK_IMAGE_RW18_SIDE_2;
+}
+
+static void parseTracksLine(CracklePlan*       pThis,
+                            const SizedString* pFields,
+                            size_t             fieldCount,
+                            unsigned int       lineNumber)
+{
+    unsigned int firstTrack = 0;
+    unsigned int lastTrack = 0;
+
+    if (fieldCount != 3 ||
+        !parseNumberField(&pFields[1], &firstTrack) ||
+        !parseNumberField(&pFields[2], &lastTrack) ||
+        firstTrack > lastTrack ||
+        lastTrack >= DISK_IMAGE_TRACKS_PER_SIDE)
+    {
+        LOG_ERROR(pThis->pSequenceFilename, lineNumber, "%s",
+                  "Line should be of the form TRACKS,firstTrack,lastTrack with tracks from 0 - 34.");
+        __throw(invalidTrackException);
+    }
+    pThis->firstTrack = firstTrack;
+    pThis->lastTrack = lastTrack;
+}
+
+static CracklePlanLoad* addLoad(CracklePlan* pThis);
+static size_t findOrAddObject(CracklePlan* pThis, const SizedString* pFilename, unsigned int lineNumber);
+static int    isObjectInLoad(CracklePlan* pThis, const CracklePlanLoad* pLoad, size_t objectIndex);
+static void   addObjectIndex(CracklePlan* pThis, size_t objectIndex);
+static void parseLoadLine(CracklePlan*       pThis,
+                          const SizedString* pFields,
+                          size_t             fieldCount,
+                          unsigned int       lineNumber)
+{
+    CracklePlanLoad* pLoad;
+    size_t           i;
+
+    for (i = 1 ; i < fieldCount ; i++)
+    {
+        if (pFields[i].stringLength == 0)
+        {
+            LOG_ERROR(pThis->pSequenceFilename, lineNumber, "%s", "objectFilename cannot be blank.");
+            __throw(invalidArgumentException);
+        }
+    }
+    if (fieldCount < 2)
+    {
+        LOG_ERROR(pThis->pSequenceFilename, lineNumber, "%s",
+                  "Line should be of the form LOAD,objectFilename[,objectFilename]...");
+        __throw(invalidArgumentCountException);
+    }
+
+    pLoad = addLoad(pThis);
+    pLoad->firstObjectIndex = pThis->objectIndexCount;
+    pLoad->lineNumber = lineNumber;
+    for (i = 1 ; i < fieldCount ; i++)
+    {
+        size_t objectIndex = findOrAddObject(pThis, &pFields[i], lineNumber);
+
+        if (isObjectInLoad(pThis, pLoad, objectIndex))
+            continue;
+        addObjectIndex(pThis, objectIndex);
+        pLoad->objectIndexCount++;
+    }
+}
+
+static CracklePlanLoad* addLoad(CracklePlan* pThis)
+{
+    CracklePlanLoad* pRealloc = realloc(pThis->pLoads, (pThis->loadCount + 1) * sizeof(*pRealloc));
+    CracklePlanLoad* pLoad;
+
+    if (!pRealloc)
+        __throw(outOfMemoryException);
+    pThis->pLoads = pRealloc;
+    pLoad = &pThis->pLoads[pThis->loadCount++];
+    memset(pLoad, 0, sizeof(*pLoad));
+
+    return pLoad;
+}
+
+static size_t findOrAddObject(CracklePlan* pThis, const SizedString* pFilename, unsigned int lineNumber)
+{
+    CracklePlanObject* pRealloc;
+    CracklePlanObject* pObject;
+    size_t             i;
+
+    for (i = 0 ; i < pThis->objectCount ; i++)
+    {
+        if (0 == SizedString_strcmp(pFilename, pThis->pObjects[i].pFilename))
+            return i;
+    }
+
+    pRealloc = realloc(pThis->pObjects, (pThis->objectCount + 1) * sizeof(*pRealloc));
+    if (!pRealloc)
+        __throw(outOfMemoryException);
+    pThis->pObjects = pRealloc;
+    pObject = &pThis->pObjects[pThis->objectCount++];
+    memset(pObject, 0, sizeof(*pObject));
+    pObject->lineNumber = lineNumber;
+    pObject->pFilename = SizedString_strdup(pFilename);
+
+    return pThis->objectCount - 1;
+}
+
+static int isObjectInLoad(CracklePlan* pThis, const CracklePlanLoad* pLoad, size_t objectIndex)
+{
+    size_t i;
+
+    for (i = 0 ; i < pLoad->objectIndexCount ; i++)
+    {
+        if (pThis->pObjectIndices[pLoad->firstObjectIndex + i] == objectIndex)
+            return 1;
+    }
+    return 0;
+}
+
+static void addObjectIndex(CracklePlan* pThis, size_t objectIndex)
+{
+    size_t* pRealloc = realloc(pThis->pObjectIndices, (pThis->objectIndexCount + 1) * sizeof(*pRealloc));
+
+    if (!pRealloc)
+        __throw(outOfMemoryException);
+    pThis->pObjectIndices = pRealloc;
+    pThis->pObjectIndices[pThis->objectIndexCount++] = objectIndex;
+}
+
+
+void CracklePlan_Free(CracklePlan* pThis)
+{
+    size_t i;
+
+    if (!pThis)
+        return;
+
+    for (i = 0 ; i < pThis->objectCount ; i++)
+        free(pThis->pObjects[i].pFilename);
+    free(pThis->pObjects);
+    free(pThis->pObjectIndices);
+    free(pThis->pLoads);
+    DiskImage_Free(pThis->pDiskImage);
+    free(pThis);
+}
+
+
+__throws void CracklePlan_OpenBundle(CracklePlan* pThis, const char* pBundleFilename)
+{
+    DiskImage_OpenBundle(pThis->pDiskImage, pBundleFilename);
+}
+
+
+static void readObjectLengths(CracklePlan* pThis);
+static void placeObjects(CracklePlan* pThis);
+static void countUsedTracks(CracklePlan* pThis);
+static void estimateSeeks(CracklePlan* pThis);
+__throws void CracklePlan_Run(CracklePlan* pThis)
+{
+    readObjectLengths(pThis);
+    placeObjects(pThis);
+    countUsedTracks(pThis);
+    estimateSeeks(pThis);
+}
+
+static void readObjectLengths(CracklePlan* pThis)
+{
+    unsigned int errorCount = 0;
+    size_t       i;
+
+    for (i = 0 ; i < pThis->objectCount ; i++)
+    {
+        CracklePlanObject* pObject = &pThis->pObjects[i];
+
+        __try
+        {
+            DiskImage_ReadObjectFile(pThis->pDiskImage, pObject->pFilename);
+            pObject->length = DiskImage_GetObjectFileLength(pThis->pDiskImage);
+        }
+        __catch
+        {
+            if (getExceptionCode() == outOfMemoryException)
+                __rethrow;
+            LOG_ERROR(pThis->pSequenceFilename, pObject->lineNumber, "Failed to read '%s' object file.",
+                      pObject->pFilename);
+            clearExceptionCode();
+            errorCount++;
+        }
+    }
+    if (errorCount > 0)
+        __throw(fileOpenException);
+}
+
+static void placeObjectsForLoad(CracklePlan* pThis, const CracklePlanLoad* pLoad, PlanCursor* pCursor);
+static void placeObjects(CracklePlan* pThis)
+{
+    PlanCursor cursor;
+    size_t     i;
+
+    cursor.sideIndex = 0;
+    cursor.track = pThis->firstTrack;
+    cursor.offset = 0;
+    for (i = 0 ; i < pThis->loadCount ; i++)
+        placeObjectsForLoad(pThis, &pThis->pLoads[i], &cursor);
+}
+
+static CracklePlanObject* findLargestUnplacedObject(CracklePlan*           pThis,
+                                                    const CracklePlanLoad* pLoad,
+                                                    unsigned int           maxLength);
+static int                shouldSkipRestOfTrack(CracklePlan* pThis, const CracklePlanLoad* pLoad, PlanCursor* pCursor);
+static void               placeObject(CracklePlan* pThis, CracklePlanObject* pObject, PlanCursor* pCursor);
+static void placeObjectsForLoad(CracklePlan* pThis, const CracklePlanLoad* pLoad, PlanCursor* pCursor)
+{
+    /* The largest object which fits tops up the current track.  Once nothing fits, the rest of the load carries on
+       across the track boundary, largest object first, unless skipping to the next track would save the load from
+       reading the current track at all. */
+    size_t placedCount = 0;
+
+    for (;;)
+    {
+        CracklePlanObject* pObject;
+
+        pObject = findLargestUnplacedObject(pThis, pLoad, DISK_IMAGE_RW18_BYTES_PER_TRACK - pCursor->offset);
+        if (!pObject && placedCount == 0 && shouldSkipRestOfTrack(pThis, pLoad, pCursor))
+        {
+            pCursor->track++;
+            pCursor->offset = 0;
+            continue;
+        }
+        if (!pObject)
+            pObject = findLargestUnplacedObject(pThis, pLoad, UINT_MAX);
+        if (!pObject)
+            break;
+        placeObject(pThis, pObject, pCursor);
+        placedCount++;
+    }
+}
+
+static unsigned int getPaddedLength(const CracklePlanObject* pObject);
+static CracklePlanObject* findLargestUnplacedObject(CracklePlan*           pThis,
+                                                    const CracklePlanLoad* pLoad,
+                                                    unsigned int           maxLength)
+{
+    CracklePlanObject* pLargest = NULL;
+    size_t             i;
+
+    for (i = 0 ; i < pLoad->objectIndexCount ; i++)
+    {
+        CracklePlanObject* pObject = &pThis->pObjects[pThis->pObjectIndices[pLoad->firstObjectIndex + i]];
+        unsigned int       paddedLength = getPaddedLength(pObject);
+
+        if (pObject->isPlaced || paddedLength > maxLength)
+            continue;
+        if (!pLargest || paddedLength > getPaddedLength(pLargest))
+            pLargest = pObject;
+    }
+    return pLargest;
+}
+
+static unsigned int getPaddedLength(const CracklePlanObject* pObject)
+{
+    return (pObject->length + DISK_IMAGE_PAGE_SIZE - 1) & ~(DISK_IMAGE_PAGE_SIZE - 1);
+}
+
+static int shouldSkipRestOfTrack(CracklePlan* pThis, const CracklePlanLoad* pLoad, PlanCursor* pCursor)
+{
+    unsigned int totalLength = 0;
+    size_t       i;
+
+    if (pCursor->offset == 0)
+        return 0;
+    for (i = 0 ; i < pLoad->objectIndexCount ; i++)
+    {
+        CracklePlanObject* pObject = &pThis->pObjects[pThis->pObjectIndices[pLoad->firstObjectIndex + i]];
+
+        if (!pObject->isPlaced)
+            totalLength += getPaddedLength(pObject);
+    }
+    if (totalLength == 0)
+        return 0;
+
+    return (pCursor->offset + totalLength - 1) / DISK_IMAGE_RW18_BYTES_PER_TRACK ==
+           1 + (totalLength - 1) / DISK_IMAGE_RW18_BYTES_PER_TRACK;
+}
+
+static unsigned int getBytesLeftOnSide(CracklePlan* pThis, const PlanCursor* pCursor);
+static void placeObject(CracklePlan* pThis, CracklePlanObject* pObject, PlanCursor* pCursor)
+{
+    unsigned int paddedLength = getPaddedLength(pObject);
+
+    if (paddedLength > getBytesLeftOnSide(pThis, pCursor))
+    {
+        pCursor->sideIndex++;
+        pCursor->track = pThis->firstTrack;
+        pCursor->offset = 0;
+    }
+    if (pCursor->sideIndex >= pThis->sideCount || paddedLength > getBytesLeftOnSide(pThis, pCursor))
+    {
+        LOG_ERROR(pThis->pSequenceFilename, pObject->lineNumber,
+                  "'%s' object doesn't fit in the tracks left on the sides being planned.", pObject->pFilename);
+        __throw(invalidTrackException);
+    }
+
+    pObject->sideIndex = pCursor->sideIndex;
+    pObject->track = pCursor->track;
+    pObject->intraTrackOffset = pCursor->offset;
+    pObject->isPlaced = 1;
+    pCursor->offset += paddedLength;
+    pCursor->track += pCursor->offset / DISK_IMAGE_RW18_BYTES_PER_TRACK;
+    pCursor->offset %= DISK_IMAGE_RW18_BYTES_PER_TRACK;
+}
+
+static unsigned int getBytesLeftOnSide(CracklePlan* pThis, const PlanCursor* pCursor)
+{
+    if (pCursor->sideIndex >= pThis->sideCount || pCursor->track > pThis->lastTrack)
+        return 0;
+    return (pThis->lastTrack - pCursor->track + 1) * DISK_IMAGE_RW18_BYTES_PER_TRACK - pCursor->offset;
+}
+
+static unsigned int getLastTrack(const CracklePlanObject* pObject);
+static void countUsedTracks(CracklePlan* pThis)
+{
+    unsigned char pagesUsed[CRACKLE_PLAN_MAX_SIDES][DISK_IMAGE_TRACKS_PER_SIDE];
+    size_t        i;
+    size_t        j;
+
+    memset(pagesUsed, 0, sizeof(pagesUsed));
+    for (i = 0 ; i < pThis->objectCount ; i++)
+    {
+        CracklePlanObject* pObject = &pThis->pObjects[i];
+        unsigned int       page = pObject->intraTrackOffset / DISK_IMAGE_PAGE_SIZE;
+        unsigned int       pageCount = getPaddedLength(pObject) / DISK_IMAGE_PAGE_SIZE;
+        unsigned int       track = pObject->track;
+
+        while (pageCount > 0)
+        {
+            unsigned int pagesOnTrack = DISK_IMAGE_RW18_PAGES_PER_TRACK - page;
+
+            if (pagesOnTrack > pageCount)
+                pagesOnTrack = pageCount;
+            pagesUsed[pObject->sideIndex][track++] += pagesOnTrack;
+            pageCount -= pagesOnTrack;
+            page = 0;
+        }
+    }
+
+    pThis->tracksUsed = 0;
+    pThis->partialTrackCount = 0;
+    for (i = 0 ; i < pThis->sideCount ; i++)
+    {
+        for (j = 0 ; j < DISK_IMAGE_TRACKS_PER_SIDE ; j++)
+        {
+            if (pagesUsed[i][j] == 0)
+                continue;
+            pThis->tracksUsed++;
+            if (pagesUsed[i][j] < DISK_IMAGE_RW18_PAGES_PER_TRACK)
+                pThis->partialTrackCount++;
+        }
+    }
+}
+
+static unsigned int getLastTrack(const CracklePlanObject* pObject)
+{
+    unsigned int paddedLength = getPaddedLength(pObject);
+
+    if (paddedLength == 0)
+        return pObject->track;
+    return pObject->track + (pObject->intraTrackOffset + paddedLength - 1) / DISK_IMAGE_RW18_BYTES_PER_TRACK;
+}
+
+static void sortObjectIndicesByDiskPosition(CracklePlan* pThis, size_t* pIndices, size_t indexCount);
+static void estimateSeeks(CracklePlan* pThis)
+{
+    /* The objects of each load are read in disk order no matter how they were listed in the load sequence. */
+    size_t*      pIndices = NULL;
+    unsigned int headTrack = 0;
+    unsigned int sideIndex = 0;
+    size_t       i;
+    size_t       j;
+
+    pThis->trackSteps = 0;
+    pThis->sideChanges = 0;
+    if (pThis->objectIndexCount == 0)
+        return;
+    pIndices = malloc(pThis->objectIndexCount * sizeof(*pIndices));
+    if (!pIndices)
+        __throw(outOfMemoryException);
+    for (i = 0 ; i < pThis->loadCount ; i++)
+    {
+        CracklePlanLoad* pLoad = &pThis->pLoads[i];
+
+        memcpy(pIndices, &pThis->pObjectIndices[pLoad->firstObjectIndex], pLoad->objectIndexCount * sizeof(*pIndices));
+        sortObjectIndicesByDiskPosition(pThis, pIndices, pLoad->objectIndexCount);
+        for (j = 0 ; j < pLoad->objectIndexCount ; j++)
+        {
+            CracklePlanObject* pObject = &pThis->pObjects[pIndices[j]];
+
+            if (pObject->sideIndex != sideIndex)
+            {
+                pThis->sideChanges++;
+                sideIndex = pObject->sideIndex;
+            }
+            pThis->trackSteps += pObject->track > headTrack ? pObject->track - headTrack : headTrack - pObject->track;
+            headTrack = getLastTrack(pObject);
+            pThis->trackSteps += headTrack - pObject->track;
+        }
+    }
+    free(pIndices);
+}
+
+static int compareDiskPositions(const CracklePlanObject* p1, const CracklePlanObject* p2);
+static void sortObjectIndicesByDiskPosition(CracklePlan* pThis, size_t* pIndices, size_t indexCount)
+{
+    /* Loads only list a handful of objects so an insertion sort is plenty. */
+    size_t i;
+
+    for (i = 1 ; i < indexCount ; i++)
+    {
+        size_t index = pIndices[i];
+        size_t j = i;
+
+        while (j > 0 && compareDiskPositions(&pThis->pObjects[pIndices[j - 1]], &pThis->pObjects[index]) > 0)
+        {
+            pIndices[j] = pIndices[j - 1];
+            j--;
+        }
+        pIndices[j] = index;
+    }
+}
+
+static int compareDiskPositions(const CracklePlanObject* p1, const CracklePlanObject* p2)
+{
+    if (p1->sideIndex != p2->sideIndex)
+        return p1->sideIndex < p2->sideIndex ? -1 : 1;
+    if (p1->track != p2->track)
+        return p1->track < p2->track ? -1 : 1;
+    if (p1->intraTrackOffset != p2->intraTrackOffset)
+        return p1->intraTrackOffset < p2->intraTrackOffset ? -1 : 1;
+    return 0;
+}
+
+
+__throws void CracklePlan_WriteScript(CracklePlan* pThis, const char* pScriptFilename)
+{
+    FILE*   pStream = NULL;
+    size_t* pIndices = NULL;
+    size_t  i;
+
+    pIndices = malloc((pThis->objectCount ? pThis->objectCount : 1) * sizeof(*pIndices));
+    if (!pIndices)
+        __throw(outOfMemoryException);
+    for (i = 0 ; i < pThis->objectCount ; i++)
+        pIndices[i] = i;
+    sortObjectIndicesByDiskPosition(pThis, pIndices, pThis->objectCount);
+
+    pStream = Vfs_OpenStream(pThis->pVfs, pScriptFilename);
+    if (!pStream)
+    {
+        free(pIndices);
+        fprintf(stderr, "error: Failed to create %s script file." LINE_ENDING, pScriptFilename);
+        __throw(fileOpenException);
+    }
+    fprintf(pStream, "# Planned by crackle --plan from %s: %u track steps and %u side changes to load.\n",
+            pThis->pSequenceFilename, pThis->trackSteps, pThis->sideChanges);
+    for (i = 0 ; i < pThis->objectCount ; i++)
+    {
+        const CracklePlanObject* pObject = &pThis->pObjects[pIndices[i]];
+
+        fprintf(pStream, "RW18,%s,0,*,0x%02x,%u,%u\n",
+                pObject->pFilename, pThis->sides[pObject->sideIndex], pObject->track, pObject->intraTrackOffset);
+    }
+    free(pIndices);
+    if (ferror(pStream))
+    {
+        fclose(pStream);
+        __throw(fileException);
+    }
+    if (0 != fclose(pStream))
+        __throw(fileException);
+}
+
+
+void CracklePlan_ReportSeeks(CracklePlan* pThis)
+{
+    printf("Planned %lu objects for %lu loads onto %u tracks, %u of them partially used.\n"
+           "Estimated head travel: %u track steps and %u side changes.\n",
+           (unsigned long)pThis->objectCount,
+           (unsigned long)pThis->loadCount,
+           pThis->tracksUsed,
+           pThis->partialTrackCount,
+           pThis->trackSteps,
+           pThis->sideChanges);
+}
@@ -0,0 +1,499 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include "CrackleSimulate.h"
+#include "CrackleSimulateTest.h"
+#include "TextFile.h"
+#include "ParseCSV.h"
+#include "util.h"
+
+
+#define LOG_ERROR(pTRACEFILENAME, LINENUMBER, FORMAT, ...) fprintf(stderr, \
+                                                                   "%s:%u: error: " FORMAT LINE_ENDING, \
+                                                                   pTRACEFILENAME, \
+                                                                   LINENUMBER, \
+                                                                   __VA_ARGS__)
+
+#define QUARTER_TRACKS_PER_TRACK 4
+#define RW18_SECTORS_PER_TRACK   (DISK_IMAGE_RW18_PAGES_PER_TRACK / 3)
+
+
+static void readImage(CrackleSimulate* pThis, const char* pImageFilename);
+static void parseTraceFile(CrackleSimulate* pThis);
+__throws CrackleSimulate* CrackleSimulate_Create(Vfs* pVfs, const char* pTraceFilename, const char* pImageFilename)
+{
+    CrackleSimulate* pThis = NULL;
+
+    __try
+    {
+        pThis = allocateAndZero(sizeof(*pThis));
+        pThis->pVfs = pVfs;
+        pThis->pTraceFilename = pTraceFilename;
+        pThis->stepUs = CRACKLE_SIMULATE_DEFAULT_STEP_US;
+        pThis->settleUs = CRACKLE_SIMULATE_DEFAULT_SETTLE_US;
+        pThis->rotationUs = CRACKLE_SIMULATE_DEFAULT_ROTATION_US;
+        readImage(pThis, pImageFilename);
+        parseTraceFile(pThis);
+    }
+    __catch
+    {
+        CrackleSimulate_Free(pThis);
+        __rethrow;
+    }
+
+    return pThis;
+}
+
+static void readImage(CrackleSimulate* pThis, const char* pImageFilename)
+{
+    /* The trace is checked against the decoded tracks so the image has to be read first. */
+    pThis->pExtract = CrackleExtract_Create(pThis->pVfs, pImageFilename);
+    if (pThis->pExtract->imageFormat != FORMAT_NIB_5_25)
+    {
+        fprintf(stderr, "error: %s isn't a .nib image." LINE_ENDING, pImageFilename);
+        __throw(fileException);
+    }
+    CrackleExtract_Decode(pThis->pExtract);
+}
+
+static int  isBlankOrComment(const SizedString* pLine);
+static void parseTraceLine(CrackleSimulate*   pThis,
+                           ParseCSV*          pParser,
+                           const SizedString* pLine,
+                           unsigned int       lineNumber,
+                           unsigned int*      pProcessUs);
+static void parseTraceFile(CrackleSimulate* pThis)
+{
+    /* Every line is checked before any error is thrown so that all of the problems in the trace are reported at
+       once. */
+    SizedString  traceFilename = SizedString_InitFromString(pThis->pTraceFilename);
+    TextFile*    pTextFile = NULL;
+    ParseCSV*    pParser = NULL;
+    unsigned int processUs = 0;
+    unsigned int errorCount = 0;
+
+    __try
+    {
+        pTextFile = TextFile_CreateFromVfs(pThis->pVfs, NULL, &traceFilename, NULL);
+        pParser = ParseCSV_Create();
+        while (!TextFile_IsEndOfFile(pTextFile))
+        {
+            SizedString nextLine = TextFile_GetNextLine(pTextFile);
+
+            if (isBlankOrComment(&nextLine))
+                continue;
+            __try
+            {
+                parseTraceLine(pThis, pParser, &nextLine, TextFile_GetLineNumber(pTextFile), &processUs);
+            }
+            __catch
+            {
+                if (getExceptionCode() == outOfMemoryException)
+                    __rethrow;
+                clearExceptionCode();
+                errorCount++;
+            }
+        }
+        if (errorCount > 0)
+            __throw(invalidArgumentException);
+    }
+    __catch
+    {
+        if (getExceptionCode() == fileOpenException)
+            fprintf(stderr, "error: Failed to open %s read trace file." LINE_ENDING, pThis->pTraceFilename);
+    }
+    ParseCSV_Free(pParser);
+    TextFile_Free(pTextFile);
+    if (getExceptionCode() != noException)
+        __rethrow;
+}
+
+static int isBlankOrComment(const SizedString* pLine)
+{
+    return SizedString_strlen(pLine) == 0 || pLine->pString[0] == '#';
+}
+
+static void parseRWTS16Line(CrackleSimulate*     pThis,
+                            const SizedString*   pFields,
+                            size_t               fieldCount,
+                            unsigned int         lineNumber,
+                            CrackleSimulateRead* pRead);
+static void parseRW18Line(CrackleSimulate*     pThis,
+                          const SizedString*   pFields,
+                          size_t               fieldCount,
+                          unsigned int         lineNumber,
+                          CrackleSimulateRead* pRead);
+static unsigned int* findTimingField(CrackleSimulate* pThis, const SizedString* pType, unsigned int* pProcessUs);
+static void parseTimingLine(CrackleSimulate*   pThis,
+                            const SizedString* pFields,
+                            size_t             fieldCount,
+                            unsigned int       lineNumber,
+                            unsigned int*      pTimingField);
+static void checkSectorsDecoded(CrackleSimulate* pThis, const CrackleSimulateRead* pRead, unsigned int lineNumber);
+static void addRead(CrackleSimulate* pThis, const CrackleSimulateRead* pRead);
+static void parseTraceLine(CrackleSimulate*   pThis,
+                           ParseCSV*          pParser,
+                           const SizedString* pLine,
+                           unsigned int       lineNumber,
+                           unsigned int*      pProcessUs)
+{
+    const SizedString*  pFields;
+    size_t              fieldCount;
+    unsigned int*       pTimingField;
+    CrackleSimulateRead read;
+
+    ParseCSV_Parse(pParser, pLine);
+    pFields = ParseCSV_FieldPointers(pParser);
+    fieldCount = ParseCSV_FieldCount(pParser);
+    memset(&read, 0, sizeof(read));
+    read.processUs = *pProcessUs;
+    if (0 == SizedString_strcasecmp(&pFields[0], "rwts16"))
+    {
+        parseRWTS16Line(pThis, pFields, fieldCount, lineNumber, &read);
+    }
+    else if (0 == SizedString_strcasecmp(&pFields[0], "rw18"))
+    {
+        parseRW18Line(pThis, pFields, fieldCount, lineNumber, &read);
+    }
+    else if (NULL != (pTimingField = findTimingField(pThis, &pFields[0], pProcessUs)))
+    {
+        parseTimingLine(pThis, pFields, fieldCount, lineNumber, pTimingField);
+        return;
+    }
+    else
+    {
+        LOG_ERROR(pThis->pTraceFilename, lineNumber,
+                  "%.*s isn't a recognized read trace line of RWTS16, RW18, STEP, SETTLE, ROTATION, PROCESS, or BUDGET.",
+                  pFields[0].stringLength, pFields[0].pString);
+        __throw(invalidArgumentException);
+    }
+    checkSectorsDecoded(pThis, &read, lineNumber);
+    addRead(pThis, &read);
+}
+
+static int parseNumberField(const SizedString* pField, unsigned int* pValue);
+static int parseSectorField(const SizedString* pField, unsigned int sectorCount, unsigned int* pSectorMask);
+static void parseRWTS16Line(CrackleSimulate*     pThis,
+                            const SizedString*   pFields,
+                            size_t               fieldCount,
+                            unsigned int         lineNumber,
+                            CrackleSimulateRead* pRead)
+{
+    const NibbleDiskImageTrackStatus* pStatus;
+
+    if (fieldCount != 3 ||
+        !parseNumberField(&pFields[1], &pRead->track) ||
+        pRead->track >= DISK_IMAGE_TRACKS_PER_SIDE ||
+        !parseSectorField(&pFields[2], NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK, &pRead->sectorMask))
+    {
+        LOG_ERROR(pThis->pTraceFilename, lineNumber, "%s",
+                  "Line should be of the form RWTS16,track,sector|* with track 0 - 34 and sector 0 - 15.");
+        __throw(invalidArgumentException);
+    }
+    pStatus = &pThis->pExtract->trackStatus[pRead->track];
+    if (pStatus->format != NIBBLE_TRACK_RWTS16)
+    {
+        LOG_ERROR(pThis->pTraceFilename, lineNumber, "Track %u of %s isn't an RWTS16 track.",
+                  pRead->track, pThis->pExtract->pImageFilename);
+        __throw(invalidTrackException);
+    }
+}
+
+static int parseNumberField(const SizedString* pField, unsigned int* pValue)
+{
+    const char* pEnd = NULL;
+
+    *pValue = SizedString_strtoul(pField, &pEnd, 0);
+    return pField->stringLength > 0 && pEnd == pField->pString + pField->stringLength;
+}
+
+static int parseSectorField(const SizedString* pField, unsigned int sectorCount, unsigned int* pSectorMask)
+{
+    unsigned int sector = 0;
+
+    if (0 == SizedString_strcmp(pField, "*"))
+    {
+        *pSectorMask = (1 << sectorCount) - 1;
+        return 1;
+    }
+    if (!parseNumberField(pField, &sector) || sector >= sectorCount)
+        return 0;
+    *pSectorMask = 1 << sector;
+    return 1;
+}
+
+static void parseRW18Line(CrackleSimulate*     pThis,
+                          const SizedString*   pFields,
+                          size_t               fieldCount,
+                          unsigned int         lineNumber,
+                          CrackleSimulateRead* pRead)
+{
+    const NibbleDiskImageTrackStatus* pStatus;
+    unsigned int                      side = 0;
+    unsigned int                      pageMask = 0;
+    unsigned int                      page;
+
+    if (fieldCount != 4 ||
+        !parseNumberField(&pFields[1], &side) ||
+        !parseNumberField(&pFields[2], &pRead->track) ||
+        pRead->track >= DISK_IMAGE_TRACKS_PER_SIDE ||
+        !parseSectorField(&pFields[3], DISK_IMAGE_RW18_PAGES_PER_TRACK, &pageMask))
+    {
+        LOG_ERROR(pThis->pTraceFilename, lineNumber, "%s",
+                  "Line should be of the form RW18,side,track,page|* with track 0 - 34 and page 0 - 17.");
+        __throw(invalidArgumentException);
+    }
+    pStatus = &pThis->pExtract->trackStatus[pRead->track];
+    if (pStatus->format != NIBBLE_TRACK_RW18 || pStatus->side != side)
+    {
+        LOG_ERROR(pThis->pTraceFilename, lineNumber, "Track %u of %s isn't an RW18 track of side 0x%02x.",
+                  pRead->track, pThis->pExtract->pImageFilename, side);
+        __throw(invalidTrackException);
+    }
+    /* Sector s of an RW18 track holds pages s, s + 6, and s + 12. */
+    for (page = 0 ; page < DISK_IMAGE_RW18_PAGES_PER_TRACK ; page++)
+    {
+        if (pageMask & (1 << page))
+            pRead->sectorMask |= 1 << (page % RW18_SECTORS_PER_TRACK);
+    }
+}
+
+static unsigned int* findTimingField(CrackleSimulate* pThis, const SizedString* pType, unsigned int* pProcessUs)
+{
+    if (0 == SizedString_strcasecmp(pType, "step"))
+        return &pThis->stepUs;
+    else if (0 == SizedString_strcasecmp(pType, "settle"))
+        return &pThis->settleUs;
+    else if (0 == SizedString_strcasecmp(pType, "rotation"))
+        return &pThis->rotationUs;
+    else if (0 == SizedString_strcasecmp(pType, "process"))
+        return pProcessUs;
+    else if (0 == SizedString_strcasecmp(pType, "budget"))
+        return &pThis->budgetUs;
+    else
+        return NULL;
+}
+
+static void parseTimingLine(CrackleSimulate*   pThis,
+                            const SizedString* pFields,
+                            size_t             fieldCount,
+                            unsigned int       lineNumber,
+                            unsigned int*      pTimingField)
+{
+    unsigned int microseconds = 0;
+
+    if (fieldCount != 2 || 
+        !parseNumberField(&pFields[1], &microseconds) || 
+        (pTimingField == &pThis->rotationUs && microseconds == 0))
+    {
+        LOG_ERROR(pThis->pTraceFilename, lineNumber, "Line should be of the form %.*s,microseconds%s.",
+                  pFields[0].stringLength, pFields[0].pString,
+                  pTimingField == &pThis->rotationUs ? " with microseconds greater than 0" : "");
+        __throw(invalidArgumentException);
+    }
+    *pTimingField = microseconds;
+}
+
+static void checkSectorsDecoded(CrackleSimulate* pThis, const CrackleSimulateRead* pRead, unsigned int lineNumber)
+{
+    unsigned int missingSectors = pRead->sectorMask & ~pThis->pExtract->trackStatus[pRead->track].goodSectors;
+    unsigned int sector = 0;
+
+    if (!missingSectors)
+        return;
+    while (!(missingSectors & (1 << sector)))
+        sector++;
+    LOG_ERROR(pThis->pTraceFilename, lineNumber, "Sector %u of track %u in %s didn't decode.",
+              sector, pRead->track, pThis->pExtract->pImageFilename);
+    __throw(invalidSectorException);
+}
+
+static void addRead(CrackleSimulate* pThis, const CrackleSimulateRead* pRead)
+{
+    CrackleSimulateRead* pRealloc = realloc(pThis->pReads, (pThis->readCount + 1) * sizeof(*pRealloc));
+
+    if (!pRealloc)
+        __throw(outOfMemoryException);
+    pThis->pReads = pRealloc;
+    pThis->pReads[pThis->readCount++] = *pRead;
+}
+
+
+void CrackleSimulate_Free(CrackleSimulate* pThis)
+{
+    if (!pThis)
+        return;
+
+    free(pThis->pReads);
+    CrackleExtract_Free(pThis->pExtract);
+    free(pThis);
+}
+
+
+typedef struct SimulateHead
+{
+    unsigned long long timeNs;
+    unsigned int       track;
+} SimulateHead;
+
+
+static void seekToTrack(CrackleSimulate* pThis, SimulateHead* pHead, unsigned int track);
+static void readSectors(CrackleSimulate* pThis, SimulateHead* pHead, const CrackleSimulateRead* pRead);
+static void addTimes(CrackleSimulateTimes* pTotal, const CrackleSimulateTimes* pTimes);
+void CrackleSimulate_Run(CrackleSimulate* pThis)
+{
+    SimulateHead head;
+    size_t       i;
+
+    memset(&pThis->totalTimes, 0, sizeof(pThis->totalTimes));
+    memset(pThis->trackTimes, 0, sizeof(pThis->trackTimes));
+    pThis->quarterTrackSteps = 0;
+    pThis->sectorsRead = 0;
+    head.timeNs = 0;
+    head.track = 0;
+    for (i = 0 ; i < pThis->readCount ; i++)
+    {
+        seekToTrack(pThis, &head, pThis->pReads[i].track);
+        readSectors(pThis, &head, &pThis->pReads[i]);
+    }
+    for (i = 0 ; i < DISK_IMAGE_TRACKS_PER_SIDE ; i++)
+        addTimes(&pThis->totalTimes, &pThis->trackTimes[i]);
+}
+
+static void seekToTrack(CrackleSimulate* pThis, SimulateHead* pHead, unsigned int track)
+{
+    CrackleSimulateTimes* pTimes = &pThis->trackTimes[track];
+    unsigned int          quarterTracks;
+    unsigned long long    stepNs;
+    unsigned long long    settleNs;
+
+    if (track == pHead->track)
+        return;
+    quarterTracks = QUARTER_TRACKS_PER_TRACK * (track > pHead->track ? track - pHead->track : pHead->track - track);
+    stepNs = (unsigned long long)quarterTracks * pThis->stepUs * 1000;
+    settleNs = (unsigned long long)pThis->settleUs * 1000;
+    pThis->quarterTrackSteps += quarterTracks;
+    pTimes->stepNs += stepNs;
+    pTimes->settleNs += settleNs;
+    pHead->timeNs += stepNs + settleNs;
+    pHead->track = track;
+}
+
+static unsigned long long nibblesToNs(CrackleSimulate* pThis, unsigned int nibbles);
+static void readSectors(CrackleSimulate* pThis, SimulateHead* pHead, const CrackleSimulateRead* pRead)
+{
+    /* Each time round, the sector read is the one whose address field will be the next to reach the head. */
+    const NibbleDiskImageTrackStatus* pStatus = &pThis->pExtract->trackStatus[pRead->track];
+    CrackleSimulateTimes*             pTimes = &pThis->trackTimes[pRead->track];
+    unsigned long long                rotationNs = (unsigned long long)pThis->rotationUs * 1000;
+    unsigned long long                processNs = (unsigned long long)pRead->processUs * 1000;
+    unsigned int                      sectorsLeft = pRead->sectorMask;
+
+    while (sectorsLeft)
+    {
+        unsigned long long angleNs = pHead->timeNs % rotationNs;
+        unsigned long long bestWaitNs = ~0ULL;
+        unsigned int       bestSector = 0;
+        unsigned long long readNs;
+        unsigned int       sector;
+
+        for (sector = 0 ; sector < NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK ; sector++)
+        {
+            unsigned long long waitNs;
+
+            if (!(sectorsLeft & (1 << sector)))
+                continue;
+            waitNs = (nibblesToNs(pThis, pStatus->sectorStarts[sector]) + rotationNs - angleNs) % rotationNs;
+            if (waitNs < bestWaitNs)
+            {
+                bestWaitNs = waitNs;
+                bestSector = sector;
+            }
+        }
+        readNs = nibblesToNs(pThis, pStatus->sectorEnds[bestSector]) - 
+                 nibblesToNs(pThis, pStatus->sectorStarts[bestSector]);
+        pTimes->waitNs += bestWaitNs;
+        pTimes->readNs += readNs;
+        pTimes->processNs += processNs;
+        pHead->timeNs += bestWaitNs + readNs + processNs;
+        pThis->sectorsRead++;
+        sectorsLeft &= ~(1 << bestSector);
+    }
+}
+
+static unsigned long long nibblesToNs(CrackleSimulate* pThis, unsigned int nibbles)
+{
+    return (unsigned long long)nibbles * pThis->rotationUs * 1000 / NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK;
+}
+
+static void addTimes(CrackleSimulateTimes* pTotal, const CrackleSimulateTimes* pTimes)
+{
+    pTotal->stepNs += pTimes->stepNs;
+    pTotal->settleNs += pTimes->settleNs;
+    pTotal->waitNs += pTimes->waitNs;
+    pTotal->readNs += pTimes->readNs;
+    pTotal->processNs += pTimes->processNs;
+}
+
+
+unsigned long long CrackleSimulate_GetTotalNs(const CrackleSimulateTimes* pTimes)
+{
+    return pTimes->stepNs + pTimes->settleNs + pTimes->waitNs + pTimes->readNs + pTimes->processNs;
+}
+
+
+int CrackleSimulate_IsOverBudget(CrackleSimulate* pThis)
+{
+    return pThis->budgetUs > 0 && 
+           CrackleSimulate_GetTotalNs(&pThis->totalTimes) > (unsigned long long)pThis->budgetUs * 1000;
+}
+
+
+static double nsToMs(unsigned long long ns);
+void CrackleSimulate_ReportTimes(CrackleSimulate* pThis)
+{
+    const CrackleSimulateTimes* pTotal = &pThis->totalTimes;
+    unsigned long long          totalNs = CrackleSimulate_GetTotalNs(pTotal);
+    unsigned int                track;
+
+    printf("%s: estimated load time of %.3f ms to read %u sectors.\n",
+           pThis->pExtract->pImageFilename, nsToMs(totalNs), pThis->sectorsRead);
+    printf("  Head stepping:   %10.3f ms for %u quarter tracks\n", nsToMs(pTotal->stepNs), pThis->quarterTrackSteps);
+    printf("  Head settling:   %10.3f ms\n", nsToMs(pTotal->settleNs));
+    printf("  Rotational wait: %10.3f ms\n", nsToMs(pTotal->waitNs));
+    printf("  Reading sectors: %10.3f ms\n", nsToMs(pTotal->readNs));
+    printf("  Processing:      %10.3f ms\n", nsToMs(pTotal->processNs));
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+    {
+        const CrackleSimulateTimes* pTimes = &pThis->trackTimes[track];
+        unsigned long long          trackNs = CrackleSimulate_GetTotalNs(pTimes);
+
+        if (trackNs == 0)
+            continue;
+        printf("Track %2u: %10.3f ms, %.3f ms of it waiting for sectors.\n",
+               track, nsToMs(trackNs), nsToMs(pTimes->waitNs));
+    }
+    if (pThis->budgetUs == 0)
+        return;
+    if (CrackleSimulate_IsOverBudget(pThis))
+        printf("Over the %.3f ms budget by %.3f ms.\n", 
+               nsToMs((unsigned long long)pThis->budgetUs * 1000),
+               nsToMs(totalNs - (unsigned long long)pThis->budgetUs * 1000));
+    else
+        printf("Within the %.3f ms budget.\n", nsToMs((unsigned long long)pThis->budgetUs * 1000));
+}
+
+static double nsToMs(unsigned long long ns)
+{
+    return (double)ns / 1000000.0;
+}
@@ -12,19 +12,30 @@
 */
 #include <assert.h>
 #include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "DiskImagePriv.h"
 #include "DiskImageTest.h"
+#include "DiskImageDelta.h"
+#include "DiskImageCompress.h"
+#include "DiskImageSchedule.h"
 #include "BinaryBuffer.h"
+#include "PosixVfs.h"
+#include "ThreadPool.h"
 #include "util.h"
 
 
 #define IMAGE_TABLE_DEFAULT_ADDRESS 0x6000
 
 static void DiskImageScriptEngine_Init(DiskImageScriptEngine* pThis);
-__throws void DiskImage_Init(DiskImage* pThis, DiskImageVTable* pVTable, unsigned int imageSize)
+__throws void DiskImage_Init(DiskImage* pThis, DiskImageVTable* pVTable, unsigned int imageSize, unsigned int regionSize)
 {
     memset(pThis, 0, sizeof(*pThis));
     pThis->pVTable = pVTable;
+    pThis->regionSize = regionSize;
     ByteBuffer_Allocate(&pThis->image, imageSize);
     DiskImageScriptEngine_Init(&pThis->script);
 }
@@ -36,7 +47,11 @@ static void DiskImageScriptEngine_Init(DiskImageScriptEngine* pThis)
 
 
 static void DiskImageScriptEngine_Free(DiskImageScriptEngine* pThis);
+static void freeInsertionList(DiskImageInsertionList* pList);
 static void closeTextFile(DiskImageScriptEngine* pThis);
+static void freeObjectCache(DiskImageObjectCache* pCache);
+static void freeCachedObject(DiskImageObject* pObject);
+static void unmapOutputImage(DiskImage* pThis);
 void DiskImage_Free(DiskImage* pThis)
 {
     if (!pThis)
@@ -44,8 +59,14 @@ void DiskImage_Free(DiskImage* pThis)
     
     if (pThis->pVTable)
         pThis->pVTable->freeObject(pThis);
+    unmapOutputImage(pThis);
     ByteBuffer_Free(&pThis->object);
     ByteBuffer_Free(&pThis->image);
+    ByteBuffer_Free(&pThis->baseline);
+    DiskImageManifest_Free(&pThis->manifest);
+    DiskImageManifest_Free(&pThis->previousManifest);
+    freeObjectCache(&pThis->objectCache);
+    ObjectBundle_Free(pThis->pBundle);
     DiskImageScriptEngine_Free(&pThis->script);
     free(pThis);
 }
@@ -53,6 +74,9 @@ void DiskImage_Free(DiskImage* pThis)
 static void DiskImageScriptEngine_Free(DiskImageScriptEngine* pThis)
 {
     ParseCSV_Free(pThis->pParser);
+    free(pThis->pDirtyRegions);
+    ByteBuffer_Free(&pThis->compressed);
+    freeInsertionList(&pThis->scheduledInsertions);
     closeTextFile(pThis);
 }
 
@@ -62,19 +86,73 @@ static void closeTextFile(DiskImageScriptEngine* pThis)
     pThis->pTextFile = NULL;
 }
 
+static void unmapOutputImage(DiskImage* pThis)
+{
+    /* A mapped image which was never written belongs to a build which failed so its temporary file is removed,
+       leaving any existing output image untouched just as on the heap buffer path. */
+    if (!pThis->pMappedImageFilename)
+        return;
+    
+    munmap(pThis->image.pBuffer, pThis->image.bufferSize);
+    pThis->image.pBuffer = NULL;
+    if (!pThis->hasWrittenMappedImage)
+        remove(pThis->pMappedTempFilename);
+    free(pThis->pMappedImageFilename);
+    free(pThis->pMappedTempFilename);
+    pThis->pMappedImageFilename = NULL;
+    pThis->pMappedTempFilename = NULL;
+}
 
-#define LOG_ERROR(pTHIS, FORMAT, ...) fprintf(stderr, \
-                                       "%s:%d: error: " FORMAT LINE_ENDING, \
-                                       pTHIS->pScriptFilename, \
-                                       pTHIS->lineNumber, \
-                                       __VA_ARGS__)
+
+/* Errors aren't reported or counted while planning an --update since any line which fails is run again and reports
+   it then. */
+#define LOG_ERROR(pTHIS, FORMAT, ...) do \
+                                      { \
+                                          if (!pTHIS->isPlanning) \
+                                          { \
+                                              pTHIS->errorCount++; \
+                                              fprintf(stderr, \
+                                                      "%s:%d: error: " FORMAT LINE_ENDING, \
+                                                      pTHIS->pScriptFilename, \
+                                                      pTHIS->lineNumber, \
+                                                      __VA_ARGS__); \
+                                          } \
+                                      } while (0)
+
+#define LOG_WARNING(pTHIS, FORMAT, ...) fprintf(stderr, \
+                                                "%s:%d: warning: " FORMAT LINE_ENDING, \
+                                                pTHIS->pScriptFilename, \
+                                                pTHIS->lineNumber, \
+                                                __VA_ARGS__)
 
 static void DiskImageScriptEngine_ProcessScriptFile(DiskImageScriptEngine* pThis, 
                                                     DiskImage*              pDiskImage, 
                                                     const char*             pScriptFilename);
 static void processScriptFromTextFile(DiskImageScriptEngine* pThis);
+static void prefetchObjectFiles(DiskImageScriptEngine* pThis);
+static int  canSkipUnchangedInsertions(DiskImageScriptEngine* pThis);
+static unsigned long long hashImage(const unsigned char* pImage, size_t imageSize);
+static void planInsertionsToSkip(DiskImageScriptEngine* pThis);
+static unsigned char* findDirtyRegions(DiskImage* pThis);
+static void hashRegionInsertions(DiskImage* pThis, DiskImageManifest* pManifest, unsigned long long* pHashes);
+static void getInsertRegions(DiskImage* pThis, DiskImageInsert* pInsert, unsigned int* pFirst, unsigned int* pLast);
+static unsigned int getRegionCount(DiskImage* pThis);
+static void processScriptLines(DiskImageScriptEngine* pThis);
+static void runScheduledInsertions(DiskImageScriptEngine* pThis);
+static void restoreUnchangedRegions(DiskImageScriptEngine* pThis);
+static void collectObjectFiles(DiskImageScriptEngine* pThis, DiskImageObject** ppObjects);
+static void addObjectFileFromScriptLine(DiskImageScriptEngine* pThis, 
+                                        const SizedString*     pScriptLine, 
+                                        DiskImageObject**      ppObjects);
+static int isObjectInsertionLine(const SizedString* pFields, size_t fieldCount);
 static int isLineAComment(const SizedString* pLine);
 static void processNextScriptLine(DiskImageScriptEngine* pThis, const SizedString* pScriptLine);
+static int  stripCompressField(const SizedString* pFields, size_t* pFieldCount);
+static void addCompressedStats(DiskImageScriptEngine* pThis);
+static void restoreUncompressedObject(DiskImageScriptEngine* pThis);
+static void compressObjectSlice(DiskImageScriptEngine* pThis);
+static unsigned int padToWholeSectors(DiskImageScriptEngine* pThis, unsigned int compressedSize);
+static unsigned int countTracksSpanned(const DiskImageInsert* pInsert);
 static void processBlockScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields);
 static void readObjectFile(DiskImage* pDiskImage, const SizedString* pFilenameString);
 static unsigned int parseLengthField(DiskImageScriptEngine* pThis, const SizedString* pLengthField);
@@ -91,15 +169,190 @@ static void setBlockInsertFieldsBaseOnScriptFields(DiskImageScriptEngine* pThis,
                                                    const SizedString* pFields);
 static void rememberLastInsertionInformation(DiskImageScriptEngine* pThis);
 static void processRWTS16ScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields);
+static void parseInterleaveField(DiskImageScriptEngine* pThis, 
+                                 const SizedString*     pField, 
+                                 DiskImageInterleave*   pInterleave);
+static void insertInterleavedSectors(DiskImageScriptEngine* pThis, const DiskImageInterleave* pInterleave);
+static void processInterleaveScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields);
 static void processRW18ScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields);
+static void insertObjectFile(DiskImageScriptEngine* pThis);
+static void scheduleInsertion(DiskImageScriptEngine* pThis);
+static int  doesInsertTouchDirtyRegion(DiskImageScriptEngine* pThis);
+static void validateSourceObjectParameters(DiskImage* pThis, DiskImageInsert* pInsert);
 static void processImageTableUpdates(DiskImageScriptEngine* pThis, unsigned short newImageTableAddress);
 static unsigned short getImageTableObjectSize(DiskImage* pDiskImage, unsigned short startImageTableAddress);
+static void makeScheduledInsertionsBeforeError(DiskImageScriptEngine* pThis);
 static void reportScriptLineException(DiskImageScriptEngine* pThis);
+static void reportInsertException(DiskImageScriptEngine* pThis, int exceptionCode);
+static const char* getInsertionTypeName(DiskImageInsertionType type);
+static void recordInsertion(DiskImageScriptEngine* pThis, DiskImageInsertionList* pList);
+static const unsigned char* getInsertionData(const DiskImageInsertionList* pList, size_t index);
 __throws void DiskImage_ProcessScriptFile(DiskImage* pThis, const char* pScriptFilename)
 {
     DiskImageScriptEngine_ProcessScriptFile(&pThis->script, pThis, pScriptFilename);
 }
 
+
+typedef struct DiskImageFanOut
+{
+    DiskImageInsertionList insertionList;
+    DiskImage**            ppImages;
+    const unsigned int*    pSides;
+    size_t                 imageCount;
+    int*                   pExceptionCodes;
+} DiskImageFanOut;
+
+static void processScriptFileForImages(DiskImage**         ppImages,
+                                       const unsigned int* pSides,
+                                       size_t              imageCount,
+                                       const char*         pScriptFilename);
+__throws void DiskImage_ProcessScriptFileForImages(DiskImage** ppImages, size_t imageCount, const char* pScriptFilename)
+{
+    processScriptFileForImages(ppImages, NULL, imageCount, pScriptFilename);
+}
+
+__throws void DiskImage_ProcessScriptFileForSides(DiskImage**         ppImages,
+                                                  const unsigned int* pSides,
+                                                  size_t              imageCount,
+                                                  const char*         pScriptFilename)
+{
+    processScriptFileForImages(ppImages, pSides, imageCount, pScriptFilename);
+}
+
+static void replayInsertions(void* pvFanOut, size_t imageIndex);
+static void flushImage(DiskImage* pThis);
+static int  shouldReplayInsertion(DiskImageFanOut* pFanOut, size_t imageIndex, const DiskImageInsert* pInsert);
+static int  isInsertionForAnyImage(DiskImageFanOut* pFanOut, const DiskImageInsert* pInsert);
+static void reportReplayExceptions(DiskImageFanOut* pFanOut, const char* pScriptFilename);
+static void processScriptFileForImages(DiskImage**         ppImages,
+                                       const unsigned int* pSides,
+                                       size_t              imageCount,
+                                       const char*         pScriptFilename)
+{
+    /* The first image parses the script and reads its objects, recording each insertion rather than making it.  The
+       recorded insertions are then made into every image concurrently.  The images are encoded afterwards, one at a
+       time, so that each can spread its tracks across all of the workers rather than just the one which made its
+       insertions.
+       Errors found while parsing are reported once and errors from the insertions themselves are reported for each
+       image which rejects them.  When pSides is given, RW18 insertions only go to the image for their side and
+       everything else only goes to the first image. */
+    DiskImageScriptEngine* pScript = &ppImages[0]->script;
+    DiskImageFanOut        fanOut;
+    size_t                 i;
+    
+    memset(&fanOut, 0, sizeof(fanOut));
+    fanOut.ppImages = ppImages;
+    fanOut.pSides = pSides;
+    fanOut.imageCount = imageCount;
+    __try
+    {
+        pScript->pInsertionList = &fanOut.insertionList;
+        DiskImageScriptEngine_ProcessScriptFile(pScript, ppImages[0], pScriptFilename);
+        pScript->pInsertionList = NULL;
+        if (fanOut.insertionList.hasRunOutOfMemory)
+            __throw(outOfMemoryException);
+        if (fanOut.insertionList.insertionCount > 0)
+        {
+            fanOut.pExceptionCodes = allocateAndZero(imageCount * fanOut.insertionList.insertionCount *
+                                                     sizeof(*fanOut.pExceptionCodes));
+            ThreadPool_Run(imageCount, replayInsertions, &fanOut);
+            for (i = 0 ; i < imageCount ; i++)
+                flushImage(ppImages[i]);
+            reportReplayExceptions(&fanOut, pScriptFilename);
+        }
+    }
+    __catch
+    {
+        pScript->pInsertionList = NULL;
+    }
+    free(fanOut.pExceptionCodes);
+    freeInsertionList(&fanOut.insertionList);
+    if (getExceptionCode() != noException)
+        __rethrow;
+}
+
+static void freeInsertionList(DiskImageInsertionList* pList)
+{
+    free(pList->pInsertions);
+    free(pList->pData);
+    memset(pList, 0, sizeof(*pList));
+}
+
+static void replayInsertions(void* pvFanOut, size_t imageIndex)
+{
+    DiskImageFanOut*        pFanOut = (DiskImageFanOut*)pvFanOut;
+    DiskImageInsertionList* pList = &pFanOut->insertionList;
+    DiskImage*              pImage = pFanOut->ppImages[imageIndex];
+    int*                    pExceptionCodes = pFanOut->pExceptionCodes + imageIndex * pList->insertionCount;
+    size_t                  i;
+    
+    for (i = 0 ; i < pList->insertionCount ; i++)
+    {
+        DiskImageInsert insert = pList->pInsertions[i].insert;
+        
+        if (!shouldReplayInsertion(pFanOut, imageIndex, &insert))
+        {
+            if (imageIndex == 0 && !isInsertionForAnyImage(pFanOut, &insert))
+                pExceptionCodes[i] = sideNotBuiltException;
+            continue;
+        }
+        __try
+        {
+            DiskImage_InsertData(pImage, getInsertionData(pList, i), &insert);
+        }
+        __catch
+        {
+            pExceptionCodes[i] = getExceptionCode();
+            clearExceptionCode();
+        }
+    }
+}
+
+static int shouldReplayInsertion(DiskImageFanOut* pFanOut, size_t imageIndex, const DiskImageInsert* pInsert)
+{
+    if (!pFanOut->pSides)
+        return TRUE;
+    if (pInsert->type != DISK_IMAGE_INSERTION_RW18)
+        return imageIndex == 0;
+    return pFanOut->pSides[imageIndex] == pInsert->side;
+}
+
+static int isInsertionForAnyImage(DiskImageFanOut* pFanOut, const DiskImageInsert* pInsert)
+{
+    size_t i;
+    
+    for (i = 0 ; i < pFanOut->imageCount ; i++)
+    {
+        if (shouldReplayInsertion(pFanOut, i, pInsert))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static void reportReplayExceptions(DiskImageFanOut* pFanOut, const char* pScriptFilename)
+{
+    DiskImageInsertionList* pList = &pFanOut->insertionList;
+    size_t                  i;
+    size_t                  j;
+    
+    for (i = 0 ; i < pFanOut->imageCount ; i++)
+    {
+        DiskImageScriptEngine* pScript = &pFanOut->ppImages[i]->script;
+        const int*             pExceptionCodes = pFanOut->pExceptionCodes + i * pList->insertionCount;
+        
+        pScript->pDiskImage = pFanOut->ppImages[i];
+        pScript->pScriptFilename = pScriptFilename;
+        for (j = 0 ; j < pList->insertionCount ; j++)
+        {
+            if (pExceptionCodes[j] == noException)
+                continue;
+            pScript->lineNumber = pList->pInsertions[j].lineNumber;
+            pScript->insert = pList->pInsertions[j].insert;
+            reportInsertException(pScript, pExceptionCodes[j]);
+        }
+    }
+}
+
 static void DiskImageScriptEngine_ProcessScriptFile(DiskImageScriptEngine* pThis, 
                                                     DiskImage*             pDiskImage, 
                                                     const char*            pScriptFilename)
@@ -109,7 +362,7 @@ static void DiskImageScriptEngine_ProcessScriptFile(DiskImageScriptEngine* pThis
         SizedString scriptFilename = SizedString_InitFromString(pScriptFilename);
         pThis->pScriptFilename = pScriptFilename;
         pThis->pDiskImage = pDiskImage;
-        pThis->pTextFile = TextFile_CreateFromFile(NULL, &scriptFilename, NULL);
+        pThis->pTextFile = TextFile_CreateFromVfs(pDiskImage->pVfs, NULL, &scriptFilename, NULL);
     }
     __catch
     {
@@ -121,8 +374,184 @@ static void DiskImageScriptEngine_ProcessScriptFile(DiskImageScriptEngine* pThis
 }
 
 static void processScriptFromTextFile(DiskImageScriptEngine* pThis)
+{
+    DiskImageStats* pStats = &pThis->pDiskImage->stats;
+    double          startTime = DiskImageStats_GetSeconds();
+    double          otherSeconds = pStats->objectReadSeconds + pStats->encodeSeconds;
+    
+    /* Images sharing a cache have already had their script's objects prefetched into it. */
+    if (!pThis->pDiskImage->pSharedObjectCache)
+        prefetchObjectFiles(pThis);
+    if (canSkipUnchangedInsertions(pThis))
+        planInsertionsToSkip(pThis);
+    processScriptLines(pThis);
+    runScheduledInsertions(pThis);
+    if (pThis->pDirtyRegions)
+        restoreUnchangedRegions(pThis);
+    closeTextFile(pThis);
+    otherSeconds = pStats->objectReadSeconds + pStats->encodeSeconds - otherSeconds;
+    pStats->parseSeconds += DiskImageStats_GetSeconds() - startTime - otherSeconds;
+}
+
+static void prefetchObjectFiles(DiskImageScriptEngine* pThis)
+{
+    /* Running out of memory while collecting the object filenames just leaves fewer objects to prefetch.  Any that
+       aren't prefetched are read by their script line as usual. */
+    DiskImageObject* pObjects = NULL;
+    
+    __try
+    {
+        collectObjectFiles(pThis, &pObjects);
+    }
+    __catch
+    {
+        clearExceptionCode();
+    }
+    TextFile_Reset(pThis->pTextFile);
+    DiskImage_PrefetchObjects(pThis->pDiskImage, pObjects);
+}
+
+static void collectObjectFiles(DiskImageScriptEngine* pThis, DiskImageObject** ppObjects)
+{
+    while (!TextFile_IsEndOfFile(pThis->pTextFile))
+    {
+        SizedString nextLine = TextFile_GetNextLine(pThis->pTextFile);
+        if (!isLineAComment(&nextLine))
+            addObjectFileFromScriptLine(pThis, &nextLine, ppObjects);
+    }
+}
+
+static void addObjectFileFromScriptLine(DiskImageScriptEngine* pThis, 
+                                        const SizedString*     pScriptLine, 
+                                        DiskImageObject**      ppObjects)
+{
+    DiskImageObject*   pObject;
+    size_t             fieldCount;
+    const SizedString* pFields;
+    
+    ParseCSV_Parse(pThis->pParser, pScriptLine);
+    fieldCount = ParseCSV_FieldCount(pThis->pParser);
+    pFields = ParseCSV_FieldPointers(pThis->pParser);
+    if (!isObjectInsertionLine(pFields, fieldCount))
+        return;
+    
+    pObject = allocateAndZero(sizeof(*pObject));
+    pObject->pNext = *ppObjects;
+    *ppObjects = pObject;
+    pObject->pFilename = SizedString_strdup(&pFields[1]);
+}
+
+static int canSkipUnchangedInsertions(DiskImageScriptEngine* pThis)
+{
+    /* Lines can only be skipped when the existing image is exactly the one described by the previous manifest and
+       nothing has been inserted into this image yet. */
+    DiskImage* pDiskImage = pThis->pDiskImage;
+    
+    return pDiskImage->isRecordingManifest &&
+           pDiskImage->hasPreviousManifest &&
+           pDiskImage->manifest.entryCount == 0 &&
+           pDiskImage->baseline.pBuffer &&
+           pDiskImage->previousManifest.imageHash == hashImage(pDiskImage->baseline.pBuffer, 
+                                                               pDiskImage->baseline.bufferSize);
+}
+
+static unsigned long long hashImage(const unsigned char* pImage, size_t imageSize)
+{
+    return DiskImageManifest_Hash(DISK_IMAGE_MANIFEST_HASH_SEED, pImage, imageSize);
+}
+
+static void planInsertionsToSkip(DiskImageScriptEngine* pThis)
+{
+    /* The first pass just records the insertions which the script would make.  Regions whose sequence of insertions
+       differs from the previous manifest are then the only ones rebuilt.  Any problem while planning falls back to
+       running every line so that errors are reported as usual. */
+    DiskImage*   pDiskImage = pThis->pDiskImage;
+    unsigned int lastBlock = pThis->lastBlock;
+    unsigned int lastLength = pThis->lastLength;
+    
+    pThis->isPlanning = TRUE;
+    pThis->hasPlanFailed = FALSE;
+    processScriptLines(pThis);
+    pThis->isPlanning = FALSE;
+    pThis->lastBlock = lastBlock;
+    pThis->lastLength = lastLength;
+    TextFile_Reset(pThis->pTextFile);
+    pDiskImage->hasPreviousManifest = FALSE;
+    
+    if (!pThis->hasPlanFailed)
+        pThis->pDirtyRegions = findDirtyRegions(pDiskImage);
+    if (!pThis->pDirtyRegions)
+        DiskImageManifest_Free(&pDiskImage->manifest);
+}
+
+static unsigned char* findDirtyRegions(DiskImage* pThis)
+{
+    unsigned int        regionCount = getRegionCount(pThis);
+    unsigned long long* pHashes = NULL;
+    unsigned char*      pDirtyRegions = NULL;
+    unsigned int        i;
+    
+    __try
+    {
+        pHashes = allocateAndZero(2 * regionCount * sizeof(*pHashes));
+        pDirtyRegions = allocateAndZero(regionCount);
+        hashRegionInsertions(pThis, &pThis->previousManifest, pHashes);
+        hashRegionInsertions(pThis, &pThis->manifest, pHashes + regionCount);
+    }
+    __catch
+    {
+        free(pHashes);
+        free(pDirtyRegions);
+        __nothrow_and_return(NULL);
+    }
+    
+    for (i = 0 ; i < regionCount ; i++)
+        pDirtyRegions[i] = pHashes[i] != pHashes[regionCount + i];
+    free(pHashes);
+    
+    return pDirtyRegions;
+}
+
+static void hashRegionInsertions(DiskImage* pThis, DiskImageManifest* pManifest, unsigned long long* pHashes)
+{
+    unsigned int regionCount = getRegionCount(pThis);
+    unsigned int i;
+    size_t       j;
+    
+    for (i = 0 ; i < regionCount ; i++)
+        pHashes[i] = DISK_IMAGE_MANIFEST_HASH_SEED;
+    for (j = 0 ; j < pManifest->entryCount ; j++)
+    {
+        DiskImageManifestEntry* pEntry = &pManifest->pEntries[j];
+        unsigned int            first;
+        unsigned int            last;
+        
+        getInsertRegions(pThis, &pEntry->insert, &first, &last);
+        for (i = first ; i <= last ; i++)
+            pHashes[i] = DiskImageManifest_HashEntry(pHashes[i], pEntry);
+    }
+}
+
+static void getInsertRegions(DiskImage* pThis, DiskImageInsert* pInsert, unsigned int* pFirst, unsigned int* pLast)
+{
+    unsigned int lastRegion = getRegionCount(pThis) - 1;
+    
+    pThis->pVTable->getInsertRegions(pThis, pInsert, pFirst, pLast);
+    if (*pLast > lastRegion)
+        *pLast = lastRegion;
+    if (*pFirst > *pLast)
+        *pFirst = *pLast;
+}
+
+static unsigned int getRegionCount(DiskImage* pThis)
+{
+    return pThis->image.bufferSize / pThis->regionSize;
+}
+
+static void processScriptLines(DiskImageScriptEngine* pThis)
 {
     pThis->lineNumber = 1;
+    DiskImageInterleave_InitIdentity(&pThis->interleave);
     while (!TextFile_IsEndOfFile(pThis->pTextFile))
     {
         SizedString nextLine = TextFile_GetNextLine(pThis->pTextFile);
@@ -130,7 +559,32 @@ static void processScriptFromTextFile(DiskImageScriptEngine* pThis)
             processNextScriptLine(pThis, &nextLine);
         pThis->lineNumber++;
     }
-    closeTextFile(pThis);
+}
+
+static void restoreUnchangedRegions(DiskImageScriptEngine* pThis)
+{
+    /* Insertions into rebuilt regions can spill over into neighbouring regions which weren't rebuilt so those are
+       copied back from the existing image. */
+    DiskImage*     pDiskImage = pThis->pDiskImage;
+    unsigned char* pImage = DiskImage_GetImagePointer(pDiskImage);
+    unsigned int   regionSize = pDiskImage->regionSize;
+    unsigned int   regionCount = getRegionCount(pDiskImage);
+    unsigned int   i;
+    
+    for (i = 0 ; i < regionCount ; i++)
+    {
+        if (!pThis->pDirtyRegions[i])
+            memcpy(pImage + i * regionSize, pDiskImage->baseline.pBuffer + i * regionSize, regionSize);
+    }
+    free(pThis->pDirtyRegions);
+    pThis->pDirtyRegions = NULL;
+}
+
+static int isObjectInsertionLine(const SizedString* pFields, size_t fieldCount)
+{
+    return fieldCount >= 2 && (0 == SizedString_strcasecmp(&pFields[0], "block") ||
+                               0 == SizedString_strcasecmp(&pFields[0], "rwts16") ||
+                               0 == SizedString_strcasecmp(&pFields[0], "rw18"));
 }
 
 static int isLineAComment(const SizedString* pLine)
@@ -143,14 +597,17 @@ static void processNextScriptLine(DiskImageScriptEngine* pThis, const SizedStrin
     size_t             fieldCount;
     const SizedString* pFields;
     
+    pThis->pDiskImage->stats.scriptLineCount++;
     ParseCSV_Parse(pThis->pParser, pScriptLine);
     fieldCount = ParseCSV_FieldCount(pThis->pParser);
     pFields = ParseCSV_FieldPointers(pThis->pParser);
     if (fieldCount < 1 || SizedString_strlen(&pFields[0]) == 0)
     {
+        makeScheduledInsertionsBeforeError(pThis);
         LOG_ERROR(pThis, "%s cannot be blank.", "Script line");
         return;
     }
+    pThis->isCompressing = stripCompressField(pFields, &fieldCount);
     
     __try
     {
@@ -160,23 +617,137 @@ static void processNextScriptLine(DiskImageScriptEngine* pThis, const SizedStrin
             processRWTS16ScriptLine(pThis, fieldCount, pFields);
         else if (0 == SizedString_strcasecmp(&pFields[0], "rw18"))
             processRW18ScriptLine(pThis, fieldCount, pFields);
+        else if (0 == SizedString_strcasecmp(&pFields[0], "interleave"))
+            processInterleaveScriptLine(pThis, fieldCount, pFields);
         else
+        {
+            makeScheduledInsertionsBeforeError(pThis);
             LOG_ERROR(pThis, "%.*s isn't a recognized image insertion type of BLOCK or RWTS16.", 
                       pFields[0].stringLength, pFields[0].pString);
+        }
+        addCompressedStats(pThis);
     }
     __catch
     {
+        pThis->hasPlanFailed = TRUE;
         reportScriptLineException(pThis);
-        __nothrow;
+        clearExceptionCode();
+    }
+    restoreUncompressedObject(pThis);
+}
+
+static int stripCompressField(const SizedString* pFields, size_t* pFieldCount)
+{
+    if (!isObjectInsertionLine(pFields, *pFieldCount) || 
+        0 != SizedString_strcasecmp(&pFields[*pFieldCount - 1], "compress"))
+        return FALSE;
+    (*pFieldCount)--;
+    return TRUE;
+}
+
+static void addCompressedStats(DiskImageScriptEngine* pThis)
+{
+    if (pThis->hasCompressedObject && !pThis->isPlanning)
+        DiskImageStats_Add(&pThis->pDiskImage->stats, &pThis->compressedStats);
+}
+
+static void restoreUncompressedObject(DiskImageScriptEngine* pThis)
+{
+    DiskImage* pDiskImage = pThis->pDiskImage;
+    
+    if (!pThis->hasCompressedObject)
+        return;
+    pDiskImage->pObjectData = pThis->pUncompressedObjectData;
+    pDiskImage->objectFileLength = pThis->uncompressedObjectFileLength;
+    pDiskImage->objectDataSize = pThis->uncompressedObjectDataSize;
+    pThis->hasCompressedObject = FALSE;
+}
+
+static void compressObjectSlice(DiskImageScriptEngine* pThis)
+{
+    /* The compressed slice stands in for the object until the end of the line so the rest of the insertion path, the
+       manifest, --update, and multiple image builds included, treats it like any other object data. */
+    DiskImage*      pDiskImage = pThis->pDiskImage;
+    DiskImageInsert uncompressedInsert = pThis->insert;
+    unsigned int    compressedSize;
+    
+    if (!pThis->isCompressing)
+        return;
+    validateSourceObjectParameters(pDiskImage, &pThis->insert);
+    compressedSize = DiskImageCompress_Compress(&pThis->compressed, 
+                                                pDiskImage->pObjectData + pThis->insert.sourceOffset,
+                                                pThis->insert.length);
+    if (pThis->insert.type == DISK_IMAGE_INSERTION_RWTS16)
+        compressedSize = padToWholeSectors(pThis, compressedSize);
+    pThis->pUncompressedObjectData = pDiskImage->pObjectData;
+    pThis->uncompressedObjectFileLength = pDiskImage->objectFileLength;
+    pThis->uncompressedObjectDataSize = pDiskImage->objectDataSize;
+    pThis->hasCompressedObject = TRUE;
+    pDiskImage->pObjectData = pThis->compressed.pBuffer;
+    pDiskImage->objectFileLength = compressedSize;
+    pDiskImage->objectDataSize = compressedSize;
+    pThis->insert.sourceOffset = 0;
+    pThis->insert.length = compressedSize;
+    
+    memset(&pThis->compressedStats, 0, sizeof(pThis->compressedStats));
+    pThis->compressedStats.compressedInserts = 1;
+    pThis->compressedStats.compressedInputBytes = uncompressedInsert.length;
+    pThis->compressedStats.compressedOutputBytes = compressedSize;
+    pThis->compressedStats.uncompressedTrackReads = countTracksSpanned(&uncompressedInsert);
+    pThis->compressedStats.compressedTrackReads = countTracksSpanned(&pThis->insert);
+}
+
+static unsigned int padToWholeSectors(DiskImageScriptEngine* pThis, unsigned int compressedSize)
+{
+    /* RWTS16 lines only insert whole sectors so the compressed data is padded with zeroes, which the decompressor never
+       reads since they follow the end token. */
+    unsigned int paddedSize = (compressedSize + DISK_IMAGE_BYTES_PER_SECTOR - 1) & ~(DISK_IMAGE_BYTES_PER_SECTOR - 1);
+    ByteBuffer   padded = { NULL, 0 };
+    
+    if (paddedSize <= pThis->compressed.bufferSize)
+        return paddedSize;
+    ByteBuffer_Allocate(&padded, paddedSize);
+    memcpy(padded.pBuffer, pThis->compressed.pBuffer, compressedSize);
+    ByteBuffer_Free(&pThis->compressed);
+    pThis->compressed = padded;
+    
+    return paddedSize;
+}
+
+static unsigned int countTracksSpanned(const DiskImageInsert* pInsert)
+{
+    /* Block images have no tracks of their own so every 8 blocks are counted as a track, like a 5.25" ProDOS disk. */
+    unsigned int trackSize;
+    unsigned int offset;
+    
+    if (pInsert->length == 0)
+        return 0;
+    switch (pInsert->type)
+    {
+    case DISK_IMAGE_INSERTION_RW18:
+        trackSize = DISK_IMAGE_RW18_BYTES_PER_TRACK;
+        offset = pInsert->intraTrackOffset;
+        break;
+    case DISK_IMAGE_INSERTION_RWTS16:
+        trackSize = DISK_IMAGE_INTERLEAVE_SECTORS * DISK_IMAGE_BYTES_PER_SECTOR;
+        offset = pInsert->sector * DISK_IMAGE_BYTES_PER_SECTOR;
+        break;
+    case DISK_IMAGE_INSERTION_BLOCK:
+    default:
+        trackSize = DISK_IMAGE_INTERLEAVE_SECTORS * DISK_IMAGE_BYTES_PER_SECTOR;
+        offset = pInsert->block * DISK_IMAGE_BLOCK_SIZE + pInsert->intraBlockOffset;
+        break;
     }
+    return (offset % trackSize + pInsert->length - 1) / trackSize + 1;
 }
 
 static void processBlockScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields)
 {
     if (fieldCount < 5 || fieldCount > 6)
     {
+        makeScheduledInsertionsBeforeError(pThis);
         LOG_ERROR(pThis, 
-                  "%s doesn't contain correct fields: BLOCK,objectFilename,objectStartOffset,insertionLength,block[,intraBlockOffset]",
+                  "%s doesn't contain correct fields: BLOCK,objectFilename,objectStartOffset,insertionLength,block[,intraBlockOffset][,compress]",
                   "Line");
         __throw(invalidArgumentException);
     }
@@ -186,8 +757,9 @@ static void processBlockScriptLine(DiskImageScriptEngine* pThis, size_t fieldCou
     pThis->insert.length = parseLengthField(pThis, &pFields[3]);
     pThis->insert.type = DISK_IMAGE_INSERTION_BLOCK;
     parseBlockRelatedFieldsAndSetInsertFields(pThis, fieldCount, pFields);
+    compressObjectSlice(pThis);
     rememberLastInsertionInformation(pThis);
-    DiskImage_InsertObjectFile(pThis->pDiskImage, &pThis->insert);
+    insertObjectFile(pThis);
 }
 
 static void readObjectFile(DiskImage* pDiskImage, const SizedString* pFilenameString)
@@ -265,13 +837,19 @@ static void rememberLastInsertionInformation(DiskImageScriptEngine* pThis)
 
 static void processRWTS16ScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields)
 {
-    if (fieldCount != 6)
+    DiskImageInterleave interleave = pThis->interleave;
+    
+    if (fieldCount < 6 || fieldCount > 7)
     {
+        makeScheduledInsertionsBeforeError(pThis);
         LOG_ERROR(pThis, 
-                  "%s doesn't contain correct fields: RWTS16,objectFilename,objectStartOffset,insertionLength,track,sector",
+                  "%s doesn't contain correct fields: "
+                    "RWTS16,objectFilename,objectStartOffset,insertionLength,track,sector[,interleave][,compress]",
                   "Line");
         __throw(invalidArgumentException);
     }
+    if (fieldCount > 6)
+        parseInterleaveField(pThis, &pFields[6], &interleave);
     
     readObjectFile(pThis->pDiskImage, &pFields[1]);
     pThis->insert.sourceOffset = SizedString_strtoul(&pFields[2], NULL, 0);
@@ -279,16 +857,77 @@ static void processRWTS16ScriptLine(DiskImageScriptEngine* pThis, size_t fieldCo
     pThis->insert.type = DISK_IMAGE_INSERTION_RWTS16;
     pThis->insert.track = SizedString_strtoul(&pFields[4], NULL, 0);
     pThis->insert.sector = SizedString_strtoul(&pFields[5], NULL, 0);
-    DiskImage_InsertObjectFile(pThis->pDiskImage, &pThis->insert);
+    compressObjectSlice(pThis);
+    if (DiskImageInterleave_IsIdentity(&interleave) || pThis->insert.sector >= DISK_IMAGE_INTERLEAVE_SECTORS)
+        insertObjectFile(pThis);
+    else
+        insertInterleavedSectors(pThis, &interleave);
+}
+
+static void parseInterleaveField(DiskImageScriptEngine* pThis, 
+                                 const SizedString*     pField, 
+                                 DiskImageInterleave*   pInterleave)
+{
+    __try
+    {
+        DiskImageInterleave_Parse(pInterleave, pField);
+    }
+    __catch
+    {
+        makeScheduledInsertionsBeforeError(pThis);
+        LOG_ERROR(pThis, "%.*s isn't a recognized interleave of identity, dos3.3, prodos, skew:n, or 16 hex digits.",
+                  pField->stringLength, pField->pString);
+        __rethrow;
+    }
+}
+
+static void insertInterleavedSectors(DiskImageScriptEngine* pThis, const DiskImageInterleave* pInterleave)
+{
+    /* Each sector is inserted on its own, at the physical sector which the interleave maps its logical sector to, so
+       manifests and --update see ordinary single sector RWTS16 insertions. */
+    unsigned int sourceOffset = pThis->insert.sourceOffset;
+    unsigned int bytesLeft = pThis->insert.length;
+    unsigned int track = pThis->insert.track;
+    unsigned int logicalSector = pThis->insert.sector;
+    
+    validateSourceObjectParameters(pThis->pDiskImage, &pThis->insert);
+    do
+    {
+        pThis->insert.sourceOffset = sourceOffset;
+        pThis->insert.length = bytesLeft < DISK_IMAGE_BYTES_PER_SECTOR ? bytesLeft : DISK_IMAGE_BYTES_PER_SECTOR;
+        pThis->insert.track = track;
+        pThis->insert.sector = pInterleave->physicalSectors[logicalSector];
+        insertObjectFile(pThis);
+        
+        sourceOffset += pThis->insert.length;
+        bytesLeft -= pThis->insert.length;
+        if (++logicalSector >= DISK_IMAGE_INTERLEAVE_SECTORS)
+        {
+            logicalSector = 0;
+            track++;
+        }
+    } while (bytesLeft > 0);
+}
+
+static void processInterleaveScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields)
+{
+    if (fieldCount != 2)
+    {
+        makeScheduledInsertionsBeforeError(pThis);
+        LOG_ERROR(pThis, "%s doesn't contain correct fields: INTERLEAVE,interleave", "Line");
+        __throw(invalidArgumentException);
+    }
+    parseInterleaveField(pThis, &pFields[1], &pThis->interleave);
 }
 
 static void processRW18ScriptLine(DiskImageScriptEngine* pThis, size_t fieldCount, const SizedString* pFields)
 {
     if (fieldCount < 7 || fieldCount > 8)
     {
+        makeScheduledInsertionsBeforeError(pThis);
         LOG_ERROR(pThis, 
                   "%s doesn't contain correct fields: "
-                    "RW18,objectFilename,objectStartOffset,insertionLength,side,track,offset[,imageTableAddress]",
+                    "RW18,objectFilename,objectStartOffset,insertionLength,side,track,offset[,imageTableAddress][,compress]",
                   "Line");
         __throw(invalidArgumentException);
     }
@@ -305,8 +944,138 @@ static void processRW18ScriptLine(DiskImageScriptEngine* pThis, size_t fieldCoun
                                                                                    pThis->pDiskImage->insert.intraTrackOffset);
     if (fieldCount > 7)
         processImageTableUpdates(pThis, SizedString_strtoul(&pFields[7], NULL, 0));
+    compressObjectSlice(pThis);
+
+    insertObjectFile(pThis);
+}
+
+static void insertObjectFile(DiskImageScriptEngine* pThis)
+{
+    DiskImage* pDiskImage = pThis->pDiskImage;
+    
+    if (pThis->isPlanning)
+    {
+        unsigned int first;
+        unsigned int last;
+        
+        validateSourceObjectParameters(pDiskImage, &pThis->insert);
+        getInsertRegions(pDiskImage, &pThis->insert, &first, &last);
+        DiskImageManifest_AddEntry(&pDiskImage->manifest, &pThis->insert, pDiskImage->pObjectData);
+        return;
+    }
+    if (pThis->pInsertionList)
+    {
+        validateSourceObjectParameters(pDiskImage, &pThis->insert);
+        recordInsertion(pThis, pThis->pInsertionList);
+        return;
+    }
+    if (pThis->pDirtyRegions && !doesInsertTouchDirtyRegion(pThis))
+        return;
+    
+    scheduleInsertion(pThis);
+}
+
+static void scheduleInsertion(DiskImageScriptEngine* pThis)
+{
+    /* The insertion is validated now so that its errors are still reported in script order, but it is only made once
+       every line has been parsed.  If it can't be recorded then the insertions recorded so far are made first so that
+       this one still lands after them. */
+    DiskImage*              pDiskImage = pThis->pDiskImage;
+    DiskImageInsertionList* pList = &pThis->scheduledInsertions;
+    unsigned int            first;
+    unsigned int            last;
+    
+    validateSourceObjectParameters(pDiskImage, &pThis->insert);
+    getInsertRegions(pDiskImage, &pThis->insert, &first, &last);
+    recordInsertion(pThis, pList);
+    if (!pList->hasRunOutOfMemory)
+        return;
+    
+    pList->hasRunOutOfMemory = FALSE;
+    runScheduledInsertions(pThis);
+    DiskImage_InsertObjectFile(pDiskImage, &pThis->insert);
+    if (pDiskImage->isRecordingManifest && !pThis->pDirtyRegions)
+        DiskImageManifest_AddEntry(&pDiskImage->manifest, &pThis->insert, pDiskImage->pObjectData);
+}
+
+static int isObjectDataCached(DiskImageScriptEngine* pThis);
+static void recordInsertion(DiskImageScriptEngine* pThis, DiskImageInsertionList* pList)
+{
+    DiskImage*           pDiskImage = pThis->pDiskImage;
+    const unsigned char* pData = pDiskImage->pObjectData + pThis->insert.sourceOffset;
+    DiskImageInsertion*  pInsertion;
+    int                  isCached = isObjectDataCached(pThis);
+    
+    if (pList->insertionCount >= pList->allocatedInsertions)
+    {
+        size_t              newCount = pList->allocatedInsertions ? pList->allocatedInsertions * 2 : 64;
+        DiskImageInsertion* pRealloc = realloc(pList->pInsertions, newCount * sizeof(*pRealloc));
+        
+        if (!pRealloc)
+        {
+            pList->hasRunOutOfMemory = TRUE;
+            return;
+        }
+        pList->pInsertions = pRealloc;
+        pList->allocatedInsertions = newCount;
+    }
+    if (!isCached && pList->dataSize + pThis->insert.length > pList->allocatedDataSize)
+    {
+        size_t         newSize = 2 * (pList->dataSize + pThis->insert.length);
+        unsigned char* pRealloc = realloc(pList->pData, newSize);
+        
+        if (!pRealloc)
+        {
+            pList->hasRunOutOfMemory = TRUE;
+            return;
+        }
+        pList->pData = pRealloc;
+        pList->allocatedDataSize = newSize;
+    }
+    
+    pInsertion = &pList->pInsertions[pList->insertionCount++];
+    pInsertion->insert = pThis->insert;
+    pInsertion->insert.sourceOffset = 0;
+    pInsertion->pCachedData = isCached ? pData : NULL;
+    pInsertion->dataOffset = pList->dataSize;
+    pInsertion->lineNumber = pThis->lineNumber;
+    if (isCached)
+        return;
+    memcpy(pList->pData + pList->dataSize, pData, pThis->insert.length);
+    pList->dataSize += pThis->insert.length;
+}
+
+static int isObjectDataCached(DiskImageScriptEngine* pThis)
+{
+    /* Image table updates and compressed lines build their data in buffers which the next line reuses.  Any other
+       object data belongs to an object in the cache, which outlives the script. */
+    DiskImage* pDiskImage = pThis->pDiskImage;
+    
+    return pDiskImage->pObjectData != pDiskImage->object.pBuffer && pDiskImage->pObjectData != pThis->compressed.pBuffer;
+}
 
-    DiskImage_InsertObjectFile(pThis->pDiskImage, &pThis->insert);
+static const unsigned char* getInsertionData(const DiskImageInsertionList* pList, size_t index)
+{
+    const DiskImageInsertion* pInsertion = &pList->pInsertions[index];
+    
+    if (pInsertion->pCachedData)
+        return pInsertion->pCachedData;
+    return pList->pData + pInsertion->dataOffset;
+}
+
+static int doesInsertTouchDirtyRegion(DiskImageScriptEngine* pThis)
+{
+    unsigned int first;
+    unsigned int last;
+    unsigned int i;
+    
+    getInsertRegions(pThis->pDiskImage, &pThis->insert, &first, &last);
+    for (i = first ; i <= last ; i++)
+    {
+        if (pThis->pDirtyRegions[i])
+            return TRUE;
+    }
+    return FALSE;
 }
 
 static void processImageTableUpdates(DiskImageScriptEngine* pThis, unsigned short newImageTableAddress)
@@ -321,8 +1090,8 @@ static void processImageTableUpdates(DiskImageScriptEngine* pThis, unsigned shor
 
 static unsigned short getImageTableObjectSize(DiskImage* pDiskImage, unsigned short startImageTableAddress)
 {
-    unsigned char* pObject = pDiskImage->object.pBuffer;
-    unsigned char  imageCount;
+    const unsigned char* pObject = pDiskImage->pObjectData;
+    unsigned char        imageCount;
     unsigned short lastImageTableAddress;
     
     imageCount = *pObject++;
@@ -333,11 +1102,20 @@ static unsigned short getImageTableObjectSize(DiskImage* pDiskImage, unsigned sh
     return (lastImageTableAddress - startImageTableAddress);
 }
 
+static void makeScheduledInsertionsBeforeError(DiskImageScriptEngine* pThis)
+{
+    /* Errors found while parsing a line are reported straight away but the insertions scheduled by earlier lines
+       haven't been made yet.  Making them first reports their errors ahead of this one, keeping script order. */
+    if (!pThis->isPlanning)
+        runScheduledInsertions(pThis);
+}
+
 static void reportScriptLineException(DiskImageScriptEngine* pThis)
 {
     const SizedString* pFields = ParseCSV_FieldPointers(pThis->pParser);
     int                exceptionCode = getExceptionCode();
     
+    makeScheduledInsertionsBeforeError(pThis);
     assert ( exceptionCode == fileOpenException ||
              exceptionCode == fileException || 
              exceptionCode == invalidArgumentException ||
@@ -358,14 +1136,22 @@ static void reportScriptLineException(DiskImageScriptEngine* pThis)
     else if (exceptionCode == fileException)
         LOG_ERROR(pThis, "Failed to process '%.*s' object file.", 
                   pFields[1].stringLength, pFields[1].pString);
-    else if (exceptionCode == blockExceedsImageBoundsException)
+    else if (exceptionCode != invalidArgumentException)
+        reportInsertException(pThis, exceptionCode);
+}
+
+static void reportInsertException(DiskImageScriptEngine* pThis, int exceptionCode)
+{
+    if (exceptionCode == blockExceedsImageBoundsException)
         LOG_ERROR(pThis, "Write starting at block %u offset %u won't fit in output image file.", 
                   pThis->insert.block, pThis->insert.intraBlockOffset);
     else if (exceptionCode == invalidInsertionTypeException)
-        LOG_ERROR(pThis, "%.*s insertion type isn't supported for this output image type.", 
-                  pFields[0].stringLength, pFields[0].pString);
+        LOG_ERROR(pThis, "%s insertion type isn't supported for this output image type.", 
+                  getInsertionTypeName(pThis->insert.type));
     else if (exceptionCode == invalidSideException)
         LOG_ERROR(pThis, "0x%x specifies an invalid side.  Must be 0xa9, 0xad, 0x79.", pThis->insert.side);
+    else if (exceptionCode == sideNotBuiltException)
+        LOG_ERROR(pThis, "0x%x side isn't one of the sides being built.", pThis->insert.side);
     else if (exceptionCode == invalidSectorException)
         LOG_ERROR(pThis, "%u specifies an invalid sector.  Must be 0 - 15.", pThis->insert.sector);
     else if (exceptionCode == invalidTrackException)
@@ -384,87 +1170,607 @@ static void reportScriptLineException(DiskImageScriptEngine* pThis)
     else if (exceptionCode == invalidLengthException)
         LOG_ERROR(pThis, "%u specifies an invalid legnth.", 
                   pThis->insert.length);
+    else
+        LOG_ERROR(pThis, "Insertion failed with exception %d.", exceptionCode);
 }
 
-
-static void DiskImageScriptEngine_ProcessScript(DiskImageScriptEngine* pThis, 
-                                                DiskImage*             pDiskImage,
-                                                char*                  pScriptText);
-__throws void DiskImage_ProcessScript(DiskImage* pThis, char* pScriptText)
+static const char* getInsertionTypeName(DiskImageInsertionType type)
 {
-    DiskImageScriptEngine_ProcessScript(&pThis->script, pThis, pScriptText);
+    switch (type)
+    {
+    case DISK_IMAGE_INSERTION_RWTS16:
+        return "RWTS16";
+    case DISK_IMAGE_INSERTION_RW18:
+        return "RW18";
+    case DISK_IMAGE_INSERTION_BLOCK:
+    default:
+        return "BLOCK";
+    }
 }
 
-static void DiskImageScriptEngine_ProcessScript(DiskImageScriptEngine* pThis, 
-                                                DiskImage*             pDiskImage,
-                                                char*                  pScriptText)
-{
-    pThis->pDiskImage = pDiskImage;
-    pThis->pScriptFilename = "<null>";
-    pThis->pTextFile = TextFile_CreateFromString(pScriptText);
 
-    processScriptFromTextFile(pThis);
+typedef struct DiskImageScheduledRun
+{
+    DiskImage*              pDiskImage;
+    DiskImageInsertionList* pList;
+    DiskImageSchedule       schedule;
+    DiskImageStats*         pGroupStats;
+    int*                    pExceptionCodes;
+} DiskImageScheduledRun;
+
+static int  prepareScheduledRun(DiskImageScriptEngine* pThis, DiskImageScheduledRun* pRun);
+static void buildSchedule(DiskImage* pDiskImage, DiskImageInsertionList* pList, DiskImageSchedule* pSchedule);
+static DiskImageInterval getRegionInterval(DiskImage* pDiskImage, DiskImageInsert* pInsert);
+static DiskImageInterval getSpanInterval(const DiskImageInsert* pInsert);
+static void makeScheduledGroup(void* pvRun, size_t groupIndex);
+static int  makeInsertion(DiskImage* pDiskImage, DiskImageInsertionList* pList, size_t index, DiskImageStats* pStats);
+static void finishScheduledRun(DiskImageScriptEngine* pThis, DiskImageScheduledRun* pRun);
+static void makeInsertionsInScriptOrder(DiskImageScriptEngine* pThis);
+static void finishInsertion(DiskImageScriptEngine* pThis, size_t index, int exceptionCode, size_t overwrite);
+static void freeScheduledRun(DiskImageScheduledRun* pRun);
+static void runScheduledInsertions(DiskImageScriptEngine* pThis)
+{
+    /* Groups of insertions which touch disjoint regions are made concurrently, each group by a single worker in script
+       order so that later lines still overwrite earlier ones.  Each group counts its stats separately until the pool
+       is done.  If there isn't enough memory to schedule the insertions then they are just made one at a time.
+       Errors and overlap warnings are reported afterwards in script order. */
+    DiskImageInsertionList* pList = &pThis->scheduledInsertions;
+    DiskImageInsert         insert = pThis->insert;
+    unsigned int            lineNumber = pThis->lineNumber;
+    DiskImageScheduledRun   run;
+    
+    memset(&run, 0, sizeof(run));
+    run.pDiskImage = pThis->pDiskImage;
+    run.pList = pList;
+    __try
+    {
+        if (pList->insertionCount > 0 && prepareScheduledRun(pThis, &run))
+        {
+            ThreadPool_Run(run.schedule.groupCount, makeScheduledGroup, &run);
+            finishScheduledRun(pThis, &run);
+        }
+        else
+        {
+            makeInsertionsInScriptOrder(pThis);
+        }
+    }
+    __catch
+    {
+    }
+    freeScheduledRun(&run);
+    freeInsertionList(pList);
+    pThis->insert = insert;
+    pThis->lineNumber = lineNumber;
+    if (getExceptionCode() != noException)
+        __rethrow;
+}
+
+static int prepareScheduledRun(DiskImageScriptEngine* pThis, DiskImageScheduledRun* pRun)
+{
+    __try
+    {
+        buildSchedule(pThis->pDiskImage, pRun->pList, &pRun->schedule);
+        pRun->pGroupStats = allocateAndZero(pRun->schedule.groupCount * sizeof(*pRun->pGroupStats));
+        pRun->pExceptionCodes = allocateAndZero(pRun->pList->insertionCount * sizeof(*pRun->pExceptionCodes));
+    }
+    __catch
+    {
+        freeScheduledRun(pRun);
+        __nothrow_and_return(FALSE);
+    }
+    return TRUE;
+}
+
+static void buildSchedule(DiskImage* pDiskImage, DiskImageInsertionList* pList, DiskImageSchedule* pSchedule)
+{
+    size_t             count = pList->insertionCount;
+    DiskImageInterval* pIntervals = allocateAndZero(2 * count * sizeof(*pIntervals));
+    size_t             i;
+    
+    __try
+    {
+        for (i = 0 ; i < count ; i++)
+        {
+            pIntervals[i] = getRegionInterval(pDiskImage, &pList->pInsertions[i].insert);
+            pIntervals[count + i] = getSpanInterval(&pList->pInsertions[i].insert);
+        }
+        DiskImageSchedule_Build(pSchedule, pIntervals, pIntervals + count, count);
+    }
+    __catch
+    {
+    }
+    free(pIntervals);
+    if (getExceptionCode() != noException)
+        __rethrow;
+}
+
+static DiskImageInterval getRegionInterval(DiskImage* pDiskImage, DiskImageInsert* pInsert)
+{
+    DiskImageInterval interval;
+    unsigned int      first;
+    unsigned int      last;
+    
+    getInsertRegions(pDiskImage, pInsert, &first, &last);
+    interval.start = first;
+    interval.end = (unsigned long long)last + 1;
+    
+    return interval;
+}
+
+static DiskImageInterval getSpanInterval(const DiskImageInsert* pInsert)
+{
+    /* The bytes written by each insertion type, and by each RW18 side, are kept apart in their own 4GB window so that
+       only lines of the same type are checked against each other for overlaps. */
+    DiskImageInterval  interval;
+    unsigned long long window;
+    unsigned long long offset;
+    
+    switch (pInsert->type)
+    {
+    case DISK_IMAGE_INSERTION_RW18:
+        window = 2 + (unsigned long long)pInsert->side;
+        offset = (unsigned long long)pInsert->track * DISK_IMAGE_RW18_BYTES_PER_TRACK + pInsert->intraTrackOffset;
+        break;
+    case DISK_IMAGE_INSERTION_RWTS16:
+        window = 1;
+        offset = ((unsigned long long)pInsert->track * DISK_IMAGE_INTERLEAVE_SECTORS + pInsert->sector) *
+                 DISK_IMAGE_BYTES_PER_SECTOR;
+        break;
+    case DISK_IMAGE_INSERTION_BLOCK:
+    default:
+        window = 0;
+        offset = (unsigned long long)pInsert->block * DISK_IMAGE_BLOCK_SIZE + pInsert->intraBlockOffset;
+        break;
+    }
+    interval.start = (window << 32) + offset;
+    interval.end = interval.start + pInsert->length;
+    
+    return interval;
+}
+
+static void makeScheduledGroup(void* pvRun, size_t groupIndex)
+{
+    DiskImageScheduledRun*   pRun = (DiskImageScheduledRun*)pvRun;
+    const DiskImageSchedule* pSchedule = &pRun->schedule;
+    size_t                   i;
+    
+    for (i = pSchedule->pGroupStarts[groupIndex] ; i < pSchedule->pGroupStarts[groupIndex + 1] ; i++)
+    {
+        size_t index = pSchedule->pOrder[i];
+        
+        pRun->pExceptionCodes[index] = makeInsertion(pRun->pDiskImage, pRun->pList, index,
+                                                     &pRun->pGroupStats[groupIndex]);
+    }
+}
+
+static int makeInsertion(DiskImage* pDiskImage, DiskImageInsertionList* pList, size_t index, DiskImageStats* pStats)
+{
+    DiskImageInsert insert = pList->pInsertions[index].insert;
+    int             exceptionCode = noException;
+    
+    __try
+    {
+        pDiskImage->pVTable->insertData(pDiskImage, getInsertionData(pList, index), &insert, pStats);
+    }
+    __catch
+    {
+        exceptionCode = getExceptionCode();
+        clearExceptionCode();
+    }
+    return exceptionCode;
+}
+
+static void finishScheduledRun(DiskImageScriptEngine* pThis, DiskImageScheduledRun* pRun)
+{
+    size_t i;
+    
+    for (i = 0 ; i < pRun->schedule.groupCount ; i++)
+        DiskImageStats_Add(&pThis->pDiskImage->stats, &pRun->pGroupStats[i]);
+    for (i = 0 ; i < pRun->pList->insertionCount ; i++)
+        finishInsertion(pThis, i, pRun->pExceptionCodes[i], pRun->schedule.pOverwrites[i]);
+}
+
+static void makeInsertionsInScriptOrder(DiskImageScriptEngine* pThis)
+{
+    DiskImage*              pDiskImage = pThis->pDiskImage;
+    DiskImageInsertionList* pList = &pThis->scheduledInsertions;
+    size_t                  i;
+    
+    for (i = 0 ; i < pList->insertionCount ; i++)
+    {
+        int exceptionCode = makeInsertion(pDiskImage, pList, i, &pDiskImage->stats);
+        
+        finishInsertion(pThis, i, exceptionCode, DISK_IMAGE_SCHEDULE_NO_OVERWRITE);
+    }
+}
+
+static void finishInsertion(DiskImageScriptEngine* pThis, size_t index, int exceptionCode, size_t overwrite)
+{
+    DiskImage*              pDiskImage = pThis->pDiskImage;
+    DiskImageInsertionList* pList = &pThis->scheduledInsertions;
+    DiskImageInsertion*     pInsertion = &pList->pInsertions[index];
+    
+    pThis->lineNumber = pInsertion->lineNumber;
+    pThis->insert = pInsertion->insert;
+    if (overwrite != DISK_IMAGE_SCHEDULE_NO_OVERWRITE)
+        LOG_WARNING(pThis, "%s insertion overwrites data inserted by line %u.",
+                    getInsertionTypeName(pInsertion->insert.type), pList->pInsertions[overwrite].lineNumber);
+    if (exceptionCode != noException)
+        reportInsertException(pThis, exceptionCode);
+    else if (pDiskImage->isRecordingManifest && !pThis->pDirtyRegions)
+        DiskImageManifest_AddEntry(&pDiskImage->manifest, &pInsertion->insert, getInsertionData(pList, index));
+}
+
+static void freeScheduledRun(DiskImageScheduledRun* pRun)
+{
+    DiskImageSchedule_Free(&pRun->schedule);
+    free(pRun->pGroupStats);
+    free(pRun->pExceptionCodes);
+    pRun->pGroupStats = NULL;
+    pRun->pExceptionCodes = NULL;
+}
+
+
+static void DiskImageScriptEngine_ProcessScript(DiskImageScriptEngine* pThis, 
+                                                DiskImage*             pDiskImage,
+                                                char*                  pScriptText);
+__throws void DiskImage_ProcessScript(DiskImage* pThis, char* pScriptText)
+{
+    DiskImageScriptEngine_ProcessScript(&pThis->script, pThis, pScriptText);
+}
+
+static void DiskImageScriptEngine_ProcessScript(DiskImageScriptEngine* pThis, 
+                                                DiskImage*             pDiskImage,
+                                                char*                  pScriptText)
+{
+    pThis->pDiskImage = pDiskImage;
+    pThis->pScriptFilename = "<null>";
+    pThis->pTextFile = TextFile_CreateFromString(pScriptText);
+
+    processScriptFromTextFile(pThis);
+}
+
+
+__throws void DiskImage_PrefetchScriptObjects(DiskImage* pThis, const char* pScriptFilename)
+{
+    DiskImageScriptEngine* pScript = &pThis->script;
+    SizedString            scriptFilename = SizedString_InitFromString(pScriptFilename);
+    
+    pScript->pDiskImage = pThis;
+    pScript->pScriptFilename = pScriptFilename;
+    pScript->pTextFile = TextFile_CreateFromVfs(pThis->pVfs, NULL, &scriptFilename, NULL);
+    prefetchObjectFiles(pScript);
+    closeTextFile(pScript);
+}
+
+
+__throws DiskImageObjectCache* DiskImage_DetachObjectCache(DiskImage* pThis)
+{
+    /* Only objects read from files are ever prefetched so a detached cache doesn't point into the image's bundle
+       unless script lines have already inserted bundle objects. */
+    DiskImageObjectCache* pCache = allocateAndZero(sizeof(*pCache));
+    
+    *pCache = pThis->objectCache;
+    memset(&pThis->objectCache, 0, sizeof(pThis->objectCache));
+    return pCache;
+}
+
+
+void DiskImage_ShareObjectCache(DiskImage* pThis, const DiskImageObjectCache* pObjectCache)
+{
+    pThis->pSharedObjectCache = pObjectCache;
+}
+
+
+void DiskImageObjectCache_Free(DiskImageObjectCache* pThis)
+{
+    if (!pThis)
+        return;
+    freeObjectCache(pThis);
+    free(pThis);
+}
+
+
+void DiskImage_SetVfs(DiskImage* pThis, Vfs* pVfs)
+{
+    pThis->pVfs = pVfs;
+}
+
+
+unsigned int DiskImage_GetScriptErrorCount(DiskImage* pThis)
+{
+    return pThis->script.errorCount;
+}
+
+
+const DiskImageStats* DiskImage_GetStats(DiskImage* pThis)
+{
+    return &pThis->stats;
+}
+
+
+unsigned int DiskImage_GetObjectFileLength(DiskImage* pThis)
+{
+    return pThis->objectFileLength;
+}
+
+
+__throws void DiskImage_OpenBundle(DiskImage* pThis, const char* pBundleFilename)
+{
+    if (pThis->pObjectData != pThis->object.pBuffer)
+    {
+        pThis->pObjectData = NULL;
+        pThis->objectDataSize = 0;
+    }
+    freeObjectCache(&pThis->objectCache);
+    ObjectBundle_Free(pThis->pBundle);
+    pThis->pBundle = NULL;
+    pThis->pBundle = ObjectBundle_Open(pThis->pVfs, pBundleFilename);
+}
+
+static void freeObjectCache(DiskImageObjectCache* pCache)
+{
+    size_t i;
+
+    for (i = 0 ; i < ARRAYSIZE(pCache->apBuckets) ; i++)
+    {
+        DiskImageObject* pObject = pCache->apBuckets[i];
+        
+        while (pObject)
+        {
+            DiskImageObject* pNext = pObject->pNext;
+            freeCachedObject(pObject);
+            pObject = pNext;
+        }
+        pCache->apBuckets[i] = NULL;
+    }
+}
+
+static void freeCachedObject(DiskImageObject* pObject)
+{
+    if (!pObject)
+        return;
+    
+    ByteBuffer_Free(&pObject->buffer);
+    free(pObject->pFilename);
+    free(pObject);
 }
 
 
-static FILE* openFile(const char* pFilename, const char* pMode);
-static void determineObjectSizeFromFileHeader(DiskImage* pThis, FILE* pFile);
+static DiskImageObject* findObjectInCaches(DiskImage* pThis, const char* pFilename);
+static DiskImageObject* findObjectInCache(const DiskImageObjectCache* pCache, const char* pFilename);
+static size_t getObjectCacheBucketIndex(const char* pFilename);
+static size_t hashFilename(const char* pFilename);
+static DiskImageObject* findCachedObject(DiskImageObject* pBucket, const char* pFilename);
+static DiskImageObject* loadObject(DiskImage* pThis, const char* pFilename);
+static int isBundleFilename(const char* pFilename);
+static void readObjectFromBundle(DiskImage* pThis, DiskImageObject* pObject, const char* pName);
+static void readObjectFromFile(DiskImage* pThis, DiskImageObject* pObject);
+static VfsFile* openObjectFile(DiskImage* pThis, DiskImageObject* pObject);
+static void allocateObjectBuffer(DiskImageObject* pObject);
+static void readObjectData(DiskImage* pThis, DiskImageObject* pObject, VfsFile* pFile);
+static VfsFile* openFile(DiskImage* pThis, const char* pFilename, const char* pMode);
+static void determineObjectSizeFromFileHeader(DiskImage* pThis, DiskImageObject* pObject, VfsFile* pFile);
+static size_t determineObjectSizeFromBundleItemHeader(DiskImageObject* pObject, const ObjectBundleItem* pItem);
 static int wasSAVedFromAssembler(const char* pSignature);
 static int wasRW18SAVedFromAssembler(const char* pSignature);
-static void readInRW18SavHeaderToSetDefaultInsertOptions(DiskImage* pThis, FILE* pFile, void* pvPartialHeader);
-static RW18SavFileHeader readInRestOfRW18FileHeader(DiskImage* pThis, FILE* pFile, void* pPartialHeader);
-static long getFileSize(FILE* pFile);
+static void readInRW18SavHeaderToSetDefaultInsertOptions(DiskImage*       pThis, 
+                                                         DiskImageObject* pObject, 
+                                                         VfsFile*         pFile, 
+                                                         void*            pPartialHeader);
+static RW18SavFileHeader readInRestOfRW18FileHeader(DiskImage* pThis, VfsFile* pFile, void* pPartialHeader);
+static void setDefaultInsertOptionsFromRW18Header(DiskImageObject* pObject, const RW18SavFileHeader* pHeader);
+static long getFileSize(DiskImage* pThis, VfsFile* pFile);
 static unsigned int roundUpLengthToBlockSize(unsigned int length);
+static void countObjectRead(DiskImage* pThis, const DiskImageObject* pObject);
+static void addObjectToCache(DiskImage* pThis, DiskImageObject* pObject);
+static void useObject(DiskImage* pThis, const DiskImageObject* pObject);
 __throws void DiskImage_ReadObjectFile(DiskImage* pThis, const char* pFilename)
 {
-    FILE*         pFile = NULL;
-    unsigned int  roundedObjectSize;
+    DiskImageObject* pObject;
+    
+    memset(&pThis->insert, 0, sizeof(pThis->insert));
+    pThis->pObjectData = NULL;
+    pThis->objectDataSize = 0;
+    pThis->stats.objectReferences++;
+    pObject = findObjectInCaches(pThis, pFilename);
+    if (!pObject)
+    {
+        pObject = loadObject(pThis, pFilename);
+        addObjectToCache(pThis, pObject);
+    }
+    useObject(pThis, pObject);
+}
+
+static DiskImageObject* findObjectInCaches(DiskImage* pThis, const char* pFilename)
+{
+    DiskImageObject* pObject = NULL;
+    
+    if (pThis->pSharedObjectCache)
+        pObject = findObjectInCache(pThis->pSharedObjectCache, pFilename);
+    if (!pObject)
+        pObject = findObjectInCache(&pThis->objectCache, pFilename);
+    return pObject;
+}
+
+static DiskImageObject* findObjectInCache(const DiskImageObjectCache* pCache, const char* pFilename)
+{
+    return findCachedObject(pCache->apBuckets[getObjectCacheBucketIndex(pFilename)], pFilename);
+}
+
+static size_t getObjectCacheBucketIndex(const char* pFilename)
+{
+    return hashFilename(pFilename) % DISK_IMAGE_OBJECT_CACHE_BUCKETS;
+}
+
+static size_t hashFilename(const char* pFilename)
+{
+    static const size_t hashMultiplier = 31;
+    size_t              hash = 0;
+    
+    while (*pFilename)
+        hash = hash * hashMultiplier + (size_t)*pFilename++;
+    
+    return hash;
+}
+
+static DiskImageObject* findCachedObject(DiskImageObject* pBucket, const char* pFilename)
+{
+    while (pBucket && 0 != strcmp(pBucket->pFilename, pFilename))
+        pBucket = pBucket->pNext;
+    return pBucket;
+}
+
+static DiskImageObject* loadObject(DiskImage* pThis, const char* pFilename)
+{
+    DiskImageObject* pObject = NULL;
+    double           startTime = DiskImageStats_GetSeconds();
+    
+    __try
+    {
+        pObject = allocateAndZero(sizeof(*pObject));
+        pObject->pFilename = copyOfString(pFilename);
+        if (isBundleFilename(pFilename))
+            readObjectFromBundle(pThis, pObject, pFilename + sizeof(DISK_IMAGE_BUNDLE_PREFIX) - 1);
+        else
+            readObjectFromFile(pThis, pObject);
+    }
+    __catch
+    {
+        freeCachedObject(pObject);
+        __rethrow;
+    }
+    countObjectRead(pThis, pObject);
+    pThis->stats.objectReadSeconds += DiskImageStats_GetSeconds() - startTime;
+    
+    return pObject;
+}
+
+static int isBundleFilename(const char* pFilename)
+{
+    return 0 == strncasecmp(pFilename, DISK_IMAGE_BUNDLE_PREFIX, sizeof(DISK_IMAGE_BUNDLE_PREFIX) - 1);
+}
+
+static void readObjectFromBundle(DiskImage* pThis, DiskImageObject* pObject, const char* pName)
+{
+    /* Objects are used in place from the mapped bundle when its padding covers the block rounded length and are
+       only copied when it doesn't. */
+    ObjectBundleItem item;
+    size_t           headerSize;
+    
+    if (!pThis->pBundle || !ObjectBundle_Find(pThis->pBundle, pName, &item))
+        __throw(fileOpenException);
+    headerSize = determineObjectSizeFromBundleItemHeader(pObject, &item);
+    pObject->pData = item.pData + headerSize;
+    pObject->dataSize = roundUpLengthToBlockSize(pObject->length);
+    if (headerSize + pObject->dataSize <= item.paddedLength)
+        return;
+    
+    ByteBuffer_Allocate(&pObject->buffer, pObject->dataSize);
+    memcpy(pObject->buffer.pBuffer, pObject->pData, pObject->length);
+    pObject->pData = pObject->buffer.pBuffer;
+}
+
+static void readObjectFromFile(DiskImage* pThis, DiskImageObject* pObject)
+{
+    VfsFile* pFile = openObjectFile(pThis, pObject);
+    
+    __try
+    {
+        allocateObjectBuffer(pObject);
+        readObjectData(pThis, pObject, pFile);
+    }
+    __catch
+    {
+        Vfs_CloseFile(pThis->pVfs, pFile);
+        __rethrow;
+    }
+
+    Vfs_CloseFile(pThis->pVfs, pFile);
+}
+
+static VfsFile* openObjectFile(DiskImage* pThis, DiskImageObject* pObject)
+{
+    VfsFile* pFile = openFile(pThis, pObject->pFilename, "rb");
     
     __try
     {
-        pFile = openFile(pFilename, "rb");
-        memset(&pThis->insert, 0, sizeof(pThis->insert));
-        determineObjectSizeFromFileHeader(pThis, pFile);
-        roundedObjectSize = roundUpLengthToBlockSize(pThis->objectFileLength);
-        ByteBuffer_Allocate(&pThis->object, roundedObjectSize);
-        ByteBuffer_ReadPartialFromFile(&pThis->object, pThis->objectFileLength, pFile);
+        determineObjectSizeFromFileHeader(pThis, pObject, pFile);
     }
     __catch
     {
-        if (pFile)
-            fclose(pFile);
+        Vfs_CloseFile(pThis->pVfs, pFile);
         __rethrow;
     }
+    
+    return pFile;
+}
 
-    fclose(pFile);    
+static void allocateObjectBuffer(DiskImageObject* pObject)
+{
+    ByteBuffer_Allocate(&pObject->buffer, roundUpLengthToBlockSize(pObject->length));
 }
 
-static FILE* openFile(const char* pFilename, const char* pMode)
+static void readObjectData(DiskImage* pThis, DiskImageObject* pObject, VfsFile* pFile)
 {
-    FILE* pFile = fopen(pFilename, pMode);
+    ByteBuffer_ReadPartialFromFile(&pObject->buffer, pObject->length, pThis->pVfs, pFile);
+    pObject->pData = pObject->buffer.pBuffer;
+    pObject->dataSize = pObject->buffer.bufferSize;
+}
+
+static VfsFile* openFile(DiskImage* pThis, const char* pFilename, const char* pMode)
+{
+    VfsFile* pFile = Vfs_OpenFile(pThis->pVfs, pFilename, pMode);
     if (!pFile)
         __throw(fileOpenException);
     return pFile;
 }
 
-static void determineObjectSizeFromFileHeader(DiskImage* pThis, FILE* pFile)
+static void determineObjectSizeFromFileHeader(DiskImage* pThis, DiskImageObject* pObject, VfsFile* pFile)
 {
     SavFileHeader     header;
     size_t            bytesRead;
     
-    bytesRead = fread(&header, 1, sizeof(header), pFile);
+    bytesRead = Vfs_ReadFile(pThis->pVfs, pFile, &header, sizeof(header));
     if (bytesRead == sizeof(header) && wasSAVedFromAssembler(header.signature))
     {
-        pThis->objectFileLength = header.length;
+        pObject->length = header.length;
     }
     else if (bytesRead == sizeof(header) && wasRW18SAVedFromAssembler(header.signature))
     {
-        readInRW18SavHeaderToSetDefaultInsertOptions(pThis, pFile, &header);
+        readInRW18SavHeaderToSetDefaultInsertOptions(pThis, pObject, pFile, &header);
+    }
+    else
+    {
+        pObject->length = getFileSize(pThis, pFile);
+    }
+}
+
+static size_t determineObjectSizeFromBundleItemHeader(DiskImageObject* pObject, const ObjectBundleItem* pItem)
+{
+    SavFileHeader     header;
+    RW18SavFileHeader rw18Header;
+    
+    if (pItem->length >= sizeof(header) && wasSAVedFromAssembler((const char*)pItem->pData))
+    {
+        memcpy(&header, pItem->pData, sizeof(header));
+        if (header.length > pItem->length - sizeof(header))
+            __throw(fileException);
+        pObject->length = header.length;
+        return sizeof(header);
+    }
+    else if (pItem->length >= sizeof(rw18Header) && wasRW18SAVedFromAssembler((const char*)pItem->pData))
+    {
+        memcpy(&rw18Header, pItem->pData, sizeof(rw18Header));
+        if (rw18Header.length > pItem->length - sizeof(rw18Header))
+            __throw(fileException);
+        setDefaultInsertOptionsFromRW18Header(pObject, &rw18Header);
+        return sizeof(rw18Header);
     }
     else
     {
-        pThis->objectFileLength = getFileSize(pFile);
-        fseek(pFile, 0, SEEK_SET);
+        pObject->length = pItem->length;
+        return 0;
     }
 }
 
@@ -478,19 +1784,17 @@ static int wasRW18SAVedFromAssembler(const char* pSignature)
     return 0 == memcmp(pSignature, BINARY_BUFFER_RW18SAV_SIGNATURE, 4);
 }
 
-static void readInRW18SavHeaderToSetDefaultInsertOptions(DiskImage* pThis, FILE* pFile, void* pPartialHeader)
+static void readInRW18SavHeaderToSetDefaultInsertOptions(DiskImage*       pThis, 
+                                                         DiskImageObject* pObject, 
+                                                         VfsFile*         pFile, 
+                                                         void*            pPartialHeader)
 {
     RW18SavFileHeader rw18Header = readInRestOfRW18FileHeader(pThis, pFile, pPartialHeader);
 
-    pThis->objectFileLength = rw18Header.length;
-    pThis->insert.type = DISK_IMAGE_INSERTION_RW18;
-    pThis->insert.length = rw18Header.length;
-    pThis->insert.side = rw18Header.side;
-    pThis->insert.track = rw18Header.track;
-    pThis->insert.intraTrackOffset = rw18Header.offset;
+    setDefaultInsertOptionsFromRW18Header(pObject, &rw18Header);
 }
 
-static RW18SavFileHeader readInRestOfRW18FileHeader(DiskImage* pThis, FILE* pFile, void* pPartialHeader)
+static RW18SavFileHeader readInRestOfRW18FileHeader(DiskImage* pThis, VfsFile* pFile, void* pPartialHeader)
 {
     RW18SavFileHeader rw18Header;
     size_t            sizeDiffBetweenHeaders = sizeof(rw18Header) - sizeof(SavFileHeader);
@@ -498,18 +1802,28 @@ static RW18SavFileHeader readInRestOfRW18FileHeader(DiskImage* pThis, FILE* pFil
 
     assert ( sizeof(rw18Header) >= sizeof(SavFileHeader) );
     memcpy(&rw18Header, pPartialHeader, sizeof(SavFileHeader));
-    bytesRead = fread((char*)&rw18Header + sizeof(SavFileHeader), 1, sizeDiffBetweenHeaders, pFile);
+    bytesRead = Vfs_ReadFile(pThis->pVfs, pFile, (char*)&rw18Header + sizeof(SavFileHeader), sizeDiffBetweenHeaders);
     if (bytesRead != sizeDiffBetweenHeaders)
         __throw(fileException);
         
     return rw18Header;
 }
 
-static long getFileSize(FILE* pFile)
+static void setDefaultInsertOptionsFromRW18Header(DiskImageObject* pObject, const RW18SavFileHeader* pHeader)
+{
+    pObject->length = pHeader->length;
+    pObject->insert.type = DISK_IMAGE_INSERTION_RW18;
+    pObject->insert.length = pHeader->length;
+    pObject->insert.side = pHeader->side;
+    pObject->insert.track = pHeader->track;
+    pObject->insert.intraTrackOffset = pHeader->offset;
+}
+
+static long getFileSize(DiskImage* pThis, VfsFile* pFile)
 {
-    fseek(pFile, 0, SEEK_END);
-    long size = ftell(pFile);
-    fseek(pFile, 0, SEEK_SET);
+    long size = Vfs_GetFileSize(pThis->pVfs, pFile);
+    if (size == -1)
+        __throw(fileException);
     return size;
 }
 
@@ -518,21 +1832,223 @@ static unsigned int roundUpLengthToBlockSize(unsigned int length)
     return (length + (DISK_IMAGE_BLOCK_SIZE - 1)) & ~(DISK_IMAGE_BLOCK_SIZE - 1);
 }
 
+static void countObjectRead(DiskImage* pThis, const DiskImageObject* pObject)
+{
+    pThis->stats.objectFilesRead++;
+    pThis->stats.objectBytesRead += pObject->length;
+}
+
+static void addObjectToCache(DiskImage* pThis, DiskImageObject* pObject)
+{
+    DiskImageObject** ppBucket = &pThis->objectCache.apBuckets[getObjectCacheBucketIndex(pObject->pFilename)];
+    
+    pObject->pNext = *ppBucket;
+    *ppBucket = pObject;
+}
+
+static void useObject(DiskImage* pThis, const DiskImageObject* pObject)
+{
+    pThis->insert = pObject->insert;
+    pThis->objectFileLength = pObject->length;
+    pThis->pObjectData = pObject->pData;
+    pThis->objectDataSize = pObject->dataSize;
+}
+
+
+typedef struct ObjectPrefetch
+{
+    DiskImageObject* pObject;
+    VfsFile*         pFile;
+    int              exceptionCode;
+} ObjectPrefetch;
+
+typedef struct ObjectPrefetchQueue
+{
+    DiskImage*      pDiskImage;
+    ObjectPrefetch* pItems;
+} ObjectPrefetchQueue;
+
+
+static size_t removeObjectsWhichDontNeedPrefetching(DiskImage* pThis, DiskImageObject** ppObjects);
+static int    doesObjectNeedPrefetching(DiskImage* pThis, DiskImageObject* pObject);
+static void   openPrefetchObject(void* pvQueue, size_t itemIndex);
+static void   allocatePrefetchBuffers(ObjectPrefetchQueue* pQueue, size_t itemCount);
+static void   readPrefetchObject(void* pvQueue, size_t itemIndex);
+static void   cacheSuccessfulPrefetches(ObjectPrefetchQueue* pQueue, size_t itemCount);
+static void   freeObjectList(DiskImageObject* pObjects);
+void DiskImage_PrefetchObjects(DiskImage* pThis, DiskImageObject* pObjects)
+{
+    /* The object files are opened and then read on the thread pool so that their I/O overlaps.  Buffers are allocated
+       back on this thread between the two passes since pool callbacks can't allocate.  Objects which fail to load are
+       just dropped so that the script line which needs them can read them again and report the error. */
+    ObjectPrefetchQueue queue;
+    size_t              itemCount = removeObjectsWhichDontNeedPrefetching(pThis, &pObjects);
+    double              startTime = DiskImageStats_GetSeconds();
+    size_t              i;
+    
+    if (itemCount == 0)
+        return;
+    
+    __try
+    {
+        queue.pItems = allocateAndZero(itemCount * sizeof(*queue.pItems));
+    }
+    __catch
+    {
+        freeObjectList(pObjects);
+        __nothrow;
+    }
+    
+    queue.pDiskImage = pThis;
+    for (i = 0 ; i < itemCount ; i++, pObjects = pObjects->pNext)
+        queue.pItems[i].pObject = pObjects;
+    ThreadPool_Run(itemCount, openPrefetchObject, &queue);
+    allocatePrefetchBuffers(&queue, itemCount);
+    ThreadPool_Run(itemCount, readPrefetchObject, &queue);
+    cacheSuccessfulPrefetches(&queue, itemCount);
+    free(queue.pItems);
+    pThis->stats.objectReadSeconds += DiskImageStats_GetSeconds() - startTime;
+}
+
+static size_t removeObjectsWhichDontNeedPrefetching(DiskImage* pThis, DiskImageObject** ppObjects)
+{
+    DiskImageObject*  pCurr = *ppObjects;
+    DiskImageObject** ppKeptTail = ppObjects;
+    size_t            keptCount = 0;
+    
+    *ppObjects = NULL;
+    while (pCurr)
+    {
+        DiskImageObject* pNext = pCurr->pNext;
+        
+        pCurr->pNext = NULL;
+        if (doesObjectNeedPrefetching(pThis, pCurr) && !findCachedObject(*ppObjects, pCurr->pFilename))
+        {
+            *ppKeptTail = pCurr;
+            ppKeptTail = &pCurr->pNext;
+            keptCount++;
+        }
+        else
+        {
+            freeCachedObject(pCurr);
+        }
+        pCurr = pNext;
+    }
+    return keptCount;
+}
+
+static int doesObjectNeedPrefetching(DiskImage* pThis, DiskImageObject* pObject)
+{
+    const char* pFilename = pObject->pFilename;
+    
+    return pFilename && 
+           !isBundleFilename(pFilename) && 
+           !findObjectInCaches(pThis, pFilename);
+}
+
+static void openPrefetchObject(void* pvQueue, size_t itemIndex)
+{
+    ObjectPrefetchQueue* pQueue = (ObjectPrefetchQueue*)pvQueue;
+    ObjectPrefetch*      pItem = &pQueue->pItems[itemIndex];
+    
+    __try
+    {
+        pItem->pFile = openObjectFile(pQueue->pDiskImage, pItem->pObject);
+    }
+    __catch
+    {
+        pItem->exceptionCode = getExceptionCode();
+        clearExceptionCode();
+    }
+}
+
+static void allocatePrefetchBuffers(ObjectPrefetchQueue* pQueue, size_t itemCount)
+{
+    size_t i;
+    
+    for (i = 0 ; i < itemCount ; i++)
+    {
+        ObjectPrefetch* pItem = &pQueue->pItems[i];
+        
+        if (pItem->exceptionCode != noException)
+            continue;
+        __try
+        {
+            allocateObjectBuffer(pItem->pObject);
+        }
+        __catch
+        {
+            pItem->exceptionCode = getExceptionCode();
+            clearExceptionCode();
+        }
+    }
+}
+
+static void readPrefetchObject(void* pvQueue, size_t itemIndex)
+{
+    ObjectPrefetchQueue* pQueue = (ObjectPrefetchQueue*)pvQueue;
+    ObjectPrefetch*      pItem = &pQueue->pItems[itemIndex];
+    
+    if (pItem->exceptionCode != noException)
+        return;
+    __try
+    {
+        readObjectData(pQueue->pDiskImage, pItem->pObject, pItem->pFile);
+    }
+    __catch
+    {
+        pItem->exceptionCode = getExceptionCode();
+        clearExceptionCode();
+    }
+}
+
+static void cacheSuccessfulPrefetches(ObjectPrefetchQueue* pQueue, size_t itemCount)
+{
+    size_t i;
+    
+    for (i = 0 ; i < itemCount ; i++)
+    {
+        ObjectPrefetch* pItem = &pQueue->pItems[i];
+        
+        if (pItem->pFile)
+            Vfs_CloseFile(pQueue->pDiskImage->pVfs, pItem->pFile);
+        if (pItem->exceptionCode == noException)
+        {
+            countObjectRead(pQueue->pDiskImage, pItem->pObject);
+            addObjectToCache(pQueue->pDiskImage, pItem->pObject);
+        }
+        else
+            freeCachedObject(pItem->pObject);
+    }
+}
+
+static void freeObjectList(DiskImageObject* pObjects)
+{
+    while (pObjects)
+    {
+        DiskImageObject* pNext = pObjects->pNext;
+        freeCachedObject(pObjects);
+        pObjects = pNext;
+    }
+}
+
 
 static void validateObjectFileHasValidImageTableHeader(DiskImage* pThis);
+static void makeObjectDataWritable(DiskImage* pThis);
 static void updateImageTableAddresses(DiskImage* pThis, unsigned short newImageTableAddress);
 __throws void DiskImage_UpdateImageTableFile(DiskImage* pThis, unsigned short newImageTableAddress)
 {
     validateObjectFileHasValidImageTableHeader(pThis);
+    makeObjectDataWritable(pThis);
     updateImageTableAddresses(pThis, newImageTableAddress);
 }
 
 static void validateObjectFileHasValidImageTableHeader(DiskImage* pThis)
 {
-    unsigned char* pObject = pThis->object.pBuffer;
-    unsigned char  imageCount;
-    unsigned short expectedStartAddress;
-    unsigned short actualStartAddress;
+    const unsigned char* pObject = pThis->pObjectData;
+    unsigned char        imageCount;
+    unsigned short       expectedStartAddress;
+    unsigned short       actualStartAddress;
     
     if (pThis->objectFileLength < 3)
         __throw(fileException);
@@ -545,6 +2061,17 @@ static void validateObjectFileHasValidImageTableHeader(DiskImage* pThis)
         __throw(fileException);
 }
 
+static void makeObjectDataWritable(DiskImage* pThis)
+{
+    const unsigned char* pObjectData = pThis->pObjectData;
+    
+    if (pObjectData == pThis->object.pBuffer)
+        return;
+    ByteBuffer_Allocate(&pThis->object, pThis->objectDataSize);
+    memcpy(pThis->object.pBuffer, pObjectData, pThis->objectDataSize);
+    pThis->pObjectData = pThis->object.pBuffer;
+}
+
 static void updateImageTableAddresses(DiskImage* pThis, unsigned short newImageTableAddress)
 {
     unsigned char* pObject = pThis->object.pBuffer;
@@ -575,49 +2102,353 @@ static void updateImageTableAddresses(DiskImage* pThis, unsigned short newImageT
 }
 
 
-static void validateSourceObjectParameters(DiskImage* pThis, DiskImageInsert* pInsert);
 __throws void DiskImage_InsertObjectFile(DiskImage* pThis, DiskImageInsert* pInsert)
 {
     validateSourceObjectParameters(pThis, pInsert);
-    pThis->pVTable->insertData(pThis, pThis->object.pBuffer, pInsert);
+    pThis->pVTable->insertData(pThis, pThis->pObjectData, pInsert, &pThis->stats);
 }
 
 static void validateSourceObjectParameters(DiskImage* pThis, DiskImageInsert* pInsert)
 {
     if (pInsert->sourceOffset >= pThis->objectFileLength)
         __throw(invalidSourceOffsetException);
-    if (pInsert->sourceOffset + pInsert->length > pThis->object.bufferSize)
+    if (pInsert->sourceOffset + pInsert->length > pThis->objectDataSize)
         __throw(invalidLengthException);
 }
 
 
+__throws void DiskImage_InsertData(DiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
+{
+    pThis->pVTable->insertData(pThis, pData, pInsert, &pThis->stats);
+}
+
+
+static int   isPosixVfs(Vfs* pVfs);
+static char* createTempFilenameTemplate(const char* pImageFilename);
+static void* mapTempFile(char* pTempFilename, const char* pImageFilename, size_t size);
+__throws void DiskImage_MapOutputImage(DiskImage* pThis, const char* pImageFilename)
+{
+    /* A temporary file next to the output image is created at its final size and mapped shared so that insertions
+       land straight in the page cache.  DiskImage_WriteImage() then only has to rename it over the output image
+       rather than copy the whole image out.  Only the POSIX file system can be mapped so any other Vfs just keeps
+       using the heap buffer. */
+    SizedString    filename = SizedString_InitFromString(pImageFilename);
+    char*          pFilenameCopy = NULL;
+    char*          pTempFilename = NULL;
+    unsigned char* pMapping = NULL;
+    
+    if (!isPosixVfs(pThis->pVfs) || pThis->pMappedImageFilename)
+        return;
+    
+    __try
+    {
+        pFilenameCopy = SizedString_strdup(&filename);
+        pTempFilename = createTempFilenameTemplate(pImageFilename);
+        pMapping = mapTempFile(pTempFilename, pImageFilename, pThis->image.bufferSize);
+    }
+    __catch
+    {
+        free(pFilenameCopy);
+        free(pTempFilename);
+        __rethrow;
+    }
+    
+    memcpy(pMapping, pThis->image.pBuffer, pThis->image.bufferSize);
+    free(pThis->image.pBuffer);
+    pThis->image.pBuffer = pMapping;
+    pThis->pMappedImageFilename = pFilenameCopy;
+    pThis->pMappedTempFilename = pTempFilename;
+    pThis->hasWrittenMappedImage = FALSE;
+}
+
+static int isPosixVfs(Vfs* pVfs)
+{
+    return pVfs == NULL || pVfs == PosixVfs_Get();
+}
+
+static char* createTempFilenameTemplate(const char* pImageFilename)
+{
+    static const char suffix[] = ".XXXXXX";
+    size_t            length = strlen(pImageFilename);
+    char*             pTempFilename = allocateAndZero(length + sizeof(suffix));
+    
+    memcpy(pTempFilename, pImageFilename, length);
+    memcpy(pTempFilename + length, suffix, sizeof(suffix));
+    return pTempFilename;
+}
+
+static mode_t getOutputImageMode(const char* pImageFilename);
+static void* mapTempFile(char* pTempFilename, const char* pImageFilename, size_t size)
+{
+    /* mkstemp() fills in the template with a name which no other crackle run, or other image in this run built into
+       the same output image, can be using.  The file it creates is only readable by its owner so it is given the mode
+       the output image should end up with.  The blocks are allocated up front, rather than just setting the file
+       size, so that running out of disk space fails here instead of raising SIGBUS when a page of the mapping is
+       later written. */
+    int   file = mkstemp(pTempFilename);
+    void* pMapping = MAP_FAILED;
+    
+    if (file < 0)
+        __throw(fileOpenException);
+    if (0 == fchmod(file, getOutputImageMode(pImageFilename)) && 0 == posix_fallocate(file, 0, size))
+        pMapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    close(file);
+    if (pMapping == MAP_FAILED)
+    {
+        remove(pTempFilename);
+        __throw(fileException);
+    }
+    
+    return pMapping;
+}
+
+static void readUmask(void);
+static mode_t g_umask;
+static mode_t getOutputImageMode(const char* pImageFilename)
+{
+    /* An existing output image keeps its permissions.  A new one gets the mode fopen() would have given it. */
+    static pthread_once_t umaskOnce = PTHREAD_ONCE_INIT;
+    struct stat           imageStat;
+    
+    if (0 == stat(pImageFilename, &imageStat))
+        return imageStat.st_mode & 07777;
+    pthread_once(&umaskOnce, readUmask);
+    return 0666 & ~g_umask;
+}
+
+static void readUmask(void)
+{
+    /* The only way to read the umask is to set it, so it is put straight back and only read the once. */
+    g_umask = umask(0);
+    umask(g_umask);
+}
+
+
+static void countImageWrite(DiskImage* pThis, double startTime, size_t bytesWritten);
 __throws void DiskImage_WriteImage(DiskImage* pThis, const char* pImageFilename)
 {
-    FILE* pFile = NULL;
+    VfsFile* pFile = NULL;
+    double   startTime;
+
+    flushImage(pThis);
+    startTime = DiskImageStats_GetSeconds();
+    if (pThis->pMappedImageFilename && 0 == strcmp(pImageFilename, pThis->pMappedImageFilename))
+    {
+        if (!pThis->hasWrittenMappedImage && 0 != rename(pThis->pMappedTempFilename, pImageFilename))
+            __throw(fileException);
+        pThis->hasWrittenMappedImage = TRUE;
+        countImageWrite(pThis, startTime, pThis->image.bufferSize);
+        return;
+    }
+    __try
+    {
+        pFile = openFile(pThis, pImageFilename, "wb");
+        ByteBuffer_WriteToFile(&pThis->image, pThis->pVfs, pFile);
+    }
+    __catch
+    {
+        Vfs_CloseFile(pThis->pVfs, pFile);
+        __rethrow;
+    }
+    
+    Vfs_CloseFile(pThis->pVfs, pFile);
+    countImageWrite(pThis, startTime, pThis->image.bufferSize);
+}
+
+static void countImageWrite(DiskImage* pThis, double startTime, size_t bytesWritten)
+{
+    pThis->stats.imageBytesWritten += bytesWritten;
+    pThis->stats.writeSeconds += DiskImageStats_GetSeconds() - startTime;
+}
+
+
+__throws void DiskImage_ReadImageForUpdate(DiskImage* pThis, const char* pImageFilename)
+{
+    /* A missing or differently sized image isn't an error.  It just means that the whole image gets written. */
+    VfsFile* pFile = NULL;
+    
+    ByteBuffer_Free(&pThis->baseline);
+    __try
+    {
+        pFile = Vfs_OpenFile(pThis->pVfs, pImageFilename, "rb");
+        if (pFile && Vfs_GetFileSize(pThis->pVfs, pFile) == (long)pThis->image.bufferSize)
+        {
+            ByteBuffer_Allocate(&pThis->baseline, pThis->image.bufferSize);
+            ByteBuffer_ReadFromFile(&pThis->baseline, pThis->pVfs, pFile);
+        }
+    }
+    __catch
+    {
+        ByteBuffer_Free(&pThis->baseline);
+        Vfs_CloseFile(pThis->pVfs, pFile);
+        if (getExceptionCode() == outOfMemoryException)
+            __rethrow;
+        __nothrow;
+    }
+    
+    Vfs_CloseFile(pThis->pVfs, pFile);
+}
+
+
+static void writeChangedRegions(DiskImage* pThis, VfsFile* pFile);
+static int  hasRegionChanged(DiskImage* pThis, unsigned int region);
+static void writeRegions(DiskImage* pThis, VfsFile* pFile, unsigned int firstRegion, unsigned int regionCount);
+__throws void DiskImage_UpdateImage(DiskImage* pThis, const char* pImageFilename)
+{
+    VfsFile* pFile = NULL;
+    double   startTime;
+    
+    if (!pThis->baseline.pBuffer)
+    {
+        DiskImage_WriteImage(pThis, pImageFilename);
+        return;
+    }
+    
+    flushImage(pThis);
+    startTime = DiskImageStats_GetSeconds();
+    __try
+    {
+        pFile = openFile(pThis, pImageFilename, "r+b");
+        writeChangedRegions(pThis, pFile);
+    }
+    __catch
+    {
+        Vfs_CloseFile(pThis->pVfs, pFile);
+        __rethrow;
+    }
+    
+    Vfs_CloseFile(pThis->pVfs, pFile);
+    memcpy(pThis->baseline.pBuffer, pThis->image.pBuffer, pThis->image.bufferSize);
+    countImageWrite(pThis, startTime, 0);
+}
+
+static void writeChangedRegions(DiskImage* pThis, VfsFile* pFile)
+{
+    /* Runs of adjacent changed regions are written with a single seek and write. */
+    unsigned int regionCount = getRegionCount(pThis);
+    unsigned int i = 0;
+    
+    while (i < regionCount)
+    {
+        unsigned int firstRegion;
+        
+        if (!hasRegionChanged(pThis, i))
+        {
+            i++;
+            continue;
+        }
+        firstRegion = i;
+        while (i < regionCount && hasRegionChanged(pThis, i))
+            i++;
+        writeRegions(pThis, pFile, firstRegion, i - firstRegion);
+    }
+}
+
+static int hasRegionChanged(DiskImage* pThis, unsigned int region)
+{
+    unsigned int offset = region * pThis->regionSize;
+    
+    return 0 != memcmp(pThis->image.pBuffer + offset, pThis->baseline.pBuffer + offset, pThis->regionSize);
+}
+
+static void writeRegions(DiskImage* pThis, VfsFile* pFile, unsigned int firstRegion, unsigned int regionCount)
+{
+    unsigned int offset = firstRegion * pThis->regionSize;
+    VfsBuffer    buffer = { pThis->image.pBuffer + offset, regionCount * pThis->regionSize };
+    
+    if (0 != Vfs_SeekFile(pThis->pVfs, pFile, (long)offset))
+        __throw(fileException);
+    if (buffer.size != Vfs_WriteFile(pThis->pVfs, pFile, &buffer, 1))
+        __throw(fileException);
+    pThis->stats.imageBytesWritten += buffer.size;
+}
+
 
+__throws void DiskImage_WriteDelta(DiskImage* pThis, const char* pBaseImageFilename, const char* pDeltaFilename)
+{
+    /* Unlike --update, a delta is useless without the image it applies to so a missing base image is an error. */
+    DiskImageDelta delta;
+    double         startTime;
+    
+    memset(&delta, 0, sizeof(delta));
+    DiskImage_ReadImageForUpdate(pThis, pBaseImageFilename);
+    if (!pThis->baseline.pBuffer)
+    {
+        fprintf(stderr, "error: Failed to read %s as the base image for the delta." LINE_ENDING, pBaseImageFilename);
+        __throw(fileOpenException);
+    }
+    
+    flushImage(pThis);
+    startTime = DiskImageStats_GetSeconds();
     __try
     {
-        pFile = openFile(pImageFilename, "wb");
-        ByteBuffer_WriteToFile(&pThis->image, pFile);
+        DiskImageDelta_Compute(&delta, pThis->baseline.pBuffer, pThis->image.pBuffer, pThis->image.bufferSize, 
+                               pThis->regionSize);
+        DiskImageDelta_Write(&delta, pThis->pVfs, pDeltaFilename);
     }
     __catch
     {
-        if (pFile)
-            fclose(pFile);
+        DiskImageDelta_Free(&delta);
         __rethrow;
     }
     
-    fclose(pFile);
+    countImageWrite(pThis, startTime, sizeof(delta.header) + delta.runsSize);
+    DiskImageDelta_Free(&delta);
+}
+
+
+__throws void DiskImage_ReadManifest(DiskImage* pThis, const char* pManifestFilename)
+{
+    /* A missing or malformed manifest just means that every script line is run.  Insertions are recorded either way
+       so that DiskImage_WriteManifest() can describe the new image. */
+    pThis->isRecordingManifest = TRUE;
+    pThis->hasPreviousManifest = FALSE;
+    __try
+    {
+        DiskImageManifest_Read(&pThis->previousManifest, pThis->pVfs, pManifestFilename);
+    }
+    __catch
+    {
+        if (getExceptionCode() == outOfMemoryException)
+            __rethrow;
+        __nothrow;
+    }
+    pThis->hasPreviousManifest = TRUE;
+}
+
+
+__throws void DiskImage_WriteManifest(DiskImage* pThis, const char* pManifestFilename)
+{
+    pThis->manifest.imageHash = hashImage(DiskImage_GetImagePointer(pThis), pThis->image.bufferSize);
+    DiskImageManifest_Write(&pThis->manifest, pThis->pVfs, pManifestFilename);
 }
 
 
 unsigned char* DiskImage_GetImagePointer(DiskImage* pThis)
 {
+    flushImage(pThis);
     return pThis->image.pBuffer;
 }
 
+static void flushImage(DiskImage* pThis)
+{
+    double startTime = DiskImageStats_GetSeconds();
+    
+    pThis->pVTable->flushImage(pThis);
+    pThis->stats.encodeSeconds += DiskImageStats_GetSeconds() - startTime;
+}
+
 
 size_t DiskImage_GetImageSize(DiskImage* pThis)
 {
     return pThis->image.bufferSize;
 }
+
+
+const char* DiskImage_GetMappedTempFilename(DiskImage* pThis)
+{
+    /* NULL unless DiskImage_MapOutputImage() has mapped the image and it hasn't been renamed over the output yet. */
+    if (pThis->hasWrittenMappedImage)
+        return NULL;
+    return pThis->pMappedTempFilename;
+}
@@ -0,0 +1,257 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include "DiskImageCompress.h"
+#include "DiskImageCompressTest.h"
+#include "util.h"
+
+
+#define HASH_BITS      12
+#define HASH_SIZE      (1 << HASH_BITS)
+#define MAX_CHAIN      256
+#define NO_POSITION    (-1)
+#define MATCH_TOKEN    0x80
+#define END_TOKEN      0x00
+
+
+typedef struct Compressor
+{
+    const unsigned char* pInput;
+    unsigned char*       pOutput;
+    int*                 pHeads;
+    int*                 pPrevious;
+    unsigned int         inputSize;
+    unsigned int         outputSize;
+} Compressor;
+
+
+unsigned int DiskImageCompress_GetMaxCompressedSize(unsigned int inputSize)
+{
+    /* Incompressible data costs one token per run of literals plus the end token. */
+    return inputSize + (inputSize + DISK_IMAGE_COMPRESS_MAX_LITERALS - 1) / DISK_IMAGE_COMPRESS_MAX_LITERALS + 1;
+}
+
+
+static void         allocateHashChains(Compressor* pThis);
+static void         freeHashChains(Compressor* pThis);
+static unsigned int findLongestMatch(Compressor* pThis, unsigned int position, unsigned int* pDistance);
+static void         addToHashChains(Compressor* pThis, unsigned int position);
+static void         emitLiterals(Compressor* pThis, unsigned int start, unsigned int end);
+static void         emitMatch(Compressor* pThis, unsigned int length, unsigned int distance);
+__throws unsigned int DiskImageCompress_Compress(ByteBuffer*          pOutput, 
+                                                 const unsigned char* pInput, 
+                                                 unsigned int         inputSize)
+{
+    /* Greedy parse using hash chains of the positions where each 3 byte sequence was last seen.  Only matches of 4 or
+       more bytes are used since a 3 byte match costs as much as the literals it would replace. */
+    Compressor   compressor;
+    unsigned int position = 0;
+    unsigned int literalStart = 0;
+
+    memset(&compressor, 0, sizeof(compressor));
+    compressor.pInput = pInput;
+    compressor.inputSize = inputSize;
+    ByteBuffer_Allocate(pOutput, DiskImageCompress_GetMaxCompressedSize(inputSize));
+    compressor.pOutput = pOutput->pBuffer;
+    __try
+    {
+        allocateHashChains(&compressor);
+    }
+    __catch
+    {
+        ByteBuffer_Free(pOutput);
+        __rethrow;
+    }
+
+    while (position < inputSize)
+    {
+        unsigned int distance = 0;
+        unsigned int length = findLongestMatch(&compressor, position, &distance);
+
+        if (length <= DISK_IMAGE_COMPRESS_MIN_MATCH)
+        {
+            addToHashChains(&compressor, position++);
+            continue;
+        }
+        emitLiterals(&compressor, literalStart, position);
+        emitMatch(&compressor, length, distance);
+        while (length--)
+            addToHashChains(&compressor, position++);
+        literalStart = position;
+    }
+    emitLiterals(&compressor, literalStart, position);
+    compressor.pOutput[compressor.outputSize++] = END_TOKEN;
+    freeHashChains(&compressor);
+
+    return compressor.outputSize;
+}
+
+static void allocateHashChains(Compressor* pThis)
+{
+    size_t i;
+
+    pThis->pHeads = malloc(HASH_SIZE * sizeof(*pThis->pHeads));
+    pThis->pPrevious = malloc((pThis->inputSize ? pThis->inputSize : 1) * sizeof(*pThis->pPrevious));
+    if (!pThis->pHeads || !pThis->pPrevious)
+    {
+        freeHashChains(pThis);
+        __throw(outOfMemoryException);
+    }
+    for (i = 0 ; i < HASH_SIZE ; i++)
+        pThis->pHeads[i] = NO_POSITION;
+}
+
+static void freeHashChains(Compressor* pThis)
+{
+    free(pThis->pHeads);
+    free(pThis->pPrevious);
+    pThis->pHeads = NULL;
+    pThis->pPrevious = NULL;
+}
+
+static unsigned int hashSequence(const unsigned char* pSequence);
+static unsigned int findLongestMatch(Compressor* pThis, unsigned int position, unsigned int* pDistance)
+{
+    unsigned int maxLength = pThis->inputSize - position;
+    unsigned int bestLength = 0;
+    unsigned int chainLength = 0;
+    int          candidate;
+
+    if (maxLength < DISK_IMAGE_COMPRESS_MIN_MATCH)
+        return 0;
+    if (maxLength > DISK_IMAGE_COMPRESS_MAX_MATCH)
+        maxLength = DISK_IMAGE_COMPRESS_MAX_MATCH;
+    candidate = pThis->pHeads[hashSequence(&pThis->pInput[position])];
+    while (candidate != NO_POSITION && 
+           position - candidate <= DISK_IMAGE_COMPRESS_MAX_DISTANCE && 
+           chainLength++ < MAX_CHAIN)
+    {
+        const unsigned char* pCandidate = &pThis->pInput[candidate];
+        const unsigned char* pCurrent = &pThis->pInput[position];
+        unsigned int         length = 0;
+
+        while (length < maxLength && pCandidate[length] == pCurrent[length])
+            length++;
+        if (length > bestLength)
+        {
+            bestLength = length;
+            *pDistance = position - candidate;
+            if (length == maxLength)
+                break;
+        }
+        candidate = pThis->pPrevious[candidate];
+    }
+    return bestLength;
+}
+
+static unsigned int hashSequence(const unsigned char* pSequence)
+{
+    unsigned int sequence = (pSequence[0] << 16) | (pSequence[1] << 8) | pSequence[2];
+
+    return (sequence * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static void addToHashChains(Compressor* pThis, unsigned int position)
+{
+    unsigned int hash;
+
+    if (pThis->inputSize - position < DISK_IMAGE_COMPRESS_MIN_MATCH)
+        return;
+    hash = hashSequence(&pThis->pInput[position]);
+    pThis->pPrevious[position] = pThis->pHeads[hash];
+    pThis->pHeads[hash] = (int)position;
+}
+
+static void emitLiterals(Compressor* pThis, unsigned int start, unsigned int end)
+{
+    while (start < end)
+    {
+        unsigned int count = end - start;
+
+        if (count > DISK_IMAGE_COMPRESS_MAX_LITERALS)
+            count = DISK_IMAGE_COMPRESS_MAX_LITERALS;
+        pThis->pOutput[pThis->outputSize++] = (unsigned char)count;
+        memcpy(&pThis->pOutput[pThis->outputSize], &pThis->pInput[start], count);
+        pThis->outputSize += count;
+        start += count;
+    }
+}
+
+static void emitMatch(Compressor* pThis, unsigned int length, unsigned int distance)
+{
+    pThis->pOutput[pThis->outputSize++] = (unsigned char)(MATCH_TOKEN | (length - DISK_IMAGE_COMPRESS_MIN_MATCH));
+    pThis->pOutput[pThis->outputSize++] = (unsigned char)(distance & 0xff);
+    pThis->pOutput[pThis->outputSize++] = (unsigned char)(distance >> 8);
+}
+
+
+static unsigned int expand(unsigned char* pOutput, const unsigned char* pInput, unsigned int inputSize);
+__throws unsigned int DiskImageCompress_Decompress(ByteBuffer*          pOutput, 
+                                                   const unsigned char* pInput, 
+                                                   unsigned int         inputSize)
+{
+    /* The first pass checks the stream and sizes the output so that the second can expand it without any checks. */
+    unsigned int outputSize = expand(NULL, pInput, inputSize);
+
+    ByteBuffer_Allocate(pOutput, outputSize ? outputSize : 1);
+    expand(pOutput->pBuffer, pInput, inputSize);
+
+    return outputSize;
+}
+
+static unsigned int expand(unsigned char* pOutput, const unsigned char* pInput, unsigned int inputSize)
+{
+    const unsigned char* pEnd = pInput + inputSize;
+    unsigned int         outputSize = 0;
+
+    while (pInput < pEnd)
+    {
+        unsigned char token = *pInput++;
+        unsigned int  length;
+        unsigned int  distance;
+
+        if (token == END_TOKEN)
+        {
+            if (pInput != pEnd)
+                __throw(fileException);
+            return outputSize;
+        }
+        if (!(token & MATCH_TOKEN))
+        {
+            if ((unsigned int)(pEnd - pInput) < token)
+                __throw(fileException);
+            if (pOutput)
+                memcpy(&pOutput[outputSize], pInput, token);
+            pInput += token;
+            outputSize += token;
+            continue;
+        }
+
+        if (pEnd - pInput < 2)
+            __throw(fileException);
+        length = (token & ~MATCH_TOKEN) + DISK_IMAGE_COMPRESS_MIN_MATCH;
+        distance = pInput[0] | (pInput[1] << 8);
+        pInput += 2;
+        if (distance == 0 || distance > outputSize)
+            __throw(fileException);
+        if (pOutput)
+        {
+            unsigned int i;
+
+            for (i = 0 ; i < length ; i++)
+                pOutput[outputSize + i] = pOutput[outputSize + i - distance];
+        }
+        outputSize += length;
+    }
+    __throw(fileException);
+}
@@ -0,0 +1,331 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "DiskImageDelta.h"
+#include "DiskImageDeltaTest.h"
+#include "DiskImageManifest.h"
+#include "ByteBuffer.h"
+#include "util.h"
+
+
+/* Unchanged stretches shorter than a run record are cheaper to resend than to split the run around. */
+#define MIN_UNCHANGED_GAP sizeof(DiskImageDeltaRun)
+
+
+void DiskImageDelta_Free(DiskImageDelta* pThis)
+{
+    free(pThis->pRuns);
+    memset(pThis, 0, sizeof(*pThis));
+}
+
+
+static void         initHeader(DiskImageDelta* pThis, unsigned int imageSize, unsigned int regionSize);
+static unsigned int findNextChange(const unsigned char* pBase, const unsigned char* pImage,
+                                   unsigned int offset, unsigned int end);
+static unsigned int findEndOfChanges(const unsigned char* pBase, const unsigned char* pImage,
+                                     unsigned int offset, unsigned int end);
+static void         addRun(DiskImageDelta* pThis, unsigned int region, unsigned int offset, unsigned int length,
+                           const unsigned char* pData);
+__throws void DiskImageDelta_Compute(DiskImageDelta*      pThis,
+                                     const unsigned char* pBaseImage,
+                                     const unsigned char* pImage,
+                                     unsigned int         imageSize,
+                                     unsigned int         regionSize)
+{
+    unsigned int region;
+
+    if (regionSize == 0 || regionSize > 0xffff || imageSize % regionSize != 0)
+        __throw(invalidArgumentException);
+    DiskImageDelta_Free(pThis);
+    initHeader(pThis, imageSize, regionSize);
+    pThis->header.baseHash = DiskImageManifest_Hash(DISK_IMAGE_MANIFEST_HASH_SEED, pBaseImage, imageSize);
+    pThis->header.imageHash = DiskImageManifest_Hash(DISK_IMAGE_MANIFEST_HASH_SEED, pImage, imageSize);
+
+    __try
+    {
+        for (region = 0 ; region < imageSize / regionSize ; region++)
+        {
+            unsigned int start = region * regionSize;
+            unsigned int end = start + regionSize;
+            unsigned int offset = start;
+
+            while ((offset = findNextChange(pBaseImage, pImage, offset, end)) < end)
+            {
+                unsigned int runEnd = findEndOfChanges(pBaseImage, pImage, offset, end);
+
+                addRun(pThis, region, offset - start, runEnd - offset, pImage + offset);
+                offset = runEnd;
+            }
+        }
+    }
+    __catch
+    {
+        DiskImageDelta_Free(pThis);
+        __rethrow;
+    }
+}
+
+static void initHeader(DiskImageDelta* pThis, unsigned int imageSize, unsigned int regionSize)
+{
+    memcpy(pThis->header.signature, DISK_IMAGE_DELTA_SIGNATURE, sizeof(pThis->header.signature));
+    pThis->header.imageSize = imageSize;
+    pThis->header.regionSize = regionSize;
+}
+
+static unsigned int findNextChange(const unsigned char* pBase, const unsigned char* pImage,
+                                   unsigned int offset, unsigned int end)
+{
+    /* Most of an image is unchanged between builds so it is skipped a machine word at a time.  The words are copied
+       out with memcpy() since the offsets aren't always aligned. */
+    while (offset + sizeof(size_t) <= end)
+    {
+        size_t baseWord;
+        size_t imageWord;
+
+        memcpy(&baseWord, pBase + offset, sizeof(baseWord));
+        memcpy(&imageWord, pImage + offset, sizeof(imageWord));
+        if (baseWord != imageWord)
+            break;
+        offset += sizeof(size_t);
+    }
+    while (offset < end && pBase[offset] == pImage[offset])
+        offset++;
+
+    return offset;
+}
+
+static unsigned int findEndOfChanges(const unsigned char* pBase, const unsigned char* pImage,
+                                     unsigned int offset, unsigned int end)
+{
+    unsigned int runEnd = offset;
+
+    for ( ; offset < end && offset - runEnd < MIN_UNCHANGED_GAP ; offset++)
+    {
+        if (pBase[offset] != pImage[offset])
+            runEnd = offset + 1;
+    }
+
+    return runEnd;
+}
+
+static void growRunsIfNecessary(DiskImageDelta* pThis, size_t bytesToAdd);
+static void addRun(DiskImageDelta* pThis, unsigned int region, unsigned int offset, unsigned int length,
+                   const unsigned char* pData)
+{
+    DiskImageDeltaRun run;
+
+    run.region = region;
+    run.offset = (unsigned short)offset;
+    run.length = (unsigned short)length;
+    growRunsIfNecessary(pThis, sizeof(run) + length);
+    memcpy(pThis->pRuns + pThis->runsSize, &run, sizeof(run));
+    memcpy(pThis->pRuns + pThis->runsSize + sizeof(run), pData, length);
+    pThis->runsSize += sizeof(run) + length;
+    pThis->changedByteCount += length;
+    pThis->header.runCount++;
+}
+
+static void growRunsIfNecessary(DiskImageDelta* pThis, size_t bytesToAdd)
+{
+    size_t         newSize = pThis->allocatedSize ? pThis->allocatedSize : 4096;
+    unsigned char* pRealloc;
+
+    if (pThis->runsSize + bytesToAdd <= pThis->allocatedSize)
+        return;
+    while (newSize < pThis->runsSize + bytesToAdd)
+        newSize *= 2;
+    pRealloc = realloc(pThis->pRuns, newSize);
+    if (!pRealloc)
+        __throw(outOfMemoryException);
+    pThis->pRuns = pRealloc;
+    pThis->allocatedSize = newSize;
+}
+
+
+static void readDeltaFile(DiskImageDelta* pThis, Vfs* pVfs, const char* pFilename);
+static void validateRuns(DiskImageDelta* pThis);
+__throws void DiskImageDelta_Read(DiskImageDelta* pThis, Vfs* pVfs, const char* pFilename)
+{
+    DiskImageDelta_Free(pThis);
+    __try
+    {
+        readDeltaFile(pThis, pVfs, pFilename);
+        validateRuns(pThis);
+    }
+    __catch
+    {
+        DiskImageDelta_Free(pThis);
+        if (getExceptionCode() == fileOpenException)
+            fprintf(stderr, "error: Failed to open %s delta file." LINE_ENDING, pFilename);
+        else if (getExceptionCode() == fileException)
+            fprintf(stderr, "error: %s isn't a valid delta file." LINE_ENDING, pFilename);
+        __rethrow;
+    }
+}
+
+static void readDeltaFile(DiskImageDelta* pThis, Vfs* pVfs, const char* pFilename)
+{
+    VfsFile* pFile = NULL;
+    long     fileSize;
+
+    __try
+    {
+        pFile = Vfs_OpenFile(pVfs, pFilename, "rb");
+        if (!pFile)
+            __throw(fileOpenException);
+        fileSize = Vfs_GetFileSize(pVfs, pFile);
+        if (fileSize < (long)sizeof(pThis->header) ||
+            sizeof(pThis->header) != Vfs_ReadFile(pVfs, pFile, &pThis->header, sizeof(pThis->header)))
+            __throw(fileException);
+        pThis->runsSize = fileSize - sizeof(pThis->header);
+        pThis->allocatedSize = pThis->runsSize;
+        pThis->pRuns = allocateAndZero(pThis->runsSize ? pThis->runsSize : 1);
+        if (pThis->runsSize != Vfs_ReadFile(pVfs, pFile, pThis->pRuns, pThis->runsSize))
+            __throw(fileException);
+    }
+    __catch
+    {
+        Vfs_CloseFile(pVfs, pFile);
+        __rethrow;
+    }
+
+    Vfs_CloseFile(pVfs, pFile);
+}
+
+static void validateRuns(DiskImageDelta* pThis)
+{
+    /* Every run is checked up front so that applying the delta can't write outside of the image. */
+    DiskImageDeltaHeader* pHeader = &pThis->header;
+    size_t                offset = 0;
+    unsigned int          i;
+
+    if (0 != memcmp(pHeader->signature, DISK_IMAGE_DELTA_SIGNATURE, sizeof(pHeader->signature)) ||
+        pHeader->regionSize == 0 || pHeader->imageSize % pHeader->regionSize != 0)
+        __throw(fileException);
+    for (i = 0 ; i < pHeader->runCount ; i++)
+    {
+        DiskImageDeltaRun run;
+
+        if (pThis->runsSize - offset < sizeof(run))
+            __throw(fileException);
+        memcpy(&run, pThis->pRuns + offset, sizeof(run));
+        offset += sizeof(run);
+        if (run.region >= pHeader->imageSize / pHeader->regionSize ||
+            (unsigned int)run.offset + run.length > pHeader->regionSize ||
+            pThis->runsSize - offset < run.length)
+            __throw(fileException);
+        offset += run.length;
+        pThis->changedByteCount += run.length;
+    }
+    if (offset != pThis->runsSize)
+        __throw(fileException);
+}
+
+
+__throws void DiskImageDelta_Write(DiskImageDelta* pThis, Vfs* pVfs, const char* pFilename)
+{
+    VfsFile*  pFile = Vfs_OpenFile(pVfs, pFilename, "wb");
+    VfsBuffer buffers[2] = { { &pThis->header, sizeof(pThis->header) }, { pThis->pRuns, pThis->runsSize } };
+    size_t    bytesWritten;
+
+    if (!pFile)
+        __throw(fileOpenException);
+    bytesWritten = Vfs_WriteFile(pVfs, pFile, buffers, 2);
+    Vfs_CloseFile(pVfs, pFile);
+    if (bytesWritten != sizeof(pThis->header) + pThis->runsSize)
+        __throw(fileException);
+}
+
+
+static const unsigned char* getRun(const unsigned char* pCurr, DiskImageDeltaRun* pRun);
+__throws void DiskImageDelta_Apply(DiskImageDelta* pThis, unsigned char* pImage, unsigned int imageSize)
+{
+    /* pImage is left untouched unless it is the image the delta was computed from.  The result is checked as well
+       since a damaged run would otherwise go unnoticed. */
+    const unsigned char* pCurr = pThis->pRuns;
+    unsigned int         i;
+
+    if (imageSize != pThis->header.imageSize ||
+        pThis->header.baseHash != DiskImageManifest_Hash(DISK_IMAGE_MANIFEST_HASH_SEED, pImage, imageSize))
+        __throw(fileException);
+    for (i = 0 ; i < pThis->header.runCount ; i++)
+    {
+        DiskImageDeltaRun run;
+
+        pCurr = getRun(pCurr, &run);
+        memcpy(pImage + run.region * pThis->header.regionSize + run.offset, pCurr, run.length);
+        pCurr += run.length;
+    }
+    if (pThis->header.imageHash != DiskImageManifest_Hash(DISK_IMAGE_MANIFEST_HASH_SEED, pImage, imageSize))
+        __throw(fileException);
+}
+
+static const unsigned char* getRun(const unsigned char* pCurr, DiskImageDeltaRun* pRun)
+{
+    memcpy(pRun, pCurr, sizeof(*pRun));
+    return pCurr + sizeof(*pRun);
+}
+
+
+static void writeRuns(DiskImageDelta* pThis, Vfs* pVfs, VfsFile* pFile);
+__throws void DiskImageDelta_ApplyToImageFile(DiskImageDelta* pThis, Vfs* pVfs, const char* pImageFilename)
+{
+    /* The whole image is read to check its hash but only the runs are written back. */
+    ByteBuffer image = { NULL, 0 };
+    VfsFile*   pFile = NULL;
+
+    __try
+    {
+        pFile = Vfs_OpenFile(pVfs, pImageFilename, "r+b");
+        if (!pFile)
+            __throw(fileOpenException);
+        if (Vfs_GetFileSize(pVfs, pFile) != (long)pThis->header.imageSize)
+            __throw(fileException);
+        ByteBuffer_Allocate(&image, pThis->header.imageSize);
+        ByteBuffer_ReadFromFile(&image, pVfs, pFile);
+        DiskImageDelta_Apply(pThis, image.pBuffer, image.bufferSize);
+        writeRuns(pThis, pVfs, pFile);
+    }
+    __catch
+    {
+        if (getExceptionCode() == fileOpenException)
+            fprintf(stderr, "error: Failed to open %s image file." LINE_ENDING, pImageFilename);
+        else if (getExceptionCode() == fileException)
+            fprintf(stderr, "error: %s isn't the image the delta was computed from." LINE_ENDING, pImageFilename);
+    }
+    ByteBuffer_Free(&image);
+    Vfs_CloseFile(pVfs, pFile);
+    if (getExceptionCode() != noException)
+        __rethrow;
+}
+
+static void writeRuns(DiskImageDelta* pThis, Vfs* pVfs, VfsFile* pFile)
+{
+    const unsigned char* pCurr = pThis->pRuns;
+    unsigned int         i;
+
+    for (i = 0 ; i < pThis->header.runCount ; i++)
+    {
+        DiskImageDeltaRun run;
+        VfsBuffer         buffer;
+
+        pCurr = getRun(pCurr, &run);
+        buffer.pData = pCurr;
+        buffer.size = run.length;
+        if (0 != Vfs_SeekFile(pVfs, pFile, (long)(run.region * pThis->header.regionSize + run.offset)) ||
+            buffer.size != Vfs_WriteFile(pVfs, pFile, &buffer, 1))
+            __throw(fileException);
+        pCurr += run.length;
+    }
+}
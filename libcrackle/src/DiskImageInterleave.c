@@ -0,0 +1,233 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "DiskImageInterleave.h"
+#include "DiskImageInterleaveTest.h"
+#include "NibbleDiskImage.h"
+
+
+static const unsigned char g_dos33PhysicalSectors[DISK_IMAGE_INTERLEAVE_SECTORS] =
+{
+    0x0, 0xd, 0xb, 0x9, 0x7, 0x5, 0x3, 0x1, 0xe, 0xc, 0xa, 0x8, 0x6, 0x4, 0x2, 0xf
+};
+
+static const unsigned char g_prodosPhysicalSectors[DISK_IMAGE_INTERLEAVE_SECTORS] =
+{
+    0x0, 0x2, 0x4, 0x6, 0x8, 0xa, 0xc, 0xe, 0x1, 0x3, 0x5, 0x7, 0x9, 0xb, 0xd, 0xf
+};
+
+
+void DiskImageInterleave_InitIdentity(DiskImageInterleave* pThis)
+{
+    unsigned int i;
+    
+    for (i = 0 ; i < DISK_IMAGE_INTERLEAVE_SECTORS ; i++)
+        pThis->physicalSectors[i] = i;
+}
+
+
+__throws void DiskImageInterleave_InitSkew(DiskImageInterleave* pThis, unsigned int skew)
+{
+    unsigned int usedSectors = 0;
+    unsigned int physicalSector = 0;
+    unsigned int i;
+    
+    if (skew == 0 || skew >= DISK_IMAGE_INTERLEAVE_SECTORS)
+        __throw(invalidArgumentException);
+    for (i = 0 ; i < DISK_IMAGE_INTERLEAVE_SECTORS ; i++)
+    {
+        while (usedSectors & (1 << physicalSector))
+            physicalSector = (physicalSector + 1) % DISK_IMAGE_INTERLEAVE_SECTORS;
+        pThis->physicalSectors[i] = physicalSector;
+        usedSectors |= 1 << physicalSector;
+        physicalSector = (physicalSector + skew) % DISK_IMAGE_INTERLEAVE_SECTORS;
+    }
+}
+
+
+static void parseSkew(DiskImageInterleave* pThis, const SizedString* pSpec);
+static void parseTable(DiskImageInterleave* pThis, const SizedString* pSpec);
+static int  hexDigitValue(char digit);
+__throws void DiskImageInterleave_Parse(DiskImageInterleave* pThis, const SizedString* pSpec)
+{
+    if (0 == SizedString_strcasecmp(pSpec, "identity"))
+        DiskImageInterleave_InitIdentity(pThis);
+    else if (0 == SizedString_strcasecmp(pSpec, "dos3.3"))
+        memcpy(pThis->physicalSectors, g_dos33PhysicalSectors, sizeof(pThis->physicalSectors));
+    else if (0 == SizedString_strcasecmp(pSpec, "prodos"))
+        memcpy(pThis->physicalSectors, g_prodosPhysicalSectors, sizeof(pThis->physicalSectors));
+    else if (pSpec->stringLength > 5 && 0 == strncasecmp(pSpec->pString, "skew:", 5))
+        parseSkew(pThis, pSpec);
+    else
+        parseTable(pThis, pSpec);
+}
+
+static void parseSkew(DiskImageInterleave* pThis, const SizedString* pSpec)
+{
+    SizedString  skewString = SizedString_Init(pSpec->pString + 5, pSpec->stringLength - 5);
+    const char*  pEnd = NULL;
+    unsigned int skew = SizedString_strtoul(&skewString, &pEnd, 0);
+    
+    if (pEnd != skewString.pString + skewString.stringLength)
+        __throw(invalidArgumentException);
+    DiskImageInterleave_InitSkew(pThis, skew);
+}
+
+static void parseTable(DiskImageInterleave* pThis, const SizedString* pSpec)
+{
+    DiskImageInterleave interleave;
+    unsigned int        usedSectors = 0;
+    size_t              i;
+    
+    if (pSpec->stringLength != DISK_IMAGE_INTERLEAVE_SECTORS)
+        __throw(invalidArgumentException);
+    for (i = 0 ; i < DISK_IMAGE_INTERLEAVE_SECTORS ; i++)
+    {
+        int physicalSector = hexDigitValue(pSpec->pString[i]);
+        
+        if (physicalSector < 0 || (usedSectors & (1 << physicalSector)))
+            __throw(invalidArgumentException);
+        usedSectors |= 1 << physicalSector;
+        interleave.physicalSectors[i] = physicalSector;
+    }
+    *pThis = interleave;
+}
+
+static int hexDigitValue(char digit)
+{
+    if (digit >= '0' && digit <= '9')
+        return digit - '0';
+    else if (digit >= 'a' && digit <= 'f')
+        return digit - 'a' + 10;
+    else if (digit >= 'A' && digit <= 'F')
+        return digit - 'A' + 10;
+    else
+        return -1;
+}
+
+
+int DiskImageInterleave_IsIdentity(const DiskImageInterleave* pThis)
+{
+    unsigned int i;
+    
+    for (i = 0 ; i < DISK_IMAGE_INTERLEAVE_SECTORS ; i++)
+    {
+        if (pThis->physicalSectors[i] != i)
+            return 0;
+    }
+    return 1;
+}
+
+
+void DiskImageInterleave_Format(const DiskImageInterleave* pThis, char* pBuffer)
+{
+    unsigned int i;
+    
+    for (i = 0 ; i < DISK_IMAGE_INTERLEAVE_SECTORS ; i++)
+        pBuffer[i] = "0123456789abcdef"[pThis->physicalSectors[i]];
+    pBuffer[i] = '\0';
+}
+
+
+static unsigned int getAddressFieldCycle(unsigned int physicalSector);
+DiskImageInterleaveTiming DiskImageInterleave_Simulate(const DiskImageInterleave* pThis, unsigned int cyclesPerSector)
+{
+    /* Times are in cycles since the first logical sector's address field arrived under the head.  Each sector is
+       read from the start of its address field through the end of its data field. */
+    static const unsigned int revolutionCycles = NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * 
+                                                 DISK_IMAGE_INTERLEAVE_CYCLES_PER_NIBBLE;
+    static const unsigned int sectorReadCycles = (NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR - 
+                                                  NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES) *
+                                                 DISK_IMAGE_INTERLEAVE_CYCLES_PER_NIBBLE;
+    DiskImageInterleaveTiming timing;
+    unsigned int              startCycle = getAddressFieldCycle(pThis->physicalSectors[0]);
+    unsigned int              now = 0;
+    unsigned int              i;
+    
+    memset(&timing, 0, sizeof(timing));
+    for (i = 0 ; i < DISK_IMAGE_INTERLEAVE_SECTORS ; i++)
+    {
+        unsigned int addressFieldCycle = getAddressFieldCycle(pThis->physicalSectors[i]);
+        unsigned int headCycle = (startCycle + now) % revolutionCycles;
+        unsigned int wait = (addressFieldCycle + revolutionCycles - headCycle) % revolutionCycles;
+        
+        timing.waitCycles += wait;
+        now += wait + sectorReadCycles + cyclesPerSector;
+    }
+    timing.trackCycles = now;
+    
+    return timing;
+}
+
+static unsigned int getAddressFieldCycle(unsigned int physicalSector)
+{
+    return (NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES + physicalSector * NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR) *
+           DISK_IMAGE_INTERLEAVE_CYCLES_PER_NIBBLE;
+}
+
+
+DiskImageInterleaveTuning DiskImageInterleave_Tune(unsigned int cyclesPerSector)
+{
+    DiskImageInterleaveTuning tuning;
+    unsigned int              i;
+    
+    memset(&tuning, 0, sizeof(tuning));
+    tuning.cyclesPerSector = cyclesPerSector;
+    for (i = 0 ; i < DISK_IMAGE_INTERLEAVE_SKEW_COUNT ; i++)
+    {
+        DiskImageInterleave interleave;
+        
+        DiskImageInterleave_InitSkew(&interleave, i + 1);
+        tuning.timings[i] = DiskImageInterleave_Simulate(&interleave, cyclesPerSector);
+        tuning.timings[i].skew = i + 1;
+        if (tuning.timings[i].trackCycles < tuning.timings[tuning.bestIndex].trackCycles)
+            tuning.bestIndex = i;
+    }
+    
+    return tuning;
+}
+
+
+static void printTiming(const DiskImageInterleave* pInterleave, const char* pName, unsigned int cyclesPerSector);
+void DiskImageInterleave_PrintTuning(const DiskImageInterleaveTuning* pTuning)
+{
+    DiskImageInterleave interleave;
+    unsigned int        i;
+    
+    printf("Simulated reading a track in logical sector order with %u cycles spent on each sector:\n",
+           pTuning->cyclesPerSector);
+    for (i = 0 ; i < DISK_IMAGE_INTERLEAVE_SKEW_COUNT ; i++)
+    {
+        char name[16];
+        
+        sprintf(name, "skew:%u", pTuning->timings[i].skew);
+        DiskImageInterleave_InitSkew(&interleave, pTuning->timings[i].skew);
+        printTiming(&interleave, name, pTuning->cyclesPerSector);
+    }
+    memcpy(interleave.physicalSectors, g_dos33PhysicalSectors, sizeof(interleave.physicalSectors));
+    printTiming(&interleave, "dos3.3", pTuning->cyclesPerSector);
+    printf("Recommended interleave: skew:%u\n", pTuning->timings[pTuning->bestIndex].skew);
+}
+
+static void printTiming(const DiskImageInterleave* pInterleave, const char* pName, unsigned int cyclesPerSector)
+{
+    static const double       revolutionCycles = NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * 
+                                                 DISK_IMAGE_INTERLEAVE_CYCLES_PER_NIBBLE;
+    DiskImageInterleaveTiming timing = DiskImageInterleave_Simulate(pInterleave, cyclesPerSector);
+    char                      table[DISK_IMAGE_INTERLEAVE_FORMAT_SIZE];
+    
+    DiskImageInterleave_Format(pInterleave, table);
+    printf("  %-8s %s %6.2f revolutions, %u cycles waiting for sectors.\n",
+           pName, table, timing.trackCycles / revolutionCycles, timing.waitCycles);
+}
@@ -0,0 +1,255 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "DiskImageManifest.h"
+#include "DiskImageManifestTest.h"
+#include "TextFile.h"
+#include "ParseCSV.h"
+#include "util.h"
+
+
+#define HASH_PRIME 0x100000001b3ULL
+
+
+void DiskImageManifest_Free(DiskImageManifest* pThis)
+{
+    free(pThis->pEntries);
+    memset(pThis, 0, sizeof(*pThis));
+}
+
+
+static void growEntryArrayIfNecessary(DiskImageManifest* pThis);
+__throws void DiskImageManifest_AddEntry(DiskImageManifest*     pThis,
+                                         const DiskImageInsert* pInsert,
+                                         const unsigned char*   pObjectData)
+{
+    DiskImageManifestEntry* pEntry;
+
+    growEntryArrayIfNecessary(pThis);
+    pEntry = &pThis->pEntries[pThis->entryCount++];
+    pEntry->insert = *pInsert;
+    pEntry->insert.sourceOffset = 0;
+    pEntry->dataHash = DiskImageManifest_Hash(DISK_IMAGE_MANIFEST_HASH_SEED,
+                                              pObjectData + pInsert->sourceOffset,
+                                              pInsert->length);
+}
+
+static void growEntryArrayIfNecessary(DiskImageManifest* pThis)
+{
+    size_t                  newCount = pThis->allocatedCount ? pThis->allocatedCount * 2 : 64;
+    DiskImageManifestEntry* pRealloc;
+
+    if (pThis->entryCount < pThis->allocatedCount)
+        return;
+    pRealloc = realloc(pThis->pEntries, newCount * sizeof(*pRealloc));
+    if (!pRealloc)
+        __throw(outOfMemoryException);
+    pThis->pEntries = pRealloc;
+    pThis->allocatedCount = newCount;
+}
+
+
+static void parseManifestLine(DiskImageManifest* pThis, ParseCSV* pParser, const SizedString* pLine);
+static unsigned int parseNumberField(const SizedString* pField);
+static unsigned long long parseHashField(const SizedString* pField);
+__throws void DiskImageManifest_Read(DiskImageManifest* pThis, Vfs* pVfs, const char* pFilename)
+{
+    SizedString filename = SizedString_InitFromString(pFilename);
+    TextFile*   pTextFile = NULL;
+    ParseCSV*   pParser = NULL;
+
+    DiskImageManifest_Free(pThis);
+    __try
+    {
+        pTextFile = TextFile_CreateFromVfs(pVfs, NULL, &filename, NULL);
+        pParser = ParseCSV_Create();
+        while (!TextFile_IsEndOfFile(pTextFile))
+        {
+            SizedString nextLine = TextFile_GetNextLine(pTextFile);
+            if (SizedString_strlen(&nextLine) > 0)
+                parseManifestLine(pThis, pParser, &nextLine);
+        }
+    }
+    __catch
+    {
+        DiskImageManifest_Free(pThis);
+    }
+    ParseCSV_Free(pParser);
+    TextFile_Free(pTextFile);
+    if (getExceptionCode() != noException)
+        __rethrow;
+}
+
+static void parseManifestLine(DiskImageManifest* pThis, ParseCSV* pParser, const SizedString* pLine)
+{
+    const SizedString* pFields;
+    size_t             fieldCount;
+    DiskImageInsert    insert;
+    size_t             lengthField = 3;
+
+    ParseCSV_Parse(pParser, pLine);
+    fieldCount = ParseCSV_FieldCount(pParser);
+    pFields = ParseCSV_FieldPointers(pParser);
+    memset(&insert, 0, sizeof(insert));
+    if (fieldCount == 2 && 0 == SizedString_strcasecmp(&pFields[0], "image"))
+    {
+        pThis->imageHash = parseHashField(&pFields[1]);
+        return;
+    }
+    else if (fieldCount == 5 && 0 == SizedString_strcasecmp(&pFields[0], "block"))
+    {
+        insert.type = DISK_IMAGE_INSERTION_BLOCK;
+        insert.block = parseNumberField(&pFields[1]);
+        insert.intraBlockOffset = parseNumberField(&pFields[2]);
+    }
+    else if (fieldCount == 5 && 0 == SizedString_strcasecmp(&pFields[0], "rwts16"))
+    {
+        insert.type = DISK_IMAGE_INSERTION_RWTS16;
+        insert.track = parseNumberField(&pFields[1]);
+        insert.sector = parseNumberField(&pFields[2]);
+    }
+    else if (fieldCount == 6 && 0 == SizedString_strcasecmp(&pFields[0], "rw18"))
+    {
+        insert.type = DISK_IMAGE_INSERTION_RW18;
+        insert.side = parseNumberField(&pFields[1]);
+        insert.track = parseNumberField(&pFields[2]);
+        insert.intraTrackOffset = parseNumberField(&pFields[3]);
+        lengthField = 4;
+    }
+    else
+    {
+        __throw(fileException);
+    }
+    insert.length = parseNumberField(&pFields[lengthField]);
+
+    growEntryArrayIfNecessary(pThis);
+    pThis->pEntries[pThis->entryCount].insert = insert;
+    pThis->pEntries[pThis->entryCount].dataHash = parseHashField(&pFields[lengthField + 1]);
+    pThis->entryCount++;
+}
+
+static unsigned int parseNumberField(const SizedString* pField)
+{
+    const char*  pEnd = NULL;
+    unsigned int value = SizedString_strtoul(pField, &pEnd, 0);
+
+    if (pField->stringLength == 0 || pEnd != pField->pString + pField->stringLength)
+        __throw(fileException);
+    return value;
+}
+
+static unsigned long long parseHashField(const SizedString* pField)
+{
+    unsigned long long hash = 0;
+    size_t             i;
+
+    if (pField->stringLength == 0 || pField->stringLength > 16)
+        __throw(fileException);
+    for (i = 0 ; i < pField->stringLength ; i++)
+    {
+        char digit = pField->pString[i];
+
+        hash <<= 4;
+        if (digit >= '0' && digit <= '9')
+            hash |= digit - '0';
+        else if (digit >= 'a' && digit <= 'f')
+            hash |= digit - 'a' + 10;
+        else if (digit >= 'A' && digit <= 'F')
+            hash |= digit - 'A' + 10;
+        else
+            __throw(fileException);
+    }
+    return hash;
+}
+
+
+static void writeManifestEntry(FILE* pStream, const DiskImageManifestEntry* pEntry);
+__throws void DiskImageManifest_Write(DiskImageManifest* pThis, Vfs* pVfs, const char* pFilename)
+{
+    FILE*  pStream = Vfs_OpenStream(pVfs, pFilename);
+    size_t i;
+
+    if (!pStream)
+        __throw(fileOpenException);
+    fprintf(pStream, "IMAGE,%016llx\n", pThis->imageHash);
+    for (i = 0 ; i < pThis->entryCount ; i++)
+        writeManifestEntry(pStream, &pThis->pEntries[i]);
+    if (ferror(pStream))
+    {
+        fclose(pStream);
+        __throw(fileException);
+    }
+    if (0 != fclose(pStream))
+        __throw(fileException);
+}
+
+static void writeManifestEntry(FILE* pStream, const DiskImageManifestEntry* pEntry)
+{
+    const DiskImageInsert* pInsert = &pEntry->insert;
+
+    switch (pInsert->type)
+    {
+    case DISK_IMAGE_INSERTION_BLOCK:
+        fprintf(pStream, "BLOCK,%u,%u,%u,%016llx\n",
+                pInsert->block, pInsert->intraBlockOffset, pInsert->length, pEntry->dataHash);
+        break;
+    case DISK_IMAGE_INSERTION_RWTS16:
+        fprintf(pStream, "RWTS16,%u,%u,%u,%016llx\n",
+                pInsert->track, pInsert->sector, pInsert->length, pEntry->dataHash);
+        break;
+    case DISK_IMAGE_INSERTION_RW18:
+    default:
+        fprintf(pStream, "RW18,0x%02x,%u,%u,%u,%016llx\n",
+                pInsert->side, pInsert->track, pInsert->intraTrackOffset, pInsert->length, pEntry->dataHash);
+        break;
+    }
+}
+
+
+unsigned long long DiskImageManifest_Hash(unsigned long long hash, const void* pData, size_t dataSize)
+{
+    /* 64-bit FNV-1a. */
+    const unsigned char* pCurr = (const unsigned char*)pData;
+
+    while (dataSize--)
+    {
+        hash ^= *pCurr++;
+        hash *= HASH_PRIME;
+    }
+    return hash;
+}
+
+
+unsigned long long DiskImageManifest_HashEntry(unsigned long long hash, const DiskImageManifestEntry* pEntry)
+{
+    const DiskImageInsert* pInsert = &pEntry->insert;
+    unsigned int           fields[5];
+
+    memset(fields, 0, sizeof(fields));
+    fields[0] = pInsert->type;
+    fields[4] = pInsert->length;
+    if (pInsert->type == DISK_IMAGE_INSERTION_BLOCK)
+    {
+        fields[1] = pInsert->block;
+        fields[2] = pInsert->intraBlockOffset;
+    }
+    else
+    {
+        fields[1] = pInsert->type == DISK_IMAGE_INSERTION_RW18 ? pInsert->side : 0;
+        fields[2] = pInsert->track;
+        fields[3] = pInsert->sector;
+    }
+    hash = DiskImageManifest_Hash(hash, fields, sizeof(fields));
+    return DiskImageManifest_Hash(hash, &pEntry->dataHash, sizeof(pEntry->dataHash));
+}
@@ -17,40 +17,136 @@
 #include "TextFile.h"
 #include "ParseCSV.h"
 #include "ByteBuffer.h"
+#include "Vfs.h"
+#include "ObjectBundle.h"
+#include "DiskImageManifest.h"
+#include "DiskImageInterleave.h"
 
 
+#define DISK_IMAGE_OBJECT_CACHE_BUCKETS 64
+
+
+/* insertData() counts any stats into pStats rather than the image's own so that inserts which touch different regions
+   can be made concurrently. */
 typedef struct DiskImageVTable
 {
     void (*freeObject)(void *pThis);
-    void (*insertData)(void* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
-
+    void (*insertData)(void* pThis, const unsigned char* pData, DiskImageInsert* pInsert, DiskImageStats* pStats);
+    void (*flushImage)(void* pThis);
+    void (*getInsertRegions)(void* pThis, DiskImageInsert* pInsert, unsigned int* pFirstRegion, unsigned int* pLastRegion);
 } DiskImageVTable;
 
 
+/* Insertions recorded while a script is parsed, to be made once it has been read.  Bytes taken straight from a cached
+   object are referenced through pCachedData.  Image table updates and compressed lines reuse their buffers for every
+   line so their bytes are copied into pData at dataOffset instead.  Running out of memory just sets hasRunOutOfMemory
+   so that it isn't reported as an error against the script line. */
+typedef struct DiskImageInsertion
+{
+    DiskImageInsert      insert;
+    const unsigned char* pCachedData;
+    size_t               dataOffset;
+    unsigned int         lineNumber;
+} DiskImageInsertion;
+
+typedef struct DiskImageInsertionList
+{
+    DiskImageInsertion* pInsertions;
+    unsigned char*      pData;
+    size_t              insertionCount;
+    size_t              allocatedInsertions;
+    size_t              dataSize;
+    size_t              allocatedDataSize;
+    int                 hasRunOutOfMemory;
+} DiskImageInsertionList;
+
+
+/* Object insertions made by a script are recorded in scheduledInsertions as each line is parsed and are only made once
+   the whole script has been parsed, when those touching disjoint regions can be made concurrently.
+   Script lines ending in the compress flag swap the DiskImage's object data for compressed, the compressed copy of the
+   line's object slice, until the line completes.  The uncompressed object is kept in the pUncompressed* fields so that
+   it can be put back.  The line's compression stats are held in compressedStats until its insert succeeds. */
 typedef struct DiskImageScriptEngine
 {
-    DiskImage*      pDiskImage;
-    TextFile*       pTextFile;
-    ParseCSV*       pParser;
-    const char*     pScriptFilename;
-    DiskImageInsert insert;
-    unsigned int    lineNumber;
-    unsigned int    lastBlock;
-    unsigned int    lastLength;
+    DiskImage*              pDiskImage;
+    TextFile*               pTextFile;
+    ParseCSV*               pParser;
+    const char*             pScriptFilename;
+    DiskImageInsertionList* pInsertionList;
+    DiskImageInsertionList  scheduledInsertions;
+    DiskImageInsert         insert;
+    DiskImageInterleave     interleave;
+    unsigned int            lineNumber;
+    unsigned int            lastBlock;
+    unsigned int            lastLength;
+    unsigned int            errorCount;
+    unsigned char*          pDirtyRegions;
+    ByteBuffer              compressed;
+    const unsigned char*    pUncompressedObjectData;
+    unsigned int            uncompressedObjectFileLength;
+    unsigned int            uncompressedObjectDataSize;
+    DiskImageStats          compressedStats;
+    int                     isPlanning;
+    int                     hasPlanFailed;
+    int                     isCompressing;
+    int                     hasCompressedObject;
 } DiskImageScriptEngine;
 
 
+/* Decoded object file kept for the life of the DiskImage so that script lines which reference the same file again
+   don't have to re-open and re-parse it.  pData is never modified once cached; image table updates are applied to a
+   copy in DiskImage::object instead. */
+typedef struct DiskImageObject
+{
+    struct DiskImageObject* pNext;
+    char*                   pFilename;
+    ByteBuffer              buffer;
+    const unsigned char*    pData;
+    DiskImageInsert         insert;
+    unsigned int            dataSize;
+    unsigned int            length;
+} DiskImageObject;
+
+
+/* Filename keyed hash table of the DiskImageObjects loaded so far. */
+struct DiskImageObjectCache
+{
+    DiskImageObject* apBuckets[DISK_IMAGE_OBJECT_CACHE_BUCKETS];
+};
+
+
+/* The image is split into equal sized regions (tracks for nibble images and blocks for block images) which are the
+   unit that --update compares against the existing image and rewrites.  Objects are looked up in the read-only
+   pSharedObjectCache, when one is set, before the image's own objectCache.  When the output file has been mapped,
+   image.pBuffer points into a mapping of pMappedTempFilename rather than at the heap. */
 struct DiskImage
 {
-    DiskImageVTable*      pVTable;
-    ByteBuffer            image;
-    ByteBuffer            object;
-    DiskImageScriptEngine script;
-    DiskImageInsert       insert;
-    unsigned int          objectFileLength;
+    DiskImageVTable*            pVTable;
+    ByteBuffer                  image;
+    ByteBuffer                  object;
+    ByteBuffer                  baseline;
+    DiskImageManifest           manifest;
+    DiskImageManifest           previousManifest;
+    DiskImageScriptEngine       script;
+    DiskImageInsert             insert;
+    Vfs*                        pVfs;
+    ObjectBundle*               pBundle;
+    DiskImageObjectCache        objectCache;
+    DiskImageStats              stats;
+    const DiskImageObjectCache* pSharedObjectCache;
+    const unsigned char*        pObjectData;
+    char*                       pMappedImageFilename;
+    char*                       pMappedTempFilename;
+    unsigned int                objectDataSize;
+    unsigned int                objectFileLength;
+    unsigned int                regionSize;
+    int                         isRecordingManifest;
+    int                         hasPreviousManifest;
+    int                         hasWrittenMappedImage;
 };
 
 
-__throws void DiskImage_Init(DiskImage* pThis, DiskImageVTable* pVTable, unsigned int imageSize);
+__throws void DiskImage_Init(DiskImage* pThis, DiskImageVTable* pVTable, unsigned int imageSize, unsigned int regionSize);
+         void DiskImage_PrefetchObjects(DiskImage* pThis, DiskImageObject* pObjects);
 
 #endif /* _DISK_IMAGE_PRIV_H_ */
@@ -0,0 +1,247 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include "DiskImageSchedule.h"
+#include "DiskImageScheduleTest.h"
+#include "util.h"
+
+
+typedef struct IntervalEntry
+{
+    unsigned long long start;
+    unsigned long long end;
+    size_t             index;
+} IntervalEntry;
+
+
+/* The tree is implicit in pEntries, which are sorted by start: the middle entry of any range is the root of the
+   subtree for that range and pMaxEnds[] at that entry is the largest end found anywhere in the subtree. */
+typedef struct IntervalTree
+{
+    IntervalEntry*      pEntries;
+    unsigned long long* pMaxEnds;
+    size_t              count;
+} IntervalTree;
+
+
+void DiskImageSchedule_Free(DiskImageSchedule* pThis)
+{
+    free(pThis->pOrder);
+    free(pThis->pGroupStarts);
+    free(pThis->pOverwrites);
+    memset(pThis, 0, sizeof(*pThis));
+}
+
+
+static IntervalEntry* createSortedEntries(const DiskImageInterval* pIntervals, size_t count);
+static void groupOverlappingRegions(DiskImageSchedule* pThis, const IntervalEntry* pRegions, size_t* pGroups);
+static void orderInsertionsByGroup(DiskImageSchedule* pThis, const size_t* pGroups);
+static void buildIntervalTree(IntervalTree* pTree, const DiskImageInterval* pIntervals, size_t count);
+static void freeIntervalTree(IntervalTree* pTree);
+static void findOverwrites(DiskImageSchedule* pThis, const IntervalTree* pTree, const DiskImageInterval* pSpans);
+__throws void DiskImageSchedule_Build(DiskImageSchedule*       pThis,
+                                      const DiskImageInterval* pRegions,
+                                      const DiskImageInterval* pSpans,
+                                      size_t                   insertionCount)
+{
+    IntervalEntry* pRegionEntries = NULL;
+    size_t*        pGroups = NULL;
+    IntervalTree   spanTree;
+    
+    memset(pThis, 0, sizeof(*pThis));
+    memset(&spanTree, 0, sizeof(spanTree));
+    __try
+    {
+        pThis->pOrder = allocateAndZero(insertionCount * sizeof(*pThis->pOrder));
+        pThis->pGroupStarts = allocateAndZero((insertionCount + 1) * sizeof(*pThis->pGroupStarts));
+        pThis->pOverwrites = allocateAndZero(insertionCount * sizeof(*pThis->pOverwrites));
+        pThis->insertionCount = insertionCount;
+        pGroups = allocateAndZero(insertionCount * sizeof(*pGroups));
+        pRegionEntries = createSortedEntries(pRegions, insertionCount);
+        groupOverlappingRegions(pThis, pRegionEntries, pGroups);
+        orderInsertionsByGroup(pThis, pGroups);
+        buildIntervalTree(&spanTree, pSpans, insertionCount);
+        findOverwrites(pThis, &spanTree, pSpans);
+    }
+    __catch
+    {
+        DiskImageSchedule_Free(pThis);
+    }
+    freeIntervalTree(&spanTree);
+    free(pRegionEntries);
+    free(pGroups);
+    if (getExceptionCode() != noException)
+        __rethrow;
+}
+
+static int compareEntries(const void* pv1, const void* pv2);
+static IntervalEntry* createSortedEntries(const DiskImageInterval* pIntervals, size_t count)
+{
+    IntervalEntry* pEntries = allocateAndZero(count * sizeof(*pEntries));
+    size_t         i;
+    
+    for (i = 0 ; i < count ; i++)
+    {
+        pEntries[i].start = pIntervals[i].start;
+        pEntries[i].end = pIntervals[i].end;
+        pEntries[i].index = i;
+    }
+    qsort(pEntries, count, sizeof(*pEntries), compareEntries);
+    
+    return pEntries;
+}
+
+static int compareEntries(const void* pv1, const void* pv2)
+{
+    const IntervalEntry* p1 = (const IntervalEntry*)pv1;
+    const IntervalEntry* p2 = (const IntervalEntry*)pv2;
+    
+    if (p1->start != p2->start)
+        return p1->start < p2->start ? -1 : 1;
+    if (p1->index != p2->index)
+        return p1->index < p2->index ? -1 : 1;
+    return 0;
+}
+
+static void groupOverlappingRegions(DiskImageSchedule* pThis, const IntervalEntry* pRegions, size_t* pGroups)
+{
+    /* Walking the regions in order of their start, each one either overlaps the regions already covered by the
+       current group or starts a new group. */
+    unsigned long long groupEnd = 0;
+    size_t             i;
+    
+    for (i = 0 ; i < pThis->insertionCount ; i++)
+    {
+        const IntervalEntry* pEntry = &pRegions[i];
+        
+        if (pThis->groupCount == 0 || pEntry->start >= groupEnd)
+        {
+            pThis->groupCount++;
+            groupEnd = pEntry->end;
+        }
+        else if (pEntry->end > groupEnd)
+        {
+            groupEnd = pEntry->end;
+        }
+        pGroups[pEntry->index] = pThis->groupCount - 1;
+    }
+}
+
+static void orderInsertionsByGroup(DiskImageSchedule* pThis, const size_t* pGroups)
+{
+    /* Counting sort on the group index, which leaves the insertions of each group in script order. */
+    size_t* pStarts = pThis->pGroupStarts;
+    size_t  i;
+    
+    for (i = 0 ; i < pThis->insertionCount ; i++)
+        pStarts[pGroups[i] + 1]++;
+    for (i = 0 ; i < pThis->groupCount ; i++)
+        pStarts[i + 1] += pStarts[i];
+    for (i = 0 ; i < pThis->insertionCount ; i++)
+        pThis->pOrder[pStarts[pGroups[i]]++] = i;
+    
+    /* Each start was advanced to the start of the following group while filling in pOrder. */
+    for (i = pThis->groupCount ; i > 0 ; i--)
+        pStarts[i] = pStarts[i - 1];
+    pStarts[0] = 0;
+}
+
+static unsigned long long calculateMaxEnds(IntervalTree* pTree, size_t low, size_t high);
+static void buildIntervalTree(IntervalTree* pTree, const DiskImageInterval* pIntervals, size_t count)
+{
+    pTree->pEntries = createSortedEntries(pIntervals, count);
+    pTree->pMaxEnds = allocateAndZero(count * sizeof(*pTree->pMaxEnds));
+    pTree->count = count;
+    calculateMaxEnds(pTree, 0, count);
+}
+
+static unsigned long long calculateMaxEnds(IntervalTree* pTree, size_t low, size_t high)
+{
+    size_t             middle = low + (high - low) / 2;
+    unsigned long long maxEnd;
+    unsigned long long childMaxEnd;
+    
+    if (low >= high)
+        return 0;
+    maxEnd = pTree->pEntries[middle].end;
+    childMaxEnd = calculateMaxEnds(pTree, low, middle);
+    if (childMaxEnd > maxEnd)
+        maxEnd = childMaxEnd;
+    childMaxEnd = calculateMaxEnds(pTree, middle + 1, high);
+    if (childMaxEnd > maxEnd)
+        maxEnd = childMaxEnd;
+    pTree->pMaxEnds[middle] = maxEnd;
+    
+    return maxEnd;
+}
+
+static void freeIntervalTree(IntervalTree* pTree)
+{
+    free(pTree->pEntries);
+    free(pTree->pMaxEnds);
+    memset(pTree, 0, sizeof(*pTree));
+}
+
+static size_t findLatestEarlierOverlap(const IntervalTree*  pTree,
+                                       size_t               low,
+                                       size_t               high,
+                                       const IntervalEntry* pQuery,
+                                       size_t               latest);
+static void findOverwrites(DiskImageSchedule* pThis, const IntervalTree* pTree, const DiskImageInterval* pSpans)
+{
+    size_t i;
+    
+    for (i = 0 ; i < pThis->insertionCount ; i++)
+    {
+        IntervalEntry query;
+        
+        query.start = pSpans[i].start;
+        query.end = pSpans[i].end;
+        query.index = i;
+        pThis->pOverwrites[i] = findLatestEarlierOverlap(pTree, 0, pTree->count, &query,
+                                                         DISK_IMAGE_SCHEDULE_NO_OVERWRITE);
+    }
+}
+
+static int isLatestEarlierOverlap(const IntervalEntry* pEntry, const IntervalEntry* pQuery, size_t latest);
+static size_t findLatestEarlierOverlap(const IntervalTree*  pTree,
+                                       size_t               low,
+                                       size_t               high,
+                                       const IntervalEntry* pQuery,
+                                       size_t               latest)
+{
+    /* Subtrees whose intervals all end before the query starts are skipped, as are entries (and everything to their
+       right) which start after the query ends. */
+    size_t               middle = low + (high - low) / 2;
+    const IntervalEntry* pEntry;
+    
+    if (low >= high || pTree->pMaxEnds[middle] <= pQuery->start)
+        return latest;
+    latest = findLatestEarlierOverlap(pTree, low, middle, pQuery, latest);
+    pEntry = &pTree->pEntries[middle];
+    if (pEntry->start >= pQuery->end)
+        return latest;
+    if (isLatestEarlierOverlap(pEntry, pQuery, latest))
+        latest = pEntry->index;
+    return findLatestEarlierOverlap(pTree, middle + 1, high, pQuery, latest);
+}
+
+static int isLatestEarlierOverlap(const IntervalEntry* pEntry, const IntervalEntry* pQuery, size_t latest)
+{
+    if (pEntry->index >= pQuery->index)
+        return FALSE;
+    if (latest != DISK_IMAGE_SCHEDULE_NO_OVERWRITE && pEntry->index < latest)
+        return FALSE;
+    /* Empty intervals never overlap anything. */
+    return pEntry->start < pEntry->end && pQuery->start < pQuery->end && pEntry->end > pQuery->start;
+}
@@ -0,0 +1,148 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <sys/time.h>
+#include "DiskImageStats.h"
+#include "DiskImageStatsTest.h"
+#include "util.h"
+
+
+double DiskImageStats_GetSeconds(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (double)now.tv_sec + (double)now.tv_usec / 1000000.0;
+}
+
+
+void DiskImageStats_Add(DiskImageStats* pTotal, const DiskImageStats* pStats)
+{
+    pTotal->objectBytesRead += pStats->objectBytesRead;
+    pTotal->imageBytesWritten += pStats->imageBytesWritten;
+    pTotal->scriptLineCount += pStats->scriptLineCount;
+    pTotal->objectFilesRead += pStats->objectFilesRead;
+    pTotal->objectReferences += pStats->objectReferences;
+    pTotal->rw18TrackMerges += pStats->rw18TrackMerges;
+    pTotal->rwts16SectorsEncoded += pStats->rwts16SectorsEncoded;
+    pTotal->rw18TracksEncoded += pStats->rw18TracksEncoded;
+    pTotal->compressedInserts += pStats->compressedInserts;
+    pTotal->compressedInputBytes += pStats->compressedInputBytes;
+    pTotal->compressedOutputBytes += pStats->compressedOutputBytes;
+    pTotal->uncompressedTrackReads += pStats->uncompressedTrackReads;
+    pTotal->compressedTrackReads += pStats->compressedTrackReads;
+    pTotal->parseSeconds += pStats->parseSeconds;
+    pTotal->objectReadSeconds += pStats->objectReadSeconds;
+    pTotal->encodeSeconds += pStats->encodeSeconds;
+    pTotal->writeSeconds += pStats->writeSeconds;
+}
+
+
+static unsigned int getRepeatedObjectReferences(const DiskImageStats* pThis);
+static int          getTrackReadsSaved(const DiskImageStats* pThis);
+void DiskImageStats_PrintText(const DiskImageStats* pThis)
+{
+    printf("Script lines:           %u" LINE_ENDING
+           "Object files read:      %u (%llu bytes)" LINE_ENDING
+           "Repeated object reads:  %u" LINE_ENDING
+           "RW18 track merges:      %u" LINE_ENDING
+           "RWTS16 sectors encoded: %u" LINE_ENDING
+           "RW18 tracks encoded:    %u" LINE_ENDING
+           "Compressed inserts:     %u (%llu -> %llu bytes)" LINE_ENDING
+           "Track reads saved:      %d (estimated)" LINE_ENDING
+           "Image bytes written:    %llu" LINE_ENDING
+           "Script parse time:      %.6f seconds" LINE_ENDING
+           "Object I/O time:        %.6f seconds" LINE_ENDING
+           "Encode time:            %.6f seconds" LINE_ENDING
+           "Write time:             %.6f seconds" LINE_ENDING,
+           pThis->scriptLineCount,
+           pThis->objectFilesRead, pThis->objectBytesRead,
+           getRepeatedObjectReferences(pThis),
+           pThis->rw18TrackMerges,
+           pThis->rwts16SectorsEncoded,
+           pThis->rw18TracksEncoded,
+           pThis->compressedInserts, pThis->compressedInputBytes, pThis->compressedOutputBytes,
+           getTrackReadsSaved(pThis),
+           pThis->imageBytesWritten,
+           pThis->parseSeconds,
+           pThis->objectReadSeconds,
+           pThis->encodeSeconds,
+           pThis->writeSeconds);
+}
+
+static unsigned int getRepeatedObjectReferences(const DiskImageStats* pThis)
+{
+    if (pThis->objectReferences <= pThis->objectFilesRead)
+        return 0;
+    return pThis->objectReferences - pThis->objectFilesRead;
+}
+
+static int getTrackReadsSaved(const DiskImageStats* pThis)
+{
+    return (int)pThis->uncompressedTrackReads - (int)pThis->compressedTrackReads;
+}
+
+
+void DiskImageStats_PrintJson(const DiskImageStats* pThis)
+{
+    printf("{" LINE_ENDING
+           "  \"scriptLines\": %u," LINE_ENDING
+           "  \"objectFilesRead\": %u," LINE_ENDING
+           "  \"objectBytesRead\": %llu," LINE_ENDING
+           "  \"repeatedObjectReads\": %u," LINE_ENDING
+           "  \"rw18TrackMerges\": %u," LINE_ENDING
+           "  \"rwts16SectorsEncoded\": %u," LINE_ENDING
+           "  \"rw18TracksEncoded\": %u," LINE_ENDING
+           "  \"compressedInserts\": %u," LINE_ENDING
+           "  \"compressedInputBytes\": %llu," LINE_ENDING
+           "  \"compressedOutputBytes\": %llu," LINE_ENDING
+           "  \"uncompressedTrackReads\": %u," LINE_ENDING
+           "  \"compressedTrackReads\": %u," LINE_ENDING
+           "  \"imageBytesWritten\": %llu," LINE_ENDING
+           "  \"parseSeconds\": %.6f," LINE_ENDING
+           "  \"objectReadSeconds\": %.6f," LINE_ENDING
+           "  \"encodeSeconds\": %.6f," LINE_ENDING
+           "  \"writeSeconds\": %.6f" LINE_ENDING
+           "}" LINE_ENDING,
+           pThis->scriptLineCount,
+           pThis->objectFilesRead,
+           pThis->objectBytesRead,
+           getRepeatedObjectReferences(pThis),
+           pThis->rw18TrackMerges,
+           pThis->rwts16SectorsEncoded,
+           pThis->rw18TracksEncoded,
+           pThis->compressedInserts,
+           pThis->compressedInputBytes,
+           pThis->compressedOutputBytes,
+           pThis->uncompressedTrackReads,
+           pThis->compressedTrackReads,
+           pThis->imageBytesWritten,
+           pThis->parseSeconds,
+           pThis->objectReadSeconds,
+           pThis->encodeSeconds,
+           pThis->writeSeconds);
+}
+
+
+void DiskImageStats_PrintCompression(const DiskImageStats* pThis)
+{
+    if (pThis->compressedInserts == 0)
+        return;
+    printf("Compressed %u inserts from %llu to %llu bytes, saving %lld bytes and an estimated %d track reads."
+           LINE_ENDING,
+           pThis->compressedInserts,
+           pThis->compressedInputBytes,
+           pThis->compressedOutputBytes,
+           (long long)pThis->compressedInputBytes - (long long)pThis->compressedOutputBytes,
+           getTrackReadsSaved(pThis));
+}
@@ -17,38 +17,117 @@
 #include "BinaryBuffer.h"
 #include "TextFile.h"
 #include "ParseCSV.h"
+#include "ThreadPool.h"
 #include "util.h"
 
 
-struct NibbleDiskImage
+/* Logical contents of a track which haven't been nibblized yet.  A track holds either a whole RW18 track or a set of
+   dirty RWTS16 sectors (stored at sector * 256 in data) and is only encoded into the nibble image when the image is
+   next read or written. */
+typedef struct NibbleDiskImageTrack
+{
+    unsigned char data[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+    unsigned int  side;
+    unsigned int  dirtySectors;
+    int           hasRW18Data;
+    int           isRW18Dirty;
+} NibbleDiskImageTrack;
+
+
+/* Scratch state used while nibblizing a single track. */
+typedef struct NibbleDiskImageEncoder
 {
-    DiskImage            super;
     unsigned char*       pWrite;
-    const unsigned char* pRead;
+    const unsigned char* pCurrentTrack;
+    unsigned char        checksum;
+    unsigned char        aux[86];
+} NibbleDiskImageEncoder;
+
+
+/* Scratch state used while inserting one object into the tracks.  Stats are counted into pStats rather than the
+   image's own since inserts into different tracks can be made concurrently. */
+typedef struct NibbleDiskImageCursor
+{
     const unsigned char* pData;
-    unsigned char*       pCurrentTrack;
+    DiskImageStats*      pStats;
     unsigned int         side;
     unsigned int         track;
     unsigned int         sector;
     unsigned int         intraTrackOffset;
     unsigned int         bytesLeft;
-    unsigned char        checksum;
-    unsigned char        lastByte;
-    unsigned char        aux[86];
-    unsigned char        decode8to6[256];
+} NibbleDiskImageCursor;
+
+
+/* Scratch state used while decoding an RW18 track back into pTrackData. */
+typedef struct NibbleDiskImageReader
+{
+    const unsigned char* pRead;
+    unsigned char*       pTrackData;
+    unsigned int         side;
+    unsigned int         track;
+} NibbleDiskImageReader;
+
+
+struct NibbleDiskImage
+{
+    DiskImage            super;
+    NibbleDiskImageTrack tracks[DISK_IMAGE_TRACKS_PER_SIDE];
+};
+
+
+/* Disk nibbles used to encode each 6-bit value. */
+static const unsigned char g_encode6to8[64] =
+{
+    0x96, 0x97, 0x9a, 0x9b, 0x9d, 0x9e, 0x9f, 0xa6,
+    0xa7, 0xab, 0xac, 0xad, 0xae, 0xaf, 0xb2, 0xb3,
+    0xb4, 0xb5, 0xb6, 0xb7, 0xb9, 0xba, 0xbb, 0xbc,
+    0xbd, 0xbe, 0xbf, 0xcb, 0xcd, 0xce, 0xcf, 0xd3,
+    0xd6, 0xd7, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde,
+    0xdf, 0xe5, 0xe6, 0xe7, 0xe9, 0xea, 0xeb, 0xec,
+    0xed, 0xee, 0xef, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6,
+    0xf7, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+
+/* 6-bit value for each disk nibble, or 0xff for nibbles which never appear in encoded data.  Decoders can OR
+   together every value they look up and check the top bits just once to find invalid nibbles. */
+static const unsigned char g_decode8to6[256] =
+{
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x01, 0xff, 0xff, 0x02, 0x03, 0xff, 0x04, 0x05, 0x06,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x07, 0x08, 0xff, 0xff, 0xff, 0x09, 0x0a, 0x0b, 0x0c, 0x0d,
+    0xff, 0xff, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0xff, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x1b, 0xff, 0x1c, 0x1d, 0x1e,
+    0xff, 0xff, 0xff, 0x1f, 0xff, 0xff, 0x20, 0x21, 0xff, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0x29, 0x2a, 0x2b, 0xff, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32,
+    0xff, 0xff, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0xff, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f
 };
 
+/* The low two bits of a data byte with their order swapped, as they are packed into the 6-and-2 aux buffer.  Swapping
+   them again restores the original order. */
+static const unsigned char g_swappedLowBits[4] = { 0x0, 0x2, 0x1, 0x3 };
+
 
 static void freeObject(void* pThis);
-static void insertData(void* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
+static void insertData(void* pThis, const unsigned char* pData, DiskImageInsert* pInsert, DiskImageStats* pStats);
+static void flushImage(void* pThis);
+static void getInsertRegions(void* pThis, DiskImageInsert* pInsert, unsigned int* pFirstRegion, unsigned int* pLastRegion);
 struct DiskImageVTable NibbleDiskImageVTable = 
 { 
     freeObject,
-    insertData 
+    insertData,
+    flushImage,
+    getInsertRegions
 };
 
 
-static void initializeDecode8to6Table(NibbleDiskImage* pThis);
 static unsigned char encode6to8(unsigned char byte);
 __throws NibbleDiskImage* NibbleDiskImage_Create(void)
 {
@@ -57,8 +136,7 @@ __throws NibbleDiskImage* NibbleDiskImage_Create(void)
     __try
     {
         pThis = allocateAndZero(sizeof(*pThis));
-        DiskImage_Init(&pThis->super, &NibbleDiskImageVTable, NIBBLE_DISK_IMAGE_SIZE);
-        initializeDecode8to6Table(pThis);
+        DiskImage_Init(&pThis->super, &NibbleDiskImageVTable, NIBBLE_DISK_IMAGE_SIZE, NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK);
     }
     __catch
     {
@@ -69,30 +147,10 @@ __throws NibbleDiskImage* NibbleDiskImage_Create(void)
     return pThis;
 }
 
-static void initializeDecode8to6Table(NibbleDiskImage* pThis)
-{
-    unsigned char i = 0;
-    memset(pThis->decode8to6, 0xFF, sizeof(pThis->decode8to6));
-    for (i = 0 ; i < 64 ; i++)
-        pThis->decode8to6[encode6to8(i)] = i;
-}
-
 static unsigned char encode6to8(unsigned char byte)
 {
-    static const unsigned char nibbleArray[64] =
-    {
-        0x96, 0x97, 0x9a, 0x9b, 0x9d, 0x9e, 0x9f, 0xa6,
-        0xa7, 0xab, 0xac, 0xad, 0xae, 0xaf, 0xb2, 0xb3,
-        0xb4, 0xb5, 0xb6, 0xb7, 0xb9, 0xba, 0xbb, 0xbc,
-        0xbd, 0xbe, 0xbf, 0xcb, 0xcd, 0xce, 0xcf, 0xd3,
-        0xd6, 0xd7, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde,
-        0xdf, 0xe5, 0xe6, 0xe7, 0xe9, 0xea, 0xeb, 0xec,
-        0xed, 0xee, 0xef, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6,
-        0xf7, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
-    };
-
     assert ( byte < 64 );
-    return nibbleArray[byte];
+    return g_encode6to8[byte];
 }
 
 
@@ -125,65 +183,47 @@ __throws void NibbleDiskImage_InsertObjectFile(NibbleDiskImage* pThis, DiskImage
 }
 
 
-static void insertData(void* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
-{
-    NibbleDiskImage_InsertData((NibbleDiskImage*)pThis, pData, pInsert);
-}
-
-static void insertRWTS16Data(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
-static void prepareForFirstRWTS16Sector(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
-static void advanceToNextSector(NibbleDiskImage* pThis);
-static void writeRWTS16Sector(NibbleDiskImage* pThis);
-static void validateRWTS16TrackAndSector(NibbleDiskImage* pThis);
-static void writeSectorLeadInSyncBytes(NibbleDiskImage* pThis);
-static void writeSyncBytes(NibbleDiskImage* pThis, size_t syncByteCount);
-static void writeRWTS16AddressField(NibbleDiskImage* pThis, unsigned char volume, unsigned char track, unsigned char sector);
-static void writeRWTS16AddressFieldProlog(NibbleDiskImage* pThis);
-static void initChecksum(NibbleDiskImage* pThis);
-static void write4and4Data(NibbleDiskImage* pThis, unsigned char byte);
-static void updateChecksum(NibbleDiskImage* pThis, unsigned char byte);
-static void writeRWTS16FieldEpilog(NibbleDiskImage* pThis);
-static void writeRWTS16DataField(NibbleDiskImage* pThis, const unsigned char* pData);
-static void writeRWTS16DataFieldProlog(NibbleDiskImage* pThis);
-static void write6and2Data(NibbleDiskImage* pThis, const unsigned char* pData);
-static void fillAuxBuffer(NibbleDiskImage* pThis, const unsigned char* pData);
-static unsigned char encodeAuxByte(NibbleDiskImage* pThis, size_t i, const unsigned char* pData);
-static unsigned char lowBitsByte(size_t i, const unsigned char* pData);
-static unsigned char lowBitOffset(size_t i);
-static unsigned char midBitsByte(size_t i, const unsigned char* pData);
-static unsigned char midBitOffset(size_t i);
-static unsigned char highBitsByte(size_t i, const unsigned char* pData);
-static unsigned char highBitOffset(size_t i);
-static void checksumNibbilizeAndWrite(NibbleDiskImage* pThis, const unsigned char* pData);
-static void checksumNibbilizeAndWriteAuxBuffer(NibbleDiskImage* pThis);
-static unsigned char nibbilizeByte(NibbleDiskImage* pThis, unsigned char byte);
-static void checksumNibbilizeAndWriteDataBuffer(NibbleDiskImage* pThis, const unsigned char* pData);
-static void nibbilizeAndWriteChecksum(NibbleDiskImage* pThis);
-static void insertRW18Data(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
-static void prepareForFirstRW18Track(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert);
-static void writeRW18Track(NibbleDiskImage* pThis);
-static void validateRW18TrackAndOffset(NibbleDiskImage* pThis);
-static unsigned int initTrackData(NibbleDiskImage* pThis, unsigned char* pTrackData, size_t trackDataSize);
-static void readCurrentTrackContentsOrZeroFill(NibbleDiskImage* pThis, unsigned char* pTrackData, size_t trackDataSize);
-static void writeEncodedBytes(NibbleDiskImage* pThis, const char* pBytes, size_t byteCount);
-static void writeRW18Sector(NibbleDiskImage* pThis, unsigned char sector);
-static void writeRW18AddressField(NibbleDiskImage* pThis, unsigned char track, unsigned char sector);
-static void writeRW18AddressFieldProlog(NibbleDiskImage* pThis);
-static void writeRW18AddressFieldEpilog(NibbleDiskImage* pThis);
-static void writeRW18DataField(NibbleDiskImage* pThis, unsigned char sector);
-static void writeRW18BundleId(NibbleDiskImage* pThis);
-static void writeRW18Data(NibbleDiskImage* pThis, unsigned char sector);
-static void writeRW18DataFieldEpilog(NibbleDiskImage* pThis);
-static void advanceToNextRW18Track(NibbleDiskImage* pThis, unsigned int bytesUsed);
 __throws void NibbleDiskImage_InsertData(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
 {
+    insertData(pThis, pData, pInsert, &pThis->super.stats);
+}
+
+static void insertRWTS16Data(NibbleDiskImage* pThis, NibbleDiskImageCursor* pCursor);
+static void prepareForFirstRWTS16Sector(NibbleDiskImageCursor* pCursor, const unsigned char* pData, DiskImageInsert* pInsert);
+static void advanceToNextSector(NibbleDiskImageCursor* pCursor);
+static void storeRWTS16Sector(NibbleDiskImage* pThis, NibbleDiskImageCursor* pCursor);
+static void validateRWTS16TrackAndSector(NibbleDiskImageCursor* pCursor);
+static void insertRW18Data(NibbleDiskImage* pThis, NibbleDiskImageCursor* pCursor);
+static void prepareForFirstRW18Track(NibbleDiskImageCursor* pCursor, const unsigned char* pData, DiskImageInsert* pInsert);
+static void storeRW18Track(NibbleDiskImage* pThis, NibbleDiskImageCursor* pCursor);
+static void validateRW18TrackAndOffset(NibbleDiskImageCursor* pCursor);
+static void readCurrentTrackContentsOrZeroFill(NibbleDiskImage*       pThis,
+                                               NibbleDiskImageCursor* pCursor,
+                                               NibbleDiskImageTrack*  pTrack);
+static unsigned int copyDataIntoTrack(NibbleDiskImageCursor* pCursor, NibbleDiskImageTrack* pTrack);
+static void advanceToNextRW18Track(NibbleDiskImageCursor* pCursor, unsigned int bytesUsed);
+static void flushTrack(NibbleDiskImage* pThis, unsigned int track, DiskImageStats* pStats);
+static void readRW18Track(NibbleDiskImage* pThis,
+                          unsigned int     side,
+                          unsigned int     track,
+                          unsigned char*   pTrackData,
+                          size_t           trackDataSize,
+                          DiskImageStats*  pStats);
+static void insertData(void* pvThis, const unsigned char* pData, DiskImageInsert* pInsert, DiskImageStats* pStats)
+{
+    NibbleDiskImage*      pThis = (NibbleDiskImage*)pvThis;
+    NibbleDiskImageCursor cursor;
+    
+    cursor.pStats = pStats;
     switch (pInsert->type)
     {
     case DISK_IMAGE_INSERTION_RWTS16:
-        insertRWTS16Data(pThis, pData, pInsert);
+        prepareForFirstRWTS16Sector(&cursor, pData, pInsert);
+        insertRWTS16Data(pThis, &cursor);
         break;
     case DISK_IMAGE_INSERTION_RW18:
-        insertRW18Data(pThis, pData, pInsert);
+        prepareForFirstRW18Track(&cursor, pData, pInsert);
+        insertRW18Data(pThis, &cursor);
         break;
     case DISK_IMAGE_INSERTION_BLOCK:
     default:
@@ -191,422 +231,540 @@ __throws void NibbleDiskImage_InsertData(NibbleDiskImage* pThis, const unsigned
     }
 }
 
-static void insertRWTS16Data(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
+static void insertRWTS16Data(NibbleDiskImage* pThis, NibbleDiskImageCursor* pCursor)
 {
-    prepareForFirstRWTS16Sector(pThis, pData, pInsert);
-    while (pThis->bytesLeft > 0)
+    while (pCursor->bytesLeft > 0)
     {
-        writeRWTS16Sector(pThis);
-        advanceToNextSector(pThis);
+        storeRWTS16Sector(pThis, pCursor);
+        advanceToNextSector(pCursor);
     }
 }
 
-static void prepareForFirstRWTS16Sector(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
+static void prepareForFirstRWTS16Sector(NibbleDiskImageCursor* pCursor, const unsigned char* pData, DiskImageInsert* pInsert)
 {
-    pThis->track = pInsert->track;
-    pThis->sector = pInsert->sector;
-    pThis->bytesLeft = pInsert->length;
-    pThis->pData = pData + pInsert->sourceOffset;
+    pCursor->track = pInsert->track;
+    pCursor->sector = pInsert->sector;
+    pCursor->bytesLeft = pInsert->length;
+    pCursor->pData = pData + pInsert->sourceOffset;
 }
 
-static void advanceToNextSector(NibbleDiskImage* pThis)
+static void advanceToNextSector(NibbleDiskImageCursor* pCursor)
 {
-    pThis->bytesLeft -= DISK_IMAGE_BYTES_PER_SECTOR;
-    pThis->pData += DISK_IMAGE_BYTES_PER_SECTOR;
-    pThis->sector++;
-    if (pThis->sector >= NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK)
+    pCursor->bytesLeft -= DISK_IMAGE_BYTES_PER_SECTOR;
+    pCursor->pData += DISK_IMAGE_BYTES_PER_SECTOR;
+    pCursor->sector++;
+    if (pCursor->sector >= NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK)
     {
-        pThis->sector = 0;
-        pThis->track++;
+        pCursor->sector = 0;
+        pCursor->track++;
     }
 }
 
-static void writeRWTS16Sector(NibbleDiskImage* pThis)
+static void storeRWTS16Sector(NibbleDiskImage* pThis, NibbleDiskImageCursor* pCursor)
 {
-    static const unsigned char   volume = 0;
-    unsigned int                 imageOffset = NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * pThis->track + 
-                                               NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES +
-                                               NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR * pThis->sector;
-    const unsigned char*         pStart;
-    
-    validateRWTS16TrackAndSector(pThis);
-        
-    pThis->pWrite = DiskImage_GetImagePointer(&pThis->super) + imageOffset;
-    pStart = pThis->pWrite;
+    NibbleDiskImageTrack* pTrack;
     
-    writeSectorLeadInSyncBytes(pThis);
-    writeRWTS16AddressField(pThis, volume, pThis->track, pThis->sector);
-    writeSyncBytes(pThis, NIBBLE_DISK_IMAGE_RWTS16_GAP2_SYNC_BYTES);
-    writeRWTS16DataField(pThis, pThis->pData);
+    validateRWTS16TrackAndSector(pCursor);
     
-    assert ( pThis->pWrite - pStart == NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR - NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES);
+    /* The sector will overwrite part of any RW18 track so that track must be nibblized first. */
+    pTrack = &pThis->tracks[pCursor->track];
+    if (pTrack->hasRW18Data)
+    {
+        flushTrack(pThis, pCursor->track, pCursor->pStats);
+        pTrack->hasRW18Data = FALSE;
+    }
+    memcpy(pTrack->data + pCursor->sector * DISK_IMAGE_BYTES_PER_SECTOR, pCursor->pData, DISK_IMAGE_BYTES_PER_SECTOR);
+    pTrack->dirtySectors |= 1 << pCursor->sector;
 }
 
-static void validateRWTS16TrackAndSector(NibbleDiskImage* pThis)
+static void validateRWTS16TrackAndSector(NibbleDiskImageCursor* pCursor)
 {
-    if (pThis->sector >= NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK)
+    if (pCursor->sector >= NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK)
         __throw(invalidSectorException);
-    if (pThis->track >= DISK_IMAGE_TRACKS_PER_SIDE)
+    if (pCursor->track >= DISK_IMAGE_TRACKS_PER_SIDE)
         __throw(invalidTrackException);
-    if (pThis->bytesLeft < DISK_IMAGE_BYTES_PER_SECTOR)
+    if (pCursor->bytesLeft < DISK_IMAGE_BYTES_PER_SECTOR)
         __throw(invalidLengthException);
 }
 
-static void writeSectorLeadInSyncBytes(NibbleDiskImage* pThis)
+static void insertRW18Data(NibbleDiskImage* pThis, NibbleDiskImageCursor* pCursor)
 {
-    size_t leadInSyncByteCount;
-    
-    if (pThis->sector == 0)
-        leadInSyncByteCount = NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES;
-    else
-        leadInSyncByteCount = NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES;
-    pThis->pWrite -= leadInSyncByteCount;
-    
-    writeSyncBytes(pThis, leadInSyncByteCount);
+    while (pCursor->bytesLeft > 0)
+        storeRW18Track(pThis, pCursor);
 }
 
-static void writeSyncBytes(NibbleDiskImage* pThis, size_t syncByteCount)
+static void prepareForFirstRW18Track(NibbleDiskImageCursor* pCursor, const unsigned char* pData, DiskImageInsert* pInsert)
 {
-    memset(pThis->pWrite, 0xff, syncByteCount);
-    pThis->pWrite += syncByteCount;
+    pCursor->side = pInsert->side;
+    pCursor->track = pInsert->track;
+    pCursor->intraTrackOffset = pInsert->intraTrackOffset;
+    pCursor->bytesLeft = pInsert->length;
+    pCursor->pData = pData + pInsert->sourceOffset;
 }
 
-static void writeRWTS16AddressField(NibbleDiskImage* pThis, unsigned char volume, unsigned char track, unsigned char sector)
+static void storeRW18Track(NibbleDiskImage* pThis, NibbleDiskImageCursor* pCursor)
 {
-    writeRWTS16AddressFieldProlog(pThis);
+    NibbleDiskImageTrack* pTrack;
+    unsigned int          bytesUsed;
     
-    initChecksum(pThis);
-    write4and4Data(pThis, volume);
-    write4and4Data(pThis, track);
-    write4and4Data(pThis, sector);
-    write4and4Data(pThis, pThis->checksum);
+    validateRW18TrackAndOffset(pCursor);
     
-    writeRWTS16FieldEpilog(pThis);
+    pTrack = &pThis->tracks[pCursor->track];
+    readCurrentTrackContentsOrZeroFill(pThis, pCursor, pTrack);
+    bytesUsed = copyDataIntoTrack(pCursor, pTrack);
+    pTrack->side = pCursor->side;
+    pTrack->hasRW18Data = TRUE;
+    pTrack->isRW18Dirty = TRUE;
+    
+    advanceToNextRW18Track(pCursor, bytesUsed);
 }
 
-static void writeRWTS16AddressFieldProlog(NibbleDiskImage* pThis)
+static void validateRW18TrackAndOffset(NibbleDiskImageCursor* pCursor)
 {
-    memcpy(pThis->pWrite, "\xD5\xAA\x96", 3);
-    pThis->pWrite += 3;
+    if (pCursor->track >= DISK_IMAGE_TRACKS_PER_SIDE)
+        __throw(invalidTrackException);
+    if (pCursor->intraTrackOffset >= DISK_IMAGE_RW18_BYTES_PER_TRACK)
+        __throw(invalidIntraTrackOffsetException);
 }
 
-static void initChecksum(NibbleDiskImage* pThis)
+static void readCurrentTrackContentsOrZeroFill(NibbleDiskImage*       pThis,
+                                               NibbleDiskImageCursor* pCursor,
+                                               NibbleDiskImageTrack*  pTrack)
 {
-    pThis->checksum = 0;
+    /* A track which was already nibblized with a different bundle id wouldn't decode so it starts out zeroed. */
+    if (pTrack->hasRW18Data)
+    {
+        if ((unsigned char)pTrack->side != (unsigned char)pCursor->side)
+            memset(pTrack->data, 0x00, sizeof(pTrack->data));
+        return;
+    }
+    
+    __try
+    {
+        readRW18Track(pThis, pCursor->side, pCursor->track, pTrack->data, sizeof(pTrack->data), pCursor->pStats);
+        pCursor->pStats->rw18TrackMerges++;
+    }
+    __catch
+    {
+        /* Track didn't already contain RW18 data so initialize it to all zeroes. */
+        memset(pTrack->data, 0x00, sizeof(pTrack->data));
+        clearExceptionCode();
+    }
 }
 
-static void write4and4Data(NibbleDiskImage* pThis, unsigned char byte)
+static unsigned int copyDataIntoTrack(NibbleDiskImageCursor* pCursor, NibbleDiskImageTrack* pTrack)
 {
-    char oddBits = byte & 0xAA;
-    char evenBits = byte & 0x55;
-    char encodedOddByte = 0xAA | (oddBits >> 1);
-    char encodedEvenByte = 0xAA | evenBits;
+    unsigned int copyBytes = sizeof(pTrack->data) - pCursor->intraTrackOffset;
     
-    updateChecksum(pThis, byte);
-    *pThis->pWrite++ = encodedOddByte;
-    *pThis->pWrite++ = encodedEvenByte;
+    if (copyBytes > pCursor->bytesLeft)
+        copyBytes = pCursor->bytesLeft;
+    memcpy(pTrack->data + pCursor->intraTrackOffset, pCursor->pData, copyBytes);
+    
+    return copyBytes;
 }
 
-static void updateChecksum(NibbleDiskImage* pThis, unsigned char byte)
+static void advanceToNextRW18Track(NibbleDiskImageCursor* pCursor, unsigned int bytesUsed)
 {
-    pThis->checksum ^= byte;
+    pCursor->bytesLeft -= bytesUsed;
+    pCursor->pData += bytesUsed;
+    pCursor->intraTrackOffset = 0;
+    pCursor->track++;
 }
 
-static void writeRWTS16FieldEpilog(NibbleDiskImage* pThis)
-{
-    memcpy(pThis->pWrite, "\xDE\xAA\xEB", 3);
-    pThis->pWrite += 3;
-}
 
-static void writeRWTS16DataField(NibbleDiskImage* pThis, const unsigned char* pData)
+static void getInsertRegions(void* pThis, DiskImageInsert* pInsert, unsigned int* pFirstRegion, unsigned int* pLastRegion)
 {
-    writeRWTS16DataFieldProlog(pThis);
-    write6and2Data(pThis, pData);
-    writeRWTS16FieldEpilog(pThis);
+    /* Each track is a region.  The starting track, sector and offset are validated the same way as insertData()
+       would. */
+    unsigned int startOffset = 0;
+    unsigned int bytesPerTrack = DISK_IMAGE_RW18_BYTES_PER_TRACK;
+    
+    switch (pInsert->type)
+    {
+    case DISK_IMAGE_INSERTION_RWTS16:
+        if (pInsert->sector >= NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK)
+            __throw(invalidSectorException);
+        startOffset = pInsert->sector * DISK_IMAGE_BYTES_PER_SECTOR;
+        bytesPerTrack = NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK * DISK_IMAGE_BYTES_PER_SECTOR;
+        break;
+    case DISK_IMAGE_INSERTION_RW18:
+        if (pInsert->intraTrackOffset >= DISK_IMAGE_RW18_BYTES_PER_TRACK)
+            __throw(invalidIntraTrackOffsetException);
+        startOffset = pInsert->intraTrackOffset;
+        break;
+    case DISK_IMAGE_INSERTION_BLOCK:
+    default:
+        __throw(invalidInsertionTypeException);
+    }
+    if (pInsert->track >= DISK_IMAGE_TRACKS_PER_SIDE)
+        __throw(invalidTrackException);
+    
+    *pFirstRegion = pInsert->track;
+    *pLastRegion = pInsert->track + (pInsert->length ? (startOffset + pInsert->length - 1) / bytesPerTrack : 0);
+}
+
+
+static int  hasDirtyTracks(NibbleDiskImage* pThis);
+static int  isTrackDirty(NibbleDiskImageTrack* pTrack);
+static void countTrackEncodes(DiskImageStats* pStats, const NibbleDiskImageTrack* pTrack);
+static void flushTrackCallback(void* pContext, size_t itemIndex);
+static void encodeTrack(NibbleDiskImage* pThis, unsigned int track);
+static void writeRW18Track(NibbleDiskImageEncoder* pEncoder, 
+                           unsigned char*          pTrackNibbles,
+                           unsigned int            track, 
+                           unsigned int            side, 
+                           const unsigned char*    pTrackData);
+static void writeEncodedBytes(NibbleDiskImageEncoder* pEncoder, const char* pBytes, size_t byteCount);
+static void writeRW18Sector(NibbleDiskImageEncoder* pEncoder, unsigned int track, unsigned int side, unsigned char sector);
+static void writeRW18AddressField(NibbleDiskImageEncoder* pEncoder, unsigned char track, unsigned char sector);
+static void writeRW18AddressFieldProlog(NibbleDiskImageEncoder* pEncoder);
+static void writeRW18AddressFieldEpilog(NibbleDiskImageEncoder* pEncoder);
+static void writeRW18DataField(NibbleDiskImageEncoder* pEncoder, unsigned int side, unsigned char sector);
+static void writeRW18BundleId(NibbleDiskImageEncoder* pEncoder, unsigned int side);
+static void writeRW18Data(NibbleDiskImageEncoder* pEncoder, unsigned char sector);
+static void writeRW18DataFieldEpilog(NibbleDiskImageEncoder* pEncoder);
+static void writeRWTS16Sector(NibbleDiskImageEncoder* pEncoder, 
+                              unsigned char*          pTrackNibbles,
+                              unsigned int            track, 
+                              unsigned int            sector, 
+                              const unsigned char*    pSectorData);
+static void writeSectorLeadInSyncBytes(NibbleDiskImageEncoder* pEncoder, unsigned int sector);
+static void writeSyncBytes(NibbleDiskImageEncoder* pEncoder, size_t syncByteCount);
+static void writeRWTS16AddressField(NibbleDiskImageEncoder* pEncoder, unsigned char volume, unsigned char track, unsigned char sector);
+static void writeRWTS16AddressFieldProlog(NibbleDiskImageEncoder* pEncoder);
+static void initChecksum(NibbleDiskImageEncoder* pEncoder);
+static void write4and4Data(NibbleDiskImageEncoder* pEncoder, unsigned char byte);
+static void updateChecksum(NibbleDiskImageEncoder* pEncoder, unsigned char byte);
+static void writeRWTS16FieldEpilog(NibbleDiskImageEncoder* pEncoder);
+static void writeRWTS16DataField(NibbleDiskImageEncoder* pEncoder, const unsigned char* pData);
+static void writeRWTS16DataFieldProlog(NibbleDiskImageEncoder* pEncoder);
+static void write6and2Data(NibbleDiskImageEncoder* pEncoder, const unsigned char* pData);
+static void fillAuxBuffer(NibbleDiskImageEncoder* pEncoder, const unsigned char* pData);
+static void checksumNibbilizeAndWrite(NibbleDiskImageEncoder* pEncoder, const unsigned char* pData);
+static void flushImage(void* pvThis)
+{
+    /* Each track is encoded into its own region of the image with its own encoder state so the dirty tracks can be
+       nibblized in parallel.  The encodes are counted up front since the stats aren't safe to update from the pool. */
+    NibbleDiskImage* pThis = (NibbleDiskImage*)pvThis;
+    unsigned int     track;
+    
+    if (!hasDirtyTracks(pThis))
+        return;
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+        countTrackEncodes(&pThis->super.stats, &pThis->tracks[track]);
+    ThreadPool_Run(DISK_IMAGE_TRACKS_PER_SIDE, flushTrackCallback, pThis);
 }
 
-static void writeRWTS16DataFieldProlog(NibbleDiskImage* pThis)
+static int hasDirtyTracks(NibbleDiskImage* pThis)
 {
-    memcpy(pThis->pWrite, "\xD5\xAA\xAD", 3);
-    pThis->pWrite += 3;
+    unsigned int track;
+    
+    for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+    {
+        if (isTrackDirty(&pThis->tracks[track]))
+            return TRUE;
+    }
+    return FALSE;
 }
 
-static void write6and2Data(NibbleDiskImage* pThis, const unsigned char* pData)
+static int isTrackDirty(NibbleDiskImageTrack* pTrack)
 {
-    fillAuxBuffer(pThis, pData);
-    checksumNibbilizeAndWrite(pThis, pData);
+    return pTrack->isRW18Dirty || pTrack->dirtySectors;
 }
 
-static void fillAuxBuffer(NibbleDiskImage* pThis, const unsigned char* pData)
+static void countTrackEncodes(DiskImageStats* pStats, const NibbleDiskImageTrack* pTrack)
 {
-    size_t i;
+    unsigned int dirtySectors = pTrack->dirtySectors;
     
-    for (i = 0; i < sizeof(pThis->aux) ; i++)
-        pThis->aux[i] = encodeAuxByte(pThis, i, pData);
+    if (pTrack->isRW18Dirty)
+        pStats->rw18TracksEncoded++;
+    for ( ; dirtySectors ; dirtySectors &= dirtySectors - 1)
+        pStats->rwts16SectorsEncoded++;
 }
 
-static unsigned char encodeAuxByte(NibbleDiskImage* pThis, size_t i, const unsigned char* pData)
+static void flushTrackCallback(void* pContext, size_t itemIndex)
 {
-    unsigned char lowByte = lowBitsByte(i, pData);
-    unsigned char midByte = midBitsByte(i, pData);
-    unsigned char highByte = highBitsByte(i, pData);
-    unsigned char lowBits = ((lowByte & 1) << 1) |
-                            ((lowByte & 2) >> 1);
-    unsigned char midBits = ((midByte & 1) << 3) |
-                            ((midByte & 2) << 1);
-    unsigned char highBits = ((highByte & 1) << 5) |
-                             ((highByte & 2) << 3);
-    
-    return highBits | midBits | lowBits;
+    encodeTrack((NibbleDiskImage*)pContext, (unsigned int)itemIndex);
 }
 
-static unsigned char lowBitsByte(size_t i, const unsigned char* pData)
+static void flushTrack(NibbleDiskImage* pThis, unsigned int track, DiskImageStats* pStats)
 {
-    return pData[lowBitOffset(i)];
+    countTrackEncodes(pStats, &pThis->tracks[track]);
+    encodeTrack(pThis, track);
 }
 
-static unsigned char lowBitOffset(size_t i)
+static void encodeTrack(NibbleDiskImage* pThis, unsigned int track)
 {
-    return (unsigned char)(0x55 - i);
+    NibbleDiskImageTrack*  pTrack = &pThis->tracks[track];
+    unsigned char*         pTrackNibbles = pThis->super.image.pBuffer + NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * track;
+    NibbleDiskImageEncoder encoder;
+    unsigned int           sector;
+    
+    if (pTrack->isRW18Dirty)
+        writeRW18Track(&encoder, pTrackNibbles, track, pTrack->side, pTrack->data);
+    pTrack->isRW18Dirty = FALSE;
+    
+    for (sector = 0 ; pTrack->dirtySectors ; sector++)
+    {
+        if (pTrack->dirtySectors & (1 << sector))
+            writeRWTS16Sector(&encoder, pTrackNibbles, track, sector, pTrack->data + sector * DISK_IMAGE_BYTES_PER_SECTOR);
+        pTrack->dirtySectors &= ~(1 << sector);
+    }
 }
 
-static unsigned char midBitsByte(size_t i, const unsigned char* pData)
+static void writeRW18Track(NibbleDiskImageEncoder* pEncoder, 
+                           unsigned char*          pTrackNibbles,
+                           unsigned int            track, 
+                           unsigned int            side, 
+                           const unsigned char*    pTrackData)
 {
-    return pData[midBitOffset(i)];
-}
+    unsigned char sector = 5;
+    
+    pEncoder->pWrite = pTrackNibbles;
+    pEncoder->pCurrentTrack = pTrackData;
+    
+    writeSyncBytes(pEncoder, 403);
+    writeEncodedBytes(pEncoder, "\xa5\x96\xbf\xff\xfe\xaa\xbb\xaa\xaa\xff\xef\x9a", 12);
+    writeRW18Sector(pEncoder, track, side, sector);
+    
+    do
+    {
+        writeSyncBytes(pEncoder, 5);
+        writeRW18Sector(pEncoder, track, side, --sector);
+    } while (sector);
 
-static unsigned char midBitOffset(size_t i)
-{
-    return (unsigned char)(0xAB - i);
+    assert ( pEncoder->pWrite - pTrackNibbles == NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK );
 }
 
-static unsigned char highBitsByte(size_t i, const unsigned char* pData)
+static void writeEncodedBytes(NibbleDiskImageEncoder* pEncoder, const char* pBytes, size_t byteCount)
 {
-    return pData[highBitOffset(i)];
+    memcpy(pEncoder->pWrite, pBytes, byteCount);
+    pEncoder->pWrite += byteCount;
 }
 
-static unsigned char highBitOffset(size_t i)
+static void writeRW18Sector(NibbleDiskImageEncoder* pEncoder, unsigned int track, unsigned int side, unsigned char sector)
 {
-    return (unsigned char)(0x101 - i);
+    writeRW18AddressField(pEncoder, track, sector);
+    writeSyncBytes(pEncoder, 2);
+    writeRW18DataField(pEncoder, side, sector);
+    writeSyncBytes(pEncoder, 1);
 }
 
-static void checksumNibbilizeAndWrite(NibbleDiskImage* pThis, const unsigned char* pData)
+static void writeRW18AddressField(NibbleDiskImageEncoder* pEncoder, unsigned char track, unsigned char sector)
 {
-    pThis->lastByte = 0;
-    initChecksum(pThis);
+    writeRW18AddressFieldProlog(pEncoder);
+    
+    *pEncoder->pWrite++ = encode6to8(track);
+    *pEncoder->pWrite++ = encode6to8(sector);
+    *pEncoder->pWrite++ = encode6to8(track ^ sector);
     
-    checksumNibbilizeAndWriteAuxBuffer(pThis);
-    checksumNibbilizeAndWriteDataBuffer(pThis, pData);
-    nibbilizeAndWriteChecksum(pThis);
+    writeRW18AddressFieldEpilog(pEncoder);
 }
 
-static void checksumNibbilizeAndWriteAuxBuffer(NibbleDiskImage* pThis)
+static void writeRW18AddressFieldProlog(NibbleDiskImageEncoder* pEncoder)
 {
-    unsigned char* pCurr = &pThis->aux[sizeof(pThis->aux)-1];
-    size_t         i;
-    
-    for (i = 0 ; i < sizeof(pThis->aux) ; i++)
-        *pThis->pWrite++ = nibbilizeByte(pThis, *pCurr--);
-    
+    memcpy(pEncoder->pWrite, "\xD5\x9D", 2);
+    pEncoder->pWrite += 2;
 }
 
-static unsigned char nibbilizeByte(NibbleDiskImage* pThis, unsigned char byte)
+static void writeRW18AddressFieldEpilog(NibbleDiskImageEncoder* pEncoder)
 {
-    unsigned char encodedByte;
-    
-    encodedByte = byte ^ pThis->lastByte;
-    pThis->lastByte = byte;
-
-    return encode6to8(encodedByte);
+    *pEncoder->pWrite++ = 0xAA;
 }
 
-static void checksumNibbilizeAndWriteDataBuffer(NibbleDiskImage* pThis, const unsigned char* pData)
+static void writeRW18DataField(NibbleDiskImageEncoder* pEncoder, unsigned int side, unsigned char sector)
 {
-    const unsigned char* pCurr = pData;
-    size_t         i;
-    
-    for (i = 0 ; i < DISK_IMAGE_BYTES_PER_SECTOR ; i++)
-        *pThis->pWrite++ = nibbilizeByte(pThis, (*pCurr++) >> 2);
-    
+    writeRW18BundleId(pEncoder, side);
+    writeRW18Data(pEncoder, sector);
+    writeRW18DataFieldEpilog(pEncoder);
 }
 
-static void nibbilizeAndWriteChecksum(NibbleDiskImage* pThis)
+static void writeRW18BundleId(NibbleDiskImageEncoder* pEncoder, unsigned int side)
 {
-    *pThis->pWrite++ = nibbilizeByte(pThis, 0x00);
+    *pEncoder->pWrite++ = side;
 }
 
-static void insertRW18Data(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
+static void writeRW18Data(NibbleDiskImageEncoder* pEncoder, unsigned char sector)
 {
-    prepareForFirstRW18Track(pThis, pData, pInsert);
-    while (pThis->bytesLeft > 0)
-        writeRW18Track(pThis);
+    unsigned char        checksum = 0;
+    unsigned char*       pWrite = pEncoder->pWrite;
+    const unsigned char* pPage0 = pEncoder->pCurrentTrack + sector * DISK_IMAGE_PAGE_SIZE;
+    const unsigned char* pPage1 = pEncoder->pCurrentTrack + (sector + 6) * DISK_IMAGE_PAGE_SIZE;
+    const unsigned char* pPage2 = pEncoder->pCurrentTrack + (sector + 12) * DISK_IMAGE_PAGE_SIZE;
+    int                  i = 0;
+    
+    for ( i = 0 ; i < DISK_IMAGE_PAGE_SIZE ; i++)
+    {
+        unsigned char byte0 = *pPage0++;
+        unsigned char byte1 = *pPage1++;
+        unsigned char byte2 = *pPage2++;
+        unsigned char auxByte = ((byte0 & 0xC0) >> 2) | ((byte1 & 0xC0) >> 4) | ((byte2 & 0xC0) >> 6);
+        
+        byte0 &= 0x3F;
+        byte1 &= 0x3F;
+        byte2 &= 0x3F;
+        pWrite[0] = g_encode6to8[auxByte];
+        pWrite[1] = g_encode6to8[byte0];
+        pWrite[2] = g_encode6to8[byte1];
+        pWrite[3] = g_encode6to8[byte2];
+        pWrite += 4;
+        
+        checksum ^= auxByte ^ byte0 ^ byte1 ^ byte2;
+    }
+    *pWrite++ = g_encode6to8[checksum];
+    
+    pEncoder->pWrite = pWrite;
 }
 
-static void prepareForFirstRW18Track(NibbleDiskImage* pThis, const unsigned char* pData, DiskImageInsert* pInsert)
+static void writeRW18DataFieldEpilog(NibbleDiskImageEncoder* pEncoder)
 {
-    pThis->side = pInsert->side;
-    pThis->track = pInsert->track;
-    pThis->intraTrackOffset = pInsert->intraTrackOffset;
-    pThis->bytesLeft = pInsert->length;
-    pThis->pData = pData + pInsert->sourceOffset;
+    *pEncoder->pWrite++ = 0xD4;
 }
 
-static void writeRW18Track(NibbleDiskImage* pThis)
+static void writeRWTS16Sector(NibbleDiskImageEncoder* pEncoder, 
+                              unsigned char*          pTrackNibbles,
+                              unsigned int            track, 
+                              unsigned int            sector, 
+                              const unsigned char*    pSectorData)
 {
-    unsigned int         bytesUsed = 0;
-    unsigned int         destOffset = NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * pThis->track;
-    unsigned char        sector = 5;
-    unsigned char        trackData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
-    const unsigned char* pStart;
+    static const unsigned char   volume = 0;
+    unsigned int                 trackOffset = NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES +
+                                               NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR * sector;
+    const unsigned char*         pStart;
     
-    validateRW18TrackAndOffset(pThis);
-
-    bytesUsed = initTrackData(pThis, trackData, sizeof(trackData));
-    pThis->pWrite = DiskImage_GetImagePointer(&pThis->super) + destOffset;
-    pThis->pCurrentTrack = trackData;
-    pStart = pThis->pWrite;
+    pEncoder->pWrite = pTrackNibbles + trackOffset;
+    pStart = pEncoder->pWrite;
     
-    writeSyncBytes(pThis, 403);
-    writeEncodedBytes(pThis, "\xa5\x96\xbf\xff\xfe\xaa\xbb\xaa\xaa\xff\xef\x9a", 12);
-    writeRW18Sector(pThis, sector);
+    writeSectorLeadInSyncBytes(pEncoder, sector);
+    writeRWTS16AddressField(pEncoder, volume, track, sector);
+    writeSyncBytes(pEncoder, NIBBLE_DISK_IMAGE_RWTS16_GAP2_SYNC_BYTES);
+    writeRWTS16DataField(pEncoder, pSectorData);
     
-    do
-    {
-        writeSyncBytes(pThis, 5);
-        writeRW18Sector(pThis, --sector);
-    } while (sector);
+    assert ( pEncoder->pWrite - pStart == NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR - NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES);
+}
 
-    assert ( pThis->pWrite - pStart == NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK );
+static void writeSectorLeadInSyncBytes(NibbleDiskImageEncoder* pEncoder, unsigned int sector)
+{
+    size_t leadInSyncByteCount;
+    
+    if (sector == 0)
+        leadInSyncByteCount = NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES;
+    else
+        leadInSyncByteCount = NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES;
+    pEncoder->pWrite -= leadInSyncByteCount;
     
-    advanceToNextRW18Track(pThis, bytesUsed);
+    writeSyncBytes(pEncoder, leadInSyncByteCount);
 }
 
-static void validateRW18TrackAndOffset(NibbleDiskImage* pThis)
+static void writeSyncBytes(NibbleDiskImageEncoder* pEncoder, size_t syncByteCount)
 {
-    if (pThis->track >= DISK_IMAGE_TRACKS_PER_SIDE)
-        __throw(invalidTrackException);
-    if (pThis->intraTrackOffset >= DISK_IMAGE_RW18_BYTES_PER_TRACK)
-        __throw(invalidIntraTrackOffsetException);
+    memset(pEncoder->pWrite, 0xff, syncByteCount);
+    pEncoder->pWrite += syncByteCount;
 }
 
-static unsigned int initTrackData(NibbleDiskImage* pThis, unsigned char* pTrackData, size_t trackDataSize)
+static void writeRWTS16AddressField(NibbleDiskImageEncoder* pEncoder, unsigned char volume, unsigned char track, unsigned char sector)
 {
-    unsigned int         copyBytes = trackDataSize - pThis->intraTrackOffset;
-    const unsigned char* pSource = pThis->pData;
-    unsigned char*       pDest = pTrackData + pThis->intraTrackOffset;
+    writeRWTS16AddressFieldProlog(pEncoder);
     
-    readCurrentTrackContentsOrZeroFill(pThis, pTrackData, trackDataSize);
-    if (copyBytes > pThis->bytesLeft)
-        copyBytes = pThis->bytesLeft;
-    memcpy(pDest, pSource, copyBytes);
+    initChecksum(pEncoder);
+    write4and4Data(pEncoder, volume);
+    write4and4Data(pEncoder, track);
+    write4and4Data(pEncoder, sector);
+    write4and4Data(pEncoder, pEncoder->checksum);
     
-    return copyBytes;
+    writeRWTS16FieldEpilog(pEncoder);
 }
 
-static void readCurrentTrackContentsOrZeroFill(NibbleDiskImage* pThis, unsigned char* pTrackData, size_t trackDataSize)
+static void writeRWTS16AddressFieldProlog(NibbleDiskImageEncoder* pEncoder)
 {
-    __try
-    {
-        NibbleDiskImage_ReadRW18Track(pThis, pThis->side, pThis->track, pTrackData, trackDataSize);
-    }
-    __catch
-    {
-        /* Track didn't already contain RW18 data so initialize it to all zeroes. */
-        memset(pTrackData, 0x00, trackDataSize);
-        clearExceptionCode();
-    }
+    memcpy(pEncoder->pWrite, "\xD5\xAA\x96", 3);
+    pEncoder->pWrite += 3;
 }
 
-static void writeEncodedBytes(NibbleDiskImage* pThis, const char* pBytes, size_t byteCount)
+static void initChecksum(NibbleDiskImageEncoder* pEncoder)
 {
-    memcpy(pThis->pWrite, pBytes, byteCount);
-    pThis->pWrite += byteCount;
+    pEncoder->checksum = 0;
 }
 
-static void writeRW18Sector(NibbleDiskImage* pThis, unsigned char sector)
+static void write4and4Data(NibbleDiskImageEncoder* pEncoder, unsigned char byte)
 {
-    writeRW18AddressField(pThis, pThis->track, sector);
-    writeSyncBytes(pThis, 2);
-    writeRW18DataField(pThis, sector);
-    writeSyncBytes(pThis, 1);
+    char oddBits = byte & 0xAA;
+    char evenBits = byte & 0x55;
+    char encodedOddByte = 0xAA | (oddBits >> 1);
+    char encodedEvenByte = 0xAA | evenBits;
+    
+    updateChecksum(pEncoder, byte);
+    *pEncoder->pWrite++ = encodedOddByte;
+    *pEncoder->pWrite++ = encodedEvenByte;
 }
 
-static void writeRW18AddressField(NibbleDiskImage* pThis, unsigned char track, unsigned char sector)
+static void updateChecksum(NibbleDiskImageEncoder* pEncoder, unsigned char byte)
 {
-    writeRW18AddressFieldProlog(pThis);
-    
-    *pThis->pWrite++ = encode6to8(track);
-    *pThis->pWrite++ = encode6to8(sector);
-    *pThis->pWrite++ = encode6to8(track ^ sector);
-    
-    writeRW18AddressFieldEpilog(pThis);
+    pEncoder->checksum ^= byte;
 }
 
-static void writeRW18AddressFieldProlog(NibbleDiskImage* pThis)
+static void writeRWTS16FieldEpilog(NibbleDiskImageEncoder* pEncoder)
 {
-    memcpy(pThis->pWrite, "\xD5\x9D", 2);
-    pThis->pWrite += 2;
+    memcpy(pEncoder->pWrite, "\xDE\xAA\xEB", 3);
+    pEncoder->pWrite += 3;
 }
 
-static void writeRW18AddressFieldEpilog(NibbleDiskImage* pThis)
+static void writeRWTS16DataField(NibbleDiskImageEncoder* pEncoder, const unsigned char* pData)
 {
-    *pThis->pWrite++ = 0xAA;
+    writeRWTS16DataFieldProlog(pEncoder);
+    write6and2Data(pEncoder, pData);
+    writeRWTS16FieldEpilog(pEncoder);
 }
 
-static void writeRW18DataField(NibbleDiskImage* pThis, unsigned char sector)
+static void writeRWTS16DataFieldProlog(NibbleDiskImageEncoder* pEncoder)
 {
-    writeRW18BundleId(pThis);
-    writeRW18Data(pThis, sector);
-    writeRW18DataFieldEpilog(pThis);
+    memcpy(pEncoder->pWrite, "\xD5\xAA\xAD", 3);
+    pEncoder->pWrite += 3;
 }
 
-static void writeRW18BundleId(NibbleDiskImage* pThis)
+static void write6and2Data(NibbleDiskImageEncoder* pEncoder, const unsigned char* pData)
 {
-    *pThis->pWrite++ = pThis->side;
+    fillAuxBuffer(pEncoder, pData);
+    checksumNibbilizeAndWrite(pEncoder, pData);
 }
 
-static void writeRW18Data(NibbleDiskImage* pThis, unsigned char sector)
+static void fillAuxBuffer(NibbleDiskImageEncoder* pEncoder, const unsigned char* pData)
 {
-    unsigned char        checksum = 0;
-    const unsigned char* pPage0 = pThis->pCurrentTrack + sector * DISK_IMAGE_PAGE_SIZE;
-    const unsigned char* pPage1 = pThis->pCurrentTrack + (sector + 6) * DISK_IMAGE_PAGE_SIZE;
-    const unsigned char* pPage2 = pThis->pCurrentTrack + (sector + 12) * DISK_IMAGE_PAGE_SIZE;
-    int                  i = 0;
+    size_t i;
     
-    for ( i = 0 ; i < DISK_IMAGE_PAGE_SIZE ; i++)
+    /* Aux byte i holds the low bits of data bytes 0x55-i, 0xAB-i, and 0x101-i (wrapping around the sector). */
+    for (i = 0; i < sizeof(pEncoder->aux) ; i++)
     {
-        unsigned char byte0 = *pPage0++;
-        unsigned char byte1 = *pPage1++;
-        unsigned char byte2 = *pPage2++;
-        unsigned char auxByte = ((byte0 & 0xC0) >> 2) | ((byte1 & 0xC0) >> 4) | ((byte2 & 0xC0) >> 6);
-        
-        *pThis->pWrite++ = encode6to8(auxByte);
-        *pThis->pWrite++ = encode6to8(byte0 & 0x3F);
-        *pThis->pWrite++ = encode6to8(byte1 & 0x3F);
-        *pThis->pWrite++ = encode6to8(byte2 & 0x3F);
-        
-        checksum ^= auxByte;
-        checksum ^= byte0 & 0x3F;
-        checksum ^= byte1 & 0x3F;
-        checksum ^= byte2 & 0x3F;
+        pEncoder->aux[i] = g_swappedLowBits[pData[(unsigned char)(0x55 - i)] & 3] |
+                           (g_swappedLowBits[pData[(unsigned char)(0xAB - i)] & 3] << 2) |
+                           (g_swappedLowBits[pData[(unsigned char)(0x101 - i)] & 3] << 4);
     }
-    *pThis->pWrite++ = encode6to8(checksum);
 }
 
-static void writeRW18DataFieldEpilog(NibbleDiskImage* pThis)
+static void checksumNibbilizeAndWrite(NibbleDiskImageEncoder* pEncoder, const unsigned char* pData)
 {
-    *pThis->pWrite++ = 0xD4;
-}
-
-static void advanceToNextRW18Track(NibbleDiskImage* pThis, unsigned int bytesUsed)
-{
-    pThis->bytesLeft -= bytesUsed;
-    pThis->pData += bytesUsed;
-    pThis->intraTrackOffset = 0;
-    pThis->track++;
+    unsigned char* pWrite = pEncoder->pWrite;
+    unsigned char  lastByte = 0;
+    size_t         i;
+    
+    /* Each 6-bit value is XORed with the one before it, so the trailing nibble of the running value is the checksum. */
+    for (i = sizeof(pEncoder->aux) ; i-- > 0 ; )
+    {
+        *pWrite++ = g_encode6to8[pEncoder->aux[i] ^ lastByte];
+        lastByte = pEncoder->aux[i];
+    }
+    for (i = 0 ; i < DISK_IMAGE_BYTES_PER_SECTOR ; i++)
+    {
+        unsigned char byte = pData[i] >> 2;
+        
+        *pWrite++ = g_encode6to8[byte ^ lastByte];
+        lastByte = byte;
+    }
+    *pWrite++ = g_encode6to8[lastByte];
+    
+    pEncoder->pWrite = pWrite;
 }
 
-
 __throws void NibbleDiskImage_WriteImage(NibbleDiskImage* pThis, const char* pImageFilename)
 {
     DiskImage_WriteImage(&pThis->super, pImageFilename);
@@ -626,34 +784,46 @@ size_t NibbleDiskImage_GetImageSize(NibbleDiskImage* pThis)
 
 
 static void validateReadRWTrackArguments(unsigned int track, size_t trackDataSize);
-static void validateSyncBytes(NibbleDiskImage* pThis, unsigned int expectedSyncBytes);
-static void validateByte(NibbleDiskImage* pThis, unsigned char expectedByte);
-static void validateBytes(NibbleDiskImage* pThis, const char* pExpectedBytes, size_t byteCount);
-static void extractRW18Sector(NibbleDiskImage* pThis, unsigned int sector);
-static void validateDecodedByte(NibbleDiskImage* pThis, unsigned char expectedByte);
+static void validateSyncBytes(NibbleDiskImageReader* pReader, unsigned int expectedSyncBytes);
+static void validateByte(NibbleDiskImageReader* pReader, unsigned char expectedByte);
+static void validateBytes(NibbleDiskImageReader* pReader, const char* pExpectedBytes, size_t byteCount);
+static void extractRW18Sector(NibbleDiskImageReader* pReader, unsigned int sector);
+static void validateDecodedByte(NibbleDiskImageReader* pReader, unsigned char expectedByte);
 __throws void NibbleDiskImage_ReadRW18Track(NibbleDiskImage* pThis,
                                             unsigned int side,
                                             unsigned int track,
                                             unsigned char* pTrackData,
                                             size_t trackDataSize)
 {
-    unsigned int sector = 5;
+    readRW18Track(pThis, side, track, pTrackData, trackDataSize, &pThis->super.stats);
+}
+
+static void readRW18Track(NibbleDiskImage* pThis,
+                          unsigned int     side,
+                          unsigned int     track,
+                          unsigned char*   pTrackData,
+                          size_t           trackDataSize,
+                          DiskImageStats*  pStats)
+{
+    NibbleDiskImageReader reader;
+    unsigned int          sector = 5;
     
     validateReadRWTrackArguments(track, trackDataSize);
+    flushTrack(pThis, track, pStats);
     
-    pThis->pRead = DiskImage_GetImagePointer(&pThis->super) +  NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * track;
-    pThis->pCurrentTrack = pTrackData;
-    pThis->track = track;
-    pThis->side = side;
-
-    validateSyncBytes(pThis, 403);
-    validateBytes(pThis, "\xa5\x96\xbf\xff\xfe\xaa\xbb\xaa\xaa\xff\xef\x9a", 12);
-    extractRW18Sector(pThis, sector);
+    reader.pRead = pThis->super.image.pBuffer +  NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * track;
+    reader.pTrackData = pTrackData;
+    reader.track = track;
+    reader.side = side;
+
+    validateSyncBytes(&reader, 403);
+    validateBytes(&reader, "\xa5\x96\xbf\xff\xfe\xaa\xbb\xaa\xaa\xff\xef\x9a", 12);
+    extractRW18Sector(&reader, sector);
     
     do
     {
-        validateSyncBytes(pThis, 5);
-        extractRW18Sector(pThis, --sector);
+        validateSyncBytes(&reader, 5);
+        extractRW18Sector(&reader, --sector);
     } while (sector > 0);
 }
 
@@ -665,50 +835,50 @@ static void validateReadRWTrackArguments(unsigned int track, size_t trackDataSiz
         __throw(invalidArgumentException);
 }
 
-static void validateSyncBytes(NibbleDiskImage* pThis, unsigned int expectedSyncBytes)
+static void validateSyncBytes(NibbleDiskImageReader* pReader, unsigned int expectedSyncBytes)
 {
     unsigned int i;
     
     for (i = 0 ; i < expectedSyncBytes ; i++)
-        validateByte(pThis, 0xFF);
+        validateByte(pReader, 0xFF);
 }
 
-static void validateByte(NibbleDiskImage* pThis, unsigned char expectedByte)
+static void validateByte(NibbleDiskImageReader* pReader, unsigned char expectedByte)
 {
-    if (*pThis->pRead++ != expectedByte)
+    if (*pReader->pRead++ != expectedByte)
         __throw(badTrackException);
 }
 
-static void validateBytes(NibbleDiskImage* pThis, const char* pExpectedBytes, size_t byteCount)
+static void validateBytes(NibbleDiskImageReader* pReader, const char* pExpectedBytes, size_t byteCount)
 {
-    if (0 != memcmp(pThis->pRead, pExpectedBytes, byteCount))
+    if (0 != memcmp(pReader->pRead, pExpectedBytes, byteCount))
         __throw(badTrackException);
-    pThis->pRead += byteCount;
+    pReader->pRead += byteCount;
 }
 
-static void extractRW18Sector(NibbleDiskImage* pThis, unsigned int sector)
+static void extractRW18Sector(NibbleDiskImageReader* pReader, unsigned int sector)
 {
-    unsigned char  checksum = pThis->track ^ sector;
-    unsigned char* pPage0 = pThis->pCurrentTrack + sector * DISK_IMAGE_PAGE_SIZE;
-    unsigned char* pPage1 = pThis->pCurrentTrack + (sector + 6) * DISK_IMAGE_PAGE_SIZE;
-    unsigned char* pPage2 = pThis->pCurrentTrack + (sector + 12) * DISK_IMAGE_PAGE_SIZE;
+    unsigned char  checksum = pReader->track ^ sector;
+    unsigned char* pPage0 = pReader->pTrackData + sector * DISK_IMAGE_PAGE_SIZE;
+    unsigned char* pPage1 = pReader->pTrackData + (sector + 6) * DISK_IMAGE_PAGE_SIZE;
+    unsigned char* pPage2 = pReader->pTrackData + (sector + 12) * DISK_IMAGE_PAGE_SIZE;
     int            i;
     
-    validateBytes(pThis, "\xd5\x9d", 2);
-    validateDecodedByte(pThis, pThis->track);
-    validateDecodedByte(pThis, sector);
-    validateDecodedByte(pThis, checksum);
-    validateBytes(pThis, "\xaa", 1);
-    validateSyncBytes(pThis, 2);
-    validateByte(pThis, pThis->side);
+    validateBytes(pReader, "\xd5\x9d", 2);
+    validateDecodedByte(pReader, pReader->track);
+    validateDecodedByte(pReader, sector);
+    validateDecodedByte(pReader, checksum);
+    validateBytes(pReader, "\xaa", 1);
+    validateSyncBytes(pReader, 2);
+    validateByte(pReader, pReader->side);
     
     checksum = 0;
     for (i = 0 ; i < 256 ; i++)
     {
-        unsigned char auxByte = pThis->decode8to6[*pThis->pRead++];
-        unsigned char byte0 = pThis->decode8to6[*pThis->pRead++];
-        unsigned char byte1 = pThis->decode8to6[*pThis->pRead++];
-        unsigned char byte2 = pThis->decode8to6[*pThis->pRead++];
+        unsigned char auxByte = g_decode8to6[*pReader->pRead++];
+        unsigned char byte0 = g_decode8to6[*pReader->pRead++];
+        unsigned char byte1 = g_decode8to6[*pReader->pRead++];
+        unsigned char byte2 = g_decode8to6[*pReader->pRead++];
         
         checksum ^= (auxByte ^ byte0 ^ byte1 ^ byte2);
         
@@ -719,15 +889,302 @@ static void extractRW18Sector(NibbleDiskImage* pThis, unsigned int sector)
         auxByte <<= 2;
         *pPage2++ = (auxByte & 0xC0) | byte2;
     }
-    validateDecodedByte(pThis, checksum);
+    validateDecodedByte(pReader, checksum);
     
-    validateByte(pThis, 0xD4);
-    validateSyncBytes(pThis, 1);
+    validateByte(pReader, 0xD4);
+    validateSyncBytes(pReader, 1);
 }
 
-static void validateDecodedByte(NibbleDiskImage* pThis, unsigned char expectedByte)
+static void validateDecodedByte(NibbleDiskImageReader* pReader, unsigned char expectedByte)
 {
-    unsigned char decodedByte = pThis->decode8to6[*pThis->pRead++];
+    unsigned char decodedByte = g_decode8to6[*pReader->pRead++];
     if (decodedByte != expectedByte)
         __throw(badTrackException);
 }
+
+
+/* Scratch state used while decoding a single track.  pRead is where the search for the next address field resumes. */
+typedef struct NibbleDiskImageDecoder
+{
+    const unsigned char*        pTrackNibbles;
+    const unsigned char*        pRead;
+    const unsigned char*        pEnd;
+    unsigned char*              pTrackData;
+    NibbleDiskImageTrackStatus* pStatus;
+    unsigned int                track;
+} NibbleDiskImageDecoder;
+
+static const unsigned char* findNextProlog(NibbleDiskImageDecoder* pDecoder);
+static void decodeRWTS16Sector(NibbleDiskImageDecoder* pDecoder, const unsigned char* pAddressField);
+static void decodeRW18Sector(NibbleDiskImageDecoder* pDecoder, const unsigned char* pAddressField);
+static int  isTrackFormat(NibbleDiskImageDecoder* pDecoder, NibbleDiskImageTrackFormat format);
+static int  isTrackBlank(const unsigned char* pTrackNibbles);
+void NibbleDiskImage_DecodeTrack(const unsigned char*        pTrackNibbles,
+                                 unsigned int                track,
+                                 unsigned char*              pTrackData,
+                                 NibbleDiskImageTrackStatus* pStatus)
+{
+    /* Address fields are found by scanning for their prologs rather than by assuming the layout used by the encoder so
+       that the sectors which are left can still be decoded from a track which has been damaged or partially
+       overwritten.  RWTS16 sector n is decoded to page n of pTrackData and RW18 tracks fill all 18 pages.  Nothing
+       here throws so tracks can be decoded concurrently. */
+    NibbleDiskImageDecoder decoder;
+    const unsigned char*   pProlog;
+    
+    memset(pTrackData, 0, DISK_IMAGE_RW18_BYTES_PER_TRACK);
+    memset(pStatus, 0, sizeof(*pStatus));
+    decoder.pTrackNibbles = pTrackNibbles;
+    decoder.pRead = pTrackNibbles;
+    decoder.pEnd = pTrackNibbles + NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK;
+    decoder.pTrackData = pTrackData;
+    decoder.pStatus = pStatus;
+    decoder.track = track;
+    
+    while ((pProlog = findNextProlog(&decoder)) != NULL)
+    {
+        if (pProlog[1] == 0xAA && pProlog[2] == 0x96)
+        {
+            if (isTrackFormat(&decoder, NIBBLE_TRACK_RWTS16))
+                decodeRWTS16Sector(&decoder, pProlog + 3);
+        }
+        else if (pProlog[1] == 0x9D)
+        {
+            if (isTrackFormat(&decoder, NIBBLE_TRACK_RW18))
+                decodeRW18Sector(&decoder, pProlog + 2);
+        }
+    }
+    
+    if (pStatus->format == NIBBLE_TRACK_EMPTY && !isTrackBlank(pTrackNibbles))
+        pStatus->format = NIBBLE_TRACK_UNKNOWN;
+}
+
+static const unsigned char* findNextProlog(NibbleDiskImageDecoder* pDecoder)
+{
+    const unsigned char* pProlog;
+    
+    if (pDecoder->pEnd - pDecoder->pRead < 3)
+        return NULL;
+    pProlog = memchr(pDecoder->pRead, 0xD5, pDecoder->pEnd - pDecoder->pRead - 2);
+    if (!pProlog)
+        return NULL;
+    pDecoder->pRead = pProlog + 1;
+    
+    return pProlog;
+}
+
+static int isTrackFormat(NibbleDiskImageDecoder* pDecoder, NibbleDiskImageTrackFormat format)
+{
+    /* The first address field found decides the format of the track. */
+    if (pDecoder->pStatus->format == NIBBLE_TRACK_EMPTY)
+        pDecoder->pStatus->format = format;
+    if (pDecoder->pStatus->format == format)
+        return TRUE;
+    
+    pDecoder->pStatus->badAddressFieldCount++;
+    return FALSE;
+}
+
+static unsigned char decode4and4(const unsigned char* pNibbles);
+static const unsigned char* findRWTS16DataField(NibbleDiskImageDecoder* pDecoder, const unsigned char* pStart);
+static int  decode6and2Data(const unsigned char* pNibbles, unsigned char* pSectorData);
+static void recordDecodedSector(NibbleDiskImageDecoder* pDecoder, 
+                                unsigned int            sector, 
+                                const unsigned char*    pProlog, 
+                                const unsigned char*    pEpilogEnd, 
+                                int                     isGood);
+static void decodeRWTS16Sector(NibbleDiskImageDecoder* pDecoder, const unsigned char* pAddressField)
+{
+    static const size_t  dataNibbles = 86 + DISK_IMAGE_BYTES_PER_SECTOR + 1;
+    unsigned char        track;
+    unsigned char        sector;
+    const unsigned char* pDataField;
+    unsigned char*       pSectorData;
+    int                  isGood;
+    
+    if (pDecoder->pEnd - pAddressField < 8 || 
+        (decode4and4(pAddressField) ^ decode4and4(pAddressField + 2) ^ 
+         decode4and4(pAddressField + 4)) != decode4and4(pAddressField + 6) ||
+        decode4and4(pAddressField + 4) >= NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK)
+    {
+        pDecoder->pStatus->badAddressFieldCount++;
+        return;
+    }
+    track = decode4and4(pAddressField + 2);
+    sector = decode4and4(pAddressField + 4);
+    pSectorData = pDecoder->pTrackData + sector * DISK_IMAGE_BYTES_PER_SECTOR;
+    
+    pDataField = findRWTS16DataField(pDecoder, pAddressField + 8);
+    isGood = pDataField && 
+             (size_t)(pDecoder->pEnd - pDataField) >= dataNibbles &&
+             track == pDecoder->track &&
+             decode6and2Data(pDataField, pSectorData);
+    if (isGood)
+        pDecoder->pRead = pDataField + dataNibbles;
+    else
+        memset(pSectorData, 0, DISK_IMAGE_BYTES_PER_SECTOR);
+    recordDecodedSector(pDecoder, sector, pAddressField - 3, pDecoder->pRead + 3, isGood);
+}
+
+static unsigned char decode4and4(const unsigned char* pNibbles)
+{
+    return ((pNibbles[0] << 1) | 0x01) & pNibbles[1];
+}
+
+static const unsigned char* findRWTS16DataField(NibbleDiskImageDecoder* pDecoder, const unsigned char* pStart)
+{
+    /* The data field prolog follows the address field epilog and gap 2, which are skipped without being checked. */
+    static const size_t  maxGap = 3 + NIBBLE_DISK_IMAGE_RWTS16_GAP2_SYNC_BYTES + 8;
+    const unsigned char* pLast = pStart + maxGap;
+    const unsigned char* pCurr;
+    
+    if (pLast > pDecoder->pEnd - 3)
+        pLast = pDecoder->pEnd - 3;
+    for (pCurr = pStart ; pCurr <= pLast ; pCurr++)
+    {
+        if (pCurr[0] == 0xD5 && pCurr[1] == 0xAA && pCurr[2] == 0xAD)
+            return pCurr + 3;
+    }
+    return NULL;
+}
+
+static int decode6and2Data(const unsigned char* pNibbles, unsigned char* pSectorData)
+{
+    /* The inverse of fillAuxBuffer() and checksumNibbilizeAndWrite().  Invalid nibbles are caught by a single check of
+       all the decoded values once the whole field has been read. */
+    unsigned char aux[86];
+    unsigned char invalidBits = 0;
+    unsigned char lastByte = 0;
+    unsigned char checksum;
+    size_t        i;
+    
+    for (i = sizeof(aux) ; i-- > 0 ; )
+    {
+        unsigned char value = g_decode8to6[*pNibbles++];
+        
+        invalidBits |= value;
+        lastByte ^= value;
+        aux[i] = lastByte;
+    }
+    for (i = 0 ; i < DISK_IMAGE_BYTES_PER_SECTOR ; i++)
+    {
+        unsigned char value = g_decode8to6[*pNibbles++];
+        
+        invalidBits |= value;
+        lastByte ^= value;
+        pSectorData[i] = lastByte << 2;
+    }
+    checksum = g_decode8to6[*pNibbles];
+    if ((invalidBits & 0xC0) || checksum != lastByte)
+        return FALSE;
+    
+    for (i = 0 ; i < sizeof(aux) ; i++)
+    {
+        pSectorData[(unsigned char)(0x55 - i)] |= g_swappedLowBits[aux[i] & 3];
+        pSectorData[(unsigned char)(0xAB - i)] |= g_swappedLowBits[(aux[i] >> 2) & 3];
+        pSectorData[(unsigned char)(0x101 - i)] |= g_swappedLowBits[(aux[i] >> 4) & 3];
+    }
+    return TRUE;
+}
+
+static void recordDecodedSector(NibbleDiskImageDecoder* pDecoder, 
+                                unsigned int            sector, 
+                                const unsigned char*    pProlog, 
+                                const unsigned char*    pEpilogEnd, 
+                                int                     isGood)
+{
+    NibbleDiskImageTrackStatus* pStatus = pDecoder->pStatus;
+    
+    if (pEpilogEnd > pDecoder->pEnd)
+        pEpilogEnd = pDecoder->pEnd;
+    if (isGood)
+    {
+        pStatus->goodSectors |= 1 << sector;
+        pStatus->sectorStarts[sector] = (unsigned short)(pProlog - pDecoder->pTrackNibbles);
+        pStatus->sectorEnds[sector] = (unsigned short)(pEpilogEnd - pDecoder->pTrackNibbles);
+    }
+    else
+    {
+        pStatus->badSectors |= 1 << sector;
+    }
+}
+
+static int decodeRW18Data(const unsigned char* pNibbles, unsigned char* pTrackData, unsigned int sector);
+static void decodeRW18Sector(NibbleDiskImageDecoder* pDecoder, const unsigned char* pAddressField)
+{
+    /* The address field is followed by its epilog, 2 sync bytes, the bundle id, the data, and the 0xD4 epilog. */
+    static const size_t fieldNibbles = 3 + 1 + 2 + 1 + 4 * DISK_IMAGE_PAGE_SIZE + 1 + 1;
+    unsigned char       track;
+    unsigned char       sector;
+    unsigned char       side;
+    int                 isGood;
+    
+    if ((size_t)(pDecoder->pEnd - pAddressField) < fieldNibbles)
+    {
+        pDecoder->pStatus->badAddressFieldCount++;
+        return;
+    }
+    track = g_decode8to6[pAddressField[0]];
+    sector = g_decode8to6[pAddressField[1]];
+    if (((track | sector) & 0xC0) || 
+        (track ^ sector) != g_decode8to6[pAddressField[2]] || 
+        sector >= DISK_IMAGE_RW18_PAGES_PER_TRACK / 3)
+    {
+        pDecoder->pStatus->badAddressFieldCount++;
+        return;
+    }
+    side = pAddressField[6];
+    if (!pDecoder->pStatus->goodSectors && !pDecoder->pStatus->badSectors)
+        pDecoder->pStatus->side = side;
+    
+    isGood = track == pDecoder->track &&
+             side == pDecoder->pStatus->side &&
+             pAddressField[fieldNibbles - 1] == 0xD4 &&
+             decodeRW18Data(pAddressField + 7, pDecoder->pTrackData, sector);
+    if (isGood)
+        pDecoder->pRead = pAddressField + fieldNibbles;
+    recordDecodedSector(pDecoder, sector, pAddressField - 2, pAddressField + fieldNibbles, isGood);
+}
+
+static int decodeRW18Data(const unsigned char* pNibbles, unsigned char* pTrackData, unsigned int sector)
+{
+    /* The inverse of writeRW18Data().  The pages are only written once the checksum has been verified so that a bad
+       sector leaves them zeroed. */
+    unsigned char pages[3][DISK_IMAGE_PAGE_SIZE];
+    unsigned char invalidBits = 0;
+    unsigned char checksum = 0;
+    int           i;
+    
+    for (i = 0 ; i < DISK_IMAGE_PAGE_SIZE ; i++)
+    {
+        unsigned char auxByte = g_decode8to6[pNibbles[0]];
+        unsigned char byte0 = g_decode8to6[pNibbles[1]];
+        unsigned char byte1 = g_decode8to6[pNibbles[2]];
+        unsigned char byte2 = g_decode8to6[pNibbles[3]];
+        
+        pNibbles += 4;
+        invalidBits |= auxByte | byte0 | byte1 | byte2;
+        checksum ^= auxByte ^ byte0 ^ byte1 ^ byte2;
+        pages[0][i] = ((auxByte << 2) & 0xC0) | byte0;
+        pages[1][i] = ((auxByte << 4) & 0xC0) | byte1;
+        pages[2][i] = ((auxByte << 6) & 0xC0) | byte2;
+    }
+    if ((invalidBits & 0xC0) || checksum != g_decode8to6[*pNibbles])
+        return FALSE;
+    
+    memcpy(pTrackData + sector * DISK_IMAGE_PAGE_SIZE, pages[0], DISK_IMAGE_PAGE_SIZE);
+    memcpy(pTrackData + (sector + 6) * DISK_IMAGE_PAGE_SIZE, pages[1], DISK_IMAGE_PAGE_SIZE);
+    memcpy(pTrackData + (sector + 12) * DISK_IMAGE_PAGE_SIZE, pages[2], DISK_IMAGE_PAGE_SIZE);
+    return TRUE;
+}
+
+static int isTrackBlank(const unsigned char* pTrackNibbles)
+{
+    size_t i;
+    
+    for (i = 0 ; i < NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK ; i++)
+    {
+        if (pTrackNibbles[i] != 0x00)
+            return FALSE;
+    }
+    return TRUE;
+}
@@ -13,15 +13,22 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // Include headers from C modules under test.
 extern "C"
 {
     #include "BlockDiskImage.h"
     #include "BinaryBuffer.h"
+    #include "DiskImageCompress.h"
+    #include "DiskImageDelta.h"
+    #include "ObjectBundle.h"
+    #include "MemoryVfs.h"
     #include "MallocFailureInject.h"
     #include "FileFailureInject.h"
     #include "printfSpy.h"
+    #include "ThreadPool.h"
     #include "util.h"
 }
 
@@ -34,6 +41,7 @@ static const char* g_savFilenameAllOnes = "BlockDiskImageTestOnes.sav";
 static const char* g_usrFilenameAllOnes = "BlockDiskImageTestOnes.usr";
 static const char* g_imgTableFilename = "BlockDiskImageTest.img";
 static const char* g_scriptFilename = "BlockDiskImageTest.script";
+static const char* g_bundleFilename = "BlockDiskImageTest.snb";
 
 
 TEST_GROUP(BlockDiskImage)
@@ -57,6 +65,7 @@ TEST_GROUP(BlockDiskImage)
         LONGS_EQUAL(noException, getExceptionCode());
         MallocFailureInject_Restore();
         printfSpy_Unhook();
+        ThreadPool_SetThreadCount(0);
         DiskImage_Free((DiskImage*)m_pDiskImage);
         if (m_pFile)
             fclose(m_pFile);
@@ -67,6 +76,7 @@ TEST_GROUP(BlockDiskImage)
         remove(g_usrFilenameAllOnes);
         remove(g_imgTableFilename);
         remove(g_scriptFilename);
+        remove(g_bundleFilename);
     }
     
     char* copy(const char* pStringToCopy)
@@ -352,6 +362,34 @@ TEST_GROUP(BlockDiskImage)
         fclose(pFile);
     }
 
+    void createSavBundle(const char* pName, const unsigned char* pData, unsigned int dataSize, unsigned int paddedSize)
+    {
+        ObjectBundleHeader header;
+        ObjectBundleEntry  entry;
+        SavFileHeader      savHeader;
+        unsigned char      zero = 0;
+        
+        memcpy(header.signature, OBJECT_BUNDLE_SIGNATURE, sizeof(header.signature));
+        header.entryCount = 1;
+        memset(&entry, 0, sizeof(entry));
+        strcpy(entry.name, pName);
+        entry.offset = sizeof(header) + sizeof(entry);
+        entry.length = sizeof(savHeader) + dataSize;
+        entry.paddedLength = sizeof(savHeader) + paddedSize;
+        memcpy(savHeader.signature, BINARY_BUFFER_SAV_SIGNATURE, sizeof(savHeader.signature));
+        savHeader.address = 0;
+        savHeader.length = dataSize;
+        
+        FILE* pFile = fopen(g_bundleFilename, "wb");
+        fwrite(&header, 1, sizeof(header), pFile);
+        fwrite(&entry, 1, sizeof(entry), pFile);
+        fwrite(&savHeader, 1, sizeof(savHeader), pFile);
+        fwrite(pData, 1, dataSize, pFile);
+        for (unsigned int i = dataSize ; i < paddedSize ; i++)
+            fwrite(&zero, 1, 1, pFile);
+        fclose(pFile);
+    }
+    
     void createTextFile(const char* pFilename, const char* pText)
     {
         FILE* pFile = fopen(pFilename, "wb");
@@ -568,9 +606,9 @@ TEST(BlockDiskImage, FailFWriteInWriteImage)
 {
     m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
     writeOnesBlocks(0, 1);
-    fwriteFail(0);
+    writevFail(0);
         __try_and_catch( BlockDiskImage_WriteImage(m_pDiskImage, g_imageFilename) );
-    fwriteRestore();
+    writevRestore();
     validateFileExceptionThrown();
 }
 
@@ -607,10 +645,10 @@ TEST(BlockDiskImage, FailSecondHeaderReadInReadUSRObjectFile)
     m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
     createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_0, 0, 0, 0);
     
-    freadFail(0);
-    freadToFail(2);
+    readFail(-1);
+    readToFail(2);
         __try_and_catch( BlockDiskImage_ReadObjectFile(m_pDiskImage, g_usrFilenameAllOnes) );
-    freadRestore();
+    readRestore();
     validateFileExceptionThrown();
 }
 
@@ -626,9 +664,9 @@ TEST(BlockDiskImage, FailHeaderReadInReadObjectFile)
     m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
     createOnesBlockObjectFile();
     
-    freadFail(0);
+    readFail(-1);
         __try_and_catch( BlockDiskImage_ReadObjectFile(m_pDiskImage, g_savFilenameAllOnes) );
-    freadRestore();
+    readRestore();
     validateFileExceptionThrown();
 }
 
@@ -647,10 +685,10 @@ TEST(BlockDiskImage, FailDataReadInReadObjectFile)
     m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
     createOnesBlockObjectFile();
     
-    freadFail(0);
-    freadToFail(2);
+    readFail(-1);
+    readToFail(2);
         __try_and_catch( BlockDiskImage_ReadObjectFile(m_pDiskImage, g_savFilenameAllOnes) );
-    freadRestore();
+    readRestore();
     validateFileExceptionThrown();
 }
 
@@ -1058,7 +1096,7 @@ TEST(BlockDiskImage, PassTooFewBlockTokensToProcessScript)
     createOnesBlockObjectFile();
 
     BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,512" LINE_ENDING));
-    STRCMP_EQUAL("<null>:1: error: Line doesn't contain correct fields: BLOCK,objectFilename,objectStartOffset,insertionLength,block[,intraBlockOffset]" LINE_ENDING,
+    STRCMP_EQUAL("<null>:1: error: Line doesn't contain correct fields: BLOCK,objectFilename,objectStartOffset,insertionLength,block[,intraBlockOffset][,compress]" LINE_ENDING,
                  printfSpy_GetLastErrorOutput());
 }
 
@@ -1068,7 +1106,7 @@ TEST(BlockDiskImage, PassTooManyTokensToProcessScript)
     createOnesBlockObjectFile();
 
     BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,512,0,0,0" LINE_ENDING));
-    STRCMP_EQUAL("<null>:1: error: Line doesn't contain correct fields: BLOCK,objectFilename,objectStartOffset,insertionLength,block[,intraBlockOffset]" LINE_ENDING,
+    STRCMP_EQUAL("<null>:1: error: Line doesn't contain correct fields: BLOCK,objectFilename,objectStartOffset,insertionLength,block[,intraBlockOffset][,compress]" LINE_ENDING,
                  printfSpy_GetLastErrorOutput());
 }
 
@@ -1148,7 +1186,7 @@ TEST(BlockDiskImage, PassTooFewRW18TokensToProcessScript)
     createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17, 0);
 
     BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,BlockDiskImageTestOnes.usr,0,*,0xa9,0" LINE_ENDING));
-    STRCMP_EQUAL("<null>:1: error: Line doesn't contain correct fields: RW18,objectFilename,objectStartOffset,insertionLength,side,track,offset[,imageTableAddress]" LINE_ENDING,
+    STRCMP_EQUAL("<null>:1: error: Line doesn't contain correct fields: RW18,objectFilename,objectStartOffset,insertionLength,side,track,offset[,imageTableAddress][,compress]" LINE_ENDING,
                  printfSpy_GetLastErrorOutput());
 }
 
@@ -1158,7 +1196,7 @@ TEST(BlockDiskImage, PassTooManyRW18TokensToProcessScript)
     createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17, 0);
 
     BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,BlockDiskImageTestOnes.usr,0,*,0xa9,0,0,0,0" LINE_ENDING));
-    STRCMP_EQUAL("<null>:1: error: Line doesn't contain correct fields: RW18,objectFilename,objectStartOffset,insertionLength,side,track,offset[,imageTableAddress]" LINE_ENDING,
+    STRCMP_EQUAL("<null>:1: error: Line doesn't contain correct fields: RW18,objectFilename,objectStartOffset,insertionLength,side,track,offset[,imageTableAddress][,compress]" LINE_ENDING,
                  printfSpy_GetLastErrorOutput());
 }
 
@@ -1218,3 +1256,680 @@ TEST(BlockDiskImage, FailToAllocateTextFileInProcessScriptFile)
     __try_and_catch( BlockDiskImage_ProcessScriptFile(m_pDiskImage, g_scriptFilename) );
     validateOutOfMemoryExceptionThrown();
 }
+
+TEST(BlockDiskImage, ProcessScriptWithObjectFromBundle)
+{
+    unsigned char blockData[DISK_IMAGE_BLOCK_SIZE];
+    
+    memset(blockData, 0xff, sizeof(blockData));
+    createSavBundle("Ones.sav", blockData, sizeof(blockData), sizeof(blockData));
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_OpenBundle((DiskImage*)m_pDiskImage, g_bundleFilename);
+    
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,bundle:ones.sav,0,*,0" LINE_ENDING));
+    
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreOnes(pImage, 0, 0);
+    validateBlocksAreZeroes(pImage, 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
+TEST(BlockDiskImage, ProcessScriptWithUnpaddedObjectFromBundle)
+{
+    createSavBundle("Short.sav", (const unsigned char*)"\xff\xff", 2, 2);
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_OpenBundle((DiskImage*)m_pDiskImage, g_bundleFilename);
+    
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,bundle:Short.sav,0,512,0" LINE_ENDING));
+    
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    LONGS_EQUAL(0xff, pImage[0]);
+    LONGS_EQUAL(0xff, pImage[1]);
+    LONGS_EQUAL(0x00, pImage[2]);
+}
+
+TEST(BlockDiskImage, UpdateImageTableFromBundleLeavesBundleUnmodified)
+{
+    static const unsigned short newStartAddress = 0x9F00;
+    static const unsigned int   startBlock = 16;
+    static const unsigned char  imageTable[] = { 0x01, 0x05, 0x60, 0x05, 0x60 };
+    
+    createSavBundle("Table.img", imageTable, sizeof(imageTable), DISK_IMAGE_BLOCK_SIZE);
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_OpenBundle((DiskImage*)m_pDiskImage, g_bundleFilename);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,bundle:Table.img,0,*,0xa9,0,0,0x9F00" LINE_ENDING
+                                                    "BLOCK,bundle:Table.img,0,5,0" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateUpdatedImageTable(pImage, startBlock, newStartAddress, 1, 0);
+    CHECK(0 == memcmp(pImage, imageTable, sizeof(imageTable)));
+}
+
+TEST(BlockDiskImage, ReuseCachedObjectFileAfterItIsRemovedFromDisk)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesBlockObjectFile();
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,*,0" LINE_ENDING));
+    remove(g_savFilenameAllOnes);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,*,1599" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreOnes(pImage, 0, 0);
+    validateBlocksAreZeroes(pImage, 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 2);
+    validateBlocksAreOnes(pImage, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
+TEST(BlockDiskImage, CountScriptLinesWhichReportErrors)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesBlockObjectFile();
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,*,0" LINE_ENDING
+                                                    "BLOCK,BlockDiskImageTestMissing.sav,0,*,1" LINE_ENDING
+                                                    LINE_ENDING
+                                                    "BLOCK,BlockDiskImageTestOnes.sav,0,*,1600" LINE_ENDING));
+    LONGS_EQUAL(3, DiskImage_GetScriptErrorCount((DiskImage*)m_pDiskImage));
+}
+
+TEST(BlockDiskImage, ReadObjectsFromCacheDetachedFromAnotherImage)
+{
+    DiskImage*            pPrefetchImage = (DiskImage*)BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImageObjectCache* pObjectCache;
+
+    createOnesBlockObjectFile();
+    createTextFile(g_scriptFilename, "BLOCK,BlockDiskImageTestOnes.sav,0,*,1" LINE_ENDING);
+    DiskImage_PrefetchScriptObjects(pPrefetchImage, g_scriptFilename);
+    pObjectCache = DiskImage_DetachObjectCache(pPrefetchImage);
+    DiskImage_Free(pPrefetchImage);
+    remove(g_savFilenameAllOnes);
+
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_ShareObjectCache((DiskImage*)m_pDiskImage, pObjectCache);
+    BlockDiskImage_ProcessScriptFile(m_pDiskImage, g_scriptFilename);
+    DiskImageObjectCache_Free(pObjectCache);
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreZeroes(pImage, 0, 0);
+    validateBlocksAreOnes(pImage, 1, 1);
+    validateBlocksAreZeroes(pImage, 2, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
+TEST(BlockDiskImage, ReuseCachedUSRObjectFileHeaderDefaults)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17, 0);
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,BlockDiskImageTestOnes.usr,0,*,0xa9,0,0" LINE_ENDING));
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateRW18SectorsAreOnes(pImage, DISK_IMAGE_RW18_SIDE_0, 0, 0, DISK_IMAGE_RW18_SIDE_0, 0, 0);
+    validateRW18SectorsAreZeroes(pImage, DISK_IMAGE_RW18_SIDE_0, 0, 1, 
+                                         DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 16);
+    validateRW18SectorsAreOnes(pImage, DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17, 
+                                       DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17);
+}
+
+TEST(BlockDiskImage, UpdateImageTableLeavesCachedObjectFileUnmodified)
+{
+    static const unsigned short newStartAddress = 0x9F00;
+    static const unsigned int   startBlock = 16;
+    static const unsigned char  imageTable[] = { 0x01, 0x05, 0x60, 0x05, 0x60 };
+    
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createBlockRawObjectFile(g_imgTableFilename, imageTable, sizeof(imageTable));
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,BlockDiskImageTest.img,0,*,0xa9,0,0,0x9F00" LINE_ENDING
+                                                    "BLOCK,BlockDiskImageTest.img,0,5,0" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateUpdatedImageTable(pImage, startBlock, newStartAddress, 1, 0);
+    CHECK(0 == memcmp(pImage, imageTable, sizeof(imageTable)));
+}
+
+TEST(BlockDiskImage, FailedObjectFileReadIsNotCached)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    __try_and_catch( BlockDiskImage_ReadObjectFile(m_pDiskImage, g_savFilenameAllOnes) );
+    validateExceptionThrown(fileOpenException);
+    createOnesBlockObjectFile();
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,*,0" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreOnes(pImage, 0, 0);
+    validateBlocksAreZeroes(pImage, 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
+TEST(BlockDiskImage, ProcessScriptWhichPrefetchesObjectFilesConcurrently)
+{
+    static const unsigned short newStartAddress = 0x9F00;
+    static const unsigned int   startBlock = 16;
+    
+    ThreadPool_SetThreadCount(4);
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesBlockObjectFile();
+    createZeroesBlockObjectFile();
+    createOnesSectorUSRObjectFile(DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17, 0);
+    createBlockRawObjectFile(g_imgTableFilename, (const unsigned char*)"\x01\x05\x60\x05\x60", 5);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,*,0" LINE_ENDING
+                                                    "BLOCK,BlockDiskImageTestZeroes.sav,0,*,1" LINE_ENDING
+                                                    "RW18,BlockDiskImageTest.img,0,*,0xa9,0,0,0x9F00" LINE_ENDING
+                                                    "RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*" LINE_ENDING
+                                                    "BLOCK,BlockDiskImageTestOnes.sav,0,*,1599" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreOnes(pImage, 0, 0);
+    validateBlocksAreZeroes(pImage, 1, 1);
+    validateUpdatedImageTable(pImage, startBlock, newStartAddress, 1, 0);
+    validateRW18SectorsAreOnes(pImage, DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17, 
+                                       DISK_IMAGE_RW18_SIDE_2, DISK_IMAGE_TRACKS_PER_SIDE - 1, 17);
+    validateBlocksAreOnes(pImage, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+}
+
+TEST(BlockDiskImage, ReportPrefetchFailureAgainstScriptLineWhichReferencesObjectFile)
+{
+    ThreadPool_SetThreadCount(4);
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesBlockObjectFile();
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,*,0" LINE_ENDING
+                                                    "# Comment" LINE_ENDING
+                                                    "BLOCK,InvalidFilename.sav,0,*,1" LINE_ENDING
+                                                    "BLOCK,BlockDiskImageTestOnes.sav,0,*,2" LINE_ENDING));
+
+    STRCMP_EQUAL("<null>:3: error: Failed to open 'InvalidFilename.sav' object file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreOnes(pImage, 0, 0);
+    validateBlocksAreZeroes(pImage, 1, 1);
+    validateBlocksAreOnes(pImage, 2, 2);
+}
+
+TEST(BlockDiskImage, FailToFindObjectInBundle)
+{
+    unsigned char blockData[DISK_IMAGE_BLOCK_SIZE];
+    
+    memset(blockData, 0xff, sizeof(blockData));
+    createSavBundle("Ones.sav", blockData, sizeof(blockData), sizeof(blockData));
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_OpenBundle((DiskImage*)m_pDiskImage, g_bundleFilename);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,bundle:Zeroes.sav,0,512,0" LINE_ENDING));
+    STRCMP_EQUAL("<null>:1: error: Failed to open 'bundle:Zeroes.sav' object file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(BlockDiskImage, FailToReadBundleObjectWithNoBundleOpened)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    __try_and_catch( BlockDiskImage_ReadObjectFile(m_pDiskImage, "bundle:Ones.sav") );
+    validateExceptionThrown(fileOpenException);
+}
+
+TEST(BlockDiskImage, FailToOpenMissingBundle)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    __try_and_catch( DiskImage_OpenBundle((DiskImage*)m_pDiskImage, g_bundleFilename) );
+    validateExceptionThrown(fileOpenException);
+}
+
+TEST(BlockDiskImage, UpdateImageWithManifestOnlyRebuildsBlocksWhoseInsertionsChanged)
+{
+    static const char    script1[] = "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestZeroes.sav,0,512,*" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestOnes.sav,0,512,10" LINE_ENDING;
+    static const char    script2[] = "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestOnes.sav,0,512,*" LINE_ENDING
+                                     "BLOCK,BlockDiskImageTestOnes.sav,0,512,10" LINE_ENDING;
+    static const char    manifestFilename[] = "BlockDiskImageTest.manifest";
+    static const size_t  imageSize = 32 * DISK_IMAGE_BLOCK_SIZE;
+    unsigned char        blockData[DISK_IMAGE_BLOCK_SIZE];
+    MemoryVfs*           pVfs = MemoryVfs_Create();
+    DiskImage*           pDiskImage;
+    const unsigned char* pImageData;
+    size_t               dataSize = 0;
+
+    memset(blockData, 0x00, sizeof(blockData));
+    MemoryVfs_AddFile(pVfs, g_savFilenameAllZeroes, blockData, sizeof(blockData));
+    memset(blockData, 0xff, sizeof(blockData));
+    MemoryVfs_AddFile(pVfs, g_savFilenameAllOnes, blockData, sizeof(blockData));
+    MemoryVfs_AddFile(pVfs, g_scriptFilename, script1, sizeof(script1) - 1);
+    pDiskImage = (DiskImage*)BlockDiskImage_Create(32);
+    DiskImage_SetVfs(pDiskImage, (Vfs*)pVfs);
+    DiskImage_ReadManifest(pDiskImage, manifestFilename);
+    DiskImage_ProcessScriptFile(pDiskImage, g_scriptFilename);
+    DiskImage_GetImagePointer(pDiskImage)[0] = 0x00;
+    DiskImage_GetImagePointer(pDiskImage)[10 * DISK_IMAGE_BLOCK_SIZE] = 0x00;
+    DiskImage_WriteImage(pDiskImage, g_imageFilename);
+    DiskImage_WriteManifest(pDiskImage, manifestFilename);
+    DiskImage_Free(pDiskImage);
+
+    MemoryVfs_AddFile(pVfs, g_scriptFilename, script2, sizeof(script2) - 1);
+    m_pDiskImage = BlockDiskImage_Create(32);
+    pDiskImage = (DiskImage*)m_pDiskImage;
+    DiskImage_SetVfs(pDiskImage, (Vfs*)pVfs);
+    DiskImage_ReadManifest(pDiskImage, manifestFilename);
+    DiskImage_ReadImageForUpdate(pDiskImage, g_imageFilename);
+    DiskImage_ProcessScriptFile(pDiskImage, g_scriptFilename);
+    DiskImage_UpdateImage(pDiskImage, g_imageFilename);
+
+    // Blocks 0 and 10 weren't rebuilt so they still have their first byte cleared.
+    pImageData = (const unsigned char*)MemoryVfs_GetFileData(pVfs, g_imageFilename, &dataSize);
+    LONGS_EQUAL(imageSize, dataSize);
+    LONGS_EQUAL(0x00, pImageData[0]);
+    validateAllOnes(pImageData + 1, DISK_IMAGE_BLOCK_SIZE - 1);
+    validateAllOnes(pImageData + DISK_IMAGE_BLOCK_SIZE, DISK_IMAGE_BLOCK_SIZE);
+    LONGS_EQUAL(0x00, pImageData[10 * DISK_IMAGE_BLOCK_SIZE]);
+    validateAllOnes(pImageData + 10 * DISK_IMAGE_BLOCK_SIZE + 1, DISK_IMAGE_BLOCK_SIZE - 1);
+    CHECK(0 == memcmp(DiskImage_GetImagePointer(pDiskImage), pImageData, imageSize));
+    Vfs_Free((Vfs*)pVfs);
+}
+
+
+TEST(BlockDiskImage, MapOutputImageSoInsertsGoStraightToTheFile)
+{
+    unsigned char   blockData[DISK_IMAGE_BLOCK_SIZE];
+    DiskImageInsert insert;
+    unsigned char*  pHeapImage;
+    char            tempFilename[256];
+    
+    memset(blockData, 0xff, sizeof(blockData));
+    memset(&insert, 0, sizeof(insert));
+    insert.type = DISK_IMAGE_INSERTION_BLOCK;
+    insert.length = sizeof(blockData);
+    insert.block = 1;
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    pHeapImage = DiskImage_GetImagePointer((DiskImage*)m_pDiskImage);
+    DiskImage_MapOutputImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    CHECK(pHeapImage != DiskImage_GetImagePointer((DiskImage*)m_pDiskImage));
+    POINTERS_EQUAL(NULL, fopen(g_imageFilename, "rb"));
+    strcpy(tempFilename, DiskImage_GetMappedTempFilename((DiskImage*)m_pDiskImage));
+    
+    DiskImage_InsertData((DiskImage*)m_pDiskImage, blockData, &insert);
+    DiskImage_WriteImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    
+    POINTERS_EQUAL(NULL, DiskImage_GetMappedTempFilename((DiskImage*)m_pDiskImage));
+    POINTERS_EQUAL(NULL, fopen(tempFilename, "rb"));
+    m_pFile = fopen(g_imageFilename, "rb");
+    CHECK(m_pFile != NULL);
+    m_pImageOnDisk = (unsigned char*)malloc(BLOCK_DISK_IMAGE_3_5_DISK_SIZE);
+    CHECK(m_pImageOnDisk != NULL);
+    LONGS_EQUAL(BLOCK_DISK_IMAGE_3_5_DISK_SIZE, fread(m_pImageOnDisk, 1, BLOCK_DISK_IMAGE_3_5_DISK_SIZE + 1, m_pFile));
+    validateBlocksAreZeroes(m_pImageOnDisk, 0, 0);
+    validateBlocksAreOnes(m_pImageOnDisk, 1, 1);
+    validateBlocksAreZeroes(m_pImageOnDisk, 2, BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT - 1);
+    CHECK(0 == memcmp(m_pImageOnDisk, DiskImage_GetImagePointer((DiskImage*)m_pDiskImage), 
+                      BLOCK_DISK_IMAGE_3_5_DISK_SIZE));
+}
+
+TEST(BlockDiskImage, FreeMappedImageWhichWasNeverWrittenKeepsExistingOutputImage)
+{
+    char tempFilename[256];
+    
+    m_pFile = fopen(g_imageFilename, "wb");
+    fwrite("old", 1, 3, m_pFile);
+    fclose(m_pFile);
+    m_pFile = NULL;
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_MapOutputImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    strcpy(tempFilename, DiskImage_GetMappedTempFilename((DiskImage*)m_pDiskImage));
+    m_pFile = fopen(tempFilename, "rb");
+    CHECK(m_pFile != NULL);
+    fclose(m_pFile);
+    
+    DiskImage_Free((DiskImage*)m_pDiskImage);
+    m_pDiskImage = NULL;
+    
+    m_pFile = fopen(tempFilename, "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+    m_pFile = fopen(g_imageFilename, "rb");
+    CHECK(m_pFile != NULL);
+    LONGS_EQUAL(3, fread(m_buffer, 1, sizeof(m_buffer), m_pFile));
+}
+
+TEST(BlockDiskImage, TwoImagesMappingTheSameOutputImageUseTheirOwnTempFiles)
+{
+    BlockDiskImage* pOtherDiskImage = NULL;
+    char            tempFilename[256];
+    
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    pOtherDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_MapOutputImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    DiskImage_MapOutputImage((DiskImage*)pOtherDiskImage, g_imageFilename);
+    strcpy(tempFilename, DiskImage_GetMappedTempFilename((DiskImage*)m_pDiskImage));
+    CHECK(0 != strcmp(tempFilename, DiskImage_GetMappedTempFilename((DiskImage*)pOtherDiskImage)));
+    
+    DiskImage_WriteImage((DiskImage*)pOtherDiskImage, g_imageFilename);
+    m_pFile = fopen(tempFilename, "rb");
+    CHECK(m_pFile != NULL);
+    fclose(m_pFile);
+    m_pFile = NULL;
+    DiskImage_WriteImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    POINTERS_EQUAL(NULL, fopen(tempFilename, "rb"));
+    DiskImage_Free((DiskImage*)pOtherDiskImage);
+}
+
+TEST(BlockDiskImage, MappedTempFileIsNextToOutputImage)
+{
+    const char* pTempFilename;
+    size_t      imageFilenameLength = strlen(g_imageFilename);
+    
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    POINTERS_EQUAL(NULL, DiskImage_GetMappedTempFilename((DiskImage*)m_pDiskImage));
+    DiskImage_MapOutputImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    pTempFilename = DiskImage_GetMappedTempFilename((DiskImage*)m_pDiskImage);
+    CHECK(0 == strncmp(pTempFilename, g_imageFilename, imageFilenameLength));
+    LONGS_EQUAL('.', pTempFilename[imageFilenameLength]);
+    CHECK(0 == strchr(pTempFilename + imageFilenameLength, '/'));
+}
+
+TEST(BlockDiskImage, WriteMappedImageKeepsPermissionsOfExistingOutputImage)
+{
+    struct stat imageStat;
+    
+    m_pFile = fopen(g_imageFilename, "wb");
+    fclose(m_pFile);
+    m_pFile = NULL;
+    LONGS_EQUAL(0, chmod(g_imageFilename, 0640));
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_MapOutputImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    DiskImage_WriteImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    LONGS_EQUAL(0, stat(g_imageFilename, &imageStat));
+    LONGS_EQUAL(0640, imageStat.st_mode & 07777);
+}
+
+TEST(BlockDiskImage, WriteNewMappedImageUsesDefaultPermissions)
+{
+    struct stat imageStat;
+    mode_t      mask = umask(0);
+    
+    umask(mask);
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_MapOutputImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    DiskImage_WriteImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    LONGS_EQUAL(0, stat(g_imageFilename, &imageStat));
+    LONGS_EQUAL(0666 & ~mask, imageStat.st_mode & 07777);
+}
+
+TEST(BlockDiskImage, WriteMappedImageToAnotherFileCopiesIt)
+{
+    static const char otherFilename[] = "BlockDiskImageTestOther.hdv";
+    
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_MapOutputImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    DiskImage_WriteImage((DiskImage*)m_pDiskImage, otherFilename);
+    
+    m_pFile = fopen(otherFilename, "rb");
+    CHECK(m_pFile != NULL);
+    fclose(m_pFile);
+    m_pFile = NULL;
+    remove(otherFilename);
+}
+
+TEST(BlockDiskImage, MapOutputImageIsIgnoredForMemoryVfs)
+{
+    MemoryVfs*     pVfs = MemoryVfs_Create();
+    unsigned char* pHeapImage;
+    size_t         imageSize = 0;
+    
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_SetVfs((DiskImage*)m_pDiskImage, (Vfs*)pVfs);
+    pHeapImage = DiskImage_GetImagePointer((DiskImage*)m_pDiskImage);
+    DiskImage_MapOutputImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    POINTERS_EQUAL(pHeapImage, DiskImage_GetImagePointer((DiskImage*)m_pDiskImage));
+    DiskImage_WriteImage((DiskImage*)m_pDiskImage, g_imageFilename);
+    CHECK(MemoryVfs_GetFileData(pVfs, g_imageFilename, &imageSize) != NULL);
+    LONGS_EQUAL(BLOCK_DISK_IMAGE_3_5_DISK_SIZE, imageSize);
+    Vfs_Free((Vfs*)pVfs);
+}
+
+TEST(BlockDiskImage, FailToMapOutputImageInMissingDirectory)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    __try_and_catch( DiskImage_MapOutputImage((DiskImage*)m_pDiskImage, "missing_directory/BlockDiskImageTest.hdv") );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(BlockDiskImage, FailAllocationsWhileMappingOutputImage)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    for (int allocationToFail = 1 ; allocationToFail <= 2 ; allocationToFail++)
+    {
+        MallocFailureInject_FailAllocation(allocationToFail);
+        __try_and_catch( DiskImage_MapOutputImage((DiskImage*)m_pDiskImage, g_imageFilename) );
+        MallocFailureInject_Restore();
+        LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+        clearExceptionCode();
+    }
+}
+
+TEST(BlockDiskImage, WriteDeltaFromPreviousImage)
+{
+    static const char    deltaFilename[] = "BlockDiskImageTest.delta";
+    unsigned char        blockData[DISK_IMAGE_BLOCK_SIZE];
+    MemoryVfs*           pVfs = MemoryVfs_Create();
+    DiskImageInsert      insert;
+    DiskImageDelta       delta;
+    unsigned char        previousImage[32 * DISK_IMAGE_BLOCK_SIZE];
+
+    memset(previousImage, 0, sizeof(previousImage));
+    previousImage[5 * DISK_IMAGE_BLOCK_SIZE] = 0x42;
+    MemoryVfs_AddFile(pVfs, g_imageFilename, previousImage, sizeof(previousImage));
+    memset(blockData, 0xff, sizeof(blockData));
+    memset(&insert, 0, sizeof(insert));
+    insert.type = DISK_IMAGE_INSERTION_BLOCK;
+    insert.length = sizeof(blockData);
+    insert.block = 2;
+    m_pDiskImage = BlockDiskImage_Create(32);
+    DiskImage_SetVfs((DiskImage*)m_pDiskImage, (Vfs*)pVfs);
+    DiskImage_InsertData((DiskImage*)m_pDiskImage, blockData, &insert);
+
+    DiskImage_WriteDelta((DiskImage*)m_pDiskImage, g_imageFilename, deltaFilename);
+
+    memset(&delta, 0, sizeof(delta));
+    DiskImageDelta_Read(&delta, (Vfs*)pVfs, deltaFilename);
+    LONGS_EQUAL(2, delta.header.runCount);
+    LONGS_EQUAL(DISK_IMAGE_BLOCK_SIZE, delta.header.regionSize);
+    LONGS_EQUAL(DISK_IMAGE_BLOCK_SIZE + 1, delta.changedByteCount);
+    DiskImageDelta_Apply(&delta, previousImage, sizeof(previousImage));
+    CHECK(0 == memcmp(DiskImage_GetImagePointer((DiskImage*)m_pDiskImage), previousImage, sizeof(previousImage)));
+    DiskImageDelta_Free(&delta);
+    Vfs_Free((Vfs*)pVfs);
+}
+
+TEST(BlockDiskImage, FailToWriteDeltaFromMissingPreviousImage)
+{
+    MemoryVfs* pVfs = MemoryVfs_Create();
+
+    m_pDiskImage = BlockDiskImage_Create(32);
+    DiskImage_SetVfs((DiskImage*)m_pDiskImage, (Vfs*)pVfs);
+    __try_and_catch( DiskImage_WriteDelta((DiskImage*)m_pDiskImage, g_imageFilename, "BlockDiskImageTest.delta") );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+    STRCMP_EQUAL("error: Failed to read BlockDiskImageTest.hdv as the base image for the delta." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    Vfs_Free((Vfs*)pVfs);
+}
+
+TEST(BlockDiskImage, StatsCountObjectBytesReadAndImageBytesWritten)
+{
+    static const char script[] = "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                 "BLOCK,BlockDiskImageTestOnes.sav,0,512,1" LINE_ENDING;
+    unsigned char     blockData[DISK_IMAGE_BLOCK_SIZE];
+    MemoryVfs*        pVfs = MemoryVfs_Create();
+
+    memset(blockData, 0xff, sizeof(blockData));
+    MemoryVfs_AddFile(pVfs, g_savFilenameAllOnes, blockData, sizeof(blockData));
+    MemoryVfs_AddFile(pVfs, g_scriptFilename, script, sizeof(script) - 1);
+    m_pDiskImage = BlockDiskImage_Create(32);
+    DiskImage_SetVfs((DiskImage*)m_pDiskImage, (Vfs*)pVfs);
+    DiskImage_ProcessScriptFile((DiskImage*)m_pDiskImage, g_scriptFilename);
+    DiskImage_WriteImage((DiskImage*)m_pDiskImage, g_imageFilename);
+
+    const DiskImageStats* pStats = DiskImage_GetStats((DiskImage*)m_pDiskImage);
+    LONGS_EQUAL(2, pStats->scriptLineCount);
+    LONGS_EQUAL(1, pStats->objectFilesRead);
+    LONGS_EQUAL(2, pStats->objectReferences);
+    CHECK(DISK_IMAGE_BLOCK_SIZE == pStats->objectBytesRead);
+    CHECK(32ULL * DISK_IMAGE_BLOCK_SIZE == pStats->imageBytesWritten);
+    LONGS_EQUAL(0, pStats->rwts16SectorsEncoded);
+    LONGS_EQUAL(0, pStats->rw18TracksEncoded);
+    Vfs_Free((Vfs*)pVfs);
+}
+
+TEST(BlockDiskImage, StatsOnlyCountChangedBytesWrittenByUpdate)
+{
+    static const char script1[] = "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING;
+    static const char script2[] = "BLOCK,BlockDiskImageTestOnes.sav,0,512,0" LINE_ENDING
+                                  "BLOCK,BlockDiskImageTestOnes.sav,0,512,5" LINE_ENDING;
+    unsigned char     blockData[DISK_IMAGE_BLOCK_SIZE];
+    MemoryVfs*        pVfs = MemoryVfs_Create();
+    DiskImage*        pDiskImage;
+
+    memset(blockData, 0xff, sizeof(blockData));
+    MemoryVfs_AddFile(pVfs, g_savFilenameAllOnes, blockData, sizeof(blockData));
+    MemoryVfs_AddFile(pVfs, g_scriptFilename, script1, sizeof(script1) - 1);
+    pDiskImage = (DiskImage*)BlockDiskImage_Create(32);
+    DiskImage_SetVfs(pDiskImage, (Vfs*)pVfs);
+    DiskImage_ProcessScriptFile(pDiskImage, g_scriptFilename);
+    DiskImage_WriteImage(pDiskImage, g_imageFilename);
+    DiskImage_Free(pDiskImage);
+
+    MemoryVfs_AddFile(pVfs, g_scriptFilename, script2, sizeof(script2) - 1);
+    m_pDiskImage = BlockDiskImage_Create(32);
+    pDiskImage = (DiskImage*)m_pDiskImage;
+    DiskImage_SetVfs(pDiskImage, (Vfs*)pVfs);
+    DiskImage_ReadImageForUpdate(pDiskImage, g_imageFilename);
+    DiskImage_ProcessScriptFile(pDiskImage, g_scriptFilename);
+    DiskImage_UpdateImage(pDiskImage, g_imageFilename);
+
+    const DiskImageStats* pStats = DiskImage_GetStats(pDiskImage);
+    CHECK(pStats->imageBytesWritten > 0);
+    CHECK(pStats->imageBytesWritten < 32ULL * DISK_IMAGE_BLOCK_SIZE);
+    Vfs_Free((Vfs*)pVfs);
+}
+
+TEST(BlockDiskImage, ProcessScriptWithCompressFlagInsertsCompressedSlice)
+{
+    ByteBuffer decompressed = { NULL, 0 };
+
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesBlockObjectFile();
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,512,1,compress" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    const DiskImageStats* pStats = DiskImage_GetStats((DiskImage*)m_pDiskImage);
+    LONGS_EQUAL(0, DiskImage_GetScriptErrorCount((DiskImage*)m_pDiskImage));
+    LONGS_EQUAL(1, pStats->compressedInserts);
+    CHECK(512ULL == pStats->compressedInputBytes);
+    CHECK(15ULL == pStats->compressedOutputBytes);
+    LONGS_EQUAL(1, pStats->uncompressedTrackReads);
+    LONGS_EQUAL(1, pStats->compressedTrackReads);
+    validateBlocksAreZeroes(pImage, 0, 0);
+    validateAllZeroes(pImage + DISK_IMAGE_BLOCK_SIZE + 15, DISK_IMAGE_BLOCK_SIZE - 15);
+    LONGS_EQUAL(512, DiskImageCompress_Decompress(&decompressed, pImage + DISK_IMAGE_BLOCK_SIZE, 15));
+    validateAllOnes(decompressed.pBuffer, decompressed.bufferSize);
+    ByteBuffer_Free(&decompressed);
+}
+
+TEST(BlockDiskImage, AsteriskAfterCompressedLineFollowsCompressedDataAndObjectIsRestored)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesBlockObjectFile();
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,512,0,COMPRESS" LINE_ENDING
+                                                    "BLOCK,BlockDiskImageTestOnes.sav,0,512,*" LINE_ENDING));
+
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    LONGS_EQUAL(0, DiskImage_GetScriptErrorCount((DiskImage*)m_pDiskImage));
+    LONGS_EQUAL(0x01, pImage[0]);
+    LONGS_EQUAL(0x00, pImage[14]);
+    validateAllOnes(pImage + 15, DISK_IMAGE_BLOCK_SIZE);
+    validateAllZeroes(pImage + 15 + DISK_IMAGE_BLOCK_SIZE, DISK_IMAGE_BLOCK_SIZE - 15);
+}
+
+TEST(BlockDiskImage, CompressRW18LineWhichSpansTracksAndCountTrackReadsSaved)
+{
+    unsigned char sectorData[3 * DISK_IMAGE_BYTES_PER_SECTOR];
+
+    memset(sectorData, 0xff, sizeof(sectorData));
+    createSectorUSRObjectFile(g_usrFilenameAllOnes, sectorData, sizeof(sectorData), DISK_IMAGE_RW18_SIDE_0, 1, 17, 0);
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("RW18,BlockDiskImageTestOnes.usr,0,*,*,*,*,compress" LINE_ENDING));
+
+    const DiskImageStats* pStats = DiskImage_GetStats((DiskImage*)m_pDiskImage);
+    LONGS_EQUAL(0, DiskImage_GetScriptErrorCount((DiskImage*)m_pDiskImage));
+    LONGS_EQUAL(1, pStats->compressedInserts);
+    LONGS_EQUAL(2, pStats->uncompressedTrackReads);
+    LONGS_EQUAL(1, pStats->compressedTrackReads);
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateRW18SectorsAreZeroes(pImage, DISK_IMAGE_RW18_SIDE_0, 2, 0, DISK_IMAGE_RW18_SIDE_0, 2, 0);
+}
+
+TEST(BlockDiskImage, FailedCompressedLinesAreNotCounted)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesBlockObjectFile();
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,513,0,compress" LINE_ENDING
+                                                    "BLOCK,BlockDiskImageTestOnes.sav,0,512,1600,compress" LINE_ENDING));
+
+    LONGS_EQUAL(2, DiskImage_GetScriptErrorCount((DiskImage*)m_pDiskImage));
+    LONGS_EQUAL(0, DiskImage_GetStats((DiskImage*)m_pDiskImage)->compressedInserts);
+    validateBlocksAreZeroes(BlockDiskImage_GetImagePointer(m_pDiskImage), 0, 0);
+}
+
+TEST(BlockDiskImage, OverlappingLinesAreReportedAsWarningsAndLastLineWins)
+{
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesBlockObjectFile();
+    createZeroesBlockObjectFile();
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, copy("BLOCK,BlockDiskImageTestOnes.sav,0,512,1" LINE_ENDING
+                                                    "BLOCK,BlockDiskImageTestZeroes.sav,0,256,1" LINE_ENDING
+                                                    "BLOCK,BlockDiskImageTestOnes.sav,0,512,2" LINE_ENDING));
+
+    LONGS_EQUAL(0, DiskImage_GetScriptErrorCount((DiskImage*)m_pDiskImage));
+    LONGS_EQUAL(1, printfSpy_GetCallCount());
+    STRCMP_EQUAL("<null>:2: warning: BLOCK insertion overwrites data inserted by line 1." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    validateBlocksAreZeroes(pImage, 0, 0);
+    validateAllZeroes(pImage + DISK_IMAGE_BLOCK_SIZE, DISK_IMAGE_BLOCK_SIZE / 2);
+    validateAllOnes(pImage + DISK_IMAGE_BLOCK_SIZE + DISK_IMAGE_BLOCK_SIZE / 2, DISK_IMAGE_BLOCK_SIZE / 2);
+    validateBlocksAreOnes(pImage, 2, 2);
+}
+
+TEST(BlockDiskImage, ManyDisjointLinesAreScheduledAcrossThreads)
+{
+    char script[64 * 48] = "";
+
+    ThreadPool_SetThreadCount(4);
+    m_pDiskImage = BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    createOnesBlockObjectFile();
+    createZeroesBlockObjectFile();
+    for (unsigned int block = 0 ; block < 64 ; block++)
+        sprintf(script + strlen(script), "BLOCK,%s,0,512,%u" LINE_ENDING,
+                block & 1 ? g_savFilenameAllZeroes : g_savFilenameAllOnes, block);
+    strcat(script, "BLOCK,BlockDiskImageTestOnes.sav,0,512,63" LINE_ENDING);
+
+    BlockDiskImage_ProcessScript(m_pDiskImage, script);
+
+    LONGS_EQUAL(0, DiskImage_GetScriptErrorCount((DiskImage*)m_pDiskImage));
+    STRCMP_EQUAL("<null>:65: warning: BLOCK insertion overwrites data inserted by line 64." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    const unsigned char* pImage = BlockDiskImage_GetImagePointer(m_pDiskImage);
+    for (unsigned int block = 0 ; block < 63 ; block++)
+    {
+        if (block & 1)
+            validateBlocksAreZeroes(pImage, block, block);
+        else
+            validateBlocksAreOnes(pImage, block, block);
+    }
+    validateBlocksAreOnes(pImage, 63, 63);
+}
@@ -29,12 +29,14 @@ TEST_GROUP(ByteBuffer)
 {
     ByteBuffer     m_buffer;
     FILE*          m_pFile;
+    VfsFile*       m_pVfsFile;
     unsigned char* m_pFileData;
     
     void setup()
     {
         memset(&m_buffer, 0, sizeof(m_buffer));
         m_pFile = NULL;
+        m_pVfsFile = NULL;
         m_pFileData = NULL;
     }
 
@@ -42,24 +44,25 @@ TEST_GROUP(ByteBuffer)
     {
         LONGS_EQUAL(noException, getExceptionCode());
         MallocFailureInject_Restore();
-        freadRestore();
-        fwriteRestore();
+        readRestore();
+        writevRestore();
         ByteBuffer_Free(&m_buffer);
         free(m_pFileData);
         if (m_pFile)
             fclose(m_pFile);
+        Vfs_CloseFile(NULL, m_pVfsFile);
         remove(g_TestFilename);
     }
     
     void writeBufferToFile()
     {
-        m_pFile = fopen(g_TestFilename, "wb");
-        CHECK(NULL != m_pFile);
+        m_pVfsFile = Vfs_OpenFile(NULL, g_TestFilename, "wb");
+        CHECK(NULL != m_pVfsFile);
 
-        ByteBuffer_WriteToFile(&m_buffer, m_pFile);
+        ByteBuffer_WriteToFile(&m_buffer, NULL, m_pVfsFile);
 
-        fclose(m_pFile);
-        m_pFile = NULL;
+        Vfs_CloseFile(NULL, m_pVfsFile);
+        m_pVfsFile = NULL;
     }
     
     void validateFileContainsBufferContents()
@@ -88,24 +91,24 @@ TEST_GROUP(ByteBuffer)
     
     void readBufferFromFile()
     {
-        m_pFile = fopen(g_TestFilename, "rb");
-        CHECK(NULL != m_pFile);
+        m_pVfsFile = Vfs_OpenFile(NULL, g_TestFilename, "rb");
+        CHECK(NULL != m_pVfsFile);
 
-        ByteBuffer_ReadFromFile(&m_buffer, m_pFile);
+        ByteBuffer_ReadFromFile(&m_buffer, NULL, m_pVfsFile);
 
-        fclose(m_pFile);
-        m_pFile = NULL;
+        Vfs_CloseFile(NULL, m_pVfsFile);
+        m_pVfsFile = NULL;
     }
     
     void readPartialBufferFromFile(size_t bytesToRead)
     {
-        m_pFile = fopen(g_TestFilename, "rb");
-        CHECK(NULL != m_pFile);
+        m_pVfsFile = Vfs_OpenFile(NULL, g_TestFilename, "rb");
+        CHECK(NULL != m_pVfsFile);
 
-        ByteBuffer_ReadPartialFromFile(&m_buffer, bytesToRead, m_pFile);
+        ByteBuffer_ReadPartialFromFile(&m_buffer, bytesToRead, NULL, m_pVfsFile);
 
-        fclose(m_pFile);
-        m_pFile = NULL;
+        Vfs_CloseFile(NULL, m_pVfsFile);
+        m_pVfsFile = NULL;
     }
 
     long getFileSize(FILE* pFile)
@@ -178,9 +181,9 @@ TEST(ByteBuffer, FailWriteToFile)
     ByteBuffer_Allocate(&m_buffer, 10);
     memset(m_buffer.pBuffer, 0xa5, m_buffer.bufferSize);
     
-    fwriteFail(m_buffer.bufferSize - 1);
+    writevFail(m_buffer.bufferSize - 1);
         __try_and_catch( writeBufferToFile() );
-    fwriteRestore();
+    writevRestore();
     validateFileExceptionThrown();
 }
 
@@ -197,9 +200,10 @@ TEST(ByteBuffer, ReadFromFile)
 TEST(ByteBuffer, FailReadFromFile)
 {
     ByteBuffer_Allocate(&m_buffer, 10);
-    freadFail(0);
-        __try_and_catch( ByteBuffer_ReadFromFile(&m_buffer, NULL) );
-    freadRestore();
+    createTestFile("0123456789", 10);
+    readFail(-1);
+        __try_and_catch( readBufferFromFile() );
+    readRestore();
     validateFileExceptionThrown();
 }
 
@@ -217,16 +221,17 @@ TEST(ByteBuffer, ReadPartialFromFileAndRestShouldBeZeroFilled)
 TEST(ByteBuffer, FailReadPartialFromFile)
 {
     ByteBuffer_Allocate(&m_buffer, 10);
-    freadFail(0);
-        __try_and_catch( ByteBuffer_ReadPartialFromFile(&m_buffer, 5, NULL) );
-    freadRestore();
+    createTestFile("0123456789", 10);
+    readFail(-1);
+        __try_and_catch( readPartialBufferFromFile(5) );
+    readRestore();
     validateFileExceptionThrown();
 }
 
 TEST(ByteBuffer, FailByReadingTooMuchFromReadPartialFromFile)
 {
     ByteBuffer_Allocate(&m_buffer, 10);
-    __try_and_catch( ByteBuffer_ReadPartialFromFile(&m_buffer, 11, NULL) );
+    __try_and_catch( ByteBuffer_ReadPartialFromFile(&m_buffer, 11, NULL, NULL) );
     LONGS_EQUAL(invalidArgumentException, getExceptionCode());
     clearExceptionCode();
 }
@@ -0,0 +1,229 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "CrackleBatch.h"
+    #include "BlockDiskImage.h"
+    #include "NibbleDiskImage.h"
+    #include "MemoryVfs.h"
+    #include "MallocFailureInject.h"
+    #include "printfSpy.h"
+    #include "ThreadPool.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+static const char g_batchFilename[] = "CrackleBatchTest.batch";
+static const char g_objectFilename[] = "CrackleBatchTest.bin";
+
+
+TEST_GROUP(CrackleBatch)
+{
+    CrackleBatch* m_pBatch;
+    MemoryVfs*    m_pMemoryVfs;
+
+    void setup()
+    {
+        clearExceptionCode();
+        printfSpy_Hook(512);
+        ThreadPool_SetThreadCount(1);
+        m_pBatch = NULL;
+        m_pMemoryVfs = MemoryVfs_Create();
+        addObjectFile(0xff);
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        printfSpy_Unhook();
+        ThreadPool_SetThreadCount(0);
+        CrackleBatch_Free(m_pBatch);
+        Vfs_Free((Vfs*)m_pMemoryVfs);
+    }
+
+    void addObjectFile(unsigned char fillValue)
+    {
+        unsigned char data[DISK_IMAGE_BLOCK_SIZE];
+
+        memset(data, fillValue, sizeof(data));
+        MemoryVfs_AddFile(m_pMemoryVfs, g_objectFilename, data, sizeof(data));
+    }
+
+    void addTextFile(const char* pFilename, const char* pText)
+    {
+        MemoryVfs_AddFile(m_pMemoryVfs, pFilename, pText, strlen(pText));
+    }
+
+    void createBatch(const char* pBatchText)
+    {
+        addTextFile(g_batchFilename, pBatchText);
+        m_pBatch = CrackleBatch_Create((Vfs*)m_pMemoryVfs, g_batchFilename);
+    }
+
+    void validateCreateBatchThrows(const char* pBatchText, int expectedExceptionCode)
+    {
+        __try_and_catch( createBatch(pBatchText) );
+        LONGS_EQUAL(expectedExceptionCode, getExceptionCode());
+        POINTERS_EQUAL(NULL, m_pBatch);
+        clearExceptionCode();
+    }
+
+    const unsigned char* getImage(const char* pImageFilename, size_t expectedSize)
+    {
+        size_t      imageSize = 0;
+        const void* pImage = MemoryVfs_GetFileData(m_pMemoryVfs, pImageFilename, &imageSize);
+
+        CHECK_TRUE(pImage != NULL);
+        LONGS_EQUAL(expectedSize, imageSize);
+        return (const unsigned char*)pImage;
+    }
+
+    void validateAllOnes(const unsigned char* pBuffer, size_t bufferSize)
+    {
+        for (size_t i = 0 ; i < bufferSize ; i++)
+            LONGS_EQUAL(0xff, *pBuffer++);
+    }
+};
+
+
+TEST(CrackleBatch, BuildTwoImagesOfDifferentFormats)
+{
+    addTextFile("a.script", "BLOCK,CrackleBatchTest.bin,0,512,1" LINE_ENDING);
+    addTextFile("b.script", "RWTS16,CrackleBatchTest.bin,0,256,0,0" LINE_ENDING);
+    createBatch("hdv_3.5,a.script,a.hdv" LINE_ENDING
+                "NIB_5.25,b.script,b.nib" LINE_ENDING);
+    LONGS_EQUAL(2, m_pBatch->imageCount);
+    LONGS_EQUAL(FORMAT_HDV_3_5, m_pBatch->pImages[0].imageFormat);
+    STRCMP_EQUAL("a.script", m_pBatch->pImages[0].pScriptFilename);
+    STRCMP_EQUAL("a.hdv", m_pBatch->pImages[0].pOutputImageFilename);
+    LONGS_EQUAL(FORMAT_NIB_5_25, m_pBatch->pImages[1].imageFormat);
+
+    CrackleBatch_Run(m_pBatch);
+
+    LONGS_EQUAL(0, m_pBatch->failedCount);
+    validateAllOnes(getImage("a.hdv", BLOCK_DISK_IMAGE_3_5_DISK_SIZE) + DISK_IMAGE_BLOCK_SIZE, DISK_IMAGE_BLOCK_SIZE);
+    getImage("b.nib", NIBBLE_DISK_IMAGE_SIZE);
+    CHECK_TRUE(m_pBatch->elapsedSeconds >= 0.0);
+    CHECK_TRUE(CrackleBatch_GetTotalBuildSeconds(m_pBatch) >= 0.0);
+}
+
+TEST(CrackleBatch, SkipBlankAndCommentLines)
+{
+    addTextFile("a.script", "BLOCK,CrackleBatchTest.bin,0,512,1" LINE_ENDING);
+    createBatch("# Comment" LINE_ENDING
+                LINE_ENDING
+                "hdv_3.5,a.script,a.hdv" LINE_ENDING);
+    LONGS_EQUAL(1, m_pBatch->imageCount);
+}
+
+TEST(CrackleBatch, RunEmptyBatch)
+{
+    createBatch("");
+    CrackleBatch_Run(m_pBatch);
+    LONGS_EQUAL(0, m_pBatch->imageCount);
+    LONGS_EQUAL(0, m_pBatch->failedCount);
+}
+
+TEST(CrackleBatch, ImagesShareObjectsPrefetchedBeforeAnyAreBuilt)
+{
+    addTextFile("a.script", "BLOCK,CrackleBatchTest.bin,0,512,1" LINE_ENDING);
+    addTextFile("b.script", "BLOCK,CrackleBatchTest.bin,0,512,2" LINE_ENDING);
+    createBatch("hdv_3.5,a.script,a.hdv" LINE_ENDING
+                "hdv_3.5,b.script,b.hdv" LINE_ENDING);
+
+    CrackleBatch_Run(m_pBatch);
+
+    CHECK_TRUE(m_pBatch->pObjectCache != NULL);
+    validateAllOnes(getImage("a.hdv", BLOCK_DISK_IMAGE_3_5_DISK_SIZE) + DISK_IMAGE_BLOCK_SIZE, DISK_IMAGE_BLOCK_SIZE);
+    validateAllOnes(getImage("b.hdv", BLOCK_DISK_IMAGE_3_5_DISK_SIZE) + 2 * DISK_IMAGE_BLOCK_SIZE,
+                    DISK_IMAGE_BLOCK_SIZE);
+}
+
+TEST(CrackleBatch, FailedImageIsCountedAndOtherImagesAreStillBuilt)
+{
+    addTextFile("a.script", "BLOCK,missing.bin,0,512,1" LINE_ENDING);
+    addTextFile("b.script", "BLOCK,CrackleBatchTest.bin,0,512,2" LINE_ENDING);
+    createBatch("hdv_3.5,a.script,a.hdv" LINE_ENDING
+                "hdv_3.5,b.script,b.hdv" LINE_ENDING
+                "hdv_3.5,missing.script,c.hdv" LINE_ENDING);
+
+    CrackleBatch_Run(m_pBatch);
+
+    LONGS_EQUAL(2, m_pBatch->failedCount);
+    LONGS_EQUAL(noException, m_pBatch->pImages[0].exceptionCode);
+    LONGS_EQUAL(1, m_pBatch->pImages[0].scriptErrorCount);
+    LONGS_EQUAL(noException, m_pBatch->pImages[1].exceptionCode);
+    LONGS_EQUAL(0, m_pBatch->pImages[1].scriptErrorCount);
+    LONGS_EQUAL(fileOpenException, m_pBatch->pImages[2].exceptionCode);
+    getImage("a.hdv", BLOCK_DISK_IMAGE_3_5_DISK_SIZE);
+    POINTERS_EQUAL(NULL, MemoryVfs_GetFileData(m_pMemoryVfs, "c.hdv", NULL));
+    validateAllOnes(getImage("b.hdv", BLOCK_DISK_IMAGE_3_5_DISK_SIZE) + 2 * DISK_IMAGE_BLOCK_SIZE,
+                    DISK_IMAGE_BLOCK_SIZE);
+}
+
+TEST(CrackleBatch, ReportEveryInvalidLineBeforeThrowing)
+{
+    validateCreateBatchThrows("hdv_3.5,a.script" LINE_ENDING
+                              "hdv_3.5,a.script,a.hdv" LINE_ENDING
+                              "dsk_5.25,b.script,b.dsk" LINE_ENDING,
+                              invalidArgumentException);
+    LONGS_EQUAL(2, printfSpy_GetCallCount());
+    STRCMP_EQUAL("CrackleBatchTest.batch:3: error: dsk_5.25 isn't a recognized image format of nib_5.25 or hdv_3.5."
+                 LINE_ENDING, printfSpy_GetLastErrorOutput());
+}
+
+TEST(CrackleBatch, ReportLineWithWrongFieldCount)
+{
+    validateCreateBatchThrows("hdv_3.5,a.script,a.hdv,extra" LINE_ENDING, invalidArgumentException);
+    STRCMP_EQUAL("CrackleBatchTest.batch:1: error: "
+                 "Line should be of the form image_format,scriptFilename,outputImageFilename." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(CrackleBatch, FailToOpenBatchFile)
+{
+    __try_and_catch( m_pBatch = CrackleBatch_Create((Vfs*)m_pMemoryVfs, g_batchFilename) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    POINTERS_EQUAL(NULL, m_pBatch);
+    clearExceptionCode();
+    STRCMP_EQUAL("error: Failed to open CrackleBatchTest.batch batch file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(CrackleBatch, FailAllAllocationsDuringCreate)
+{
+    static const char batchText[] = "hdv_3.5,a.script,a.hdv" LINE_ENDING
+                                    "nib_5.25,b.script,b.nib" LINE_ENDING;
+    int               allocationToFail = 1;
+
+    addTextFile(g_batchFilename, batchText);
+    do
+    {
+        MallocFailureInject_FailAllocation(allocationToFail++);
+        __try_and_catch( m_pBatch = CrackleBatch_Create((Vfs*)m_pMemoryVfs, g_batchFilename) );
+        MallocFailureInject_Restore();
+        if (getExceptionCode() == noException)
+            break;
+        CHECK_TRUE(getExceptionCode() == outOfMemoryException || getExceptionCode() == fileOpenException);
+        POINTERS_EQUAL(NULL, m_pBatch);
+        clearExceptionCode();
+    } while (allocationToFail < 100);
+    CHECK_TRUE(m_pBatch != NULL);
+    LONGS_EQUAL(2, m_pBatch->imageCount);
+}
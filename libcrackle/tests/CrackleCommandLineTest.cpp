@@ -29,7 +29,7 @@ static const char g_usageString[] = "Usage:";
 
 TEST_GROUP(CrackleCommandLine)
 {
-    const char*        m_argv[10];
+    const char*        m_argv[16];
     CrackleCommandLine m_commandLine;
     int                m_argc;
     
@@ -148,6 +148,105 @@ TEST(CrackleCommandLine, ValidFormatOfHDV_3_5)
     STRCMP_EQUAL("pop1.crackle", m_commandLine.pScriptFilename);
     STRCMP_EQUAL("pop1.nib", m_commandLine.pOutputImageFilename);
     LONGS_EQUAL(FORMAT_HDV_3_5, m_commandLine.imageFormat);
+    POINTERS_EQUAL(NULL, m_commandLine.pBundleFilename);
+    POINTERS_EQUAL(NULL, m_commandLine.pManifestFilename);
+    LONGS_EQUAL(0, m_commandLine.updateImage);
+    LONGS_EQUAL(STATS_NONE, m_commandLine.statsFormat);
+}
+
+TEST(CrackleCommandLine, ValidBundleFilename)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--bundle");
+    addArg("pop1.snb");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("pop1.snb", m_commandLine.pBundleFilename);
+    STRCMP_EQUAL("pop1.crackle", m_commandLine.pScriptFilename);
+}
+
+TEST(CrackleCommandLine, MissingBundleFilename)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    addArg("--bundle");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidUpdateWithManifest)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--update");
+    addArg("--manifest");
+    addArg("pop1.manifest");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(1, m_commandLine.updateImage);
+    STRCMP_EQUAL("pop1.manifest", m_commandLine.pManifestFilename);
+    STRCMP_EQUAL("pop1.crackle", m_commandLine.pScriptFilename);
+    STRCMP_EQUAL("pop1.nib", m_commandLine.pOutputImageFilename);
+}
+
+TEST(CrackleCommandLine, MissingManifestFilename)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    addArg("--manifest");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidBatchWithBundle)
+{
+    addArg("--batch");
+    addArg("pop.batch");
+    addArg("--bundle");
+    addArg("pop.snb");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("pop.batch", m_commandLine.pBatchFilename);
+    STRCMP_EQUAL("pop.snb", m_commandLine.pBundleFilename);
+    POINTERS_EQUAL(NULL, m_commandLine.pScriptFilename);
+    LONGS_EQUAL(FORMAT_UNKNOWN, m_commandLine.imageFormat);
+}
+
+TEST(CrackleCommandLine, MissingBatchFilename)
+{
+    addArg("--batch");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidBatchWithScriptAndFormat)
+{
+    addArg("--batch");
+    addArg("pop.batch");
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidBatchWithUpdate)
+{
+    addArg("--batch");
+    addArg("pop.batch");
+    addArg("--update");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
 }
 
 TEST(CrackleCommandLine, InvalidCaseOfTooManyFilenames)
@@ -160,3 +259,451 @@ TEST(CrackleCommandLine, InvalidCaseOfTooManyFilenames)
     __try_and_catch ( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
     validateInvalidArgumentExceptionThrown();
 }
+
+TEST(CrackleCommandLine, ValidMultipleFormatsWithOutputForEach)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--format");
+    addArg("hdv_3.5");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    addArg("pop1.hdv");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(2, m_commandLine.imageFormatCount);
+    LONGS_EQUAL(2, m_commandLine.outputImageCount);
+    LONGS_EQUAL(FORMAT_NIB_5_25, m_commandLine.imageFormats[0]);
+    LONGS_EQUAL(FORMAT_HDV_3_5, m_commandLine.imageFormats[1]);
+    STRCMP_EQUAL("pop1.nib", m_commandLine.apOutputImageFilenames[0]);
+    STRCMP_EQUAL("pop1.hdv", m_commandLine.apOutputImageFilenames[1]);
+    LONGS_EQUAL(FORMAT_NIB_5_25, m_commandLine.imageFormat);
+    STRCMP_EQUAL("pop1.crackle", m_commandLine.pScriptFilename);
+    STRCMP_EQUAL("pop1.nib", m_commandLine.pOutputImageFilename);
+}
+
+TEST(CrackleCommandLine, InvalidMultipleFormatsWithTooFewOutputs)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--format");
+    addArg("hdv_3.5");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidCaseOfTooManyFormats)
+{
+    for (int i = 0 ; i <= CRACKLE_COMMAND_LINE_MAX_IMAGES ; i++)
+    {
+        addArg("--format");
+        addArg("nib_5.25");
+    }
+    addArg("pop1.crackle");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidMultipleFormatsWithUpdate)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--format");
+    addArg("hdv_3.5");
+    addArg("--update");
+    addArg("pop1.crackle");
+    addArg("pop1.nib");
+    addArg("pop1.hdv");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidSidesWithOutputForEach)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--sides");
+    addArg("0xa9,0xAD,0x79");
+    addArg("pop.crackle");
+    addArg("popA.nib");
+    addArg("popB.nib");
+    addArg("popC.nib");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(3, m_commandLine.sideCount);
+    LONGS_EQUAL(0xa9, m_commandLine.sides[0]);
+    LONGS_EQUAL(0xad, m_commandLine.sides[1]);
+    LONGS_EQUAL(0x79, m_commandLine.sides[2]);
+    LONGS_EQUAL(3, m_commandLine.outputImageCount);
+    STRCMP_EQUAL("popC.nib", m_commandLine.apOutputImageFilenames[2]);
+}
+
+TEST(CrackleCommandLine, InvalidSides)
+{
+    static const char* invalidSides[] = { "0xa8", "0xa9,0xa9", "0xa9,", "0xa9;0xad", "", "xyz" };
+
+    for (size_t i = 0 ; i < ARRAYSIZE(invalidSides) ; i++)
+    {
+        m_argc = 0;
+        addArg("--format");
+        addArg("nib_5.25");
+        addArg("--sides");
+        addArg(invalidSides[i]);
+        addArg("pop.crackle");
+        addArg("popA.nib");
+        __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+        validateInvalidArgumentExceptionThrown();
+    }
+}
+
+TEST(CrackleCommandLine, InvalidSidesWithTooFewOutputs)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--sides");
+    addArg("0xa9,0xad");
+    addArg("pop.crackle");
+    addArg("popA.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidSidesWithBlockFormat)
+{
+    addArg("--format");
+    addArg("hdv_3.5");
+    addArg("--sides");
+    addArg("0xa9");
+    addArg("pop.crackle");
+    addArg("pop.hdv");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidSidesWithBatch)
+{
+    addArg("--batch");
+    addArg("pop.batch");
+    addArg("--sides");
+    addArg("0xa9");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidExtract)
+{
+    addArg("--extract");
+    addArg("pop.nib");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("pop.nib", m_commandLine.pExtractFilename);
+    POINTERS_EQUAL(NULL, m_commandLine.pExtractOutputFilename);
+    POINTERS_EQUAL(NULL, m_commandLine.pScriptFilename);
+}
+
+TEST(CrackleCommandLine, ValidExtractWithOutputFilename)
+{
+    addArg("--extract");
+    addArg("pop.nib");
+    addArg("pop.bin");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("pop.nib", m_commandLine.pExtractFilename);
+    STRCMP_EQUAL("pop.bin", m_commandLine.pExtractOutputFilename);
+    POINTERS_EQUAL(NULL, m_commandLine.pScriptFilename);
+    LONGS_EQUAL(0, m_commandLine.outputImageCount);
+}
+
+TEST(CrackleCommandLine, InvalidExtractWithTooManyFilenames)
+{
+    addArg("--extract");
+    addArg("pop.nib");
+    addArg("pop.bin");
+    addArg("extra.bin");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidExtractWithFormat)
+{
+    addArg("--extract");
+    addArg("pop.nib");
+    addArg("--format");
+    addArg("nib_5.25");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidExtractWithoutImageFilename)
+{
+    addArg("--extract");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidDeltaFrom)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--delta-from");
+    addArg("old.nib");
+    addArg("pop.crackle");
+    addArg("pop.delta");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("old.nib", m_commandLine.pDeltaFromFilename);
+    STRCMP_EQUAL("pop.crackle", m_commandLine.pScriptFilename);
+    STRCMP_EQUAL("pop.delta", m_commandLine.pOutputImageFilename);
+}
+
+TEST(CrackleCommandLine, InvalidDeltaFromWithUpdate)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--delta-from");
+    addArg("old.nib");
+    addArg("--update");
+    addArg("pop.crackle");
+    addArg("pop.delta");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidDeltaFromWithMultipleFormats)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--format");
+    addArg("hdv_3.5");
+    addArg("--delta-from");
+    addArg("old.nib");
+    addArg("pop.crackle");
+    addArg("pop.delta");
+    addArg("pop2.delta");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidApplyDelta)
+{
+    addArg("--apply-delta");
+    addArg("pop.delta");
+    addArg("pop.nib");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("pop.delta", m_commandLine.pApplyDeltaFilename);
+    STRCMP_EQUAL("pop.nib", m_commandLine.pOutputImageFilename);
+    POINTERS_EQUAL(NULL, m_commandLine.pScriptFilename);
+}
+
+TEST(CrackleCommandLine, InvalidApplyDeltaWithoutImageFilename)
+{
+    addArg("--apply-delta");
+    addArg("pop.delta");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidApplyDeltaWithFormat)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--apply-delta");
+    addArg("pop.delta");
+    addArg("pop.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidStatsText)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--stats");
+    addArg("text");
+    addArg("pop.crackle");
+    addArg("pop.nib");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(STATS_TEXT, m_commandLine.statsFormat);
+    STRCMP_EQUAL("pop.crackle", m_commandLine.pScriptFilename);
+}
+
+TEST(CrackleCommandLine, ValidStatsJsonIsCaseInsensitive)
+{
+    addArg("--stats");
+    addArg("JSON");
+    addArg("--batch");
+    addArg("pop.batch");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(STATS_JSON, m_commandLine.statsFormat);
+}
+
+TEST(CrackleCommandLine, InvalidStatsFormat)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--stats");
+    addArg("xml");
+    addArg("pop.crackle");
+    addArg("pop.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, MissingStatsFormat)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop.crackle");
+    addArg("pop.nib");
+    addArg("--stats");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidStatsWithExtract)
+{
+    addArg("--stats");
+    addArg("text");
+    addArg("--extract");
+    addArg("pop.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidStatsWithApplyDelta)
+{
+    addArg("--stats");
+    addArg("json");
+    addArg("--apply-delta");
+    addArg("pop.delta");
+    addArg("pop.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidPlanWithBundle)
+{
+    addArg("--plan");
+    addArg("pop.loads");
+    addArg("--bundle");
+    addArg("pop.bundle");
+    addArg("pop.crackle");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("pop.loads", m_commandLine.pPlanFilename);
+    STRCMP_EQUAL("pop.bundle", m_commandLine.pBundleFilename);
+    STRCMP_EQUAL("pop.crackle", m_commandLine.pScriptFilename);
+    LONGS_EQUAL(0, m_commandLine.outputImageCount);
+}
+
+TEST(CrackleCommandLine, InvalidPlanWithoutScriptFilename)
+{
+    addArg("--plan");
+    addArg("pop.loads");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidPlanWithFormatAndImage)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--plan");
+    addArg("pop.loads");
+    addArg("pop.crackle");
+    addArg("pop.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, MissingPlanFilename)
+{
+    addArg("pop.crackle");
+    addArg("--plan");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidTuneInterleave)
+{
+    addArg("--tune-interleave");
+    addArg("0x1388");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(1, m_commandLine.tuneInterleave);
+    LONGS_EQUAL(5000, m_commandLine.cyclesPerSector);
+    POINTERS_EQUAL(NULL, m_commandLine.pScriptFilename);
+}
+
+TEST(CrackleCommandLine, InvalidTuneInterleaveWithScriptFilename)
+{
+    addArg("--tune-interleave");
+    addArg("5000");
+    addArg("pop.crackle");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidTuneInterleaveCycleCounts)
+{
+    addArg("--tune-interleave");
+    addArg("5000x");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+    m_argv[1] = "";
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+    m_argv[1] = "1000001";
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, MissingTuneInterleaveCycleCount)
+{
+    addArg("--tune-interleave");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, ValidSimulate)
+{
+    addArg("--simulate");
+    addArg("pop.trace");
+    addArg("pop.nib");
+    m_commandLine = CrackleCommandLine_Init(m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    STRCMP_EQUAL("pop.trace", m_commandLine.pSimulateFilename);
+    STRCMP_EQUAL("pop.nib", m_commandLine.pOutputImageFilename);
+    POINTERS_EQUAL(NULL, m_commandLine.pScriptFilename);
+}
+
+TEST(CrackleCommandLine, InvalidSimulateWithoutImageFilename)
+{
+    addArg("--simulate");
+    addArg("pop.trace");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, InvalidSimulateWithExtract)
+{
+    addArg("--simulate");
+    addArg("pop.trace");
+    addArg("--extract");
+    addArg("pop.nib");
+    addArg("pop.nib");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
+
+TEST(CrackleCommandLine, MissingSimulateTraceFilename)
+{
+    addArg("--simulate");
+    __try_and_catch( m_commandLine = CrackleCommandLine_Init(m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrown();
+}
@@ -0,0 +1,371 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "CrackleExtract.h"
+    #include "NibbleDiskImage.h"
+    #include "BlockDiskImage.h"
+    #include "MemoryVfs.h"
+    #include "MallocFailureInject.h"
+    #include "printfSpy.h"
+    #include "ThreadPool.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+static const char g_nibFilename[] = "CrackleExtractTest.nib";
+static const char g_hdvFilename[] = "CrackleExtractTest.hdv";
+static const char g_outputFilename[] = "CrackleExtractTest.out";
+
+
+TEST_GROUP(CrackleExtract)
+{
+    CrackleExtract*  m_pExtract;
+    NibbleDiskImage* m_pNibbleDiskImage;
+    MemoryVfs*       m_pMemoryVfs;
+    unsigned char    m_trackData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+
+    void setup()
+    {
+        clearExceptionCode();
+        printfSpy_Hook(512);
+        m_pExtract = NULL;
+        m_pNibbleDiskImage = NULL;
+        m_pMemoryVfs = MemoryVfs_Create();
+        for (size_t i = 0 ; i < sizeof(m_trackData) ; i++)
+            m_trackData[i] = (unsigned char)(i * 7 + (i >> 8));
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        printfSpy_Unhook();
+        ThreadPool_SetThreadCount(0);
+        CrackleExtract_Free(m_pExtract);
+        DiskImage_Free((DiskImage*)m_pNibbleDiskImage);
+        Vfs_Free((Vfs*)m_pMemoryVfs);
+    }
+
+    void insertRWTS16Track(unsigned int track)
+    {
+        DiskImageInsert insert;
+
+        memset(&insert, 0, sizeof(insert));
+        insert.type = DISK_IMAGE_INSERTION_RWTS16;
+        insert.length = NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK * DISK_IMAGE_BYTES_PER_SECTOR;
+        insert.track = track;
+        NibbleDiskImage_InsertData(m_pNibbleDiskImage, m_trackData, &insert);
+    }
+
+    void insertRW18Track(unsigned int track, unsigned int side)
+    {
+        DiskImageInsert insert;
+
+        memset(&insert, 0, sizeof(insert));
+        insert.type = DISK_IMAGE_INSERTION_RW18;
+        insert.length = DISK_IMAGE_RW18_BYTES_PER_TRACK;
+        insert.side = side;
+        insert.track = track;
+        NibbleDiskImage_InsertData(m_pNibbleDiskImage, m_trackData, &insert);
+    }
+
+    void createNibbleImage()
+    {
+        m_pNibbleDiskImage = NibbleDiskImage_Create();
+        DiskImage_SetVfs((DiskImage*)m_pNibbleDiskImage, (Vfs*)m_pMemoryVfs);
+    }
+
+    void writeNibbleImage()
+    {
+        NibbleDiskImage_WriteImage(m_pNibbleDiskImage, g_nibFilename);
+    }
+
+    unsigned char* getWritableImage(const char* pFilename)
+    {
+        size_t imageSize = 0;
+
+        return (unsigned char*)MemoryVfs_GetFileData(m_pMemoryVfs, pFilename, &imageSize);
+    }
+
+    void extract(const char* pFilename)
+    {
+        m_pExtract = CrackleExtract_Create((Vfs*)m_pMemoryVfs, pFilename);
+        CrackleExtract_Decode(m_pExtract);
+    }
+
+    const unsigned char* getTrack(unsigned int track)
+    {
+        return m_pExtract->pLogicalData + track * DISK_IMAGE_RW18_BYTES_PER_TRACK;
+    }
+
+    void validateCreateThrows(const char* pFilename, int expectedExceptionCode)
+    {
+        __try_and_catch( m_pExtract = CrackleExtract_Create((Vfs*)m_pMemoryVfs, pFilename) );
+        LONGS_EQUAL(expectedExceptionCode, getExceptionCode());
+        POINTERS_EQUAL(NULL, m_pExtract);
+        clearExceptionCode();
+    }
+
+    static unsigned int countBits(unsigned int bits)
+    {
+        unsigned int count = 0;
+
+        for ( ; bits ; bits >>= 1)
+            count += bits & 1;
+        return count;
+    }
+
+    static int isZeroed(const unsigned char* pData, size_t dataSize)
+    {
+        while (dataSize--)
+        {
+            if (*pData++)
+                return FALSE;
+        }
+        return TRUE;
+    }
+};
+
+
+TEST(CrackleExtract, DecodeRWTS16AndRW18TracksBackToInsertedData)
+{
+    createNibbleImage();
+    insertRWTS16Track(0);
+    insertRW18Track(1, 0xa9);
+    insertRW18Track(34, 0xa9);
+    writeNibbleImage();
+
+    extract(g_nibFilename);
+
+    LONGS_EQUAL(FORMAT_NIB_5_25, m_pExtract->imageFormat);
+    LONGS_EQUAL(DISK_IMAGE_TRACKS_PER_SIDE * DISK_IMAGE_RW18_BYTES_PER_TRACK, m_pExtract->logicalSize);
+    LONGS_EQUAL(0, m_pExtract->badTrackCount);
+    LONGS_EQUAL(NIBBLE_TRACK_RWTS16, m_pExtract->trackStatus[0].format);
+    LONGS_EQUAL(0xffff, m_pExtract->trackStatus[0].goodSectors);
+    CHECK(0 == memcmp(m_trackData, getTrack(0), 16 * DISK_IMAGE_BYTES_PER_SECTOR));
+    CHECK_TRUE(isZeroed(getTrack(0) + 16 * DISK_IMAGE_BYTES_PER_SECTOR, 2 * DISK_IMAGE_BYTES_PER_SECTOR));
+    LONGS_EQUAL(NIBBLE_TRACK_RW18, m_pExtract->trackStatus[1].format);
+    LONGS_EQUAL(0xa9, m_pExtract->trackStatus[1].side);
+    LONGS_EQUAL(0x3f, m_pExtract->trackStatus[1].goodSectors);
+    CHECK(0 == memcmp(m_trackData, getTrack(1), DISK_IMAGE_RW18_BYTES_PER_TRACK));
+    CHECK(0 == memcmp(m_trackData, getTrack(34), DISK_IMAGE_RW18_BYTES_PER_TRACK));
+    LONGS_EQUAL(NIBBLE_TRACK_EMPTY, m_pExtract->trackStatus[2].format);
+    CHECK_TRUE(isZeroed(getTrack(2), DISK_IMAGE_RW18_BYTES_PER_TRACK));
+}
+
+TEST(CrackleExtract, RecordWhereEachGoodSectorStartsAndEnds)
+{
+    static const unsigned int rwts16SectorNibbles = NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR - 
+                                                    NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES;
+    
+    createNibbleImage();
+    insertRWTS16Track(0);
+    insertRW18Track(1, 0xa9);
+    writeNibbleImage();
+
+    extract(g_nibFilename);
+
+    LONGS_EQUAL(NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES, m_pExtract->trackStatus[0].sectorStarts[0]);
+    LONGS_EQUAL(NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES + rwts16SectorNibbles, m_pExtract->trackStatus[0].sectorEnds[0]);
+    LONGS_EQUAL(NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES + 15 * NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR,
+                m_pExtract->trackStatus[0].sectorStarts[15]);
+    LONGS_EQUAL(NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK, m_pExtract->trackStatus[0].sectorEnds[15]);
+    LONGS_EQUAL(415, m_pExtract->trackStatus[1].sectorStarts[5]);
+    LONGS_EQUAL(1450, m_pExtract->trackStatus[1].sectorEnds[5]);
+    LONGS_EQUAL(5620, m_pExtract->trackStatus[1].sectorStarts[0]);
+    LONGS_EQUAL(NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK - 1, m_pExtract->trackStatus[1].sectorEnds[0]);
+}
+
+TEST(CrackleExtract, DecodeTracksConcurrently)
+{
+    createNibbleImage();
+    for (unsigned int track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+        insertRW18Track(track, 0xad);
+    writeNibbleImage();
+    ThreadPool_SetThreadCount(4);
+
+    extract(g_nibFilename);
+
+    LONGS_EQUAL(0, m_pExtract->badTrackCount);
+    for (unsigned int track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+    {
+        LONGS_EQUAL(0xad, m_pExtract->trackStatus[track].side);
+        CHECK(0 == memcmp(m_trackData, getTrack(track), DISK_IMAGE_RW18_BYTES_PER_TRACK));
+    }
+}
+
+TEST(CrackleExtract, CorruptedRWTS16DataNibbleMarksOnlyThatSectorBad)
+{
+    unsigned char* pImage;
+    unsigned char* pDataProlog;
+
+    createNibbleImage();
+    insertRWTS16Track(5);
+    writeNibbleImage();
+    pImage = getWritableImage(g_nibFilename) + 5 * NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK;
+    pDataProlog = (unsigned char*)memchr(pImage + NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES + 14, 0xD5, 32);
+    CHECK_TRUE(pDataProlog != NULL);
+    pDataProlog[3 + 100] = 0xAA;
+
+    extract(g_nibFilename);
+
+    LONGS_EQUAL(1, m_pExtract->badTrackCount);
+    LONGS_EQUAL(0x0001, m_pExtract->trackStatus[5].badSectors);
+    LONGS_EQUAL(0xfffe, m_pExtract->trackStatus[5].goodSectors);
+    CHECK_TRUE(isZeroed(getTrack(5), DISK_IMAGE_BYTES_PER_SECTOR));
+    CHECK(0 == memcmp(m_trackData + DISK_IMAGE_BYTES_PER_SECTOR, getTrack(5) + DISK_IMAGE_BYTES_PER_SECTOR,
+                      15 * DISK_IMAGE_BYTES_PER_SECTOR));
+}
+
+TEST(CrackleExtract, CorruptedRW18ChecksumMarksSectorBad)
+{
+    unsigned char* pImage;
+    unsigned char* pAddressProlog;
+
+    createNibbleImage();
+    insertRW18Track(3, 0xa9);
+    writeNibbleImage();
+    pImage = getWritableImage(g_nibFilename) + 3 * NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK;
+    pAddressProlog = pImage;
+    do
+    {
+        pAddressProlog = (unsigned char*)memchr(pAddressProlog + 1, 0xD5, NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK / 2);
+        CHECK_TRUE(pAddressProlog != NULL);
+    } while (pAddressProlog[1] != 0x9D);
+    pAddressProlog[2 + 3 + 1 + 2 + 1 + 4 * DISK_IMAGE_PAGE_SIZE] ^= 0x01;
+
+    extract(g_nibFilename);
+
+    LONGS_EQUAL(1, m_pExtract->badTrackCount);
+    LONGS_EQUAL(1, countBits(m_pExtract->trackStatus[3].badSectors));
+    LONGS_EQUAL(5, countBits(m_pExtract->trackStatus[3].goodSectors));
+}
+
+TEST(CrackleExtract, TrackWithoutAddressFieldsIsUnknown)
+{
+    createNibbleImage();
+    writeNibbleImage();
+    memset(getWritableImage(g_nibFilename) + 7 * NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK, 0xff, 64);
+
+    extract(g_nibFilename);
+
+    LONGS_EQUAL(1, m_pExtract->badTrackCount);
+    LONGS_EQUAL(NIBBLE_TRACK_UNKNOWN, m_pExtract->trackStatus[7].format);
+}
+
+TEST(CrackleExtract, ReportStatusOfNonEmptyTracks)
+{
+    createNibbleImage();
+    insertRWTS16Track(0);
+    insertRW18Track(1, 0xa9);
+    writeNibbleImage();
+    extract(g_nibFilename);
+
+    CrackleExtract_ReportStatus(m_pExtract);
+
+    LONGS_EQUAL(5, printfSpy_GetCallCount());
+    STRCMP_EQUAL("CrackleExtractTest.nib: 0 of 35 tracks failed to decode.\n", printfSpy_GetLastOutput());
+}
+
+TEST(CrackleExtract, ExtractHdvImageCountsUsedBlocks)
+{
+    unsigned char image[4 * DISK_IMAGE_BLOCK_SIZE];
+
+    memset(image, 0, sizeof(image));
+    image[DISK_IMAGE_BLOCK_SIZE + 17] = 0x42;
+    image[3 * DISK_IMAGE_BLOCK_SIZE + 511] = 0x01;
+    MemoryVfs_AddFile(m_pMemoryVfs, g_hdvFilename, image, sizeof(image));
+
+    extract(g_hdvFilename);
+
+    LONGS_EQUAL(FORMAT_HDV_3_5, m_pExtract->imageFormat);
+    LONGS_EQUAL(sizeof(image), m_pExtract->logicalSize);
+    LONGS_EQUAL(2, m_pExtract->usedBlockCount);
+    CHECK(0 == memcmp(image, m_pExtract->pLogicalData, sizeof(image)));
+    CrackleExtract_ReportStatus(m_pExtract);
+    STRCMP_EQUAL("CrackleExtractTest.hdv: 2 of 4 blocks in use.\n", printfSpy_GetLastOutput());
+}
+
+TEST(CrackleExtract, WriteLogicalData)
+{
+    unsigned char image[DISK_IMAGE_BLOCK_SIZE];
+    size_t        dataSize = 0;
+    const void*   pData;
+
+    memset(image, 0x5a, sizeof(image));
+    MemoryVfs_AddFile(m_pMemoryVfs, g_hdvFilename, image, sizeof(image));
+    extract(g_hdvFilename);
+
+    CrackleExtract_WriteLogicalData(m_pExtract, (Vfs*)m_pMemoryVfs, g_outputFilename);
+
+    pData = MemoryVfs_GetFileData(m_pMemoryVfs, g_outputFilename, &dataSize);
+    LONGS_EQUAL(sizeof(image), dataSize);
+    CHECK(0 == memcmp(image, pData, sizeof(image)));
+}
+
+TEST(CrackleExtract, FailToOpenImageForWriteOfLogicalData)
+{
+    unsigned char image[DISK_IMAGE_BLOCK_SIZE];
+
+    memset(image, 0, sizeof(image));
+    MemoryVfs_AddFile(m_pMemoryVfs, g_hdvFilename, image, sizeof(image));
+    extract(g_hdvFilename);
+
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( CrackleExtract_WriteLogicalData(m_pExtract, (Vfs*)m_pMemoryVfs, g_outputFilename) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(CrackleExtract, FailToOpenMissingImage)
+{
+    validateCreateThrows(g_nibFilename, fileOpenException);
+    STRCMP_EQUAL("error: Failed to open CrackleExtractTest.nib image file." LINE_ENDING, printfSpy_GetLastErrorOutput());
+}
+
+TEST(CrackleExtract, FailOnImageOfUnrecognizedSize)
+{
+    unsigned char image[DISK_IMAGE_BLOCK_SIZE + 1];
+
+    memset(image, 0, sizeof(image));
+    MemoryVfs_AddFile(m_pMemoryVfs, g_hdvFilename, image, sizeof(image));
+    validateCreateThrows(g_hdvFilename, fileException);
+    STRCMP_EQUAL("error: CrackleExtractTest.hdv isn't a .nib or .hdv image." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(CrackleExtract, FailAllAllocationsDuringCreate)
+{
+    int allocationToFail = 1;
+
+    createNibbleImage();
+    writeNibbleImage();
+    do
+    {
+        MallocFailureInject_FailAllocation(allocationToFail++);
+        __try_and_catch( m_pExtract = CrackleExtract_Create((Vfs*)m_pMemoryVfs, g_nibFilename) );
+        MallocFailureInject_Restore();
+        if (getExceptionCode() == noException)
+            break;
+        CHECK_TRUE(getExceptionCode() == outOfMemoryException || getExceptionCode() == fileOpenException);
+        POINTERS_EQUAL(NULL, m_pExtract);
+        clearExceptionCode();
+    } while (allocationToFail < 100);
+    CHECK_TRUE(m_pExtract != NULL);
+}
@@ -0,0 +1,406 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "CracklePlan.h"
+    #include "NibbleDiskImage.h"
+    #include "MemoryVfs.h"
+    #include "MallocFailureInject.h"
+    #include "printfSpy.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+static const char g_sequenceFilename[] = "CracklePlanTest.loads";
+static const char g_scriptFilename[] = "CracklePlanTest.script";
+
+
+TEST_GROUP(CracklePlan)
+{
+    CracklePlan* m_pPlan;
+    MemoryVfs*   m_pMemoryVfs;
+
+    void setup()
+    {
+        clearExceptionCode();
+        printfSpy_Hook(512);
+        m_pPlan = NULL;
+        m_pMemoryVfs = MemoryVfs_Create();
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        printfSpy_Unhook();
+        CracklePlan_Free(m_pPlan);
+        Vfs_Free((Vfs*)m_pMemoryVfs);
+    }
+
+    void addObjectFile(const char* pFilename, size_t length, unsigned char fillValue)
+    {
+        unsigned char* pData = (unsigned char*)malloc(length);
+
+        CHECK_TRUE(pData != NULL);
+        memset(pData, fillValue, length);
+        MemoryVfs_AddFile(m_pMemoryVfs, pFilename, pData, length);
+        free(pData);
+    }
+
+    void addTextFile(const char* pFilename, const char* pText)
+    {
+        MemoryVfs_AddFile(m_pMemoryVfs, pFilename, pText, strlen(pText));
+    }
+
+    void createPlan(const char* pSequenceText)
+    {
+        addTextFile(g_sequenceFilename, pSequenceText);
+        m_pPlan = CracklePlan_Create((Vfs*)m_pMemoryVfs, g_sequenceFilename);
+    }
+
+    void runPlan(const char* pSequenceText)
+    {
+        createPlan(pSequenceText);
+        CracklePlan_Run(m_pPlan);
+    }
+
+    void validateCreatePlanThrows(const char* pSequenceText, int expectedExceptionCode)
+    {
+        __try_and_catch( createPlan(pSequenceText) );
+        LONGS_EQUAL(expectedExceptionCode, getExceptionCode());
+        POINTERS_EQUAL(NULL, m_pPlan);
+        clearExceptionCode();
+    }
+
+    const CracklePlanObject* findObject(const char* pFilename)
+    {
+        for (size_t i = 0 ; i < m_pPlan->objectCount ; i++)
+        {
+            if (0 == strcmp(pFilename, m_pPlan->pObjects[i].pFilename))
+                return &m_pPlan->pObjects[i];
+        }
+        FAIL("Object wasn't found in plan.");
+        return NULL;
+    }
+
+    void validatePlacement(const char* pFilename, unsigned int sideIndex, unsigned int track, unsigned int offset)
+    {
+        const CracklePlanObject* pObject = findObject(pFilename);
+
+        CHECK_TRUE(pObject->isPlaced);
+        LONGS_EQUAL(sideIndex, pObject->sideIndex);
+        LONGS_EQUAL(track, pObject->track);
+        LONGS_EQUAL(offset, pObject->intraTrackOffset);
+    }
+
+    void writeScript()
+    {
+        // The script is written with fprintf() so the spy has to be out of the way.
+        printfSpy_Unhook();
+        CracklePlan_WriteScript(m_pPlan, g_scriptFilename);
+    }
+
+    void validateScriptFile(const char* pExpected)
+    {
+        size_t      dataSize = 0;
+        const void* pData = MemoryVfs_GetFileData(m_pMemoryVfs, g_scriptFilename, &dataSize);
+
+        CHECK_TRUE(pData != NULL);
+        LONGS_EQUAL(strlen(pExpected), dataSize);
+        CHECK(0 == memcmp(pExpected, pData, dataSize));
+    }
+};
+
+
+TEST(CracklePlan, PlaceLoadsInOrderOnPageBoundariesFromTrack1)
+{
+    addObjectFile("a.bin", 300, 0x11);
+    addObjectFile("b.bin", 256, 0x22);
+    runPlan("# Comment" LINE_ENDING
+            LINE_ENDING
+            "LOAD,a.bin" LINE_ENDING
+            "load,b.bin" LINE_ENDING);
+
+    LONGS_EQUAL(2, m_pPlan->loadCount);
+    LONGS_EQUAL(2, m_pPlan->objectCount);
+    LONGS_EQUAL(300, findObject("a.bin")->length);
+    validatePlacement("a.bin", 0, 1, 0);
+    validatePlacement("b.bin", 0, 1, 512);
+    LONGS_EQUAL(1, m_pPlan->tracksUsed);
+    LONGS_EQUAL(1, m_pPlan->partialTrackCount);
+    LONGS_EQUAL(1, m_pPlan->trackSteps);
+    LONGS_EQUAL(0, m_pPlan->sideChanges);
+
+    writeScript();
+    validateScriptFile("# Planned by crackle --plan from CracklePlanTest.loads: "
+                       "1 track steps and 0 side changes to load.\n"
+                       "RW18,a.bin,0,*,0xa9,1,0\n"
+                       "RW18,b.bin,0,*,0xa9,1,512\n");
+}
+
+TEST(CracklePlan, CoLoadedObjectsTopUpPartialTrackWithLargestObjectWhichFits)
+{
+    addObjectFile("big.bin", 4096, 0x11);
+    addObjectFile("c.bin", 1024, 0x22);
+    addObjectFile("d.bin", 512, 0x33);
+    addObjectFile("e.bin", 256, 0x44);
+    runPlan("LOAD,big.bin" LINE_ENDING
+            "LOAD,c.bin,d.bin,e.bin" LINE_ENDING);
+
+    validatePlacement("big.bin", 0, 1, 0);
+    validatePlacement("d.bin", 0, 1, 4096);
+    validatePlacement("c.bin", 0, 2, 0);
+    validatePlacement("e.bin", 0, 2, 1024);
+    LONGS_EQUAL(2, m_pPlan->tracksUsed);
+    LONGS_EQUAL(1, m_pPlan->partialTrackCount);
+    LONGS_EQUAL(2, m_pPlan->trackSteps);
+}
+
+TEST(CracklePlan, ObjectLargerThanTrackStartsInRemainderWhenThatEndsOnEarlierTrack)
+{
+    addObjectFile("a.bin", 17 * 256, 0x11);
+    addObjectFile("big.bin", 19 * 256, 0x22);
+    runPlan("LOAD,a.bin" LINE_ENDING
+            "LOAD,big.bin" LINE_ENDING);
+
+    validatePlacement("big.bin", 0, 1, 17 * 256);
+    LONGS_EQUAL(2, m_pPlan->tracksUsed);
+    LONGS_EQUAL(0, m_pPlan->partialTrackCount);
+    LONGS_EQUAL(2, m_pPlan->trackSteps);
+}
+
+TEST(CracklePlan, ObjectLargerThanTrackSkipsRemainderWhenItWouldEndOnSameTrackAnyway)
+{
+    addObjectFile("a.bin", 17 * 256, 0x11);
+    addObjectFile("big.bin", 5000, 0x22);
+    runPlan("LOAD,a.bin" LINE_ENDING
+            "LOAD,big.bin" LINE_ENDING);
+
+    validatePlacement("big.bin", 0, 2, 0);
+    LONGS_EQUAL(3, m_pPlan->tracksUsed);
+    LONGS_EQUAL(2, m_pPlan->partialTrackCount);
+    LONGS_EQUAL(3, m_pPlan->trackSteps);
+}
+
+TEST(CracklePlan, CoLoadedObjectsCarryOnAcrossTrackOnceLoadHasStartedOnIt)
+{
+    addObjectFile("boot.bin", 3000, 0x11);
+    addObjectFile("level.bin", 9000, 0x22);
+    addObjectFile("chr1.bin", 700, 0x33);
+    addObjectFile("chr2.bin", 2000, 0x44);
+    runPlan("LOAD,boot.bin" LINE_ENDING
+            "LOAD,level.bin,chr1.bin,chr2.bin" LINE_ENDING);
+
+    validatePlacement("chr1.bin", 0, 1, 3072);
+    validatePlacement("level.bin", 0, 1, 3840);
+    validatePlacement("chr2.bin", 0, 3, 3840);
+    LONGS_EQUAL(4, m_pPlan->tracksUsed);
+    LONGS_EQUAL(1, m_pPlan->partialTrackCount);
+    LONGS_EQUAL(4, m_pPlan->trackSteps);
+}
+
+TEST(CracklePlan, SmallObjectWhichDoesntFitSkipsRestOfTrackRatherThanStraddlingIt)
+{
+    addObjectFile("a.bin", 17 * 256, 0x11);
+    addObjectFile("b.bin", 512, 0x22);
+    runPlan("LOAD,a.bin" LINE_ENDING
+            "LOAD,b.bin" LINE_ENDING);
+
+    validatePlacement("b.bin", 0, 2, 0);
+    LONGS_EQUAL(2, m_pPlan->tracksUsed);
+    LONGS_EQUAL(2, m_pPlan->partialTrackCount);
+    LONGS_EQUAL(2, m_pPlan->trackSteps);
+}
+
+TEST(CracklePlan, ReloadedObjectIsPlacedOnceAndSeekedBackTo)
+{
+    addObjectFile("a.bin", 256, 0x11);
+    addObjectFile("b.bin", DISK_IMAGE_RW18_BYTES_PER_TRACK, 0x22);
+    runPlan("LOAD,a.bin" LINE_ENDING
+            "LOAD,b.bin" LINE_ENDING
+            "LOAD,a.bin,a.bin" LINE_ENDING);
+
+    LONGS_EQUAL(2, m_pPlan->objectCount);
+    LONGS_EQUAL(3, m_pPlan->loadCount);
+    LONGS_EQUAL(1, m_pPlan->pLoads[2].objectIndexCount);
+    validatePlacement("a.bin", 0, 1, 0);
+    validatePlacement("b.bin", 0, 2, 0);
+    LONGS_EQUAL(3, m_pPlan->trackSteps);
+}
+
+TEST(CracklePlan, CoLoadedObjectsAreEstimatedInDiskOrder)
+{
+    addObjectFile("x.bin", DISK_IMAGE_RW18_BYTES_PER_TRACK, 0x11);
+    addObjectFile("y.bin", DISK_IMAGE_RW18_BYTES_PER_TRACK, 0x22);
+    runPlan("LOAD,x.bin,y.bin" LINE_ENDING
+            "LOAD,y.bin,x.bin" LINE_ENDING);
+
+    validatePlacement("x.bin", 0, 1, 0);
+    validatePlacement("y.bin", 0, 2, 0);
+    LONGS_EQUAL(4, m_pPlan->trackSteps);
+}
+
+TEST(CracklePlan, MoveToNextSideOnceTracksAreFull)
+{
+    addObjectFile("a.bin", 4096, 0x11);
+    addObjectFile("b.bin", 1024, 0x22);
+    runPlan("SIDES,0xa9,0xad" LINE_ENDING
+            "TRACKS,1,1" LINE_ENDING
+            "LOAD,a.bin" LINE_ENDING
+            "LOAD,b.bin" LINE_ENDING);
+
+    validatePlacement("a.bin", 0, 1, 0);
+    validatePlacement("b.bin", 1, 1, 0);
+    LONGS_EQUAL(1, m_pPlan->sideChanges);
+    LONGS_EQUAL(1, m_pPlan->trackSteps);
+    LONGS_EQUAL(2, m_pPlan->partialTrackCount);
+
+    writeScript();
+    validateScriptFile("# Planned by crackle --plan from CracklePlanTest.loads: "
+                       "1 track steps and 1 side changes to load.\n"
+                       "RW18,a.bin,0,*,0xa9,1,0\n"
+                       "RW18,b.bin,0,*,0xad,1,0\n");
+}
+
+TEST(CracklePlan, FailWhenObjectsDontFitOnSides)
+{
+    addObjectFile("a.bin", 2 * DISK_IMAGE_RW18_BYTES_PER_TRACK, 0x11);
+    createPlan("TRACKS,0,0" LINE_ENDING
+               "LOAD,a.bin" LINE_ENDING);
+    __try_and_catch( CracklePlan_Run(m_pPlan) );
+    LONGS_EQUAL(invalidTrackException, getExceptionCode());
+    clearExceptionCode();
+    STRCMP_EQUAL("CracklePlanTest.loads:2: error: 'a.bin' object doesn't fit in the tracks left on the sides being "
+                 "planned." LINE_ENDING, printfSpy_GetLastErrorOutput());
+}
+
+TEST(CracklePlan, WrittenScriptBuildsImageWithEachObjectWherePlanned)
+{
+    unsigned char trackData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+    DiskImage*    pDiskImage = (DiskImage*)NibbleDiskImage_Create();
+
+    addObjectFile("a.bin", 300, 0x11);
+    addObjectFile("b.bin", 256, 0x22);
+    runPlan("LOAD,a.bin,b.bin" LINE_ENDING);
+    writeScript();
+
+    DiskImage_SetVfs(pDiskImage, (Vfs*)m_pMemoryVfs);
+    DiskImage_ProcessScriptFile(pDiskImage, g_scriptFilename);
+    LONGS_EQUAL(0, DiskImage_GetScriptErrorCount(pDiskImage));
+    NibbleDiskImage_ReadRW18Track((NibbleDiskImage*)pDiskImage, DISK_IMAGE_RW18_SIDE_0, 1,
+                                  trackData, sizeof(trackData));
+    LONGS_EQUAL(0x11, trackData[0]);
+    LONGS_EQUAL(0x11, trackData[299]);
+    LONGS_EQUAL(0x00, trackData[300]);
+    LONGS_EQUAL(0x22, trackData[512]);
+    LONGS_EQUAL(0x22, trackData[767]);
+    DiskImage_Free(pDiskImage);
+}
+
+TEST(CracklePlan, EmptySequenceWritesScriptWithNoLines)
+{
+    runPlan("");
+    writeScript();
+    validateScriptFile("# Planned by crackle --plan from CracklePlanTest.loads: "
+                       "0 track steps and 0 side changes to load.\n");
+}
+
+TEST(CracklePlan, ReportSeeks)
+{
+    addObjectFile("a.bin", 256, 0x11);
+    runPlan("LOAD,a.bin" LINE_ENDING);
+    CracklePlan_ReportSeeks(m_pPlan);
+    STRCMP_EQUAL("Planned 1 objects for 1 loads onto 1 tracks, 1 of them partially used.\n"
+                 "Estimated head travel: 1 track steps and 0 side changes.\n",
+                 printfSpy_GetLastOutput());
+}
+
+TEST(CracklePlan, ReportEveryInvalidLineBeforeThrowing)
+{
+    validateCreatePlanThrows("BOGUS,a.bin" LINE_ENDING
+                             "SIDES,0xaa" LINE_ENDING
+                             "SIDES,0xa9,0xa9" LINE_ENDING
+                             "TRACKS,5,4" LINE_ENDING
+                             "TRACKS,0,35" LINE_ENDING
+                             "LOAD" LINE_ENDING
+                             "LOAD,a.bin,,b.bin" LINE_ENDING,
+                             invalidArgumentException);
+    LONGS_EQUAL(7, printfSpy_GetCallCount());
+    STRCMP_EQUAL("CracklePlanTest.loads:7: error: objectFilename cannot be blank." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(CracklePlan, ReportUnrecognizedLine)
+{
+    validateCreatePlanThrows("BOGUS,a.bin" LINE_ENDING, invalidArgumentException);
+    STRCMP_EQUAL("CracklePlanTest.loads:1: error: BOGUS isn't a recognized load sequence line of LOAD, SIDES, or "
+                 "TRACKS." LINE_ENDING, printfSpy_GetLastErrorOutput());
+}
+
+TEST(CracklePlan, ReportDuplicateSide)
+{
+    validateCreatePlanThrows("SIDES,0xad,0x79,0xad" LINE_ENDING, invalidArgumentException);
+    STRCMP_EQUAL("CracklePlanTest.loads:1: error: 0xad side is listed more than once." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(CracklePlan, ReportEveryObjectWhichFailsToRead)
+{
+    createPlan("LOAD,missing1.bin" LINE_ENDING
+               "LOAD,missing2.bin" LINE_ENDING);
+    __try_and_catch( CracklePlan_Run(m_pPlan) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+    LONGS_EQUAL(2, printfSpy_GetCallCount());
+    STRCMP_EQUAL("CracklePlanTest.loads:2: error: Failed to read 'missing2.bin' object file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(CracklePlan, FailToOpenSequenceFile)
+{
+    __try_and_catch( m_pPlan = CracklePlan_Create((Vfs*)m_pMemoryVfs, g_sequenceFilename) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    POINTERS_EQUAL(NULL, m_pPlan);
+    clearExceptionCode();
+    STRCMP_EQUAL("error: Failed to open CracklePlanTest.loads load sequence file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(CracklePlan, FailAllAllocationsDuringCreate)
+{
+    static const char sequenceText[] = "SIDES,0xa9,0xad" LINE_ENDING
+                                       "LOAD,a.bin,b.bin" LINE_ENDING
+                                       "LOAD,a.bin" LINE_ENDING;
+    int               allocationToFail = 1;
+
+    addTextFile(g_sequenceFilename, sequenceText);
+    do
+    {
+        MallocFailureInject_FailAllocation(allocationToFail++);
+        __try_and_catch( m_pPlan = CracklePlan_Create((Vfs*)m_pMemoryVfs, g_sequenceFilename) );
+        MallocFailureInject_Restore();
+        if (getExceptionCode() == noException)
+            break;
+        CHECK_TRUE(getExceptionCode() == outOfMemoryException || getExceptionCode() == fileOpenException);
+        POINTERS_EQUAL(NULL, m_pPlan);
+        clearExceptionCode();
+    } while (allocationToFail < 100);
+    CHECK_TRUE(m_pPlan != NULL);
+    LONGS_EQUAL(2, m_pPlan->loadCount);
+    LONGS_EQUAL(2, m_pPlan->objectCount);
+}
@@ -0,0 +1,382 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "CrackleSimulate.h"
+    #include "NibbleDiskImage.h"
+    #include "MemoryVfs.h"
+    #include "MallocFailureInject.h"
+    #include "printfSpy.h"
+    #include "ThreadPool.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+static const char g_nibFilename[] = "CrackleSimulateTest.nib";
+static const char g_traceFilename[] = "CrackleSimulateTest.trace";
+
+static const unsigned int g_rw18Sector5Start = 415;
+static const unsigned int g_rw18SectorNibbles = 1041;
+static const unsigned int g_rw18SectorGapNibbles = 6;
+
+
+TEST_GROUP(CrackleSimulate)
+{
+    CrackleSimulate* m_pSimulate;
+    NibbleDiskImage* m_pNibbleDiskImage;
+    MemoryVfs*       m_pMemoryVfs;
+    unsigned char    m_trackData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+
+    void setup()
+    {
+        clearExceptionCode();
+        printfSpy_Hook(512);
+        ThreadPool_SetThreadCount(1);
+        m_pSimulate = NULL;
+        m_pMemoryVfs = MemoryVfs_Create();
+        m_pNibbleDiskImage = NibbleDiskImage_Create();
+        DiskImage_SetVfs((DiskImage*)m_pNibbleDiskImage, (Vfs*)m_pMemoryVfs);
+        for (size_t i = 0 ; i < sizeof(m_trackData) ; i++)
+            m_trackData[i] = (unsigned char)(i * 7 + (i >> 8));
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        printfSpy_Unhook();
+        ThreadPool_SetThreadCount(0);
+        CrackleSimulate_Free(m_pSimulate);
+        DiskImage_Free((DiskImage*)m_pNibbleDiskImage);
+        Vfs_Free((Vfs*)m_pMemoryVfs);
+    }
+
+    void insertRWTS16Track(unsigned int track)
+    {
+        DiskImageInsert insert;
+
+        memset(&insert, 0, sizeof(insert));
+        insert.type = DISK_IMAGE_INSERTION_RWTS16;
+        insert.length = NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK * DISK_IMAGE_BYTES_PER_SECTOR;
+        insert.track = track;
+        NibbleDiskImage_InsertData(m_pNibbleDiskImage, m_trackData, &insert);
+    }
+
+    void insertRW18Track(unsigned int track, unsigned int side)
+    {
+        DiskImageInsert insert;
+
+        memset(&insert, 0, sizeof(insert));
+        insert.type = DISK_IMAGE_INSERTION_RW18;
+        insert.length = DISK_IMAGE_RW18_BYTES_PER_TRACK;
+        insert.side = side;
+        insert.track = track;
+        NibbleDiskImage_InsertData(m_pNibbleDiskImage, m_trackData, &insert);
+    }
+
+    void writeNibbleImage()
+    {
+        NibbleDiskImage_WriteImage(m_pNibbleDiskImage, g_nibFilename);
+    }
+
+    void createSimulate(const char* pTraceText)
+    {
+        MemoryVfs_AddFile(m_pMemoryVfs, g_traceFilename, pTraceText, strlen(pTraceText));
+        m_pSimulate = CrackleSimulate_Create((Vfs*)m_pMemoryVfs, g_traceFilename, g_nibFilename);
+    }
+
+    void simulate(const char* pTraceText)
+    {
+        createSimulate(pTraceText);
+        CrackleSimulate_Run(m_pSimulate);
+    }
+
+    void validateCreateThrows(const char* pTraceText, int expectedExceptionCode)
+    {
+        __try_and_catch( createSimulate(pTraceText) );
+        LONGS_EQUAL(expectedExceptionCode, getExceptionCode());
+        POINTERS_EQUAL(NULL, m_pSimulate);
+        clearExceptionCode();
+    }
+
+    static unsigned long long nibblesToNs(unsigned int nibbles)
+    {
+        return (unsigned long long)nibbles * CRACKLE_SIMULATE_DEFAULT_ROTATION_US * 1000 / 
+               NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK;
+    }
+
+    static unsigned int rwts16SectorStart(unsigned int sector)
+    {
+        return NIBBLE_DISK_IMAGE_RWTS16_GAP1_SYNC_BYTES + sector * NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR;
+    }
+
+    static unsigned int rwts16SectorEnd(unsigned int sector)
+    {
+        return rwts16SectorStart(sector + 1) - NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES;
+    }
+
+    static unsigned int rw18SectorEnd(unsigned int sector)
+    {
+        return g_rw18Sector5Start + (6 - sector) * g_rw18SectorNibbles - g_rw18SectorGapNibbles;
+    }
+};
+
+
+TEST(CrackleSimulate, ReadOneRWTS16SectorWithoutSeeking)
+{
+    insertRWTS16Track(0);
+    writeNibbleImage();
+
+    simulate("RWTS16,0,0" LINE_ENDING);
+
+    LONGS_EQUAL(1, m_pSimulate->readCount);
+    LONGS_EQUAL(1, m_pSimulate->sectorsRead);
+    LONGS_EQUAL(0, m_pSimulate->quarterTrackSteps);
+    LONGS_EQUAL(0, m_pSimulate->totalTimes.stepNs);
+    LONGS_EQUAL(0, m_pSimulate->totalTimes.settleNs);
+    LONGS_EQUAL(nibblesToNs(rwts16SectorStart(0)), m_pSimulate->totalTimes.waitNs);
+    LONGS_EQUAL(nibblesToNs(rwts16SectorEnd(0)) - nibblesToNs(rwts16SectorStart(0)), m_pSimulate->totalTimes.readNs);
+    LONGS_EQUAL(0, m_pSimulate->totalTimes.processNs);
+    LONGS_EQUAL(nibblesToNs(rwts16SectorEnd(0)), CrackleSimulate_GetTotalNs(&m_pSimulate->totalTimes));
+    LONGS_EQUAL(CrackleSimulate_GetTotalNs(&m_pSimulate->totalTimes), 
+                CrackleSimulate_GetTotalNs(&m_pSimulate->trackTimes[0]));
+}
+
+TEST(CrackleSimulate, WholeTrackIsReadInOneRevolution)
+{
+    insertRWTS16Track(0);
+    writeNibbleImage();
+
+    simulate("# Comment" LINE_ENDING
+             LINE_ENDING
+             "rwts16,0,*" LINE_ENDING);
+
+    LONGS_EQUAL(16, m_pSimulate->sectorsRead);
+    LONGS_EQUAL(CRACKLE_SIMULATE_DEFAULT_ROTATION_US * 1000ULL, CrackleSimulate_GetTotalNs(&m_pSimulate->totalTimes));
+}
+
+TEST(CrackleSimulate, SeekStepsQuarterTracksAndThenSettles)
+{
+    insertRWTS16Track(2);
+    writeNibbleImage();
+
+    simulate("STEP,1000" LINE_ENDING
+             "SETTLE,5000" LINE_ENDING
+             "RWTS16,2,0" LINE_ENDING);
+
+    LONGS_EQUAL(8, m_pSimulate->quarterTrackSteps);
+    LONGS_EQUAL(8000000, m_pSimulate->totalTimes.stepNs);
+    LONGS_EQUAL(5000000, m_pSimulate->totalTimes.settleNs);
+    LONGS_EQUAL(nibblesToNs(rwts16SectorStart(0)) - 13000000, m_pSimulate->totalTimes.waitNs);
+    LONGS_EQUAL(8000000, m_pSimulate->trackTimes[2].stepNs);
+}
+
+TEST(CrackleSimulate, ProcessingPastTheNextSectorCostsARevolution)
+{
+    insertRWTS16Track(0);
+    writeNibbleImage();
+
+    simulate("RWTS16,0,0" LINE_ENDING
+             "PROCESS,2000" LINE_ENDING
+             "RWTS16,0,1" LINE_ENDING
+             "RWTS16,0,2" LINE_ENDING);
+
+    LONGS_EQUAL(4000000, m_pSimulate->totalTimes.processNs);
+    LONGS_EQUAL(nibblesToNs(rwts16SectorStart(0)) + 
+                (nibblesToNs(rwts16SectorStart(1)) - nibblesToNs(rwts16SectorEnd(0))) + 
+                (nibblesToNs(rwts16SectorStart(2)) + CRACKLE_SIMULATE_DEFAULT_ROTATION_US * 1000ULL - 
+                 nibblesToNs(rwts16SectorEnd(1)) - 2000000),
+                m_pSimulate->totalTimes.waitNs);
+}
+
+TEST(CrackleSimulate, RW18PagesAreReadWithTheRestOfTheirSector)
+{
+    insertRW18Track(1, 0xa9);
+    writeNibbleImage();
+
+    simulate("ROTATION,200000" LINE_ENDING
+             "RW18,0xa9,1,7" LINE_ENDING
+             "RW18,0xa9,1,1" LINE_ENDING);
+
+    LONGS_EQUAL(2, m_pSimulate->readCount);
+    LONGS_EQUAL(0x02, m_pSimulate->pReads[0].sectorMask);
+    LONGS_EQUAL(2, m_pSimulate->sectorsRead);
+    LONGS_EQUAL(4, m_pSimulate->quarterTrackSteps);
+    LONGS_EQUAL(4 * CRACKLE_SIMULATE_DEFAULT_STEP_US * 1000ULL, m_pSimulate->totalTimes.stepNs);
+    LONGS_EQUAL(CRACKLE_SIMULATE_DEFAULT_SETTLE_US * 1000ULL, m_pSimulate->totalTimes.settleNs);
+    LONGS_EQUAL(CRACKLE_SIMULATE_DEFAULT_ROTATION_US * 1000ULL + nibblesToNs(rw18SectorEnd(1)),
+                CrackleSimulate_GetTotalNs(&m_pSimulate->totalTimes));
+}
+
+TEST(CrackleSimulate, WholeRW18TrackReadsSixSectors)
+{
+    insertRW18Track(0, 0xad);
+    writeNibbleImage();
+
+    simulate("RW18,0xad,0,*" LINE_ENDING);
+
+    LONGS_EQUAL(0x3f, m_pSimulate->pReads[0].sectorMask);
+    LONGS_EQUAL(6, m_pSimulate->sectorsRead);
+    LONGS_EQUAL(nibblesToNs(NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK - 1), 
+                CrackleSimulate_GetTotalNs(&m_pSimulate->totalTimes));
+}
+
+TEST(CrackleSimulate, CheckBudget)
+{
+    insertRWTS16Track(0);
+    writeNibbleImage();
+
+    simulate("BUDGET,200000" LINE_ENDING
+             "RWTS16,0,*" LINE_ENDING);
+    CHECK_FALSE(CrackleSimulate_IsOverBudget(m_pSimulate));
+    CrackleSimulate_Free(m_pSimulate);
+    m_pSimulate = NULL;
+
+    simulate("BUDGET,199999" LINE_ENDING
+             "RWTS16,0,*" LINE_ENDING);
+    CHECK_TRUE(CrackleSimulate_IsOverBudget(m_pSimulate));
+}
+
+TEST(CrackleSimulate, NoBudgetIsNeverExceeded)
+{
+    insertRWTS16Track(0);
+    writeNibbleImage();
+
+    simulate("RWTS16,0,*" LINE_ENDING);
+    CHECK_FALSE(CrackleSimulate_IsOverBudget(m_pSimulate));
+}
+
+TEST(CrackleSimulate, ReportTimes)
+{
+    insertRWTS16Track(0);
+    writeNibbleImage();
+    simulate("BUDGET,100000" LINE_ENDING
+             "RWTS16,0,*" LINE_ENDING);
+
+    CrackleSimulate_ReportTimes(m_pSimulate);
+
+    LONGS_EQUAL(8, printfSpy_GetCallCount());
+    STRCMP_EQUAL("Over the 100.000 ms budget by 100.000 ms.\n", printfSpy_GetLastOutput());
+}
+
+TEST(CrackleSimulate, ReportEveryInvalidLineBeforeThrowing)
+{
+    insertRWTS16Track(0);
+    insertRW18Track(1, 0xa9);
+    writeNibbleImage();
+
+    validateCreateThrows("SEEK,100" LINE_ENDING
+                         "RWTS16,0" LINE_ENDING
+                         "RWTS16,35,0" LINE_ENDING
+                         "RWTS16,0,16" LINE_ENDING
+                         "RW18,0xa9,1,18" LINE_ENDING
+                         "STEP,1x" LINE_ENDING
+                         "ROTATION,0" LINE_ENDING
+                         "RWTS16,1,0" LINE_ENDING
+                         "RW18,0xad,1,0" LINE_ENDING
+                         "RW18,0xa9,2,*" LINE_ENDING,
+                         invalidArgumentException);
+    LONGS_EQUAL(10, printfSpy_GetCallCount());
+    STRCMP_EQUAL("CrackleSimulateTest.trace:10: error: Track 2 of CrackleSimulateTest.nib isn't an RW18 track of side 0xa9."
+                 LINE_ENDING, printfSpy_GetLastErrorOutput());
+}
+
+TEST(CrackleSimulate, ReportUnknownLineType)
+{
+    insertRWTS16Track(0);
+    writeNibbleImage();
+
+    validateCreateThrows("SEEK,100" LINE_ENDING, invalidArgumentException);
+    STRCMP_EQUAL("CrackleSimulateTest.trace:1: error: SEEK isn't a recognized read trace line of RWTS16, RW18, STEP, "
+                 "SETTLE, ROTATION, PROCESS, or BUDGET." LINE_ENDING, printfSpy_GetLastErrorOutput());
+}
+
+TEST(CrackleSimulate, ReportZeroRotation)
+{
+    insertRWTS16Track(0);
+    writeNibbleImage();
+
+    validateCreateThrows("rotation,0" LINE_ENDING, invalidArgumentException);
+    STRCMP_EQUAL("CrackleSimulateTest.trace:1: error: Line should be of the form rotation,microseconds with "
+                 "microseconds greater than 0." LINE_ENDING, printfSpy_GetLastErrorOutput());
+}
+
+TEST(CrackleSimulate, ReportSectorWhichDidNotDecode)
+{
+    unsigned char* pImage;
+    size_t         imageSize = 0;
+
+    insertRWTS16Track(0);
+    writeNibbleImage();
+    pImage = (unsigned char*)MemoryVfs_GetFileData(m_pMemoryVfs, g_nibFilename, &imageSize);
+    pImage[rwts16SectorStart(3) + 100] = pImage[rwts16SectorStart(3) + 100] == 0x96 ? 0x97 : 0x96;
+
+    validateCreateThrows("RWTS16,0,2" LINE_ENDING
+                         "RWTS16,0,*" LINE_ENDING, invalidArgumentException);
+    LONGS_EQUAL(1, printfSpy_GetCallCount());
+    STRCMP_EQUAL("CrackleSimulateTest.trace:2: error: Sector 3 of track 0 in CrackleSimulateTest.nib didn't decode."
+                 LINE_ENDING, printfSpy_GetLastErrorOutput());
+}
+
+TEST(CrackleSimulate, FailToOpenTraceFile)
+{
+    insertRWTS16Track(0);
+    writeNibbleImage();
+
+    __try_and_catch( m_pSimulate = CrackleSimulate_Create((Vfs*)m_pMemoryVfs, g_traceFilename, g_nibFilename) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    POINTERS_EQUAL(NULL, m_pSimulate);
+    clearExceptionCode();
+    STRCMP_EQUAL("error: Failed to open CrackleSimulateTest.trace read trace file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(CrackleSimulate, FailToSimulateBlockImage)
+{
+    unsigned char image[2 * DISK_IMAGE_BLOCK_SIZE];
+
+    memset(image, 0, sizeof(image));
+    MemoryVfs_AddFile(m_pMemoryVfs, g_nibFilename, image, sizeof(image));
+
+    validateCreateThrows("RWTS16,0,0" LINE_ENDING, fileException);
+    STRCMP_EQUAL("error: CrackleSimulateTest.nib isn't a .nib image." LINE_ENDING, printfSpy_GetLastErrorOutput());
+}
+
+TEST(CrackleSimulate, FailAllAllocationsDuringCreate)
+{
+    static const char traceText[] = "RWTS16,0,0" LINE_ENDING
+                                    "RWTS16,0,1" LINE_ENDING;
+    int               allocationToFail = 1;
+
+    insertRWTS16Track(0);
+    writeNibbleImage();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_traceFilename, traceText, strlen(traceText));
+    do
+    {
+        MallocFailureInject_FailAllocation(allocationToFail++);
+        __try_and_catch( m_pSimulate = CrackleSimulate_Create((Vfs*)m_pMemoryVfs, g_traceFilename, g_nibFilename) );
+        MallocFailureInject_Restore();
+        if (getExceptionCode() == noException)
+            break;
+        CHECK_TRUE(getExceptionCode() == outOfMemoryException || getExceptionCode() == fileOpenException);
+        POINTERS_EQUAL(NULL, m_pSimulate);
+        clearExceptionCode();
+    } while (allocationToFail < 100);
+    CHECK_TRUE(m_pSimulate != NULL);
+    LONGS_EQUAL(2, m_pSimulate->readCount);
+}
@@ -0,0 +1,231 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "DiskImageCompress.h"
+    #include "MallocFailureInject.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+TEST_GROUP(DiskImageCompress)
+{
+    ByteBuffer     m_compressed;
+    ByteBuffer     m_decompressed;
+    unsigned char* m_pData;
+    unsigned int   m_compressedSize;
+
+    void setup()
+    {
+        clearExceptionCode();
+        memset(&m_compressed, 0, sizeof(m_compressed));
+        memset(&m_decompressed, 0, sizeof(m_decompressed));
+        m_pData = NULL;
+        m_compressedSize = 0;
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        ByteBuffer_Free(&m_compressed);
+        ByteBuffer_Free(&m_decompressed);
+        free(m_pData);
+    }
+
+    unsigned char* allocateData(unsigned int size)
+    {
+        m_pData = (unsigned char*)malloc(size ? size : 1);
+        CHECK_TRUE(m_pData != NULL);
+        return m_pData;
+    }
+
+    void fillWithRandomBytes(unsigned char* pData, unsigned int size)
+    {
+        unsigned int seed = 0x12345678;
+
+        for (unsigned int i = 0 ; i < size ; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            pData[i] = (unsigned char)(seed >> 16);
+        }
+    }
+
+    void validateRoundTrip(const unsigned char* pData, unsigned int size)
+    {
+        unsigned int decompressedSize;
+
+        m_compressedSize = DiskImageCompress_Compress(&m_compressed, pData, size);
+        CHECK_TRUE(m_compressedSize <= DiskImageCompress_GetMaxCompressedSize(size));
+        LONGS_EQUAL(0x00, m_compressed.pBuffer[m_compressedSize - 1]);
+        decompressedSize = DiskImageCompress_Decompress(&m_decompressed, m_compressed.pBuffer, m_compressedSize);
+        LONGS_EQUAL(size, decompressedSize);
+        CHECK_TRUE(0 == memcmp(pData, m_decompressed.pBuffer, size));
+    }
+
+    void validateCompressed(const char* pData, const unsigned char* pExpected, unsigned int expectedSize)
+    {
+        validateRoundTrip((const unsigned char*)pData, strlen(pData));
+        LONGS_EQUAL(expectedSize, m_compressedSize);
+        CHECK_TRUE(0 == memcmp(pExpected, m_compressed.pBuffer, expectedSize));
+    }
+
+    void validateDecompressThrows(const unsigned char* pData, unsigned int size)
+    {
+        __try_and_catch( DiskImageCompress_Decompress(&m_decompressed, pData, size) );
+        LONGS_EQUAL(fileException, getExceptionCode());
+        POINTERS_EQUAL(NULL, m_decompressed.pBuffer);
+        clearExceptionCode();
+    }
+};
+
+
+TEST(DiskImageCompress, MaxCompressedSizeAllowsForLiteralTokensAndEnd)
+{
+    LONGS_EQUAL(1, DiskImageCompress_GetMaxCompressedSize(0));
+    LONGS_EQUAL(3, DiskImageCompress_GetMaxCompressedSize(1));
+    LONGS_EQUAL(129, DiskImageCompress_GetMaxCompressedSize(127));
+    LONGS_EQUAL(131, DiskImageCompress_GetMaxCompressedSize(128));
+}
+
+TEST(DiskImageCompress, CompressEmptyInputToJustEndToken)
+{
+    static const unsigned char expected[] = { 0x00 };
+    validateCompressed("", expected, sizeof(expected));
+}
+
+TEST(DiskImageCompress, CompressSingleByteAsLiteral)
+{
+    static const unsigned char expected[] = { 0x01, 'a', 0x00 };
+    validateCompressed("a", expected, sizeof(expected));
+}
+
+TEST(DiskImageCompress, CompressRunAsOverlappingMatch)
+{
+    static const unsigned char expected[] = { 0x01, 'a', 0x82, 0x01, 0x00, 0x00 };
+    validateCompressed("aaaaaa", expected, sizeof(expected));
+}
+
+TEST(DiskImageCompress, LeaveThreeByteRepeatAsLiterals)
+{
+    static const unsigned char expected[] = { 0x06, 'a', 'b', 'c', 'a', 'b', 'c', 0x00 };
+    validateCompressed("abcabc", expected, sizeof(expected));
+}
+
+TEST(DiskImageCompress, CompressRepeatedText)
+{
+    static const unsigned char expected[] = { 0x05, 'a', 'b', 'c', 'd', ' ', 0x86, 0x05, 0x00, 0x00 };
+    validateCompressed("abcd abcd abcd", expected, sizeof(expected));
+}
+
+TEST(DiskImageCompress, RoundTripLongRunUsesMaximumMatchLength)
+{
+    unsigned char* pData = allocateData(1000);
+    memset(pData, 0xa5, 1000);
+    validateRoundTrip(pData, 1000);
+    LONGS_EQUAL(0xff, m_compressed.pBuffer[2]);
+    CHECK_TRUE(m_compressedSize < 30);
+}
+
+TEST(DiskImageCompress, RoundTripRandomDataSplitsLiteralRuns)
+{
+    unsigned char* pData = allocateData(1000);
+    fillWithRandomBytes(pData, 1000);
+    validateRoundTrip(pData, 1000);
+    LONGS_EQUAL(DiskImageCompress_GetMaxCompressedSize(1000), m_compressedSize);
+    LONGS_EQUAL(0x7f, m_compressed.pBuffer[0]);
+}
+
+TEST(DiskImageCompress, RoundTripLiteralRunBoundaries)
+{
+    unsigned char* pData = allocateData(255);
+    fillWithRandomBytes(pData, 255);
+    for (unsigned int size = 126 ; size <= 129 ; size++)
+    {
+        validateRoundTrip(pData, size);
+        ByteBuffer_Free(&m_compressed);
+        ByteBuffer_Free(&m_decompressed);
+    }
+    validateRoundTrip(pData, 254);
+}
+
+TEST(DiskImageCompress, RoundTripRepeatsFurtherApartThanMaximumDistance)
+{
+    unsigned int   size = 3 * 0x10000;
+    unsigned char* pData = allocateData(size);
+    fillWithRandomBytes(pData, 0x10000);
+    memcpy(pData + 0x10000, pData, 0x10000);
+    memcpy(pData + 0x20000, pData + 0x8000, 0x10000);
+    validateRoundTrip(pData, size);
+    CHECK_TRUE(m_compressedSize < size);
+}
+
+TEST(DiskImageCompress, RoundTripCodeLikeData)
+{
+    static const char text[] = "        LDA #$00" LINE_ENDING
+                               "        STA $C000" LINE_ENDING
+                               "        LDA #$01" LINE_ENDING
+                               "        STA $C001" LINE_ENDING
+                               "        JSR $FDED" LINE_ENDING;
+    validateRoundTrip((const unsigned char*)text, sizeof(text) - 1);
+    CHECK_TRUE(m_compressedSize < sizeof(text) - 1);
+}
+
+TEST(DiskImageCompress, DecompressRejectsMalformedStreams)
+{
+    static const unsigned char missingEnd[] = { 0x01, 'a' };
+    static const unsigned char truncatedLiteral[] = { 0x03, 'a', 'b' };
+    static const unsigned char truncatedMatch[] = { 0x01, 'a', 0x80, 0x01 };
+    static const unsigned char zeroDistance[] = { 0x01, 'a', 0x80, 0x00, 0x00, 0x00 };
+    static const unsigned char distanceBeforeStart[] = { 0x01, 'a', 0x80, 0x02, 0x00, 0x00 };
+    static const unsigned char trailingBytes[] = { 0x01, 'a', 0x00, 0x00 };
+
+    validateDecompressThrows(missingEnd, 0);
+    validateDecompressThrows(missingEnd, sizeof(missingEnd));
+    validateDecompressThrows(truncatedLiteral, sizeof(truncatedLiteral));
+    validateDecompressThrows(truncatedMatch, sizeof(truncatedMatch));
+    validateDecompressThrows(zeroDistance, sizeof(zeroDistance));
+    validateDecompressThrows(distanceBeforeStart, sizeof(distanceBeforeStart));
+    validateDecompressThrows(trailingBytes, sizeof(trailingBytes));
+}
+
+TEST(DiskImageCompress, FailAllocationsDuringCompress)
+{
+    static const unsigned char data[] = "abcdabcdabcd";
+
+    for (int allocationToFail = 1 ; allocationToFail <= 3 ; allocationToFail++)
+    {
+        MallocFailureInject_FailAllocation(allocationToFail);
+        __try_and_catch( DiskImageCompress_Compress(&m_compressed, data, sizeof(data)) );
+        MallocFailureInject_Restore();
+        LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+        POINTERS_EQUAL(NULL, m_compressed.pBuffer);
+        clearExceptionCode();
+    }
+}
+
+TEST(DiskImageCompress, FailAllocationDuringDecompress)
+{
+    static const unsigned char compressed[] = { 0x01, 'a', 0x00 };
+
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( DiskImageCompress_Decompress(&m_decompressed, compressed, sizeof(compressed)) );
+    LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+    clearExceptionCode();
+}
@@ -0,0 +1,356 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "DiskImageDelta.h"
+    #include "DiskImageManifest.h"
+    #include "MemoryVfs.h"
+    #include "MallocFailureInject.h"
+    #include "printfSpy.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+static const char g_deltaFilename[] = "DiskImageDeltaTest.delta";
+static const char g_imageFilename[] = "DiskImageDeltaTest.hdv";
+
+#define REGION_SIZE 512
+#define REGION_COUNT 4
+#define IMAGE_SIZE (REGION_SIZE * REGION_COUNT)
+
+
+TEST_GROUP(DiskImageDelta)
+{
+    DiskImageDelta m_delta;
+    DiskImageDelta m_readDelta;
+    MemoryVfs*     m_pMemoryVfs;
+    unsigned char  m_base[IMAGE_SIZE];
+    unsigned char  m_image[IMAGE_SIZE];
+
+    void setup()
+    {
+        clearExceptionCode();
+        printfSpy_Hook(512);
+        memset(&m_delta, 0, sizeof(m_delta));
+        memset(&m_readDelta, 0, sizeof(m_readDelta));
+        m_pMemoryVfs = MemoryVfs_Create();
+        for (size_t i = 0 ; i < sizeof(m_base) ; i++)
+            m_base[i] = (unsigned char)(i * 7 + (i >> 8));
+        memcpy(m_image, m_base, sizeof(m_image));
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        printfSpy_Unhook();
+        DiskImageDelta_Free(&m_delta);
+        DiskImageDelta_Free(&m_readDelta);
+        Vfs_Free((Vfs*)m_pMemoryVfs);
+    }
+
+    void compute()
+    {
+        DiskImageDelta_Compute(&m_delta, m_base, m_image, IMAGE_SIZE, REGION_SIZE);
+    }
+
+    DiskImageDeltaRun getRun(unsigned int index, const unsigned char** ppData)
+    {
+        const unsigned char* pCurr = m_delta.pRuns;
+        DiskImageDeltaRun    run;
+
+        for (unsigned int i = 0 ; i <= index ; i++)
+        {
+            memcpy(&run, pCurr, sizeof(run));
+            *ppData = pCurr + sizeof(run);
+            pCurr += sizeof(run) + run.length;
+        }
+        return run;
+    }
+
+    void validateRun(unsigned int index, unsigned int region, unsigned int offset, unsigned int length)
+    {
+        const unsigned char* pData = NULL;
+        DiskImageDeltaRun    run = getRun(index, &pData);
+
+        LONGS_EQUAL(region, run.region);
+        LONGS_EQUAL(offset, run.offset);
+        LONGS_EQUAL(length, run.length);
+        CHECK(0 == memcmp(m_image + region * REGION_SIZE + offset, pData, length));
+    }
+
+    void applyToBase()
+    {
+        DiskImageDelta_Apply(&m_delta, m_base, IMAGE_SIZE);
+        CHECK(0 == memcmp(m_image, m_base, IMAGE_SIZE));
+    }
+
+    void addDeltaFile(const void* pHeader, size_t headerSize, const void* pRuns, size_t runsSize)
+    {
+        unsigned char file[256];
+
+        CHECK(headerSize + runsSize <= sizeof(file));
+        memcpy(file, pHeader, headerSize);
+        memcpy(file + headerSize, pRuns, runsSize);
+        MemoryVfs_AddFile(m_pMemoryVfs, g_deltaFilename, file, headerSize + runsSize);
+    }
+
+    void validateReadThrows(int expectedExceptionCode)
+    {
+        __try_and_catch( DiskImageDelta_Read(&m_readDelta, (Vfs*)m_pMemoryVfs, g_deltaFilename) );
+        LONGS_EQUAL(expectedExceptionCode, getExceptionCode());
+        POINTERS_EQUAL(NULL, m_readDelta.pRuns);
+        clearExceptionCode();
+    }
+};
+
+
+TEST(DiskImageDelta, IdenticalImagesHaveNoRuns)
+{
+    compute();
+    CHECK(0 == memcmp(DISK_IMAGE_DELTA_SIGNATURE, m_delta.header.signature, sizeof(m_delta.header.signature)));
+    LONGS_EQUAL(IMAGE_SIZE, m_delta.header.imageSize);
+    LONGS_EQUAL(REGION_SIZE, m_delta.header.regionSize);
+    LONGS_EQUAL(0, m_delta.header.runCount);
+    LONGS_EQUAL(0, m_delta.changedByteCount);
+    CHECK(m_delta.header.baseHash == m_delta.header.imageHash);
+    CHECK(DiskImageManifest_Hash(DISK_IMAGE_MANIFEST_HASH_SEED, m_base, IMAGE_SIZE) == m_delta.header.baseHash);
+    applyToBase();
+}
+
+TEST(DiskImageDelta, SingleChangedByte)
+{
+    m_image[REGION_SIZE + 5] ^= 0xff;
+    compute();
+    LONGS_EQUAL(1, m_delta.header.runCount);
+    LONGS_EQUAL(1, m_delta.changedByteCount);
+    validateRun(0, 1, 5, 1);
+    applyToBase();
+}
+
+TEST(DiskImageDelta, ChangesSeparatedByShortGapShareARun)
+{
+    m_image[10] ^= 0xff;
+    m_image[10 + sizeof(DiskImageDeltaRun)] ^= 0xff;
+    compute();
+    LONGS_EQUAL(1, m_delta.header.runCount);
+    validateRun(0, 0, 10, sizeof(DiskImageDeltaRun) + 1);
+    applyToBase();
+}
+
+TEST(DiskImageDelta, ChangesSeparatedByLongGapGetTheirOwnRuns)
+{
+    m_image[10] ^= 0xff;
+    m_image[10 + sizeof(DiskImageDeltaRun) + 1] ^= 0xff;
+    compute();
+    LONGS_EQUAL(2, m_delta.header.runCount);
+    validateRun(0, 0, 10, 1);
+    validateRun(1, 0, 10 + sizeof(DiskImageDeltaRun) + 1, 1);
+    applyToBase();
+}
+
+TEST(DiskImageDelta, RunsDontCrossRegions)
+{
+    memset(m_image + REGION_SIZE - 3, 0xa5, 6);
+    m_image[IMAGE_SIZE - 1] ^= 0xff;
+    compute();
+    LONGS_EQUAL(3, m_delta.header.runCount);
+    validateRun(0, 0, REGION_SIZE - 3, 3);
+    validateRun(1, 1, 0, 3);
+    validateRun(2, REGION_COUNT - 1, REGION_SIZE - 1, 1);
+    applyToBase();
+}
+
+TEST(DiskImageDelta, EveryByteChanged)
+{
+    for (size_t i = 0 ; i < sizeof(m_image) ; i++)
+        m_image[i] ^= 0x01;
+    compute();
+    LONGS_EQUAL(REGION_COUNT, m_delta.header.runCount);
+    LONGS_EQUAL(IMAGE_SIZE, m_delta.changedByteCount);
+    for (unsigned int i = 0 ; i < REGION_COUNT ; i++)
+        validateRun(i, i, 0, REGION_SIZE);
+    applyToBase();
+}
+
+TEST(DiskImageDelta, ComputeWithInvalidRegionSize)
+{
+    __try_and_catch( DiskImageDelta_Compute(&m_delta, m_base, m_image, IMAGE_SIZE, 0) );
+    LONGS_EQUAL(invalidArgumentException, getExceptionCode());
+    clearExceptionCode();
+    __try_and_catch( DiskImageDelta_Compute(&m_delta, m_base, m_image, IMAGE_SIZE, 500) );
+    LONGS_EQUAL(invalidArgumentException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(DiskImageDelta, FailAllocationDuringCompute)
+{
+    m_image[0] ^= 0xff;
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( compute() );
+    LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+    POINTERS_EQUAL(NULL, m_delta.pRuns);
+    LONGS_EQUAL(0, m_delta.header.runCount);
+    clearExceptionCode();
+}
+
+TEST(DiskImageDelta, ApplyToWrongBaseImageLeavesItUntouched)
+{
+    unsigned char other[IMAGE_SIZE];
+
+    m_image[100] ^= 0xff;
+    compute();
+    memcpy(other, m_base, sizeof(other));
+    other[1000] ^= 0xff;
+    __try_and_catch( DiskImageDelta_Apply(&m_delta, other, sizeof(other)) );
+    LONGS_EQUAL(fileException, getExceptionCode());
+    clearExceptionCode();
+    LONGS_EQUAL(m_base[100], other[100]);
+    __try_and_catch( DiskImageDelta_Apply(&m_delta, m_base, IMAGE_SIZE - REGION_SIZE) );
+    LONGS_EQUAL(fileException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(DiskImageDelta, WriteAndReadBack)
+{
+    m_image[3] ^= 0xff;
+    m_image[2 * REGION_SIZE + 7] ^= 0xff;
+    compute();
+
+    DiskImageDelta_Write(&m_delta, (Vfs*)m_pMemoryVfs, g_deltaFilename);
+    DiskImageDelta_Read(&m_readDelta, (Vfs*)m_pMemoryVfs, g_deltaFilename);
+
+    CHECK(0 == memcmp(&m_delta.header, &m_readDelta.header, sizeof(m_delta.header)));
+    LONGS_EQUAL(m_delta.runsSize, m_readDelta.runsSize);
+    LONGS_EQUAL(2, m_readDelta.changedByteCount);
+    CHECK(0 == memcmp(m_delta.pRuns, m_readDelta.pRuns, m_delta.runsSize));
+    DiskImageDelta_Apply(&m_readDelta, m_base, IMAGE_SIZE);
+    CHECK(0 == memcmp(m_image, m_base, IMAGE_SIZE));
+}
+
+TEST(DiskImageDelta, DeltaFileOnlyHoldsChangedBytes)
+{
+    size_t deltaSize = 0;
+
+    m_image[3] ^= 0xff;
+    compute();
+    DiskImageDelta_Write(&m_delta, (Vfs*)m_pMemoryVfs, g_deltaFilename);
+    MemoryVfs_GetFileData(m_pMemoryVfs, g_deltaFilename, &deltaSize);
+    LONGS_EQUAL(sizeof(DiskImageDeltaHeader) + sizeof(DiskImageDeltaRun) + 1, deltaSize);
+}
+
+TEST(DiskImageDelta, ApplyToImageFileOnlyRewritesRuns)
+{
+    size_t               imageSize = 0;
+    const unsigned char* pImage;
+
+    m_image[REGION_SIZE] ^= 0xff;
+    compute();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_imageFilename, m_base, sizeof(m_base));
+
+    DiskImageDelta_ApplyToImageFile(&m_delta, (Vfs*)m_pMemoryVfs, g_imageFilename);
+
+    pImage = (const unsigned char*)MemoryVfs_GetFileData(m_pMemoryVfs, g_imageFilename, &imageSize);
+    LONGS_EQUAL(IMAGE_SIZE, imageSize);
+    CHECK(0 == memcmp(m_image, pImage, IMAGE_SIZE));
+}
+
+TEST(DiskImageDelta, ApplyToImageFileOfWrongImage)
+{
+    size_t               imageSize = 0;
+    const unsigned char* pImage;
+
+    m_image[REGION_SIZE] ^= 0xff;
+    compute();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_imageFilename, m_image, sizeof(m_image));
+
+    __try_and_catch( DiskImageDelta_ApplyToImageFile(&m_delta, (Vfs*)m_pMemoryVfs, g_imageFilename) );
+    LONGS_EQUAL(fileException, getExceptionCode());
+    clearExceptionCode();
+    STRCMP_EQUAL("error: DiskImageDeltaTest.hdv isn't the image the delta was computed from." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    pImage = (const unsigned char*)MemoryVfs_GetFileData(m_pMemoryVfs, g_imageFilename, &imageSize);
+    CHECK(0 == memcmp(m_image, pImage, IMAGE_SIZE));
+}
+
+TEST(DiskImageDelta, ApplyToMissingImageFile)
+{
+    compute();
+    __try_and_catch( DiskImageDelta_ApplyToImageFile(&m_delta, (Vfs*)m_pMemoryVfs, g_imageFilename) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+    STRCMP_EQUAL("error: Failed to open DiskImageDeltaTest.hdv image file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(DiskImageDelta, ReadMissingDeltaFile)
+{
+    validateReadThrows(fileOpenException);
+    STRCMP_EQUAL("error: Failed to open DiskImageDeltaTest.delta delta file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+}
+
+TEST(DiskImageDelta, ReadMalformedDeltaFiles)
+{
+    DiskImageDeltaHeader header;
+    DiskImageDeltaRun    run;
+    unsigned char        runData[sizeof(run) + 4];
+
+    compute();
+    header = m_delta.header;
+    header.runCount = 1;
+    run.region = 0;
+    run.offset = 0;
+    run.length = 4;
+    memcpy(runData, &run, sizeof(run));
+    memset(runData + sizeof(run), 0, 4);
+
+    addDeltaFile(&header, sizeof(header) - 1, NULL, 0);
+    validateReadThrows(fileException);
+    STRCMP_EQUAL("error: DiskImageDeltaTest.delta isn't a valid delta file." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    addDeltaFile(&header, sizeof(header), runData, sizeof(runData) - 1);
+    validateReadThrows(fileException);
+    addDeltaFile(&header, sizeof(header), runData, sizeof(run) - 1);
+    validateReadThrows(fileException);
+    header.runCount = 0;
+    addDeltaFile(&header, sizeof(header), runData, sizeof(runData));
+    validateReadThrows(fileException);
+    header.runCount = 1;
+    run.region = REGION_COUNT;
+    memcpy(runData, &run, sizeof(run));
+    addDeltaFile(&header, sizeof(header), runData, sizeof(runData));
+    validateReadThrows(fileException);
+    run.region = 0;
+    run.offset = REGION_SIZE - 3;
+    memcpy(runData, &run, sizeof(run));
+    addDeltaFile(&header, sizeof(header), runData, sizeof(runData));
+    validateReadThrows(fileException);
+    header.signature[0] = 'X';
+    addDeltaFile(&header, sizeof(header), NULL, 0);
+    validateReadThrows(fileException);
+}
+
+TEST(DiskImageDelta, FailOpeningDeltaForWrite)
+{
+    compute();
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( DiskImageDelta_Write(&m_delta, (Vfs*)m_pMemoryVfs, g_deltaFilename) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
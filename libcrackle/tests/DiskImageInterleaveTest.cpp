@@ -0,0 +1,193 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "DiskImageInterleave.h"
+    #include "NibbleDiskImage.h"
+    #include "printfSpy.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+static const unsigned int g_revolutionCycles = NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * 
+                                               DISK_IMAGE_INTERLEAVE_CYCLES_PER_NIBBLE;
+static const unsigned int g_sectorSlotCycles = NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR * 
+                                               DISK_IMAGE_INTERLEAVE_CYCLES_PER_NIBBLE;
+static const unsigned int g_sectorReadCycles = (NIBBLE_DISK_IMAGE_RWTS16_NIBBLES_PER_SECTOR - 
+                                                NIBBLE_DISK_IMAGE_RWTS16_GAP3_SYNC_BYTES) *
+                                               DISK_IMAGE_INTERLEAVE_CYCLES_PER_NIBBLE;
+
+
+TEST_GROUP(DiskImageInterleave)
+{
+    DiskImageInterleave m_interleave;
+    char                m_table[DISK_IMAGE_INTERLEAVE_FORMAT_SIZE];
+    
+    void setup()
+    {
+        clearExceptionCode();
+        printfSpy_Hook(128);
+        memset(&m_interleave, 0xff, sizeof(m_interleave));
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        printfSpy_Unhook();
+    }
+    
+    void parse(const char* pSpec)
+    {
+        SizedString spec = SizedString_InitFromString(pSpec);
+        
+        DiskImageInterleave_Parse(&m_interleave, &spec);
+    }
+    
+    void validateParseThrows(const char* pSpec)
+    {
+        DiskImageInterleave original = m_interleave;
+        
+        __try_and_catch( parse(pSpec) );
+        LONGS_EQUAL(invalidArgumentException, getExceptionCode());
+        CHECK(0 == memcmp(&original, &m_interleave, sizeof(original)));
+        clearExceptionCode();
+    }
+    
+    const char* format()
+    {
+        DiskImageInterleave_Format(&m_interleave, m_table);
+        return m_table;
+    }
+};
+
+
+TEST(DiskImageInterleave, InitIdentity)
+{
+    DiskImageInterleave_InitIdentity(&m_interleave);
+    STRCMP_EQUAL("0123456789abcdef", format());
+    CHECK_TRUE(DiskImageInterleave_IsIdentity(&m_interleave));
+}
+
+TEST(DiskImageInterleave, ParseNamedInterleavesIgnoringCase)
+{
+    parse("DOS3.3");
+    STRCMP_EQUAL("0db97531eca8642f", format());
+    CHECK_FALSE(DiskImageInterleave_IsIdentity(&m_interleave));
+    parse("ProDOS");
+    STRCMP_EQUAL("02468ace13579bdf", format());
+    parse("identity");
+    CHECK_TRUE(DiskImageInterleave_IsIdentity(&m_interleave));
+}
+
+TEST(DiskImageInterleave, ParseSkews)
+{
+    parse("skew:3");
+    STRCMP_EQUAL("0369cf258be147ad", format());
+    parse("SKEW:0xf");
+    STRCMP_EQUAL("0fedcba987654321", format());
+    parse("skew:1");
+    CHECK_TRUE(DiskImageInterleave_IsIdentity(&m_interleave));
+}
+
+TEST(DiskImageInterleave, ParseSkewsWhichMoveOnToNextFreeSector)
+{
+    parse("skew:2");
+    STRCMP_EQUAL("02468ace13579bdf", format());
+    parse("skew:4");
+    STRCMP_EQUAL("048c159d26ae37bf", format());
+    parse("skew:6");
+    STRCMP_EQUAL("06c28e4a17d39f5b", format());
+}
+
+TEST(DiskImageInterleave, ParseInvalidSkews)
+{
+    validateParseThrows("skew:0");
+    validateParseThrows("skew:16");
+    validateParseThrows("skew:3x");
+    validateParseThrows("skew:");
+}
+
+TEST(DiskImageInterleave, ParseHexTable)
+{
+    parse("FEDCBA9876543210");
+    STRCMP_EQUAL("fedcba9876543210", format());
+}
+
+TEST(DiskImageInterleave, ParseInvalidHexTables)
+{
+    validateParseThrows("0123456789abcde");
+    validateParseThrows("0123456789abcdef0");
+    validateParseThrows("0123456789abcdee");
+    validateParseThrows("0123456789abcdeg");
+    validateParseThrows("");
+}
+
+TEST(DiskImageInterleave, SimulateIdentityWithNoProcessingReadsSectorsBackToBack)
+{
+    DiskImageInterleave_InitIdentity(&m_interleave);
+    DiskImageInterleaveTiming timing = DiskImageInterleave_Simulate(&m_interleave, 0);
+    LONGS_EQUAL(15 * (g_sectorSlotCycles - g_sectorReadCycles), timing.waitCycles);
+    LONGS_EQUAL(15 * g_sectorSlotCycles + g_sectorReadCycles, timing.trackCycles);
+}
+
+TEST(DiskImageInterleave, SimulateIdentityWhichMissesEverySectorWaitsNearlyARevolutionForEach)
+{
+    static const unsigned int cyclesPerSector = 2000;
+    unsigned int              waitPerSector = g_revolutionCycles + g_sectorSlotCycles - g_sectorReadCycles - 
+                                              cyclesPerSector;
+    
+    DiskImageInterleave_InitIdentity(&m_interleave);
+    DiskImageInterleaveTiming timing = DiskImageInterleave_Simulate(&m_interleave, cyclesPerSector);
+    LONGS_EQUAL(15 * waitPerSector, timing.waitCycles);
+    LONGS_EQUAL(15 * waitPerSector + 16 * (g_sectorReadCycles + cyclesPerSector), timing.trackCycles);
+}
+
+TEST(DiskImageInterleave, SimulateSkewWhichGivesEnoughTimeBetweenSectors)
+{
+    parse("skew:2");
+    DiskImageInterleaveTiming timing = DiskImageInterleave_Simulate(&m_interleave, 5000);
+    CHECK_TRUE(timing.trackCycles < 2 * g_revolutionCycles);
+    CHECK_TRUE(timing.trackCycles > g_revolutionCycles);
+}
+
+TEST(DiskImageInterleave, TuneRecommendsSmallestSkewThatKeepsUpWithLoader)
+{
+    DiskImageInterleaveTuning tuning = DiskImageInterleave_Tune(0);
+    LONGS_EQUAL(1, tuning.timings[tuning.bestIndex].skew);
+    
+    tuning = DiskImageInterleave_Tune(5000);
+    LONGS_EQUAL(5000, tuning.cyclesPerSector);
+    LONGS_EQUAL(2, tuning.timings[tuning.bestIndex].skew);
+    
+    tuning = DiskImageInterleave_Tune(30000);
+    LONGS_EQUAL(4, tuning.timings[tuning.bestIndex].skew);
+    for (unsigned int i = 0 ; i < DISK_IMAGE_INTERLEAVE_SKEW_COUNT ; i++)
+    {
+        LONGS_EQUAL(i + 1, tuning.timings[i].skew);
+        CHECK_TRUE(tuning.timings[i].trackCycles >= tuning.timings[tuning.bestIndex].trackCycles);
+    }
+}
+
+TEST(DiskImageInterleave, PrintTuning)
+{
+    DiskImageInterleaveTuning tuning = DiskImageInterleave_Tune(5000);
+    
+    DiskImageInterleave_PrintTuning(&tuning);
+    LONGS_EQUAL(18, printfSpy_GetCallCount());
+    STRCMP_EQUAL("Recommended interleave: skew:2\n", printfSpy_GetLastOutput());
+}
@@ -0,0 +1,246 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "DiskImageManifest.h"
+    #include "MemoryVfs.h"
+    #include "MallocFailureInject.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+static const char g_manifestFilename[] = "DiskImageManifestTest.manifest";
+
+
+TEST_GROUP(DiskImageManifest)
+{
+    DiskImageManifest m_manifest;
+    DiskImageManifest m_readManifest;
+    MemoryVfs*        m_pMemoryVfs;
+    unsigned char     m_data[512];
+
+    void setup()
+    {
+        clearExceptionCode();
+        memset(&m_manifest, 0, sizeof(m_manifest));
+        memset(&m_readManifest, 0, sizeof(m_readManifest));
+        m_pMemoryVfs = MemoryVfs_Create();
+        for (size_t i = 0 ; i < sizeof(m_data) ; i++)
+            m_data[i] = (unsigned char)(i + i / 256);
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        DiskImageManifest_Free(&m_manifest);
+        DiskImageManifest_Free(&m_readManifest);
+        Vfs_Free((Vfs*)m_pMemoryVfs);
+    }
+
+    void addBlockEntry(unsigned int block, unsigned int intraBlockOffset, unsigned int sourceOffset, unsigned int length)
+    {
+        DiskImageInsert insert;
+
+        memset(&insert, 0, sizeof(insert));
+        insert.type = DISK_IMAGE_INSERTION_BLOCK;
+        insert.block = block;
+        insert.intraBlockOffset = intraBlockOffset;
+        insert.sourceOffset = sourceOffset;
+        insert.length = length;
+        DiskImageManifest_AddEntry(&m_manifest, &insert, m_data);
+    }
+
+    void addTrackEntry(DiskImageInsertionType type, unsigned int side, unsigned int track, unsigned int sector)
+    {
+        DiskImageInsert insert;
+
+        memset(&insert, 0, sizeof(insert));
+        insert.type = type;
+        insert.side = side;
+        insert.track = track;
+        insert.sector = sector;
+        insert.length = 256;
+        DiskImageManifest_AddEntry(&m_manifest, &insert, m_data);
+    }
+
+    void addManifestFile(const char* pText)
+    {
+        MemoryVfs_AddFile(m_pMemoryVfs, g_manifestFilename, pText, strlen(pText));
+    }
+
+    void validateManifestFile(const char* pExpected)
+    {
+        size_t      dataSize = 0;
+        const void* pData = MemoryVfs_GetFileData(m_pMemoryVfs, g_manifestFilename, &dataSize);
+
+        LONGS_EQUAL(strlen(pExpected), dataSize);
+        CHECK(0 == memcmp(pExpected, pData, dataSize));
+    }
+
+    void validateEntriesEqual(const DiskImageManifestEntry* pExpected, const DiskImageManifestEntry* pActual)
+    {
+        LONGS_EQUAL(pExpected->insert.type, pActual->insert.type);
+        LONGS_EQUAL(pExpected->insert.length, pActual->insert.length);
+        LONGS_EQUAL(pExpected->insert.side, pActual->insert.side);
+        LONGS_EQUAL(pExpected->insert.track, pActual->insert.track);
+        LONGS_EQUAL(pExpected->insert.sector, pActual->insert.sector);
+        CHECK(pExpected->dataHash == pActual->dataHash);
+        CHECK(DiskImageManifest_HashEntry(0, pExpected) == DiskImageManifest_HashEntry(0, pActual));
+    }
+
+    void validateReadThrows(const char* pText, int expectedExceptionCode)
+    {
+        MemoryVfs_AddFile(m_pMemoryVfs, g_manifestFilename, pText, strlen(pText));
+        __try_and_catch( DiskImageManifest_Read(&m_readManifest, (Vfs*)m_pMemoryVfs, g_manifestFilename) );
+        LONGS_EQUAL(expectedExceptionCode, getExceptionCode());
+        LONGS_EQUAL(0, m_readManifest.entryCount);
+        POINTERS_EQUAL(NULL, m_readManifest.pEntries);
+        clearExceptionCode();
+    }
+};
+
+
+TEST(DiskImageManifest, HashIs64BitFNV1a)
+{
+    CHECK(0xcbf29ce484222325ULL == DiskImageManifest_Hash(DISK_IMAGE_MANIFEST_HASH_SEED, "", 0));
+    CHECK(0xaf63dc4c8601ec8cULL == DiskImageManifest_Hash(DISK_IMAGE_MANIFEST_HASH_SEED, "a", 1));
+    CHECK(0x85944171f73967e8ULL == DiskImageManifest_Hash(DISK_IMAGE_MANIFEST_HASH_SEED, "foobar", 6));
+}
+
+TEST(DiskImageManifest, EntryHashesDataAtSourceOffsetButNotTheOffsetItself)
+{
+    addBlockEntry(0, 0, 0, 256);
+    addBlockEntry(0, 0, 256, 256);
+    memcpy(m_data, m_data + 256, 256);
+    addBlockEntry(0, 0, 0, 256);
+
+    LONGS_EQUAL(3, m_manifest.entryCount);
+    LONGS_EQUAL(0, m_manifest.pEntries[1].insert.sourceOffset);
+    CHECK(m_manifest.pEntries[0].dataHash != m_manifest.pEntries[1].dataHash);
+    CHECK(m_manifest.pEntries[1].dataHash == m_manifest.pEntries[2].dataHash);
+    CHECK(DiskImageManifest_HashEntry(0, &m_manifest.pEntries[1]) ==
+          DiskImageManifest_HashEntry(0, &m_manifest.pEntries[2]));
+}
+
+TEST(DiskImageManifest, EntryHashDependsOnWhereDataIsInserted)
+{
+    addBlockEntry(0, 0, 0, 256);
+    addBlockEntry(1, 0, 0, 256);
+    addBlockEntry(0, 256, 0, 256);
+    addTrackEntry(DISK_IMAGE_INSERTION_RW18, 0xa9, 0, 0);
+    addTrackEntry(DISK_IMAGE_INSERTION_RW18, 0xad, 0, 0);
+
+    CHECK(DiskImageManifest_HashEntry(0, &m_manifest.pEntries[0]) !=
+          DiskImageManifest_HashEntry(0, &m_manifest.pEntries[1]));
+    CHECK(DiskImageManifest_HashEntry(0, &m_manifest.pEntries[0]) !=
+          DiskImageManifest_HashEntry(0, &m_manifest.pEntries[2]));
+    CHECK(DiskImageManifest_HashEntry(0, &m_manifest.pEntries[3]) !=
+          DiskImageManifest_HashEntry(0, &m_manifest.pEntries[4]));
+}
+
+TEST(DiskImageManifest, WriteAndReadBackEachInsertionType)
+{
+    addBlockEntry(5, 128, 0, 512);
+    addTrackEntry(DISK_IMAGE_INSERTION_RWTS16, 0, 17, 15);
+    addTrackEntry(DISK_IMAGE_INSERTION_RW18, 0xad, 34, 4352);
+    m_manifest.imageHash = 0x0123456789abcdefULL;
+
+    DiskImageManifest_Write(&m_manifest, (Vfs*)m_pMemoryVfs, g_manifestFilename);
+    DiskImageManifest_Read(&m_readManifest, (Vfs*)m_pMemoryVfs, g_manifestFilename);
+
+    CHECK(m_manifest.imageHash == m_readManifest.imageHash);
+    LONGS_EQUAL(3, m_readManifest.entryCount);
+    for (size_t i = 0 ; i < m_readManifest.entryCount ; i++)
+        validateEntriesEqual(&m_manifest.pEntries[i], &m_readManifest.pEntries[i]);
+}
+
+TEST(DiskImageManifest, WriteEmptyManifest)
+{
+    m_manifest.imageHash = 0xabcULL;
+    DiskImageManifest_Write(&m_manifest, (Vfs*)m_pMemoryVfs, g_manifestFilename);
+    validateManifestFile("IMAGE,0000000000000abc\n");
+}
+
+TEST(DiskImageManifest, ReadIsCaseInsensitiveAndSkipsBlankLines)
+{
+    addManifestFile("image,FEDCBA9876543210\n"
+                    "\n"
+                    "block,1,2,3,a\n"
+                    "rwts16,4,5,256,B\n");
+    DiskImageManifest_Read(&m_readManifest, (Vfs*)m_pMemoryVfs, g_manifestFilename);
+
+    CHECK(0xfedcba9876543210ULL == m_readManifest.imageHash);
+    LONGS_EQUAL(2, m_readManifest.entryCount);
+    LONGS_EQUAL(DISK_IMAGE_INSERTION_BLOCK, m_readManifest.pEntries[0].insert.type);
+    LONGS_EQUAL(1, m_readManifest.pEntries[0].insert.block);
+    LONGS_EQUAL(2, m_readManifest.pEntries[0].insert.intraBlockOffset);
+    LONGS_EQUAL(3, m_readManifest.pEntries[0].insert.length);
+    CHECK(0xaULL == m_readManifest.pEntries[0].dataHash);
+    LONGS_EQUAL(DISK_IMAGE_INSERTION_RWTS16, m_readManifest.pEntries[1].insert.type);
+    LONGS_EQUAL(4, m_readManifest.pEntries[1].insert.track);
+    LONGS_EQUAL(5, m_readManifest.pEntries[1].insert.sector);
+    CHECK(0xbULL == m_readManifest.pEntries[1].dataHash);
+}
+
+TEST(DiskImageManifest, ReadManyEntriesGrowsEntryArray)
+{
+    for (unsigned int i = 0 ; i < 200 ; i++)
+        addBlockEntry(i, 0, 0, 512);
+    DiskImageManifest_Write(&m_manifest, (Vfs*)m_pMemoryVfs, g_manifestFilename);
+    DiskImageManifest_Read(&m_readManifest, (Vfs*)m_pMemoryVfs, g_manifestFilename);
+
+    LONGS_EQUAL(200, m_readManifest.entryCount);
+    LONGS_EQUAL(199, m_readManifest.pEntries[199].insert.block);
+}
+
+TEST(DiskImageManifest, ReadMissingManifest)
+{
+    __try_and_catch( DiskImageManifest_Read(&m_readManifest, (Vfs*)m_pMemoryVfs, g_manifestFilename) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(DiskImageManifest, ReadMalformedManifests)
+{
+    validateReadThrows("IMAGE,0\nBOGUS,1,2,3,4\n", fileException);
+    validateReadThrows("IMAGE,0\nBLOCK,1,2,3\n", fileException);
+    validateReadThrows("IMAGE,0\nRW18,0xa9,1,2,3\n", fileException);
+    validateReadThrows("IMAGE,0\nBLOCK,1x,2,3,4\n", fileException);
+    validateReadThrows("IMAGE,0\nBLOCK,,2,3,4\n", fileException);
+    validateReadThrows("IMAGE,0\nBLOCK,1,2,3,xyz\n", fileException);
+    validateReadThrows("IMAGE,\n", fileException);
+    validateReadThrows("IMAGE,00000000000000000\n", fileException);
+}
+
+TEST(DiskImageManifest, FailAllocationWhileAddingEntry)
+{
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( addBlockEntry(0, 0, 0, 512) );
+    LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+    LONGS_EQUAL(0, m_manifest.entryCount);
+    clearExceptionCode();
+}
+
+TEST(DiskImageManifest, FailOpeningManifestForWrite)
+{
+    MallocFailureInject_FailAllocation(1);
+    __try_and_catch( DiskImageManifest_Write(&m_manifest, (Vfs*)m_pMemoryVfs, g_manifestFilename) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
@@ -0,0 +1,241 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "DiskImageSchedule.h"
+    #include "MallocFailureInject.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+TEST_GROUP(DiskImageSchedule)
+{
+    DiskImageSchedule m_schedule;
+    DiskImageInterval m_regions[256];
+    DiskImageInterval m_spans[256];
+    size_t            m_count;
+
+    void setup()
+    {
+        clearExceptionCode();
+        memset(&m_schedule, 0, sizeof(m_schedule));
+        m_count = 0;
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        MallocFailureInject_Restore();
+        DiskImageSchedule_Free(&m_schedule);
+    }
+
+    void addInsertion(unsigned long long firstRegion, unsigned long long endRegion,
+                      unsigned long long startByte, unsigned long long endByte)
+    {
+        m_regions[m_count].start = firstRegion;
+        m_regions[m_count].end = endRegion;
+        m_spans[m_count].start = startByte;
+        m_spans[m_count].end = endByte;
+        m_count++;
+    }
+
+    void addRegions(unsigned long long firstRegion, unsigned long long endRegion)
+    {
+        addInsertion(firstRegion, endRegion, firstRegion * 512, endRegion * 512);
+    }
+
+    void build()
+    {
+        DiskImageSchedule_Build(&m_schedule, m_regions, m_spans, m_count);
+    }
+
+    void validateGroup(size_t group, const size_t* pExpectedOrder, size_t expectedCount)
+    {
+        size_t start = m_schedule.pGroupStarts[group];
+
+        LONGS_EQUAL(expectedCount, m_schedule.pGroupStarts[group + 1] - start);
+        for (size_t i = 0 ; i < expectedCount ; i++)
+            LONGS_EQUAL(pExpectedOrder[i], m_schedule.pOrder[start + i]);
+    }
+
+    size_t findGroup(size_t insertion)
+    {
+        for (size_t group = 0 ; group < m_schedule.groupCount ; group++)
+        {
+            for (size_t i = m_schedule.pGroupStarts[group] ; i < m_schedule.pGroupStarts[group + 1] ; i++)
+            {
+                if (m_schedule.pOrder[i] == insertion)
+                    return group;
+            }
+        }
+        FAIL("Insertion wasn't scheduled.");
+        return 0;
+    }
+
+    static int doIntervalsOverlap(const DiskImageInterval* p1, const DiskImageInterval* p2)
+    {
+        return p1->start < p1->end && p2->start < p2->end && p1->start < p2->end && p2->start < p1->end;
+    }
+};
+
+
+TEST(DiskImageSchedule, DisjointRegionsAreEachPlacedInTheirOwnGroup)
+{
+    static const size_t group0[] = { 1 };
+    static const size_t group1[] = { 2 };
+    static const size_t group2[] = { 0 };
+
+    addRegions(7, 8);
+    addRegions(0, 3);
+    addRegions(3, 7);
+    build();
+
+    LONGS_EQUAL(3, m_schedule.insertionCount);
+    LONGS_EQUAL(3, m_schedule.groupCount);
+    validateGroup(0, group0, ARRAYSIZE(group0));
+    validateGroup(1, group1, ARRAYSIZE(group1));
+    validateGroup(2, group2, ARRAYSIZE(group2));
+    for (size_t i = 0 ; i < m_count ; i++)
+        LONGS_EQUAL(DISK_IMAGE_SCHEDULE_NO_OVERWRITE, m_schedule.pOverwrites[i]);
+}
+
+TEST(DiskImageSchedule, OverlappingRegionsShareAGroupInScriptOrder)
+{
+    static const size_t group0[] = { 1 };
+    static const size_t group1[] = { 0, 2, 3 };
+
+    addRegions(5, 6);
+    addRegions(0, 1);
+    addRegions(4, 6);
+    addRegions(5, 6);
+    build();
+
+    LONGS_EQUAL(2, m_schedule.groupCount);
+    validateGroup(0, group0, ARRAYSIZE(group0));
+    validateGroup(1, group1, ARRAYSIZE(group1));
+}
+
+TEST(DiskImageSchedule, RegionsWhichOnlyOverlapThroughAnotherInsertionShareAGroup)
+{
+    static const size_t group0[] = { 0, 1, 2 };
+    static const size_t group1[] = { 3 };
+
+    addRegions(0, 2);
+    addRegions(3, 5);
+    addRegions(1, 4);
+    addRegions(5, 6);
+    build();
+
+    LONGS_EQUAL(2, m_schedule.groupCount);
+    validateGroup(0, group0, ARRAYSIZE(group0));
+    validateGroup(1, group1, ARRAYSIZE(group1));
+}
+
+TEST(DiskImageSchedule, InsertionsIntoTheSameRegionWhichDontShareBytesAreNotOverwrites)
+{
+    addInsertion(3, 4, 0x3000, 0x3100);
+    addInsertion(3, 4, 0x3100, 0x3200);
+    addInsertion(3, 4, 0x30ff, 0x3100);
+    build();
+
+    LONGS_EQUAL(1, m_schedule.groupCount);
+    LONGS_EQUAL(DISK_IMAGE_SCHEDULE_NO_OVERWRITE, m_schedule.pOverwrites[0]);
+    LONGS_EQUAL(DISK_IMAGE_SCHEDULE_NO_OVERWRITE, m_schedule.pOverwrites[1]);
+    LONGS_EQUAL(0, m_schedule.pOverwrites[2]);
+}
+
+TEST(DiskImageSchedule, OverwriteIsTheLatestEarlierInsertionWhichSharesBytes)
+{
+    addInsertion(0, 1, 0, 100);
+    addInsertion(0, 1, 100, 200);
+    addInsertion(0, 1, 50, 150);
+    addInsertion(0, 1, 60, 70);
+    addInsertion(0, 1, 0, 10);
+    build();
+
+    LONGS_EQUAL(DISK_IMAGE_SCHEDULE_NO_OVERWRITE, m_schedule.pOverwrites[0]);
+    LONGS_EQUAL(DISK_IMAGE_SCHEDULE_NO_OVERWRITE, m_schedule.pOverwrites[1]);
+    LONGS_EQUAL(1, m_schedule.pOverwrites[2]);
+    LONGS_EQUAL(2, m_schedule.pOverwrites[3]);
+    LONGS_EQUAL(0, m_schedule.pOverwrites[4]);
+}
+
+TEST(DiskImageSchedule, EmptySpansNeverOverwriteOrGetOverwritten)
+{
+    addInsertion(0, 1, 0, 100);
+    addInsertion(0, 1, 50, 50);
+    addInsertion(0, 1, 40, 60);
+    build();
+
+    LONGS_EQUAL(DISK_IMAGE_SCHEDULE_NO_OVERWRITE, m_schedule.pOverwrites[1]);
+    LONGS_EQUAL(0, m_schedule.pOverwrites[2]);
+}
+
+TEST(DiskImageSchedule, ManyRandomInsertionsMatchBruteForceResults)
+{
+    srand(50);
+    for (size_t i = 0 ; i < ARRAYSIZE(m_regions) ; i++)
+    {
+        unsigned long long start = rand() % 4096;
+        unsigned long long length = rand() % 64;
+
+        addInsertion(start / 256, (start + length + 255) / 256, start, start + length);
+    }
+    build();
+
+    for (size_t i = 0 ; i < m_count ; i++)
+    {
+        size_t expectedOverwrite = DISK_IMAGE_SCHEDULE_NO_OVERWRITE;
+
+        for (size_t j = 0 ; j < i ; j++)
+        {
+            if (doIntervalsOverlap(&m_spans[i], &m_spans[j]))
+                expectedOverwrite = j;
+            if (doIntervalsOverlap(&m_regions[i], &m_regions[j]))
+                LONGS_EQUAL(findGroup(j), findGroup(i));
+        }
+        LONGS_EQUAL(expectedOverwrite, m_schedule.pOverwrites[i]);
+    }
+    for (size_t group = 0 ; group < m_schedule.groupCount ; group++)
+    {
+        for (size_t i = m_schedule.pGroupStarts[group] + 1 ; i < m_schedule.pGroupStarts[group + 1] ; i++)
+            CHECK_TRUE(m_schedule.pOrder[i - 1] < m_schedule.pOrder[i]);
+    }
+}
+
+TEST(DiskImageSchedule, FailAllAllocationsDuringBuild)
+{
+    int allocationToFail = 1;
+
+    addRegions(0, 1);
+    addRegions(1, 2);
+    do
+    {
+        MallocFailureInject_FailAllocation(allocationToFail++);
+        __try_and_catch( build() );
+        MallocFailureInject_Restore();
+        if (getExceptionCode() == noException)
+            break;
+        LONGS_EQUAL(outOfMemoryException, getExceptionCode());
+        POINTERS_EQUAL(NULL, m_schedule.pOrder);
+        LONGS_EQUAL(0, m_schedule.groupCount);
+        clearExceptionCode();
+    } while (allocationToFail < 20);
+    LONGS_EQUAL(2, m_schedule.groupCount);
+}
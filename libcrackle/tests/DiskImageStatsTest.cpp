@@ -0,0 +1,168 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "DiskImageStats.h"
+    #include "printfSpy.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+TEST_GROUP(DiskImageStats)
+{
+    DiskImageStats m_stats;
+
+    void setup()
+    {
+        printfSpy_Hook(1024);
+        memset(&m_stats, 0, sizeof(m_stats));
+    }
+
+    void teardown()
+    {
+        printfSpy_Unhook();
+    }
+
+    void fillStats()
+    {
+        m_stats.scriptLineCount = 10;
+        m_stats.objectFilesRead = 3;
+        m_stats.objectBytesRead = 1536;
+        m_stats.objectReferences = 7;
+        m_stats.rw18TrackMerges = 2;
+        m_stats.rwts16SectorsEncoded = 16;
+        m_stats.rw18TracksEncoded = 4;
+        m_stats.compressedInserts = 2;
+        m_stats.compressedInputBytes = 9216;
+        m_stats.compressedOutputBytes = 4000;
+        m_stats.uncompressedTrackReads = 3;
+        m_stats.compressedTrackReads = 2;
+        m_stats.imageBytesWritten = 232960;
+        m_stats.parseSeconds = 0.25;
+        m_stats.objectReadSeconds = 0.5;
+        m_stats.encodeSeconds = 1.0;
+        m_stats.writeSeconds = 0.125;
+    }
+};
+
+
+TEST(DiskImageStats, AddSumsEveryField)
+{
+    DiskImageStats total;
+
+    memset(&total, 0, sizeof(total));
+    fillStats();
+    DiskImageStats_Add(&total, &m_stats);
+    DiskImageStats_Add(&total, &m_stats);
+
+    LONGS_EQUAL(20, total.scriptLineCount);
+    LONGS_EQUAL(6, total.objectFilesRead);
+    CHECK(3072ULL == total.objectBytesRead);
+    LONGS_EQUAL(14, total.objectReferences);
+    LONGS_EQUAL(4, total.rw18TrackMerges);
+    LONGS_EQUAL(32, total.rwts16SectorsEncoded);
+    LONGS_EQUAL(8, total.rw18TracksEncoded);
+    LONGS_EQUAL(4, total.compressedInserts);
+    CHECK(18432ULL == total.compressedInputBytes);
+    CHECK(8000ULL == total.compressedOutputBytes);
+    LONGS_EQUAL(6, total.uncompressedTrackReads);
+    LONGS_EQUAL(4, total.compressedTrackReads);
+    CHECK(465920ULL == total.imageBytesWritten);
+    DOUBLES_EQUAL(0.5, total.parseSeconds, 0.0);
+    DOUBLES_EQUAL(1.0, total.objectReadSeconds, 0.0);
+    DOUBLES_EQUAL(2.0, total.encodeSeconds, 0.0);
+    DOUBLES_EQUAL(0.25, total.writeSeconds, 0.0);
+}
+
+TEST(DiskImageStats, PrintText)
+{
+    fillStats();
+    DiskImageStats_PrintText(&m_stats);
+    STRCMP_EQUAL("Script lines:           10" LINE_ENDING
+                 "Object files read:      3 (1536 bytes)" LINE_ENDING
+                 "Repeated object reads:  4" LINE_ENDING
+                 "RW18 track merges:      2" LINE_ENDING
+                 "RWTS16 sectors encoded: 16" LINE_ENDING
+                 "RW18 tracks encoded:    4" LINE_ENDING
+                 "Compressed inserts:     2 (9216 -> 4000 bytes)" LINE_ENDING
+                 "Track reads saved:      1 (estimated)" LINE_ENDING
+                 "Image bytes written:    232960" LINE_ENDING
+                 "Script parse time:      0.250000 seconds" LINE_ENDING
+                 "Object I/O time:        0.500000 seconds" LINE_ENDING
+                 "Encode time:            1.000000 seconds" LINE_ENDING
+                 "Write time:             0.125000 seconds" LINE_ENDING,
+                 printfSpy_GetLastOutput());
+}
+
+TEST(DiskImageStats, PrintJson)
+{
+    fillStats();
+    DiskImageStats_PrintJson(&m_stats);
+    STRCMP_EQUAL("{" LINE_ENDING
+                 "  \"scriptLines\": 10," LINE_ENDING
+                 "  \"objectFilesRead\": 3," LINE_ENDING
+                 "  \"objectBytesRead\": 1536," LINE_ENDING
+                 "  \"repeatedObjectReads\": 4," LINE_ENDING
+                 "  \"rw18TrackMerges\": 2," LINE_ENDING
+                 "  \"rwts16SectorsEncoded\": 16," LINE_ENDING
+                 "  \"rw18TracksEncoded\": 4," LINE_ENDING
+                 "  \"compressedInserts\": 2," LINE_ENDING
+                 "  \"compressedInputBytes\": 9216," LINE_ENDING
+                 "  \"compressedOutputBytes\": 4000," LINE_ENDING
+                 "  \"uncompressedTrackReads\": 3," LINE_ENDING
+                 "  \"compressedTrackReads\": 2," LINE_ENDING
+                 "  \"imageBytesWritten\": 232960," LINE_ENDING
+                 "  \"parseSeconds\": 0.250000," LINE_ENDING
+                 "  \"objectReadSeconds\": 0.500000," LINE_ENDING
+                 "  \"encodeSeconds\": 1.000000," LINE_ENDING
+                 "  \"writeSeconds\": 0.125000" LINE_ENDING
+                 "}" LINE_ENDING,
+                 printfSpy_GetLastOutput());
+}
+
+TEST(DiskImageStats, RepeatedObjectReadsNeverGoesNegative)
+{
+    m_stats.objectFilesRead = 2;
+    m_stats.objectReferences = 1;
+    DiskImageStats_PrintJson(&m_stats);
+    CHECK(NULL != strstr(printfSpy_GetLastOutput(), "\"repeatedObjectReads\": 0,"));
+}
+
+TEST(DiskImageStats, GetSecondsNeverGoesBackwards)
+{
+    double first = DiskImageStats_GetSeconds();
+    double second = DiskImageStats_GetSeconds();
+
+    CHECK_TRUE(first > 0.0);
+    CHECK_TRUE(second >= first);
+}
+
+TEST(DiskImageStats, PrintCompressionSummary)
+{
+    fillStats();
+    DiskImageStats_PrintCompression(&m_stats);
+    STRCMP_EQUAL("Compressed 2 inserts from 9216 to 4000 bytes, saving 5216 bytes and an estimated 1 track reads."
+                 LINE_ENDING, printfSpy_GetLastOutput());
+}
+
+TEST(DiskImageStats, PrintCompressionSummaryOnlyWhenSomethingWasCompressed)
+{
+    DiskImageStats_PrintCompression(&m_stats);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+}
@@ -16,10 +16,14 @@
 extern "C"
 {
     #include "NibbleDiskImage.h"
+    #include "BlockDiskImage.h"
+    #include "DiskImageCompress.h"
+    #include "MemoryVfs.h"
     #include "BinaryBuffer.h"
     #include "MallocFailureInject.h"
     #include "FileFailureInject.h"
     #include "printfSpy.h"
+    #include "ThreadPool.h"
     #include "util.h"
 }
 
@@ -29,16 +33,20 @@ extern "C"
 static const char* g_imageFilename = "NibbleDiskImageTest.nib";
 static const char* g_savFilenameAllZeroes = "NibbleDiskImageTestAllZeroes.sav";
 static const char* g_savFilenameAllOnes = "NibbleDiskImageAllOnes.sav";
+static const char* g_savFilenameTwoSectors = "NibbleDiskImageTestTwoSectors.sav";
 static const char* g_scriptFilename = "NibbleDiskImageTest.script";
+static const char* g_manifestFilename = "NibbleDiskImageTest.manifest";
 
 
 TEST_GROUP(NibbleDiskImage)
 {
     NibbleDiskImage*     m_pNibbleDiskImage;
+    MemoryVfs*           m_pMemoryVfs;
     const unsigned char* m_pCurr;
     FILE*                m_pFile;
     unsigned char*       m_pImageOnDisk;
     unsigned char        m_checksum;
+    unsigned char        m_side;
     char                 m_buffer[256];
     
     void setup()
@@ -46,9 +54,11 @@ TEST_GROUP(NibbleDiskImage)
         clearExceptionCode();
         printfSpy_Hook(512);
         m_pNibbleDiskImage = NULL;
+        m_pMemoryVfs = NULL;
         m_pFile = NULL;
         m_pCurr = NULL;
         m_pImageOnDisk = NULL;
+        m_side = 0xa9;
     }
 
     void teardown()
@@ -56,13 +66,16 @@ TEST_GROUP(NibbleDiskImage)
         LONGS_EQUAL(noException, getExceptionCode());
         MallocFailureInject_Restore();
         printfSpy_Unhook();
+        ThreadPool_SetThreadCount(0);
         DiskImage_Free((DiskImage*)m_pNibbleDiskImage);
+        Vfs_Free((Vfs*)m_pMemoryVfs);
         if (m_pFile)
             fclose(m_pFile);
         free(m_pImageOnDisk);
         remove(g_imageFilename);
         remove(g_savFilenameAllZeroes);
         remove(g_savFilenameAllOnes);
+        remove(g_savFilenameTwoSectors);
         remove(g_scriptFilename);
     }
     
@@ -130,6 +143,43 @@ TEST_GROUP(NibbleDiskImage)
         validateDataField(pExpectedContent);
     }
     
+    void encode6and2(unsigned char* pEncoded, const unsigned char* pData)
+    {
+        static const unsigned char diskBytes[64] =
+        {
+            0x96, 0x97, 0x9a, 0x9b, 0x9d, 0x9e, 0x9f, 0xa6,
+            0xa7, 0xab, 0xac, 0xad, 0xae, 0xaf, 0xb2, 0xb3,
+            0xb4, 0xb5, 0xb6, 0xb7, 0xb9, 0xba, 0xbb, 0xbc,
+            0xbd, 0xbe, 0xbf, 0xcb, 0xcd, 0xce, 0xcf, 0xd3,
+            0xd6, 0xd7, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde,
+            0xdf, 0xe5, 0xe6, 0xe7, 0xe9, 0xea, 0xeb, 0xec,
+            0xed, 0xee, 0xef, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6,
+            0xf7, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+        };
+        unsigned char values[342];
+        unsigned char previous = 0;
+        
+        for (int i = 0 ; i < 86 ; i++)
+        {
+            values[i] = reverseLowBits(pData[i]) | 
+                        (reverseLowBits(pData[i + 86]) << 2) | 
+                        (reverseLowBits(pData[(i + 172) & 0xFF]) << 4);
+        }
+        for (int i = 0 ; i < 256 ; i++)
+            values[86 + i] = pData[i] >> 2;
+        for (int i = 0 ; i < 342 ; i++)
+        {
+            *pEncoded++ = diskBytes[values[i] ^ previous];
+            previous = values[i];
+        }
+        *pEncoded = diskBytes[previous];
+    }
+    
+    unsigned char reverseLowBits(unsigned char byte)
+    {
+        return ((byte & 1) << 1) | ((byte & 2) >> 1);
+    }
+    
     void validateSyncBytes(size_t syncByteCount)
     {
         for (size_t i = 0 ; i < syncByteCount ; i++)
@@ -257,7 +307,7 @@ TEST_GROUP(NibbleDiskImage)
         insert.type = DISK_IMAGE_INSERTION_RW18;
         insert.sourceOffset = 0;
         insert.length = totalSize;
-        insert.side = 0xa9;
+        insert.side = m_side;
         insert.track = startTrack;
         insert.intraTrackOffset = startTrackOffset;
 
@@ -265,6 +315,36 @@ TEST_GROUP(NibbleDiskImage)
         free(pSectorData);
     }
     
+    void writeEveryTrackWithTestPattern()
+    {
+        static unsigned char trackData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+        DiskImageInsert      insert;
+        unsigned int         track;
+        
+        for (size_t i = 0 ; i < sizeof(trackData) ; i++)
+            trackData[i] = (unsigned char)(i * 7 + (i >> 8));
+        
+        memset(&insert, 0, sizeof(insert));
+        insert.sourceOffset = 0;
+        for (track = 0 ; track < DISK_IMAGE_TRACKS_PER_SIDE ; track++)
+        {
+            insert.track = track;
+            if (track & 1)
+            {
+                insert.type = DISK_IMAGE_INSERTION_RW18;
+                insert.side = 0xa9;
+                insert.length = DISK_IMAGE_RW18_BYTES_PER_TRACK;
+            }
+            else
+            {
+                insert.type = DISK_IMAGE_INSERTION_RWTS16;
+                insert.sector = 0;
+                insert.length = NIBBLE_DISK_IMAGE_RWTS16_SECTORS_PER_TRACK * DISK_IMAGE_BYTES_PER_SECTOR;
+            }
+            NibbleDiskImage_InsertData(m_pNibbleDiskImage, trackData, &insert);
+        }
+    }
+    
     const unsigned char* readNibbleDiskImageIntoMemory(void)
     {
         m_pFile = fopen(g_imageFilename, "rb");
@@ -338,12 +418,126 @@ TEST_GROUP(NibbleDiskImage)
         fclose(pFile);
     }
 
+    void createTwoSectorObjectFile()
+    {
+        unsigned char sectorData[2 * DISK_IMAGE_BYTES_PER_SECTOR];
+        
+        memset(sectorData, 0x11, DISK_IMAGE_BYTES_PER_SECTOR);
+        memset(sectorData + DISK_IMAGE_BYTES_PER_SECTOR, 0x22, DISK_IMAGE_BYTES_PER_SECTOR);
+        createSectorObjectFile(g_savFilenameTwoSectors, sectorData, sizeof(sectorData));
+    }
+    
+    void validateDecodedRWTS16Sectors(unsigned int  track, 
+                                      unsigned char firstFill, 
+                                      unsigned int  firstSector, 
+                                      unsigned char secondFill, 
+                                      unsigned int  secondSector)
+    {
+        const unsigned char*       pImage = NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+        unsigned char              trackData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+        NibbleDiskImageTrackStatus status;
+        unsigned char              expectedSector[DISK_IMAGE_BYTES_PER_SECTOR];
+        
+        NibbleDiskImage_DecodeTrack(pImage + track * NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK, track, trackData, &status);
+        LONGS_EQUAL(NIBBLE_TRACK_RWTS16, status.format);
+        LONGS_EQUAL((1 << firstSector) | (1 << secondSector), status.goodSectors);
+        memset(expectedSector, firstFill, sizeof(expectedSector));
+        CHECK(0 == memcmp(expectedSector, trackData + firstSector * DISK_IMAGE_BYTES_PER_SECTOR, sizeof(expectedSector)));
+        memset(expectedSector, secondFill, sizeof(expectedSector));
+        CHECK(0 == memcmp(expectedSector, trackData + secondSector * DISK_IMAGE_BYTES_PER_SECTOR, sizeof(expectedSector)));
+    }
+    
     void createTextFile(const char* pFilename, const char* pText)
     {
         FILE* pFile = fopen(pFilename, "wb");
         fwrite(pText, 1, strlen(pText), pFile);
         fclose(pFile);
     }
+    
+    void createMemoryVfsWithSectorObjectFiles()
+    {
+        unsigned char sectorData[DISK_IMAGE_BYTES_PER_SECTOR];
+        
+        m_pMemoryVfs = MemoryVfs_Create();
+        memset(sectorData, 0x00, sizeof(sectorData));
+        MemoryVfs_AddFile(m_pMemoryVfs, g_savFilenameAllZeroes, sectorData, sizeof(sectorData));
+        memset(sectorData, 0xff, sizeof(sectorData));
+        MemoryVfs_AddFile(m_pMemoryVfs, g_savFilenameAllOnes, sectorData, sizeof(sectorData));
+    }
+    
+    DiskImage* createDiskImageUsingMemoryVfs()
+    {
+        DiskImage_Free((DiskImage*)m_pNibbleDiskImage);
+        m_pNibbleDiskImage = NULL;
+        m_pNibbleDiskImage = NibbleDiskImage_Create();
+        DiskImage_SetVfs((DiskImage*)m_pNibbleDiskImage, (Vfs*)m_pMemoryVfs);
+        return (DiskImage*)m_pNibbleDiskImage;
+    }
+    
+    DiskImage* processScriptUsingMemoryVfs(const char* pScript, const char* pManifestFilename)
+    {
+        DiskImage* pDiskImage = createDiskImageUsingMemoryVfs();
+        
+        MemoryVfs_AddFile(m_pMemoryVfs, g_scriptFilename, pScript, strlen(pScript));
+        if (pManifestFilename)
+            DiskImage_ReadManifest(pDiskImage, pManifestFilename);
+        DiskImage_ProcessScriptFile(pDiskImage, g_scriptFilename);
+        return pDiskImage;
+    }
+    
+    void buildImageUsingMemoryVfs(const char* pScript, const char* pManifestFilename)
+    {
+        DiskImage* pDiskImage = processScriptUsingMemoryVfs(pScript, pManifestFilename);
+        
+        DiskImage_WriteImage(pDiskImage, g_imageFilename);
+        if (pManifestFilename)
+            DiskImage_WriteManifest(pDiskImage, pManifestFilename);
+    }
+    
+    void updateImageUsingMemoryVfs(const char* pScript, const char* pManifestFilename)
+    {
+        DiskImage* pDiskImage = createDiskImageUsingMemoryVfs();
+        
+        MemoryVfs_AddFile(m_pMemoryVfs, g_scriptFilename, pScript, strlen(pScript));
+        if (pManifestFilename)
+            DiskImage_ReadManifest(pDiskImage, pManifestFilename);
+        DiskImage_ReadImageForUpdate(pDiskImage, g_imageFilename);
+        DiskImage_ProcessScriptFile(pDiskImage, g_scriptFilename);
+        DiskImage_UpdateImage(pDiskImage, g_imageFilename);
+        if (pManifestFilename)
+            DiskImage_WriteManifest(pDiskImage, pManifestFilename);
+    }
+    
+    void loadExpectedImage(const char* pScript)
+    {
+        DiskImage* pDiskImage = processScriptUsingMemoryVfs(pScript, NULL);
+        
+        m_pImageOnDisk = (unsigned char*)malloc(NIBBLE_DISK_IMAGE_SIZE);
+        CHECK(m_pImageOnDisk != NULL);
+        memcpy(m_pImageOnDisk, DiskImage_GetImagePointer(pDiskImage), NIBBLE_DISK_IMAGE_SIZE);
+    }
+    
+    void flipImageFileByte(unsigned int offset)
+    {
+        size_t         imageSize = 0;
+        unsigned char* pImage = (unsigned char*)malloc(NIBBLE_DISK_IMAGE_SIZE);
+        
+        CHECK(pImage != NULL);
+        memcpy(pImage, MemoryVfs_GetFileData(m_pMemoryVfs, g_imageFilename, &imageSize), NIBBLE_DISK_IMAGE_SIZE);
+        LONGS_EQUAL(NIBBLE_DISK_IMAGE_SIZE, imageSize);
+        pImage[offset] ^= 0xff;
+        MemoryVfs_AddFile(m_pMemoryVfs, g_imageFilename, pImage, NIBBLE_DISK_IMAGE_SIZE);
+        free(pImage);
+    }
+    
+    void validateImageFileMatchesExpectedImage()
+    {
+        size_t      imageSize = 0;
+        const void* pImageData = MemoryVfs_GetFileData(m_pMemoryVfs, g_imageFilename, &imageSize);
+        
+        LONGS_EQUAL(NIBBLE_DISK_IMAGE_SIZE, imageSize);
+        CHECK(0 == memcmp(m_pImageOnDisk, pImageData, NIBBLE_DISK_IMAGE_SIZE));
+    }
 };
 
 
@@ -543,6 +737,65 @@ TEST(NibbleDiskImage, InsertTestSectorAt0_0AsRWTS16)
     validateRWTS16SectorContainsNibbles(pImage, expectedEncodedData, 0, 0);
 }
 
+TEST(NibbleDiskImage, InsertSectorsWithVariedDataAsRWTS16AndMatchReferenceEncoder)
+{
+    static unsigned char sectorData[16 * DISK_IMAGE_BYTES_PER_SECTOR];
+    unsigned int         seed = 0x1234;
+    
+    for (size_t i = 0 ; i < sizeof(sectorData) ; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        sectorData[i] = (unsigned char)(seed >> 16);
+    }
+    for (int i = 0 ; i < DISK_IMAGE_BYTES_PER_SECTOR ; i++)
+        sectorData[i] = (unsigned char)i;
+    memset(sectorData + DISK_IMAGE_BYTES_PER_SECTOR, 0xFF, DISK_IMAGE_BYTES_PER_SECTOR);
+
+    DiskImageInsert insert;
+    insert.type = DISK_IMAGE_INSERTION_RWTS16;
+    insert.sourceOffset = 0;
+    insert.length = sizeof(sectorData);
+    insert.track = 5;
+    insert.sector = 0;
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    NibbleDiskImage_InsertData(m_pNibbleDiskImage, sectorData, &insert);
+
+    const unsigned char* pImage = NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+    for (unsigned int sector = 0 ; sector < 16 ; sector++)
+    {
+        unsigned char expectedEncodedData[343];
+        encode6and2(expectedEncodedData, sectorData + sector * DISK_IMAGE_BYTES_PER_SECTOR);
+        validateRWTS16SectorContainsNibbles(pImage, expectedEncodedData, 5, sector);
+    }
+}
+
+TEST(NibbleDiskImage, InsertRW18TrackWithVariedDataAndReadItBack)
+{
+    static unsigned char trackData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+    static unsigned char readData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+    unsigned int         seed = 0x4321;
+    
+    for (size_t i = 0 ; i < sizeof(trackData) ; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        trackData[i] = (unsigned char)(seed >> 16);
+    }
+
+    DiskImageInsert insert;
+    insert.type = DISK_IMAGE_INSERTION_RW18;
+    insert.sourceOffset = 0;
+    insert.length = sizeof(trackData);
+    insert.side = 0xa9;
+    insert.track = 7;
+    insert.intraTrackOffset = 0;
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    NibbleDiskImage_InsertData(m_pNibbleDiskImage, trackData, &insert);
+    NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+
+    NibbleDiskImage_ReadRW18Track(m_pNibbleDiskImage, 0xa9, 7, readData, sizeof(readData));
+    CHECK(0 == memcmp(trackData, readData, sizeof(trackData)));
+}
+
 TEST(NibbleDiskImage, InsertRW18SectorsInTrack0)
 {
     m_pNibbleDiskImage = NibbleDiskImage_Create();
@@ -576,6 +829,78 @@ TEST(NibbleDiskImage, InsertRW18SectorsAcrossTracks0and1)
     validateRWTS16SectorsAreClear(pImage, 2, 0, 34, 15);
 }
 
+TEST(NibbleDiskImage, InsertRWTS16SectorIntoTrackAlreadyContainingRW18Data)
+{
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeOnesRW18Sectors(0, 0x0000, 18);
+    writeZeroRWTS16Sectors(0, 0, 1);
+
+    const unsigned char* pImage = NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+    validateRWTS16SectorContainsZeroData(pImage, 0, 0);
+    validateRWTS16SectorsAreClear(pImage, 1, 0, 34, 15);
+}
+
+TEST(NibbleDiskImage, InsertRW18SectorsIntoTrackAlreadyContainingRWTS16DataStartsFromZeroes)
+{
+    unsigned char trackBuffer[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeZeroRWTS16Sectors(0, 0, 16);
+    writeOnesRW18Sectors(0, 0x0100, 1);
+
+    NibbleDiskImage_ReadRW18Track(m_pNibbleDiskImage, 0xa9, 0, trackBuffer, sizeof(trackBuffer));
+    validateAllZeroes(trackBuffer, DISK_IMAGE_PAGE_SIZE);
+    validateAllOnes(trackBuffer + DISK_IMAGE_PAGE_SIZE, DISK_IMAGE_PAGE_SIZE);
+    validateAllZeroes(trackBuffer + 2 * DISK_IMAGE_PAGE_SIZE, 16 * DISK_IMAGE_PAGE_SIZE);
+}
+
+TEST(NibbleDiskImage, InsertRW18SectorsForDifferentSideIntoSameTrackStartsFromZeroes)
+{
+    unsigned char trackBuffer[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeOnesRW18Sectors(0, 0x0000, 18);
+    m_side = 0xaa;
+    writeOnesRW18Sectors(0, 0x0100, 1);
+
+    NibbleDiskImage_ReadRW18Track(m_pNibbleDiskImage, 0xaa, 0, trackBuffer, sizeof(trackBuffer));
+    validateAllZeroes(trackBuffer, DISK_IMAGE_PAGE_SIZE);
+    validateAllOnes(trackBuffer + DISK_IMAGE_PAGE_SIZE, DISK_IMAGE_PAGE_SIZE);
+    validateAllZeroes(trackBuffer + 2 * DISK_IMAGE_PAGE_SIZE, 16 * DISK_IMAGE_PAGE_SIZE);
+}
+
+TEST(NibbleDiskImage, WriteImageEncodesPendingRW18Track)
+{
+    unsigned char trackBuffer[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeOnesRW18Sectors(34, 0x0000, 18);
+    NibbleDiskImage_WriteImage(m_pNibbleDiskImage, g_imageFilename);
+    
+    const unsigned char* pImageOnDisk = readNibbleDiskImageIntoMemory();
+    CHECK(0 == memcmp(pImageOnDisk, NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage), NIBBLE_DISK_IMAGE_SIZE));
+    NibbleDiskImage_ReadRW18Track(m_pNibbleDiskImage, 0xa9, 34, trackBuffer, sizeof(trackBuffer));
+    validateAllOnes(trackBuffer, sizeof(trackBuffer));
+}
+
+TEST(NibbleDiskImage, EncodeEveryTrackInParallelAndMatchSerialEncode)
+{
+    unsigned char* pSerialImage = (unsigned char*)malloc(NIBBLE_DISK_IMAGE_SIZE);
+    CHECK(pSerialImage != NULL);
+    
+    ThreadPool_SetThreadCount(1);
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeEveryTrackWithTestPattern();
+    memcpy(pSerialImage, NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage), NIBBLE_DISK_IMAGE_SIZE);
+    DiskImage_Free((DiskImage*)m_pNibbleDiskImage);
+    
+    ThreadPool_SetThreadCount(4);
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeEveryTrackWithTestPattern();
+    CHECK(0 == memcmp(pSerialImage, NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage), NIBBLE_DISK_IMAGE_SIZE));
+    free(pSerialImage);
+}
+
 TEST(NibbleDiskImage, FailToInsertTrack35AsRW18)
 {
     m_pNibbleDiskImage = NibbleDiskImage_Create();
@@ -668,9 +993,9 @@ TEST(NibbleDiskImage, FailFWriteInWriteImage)
 {
     m_pNibbleDiskImage = NibbleDiskImage_Create();
     writeZeroRWTS16Sectors(0, 0, 1);
-    fwriteFail(0);
+    writevFail(0);
         __try_and_catch( NibbleDiskImage_WriteImage(m_pNibbleDiskImage, g_imageFilename) );
-    fwriteRestore();
+    writevRestore();
     validateFileExceptionThrown();
 }
 
@@ -693,9 +1018,9 @@ TEST(NibbleDiskImage, FailHeaderReadInReadObjectFile)
     m_pNibbleDiskImage = NibbleDiskImage_Create();
     createZeroSectorObjectFile();
     
-    freadFail(0);
+    readFail(-1);
         __try_and_catch( NibbleDiskImage_ReadObjectFile(m_pNibbleDiskImage, g_savFilenameAllZeroes) );
-    freadRestore();
+    readRestore();
     validateFileExceptionThrown();
 }
 
@@ -714,10 +1039,10 @@ TEST(NibbleDiskImage, FailDataReadInReadObjectFile)
     m_pNibbleDiskImage = NibbleDiskImage_Create();
     createZeroSectorObjectFile();
     
-    freadFail(0);
-    freadToFail(2);
+    readFail(-1);
+    readToFail(2);
         __try_and_catch( NibbleDiskImage_ReadObjectFile(m_pNibbleDiskImage, g_savFilenameAllZeroes) );
-    freadRestore();
+    readRestore();
     validateFileExceptionThrown();
 }
 
@@ -911,10 +1236,51 @@ TEST(NibbleDiskImage, PassTooFewParametersToProcessScript)
     createZeroSectorObjectFile();
 
     NibbleDiskImage_ProcessScript(m_pNibbleDiskImage, copy("RWTS16,NibbleDiskImageTestAllZeroes.sav,0,256,0"));
-    STRCMP_EQUAL("<null>:1: error: Line doesn't contain correct fields: RWTS16,objectFilename,objectStartOffset,insertionLength,track,sector" LINE_ENDING,
+    STRCMP_EQUAL("<null>:1: error: Line doesn't contain correct fields: RWTS16,objectFilename,objectStartOffset,insertionLength,track,sector[,interleave][,compress]" LINE_ENDING,
                  printfSpy_GetLastErrorOutput());
 }
 
+TEST(NibbleDiskImage, ProcessRWTS16ScriptLineWithInterleave)
+{
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    createTwoSectorObjectFile();
+
+    NibbleDiskImage_ProcessScript(m_pNibbleDiskImage, copy("RWTS16,NibbleDiskImageTestTwoSectors.sav,0,512,0,0,dos3.3" LINE_ENDING));
+
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    validateDecodedRWTS16Sectors(0, 0x11, 0, 0x22, 13);
+}
+
+TEST(NibbleDiskImage, ProcessInterleaveScriptLineWhichAppliesToLaterRWTS16Lines)
+{
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    createTwoSectorObjectFile();
+
+    NibbleDiskImage_ProcessScript(m_pNibbleDiskImage, copy("RWTS16,NibbleDiskImageTestTwoSectors.sav,0,256,3,1" LINE_ENDING
+                                                           "INTERLEAVE,skew:3" LINE_ENDING
+                                                           "RWTS16,NibbleDiskImageTestTwoSectors.sav,0,512,1,15" LINE_ENDING
+                                                           "RWTS16,NibbleDiskImageTestTwoSectors.sav,0,256,2,1,identity" LINE_ENDING));
+
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    validateDecodedRWTS16Sectors(1, 0x11, 13, 0x11, 13);
+    validateDecodedRWTS16Sectors(2, 0x22, 0, 0x11, 1);
+    validateDecodedRWTS16Sectors(3, 0x11, 1, 0x11, 1);
+}
+
+TEST(NibbleDiskImage, PassInvalidInterleavesToProcessScript)
+{
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    createZeroSectorObjectFile();
+
+    NibbleDiskImage_ProcessScript(m_pNibbleDiskImage, copy("RWTS16,NibbleDiskImageTestAllZeroes.sav,0,256,0,0,skew:16" LINE_ENDING
+                                                           "INTERLEAVE" LINE_ENDING
+                                                           "INTERLEAVE,dos3.2" LINE_ENDING));
+    LONGS_EQUAL(3, DiskImage_GetScriptErrorCount((DiskImage*)m_pNibbleDiskImage));
+    STRCMP_EQUAL("<null>:3: error: dos3.2 isn't a recognized interleave of identity, dos3.3, prodos, skew:n, or 16 hex digits." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    validateRWTS16SectorsAreClear(NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage), 0, 0, 34, 15);
+}
+
 TEST(NibbleDiskImage, PassInvalidFilenameToProcessScript)
 {
     m_pNibbleDiskImage = NibbleDiskImage_Create();
@@ -972,3 +1338,425 @@ TEST(NibbleDiskImage, FailToAllocateTextFileInProcessScriptFile)
     validateOutOfMemoryExceptionThrown();
 }
 
+TEST(NibbleDiskImage, ProcessScriptFileAndWriteImageUsingMemoryVfs)
+{
+    static const char script[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING;
+    unsigned char     sectorData[DISK_IMAGE_BYTES_PER_SECTOR];
+    MemoryVfs*        pVfs = MemoryVfs_Create();
+    const void*       pImageData;
+    size_t            imageSize = 0;
+
+    memset(sectorData, 0xff, sizeof(sectorData));
+    MemoryVfs_AddFile(pVfs, g_savFilenameAllOnes, sectorData, sizeof(sectorData));
+    MemoryVfs_AddFile(pVfs, g_scriptFilename, script, sizeof(script) - 1);
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    DiskImage_SetVfs((DiskImage*)m_pNibbleDiskImage, (Vfs*)pVfs);
+
+    NibbleDiskImage_ProcessScriptFile(m_pNibbleDiskImage, g_scriptFilename);
+    NibbleDiskImage_WriteImage(m_pNibbleDiskImage, g_imageFilename);
+
+    pImageData = MemoryVfs_GetFileData(pVfs, g_imageFilename, &imageSize);
+    CHECK(pImageData != NULL);
+    LONGS_EQUAL(NIBBLE_DISK_IMAGE_SIZE, imageSize);
+    CHECK(0 == memcmp(NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage), pImageData, imageSize));
+    POINTERS_EQUAL(NULL, fopen(g_imageFilename, "rb"));
+    Vfs_Free((Vfs*)pVfs);
+}
+
+TEST(NibbleDiskImage, UpdateImageWithoutManifestMatchesFullBuild)
+{
+    static const char script1[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING
+                                  "RWTS16,NibbleDiskImageAllOnes.sav,0,256,5,3" LINE_ENDING;
+    static const char script2[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING
+                                  "RWTS16,NibbleDiskImageTestAllZeroes.sav,0,256,5,3" LINE_ENDING
+                                  "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,20,0" LINE_ENDING;
+    createMemoryVfsWithSectorObjectFiles();
+    buildImageUsingMemoryVfs(script1, NULL);
+    flipImageFileByte(NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK * 30);
+
+    updateImageUsingMemoryVfs(script2, NULL);
+
+    loadExpectedImage(script2);
+    validateImageFileMatchesExpectedImage();
+}
+
+TEST(NibbleDiskImage, UpdateMissingImageWritesWholeImage)
+{
+    static const char script[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,5,3" LINE_ENDING;
+    createMemoryVfsWithSectorObjectFiles();
+
+    updateImageUsingMemoryVfs(script, g_manifestFilename);
+
+    loadExpectedImage(script);
+    validateImageFileMatchesExpectedImage();
+}
+
+TEST(NibbleDiskImage, UpdateImageWithManifestOnlyRebuildsTracksWhoseInsertionsChanged)
+{
+    static const char script1[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING
+                                  "RWTS16,NibbleDiskImageAllOnes.sav,0,256,5,3" LINE_ENDING
+                                  "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,20,0" LINE_ENDING;
+    static const char script2[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING
+                                  "RW18,NibbleDiskImageTestAllZeroes.sav,0,256,0xa9,21,0" LINE_ENDING
+                                  "RWTS16,NibbleDiskImageTestAllZeroes.sav,0,256,5,3" LINE_ENDING
+                                  "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,20,0" LINE_ENDING;
+    createMemoryVfsWithSectorObjectFiles();
+    DiskImage* pDiskImage = processScriptUsingMemoryVfs(script1, g_manifestFilename);
+    DiskImage_GetImagePointer(pDiskImage)[10] ^= 0xff;
+    DiskImage_WriteImage(pDiskImage, g_imageFilename);
+    DiskImage_WriteManifest(pDiskImage, g_manifestFilename);
+
+    updateImageUsingMemoryVfs(script2, g_manifestFilename);
+
+    // Track 0 still has the byte flipped since its insertions didn't change so it wasn't rebuilt.
+    loadExpectedImage(script2);
+    m_pImageOnDisk[10] ^= 0xff;
+    validateImageFileMatchesExpectedImage();
+}
+
+TEST(NibbleDiskImage, UpdateImageWithManifestAgainAfterNoChangesLeavesImageAsIs)
+{
+    static const char script[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,5,3" LINE_ENDING
+                                 "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,20,0" LINE_ENDING;
+    createMemoryVfsWithSectorObjectFiles();
+    buildImageUsingMemoryVfs(script, g_manifestFilename);
+    updateImageUsingMemoryVfs(script, g_manifestFilename);
+    updateImageUsingMemoryVfs(script, g_manifestFilename);
+
+    loadExpectedImage(script);
+    validateImageFileMatchesExpectedImage();
+}
+
+TEST(NibbleDiskImage, UpdateImageWithManifestRebuildsEverythingWhenImageWasModified)
+{
+    static const char script1[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING;
+    static const char script2[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING
+                                  "RWTS16,NibbleDiskImageAllOnes.sav,0,256,5,3" LINE_ENDING;
+    createMemoryVfsWithSectorObjectFiles();
+    buildImageUsingMemoryVfs(script1, g_manifestFilename);
+    flipImageFileByte(10);
+
+    updateImageUsingMemoryVfs(script2, g_manifestFilename);
+
+    loadExpectedImage(script2);
+    validateImageFileMatchesExpectedImage();
+}
+
+TEST(NibbleDiskImage, UpdateImageWithManifestReportsScriptErrorsOnce)
+{
+    static const char script1[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING;
+    static const char script2[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING
+                                  "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,16" LINE_ENDING;
+    createMemoryVfsWithSectorObjectFiles();
+    buildImageUsingMemoryVfs(script1, g_manifestFilename);
+
+    updateImageUsingMemoryVfs(script2, g_manifestFilename);
+
+    LONGS_EQUAL(1, printfSpy_GetCallCount());
+    STRCMP_EQUAL("NibbleDiskImageTest.script:2: error: 16 specifies an invalid sector.  Must be 0 - 15." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    loadExpectedImage(script1);
+    validateImageFileMatchesExpectedImage();
+}
+
+
+TEST(NibbleDiskImage, ProcessScriptOnceForNibbleAndBlockImagesMatchesSeparateBuilds)
+{
+    static const char script[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,1,2" LINE_ENDING
+                                 "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,3,0" LINE_ENDING
+                                 "BLOCK,NibbleDiskImageAllOnes.sav,0,256,5" LINE_ENDING;
+    DiskImage*        apImages[2];
+    DiskImage*        pExpectedBlockImage;
+    unsigned char*    pExpectedBlockData;
+
+    createMemoryVfsWithSectorObjectFiles();
+    loadExpectedImage(script);
+    pExpectedBlockImage = (DiskImage*)BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_SetVfs(pExpectedBlockImage, (Vfs*)m_pMemoryVfs);
+    DiskImage_ProcessScriptFile(pExpectedBlockImage, g_scriptFilename);
+    pExpectedBlockData = (unsigned char*)malloc(BLOCK_DISK_IMAGE_3_5_DISK_SIZE);
+    CHECK(pExpectedBlockData != NULL);
+    memcpy(pExpectedBlockData, DiskImage_GetImagePointer(pExpectedBlockImage), BLOCK_DISK_IMAGE_3_5_DISK_SIZE);
+    DiskImage_Free(pExpectedBlockImage);
+    printfSpy_Unhook();
+    printfSpy_Hook(512);
+
+    apImages[0] = createDiskImageUsingMemoryVfs();
+    apImages[1] = (DiskImage*)BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImage_SetVfs(apImages[1], (Vfs*)m_pMemoryVfs);
+    DiskImage_ProcessScriptFileForImages(apImages, 2, g_scriptFilename);
+
+    LONGS_EQUAL(2, printfSpy_GetCallCount());
+    STRCMP_EQUAL("NibbleDiskImageTest.script:1: error: RWTS16 insertion type isn't supported for this output image type."
+                 LINE_ENDING, printfSpy_GetLastErrorOutput());
+    LONGS_EQUAL(1, DiskImage_GetScriptErrorCount(apImages[0]));
+    LONGS_EQUAL(1, DiskImage_GetScriptErrorCount(apImages[1]));
+    CHECK(0 == memcmp(m_pImageOnDisk, DiskImage_GetImagePointer(apImages[0]), NIBBLE_DISK_IMAGE_SIZE));
+    CHECK(0 == memcmp(pExpectedBlockData, DiskImage_GetImagePointer(apImages[1]), BLOCK_DISK_IMAGE_3_5_DISK_SIZE));
+    free(pExpectedBlockData);
+    DiskImage_Free(apImages[1]);
+}
+
+TEST(NibbleDiskImage, ProcessScriptForImagesWithNoInsertions)
+{
+    DiskImage* pDiskImage;
+
+    createMemoryVfsWithSectorObjectFiles();
+    pDiskImage = createDiskImageUsingMemoryVfs();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_scriptFilename, "", 0);
+    DiskImage_ProcessScriptFileForImages(&pDiskImage, 1, g_scriptFilename);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(0, DiskImage_GetScriptErrorCount(pDiskImage));
+}
+
+TEST(NibbleDiskImage, ProcessMissingScriptForImages)
+{
+    DiskImage* pDiskImage;
+
+    createMemoryVfsWithSectorObjectFiles();
+    pDiskImage = createDiskImageUsingMemoryVfs();
+    __try_and_catch( DiskImage_ProcessScriptFileForImages(&pDiskImage, 1, g_scriptFilename) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
+
+TEST(NibbleDiskImage, FailAllAllocationsWhileProcessingScriptForImages)
+{
+    static const char script[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING;
+    DiskImage*        pDiskImage;
+    int               allocationToFail = 1;
+
+    ThreadPool_SetThreadCount(1);
+    createMemoryVfsWithSectorObjectFiles();
+    MemoryVfs_AddFile(m_pMemoryVfs, g_scriptFilename, script, strlen(script));
+    do
+    {
+        pDiskImage = createDiskImageUsingMemoryVfs();
+        MallocFailureInject_FailAllocation(allocationToFail++);
+        __try_and_catch( DiskImage_ProcessScriptFileForImages(&pDiskImage, 1, g_scriptFilename) );
+        MallocFailureInject_Restore();
+        if (getExceptionCode() == noException)
+            break;
+        CHECK_TRUE(getExceptionCode() == outOfMemoryException || getExceptionCode() == fileOpenException);
+        clearExceptionCode();
+    } while (allocationToFail < 100);
+    LONGS_EQUAL(0, DiskImage_GetScriptErrorCount(pDiskImage));
+}
+
+TEST(NibbleDiskImage, ProcessScriptForSidesRoutesRW18InsertionsToImageForTheirSide)
+{
+    static const char sideAScript[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING
+                                       "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,1,0" LINE_ENDING;
+    static const char sideBScript[] = "RW18,NibbleDiskImageAllOnes.sav,0,256,0xad,1,256" LINE_ENDING;
+    static const char script[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING
+                                 "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,1,0" LINE_ENDING
+                                 "RW18,NibbleDiskImageAllOnes.sav,0,256,0xad,1,256" LINE_ENDING
+                                 "RW18,NibbleDiskImageAllOnes.sav,0,256,0x79,2,0" LINE_ENDING;
+    static const unsigned int sides[] = { DISK_IMAGE_RW18_SIDE_0, DISK_IMAGE_RW18_SIDE_1 };
+    DiskImage*                apImages[2];
+    unsigned char*            pExpectedSideB;
+
+    createMemoryVfsWithSectorObjectFiles();
+    loadExpectedImage(sideBScript);
+    pExpectedSideB = m_pImageOnDisk;
+    m_pImageOnDisk = NULL;
+    loadExpectedImage(sideAScript);
+
+    apImages[0] = createDiskImageUsingMemoryVfs();
+    apImages[1] = (DiskImage*)NibbleDiskImage_Create();
+    DiskImage_SetVfs(apImages[1], (Vfs*)m_pMemoryVfs);
+    MemoryVfs_AddFile(m_pMemoryVfs, g_scriptFilename, script, strlen(script));
+    DiskImage_ProcessScriptFileForSides(apImages, sides, 2, g_scriptFilename);
+
+    LONGS_EQUAL(1, printfSpy_GetCallCount());
+    STRCMP_EQUAL("NibbleDiskImageTest.script:4: error: 0x79 side isn't one of the sides being built." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    LONGS_EQUAL(1, DiskImage_GetScriptErrorCount(apImages[0]));
+    LONGS_EQUAL(0, DiskImage_GetScriptErrorCount(apImages[1]));
+    CHECK(0 == memcmp(m_pImageOnDisk, DiskImage_GetImagePointer(apImages[0]), NIBBLE_DISK_IMAGE_SIZE));
+    CHECK(0 == memcmp(pExpectedSideB, DiskImage_GetImagePointer(apImages[1]), NIBBLE_DISK_IMAGE_SIZE));
+    free(pExpectedSideB);
+    DiskImage_Free(apImages[1]);
+}
+
+TEST(NibbleDiskImage, StatsCountScriptLinesObjectReadsAndEncodedSectors)
+{
+    static const char script[] = "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING
+                                 "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,1" LINE_ENDING
+                                 "RWTS16,NibbleDiskImageTestAllZeroes.sav,0,256,1,0" LINE_ENDING;
+    createMemoryVfsWithSectorObjectFiles();
+    buildImageUsingMemoryVfs(script, NULL);
+
+    const DiskImageStats* pStats = DiskImage_GetStats((DiskImage*)m_pNibbleDiskImage);
+    LONGS_EQUAL(3, pStats->scriptLineCount);
+    LONGS_EQUAL(2, pStats->objectFilesRead);
+    CHECK(2ULL * DISK_IMAGE_BYTES_PER_SECTOR == pStats->objectBytesRead);
+    LONGS_EQUAL(3, pStats->objectReferences);
+    LONGS_EQUAL(3, pStats->rwts16SectorsEncoded);
+    LONGS_EQUAL(0, pStats->rw18TracksEncoded);
+    LONGS_EQUAL(0, pStats->rw18TrackMerges);
+    CHECK(NIBBLE_DISK_IMAGE_SIZE == pStats->imageBytesWritten);
+    CHECK_TRUE(pStats->parseSeconds >= 0.0);
+    CHECK_TRUE(pStats->encodeSeconds >= 0.0);
+    CHECK_TRUE(pStats->writeSeconds >= 0.0);
+}
+
+TEST(NibbleDiskImage, StatsCountEachDirtyRW18TrackOnceWhenEncoded)
+{
+    static const char script[] = "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,20,0" LINE_ENDING
+                                 "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,20,256" LINE_ENDING
+                                 "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,21,0" LINE_ENDING;
+    createMemoryVfsWithSectorObjectFiles();
+    buildImageUsingMemoryVfs(script, NULL);
+
+    const DiskImageStats* pStats = DiskImage_GetStats((DiskImage*)m_pNibbleDiskImage);
+    LONGS_EQUAL(2, pStats->rw18TracksEncoded);
+    LONGS_EQUAL(0, pStats->rwts16SectorsEncoded);
+    LONGS_EQUAL(0, pStats->rw18TrackMerges);
+}
+
+TEST(NibbleDiskImage, StatsCountRW18TrackDecodedFromImageBeforeMerge)
+{
+    unsigned char* pNibbles = (unsigned char*)malloc(NIBBLE_DISK_IMAGE_SIZE);
+    CHECK(pNibbles != NULL);
+
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    writeOnesRW18Sectors(0, 0x0000, 18);
+    memcpy(pNibbles, NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage), NIBBLE_DISK_IMAGE_SIZE);
+    DiskImage_Free((DiskImage*)m_pNibbleDiskImage);
+
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    memcpy(DiskImage_GetImagePointer((DiskImage*)m_pNibbleDiskImage), pNibbles, NIBBLE_DISK_IMAGE_SIZE);
+    writeZeroRW18Sectors(0, 0x0100, 1);
+    writeZeroRW18Sectors(0, 0x0200, 1);
+    NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+
+    const DiskImageStats* pStats = DiskImage_GetStats((DiskImage*)m_pNibbleDiskImage);
+    LONGS_EQUAL(1, pStats->rw18TrackMerges);
+    LONGS_EQUAL(1, pStats->rw18TracksEncoded);
+    free(pNibbles);
+}
+
+TEST(NibbleDiskImage, ProcessRWTS16ScriptLinesWithCompressFlagPadToWholeSectors)
+{
+    unsigned char              sectorData[2 * DISK_IMAGE_BYTES_PER_SECTOR];
+    unsigned char              trackData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+    NibbleDiskImageTrackStatus status;
+    ByteBuffer                 compressed = { NULL, 0 };
+    unsigned int               compressedSize;
+
+    memset(sectorData, 0x11, DISK_IMAGE_BYTES_PER_SECTOR);
+    memset(sectorData + DISK_IMAGE_BYTES_PER_SECTOR, 0x22, DISK_IMAGE_BYTES_PER_SECTOR);
+    compressedSize = DiskImageCompress_Compress(&compressed, sectorData, sizeof(sectorData));
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    createTwoSectorObjectFile();
+
+    NibbleDiskImage_ProcessScript(m_pNibbleDiskImage, 
+                                  copy("RWTS16,NibbleDiskImageTestTwoSectors.sav,0,512,0,5,compress" LINE_ENDING
+                                       "RWTS16,NibbleDiskImageTestTwoSectors.sav,0,100,1,0,compress" LINE_ENDING));
+
+    const unsigned char*  pImage = NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+    const DiskImageStats* pStats = DiskImage_GetStats((DiskImage*)m_pNibbleDiskImage);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(2, pStats->compressedInserts);
+    CHECK(612ULL == pStats->compressedInputBytes);
+    CHECK(2ULL * DISK_IMAGE_BYTES_PER_SECTOR == pStats->compressedOutputBytes);
+    LONGS_EQUAL(2, pStats->rwts16SectorsEncoded);
+    NibbleDiskImage_DecodeTrack(pImage, 0, trackData, &status);
+    LONGS_EQUAL(1 << 5, status.goodSectors);
+    CHECK(0 == memcmp(compressed.pBuffer, trackData + 5 * DISK_IMAGE_BYTES_PER_SECTOR, compressedSize));
+    validateAllZeroes(trackData + 5 * DISK_IMAGE_BYTES_PER_SECTOR + compressedSize,
+                      DISK_IMAGE_BYTES_PER_SECTOR - compressedSize);
+    NibbleDiskImage_DecodeTrack(pImage + NIBBLE_DISK_IMAGE_NIBBLES_PER_TRACK, 1, trackData, &status);
+    LONGS_EQUAL(1 << 0, status.goodSectors);
+    ByteBuffer_Free(&compressed);
+}
+
+TEST(NibbleDiskImage, ScheduledRW18LinesStillMergeIntoSharedTracksAndLastLineWins)
+{
+    unsigned char trackData[DISK_IMAGE_RW18_BYTES_PER_TRACK];
+
+    ThreadPool_SetThreadCount(4);
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    createOnesSectorObjectFile();
+    createZeroSectorObjectFile();
+    createTwoSectorObjectFile();
+    createTextFile(g_scriptFilename, "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,5,0" LINE_ENDING
+                                     "RW18,NibbleDiskImageTestTwoSectors.sav,0,512,0xa9,5,4352" LINE_ENDING
+                                     "RW18,NibbleDiskImageTestAllZeroes.sav,0,256,0xa9,5,128" LINE_ENDING
+                                     "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,20,0" LINE_ENDING);
+
+    NibbleDiskImage_ProcessScriptFile(m_pNibbleDiskImage, g_scriptFilename);
+
+    LONGS_EQUAL(0, DiskImage_GetScriptErrorCount((DiskImage*)m_pNibbleDiskImage));
+    LONGS_EQUAL(1, printfSpy_GetCallCount());
+    STRCMP_EQUAL("NibbleDiskImageTest.script:3: warning: RW18 insertion overwrites data inserted by line 1." LINE_ENDING,
+                 printfSpy_GetLastErrorOutput());
+    NibbleDiskImage_ReadRW18Track(m_pNibbleDiskImage, 0xa9, 5, trackData, sizeof(trackData));
+    validateAllOnes(trackData, 128);
+    validateAllZeroes(trackData + 128, 128);
+    for (size_t i = 4352 ; i < sizeof(trackData) ; i++)
+        LONGS_EQUAL(0x11, trackData[i]);
+    NibbleDiskImage_ReadRW18Track(m_pNibbleDiskImage, 0xa9, 6, trackData, sizeof(trackData));
+    for (size_t i = 0 ; i < DISK_IMAGE_BYTES_PER_SECTOR ; i++)
+        LONGS_EQUAL(0x22, trackData[i]);
+    NibbleDiskImage_ReadRW18Track(m_pNibbleDiskImage, 0xa9, 20, trackData, sizeof(trackData));
+    validateAllOnes(trackData, DISK_IMAGE_BYTES_PER_SECTOR);
+}
+
+TEST(NibbleDiskImage, RWTS16AndRW18LinesForDifferentTracksAreNotReportedAsOverlapping)
+{
+    ThreadPool_SetThreadCount(4);
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    createOnesSectorObjectFile();
+    createTextFile(g_scriptFilename, "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,0" LINE_ENDING
+                                     "RW18,NibbleDiskImageAllOnes.sav,0,256,0xa9,1,0" LINE_ENDING
+                                     "RW18,NibbleDiskImageAllOnes.sav,0,256,0xad,2,0" LINE_ENDING
+                                     "RWTS16,NibbleDiskImageAllOnes.sav,0,256,0,1" LINE_ENDING);
+
+    NibbleDiskImage_ProcessScriptFile(m_pNibbleDiskImage, g_scriptFilename);
+
+    LONGS_EQUAL(0, DiskImage_GetScriptErrorCount((DiskImage*)m_pNibbleDiskImage));
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+    LONGS_EQUAL(2, DiskImage_GetStats((DiskImage*)m_pNibbleDiskImage)->rw18TracksEncoded);
+    LONGS_EQUAL(2, DiskImage_GetStats((DiskImage*)m_pNibbleDiskImage)->rwts16SectorsEncoded);
+}
+
+TEST(NibbleDiskImage, InsertionWhichFailsPartWayThroughIsReportedAgainstItsLine)
+{
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    createTwoSectorObjectFile();
+    createZeroSectorObjectFile();
+    createTextFile(g_scriptFilename, "RWTS16,NibbleDiskImageTestTwoSectors.sav,0,512,34,15" LINE_ENDING
+                                     "RWTS16,NibbleDiskImageTestAllZeroes.sav,0,256,0,0" LINE_ENDING);
+
+    NibbleDiskImage_ProcessScriptFile(m_pNibbleDiskImage, g_scriptFilename);
+
+    LONGS_EQUAL(1, DiskImage_GetScriptErrorCount((DiskImage*)m_pNibbleDiskImage));
+    STRCMP_EQUAL("NibbleDiskImageTest.script:1: error: Write starting at track/sector 34/15 won't fit in output image "
+                 "file." LINE_ENDING, printfSpy_GetLastErrorOutput());
+    const unsigned char* pImage = NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+    validateRWTS16SectorContainsZeroData(pImage, 0, 0);
+}
+
+TEST(NibbleDiskImage, InsertionErrorsAndParseErrorsAreReportedInScriptOrder)
+{
+    m_pNibbleDiskImage = NibbleDiskImage_Create();
+    createTwoSectorObjectFile();
+    createZeroSectorObjectFile();
+    createTextFile(g_scriptFilename, "RWTS16,NibbleDiskImageTestTwoSectors.sav,0,512,34,15" LINE_ENDING
+                                     "RWTS16,NibbleDiskImageTestMissing.sav,0,256,0,1" LINE_ENDING
+                                     "RWTS16,NibbleDiskImageTestAllZeroes.sav,0,256,0,0" LINE_ENDING);
+
+    NibbleDiskImage_ProcessScriptFile(m_pNibbleDiskImage, g_scriptFilename);
+
+    LONGS_EQUAL(2, DiskImage_GetScriptErrorCount((DiskImage*)m_pNibbleDiskImage));
+    LONGS_EQUAL(2, printfSpy_GetCallCount());
+    STRCMP_EQUAL("NibbleDiskImageTest.script:1: error: Write starting at track/sector 34/15 won't fit in output image "
+                 "file." LINE_ENDING, printfSpy_GetPreviousOutput());
+    STRCMP_EQUAL("NibbleDiskImageTest.script:2: error: Failed to open 'NibbleDiskImageTestMissing.sav' object file."
+                 LINE_ENDING, printfSpy_GetLastErrorOutput());
+    const unsigned char* pImage = NibbleDiskImage_GetImagePointer(m_pNibbleDiskImage);
+    validateRWTS16SectorContainsZeroData(pImage, 0, 0);
+}
@@ -23,6 +23,10 @@ int    (*hook_fseek)(FILE* stream, long offset, int whence) = fseek;
 long   (*hook_ftell)(FILE* stream) = ftell;
 size_t (*hook_fwrite)(const void* ptr, size_t size, size_t nitems, FILE* stream) = fwrite;
 size_t (*hook_fread)(void* ptr, size_t size, size_t nitems, FILE* stream) = fread;
+ssize_t (*hook_read)(int fildes, void* buf, size_t nbyte) = read;
+off_t  (*hook_lseek)(int fildes, off_t offset, int whence) = lseek;
+ssize_t (*hook_writev)(int fildes, const struct iovec* iov, int iovcnt) = writev;
+int    (*hook_rename)(const char* oldPath, const char* newPath) = rename;
 
 
 static FILE*  g_fopenFailureReturn;
@@ -32,6 +36,12 @@ static long   g_ftellFailureReturn;
 static size_t g_fwriteFailureReturn;
 static size_t g_freadFailureReturn;
 static int    g_freadToFail;
+static ssize_t g_readFailureReturn;
+static int    g_readToFail;
+static off_t  g_lseekFailureReturn;
+static int    g_lseekCallsToPass;
+static ssize_t g_writevFailureReturn;
+static int    g_renameFailureReturn;
 
 
 static FILE* mock_fopen(const char* filename, const char* mode);
@@ -156,3 +166,108 @@ void freadRestore(void)
     hook_fread = fread;
     g_freadToFail = 0;
 }
+
+
+static ssize_t mock_read(int fildes, void* buf, size_t nbyte);
+void readFail(ssize_t failureReturn)
+{
+    g_readFailureReturn = failureReturn;
+    g_readToFail = FAIL_ALL_CALLS;
+    hook_read = mock_read;
+}
+
+static ssize_t mock_read(int fildes, void* buf, size_t nbyte)
+{
+    if (g_readToFail > 0)
+    {
+        if (--g_readToFail == 0)
+        {
+            readRestore();
+            return g_readFailureReturn;
+        }
+        return read(fildes, buf, nbyte);
+    }
+    return g_readFailureReturn;
+}
+
+
+void readToFail(int readToFail)
+{
+    g_readToFail = readToFail;
+}
+
+
+void readRestore(void)
+{
+    hook_read = read;
+    g_readToFail = 0;
+}
+
+
+static off_t mock_lseek(int fildes, off_t offset, int whence);
+void lseekSetFailureCode(off_t failureReturn)
+{
+    g_lseekFailureReturn = failureReturn;
+    hook_lseek = mock_lseek;
+}
+
+static off_t mock_lseek(int fildes, off_t offset, int whence)
+{
+    if (g_lseekCallsToPass > 0)
+    {
+        g_lseekCallsToPass--;
+        return lseek(fildes, offset, whence);
+    }
+    
+    return g_lseekFailureReturn;
+}
+
+
+void lseekSetCallsBeforeFailure(int callCountToAllowBeforeFailing)
+{
+    g_lseekCallsToPass = callCountToAllowBeforeFailing;
+}
+
+
+void lseekRestore(void)
+{
+    hook_lseek = lseek;
+}
+
+
+static ssize_t mock_writev(int fildes, const struct iovec* iov, int iovcnt);
+void writevFail(ssize_t failureReturn)
+{
+    g_writevFailureReturn = failureReturn;
+    hook_writev = mock_writev;
+}
+
+static ssize_t mock_writev(int fildes, const struct iovec* iov, int iovcnt)
+{
+    return g_writevFailureReturn;
+}
+
+
+void writevRestore(void)
+{
+    hook_writev = writev;
+}
+
+
+static int mock_rename(const char* oldPath, const char* newPath);
+void renameFail(int failureReturn)
+{
+    g_renameFailureReturn = failureReturn;
+    hook_rename = mock_rename;
+}
+
+static int mock_rename(const char* oldPath, const char* newPath)
+{
+    return g_renameFailureReturn;
+}
+
+
+void renameRestore(void)
+{
+    hook_rename = rename;
+}
@@ -151,3 +151,94 @@ TEST(FileFailureInject, FailSecondOutOfThreeFReads)
     LONGS_EQUAL(1, hook_fread(buffer, 1, 1, m_pFile));
     freadRestore();
 }
+
+TEST(FileFailureInject, SuccessfulRead)
+{
+    char buffer[16];
+    
+    createSmallTestFile();
+    LONGS_EQUAL(1, hook_read(fileno(m_pFile), buffer, 1));
+}
+
+TEST(FileFailureInject, FailRead)
+{
+    char buffer[16];
+    
+    createSmallTestFile();
+    readFail(-1);
+    LONGS_EQUAL(-1, hook_read(fileno(m_pFile), buffer, 1));
+    readRestore();
+}
+
+TEST(FileFailureInject, FailSecondOutOfThreeReads)
+{
+    char buffer[16];
+    
+    createSmallTestFile();
+    readFail(-1);
+    readToFail(2);
+    LONGS_EQUAL(1, hook_read(fileno(m_pFile), buffer, 1));
+    LONGS_EQUAL(-1, hook_read(fileno(m_pFile), buffer, 1));
+    LONGS_EQUAL(1, hook_read(fileno(m_pFile), buffer, 1));
+    readRestore();
+}
+
+TEST(FileFailureInject, SuccessfulLSeek)
+{
+    createSmallTestFile();
+    LONGS_EQUAL(5, hook_lseek(fileno(m_pFile), 0, SEEK_END));
+}
+
+TEST(FileFailureInject, FailLSeek)
+{
+    createSmallTestFile();
+    lseekSetFailureCode(-1);
+    lseekSetCallsBeforeFailure(0);
+    LONGS_EQUAL(-1, hook_lseek(fileno(m_pFile), 0, SEEK_SET));
+    lseekRestore();
+}
+
+TEST(FileFailureInject, FailSecondLSeek)
+{
+    createSmallTestFile();
+    lseekSetFailureCode(-1);
+    lseekSetCallsBeforeFailure(1);
+    LONGS_EQUAL(0, hook_lseek(fileno(m_pFile), 0, SEEK_SET));
+    LONGS_EQUAL(-1, hook_lseek(fileno(m_pFile), 0, SEEK_SET));
+    lseekRestore();
+}
+
+TEST(FileFailureInject, SuccessfulWriteV)
+{
+    struct iovec iov = { (void*)" ", 1 };
+    
+    openFile();
+    LONGS_EQUAL(1, hook_writev(fileno(m_pFile), &iov, 1));
+}
+
+TEST(FileFailureInject, FailWriteV)
+{
+    struct iovec iov = { (void*)" ", 1 };
+    
+    openFile();
+    writevFail(-1);
+    LONGS_EQUAL(-1, hook_writev(fileno(m_pFile), &iov, 1));
+    writevRestore();
+}
+
+TEST(FileFailureInject, SuccessfulRename)
+{
+    static const char* renamedFilename = "FileFailureInjectTestCpp.renamed";
+    
+    createSmallTestFile();
+    LONGS_EQUAL(0, hook_rename(testFilename, renamedFilename));
+    LONGS_EQUAL(0, remove(renamedFilename));
+}
+
+TEST(FileFailureInject, FailRename)
+{
+    createSmallTestFile();
+    renameFail(-1);
+    LONGS_EQUAL(-1, hook_rename(testFilename, "FileFailureInjectTestCpp.renamed"));
+    renameRestore();
+}
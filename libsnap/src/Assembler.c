@@ -23,6 +23,30 @@
 #include "LupSource.h"
 
 
+static Vfs* getVfs(const AssemblerInitParams* pParams)
+{
+    return pParams ? pParams->pVfs : NULL;
+}
+
+static const char* getBundleFilename(const AssemblerInitParams* pParams)
+{
+    return pParams ? pParams->pBundleFilename : NULL;
+}
+
+static int hasObjectHandler(const AssemblerInitParams* pParams)
+{
+    return pParams && pParams->objectHandler;
+}
+
+static const char* getOutputDirectory(const AssemblerInitParams* pParams)
+{
+    /* Bundle entries are looked up by bare object filename so the output directory only applies to loose files. */
+    if (!pParams || pParams->pBundleFilename)
+        return NULL;
+    return pParams->pOutputDirectory;
+}
+
+
 static void commonObjectInit(Assembler* pThis, const AssemblerInitParams* pParams, TextFile* pTextFile);
 static FILE* createListFileOrRedirectToStdOut(Assembler* pThis, const AssemblerInitParams* pParams);
 static void createParseObjectForPutSearchPath(Assembler* ptThis, const AssemblerInitParams* pParams);
@@ -73,8 +97,8 @@ static void commonObjectInit(Assembler* pThis, const AssemblerInitParams* pParam
         pListFile = createListFileOrRedirectToStdOut(pThis, pParams);
         pThis->pListFile = ListFile_Create(pListFile);
         pThis->pSymbols = SymbolTable_Create(NUMBER_OF_SYMBOL_TABLE_HASH_BUCKETS);
-        pThis->pObjectBuffer = BinaryBuffer_Create(SIZE_OF_OBJECT_AND_DUMMY_BUFFERS);
-        pThis->pDummyBuffer = BinaryBuffer_Create(SIZE_OF_OBJECT_AND_DUMMY_BUFFERS);
+        pThis->pObjectBuffer = BinaryBuffer_Create(SIZE_OF_OBJECT_AND_DUMMY_SEGMENTS);
+        pThis->pDummyBuffer = BinaryBuffer_Create(SIZE_OF_OBJECT_AND_DUMMY_SEGMENTS);
         createParseObjectForPutSearchPath(pThis, pParams);
         createFullInstructionSetTables(pThis);
         pThis->pInitParams = pParams;
@@ -95,7 +119,7 @@ static FILE* createListFileOrRedirectToStdOut(Assembler* pThis, const AssemblerI
     if (!pParams || !pParams->pListFilename)
         return stdout;
         
-    pThis->pFileForListing = fopen(pParams->pListFilename, "wb");
+    pThis->pFileForListing = Vfs_OpenStream(pParams->pVfs, pParams->pListFilename);
     if (!pThis->pFileForListing)
         __throw(fileOpenException);
     return pThis->pFileForListing;
@@ -274,7 +298,7 @@ __throws Assembler* Assembler_CreateFromFile(const char* pSourceFilename, const
         
         SizedString sourceFilename = SizedString_InitFromString(pSourceFilename);
         pThis = allocateAndZero(sizeof(*pThis));
-        pTextFile = TextFile_CreateFromFile(NULL, &sourceFilename, NULL);
+        pTextFile = TextFile_CreateFromVfs(getVfs(pParams), NULL, &sourceFilename, NULL);
         commonObjectInit(pThis, pParams, pTextFile);
     }
     __catch
@@ -345,6 +369,11 @@ static void freeInstructionSets(Assembler* pThis)
 
 
 static void firstPass(Assembler* pThis);
+static int isStreamingListing(Assembler* pThis);
+static void listAndFreeLinesWithNoPendingForwardReferences(Assembler* pThis);
+static void writeQueuedObjectFilesIfNoLinesArePending(Assembler* pThis);
+static int isLineReadyToBeFreed(Assembler* pThis, LineInfo* pLineInfo);
+static void freeLineAtHeadOfList(Assembler* pThis);
 static int getNextSourceLine(Assembler* pThis, SizedString* pLine);
 static int attemptToPopTextFileAndGetNextLine(Assembler* pThis, SizedString* pLine);
 static void parseLine(Assembler* pThis, const SizedString* pLine);
@@ -453,6 +482,7 @@ static void checkForUndefinedSymbols(Assembler* pThis);
 static void checkSymbolForOutstandingForwardReferences(Assembler* pThis, Symbol* pSymbol);
 static void checkForOpenConditionals(Assembler* pThis);
 static void secondPass(Assembler* pThis);
+static void writeObjectFiles(Assembler* pThis, int stageFiles);
 static void outputListFile(Assembler* pThis);
 void Assembler_Run(Assembler* pThis)
 {
@@ -466,7 +496,71 @@ static void firstPass(Assembler* pThis)
 {
     SizedString line;
     while (getNextSourceLine(pThis, &line))
+    {
         parseLine(pThis, &line);
+        if (isStreamingListing(pThis))
+        {
+            listAndFreeLinesWithNoPendingForwardReferences(pThis);
+            writeQueuedObjectFilesIfNoLinesArePending(pThis);
+        }
+    }
+}
+
+static int isStreamingListing(Assembler* pThis)
+{
+    return pThis->pInitParams && pThis->pInitParams->streamListing;
+}
+
+static void listAndFreeLinesWithNoPendingForwardReferences(Assembler* pThis)
+{
+    /* Lines are listed in source order so a line still waiting on a forward reference holds back all lines after it. */
+    while (isLineReadyToBeFreed(pThis, pThis->linesHead.pNext))
+    {
+        ListFile_OutputLine(pThis->pListFile, pThis->linesHead.pNext);
+        freeLineAtHeadOfList(pThis);
+    }
+}
+
+static void writeQueuedObjectFilesIfNoLinesArePending(Assembler* pThis)
+{
+    /* Once only the current line remains nothing refers back into the object buffers so queued saves can be written
+       now and the segments holding earlier ORG sections recycled, bounding memory by the largest section instead of
+       by the whole output.  The files are only staged since a later line could still fail the assembly, in which
+       case none of them should replace what is already on disk.  A bundle or an object handler can't be staged so
+       their output waits for the whole assembly to succeed. */
+    if (pThis->linesHead.pNext != pThis->pLineInfo || pThis->errorCount > 0 || 
+        getBundleFilename(pThis->pInitParams) || hasObjectHandler(pThis->pInitParams))
+        return;
+    __try
+    {
+        writeObjectFiles(pThis, TRUE);
+    }
+    __catch
+    {
+        LOG_ERROR(pThis, "Failed to save %s.", "output");
+        __rethrow;
+    }
+    BinaryBuffer_ReleaseWrittenSegments(pThis->pObjectBuffer);
+    BinaryBuffer_ReleaseWrittenSegments(pThis->pDummyBuffer);
+}
+
+static int isLineReadyToBeFreed(Assembler* pThis, LineInfo* pLineInfo)
+{
+    /* The current line is always kept around since error logging and the next line's setup refer to it. */
+    return pLineInfo && pLineInfo != pThis->pLineInfo && pLineInfo->forwardReferenceCount == 0;
+}
+
+static void freeLineAtHeadOfList(Assembler* pThis)
+{
+    LineInfo* pLineInfo = pThis->linesHead.pNext;
+    Symbol*   pSymbol = pLineInfo->pSymbol;
+
+    /* Symbols defined on this line must still look defined so point them at the same sentinel used for ]1 - ]9. */
+    if (pSymbol && pSymbol->pDefinedLine == pLineInfo)
+        pSymbol->pDefinedLine = &pThis->linesHead;
+    pThis->linesHead.pNext = pLineInfo->pNext;
+    pThis->pendingLineCount--;
+    free(pLineInfo);
 }
 
 static int getNextSourceLine(Assembler* pThis, SizedString* pLine)
@@ -519,6 +613,8 @@ static void prepareLineInfoForThisLine(Assembler* pThis, const SizedString* pLin
     pLineInfo->flags = pThis->pConditionals ? pThis->pConditionals->flags & CONDITIONAL_SKIP_STATES_MASK : 0;
     pThis->pLineInfo->pNext = pLineInfo;
     pThis->pLineInfo = pLineInfo;
+    if (++pThis->pendingLineCount > pThis->maxPendingLineCount)
+        pThis->maxPendingLineCount = pThis->pendingLineCount;
 }
 
 static void rememberLabelIfGlobal(Assembler* pThis)
@@ -822,7 +918,7 @@ static void reallocLineInfoMachineCodeBytes(Assembler* pThis, size_t bytesToAllo
     }
     __catch
     {
-        LOG_ERROR(pThis, "Exceeded the %d allowed bytes in the object file.", SIZE_OF_OBJECT_AND_DUMMY_BUFFERS);
+        LOG_ERROR(pThis, "Ran out of memory for %s.", "object file bytes");
         pThis->pLineInfo->machineCodeSize = 0;
         __rethrow;
     }
@@ -1382,7 +1478,7 @@ static void handleSAV(Assembler* pThis)
     {
         validateOperandWasProvided(pThis);
         BinaryBuffer_QueueWriteToFile(pThis->pObjectBuffer, 
-                                      pThis->pInitParams ? pThis->pInitParams->pOutputDirectory : NULL, 
+                                      getOutputDirectory(pThis->pInitParams), 
                                       &pThis->parsedLine.operands,
                                       NULL);
     }
@@ -1515,7 +1611,7 @@ static TextFile* openPutFileUsingSearchPath(Assembler* pThis, const SizedString*
     size_t             i;
     
     if (!pThis->pPutSearchPath)
-        return TextFile_CreateFromFile(NULL, pFilename, ".S");
+        return TextFile_CreateFromVfs(getVfs(pThis->pInitParams), NULL, pFilename, ".S");
         
     fieldCount = ParseCSV_FieldCount(pThis->pPutSearchPath);
     pFields = ParseCSV_FieldPointers(pThis->pPutSearchPath);
@@ -1523,7 +1619,7 @@ static TextFile* openPutFileUsingSearchPath(Assembler* pThis, const SizedString*
     {
         __try
         {
-            pTextFile = TextFile_CreateFromFile(&pFields[i], pFilename, ".S");
+            pTextFile = TextFile_CreateFromVfs(getVfs(pThis->pInitParams), &pFields[i], pFilename, ".S");
             break;
         }
         __catch
@@ -1568,7 +1664,7 @@ static void handleUSR(Assembler* pThis)
             __throw(invalidArgumentCountException);
 
         BinaryBuffer_QueueRW18WriteToFile(pThis->pObjectBuffer, 
-                                          pThis->pInitParams ? pThis->pInitParams->pOutputDirectory : NULL, 
+                                          getOutputDirectory(pThis->pInitParams), 
                                           &filename,
                                           NULL,
                                           side, track, offset);
@@ -1656,7 +1752,7 @@ static void pushConditional(Assembler* pThis, int skipSourceLines)
             pAlloc->flags |= CONDITIONAL_SKIP_SOURCE;
         pAlloc->flags |= determineInheritedConditionalSkipSourceLineState(pThis);
         pAlloc->pPrev = pThis->pConditionals;
-        pAlloc->pLineInfo = pThis->pLineInfo;
+        pAlloc->lineInfo = *pThis->pLineInfo;
         pThis->pConditionals = pAlloc;
     }
     __catch
@@ -1879,18 +1975,26 @@ static void checkSymbolForOutstandingForwardReferences(Assembler* pThis, Symbol*
 
 static void checkForOpenConditionals(Assembler* pThis)
 {
-    if (pThis->pConditionals)
-        LOG_LINE_WARNING(pThis, pThis->pConditionals->pLineInfo, "%s directive is missing matching FIN directive.", "DO/IF");
+    LineInfo* pConditionalLineInfo;
+    
+    if (!pThis->pConditionals)
+        return;
+    pConditionalLineInfo = &pThis->pConditionals->lineInfo;
+    LOG_LINE_WARNING(pThis, pConditionalLineInfo, "%s directive is missing matching FIN directive.", "DO/IF");
 }
 
 static void secondPass(Assembler* pThis)
 {
     outputListFile(pThis);
     if (pThis->errorCount > 0)
+    {
+        BinaryBuffer_DiscardStagedFiles(pThis->pObjectBuffer);
         return;
+    }
     __try
     {
-        BinaryBuffer_ProcessWriteFileQueue(pThis->pObjectBuffer);
+        writeObjectFiles(pThis, isStreamingListing(pThis));
+        BinaryBuffer_CommitStagedFiles(pThis->pObjectBuffer);
     }
     __catch
     {
@@ -1899,6 +2003,23 @@ static void secondPass(Assembler* pThis)
     }
 }
 
+static void writeObjectFiles(Assembler* pThis, int stageFiles)
+{
+    const AssemblerInitParams* pParams = pThis->pInitParams;
+    const char*                pBundleFilename = getBundleFilename(pParams);
+    
+    if (hasObjectHandler(pParams))
+        BinaryBuffer_ProcessWriteFileQueueToHandler(pThis->pObjectBuffer, 
+                                                    pParams->objectHandler, 
+                                                    pParams->pObjectHandlerContext);
+    else if (pBundleFilename)
+        BinaryBuffer_ProcessWriteFileQueueToBundle(pThis->pObjectBuffer, getVfs(pThis->pInitParams), pBundleFilename);
+    else if (stageFiles)
+        BinaryBuffer_StageWriteFileQueue(pThis->pObjectBuffer, getVfs(pThis->pInitParams));
+    else
+        BinaryBuffer_ProcessWriteFileQueue(pThis->pObjectBuffer, getVfs(pThis->pInitParams));
+}
+
 static void outputListFile(Assembler* pThis)
 {
     LineInfo* pCurr = pThis->linesHead.pNext;
@@ -1923,6 +2044,18 @@ unsigned int Assembler_GetWarningCount(Assembler* pThis)
 }
 
 
+unsigned int Assembler_GetWrittenFileCount(Assembler* pThis)
+{
+    return BinaryBuffer_GetWrittenFileCount(pThis->pObjectBuffer);
+}
+
+
+unsigned int Assembler_GetSkippedFileCount(Assembler* pThis)
+{
+    return BinaryBuffer_GetSkippedFileCount(pThis->pObjectBuffer);
+}
+
+
 static void throwIfForwardReferencesAreDisallowed(Assembler* pThis);
 static int areForwardReferencesDisallowed(Assembler* pThis);
 __throws Symbol* Assembler_FindLabel(Assembler* pThis, SizedString* pLabelName)
@@ -28,7 +28,7 @@
 
 
 #define NUMBER_OF_SYMBOL_TABLE_HASH_BUCKETS 511
-#define SIZE_OF_OBJECT_AND_DUMMY_BUFFERS    (64 * 1024)
+#define SIZE_OF_OBJECT_AND_DUMMY_SEGMENTS   (64 * 1024)
 
 /* Bits in the Assembler::flags fields. */
 #define ASSEMBLER_LUP       1
@@ -63,7 +63,7 @@ typedef struct OpCodeEntry
 typedef struct Conditional
 {
     struct Conditional* pPrev;
-    LineInfo*           pLineInfo;
+    LineInfo            lineInfo;
     unsigned int        flags;
 } Conditional;
 
@@ -90,6 +90,8 @@ struct Assembler
     unsigned int               flags;
     unsigned int               errorCount;
     unsigned int               warningCount;
+    unsigned int               pendingLineCount;
+    unsigned int               maxPendingLineCount;
     unsigned short             programCounter;
     unsigned short             programCounterBeforeDUM;
 };
@@ -4,22 +4,37 @@
     modify it under the terms of the GNU General Public License
     as published by the Free Software Foundation; either version 2
     of the License, or (at your option) any later version.
-
+    
     This program is distributed in the hope that it will be useful,
     but WITHOUT ANY WARRANTY; without even the implied warranty of
     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
     GNU General Public License for more details.
 */
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include "BinaryBuffer.h"
 #include "BinaryBufferTest.h"
+#include "ObjectBundle.h"
+#include "ThreadPool.h"
 #include "util.h"
 
 
+typedef struct BufferSegment
+{
+    struct BufferSegment* pNext;
+    unsigned char*        pStart;
+    unsigned char*        pEnd;
+    unsigned char*        pFilled;
+} BufferSegment;
+
 typedef struct FileWriteEntry
 {
     struct FileWriteEntry* pNext;
+    BufferSegment*         pBaseSegment;
     unsigned char*         pBase;
+    BufferSegment*         pLastSegment;
+    unsigned char*         pLast;
     size_t                 contentLength;
     size_t                 headerLength;
     union
@@ -27,50 +42,151 @@ typedef struct FileWriteEntry
         SavFileHeader     savFileHeader;
         RW18SavFileHeader rw18FileHeader;
     };
+    int                    exceptionCode;
+    int                    isUnchanged;
     unsigned short         baseAddress;
     char                   filename[PATH_LENGTH];
 } FileWriteEntry;
 
+/* A file which has been written to its temporary file but not yet renamed over the real one. */
+typedef struct StagedFile
+{
+    struct StagedFile* pNext;
+    struct StagedFile* pReplaces;
+    Vfs*               pVfs;
+    int                isRevertedToDisk;
+    char               filename[PATH_LENGTH];
+    char               tempFilename[PATH_LENGTH + 32];
+} StagedFile;
+
+typedef struct FileWriteQueue
+{
+    FileWriteEntry** ppEntries;
+    StagedFile**     ppStagedFiles;
+    Vfs*             pVfs;
+} FileWriteQueue;
+
+typedef int (*ContentCallback)(void* pContext, const void* pData, size_t size);
+
+/* Describes the bytes of an output file as a sequence of buffers which walk() hands to a callback in order. */
+typedef struct OutputContent
+{
+    const char* pFilename;
+    size_t      length;
+    int         (*walk)(void* pvSource, ContentCallback callback, void* pContext);
+    void*       pvSource;
+} OutputContent;
+
+typedef struct ContentMatcher
+{
+    Vfs*     pVfs;
+    VfsFile* pFile;
+} ContentMatcher;
+
+typedef struct GatherWriter
+{
+    Vfs*      pVfs;
+    VfsFile*  pFile;
+    VfsBuffer buffers[16];
+    size_t    bufferCount;
+    size_t    bytesWritten;
+} GatherWriter;
+
+typedef struct BundleContent
+{
+    unsigned char*   pIndex;
+    FileWriteEntry** ppEntries;
+    size_t           indexSize;
+    size_t           entryCount;
+    size_t           length;
+} BundleContent;
+
 
+/* The buffer is a list of segments which never move once allocated so that pointers handed out by
+   BinaryBuffer_Alloc() stay valid.  An allocation never straddles two segments so the image saved by a single SAV
+   can be spread across several of them. */
 struct BinaryBuffer
 {
-    unsigned char*  pBuffer;
-    unsigned char*  pEnd;
+    BufferSegment*  pSegmentHead;
+    BufferSegment*  pSegmentTail;
+    BufferSegment*  pSpareSegment;
+    BufferSegment*  pBaseSegment;
     unsigned char*  pCurrent;
     unsigned char*  pLastAlloc;
     unsigned char*  pBase;
     FileWriteEntry* pFileWriteHead;
     FileWriteEntry* pFileWriteTail;
+    StagedFile*     pStagedHead;
+    size_t          segmentSize;
     size_t          allocationToFail;
+    int             hasUnprocessedWrites;
+    unsigned int    writtenFileCount;
+    unsigned int    skippedFileCount;
+    unsigned int    releasedWrittenFileCount;
+    unsigned int    releasedSkippedFileCount;
+    unsigned int    stageSequence;
     unsigned short  baseAddress;
 };
 
 static void* allocateAndZero(size_t sizeToAllocate);
-__throws BinaryBuffer* BinaryBuffer_Create(size_t bufferSize)
+static BufferSegment* allocateSegment(BinaryBuffer* pThis, size_t minimumSize);
+__throws BinaryBuffer* BinaryBuffer_Create(size_t segmentSize)
 {
     BinaryBuffer* pThis = allocateAndZero(sizeof(*pThis));
-    pThis->pBuffer = malloc(bufferSize);
-    if (!pThis->pBuffer)
+    
+    pThis->segmentSize = segmentSize;
+    __try
+    {
+        pThis->pSegmentHead = allocateSegment(pThis, segmentSize);
+    }
+    __catch
     {
         BinaryBuffer_Free(pThis);
-        __throw(outOfMemoryException);
+        __rethrow;
     }
-    pThis->pCurrent = pThis->pBuffer;
-    pThis->pBase = pThis->pBuffer;
-    pThis->pEnd = pThis->pCurrent + bufferSize;
+    pThis->pSegmentTail = pThis->pSegmentHead;
+    pThis->pBaseSegment = pThis->pSegmentHead;
+    pThis->pCurrent = pThis->pSegmentHead->pStart;
+    pThis->pBase = pThis->pCurrent;
     
     return pThis;
 }
 
+static BufferSegment* allocateSegment(BinaryBuffer* pThis, size_t minimumSize)
+{
+    size_t         dataSize = minimumSize > pThis->segmentSize ? minimumSize : pThis->segmentSize;
+    BufferSegment* pSegment = pThis->pSpareSegment;
+    
+    if (pSegment && (size_t)(pSegment->pEnd - pSegment->pStart) >= dataSize)
+    {
+        pThis->pSpareSegment = NULL;
+    }
+    else
+    {
+        pSegment = malloc(sizeof(*pSegment) + dataSize);
+        if (!pSegment)
+            __throw(outOfMemoryException);
+        pSegment->pStart = (unsigned char*)(pSegment + 1);
+        pSegment->pEnd = pSegment->pStart + dataSize;
+    }
+    pSegment->pNext = NULL;
+    pSegment->pFilled = pSegment->pStart;
+    
+    return pSegment;
+}
+
 
 static void freeFileWriteEntries(BinaryBuffer* pThis);
+static void freeSegments(BufferSegment* pSegment);
 void BinaryBuffer_Free(BinaryBuffer* pThis)
 {
     if (!pThis)
         return;
-        
+    
+    BinaryBuffer_DiscardStagedFiles(pThis);
     freeFileWriteEntries(pThis);
-    free(pThis->pBuffer);
+    freeSegments(pThis->pSegmentHead);
+    free(pThis->pSpareSegment);
     free(pThis);
 }
 
@@ -84,18 +200,34 @@ static void freeFileWriteEntries(BinaryBuffer* pThis)
         free(pEntry);
         pEntry = pNext;
     }
+    pThis->pFileWriteHead = NULL;
+    pThis->pFileWriteTail = NULL;
+}
+
+static void freeSegments(BufferSegment* pSegment)
+{
+    while (pSegment)
+    {
+        BufferSegment* pNext = pSegment->pNext;
+        free(pSegment);
+        pSegment = pNext;
+    }
 }
 
 
-static int shouldInjectFailureOnThisAllocation(BinaryBuffer* pThis);
+static int  shouldInjectFailureOnThisAllocation(BinaryBuffer* pThis);
+static void startNewSegment(BinaryBuffer* pThis, size_t minimumSize);
 __throws unsigned char* BinaryBuffer_Alloc(BinaryBuffer* pThis, size_t bytesToAllocate)
 {
-    size_t         bytesLeft = pThis->pEnd - pThis->pCurrent;
-    unsigned char* pAlloc = pThis->pCurrent;
+    size_t         bytesLeft = pThis->pSegmentTail->pEnd - pThis->pCurrent;
+    unsigned char* pAlloc;
     
-    if (bytesLeft < bytesToAllocate || shouldInjectFailureOnThisAllocation(pThis))
+    if (shouldInjectFailureOnThisAllocation(pThis))
         __throw(outOfMemoryException);
-
+    if (bytesLeft < bytesToAllocate)
+        startNewSegment(pThis, bytesToAllocate);
+    
+    pAlloc = pThis->pCurrent;
     pThis->pCurrent += bytesToAllocate;
     pThis->pLastAlloc = pAlloc;
     
@@ -109,21 +241,46 @@ static int shouldInjectFailureOnThisAllocation(BinaryBuffer* pThis)
     
     if (--pThis->allocationToFail == 0)
         return TRUE;
-        
+    
     return FALSE;
 }
 
+static void startNewSegment(BinaryBuffer* pThis, size_t minimumSize)
+{
+    BufferSegment* pSegment = allocateSegment(pThis, minimumSize);
+    int            isSectionEmpty = pThis->pBase == pThis->pCurrent;
+    
+    pThis->pSegmentTail->pFilled = pThis->pCurrent;
+    pThis->pSegmentTail->pNext = pSegment;
+    pThis->pSegmentTail = pSegment;
+    pThis->pCurrent = pSegment->pStart;
+    if (isSectionEmpty)
+    {
+        pThis->pBaseSegment = pSegment;
+        pThis->pBase = pThis->pCurrent;
+    }
+}
+
 
 __throws unsigned char* BinaryBuffer_Realloc(BinaryBuffer* pThis, unsigned char* pToRealloc, size_t bytesToAllocate)
 {
+    unsigned char* pAlloc;
+    size_t         oldSize;
+
     if (!pToRealloc)
         return BinaryBuffer_Alloc(pThis, bytesToAllocate);
     
     if(pToRealloc != pThis->pLastAlloc)
         __throw(invalidArgumentException);
-        
+    
+    /* The old bytes are left in place when the allocation moves to a new segment so they can still be copied. */
+    oldSize = pThis->pCurrent - pThis->pLastAlloc;
     pThis->pCurrent = pThis->pLastAlloc;
-    return BinaryBuffer_Alloc(pThis, bytesToAllocate);
+    pAlloc = BinaryBuffer_Alloc(pThis, bytesToAllocate);
+    if (pAlloc != pToRealloc)
+        memcpy(pAlloc, pToRealloc, oldSize < bytesToAllocate ? oldSize : bytesToAllocate);
+    
+    return pAlloc;
 }
 
 
@@ -136,6 +293,7 @@ void BinaryBuffer_FailAllocation(BinaryBuffer* pThis, size_t allocationToFail)
 void BinaryBuffer_SetOrigin(BinaryBuffer* pThis, unsigned short origin)
 {
     pThis->baseAddress = origin;
+    pThis->pBaseSegment = pThis->pSegmentTail;
     pThis->pBase = pThis->pCurrent;
 }
 
@@ -155,6 +313,8 @@ static void initializeBaseFileWriteEntry(BinaryBuffer*   pThis,
                                          const char*     pDirectoryName,
                                          SizedString*    pFilename,
                                          const char*     pFilenameSuffix);
+static size_t calculateEntryContentLength(FileWriteEntry* pEntry);
+static unsigned char* segmentEndForEntry(FileWriteEntry* pEntry, BufferSegment* pSegment);
 static void addFileWriteEntryToList(BinaryBuffer* pThis, FileWriteEntry* pEntry);
 __throws void BinaryBuffer_QueueWriteToFile(BinaryBuffer* pThis, 
                                             const char*   pDirectoryName, 
@@ -215,15 +375,43 @@ static void initializeBaseFileWriteEntry(BinaryBuffer*   pThis,
     
     if (fullLength > sizeof(pEntry->filename)-1)
         __throw(invalidArgumentException);
-
+    
     memcpy(pEntry->filename, pDirectoryName, directoryLength);
     memcpy(pEntry->filename + directoryLength, &pathSeparator, slashSpace);
     memcpy(pEntry->filename + directoryLength + slashSpace, pFilename->pString, filenameLength);
     memcpy(pEntry->filename + directoryLength + slashSpace + filenameLength, pFilenameSuffix, suffixLength);
     pEntry->filename[fullLength] = '\0';
     pEntry->baseAddress = pThis->baseAddress;
+    pEntry->pBaseSegment = pThis->pBaseSegment;
     pEntry->pBase = pThis->pBase;
-    pEntry->contentLength = pThis->pCurrent - pThis->pBase;
+    pEntry->pLastSegment = pThis->pSegmentTail;
+    pEntry->pLast = pThis->pCurrent;
+    pEntry->contentLength = calculateEntryContentLength(pEntry);
+    
+    /* The length field in the object file headers is only 16 bits wide. */
+    if (pEntry->contentLength > 0xFFFF)
+        __throw(invalidArgumentException);
+}
+
+static size_t calculateEntryContentLength(FileWriteEntry* pEntry)
+{
+    BufferSegment* pSegment = pEntry->pBaseSegment;
+    unsigned char* pStart = pEntry->pBase;
+    size_t         contentLength = 0;
+    
+    for (;;)
+    {
+        contentLength += segmentEndForEntry(pEntry, pSegment) - pStart;
+        if (pSegment == pEntry->pLastSegment)
+            return contentLength;
+        pSegment = pSegment->pNext;
+        pStart = pSegment->pStart;
+    }
+}
+
+static unsigned char* segmentEndForEntry(FileWriteEntry* pEntry, BufferSegment* pSegment)
+{
+    return pSegment == pEntry->pLastSegment ? pEntry->pLast : pSegment->pFilled;
 }
 
 static void addFileWriteEntryToList(BinaryBuffer* pThis, FileWriteEntry* pEntry)
@@ -238,6 +426,7 @@ static void addFileWriteEntryToList(BinaryBuffer* pThis, FileWriteEntry* pEntry)
         pThis->pFileWriteTail->pNext = pEntry;
         pThis->pFileWriteTail = pEntry;
     }
+    pThis->hasUnprocessedWrites = TRUE;
 }
 
 
@@ -262,37 +451,685 @@ __throws void BinaryBuffer_QueueRW18WriteToFile(BinaryBuffer*  pThis,
 }
 
 
-static void writeEntryToDisk(FileWriteEntry* pEntry);
-__throws void BinaryBuffer_ProcessWriteFileQueue(BinaryBuffer* pThis)
+static void   processWriteFileQueue(BinaryBuffer* pThis, Vfs* pVfs, int stageFiles);
+__throws void BinaryBuffer_ProcessWriteFileQueue(BinaryBuffer* pThis, Vfs* pVfs)
 {
-    FileWriteEntry* pEntry = pThis->pFileWriteHead;
-    int             exceptionThrown = noException;
+    processWriteFileQueue(pThis, pVfs, FALSE);
+}
+
+
+__throws void BinaryBuffer_StageWriteFileQueue(BinaryBuffer* pThis, Vfs* pVfs)
+{
+    /* Like BinaryBuffer_ProcessWriteFileQueue() except that the files are left in their temporary files until
+       BinaryBuffer_CommitStagedFiles() renames them over the real ones or BinaryBuffer_DiscardStagedFiles() removes
+       them. */
+    processWriteFileQueue(pThis, pVfs, TRUE);
+}
+
+static size_t countFileWriteEntries(BinaryBuffer* pThis);
+static void   fillFileWriteEntryArray(BinaryBuffer* pThis, FileWriteEntry** ppEntries);
+static size_t removeEntriesOverwrittenByLaterEntries(FileWriteEntry** ppEntries, size_t entryCount);
+static void   allocateStagedFiles(BinaryBuffer* pThis, FileWriteQueue* pQueue, size_t entryCount);
+static void   processWriteEntry(void* pvQueue, size_t entryIndex);
+static void   initEntryOutputContent(OutputContent* pContent, FileWriteEntry* pEntry);
+static int    isEntryUnchanged(FileWriteQueue* pQueue, size_t entryIndex, OutputContent* pContent);
+static int    walkEntryContent(void* pvEntry, ContentCallback callback, void* pContext);
+static int    isContentAlreadyOnDisk(OutputContent* pContent, Vfs* pVfs);
+static int    matchContentCallback(void* pvContext, const void* pData, size_t size);
+static int    doesFileContentMatch(Vfs* pVfs, VfsFile* pFile, const void* pvExpected, size_t expectedSize);
+static void   writeContentToDisk(OutputContent* pContent, Vfs* pVfs);
+static void   writeContentToTempFile(OutputContent* pContent, Vfs* pVfs, const char* pTempFilename);
+static void   writeContentToFile(OutputContent* pContent, Vfs* pVfs, const char* pFilename);
+static int    gatherContentCallback(void* pvContext, const void* pData, size_t size);
+static void   flushGatheredContent(GatherWriter* pWriter);
+static int    tallyWriteResults(BinaryBuffer* pThis, FileWriteEntry** ppEntries, size_t entryCount);
+static void   keepStagedFiles(BinaryBuffer* pThis, FileWriteQueue* pQueue, size_t entryCount);
+static void processWriteFileQueue(BinaryBuffer* pThis, Vfs* pVfs, int stageFiles)
+{
+    FileWriteQueue queue;
+    size_t         entryCount = countFileWriteEntries(pThis);
+    int            exceptionThrown = noException;
     
-    while (pEntry)
+    pThis->writtenFileCount = 0;
+    pThis->skippedFileCount = 0;
+    if (entryCount == 0)
+        return;
+    
+    memset(&queue, 0, sizeof(queue));
+    queue.ppEntries = allocateAndZero(entryCount * sizeof(*queue.ppEntries));
+    queue.pVfs = pVfs;
+    fillFileWriteEntryArray(pThis, queue.ppEntries);
+    entryCount = removeEntriesOverwrittenByLaterEntries(queue.ppEntries, entryCount);
+    if (stageFiles)
     {
         __try
-            writeEntryToDisk(pEntry);
+        {
+            allocateStagedFiles(pThis, &queue, entryCount);
+        }
         __catch
-            exceptionThrown = getExceptionCode();
-        pEntry = pEntry->pNext;
+        {
+            free(queue.ppEntries);
+            __rethrow;
+        }
     }
+    ThreadPool_Run(entryCount, processWriteEntry, &queue);
+    exceptionThrown = tallyWriteResults(pThis, queue.ppEntries, entryCount);
+    if (stageFiles)
+        keepStagedFiles(pThis, &queue, entryCount);
+    free(queue.ppEntries);
     
     if (exceptionThrown != noException)
         __throw(exceptionThrown);
+    pThis->hasUnprocessedWrites = FALSE;
+}
+
+static size_t countFileWriteEntries(BinaryBuffer* pThis)
+{
+    FileWriteEntry* pEntry = pThis->pFileWriteHead;
+    size_t          entryCount = 0;
+    
+    while (pEntry)
+    {
+        entryCount++;
+        pEntry = pEntry->pNext;
+    }
+    return entryCount;
+}
+
+static void fillFileWriteEntryArray(BinaryBuffer* pThis, FileWriteEntry** ppEntries)
+{
+    FileWriteEntry* pEntry = pThis->pFileWriteHead;
+    
+    while (pEntry)
+    {
+        *ppEntries++ = pEntry;
+        pEntry = pEntry->pNext;
+    }
+}
+
+static size_t removeEntriesOverwrittenByLaterEntries(FileWriteEntry** ppEntries, size_t entryCount)
+{
+    /* Entries are written concurrently so only the last write queued for each filename can be kept to match the
+       results of writing them out one after another. */
+    size_t keptCount = 0;
+    size_t i;
+    size_t j;
+    
+    for (i = 0 ; i < entryCount ; i++)
+    {
+        for (j = i + 1 ; j < entryCount ; j++)
+        {
+            if (0 == strcmp(ppEntries[i]->filename, ppEntries[j]->filename))
+                break;
+        }
+        if (j == entryCount)
+            ppEntries[keptCount++] = ppEntries[i];
+    }
+    return keptCount;
+}
+
+static StagedFile* findStagedFile(BinaryBuffer* pThis, const char* pFilename);
+static void allocateStagedFiles(BinaryBuffer* pThis, FileWriteQueue* pQueue, size_t entryCount)
+{
+    /* The records are allocated up front since the pool callbacks which write the temporary files can't allocate.  An
+       entry for a file already staged by an earlier call is compared against that staged file rather than the one on
+       disk since it is what the file will end up holding. */
+    size_t i;
+    
+    pQueue->ppStagedFiles = allocateAndZero(entryCount * sizeof(*pQueue->ppStagedFiles));
+    for (i = 0 ; i < entryCount ; i++)
+    {
+        StagedFile* pStagedFile;
+        
+        __try
+        {
+            pStagedFile = allocateAndZero(sizeof(*pStagedFile));
+        }
+        __catch
+        {
+            while (i-- > 0)
+                free(pQueue->ppStagedFiles[i]);
+            free(pQueue->ppStagedFiles);
+            pQueue->ppStagedFiles = NULL;
+            __rethrow;
+        }
+        pStagedFile->pVfs = pQueue->pVfs;
+        pStagedFile->pReplaces = findStagedFile(pThis, pQueue->ppEntries[i]->filename);
+        strcpy(pStagedFile->filename, pQueue->ppEntries[i]->filename);
+        snprintf(pStagedFile->tempFilename, sizeof(pStagedFile->tempFilename), "%s.%lu.%u.tmp", 
+                 pStagedFile->filename, (unsigned long)getpid(), pThis->stageSequence++);
+        pQueue->ppStagedFiles[i] = pStagedFile;
+    }
+}
+
+static StagedFile* findStagedFile(BinaryBuffer* pThis, const char* pFilename)
+{
+    StagedFile* pCurr = pThis->pStagedHead;
+    
+    while (pCurr && 0 != strcmp(pCurr->filename, pFilename))
+        pCurr = pCurr->pNext;
+    return pCurr;
 }
 
-static void writeEntryToDisk(FileWriteEntry* pEntry)
+static void processWriteEntry(void* pvQueue, size_t entryIndex)
 {
-    size_t                     bytesWritten;
-    FILE*                      pFile;
+    FileWriteQueue* pQueue = (FileWriteQueue*)pvQueue;
+    FileWriteEntry* pEntry = pQueue->ppEntries[entryIndex];
+    OutputContent   content;
     
-    pFile = fopen(pEntry->filename, "wb");
-    if (!pFile)
+    initEntryOutputContent(&content, pEntry);
+    pEntry->exceptionCode = noException;
+    __try
+    {
+        pEntry->isUnchanged = isEntryUnchanged(pQueue, entryIndex, &content);
+        if (!pEntry->isUnchanged && pQueue->ppStagedFiles)
+            writeContentToTempFile(&content, pQueue->pVfs, pQueue->ppStagedFiles[entryIndex]->tempFilename);
+        else if (!pEntry->isUnchanged)
+            writeContentToDisk(&content, pQueue->pVfs);
+    }
+    __catch
+    {
+        pEntry->exceptionCode = getExceptionCode();
+        clearExceptionCode();
+    }
+}
+
+static void initEntryOutputContent(OutputContent* pContent, FileWriteEntry* pEntry)
+{
+    pContent->pFilename = pEntry->filename;
+    pContent->length = pEntry->headerLength + pEntry->contentLength;
+    pContent->walk = walkEntryContent;
+    pContent->pvSource = pEntry;
+}
+
+static int isEntryUnchanged(FileWriteQueue* pQueue, size_t entryIndex, OutputContent* pContent)
+{
+    /* A file which is staged again with the content already on disk has its earlier staged file dropped instead so
+       that committing doesn't rename an identical file over it and touch its modification time. */
+    StagedFile*   pStagedFile;
+    OutputContent stagedContent;
+    
+    if (!pQueue->ppStagedFiles || !pQueue->ppStagedFiles[entryIndex]->pReplaces)
+        return isContentAlreadyOnDisk(pContent, pQueue->pVfs);
+    pStagedFile = pQueue->ppStagedFiles[entryIndex];
+    stagedContent = *pContent;
+    stagedContent.pFilename = pStagedFile->pReplaces->tempFilename;
+    if (isContentAlreadyOnDisk(&stagedContent, pQueue->pVfs))
+        return TRUE;
+    pStagedFile->isRevertedToDisk = isContentAlreadyOnDisk(pContent, pQueue->pVfs);
+    return pStagedFile->isRevertedToDisk;
+}
+
+static int walkEntryContent(void* pvEntry, ContentCallback callback, void* pContext)
+{
+    FileWriteEntry* pEntry = (FileWriteEntry*)pvEntry;
+    BufferSegment*  pSegment = pEntry->pBaseSegment;
+    unsigned char*  pStart = pEntry->pBase;
+    
+    if (!callback(pContext, &pEntry->savFileHeader, pEntry->headerLength))
+        return FALSE;
+    for (;;)
+    {
+        if (!callback(pContext, pStart, segmentEndForEntry(pEntry, pSegment) - pStart))
+            return FALSE;
+        if (pSegment == pEntry->pLastSegment)
+            return TRUE;
+        pSegment = pSegment->pNext;
+        pStart = pSegment->pStart;
+    }
+}
+
+static int isContentAlreadyOnDisk(OutputContent* pContent, Vfs* pVfs)
+{
+    ContentMatcher matcher;
+    int            isMatch;
+    
+    matcher.pVfs = pVfs;
+    matcher.pFile = Vfs_OpenFile(pVfs, pContent->pFilename, "rb");
+    if (!matcher.pFile)
+        return FALSE;
+    isMatch = Vfs_GetFileSize(pVfs, matcher.pFile) == (long)pContent->length &&
+              pContent->walk(pContent->pvSource, matchContentCallback, &matcher);
+    Vfs_CloseFile(pVfs, matcher.pFile);
+    
+    return isMatch;
+}
+
+static int matchContentCallback(void* pvContext, const void* pData, size_t size)
+{
+    ContentMatcher* pMatcher = (ContentMatcher*)pvContext;
+    
+    return doesFileContentMatch(pMatcher->pVfs, pMatcher->pFile, pData, size);
+}
+
+static int doesFileContentMatch(Vfs* pVfs, VfsFile* pFile, const void* pvExpected, size_t expectedSize)
+{
+    const unsigned char* pExpected = (const unsigned char*)pvExpected;
+    unsigned char        buffer[4096];
+    
+    while (expectedSize > 0)
+    {
+        size_t bytesToRead = expectedSize < sizeof(buffer) ? expectedSize : sizeof(buffer);
+        
+        if (bytesToRead != Vfs_ReadFile(pVfs, pFile, buffer, bytesToRead) || 
+            0 != memcmp(buffer, pExpected, bytesToRead))
+            return FALSE;
+        pExpected += bytesToRead;
+        expectedSize -= bytesToRead;
+    }
+    return TRUE;
+}
+
+static void writeContentToDisk(OutputContent* pContent, Vfs* pVfs)
+{
+    /* Write to a temporary file in the same directory and then rename it over the real one so that readers never
+       see a partially written object file.  The temporary file takes on the permissions of the file it replaces. */
+    char tempFilename[PATH_LENGTH + 32];
+    
+    snprintf(tempFilename, sizeof(tempFilename), "%s.%lu.tmp", pContent->pFilename, (unsigned long)getpid());
+    writeContentToTempFile(pContent, pVfs, tempFilename);
+    if (0 != Vfs_CopyFileMode(pVfs, pContent->pFilename, tempFilename) ||
+        0 != Vfs_RenameFile(pVfs, tempFilename, pContent->pFilename))
+    {
+        Vfs_RemoveFile(pVfs, tempFilename);
+        __throw(fileException);
+    }
+}
+
+static void writeContentToTempFile(OutputContent* pContent, Vfs* pVfs, const char* pTempFilename)
+{
+    __try
+        writeContentToFile(pContent, pVfs, pTempFilename);
+    __catch
+    {
+        Vfs_RemoveFile(pVfs, pTempFilename);
+        __rethrow;
+    }
+}
+
+static void writeContentToFile(OutputContent* pContent, Vfs* pVfs, const char* pFilename)
+{
+    GatherWriter writer;
+    
+    memset(&writer, 0, sizeof(writer));
+    writer.pVfs = pVfs;
+    writer.pFile = Vfs_OpenFile(pVfs, pFilename, "wb");
+    if (!writer.pFile)
         __throw(fileException);
     
-    bytesWritten = fwrite(&pEntry->savFileHeader, 1, pEntry->headerLength, pFile);
-    bytesWritten += fwrite(pEntry->pBase, 1, pEntry->contentLength, pFile);
-    fclose(pFile);
-    if (bytesWritten != pEntry->contentLength + pEntry->headerLength)
+    pContent->walk(pContent->pvSource, gatherContentCallback, &writer);
+    flushGatheredContent(&writer);
+    Vfs_CloseFile(pVfs, writer.pFile);
+    if (writer.bytesWritten != pContent->length)
         __throw(fileException);
 }
+
+static int gatherContentCallback(void* pvContext, const void* pData, size_t size)
+{
+    /* The header and the piece of the image held in each segment are gathered into as few writes as possible. */
+    GatherWriter* pWriter = (GatherWriter*)pvContext;
+    
+    if (pWriter->bufferCount == ARRAYSIZE(pWriter->buffers))
+        flushGatheredContent(pWriter);
+    pWriter->buffers[pWriter->bufferCount].pData = pData;
+    pWriter->buffers[pWriter->bufferCount].size = size;
+    pWriter->bufferCount++;
+    
+    return TRUE;
+}
+
+static void flushGatheredContent(GatherWriter* pWriter)
+{
+    if (pWriter->bufferCount == 0)
+        return;
+    pWriter->bytesWritten += Vfs_WriteFile(pWriter->pVfs, pWriter->pFile, pWriter->buffers, pWriter->bufferCount);
+    pWriter->bufferCount = 0;
+}
+
+static int tallyWriteResults(BinaryBuffer* pThis, FileWriteEntry** ppEntries, size_t entryCount)
+{
+    int    exceptionThrown = noException;
+    size_t i;
+    
+    for (i = 0 ; i < entryCount ; i++)
+    {
+        FileWriteEntry* pEntry = ppEntries[i];
+        
+        if (pEntry->exceptionCode != noException)
+            exceptionThrown = pEntry->exceptionCode;
+        else if (pEntry->isUnchanged)
+            pThis->skippedFileCount++;
+        else
+            pThis->writtenFileCount++;
+    }
+    return exceptionThrown;
+}
+
+static void discardStagedFile(BinaryBuffer* pThis, const char* pFilename);
+static void keepStagedFiles(BinaryBuffer* pThis, FileWriteQueue* pQueue, size_t entryCount)
+{
+    /* Files are kept even when another entry failed so that they are still cleaned up by a later discard.  They
+       aren't counted as written until they are committed. */
+    size_t i;
+    
+    for (i = 0 ; i < entryCount ; i++)
+    {
+        FileWriteEntry* pEntry = pQueue->ppEntries[i];
+        StagedFile*     pStagedFile = pQueue->ppStagedFiles[i];
+        StagedFile**    ppTail = &pThis->pStagedHead;
+        
+        if (pEntry->exceptionCode == noException && pStagedFile->isRevertedToDisk)
+            discardStagedFile(pThis, pStagedFile->filename);
+        if (pEntry->exceptionCode != noException || pEntry->isUnchanged)
+        {
+            free(pStagedFile);
+            continue;
+        }
+        if (pStagedFile->pReplaces)
+            discardStagedFile(pThis, pStagedFile->filename);
+        while (*ppTail)
+            ppTail = &(*ppTail)->pNext;
+        pStagedFile->pReplaces = NULL;
+        *ppTail = pStagedFile;
+        pThis->writtenFileCount--;
+    }
+    free(pQueue->ppStagedFiles);
+}
+
+static void discardStagedFile(BinaryBuffer* pThis, const char* pFilename)
+{
+    StagedFile** ppCurr = &pThis->pStagedHead;
+    
+    while (*ppCurr)
+    {
+        StagedFile* pStagedFile = *ppCurr;
+        
+        if (0 == strcmp(pStagedFile->filename, pFilename))
+        {
+            *ppCurr = pStagedFile->pNext;
+            Vfs_RemoveFile(pStagedFile->pVfs, pStagedFile->tempFilename);
+            free(pStagedFile);
+            return;
+        }
+        ppCurr = &pStagedFile->pNext;
+    }
+}
+
+
+__throws void BinaryBuffer_CommitStagedFiles(BinaryBuffer* pThis)
+{
+    /* Every staged file is renamed even if an earlier one fails so that none of their temporary files are left. */
+    int exceptionThrown = noException;
+    
+    while (pThis->pStagedHead)
+    {
+        StagedFile* pStagedFile = pThis->pStagedHead;
+        
+        if (0 == Vfs_CopyFileMode(pStagedFile->pVfs, pStagedFile->filename, pStagedFile->tempFilename) &&
+            0 == Vfs_RenameFile(pStagedFile->pVfs, pStagedFile->tempFilename, pStagedFile->filename))
+        {
+            pThis->releasedWrittenFileCount++;
+        }
+        else
+        {
+            Vfs_RemoveFile(pStagedFile->pVfs, pStagedFile->tempFilename);
+            exceptionThrown = fileException;
+        }
+        pThis->pStagedHead = pStagedFile->pNext;
+        free(pStagedFile);
+    }
+    if (exceptionThrown != noException)
+        __throw(exceptionThrown);
+}
+
+
+void BinaryBuffer_DiscardStagedFiles(BinaryBuffer* pThis)
+{
+    while (pThis->pStagedHead)
+        discardStagedFile(pThis, pThis->pStagedHead->filename);
+}
+
+
+static void   buildBundleIndex(BundleContent* pBundle);
+static size_t paddingForEntry(FileWriteEntry* pEntry);
+static int    walkBundleContent(void* pvBundle, ContentCallback callback, void* pContext);
+__throws void BinaryBuffer_ProcessWriteFileQueueToBundle(BinaryBuffer* pThis, Vfs* pVfs, const char* pBundleFilename)
+{
+    BundleContent bundle;
+    OutputContent content;
+    size_t        entryCount = countFileWriteEntries(pThis);
+    
+    pThis->writtenFileCount = 0;
+    pThis->skippedFileCount = 0;
+    if (entryCount == 0)
+        return;
+    
+    memset(&bundle, 0, sizeof(bundle));
+    __try
+    {
+        bundle.ppEntries = allocateAndZero(entryCount * sizeof(*bundle.ppEntries));
+        fillFileWriteEntryArray(pThis, bundle.ppEntries);
+        bundle.entryCount = removeEntriesOverwrittenByLaterEntries(bundle.ppEntries, entryCount);
+        buildBundleIndex(&bundle);
+        
+        content.pFilename = pBundleFilename;
+        content.length = bundle.length;
+        content.walk = walkBundleContent;
+        content.pvSource = &bundle;
+        if (isContentAlreadyOnDisk(&content, pVfs))
+        {
+            pThis->skippedFileCount++;
+        }
+        else
+        {
+            writeContentToDisk(&content, pVfs);
+            pThis->writtenFileCount++;
+        }
+    }
+    __catch
+    {
+        free(bundle.pIndex);
+        free(bundle.ppEntries);
+        __rethrow;
+    }
+    free(bundle.pIndex);
+    free(bundle.ppEntries);
+    pThis->hasUnprocessedWrites = FALSE;
+}
+
+static void buildBundleIndex(BundleContent* pBundle)
+{
+    ObjectBundleHeader* pHeader;
+    ObjectBundleEntry*  pIndexEntries;
+    size_t              offset;
+    size_t              i;
+    
+    pBundle->indexSize = sizeof(*pHeader) + pBundle->entryCount * sizeof(*pIndexEntries);
+    pBundle->pIndex = allocateAndZero(pBundle->indexSize);
+    pHeader = (ObjectBundleHeader*)pBundle->pIndex;
+    pIndexEntries = (ObjectBundleEntry*)(pHeader + 1);
+    memcpy(pHeader->signature, OBJECT_BUNDLE_SIGNATURE, sizeof(pHeader->signature));
+    pHeader->entryCount = pBundle->entryCount;
+    
+    offset = pBundle->indexSize;
+    for (i = 0 ; i < pBundle->entryCount ; i++)
+    {
+        FileWriteEntry*    pEntry = pBundle->ppEntries[i];
+        ObjectBundleEntry* pIndexEntry = &pIndexEntries[i];
+        size_t             nameLength = strlen(pEntry->filename);
+        
+        if (nameLength > sizeof(pIndexEntry->name) - 1)
+            __throw(invalidArgumentException);
+        memcpy(pIndexEntry->name, pEntry->filename, nameLength);
+        pIndexEntry->offset = offset;
+        pIndexEntry->length = pEntry->headerLength + pEntry->contentLength;
+        pIndexEntry->paddedLength = pIndexEntry->length + paddingForEntry(pEntry);
+        offset += pIndexEntry->paddedLength;
+    }
+    pBundle->length = offset;
+}
+
+static size_t paddingForEntry(FileWriteEntry* pEntry)
+{
+    /* crackle rounds object data up to whole blocks so the padding lets it insert straight from the bundle. */
+    size_t roundedLength = (pEntry->contentLength + (OBJECT_BUNDLE_PADDING_SIZE - 1)) & 
+                           ~(size_t)(OBJECT_BUNDLE_PADDING_SIZE - 1);
+    
+    return roundedLength - pEntry->contentLength;
+}
+
+static int walkBundleContent(void* pvBundle, ContentCallback callback, void* pContext)
+{
+    static const unsigned char zeroes[OBJECT_BUNDLE_PADDING_SIZE];
+    BundleContent*             pBundle = (BundleContent*)pvBundle;
+    size_t                     i;
+    
+    if (!callback(pContext, pBundle->pIndex, pBundle->indexSize))
+        return FALSE;
+    for (i = 0 ; i < pBundle->entryCount ; i++)
+    {
+        FileWriteEntry* pEntry = pBundle->ppEntries[i];
+        
+        if (!walkEntryContent(pEntry, callback, pContext) ||
+            !callback(pContext, zeroes, paddingForEntry(pEntry)))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+
+static void passEntryToHandler(FileWriteEntry* pEntry, BinaryBufferObjectHandler handler, void* pContext);
+static unsigned char* copyEntryContent(FileWriteEntry* pEntry);
+__throws void BinaryBuffer_ProcessWriteFileQueueToHandler(BinaryBuffer*             pThis, 
+                                                          BinaryBufferObjectHandler handler, 
+                                                          void*                     pContext)
+{
+    FileWriteEntry* pEntry;
+    
+    pThis->writtenFileCount = 0;
+    pThis->skippedFileCount = 0;
+    for (pEntry = pThis->pFileWriteHead ; pEntry ; pEntry = pEntry->pNext)
+    {
+        passEntryToHandler(pEntry, handler, pContext);
+        pThis->writtenFileCount++;
+    }
+    pThis->hasUnprocessedWrites = FALSE;
+}
+
+static void passEntryToHandler(FileWriteEntry* pEntry, BinaryBufferObjectHandler handler, void* pContext)
+{
+    /* Objects are handed over in queue order, so a later save to the same filename is seen after the earlier one. */
+    BinaryBufferObject object;
+    unsigned char*     pCopy = NULL;
+    
+    object.pFilename = pEntry->filename;
+    object.pHeader = &pEntry->savFileHeader;
+    object.headerLength = pEntry->headerLength;
+    object.pData = pEntry->pBase;
+    object.dataLength = pEntry->contentLength;
+    if (pEntry->pBaseSegment != pEntry->pLastSegment)
+        object.pData = pCopy = copyEntryContent(pEntry);
+    
+    __try
+    {
+        handler(pContext, &object);
+    }
+    __catch
+    {
+        free(pCopy);
+        __rethrow;
+    }
+    free(pCopy);
+}
+
+static unsigned char* copyEntryContent(FileWriteEntry* pEntry)
+{
+    unsigned char* pCopy = allocateAndZero(pEntry->contentLength);
+    unsigned char* pDest = pCopy;
+    BufferSegment* pSegment = pEntry->pBaseSegment;
+    unsigned char* pStart = pEntry->pBase;
+    
+    for (;;)
+    {
+        size_t size = segmentEndForEntry(pEntry, pSegment) - pStart;
+        
+        memcpy(pDest, pStart, size);
+        pDest += size;
+        if (pSegment == pEntry->pLastSegment)
+            return pCopy;
+        pSegment = pSegment->pNext;
+        pStart = pSegment->pStart;
+    }
+}
+
+
+static int walkObjectContent(void* pvObject, ContentCallback callback, void* pContext);
+__throws int BinaryBuffer_WriteObjectToFile(Vfs* pVfs, const BinaryBufferObject* pObject)
+{
+    /* Objects handed to a handler which aren't consumed by it are written the same way as queued object files.
+       Returns FALSE if the file already held the object and was left untouched. */
+    OutputContent content;
+    
+    content.pFilename = pObject->pFilename;
+    content.length = pObject->headerLength + pObject->dataLength;
+    content.walk = walkObjectContent;
+    content.pvSource = (void*)pObject;
+    if (isContentAlreadyOnDisk(&content, pVfs))
+        return FALSE;
+    writeContentToDisk(&content, pVfs);
+    return TRUE;
+}
+
+static int walkObjectContent(void* pvObject, ContentCallback callback, void* pContext)
+{
+    const BinaryBufferObject* pObject = (const BinaryBufferObject*)pvObject;
+    
+    return callback(pContext, pObject->pHeader, pObject->headerLength) && 
+           callback(pContext, pObject->pData, pObject->dataLength);
+}
+
+
+static void recycleSegment(BinaryBuffer* pThis, BufferSegment* pSegment);
+void BinaryBuffer_ReleaseWrittenSegments(BinaryBuffer* pThis)
+{
+    if (pThis->hasUnprocessedWrites)
+        return;
+    
+    pThis->releasedWrittenFileCount += pThis->writtenFileCount;
+    pThis->releasedSkippedFileCount += pThis->skippedFileCount;
+    pThis->writtenFileCount = 0;
+    pThis->skippedFileCount = 0;
+    freeFileWriteEntries(pThis);
+    while (pThis->pSegmentHead != pThis->pBaseSegment)
+    {
+        BufferSegment* pSegment = pThis->pSegmentHead;
+    
+        pThis->pSegmentHead = pSegment->pNext;
+        recycleSegment(pThis, pSegment);
+    }
+}
+
+static void recycleSegment(BinaryBuffer* pThis, BufferSegment* pSegment)
+{
+    /* A single spare is enough to stop a source with many ORG sections from calling malloc for every segment. */
+    if (pThis->pSpareSegment)
+    {
+        free(pSegment);
+        return;
+    }
+    pThis->pSpareSegment = pSegment;
+}
+
+
+unsigned int BinaryBuffer_GetWrittenFileCount(BinaryBuffer* pThis)
+{
+    return pThis->releasedWrittenFileCount + pThis->writtenFileCount;
+}
+
+
+unsigned int BinaryBuffer_GetSkippedFileCount(BinaryBuffer* pThis)
+{
+    return pThis->releasedSkippedFileCount + pThis->skippedFileCount;
+}
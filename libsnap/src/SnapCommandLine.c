@@ -27,7 +27,8 @@ static void displayCopyrightNotice(void)
 static void displayUsage(void)
 {
     printf("Usage: snap [--list listFilename] [--putdirs includeDir1;includeDir2...]\n"
-           "            [--outdir outputDirectory]sourceFilename\n\n"
+           "            [--outdir outputDirectory] [--bundle bundleFilename]\n"
+           "            [--stream] sourceFilename\n\n"
            "Where: --list listFilename allows the list file for the assembly\n"
            "         process to be output to the specified file.  By default it\n"
            "         will be sent to stdout.\n"
@@ -35,6 +36,12 @@ static void displayUsage(void)
            "         files will be searched when including files with PUT directive.\n"
            "       --outdir sets the directory where output files from directives\n"
            "         like USR and SAV should be stored.\n"
+           "       --bundle writes all of the USR and SAV output files into a single\n"
+           "         indexed bundle file which crackle can read with its own --bundle\n"
+           "         option.\n"
+           "       --stream lists each source line as soon as it has no pending\n"
+           "         forward references and then frees the memory used to track it.\n"
+           "         The source text itself stays in memory for the whole assembly.\n"
            "       sourceFilename is the required name of an input assembly\n"
            "         language file.\n");
 }
@@ -43,6 +50,7 @@ static void displayUsage(void)
 static int parseArgument(SnapCommandLine* pThis, int argc, const char** ppArgs);
 static int hasDoubleDashPrefix(const char* pArgument);
 static int parseFlagArgument(SnapCommandLine* pThis, int argc, const char** ppArgs);
+static int parseBooleanFlagArgument(SnapCommandLine* pThis, const char* pArgument);
 static void parseStringParamter(const char** ppDestField, int argc, const char* pSourceArgument);
 static int parseFilenameArgument(SnapCommandLine* pThis, int argc, const char* pArgument);
 static void throwIfRequiredArgumentNotSpecified(SnapCommandLine* pThis);
@@ -92,7 +100,8 @@ static int parseFlagArgument(SnapCommandLine* pThis, int argc, const char** ppAr
     {
         { "--list",    offsetof(SnapCommandLine, assemblerInitParams) + offsetof(AssemblerInitParams, pListFilename) },
         { "--putdirs", offsetof(SnapCommandLine, assemblerInitParams) + offsetof(AssemblerInitParams, pPutDirectories) },
-        { "--outdir",  offsetof(SnapCommandLine, assemblerInitParams) + offsetof(AssemblerInitParams, pOutputDirectory) }
+        { "--outdir",  offsetof(SnapCommandLine, assemblerInitParams) + offsetof(AssemblerInitParams, pOutputDirectory) },
+        { "--bundle",  offsetof(SnapCommandLine, assemblerInitParams) + offsetof(AssemblerInitParams, pBundleFilename) }
     };
     size_t i;
     
@@ -106,6 +115,31 @@ static int parseFlagArgument(SnapCommandLine* pThis, int argc, const char** ppAr
         }
     }
 
+    return parseBooleanFlagArgument(pThis, *ppArgs);
+}
+
+static int parseBooleanFlagArgument(SnapCommandLine* pThis, const char* pArgument)
+{
+    static struct
+    {
+        const char* pFlag;
+        int         destIntOffsetInThis;
+    } const booleanFlagArguments[] =
+    {
+        { "--stream", offsetof(SnapCommandLine, assemblerInitParams) + offsetof(AssemblerInitParams, streamListing) }
+    };
+    size_t i;
+    
+    for (i = 0 ; i < ARRAYSIZE(booleanFlagArguments) ; i++)
+    {
+        if (0 == strcasecmp(pArgument, booleanFlagArguments[i].pFlag))
+        {
+            int* pDestField = (int*)((char*)pThis + booleanFlagArguments[i].destIntOffsetInThis);
+            *pDestField = 1;
+            return 1;
+        }
+    }
+
     __throw(invalidArgumentException);
 }
 
@@ -260,6 +260,7 @@ __throws void Symbol_LineReferenceAdd(Symbol* pSymbol, LineInfo* pLineInfo)
     pLineReference->pLineInfo = pLineInfo;
     pLineReference->pNext = pSymbol->pLineReferences;
     pSymbol->pLineReferences = pLineReference;
+    pLineInfo->forwardReferenceCount++;
 }
 
 
@@ -310,6 +311,7 @@ void Symbol_LineReferenceRemove(Symbol* pSymbol, LineInfo* pLineInfo)
         else
             find.pPrev->pNext = find.pFound->pNext;
         free(find.pFound);
+        pLineInfo->forwardReferenceCount--;
     }
 }
 
@@ -15,6 +15,12 @@
 */
 #include "AssemblerBaseTest.h"
 
+extern "C"
+{
+    #include "MemoryVfs.h"
+    #include "ObjectBundle.h"
+}
+
 
 TEST_GROUP_BASE(AssemblerCore, AssemblerBase)
 {
@@ -191,7 +197,7 @@ TEST(AssemblerCore, FailBinaryBufferAllocationOnEmitSingleByteInstruction)
 {
     m_pAssembler = Assembler_CreateFromString(dupe(" clc" LINE_ENDING), NULL);
     BinaryBuffer_FailAllocation(m_pAssembler->pCurrentBuffer, 1);
-    runAssemblerAndValidateFailure("filename:1: error: Exceeded the 65536 allowed bytes in the object file." LINE_ENDING,
+    runAssemblerAndValidateFailure("filename:1: error: Ran out of memory for object file bytes." LINE_ENDING,
                                    "    :              1  clc" LINE_ENDING);
 }
 
@@ -199,7 +205,7 @@ TEST(AssemblerCore, FailBinaryBufferAllocationOnEmitTwoByteInstruction)
 {
     m_pAssembler = Assembler_CreateFromString(dupe(" lda #1" LINE_ENDING), NULL);
     BinaryBuffer_FailAllocation(m_pAssembler->pCurrentBuffer, 1);
-    runAssemblerAndValidateFailure("filename:1: error: Exceeded the 65536 allowed bytes in the object file." LINE_ENDING,
+    runAssemblerAndValidateFailure("filename:1: error: Ran out of memory for object file bytes." LINE_ENDING,
                                    "    :              1  lda #1" LINE_ENDING);
 }
 
@@ -207,6 +213,245 @@ TEST(AssemblerCore, FailBinaryBufferAllocationOnEmitThreeByteInstruction)
 {
     m_pAssembler = Assembler_CreateFromString(dupe(" lda $800" LINE_ENDING), NULL);
     BinaryBuffer_FailAllocation(m_pAssembler->pCurrentBuffer, 1);
-    runAssemblerAndValidateFailure("filename:1: error: Exceeded the 65536 allowed bytes in the object file." LINE_ENDING,
+    runAssemblerAndValidateFailure("filename:1: error: Ran out of memory for object file bytes." LINE_ENDING,
                                    "    :              1  lda $800" LINE_ENDING);
 }
+
+TEST(AssemblerCore, StreamListingOnlyKeepsCurrentLineWhenNoForwardReferences)
+{
+    static const int lineCount = 10000;
+    FILE* pFile = fopen(g_sourceFilename, "wb");
+    for (int i = 0 ; i < lineCount ; i++)
+        fprintf(pFile, " nop" LINE_ENDING);
+    fclose(pFile);
+    m_initParams.streamListing = 1;
+    
+    m_pAssembler = Assembler_CreateFromFile(g_sourceFilename, &m_initParams);
+    runAssemblerAndValidateLastLineIs("A70F: EA        10000  nop" LINE_ENDING, lineCount);
+    LONGS_EQUAL(2, m_pAssembler->maxPendingLineCount);
+    LONGS_EQUAL(1, m_pAssembler->pendingLineCount);
+}
+
+TEST(AssemblerCore, StreamListingHoldsLinesUntilForwardReferenceIsResolved)
+{
+    m_initParams.streamListing = 1;
+    m_pAssembler = Assembler_CreateFromString(dupe(" jmp label" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   "label nop" LINE_ENDING
+                                                   " nop" LINE_ENDING), &m_initParams);
+    runAssemblerAndValidateLastTwoLinesOfOutputAre("8005: EA           4 label nop" LINE_ENDING,
+                                                   "8006: EA           5  nop" LINE_ENDING, 5);
+    LONGS_EQUAL(4, m_pAssembler->maxPendingLineCount);
+}
+
+TEST(AssemblerCore, StreamListingStillDetectsRedefinitionOfLabelFromFreedLine)
+{
+    m_initParams.streamListing = 1;
+    m_pAssembler = Assembler_CreateFromString(dupe("entry lda #$60" LINE_ENDING
+                                                   " nop" LINE_ENDING
+                                                   "entry lda #$61" LINE_ENDING), &m_initParams);
+    runAssemblerAndValidateFailure("filename:3: error: 'entry' symbol has already been defined." LINE_ENDING,
+                                   "8003: A9 61        3 entry lda #$61" LINE_ENDING, 4);
+}
+
+TEST(AssemblerCore, StreamListingProducesSameListFileAsDefaultMode)
+{
+    static const char source[] = " org $800" LINE_ENDING
+                                 "entry do 1" LINE_ENDING
+                                 " lda label" LINE_ENDING
+                                 " sta :local" LINE_ENDING
+                                 ":local db 1" LINE_ENDING
+                                 "label db 2" LINE_ENDING
+                                 " fin" LINE_ENDING
+                                 " lda label" LINE_ENDING;
+    char   expectedListOutput[512];
+    size_t expectedListSize;
+    
+    createSourceFile(source);
+    m_initParams.pListFilename = g_listFilename;
+    printfSpy_Unhook();
+    m_pAssembler = Assembler_CreateFromFile(g_sourceFilename, &m_initParams);
+    Assembler_Run(m_pAssembler);
+    Assembler_Free(m_pAssembler);
+    m_pFile = fopen(g_listFilename, "rb");
+    expectedListSize = fread(expectedListOutput, 1, sizeof(expectedListOutput), m_pFile);
+    fclose(m_pFile);
+    m_pFile = NULL;
+
+    m_initParams.streamListing = 1;
+    m_pAssembler = Assembler_CreateFromFile(g_sourceFilename, &m_initParams);
+    Assembler_Run(m_pAssembler);
+    LONGS_EQUAL(0, Assembler_GetErrorCount(m_pAssembler));
+    Assembler_Free(m_pAssembler);
+    m_pAssembler = NULL;
+    
+    validateListFileContains(expectedListOutput, expectedListSize);
+}
+
+TEST(AssemblerCore, AssembleFromMemoryVfsProducesSameOutputAsDiskWithoutTouchingDisk)
+{
+    static const char source[] = " org $800" LINE_ENDING
+                                 " put AssemblerTestPut" LINE_ENDING
+                                 " hex 00,ff" LINE_ENDING
+                                 " sav AssemblerTest.sav" LINE_ENDING;
+    static const char putSource[] = "SYM1 EQU $1" LINE_ENDING
+                                    " lda #SYM1" LINE_ENDING;
+    static const char putFilename[] = "AssemblerTestPut.S";
+    char              expectedListOutput[512];
+    size_t            expectedListSize;
+    char              expectedObject[64];
+    size_t            expectedObjectSize;
+    MemoryVfs*        pVfs = NULL;
+    const void*       pData;
+    size_t            dataSize;
+    
+    createSourceFile(source);
+    createThisSourceFile(putFilename, putSource);
+    m_initParams.pListFilename = g_listFilename;
+    printfSpy_Unhook();
+    m_pAssembler = Assembler_CreateFromFile(g_sourceFilename, &m_initParams);
+    Assembler_Run(m_pAssembler);
+    Assembler_Free(m_pAssembler);
+    m_pAssembler = NULL;
+    m_pFile = fopen(g_listFilename, "rb");
+    expectedListSize = fread(expectedListOutput, 1, sizeof(expectedListOutput), m_pFile);
+    fclose(m_pFile);
+    m_pFile = fopen(g_objectFilename, "rb");
+    expectedObjectSize = fread(expectedObject, 1, sizeof(expectedObject), m_pFile);
+    fclose(m_pFile);
+    m_pFile = NULL;
+    remove(g_sourceFilename);
+    remove(g_objectFilename);
+    remove(g_listFilename);
+    remove(putFilename);
+
+    pVfs = MemoryVfs_Create();
+    MemoryVfs_AddFile(pVfs, g_sourceFilename, source, sizeof(source) - 1);
+    MemoryVfs_AddFile(pVfs, putFilename, putSource, sizeof(putSource) - 1);
+    m_initParams.pVfs = (Vfs*)pVfs;
+    m_pAssembler = Assembler_CreateFromFile(g_sourceFilename, &m_initParams);
+    Assembler_Run(m_pAssembler);
+    LONGS_EQUAL(0, Assembler_GetErrorCount(m_pAssembler));
+    Assembler_Free(m_pAssembler);
+    m_pAssembler = NULL;
+    
+    pData = MemoryVfs_GetFileData(pVfs, g_listFilename, &dataSize);
+    CHECK(pData != NULL);
+    LONGS_EQUAL(expectedListSize, dataSize);
+    CHECK(0 == memcmp(expectedListOutput, pData, dataSize));
+    pData = MemoryVfs_GetFileData(pVfs, g_objectFilename, &dataSize);
+    CHECK(pData != NULL);
+    LONGS_EQUAL(expectedObjectSize, dataSize);
+    CHECK(0 == memcmp(expectedObject, pData, dataSize));
+    LONGS_EQUAL(4, MemoryVfs_GetFileCount(pVfs));
+    Vfs_Free((Vfs*)pVfs);
+    
+    POINTERS_EQUAL(NULL, fopen(g_listFilename, "rb"));
+    POINTERS_EQUAL(NULL, fopen(g_objectFilename, "rb"));
+}
+
+TEST(AssemblerCore, AssembleMoreThan64kOfOutputAcrossSeveralSavDirectives)
+{
+    static const char section[] = " org $800" LINE_ENDING
+                                  " ds $8000,$aa" LINE_ENDING
+                                  " sav AssemblerTest.sav" LINE_ENDING;
+    char              source[3 * sizeof(section)];
+    static char       expectedContent[0x8000];
+    
+    snprintf(source, sizeof(source), "%s%s%s", section, section, section);
+    memset(expectedContent, 0xaa, sizeof(expectedContent));
+    createSourceFile(source);
+    m_pAssembler = Assembler_CreateFromFile(g_sourceFilename, &m_initParams);
+    Assembler_Run(m_pAssembler);
+    LONGS_EQUAL(0, Assembler_GetErrorCount(m_pAssembler));
+    LONGS_EQUAL(1, Assembler_GetWrittenFileCount(m_pAssembler));
+    validateObjectFileContains(0x800, expectedContent, sizeof(expectedContent));
+}
+
+TEST(AssemblerCore, StreamListingWritesEachSavAsSoonAsNoLinesArePending)
+{
+    static const char section[] = " org $800" LINE_ENDING
+                                  " ds $8000,$aa" LINE_ENDING
+                                  " sav AssemblerTest.sav" LINE_ENDING;
+    char              source[3 * sizeof(section)];
+    static char       expectedContent[0x8000];
+    
+    snprintf(source, sizeof(source), "%s%s%s", section, section, section);
+    memset(expectedContent, 0xaa, sizeof(expectedContent));
+    createSourceFile(source);
+    m_initParams.streamListing = 1;
+    m_pAssembler = Assembler_CreateFromFile(g_sourceFilename, &m_initParams);
+    Assembler_Run(m_pAssembler);
+    LONGS_EQUAL(0, Assembler_GetErrorCount(m_pAssembler));
+    LONGS_EQUAL(1, Assembler_GetWrittenFileCount(m_pAssembler));
+    LONGS_EQUAL(2, Assembler_GetSkippedFileCount(m_pAssembler));
+    validateObjectFileContains(0x800, expectedContent, sizeof(expectedContent));
+}
+
+TEST(AssemblerCore, StreamListingLeavesExistingObjectFilesWhenALaterLineFails)
+{
+    static const char source[] = " org $800" LINE_ENDING
+                                 " hex 00,ff" LINE_ENDING
+                                 " sav AssemblerTest.sav" LINE_ENDING
+                                 " org $900" LINE_ENDING
+                                 " hex 01,02,03" LINE_ENDING
+                                 " sav AssemblerTest2.sav" LINE_ENDING
+                                 " org $a00" LINE_ENDING
+                                 " foo" LINE_ENDING;
+    static const char existingObject[] = "Original";
+    MemoryVfs*        pVfs = MemoryVfs_Create();
+    const void*       pData;
+    size_t            dataSize = 0;
+    
+    MemoryVfs_AddFile(pVfs, g_sourceFilename, source, sizeof(source) - 1);
+    MemoryVfs_AddFile(pVfs, g_objectFilename, existingObject, sizeof(existingObject));
+    m_initParams.pVfs = (Vfs*)pVfs;
+    m_initParams.streamListing = 1;
+    m_pAssembler = Assembler_CreateFromFile(g_sourceFilename, &m_initParams);
+    Assembler_Run(m_pAssembler);
+    LONGS_EQUAL(1, Assembler_GetErrorCount(m_pAssembler));
+    LONGS_EQUAL(0, Assembler_GetWrittenFileCount(m_pAssembler));
+    Assembler_Free(m_pAssembler);
+    m_pAssembler = NULL;
+    
+    LONGS_EQUAL(2, MemoryVfs_GetFileCount(pVfs));
+    pData = MemoryVfs_GetFileData(pVfs, g_objectFilename, &dataSize);
+    LONGS_EQUAL(sizeof(existingObject), dataSize);
+    CHECK(0 == memcmp(existingObject, pData, dataSize));
+    Vfs_Free((Vfs*)pVfs);
+}
+
+TEST(AssemblerCore, BundleWritesAllSavAndUsrOutputToOneFileInsteadOfOutputDirectory)
+{
+    static const char source[] = " org $800" LINE_ENDING
+                                 " hex 00,ff" LINE_ENDING
+                                 " sav AssemblerTest.sav" LINE_ENDING
+                                 " org $900" LINE_ENDING
+                                 " hex 01,02,03" LINE_ENDING
+                                 " usr $a9,1,$0000,*-$900" LINE_ENDING;
+    static const char bundleFilename[] = "AssemblerTest.snb";
+    MemoryVfs*        pVfs = MemoryVfs_Create();
+    ObjectBundle*     pBundle;
+    ObjectBundleItem  item;
+    
+    MemoryVfs_AddFile(pVfs, g_sourceFilename, source, sizeof(source) - 1);
+    m_initParams.pVfs = (Vfs*)pVfs;
+    m_initParams.pOutputDirectory = "ignored";
+    m_initParams.pBundleFilename = bundleFilename;
+    m_pAssembler = Assembler_CreateFromFile(g_sourceFilename, &m_initParams);
+    Assembler_Run(m_pAssembler);
+    LONGS_EQUAL(0, Assembler_GetErrorCount(m_pAssembler));
+    LONGS_EQUAL(1, Assembler_GetWrittenFileCount(m_pAssembler));
+    LONGS_EQUAL(2, MemoryVfs_GetFileCount(pVfs));
+    
+    pBundle = ObjectBundle_Open((Vfs*)pVfs, bundleFilename);
+    LONGS_EQUAL(2, ObjectBundle_GetEntryCount(pBundle));
+    CHECK_TRUE(ObjectBundle_Find(pBundle, g_objectFilename, &item));
+    LONGS_EQUAL(sizeof(SavFileHeader) + 2, item.length);
+    LONGS_EQUAL(0x800, ((SavFileHeader*)item.pData)->address);
+    CHECK_TRUE(ObjectBundle_Find(pBundle, "AssemblerTest", &item));
+    LONGS_EQUAL(sizeof(RW18SavFileHeader) + 3, item.length);
+    ObjectBundle_Free(pBundle);
+    Vfs_Free((Vfs*)pVfs);
+}
@@ -152,7 +152,7 @@ TEST(AssemblerDirectives, FailBinaryBufferAllocationInHEXDirective)
 {
     m_pAssembler = Assembler_CreateFromString(dupe(" hex ff" LINE_ENDING), NULL);
     BinaryBuffer_FailAllocation(m_pAssembler->pCurrentBuffer, 1);
-    runAssemblerAndValidateFailure("filename:1: error: Exceeded the 65536 allowed bytes in the object file." LINE_ENDING,
+    runAssemblerAndValidateFailure("filename:1: error: Ran out of memory for object file bytes." LINE_ENDING,
                                    "    :              1  hex ff" LINE_ENDING);
 }
 
@@ -340,7 +340,7 @@ TEST(AssemblerDirectives, FailBinaryBufferAllocationInDSDirective)
 {
     m_pAssembler = Assembler_CreateFromString(dupe(" ds 1" LINE_ENDING), NULL);
     BinaryBuffer_FailAllocation(m_pAssembler->pCurrentBuffer, 1);
-    runAssemblerAndValidateFailure("filename:1: error: Exceeded the 65536 allowed bytes in the object file." LINE_ENDING,
+    runAssemblerAndValidateFailure("filename:1: error: Ran out of memory for object file bytes." LINE_ENDING,
                                    "    :              1  ds 1" LINE_ENDING);
 }
 
@@ -399,7 +399,7 @@ TEST(AssemblerDirectives, FailBinaryBufferAllocationInASCDirective)
 {
     m_pAssembler = Assembler_CreateFromString(dupe(" asc 'Tst'" LINE_ENDING), NULL);
     BinaryBuffer_FailAllocation(m_pAssembler->pCurrentBuffer, 1);
-    runAssemblerAndValidateFailure("filename:1: error: Exceeded the 65536 allowed bytes in the object file." LINE_ENDING,
+    runAssemblerAndValidateFailure("filename:1: error: Ran out of memory for object file bytes." LINE_ENDING,
                                    "    :              1  asc 'Tst'" LINE_ENDING);
 }
 
@@ -439,7 +439,7 @@ TEST(AssemblerDirectives, FailBinaryBufferAllocationInREVDirective)
 {
     m_pAssembler = Assembler_CreateFromString(dupe(" rev 'Tst'" LINE_ENDING), NULL);
     BinaryBuffer_FailAllocation(m_pAssembler->pCurrentBuffer, 1);
-    runAssemblerAndValidateFailure("filename:1: error: Exceeded the 65536 allowed bytes in the object file." LINE_ENDING,
+    runAssemblerAndValidateFailure("filename:1: error: Ran out of memory for object file bytes." LINE_ENDING,
                                    "    :              1  rev 'Tst'" LINE_ENDING);
 }
 
@@ -12,12 +12,16 @@
 */
 
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 // Include headers from C modules under test.
 extern "C"
 {
     #include "BinaryBuffer.h"
+    #include "ObjectBundle.h"
     #include "MallocFailureInject.h"
     #include "FileFailureInject.h"
+    #include "ThreadPool.h"
     #include "util.h"
 }
 
@@ -32,6 +36,7 @@ extern "C"
 
 static const char*         g_filename = "BinaryBufferTest.test";
 static const char*         g_filename2 = "BinaryBufferTest2.test";
+static const char*         g_bundleFilename = "BinaryBufferTest.bundle";
 static const unsigned char g_testData[2] = { 0x00, 0xff };
 
 TEST_GROUP(BinaryBuffer)
@@ -42,6 +47,7 @@ TEST_GROUP(BinaryBuffer)
     size_t          m_allocSize;
     FILE*           m_pFile;
     char*           m_pReadBuffer;
+    ObjectBundle*   m_pBundle;
     
     void setup()
     {
@@ -51,6 +57,7 @@ TEST_GROUP(BinaryBuffer)
         m_allocSize = 0;
         m_pFile = NULL;
         m_pReadBuffer = NULL;
+        m_pBundle = NULL;
     }
 
     void teardown()
@@ -58,13 +65,18 @@ TEST_GROUP(BinaryBuffer)
         MallocFailureInject_Restore();
         fopenRestore();
         fwriteRestore();
+        writevRestore();
+        renameRestore();
+        ThreadPool_SetThreadCount(0);
         LONGS_EQUAL(noException, getExceptionCode());
         if (m_pFile)
             fclose(m_pFile);
         free(m_pReadBuffer);
+        ObjectBundle_Free(m_pBundle);
         BinaryBuffer_Free(m_pBinaryBuffer);
         remove(g_filename);
         remove(g_filename2);
+        remove(g_bundleFilename);
     }
     
     SizedString* toSizedString(const char* pString)
@@ -141,6 +153,21 @@ TEST_GROUP(BinaryBuffer)
         m_pFile = NULL;
     }
     
+    void createFileWithContent(const char* pFilename, const void* pContent, size_t contentSize)
+    {
+        m_pFile = fopen(pFilename, "wb");
+        CHECK(m_pFile != NULL);
+        LONGS_EQUAL(contentSize, fwrite(pContent, 1, contentSize, m_pFile));
+        fclose(m_pFile);
+        m_pFile = NULL;
+    }
+    
+    void validateWriteCounts(unsigned int expectedWritten, unsigned int expectedSkipped)
+    {
+        LONGS_EQUAL(expectedWritten, BinaryBuffer_GetWrittenFileCount(m_pBinaryBuffer));
+        LONGS_EQUAL(expectedSkipped, BinaryBuffer_GetSkippedFileCount(m_pBinaryBuffer));
+    }
+    
     long getFileSize(FILE* pFile)
     {
         fseek(pFile, 0, SEEK_END);
@@ -182,10 +209,31 @@ TEST(BinaryBuffer, Allocate2Items)
     CHECK_TRUE(pAlloc2 == pAlloc1+1);
 }
 
-TEST(BinaryBuffer, FailToAllocateItem)
+TEST(BinaryBuffer, AllocateItemLargerThanSegmentSize)
 {
     m_pBinaryBuffer = BinaryBuffer_Create(1);
-    __try_and_catch( BinaryBuffer_Alloc(m_pBinaryBuffer, 2) );
+    unsigned char* pAlloc = BinaryBuffer_Alloc(m_pBinaryBuffer, 2);
+    CHECK_TRUE(NULL != pAlloc);
+    pAlloc[0] = 0x00;
+    pAlloc[1] = 0xff;
+}
+
+TEST(BinaryBuffer, AllocationThatDoesNotFitStartsNewSegment)
+{
+    m_pBinaryBuffer = BinaryBuffer_Create(4);
+    unsigned char* pAlloc1 = BinaryBuffer_Alloc(m_pBinaryBuffer, 3);
+    unsigned char* pAlloc2 = BinaryBuffer_Alloc(m_pBinaryBuffer, 2);
+    unsigned char* pAlloc3 = BinaryBuffer_Alloc(m_pBinaryBuffer, 2);
+    CHECK_TRUE(pAlloc2 != pAlloc1 + 3);
+    CHECK_TRUE(pAlloc3 == pAlloc2 + 2);
+}
+
+TEST(BinaryBuffer, FailMemoryAllocationForNewSegment)
+{
+    m_pBinaryBuffer = BinaryBuffer_Create(1);
+    BinaryBuffer_Alloc(m_pBinaryBuffer, 1);
+    MallocFailureInject_FailAllocation(1);
+        __try_and_catch( BinaryBuffer_Alloc(m_pBinaryBuffer, 1) );
     validateExceptionThrown(outOfMemoryException);
 }
 
@@ -206,6 +254,17 @@ TEST(BinaryBuffer, ReallocToGrowBufferByOneByte)
     CHECK_TRUE(pAlloc3 == pAlloc2 + 2);
 }
 
+TEST(BinaryBuffer, ReallocPastEndOfSegmentMovesAndKeepsContent)
+{
+    m_pBinaryBuffer = BinaryBuffer_Create(4);
+                             BinaryBuffer_Alloc(m_pBinaryBuffer, 2);
+    unsigned char* pAlloc1 = BinaryBuffer_Alloc(m_pBinaryBuffer, 2);
+    memcpy(pAlloc1, g_testData, sizeof(g_testData));
+    unsigned char* pAlloc2 = BinaryBuffer_Realloc(m_pBinaryBuffer, pAlloc1, 3);
+    CHECK_TRUE(pAlloc1 != pAlloc2);
+    CHECK(0 == memcmp(pAlloc2, g_testData, sizeof(g_testData)));
+}
+
 TEST(BinaryBuffer, FailReallocBySpecifyingPointerOtherThanLastAllocated)
 {
     m_pBinaryBuffer = BinaryBuffer_Create(64);
@@ -237,7 +296,7 @@ TEST(BinaryBuffer, QueueWriteToFile)
 {
     placeDataInBuffer(g_testData, sizeof(g_testData));
     BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
-    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
     validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
 }
 
@@ -245,7 +304,7 @@ TEST(BinaryBuffer, QueueWriteToFileWithDirectoryNoSlash)
 {
     placeDataInBuffer(g_testData, sizeof(g_testData));
     BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, ".", toSizedString(g_filename), NULL);
-    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
     validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
 }
 
@@ -253,7 +312,7 @@ TEST(BinaryBuffer, QueueWriteToFileWithDirectorySlash)
 {
     placeDataInBuffer(g_testData, sizeof(g_testData));
     BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, "." SLASH_STR, toSizedString(g_filename), NULL);
-    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
     validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
 }
 
@@ -261,7 +320,7 @@ TEST(BinaryBuffer, QueueWriteToFileWithDirectoryAndSuffix)
 {
     placeDataInBuffer(g_testData, sizeof(g_testData));
     BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, ".", toSizedString("BinaryBufferTest"), ".test");
-    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
     validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
 }
 
@@ -269,7 +328,7 @@ TEST(BinaryBuffer, QueueWriteToInvalidDirectory)
 {
     placeDataInBuffer(g_testData, sizeof(g_testData));
     BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, "invalidDirectory" SLASH_STR, toSizedString(g_filename), NULL);
-    __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer) );
+    __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL) );
     validateExceptionThrown(fileException);
 }
 
@@ -279,17 +338,17 @@ TEST(BinaryBuffer, FailFOpenDuringWriteToFile)
     
     fopenFail(NULL);
         BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
-        __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer) );
+        __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL) );
     validateExceptionThrown(fileException);
 }
 
-TEST(BinaryBuffer, FailFWriteDuringWriteToFile)
+TEST(BinaryBuffer, FailWriteVDuringWriteToFile)
 {
     placeDataInBuffer(g_testData, sizeof(g_testData));
     
-    fwriteFail(0);
+    writevFail(-1);
         BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
-        __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer) );
+        __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL) );
     validateExceptionThrown(fileException);
 }
 
@@ -317,7 +376,7 @@ TEST(BinaryBuffer, QueueRW18WriteToFile)
     placeDataInBuffer(g_testData, sizeof(g_testData));
     BinaryBuffer_QueueRW18WriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL,
                                       RW18_SIDE_0, RW18_TRACK_1, RW18_OFFSET_0);
-    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
     validateRW18ObjectFileContains(g_filename, RW18_SIDE_0, RW18_TRACK_1, RW18_OFFSET_0, 
                                    g_testData, sizeof(g_testData));
 }
@@ -354,7 +413,477 @@ TEST(BinaryBuffer, QueueUPTwoWritesFromBuffer)
     BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename2), NULL);
 
 
-    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
     validateObjectFileContains(g_filename, 0x800, testData1, sizeof(testData1));
     validateObjectFileContains(g_filename2, 0x900, testData2, sizeof(testData2));
 }
+
+TEST(BinaryBuffer, CountWrittenFiles)
+{
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateWriteCounts(1, 0);
+}
+
+TEST(BinaryBuffer, SkipWriteOfFileWithUnchangedContent)
+{
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    
+    writevFail(-1);
+        BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateWriteCounts(0, 1);
+    validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
+}
+
+TEST(BinaryBuffer, RewriteFileWithSameSizeButDifferentContent)
+{
+    static const unsigned char existingContent[sizeof(SavFileHeader) + sizeof(g_testData)] = "SAV\x1a";
+    
+    createFileWithContent(g_filename, existingContent, sizeof(existingContent));
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateWriteCounts(1, 0);
+    validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
+}
+
+TEST(BinaryBuffer, RewriteFileKeepsPermissionsOfOriginalFile)
+{
+    static const unsigned char existingContent[] = "Original";
+    struct stat                fileStat;
+    
+    createFileWithContent(g_filename, existingContent, sizeof(existingContent));
+    LONGS_EQUAL(0, chmod(g_filename, 0640));
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
+    LONGS_EQUAL(0, stat(g_filename, &fileStat));
+    LONGS_EQUAL(0640, fileStat.st_mode & 07777);
+}
+
+TEST(BinaryBuffer, FailRenameDuringWriteToFileLeavesOriginalFileAndNoTemporaryFile)
+{
+    static const unsigned char existingContent[] = "Original";
+    char                       tempFilename[256];
+    
+    snprintf(tempFilename, sizeof(tempFilename), "%s.%lu.tmp", g_filename, (unsigned long)getpid());
+    createFileWithContent(g_filename, existingContent, sizeof(existingContent));
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    
+    renameFail(-1);
+        BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+        __try_and_catch( BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL) );
+    validateExceptionThrown(fileException);
+    validateWriteCounts(0, 0);
+    
+    m_pFile = fopen(tempFilename, "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+    m_pFile = fopen(g_filename, "rb");
+    LONGS_EQUAL(sizeof(existingContent), getFileSize(m_pFile));
+}
+
+TEST(BinaryBuffer, QueueTwoWritesToSameFileKeepsLastOne)
+{
+    static const unsigned char testData1[2] = { 1, 2 };
+    static const unsigned char testData2[2] = { 3, 4 };
+    
+    m_pBinaryBuffer = BinaryBuffer_Create(4);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x800);
+    placeDataInBuffer(testData1, sizeof(testData1));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x900);
+    placeDataInBuffer(testData2, sizeof(testData2));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateWriteCounts(1, 0);
+    validateObjectFileContains(g_filename, 0x900, testData2, sizeof(testData2));
+}
+
+TEST(BinaryBuffer, WriteManyFilesConcurrently)
+{
+    static const int fileCount = 16;
+    char             filenames[fileCount][32];
+    unsigned char    data[fileCount];
+    
+    ThreadPool_SetThreadCount(4);
+    m_pBinaryBuffer = BinaryBuffer_Create(fileCount);
+    for (int i = 0 ; i < fileCount ; i++)
+    {
+        snprintf(filenames[i], sizeof(filenames[i]), "BinaryBufferTest%d.test", i);
+        data[i] = (unsigned char)i;
+        BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x800 + i);
+        placeDataInBuffer(&data[i], 1);
+        BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(filenames[i]), NULL);
+    }
+    
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateWriteCounts(fileCount, 0);
+    for (int i = 0 ; i < fileCount ; i++)
+    {
+        validateObjectFileContains(filenames[i], 0x800 + i, &data[i], 1);
+        remove(filenames[i]);
+    }
+}
+
+TEST(BinaryBuffer, QueueWriteToFileOfContentSpreadAcrossSegments)
+{
+    static const unsigned char testData[7] = { 1, 2, 3, 4, 5, 6, 7 };
+    
+    m_pBinaryBuffer = BinaryBuffer_Create(3);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x800);
+    placeDataInBuffer(testData, 2);
+    placeDataInBuffer(testData + 2, 2);
+    placeDataInBuffer(testData + 4, 3);
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateObjectFileContains(g_filename, 0x800, testData, sizeof(testData));
+}
+
+TEST(BinaryBuffer, QueueWriteToFileAfterReallocMovedToNewSegment)
+{
+    static const unsigned char testData[5] = { 1, 2, 3, 4, 5 };
+    
+    m_pBinaryBuffer = BinaryBuffer_Create(4);
+    placeDataInBuffer(testData, 2);
+    placeDataInBuffer(testData + 2, 2);
+    m_pAlloc = BinaryBuffer_Realloc(m_pBinaryBuffer, m_pAlloc, 3);
+    m_pAlloc[2] = testData[4];
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateObjectFileContains(g_filename, 0x0000, testData, sizeof(testData));
+}
+
+TEST(BinaryBuffer, SkipWriteOfUnchangedFileWithContentSpreadAcrossSegments)
+{
+    static const unsigned char testData[4] = { 1, 2, 3, 4 };
+    
+    m_pBinaryBuffer = BinaryBuffer_Create(2);
+    placeDataInBuffer(testData, 2);
+    placeDataInBuffer(testData + 2, 2);
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    
+    writevFail(-1);
+        BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateWriteCounts(0, 1);
+}
+
+TEST(BinaryBuffer, FailToQueueWriteLargerThanObjectFileHeaderAllows)
+{
+    m_pBinaryBuffer = BinaryBuffer_Create(64*1024);
+    BinaryBuffer_Alloc(m_pBinaryBuffer, 0x10000);
+    __try_and_catch( BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL) );
+    validateExceptionThrown(invalidArgumentException);
+}
+
+TEST(BinaryBuffer, ReleaseWrittenSegmentsRecyclesSegmentsBeforeCurrentOrigin)
+{
+    m_pBinaryBuffer = BinaryBuffer_Create(2);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x800);
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    unsigned char* pFirstSegment = m_pAlloc;
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x900);
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_ReleaseWrittenSegments(m_pBinaryBuffer);
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    CHECK_TRUE(pFirstSegment == m_pAlloc);
+    validateWriteCounts(1, 0);
+}
+
+TEST(BinaryBuffer, ReleaseWrittenSegmentsIgnoredWhileWritesAreStillQueued)
+{
+    static const unsigned char testData[4] = { 1, 2, 3, 4 };
+    
+    m_pBinaryBuffer = BinaryBuffer_Create(2);
+    placeDataInBuffer(testData, 2);
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x900);
+    placeDataInBuffer(testData + 2, 2);
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename2), NULL);
+    BinaryBuffer_ReleaseWrittenSegments(m_pBinaryBuffer);
+    
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    validateObjectFileContains(g_filename, 0x0000, testData, 2);
+    validateObjectFileContains(g_filename2, 0x900, testData + 2, 2);
+}
+
+TEST(BinaryBuffer, StagedFileOnlyReplacesExistingFileOnCommit)
+{
+    static const unsigned char existingContent[] = "Original";
+    
+    createFileWithContent(g_filename, existingContent, sizeof(existingContent));
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_StageWriteFileQueue(m_pBinaryBuffer, NULL);
+    BinaryBuffer_ReleaseWrittenSegments(m_pBinaryBuffer);
+    validateWriteCounts(0, 0);
+    m_pFile = fopen(g_filename, "rb");
+    LONGS_EQUAL(sizeof(existingContent), getFileSize(m_pFile));
+    fclose(m_pFile);
+    m_pFile = NULL;
+    
+    BinaryBuffer_CommitStagedFiles(m_pBinaryBuffer);
+    validateWriteCounts(1, 0);
+    validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
+}
+
+TEST(BinaryBuffer, CommitStagedFileKeepsPermissionsOfOriginalFile)
+{
+    static const unsigned char existingContent[] = "Original";
+    struct stat                fileStat;
+    
+    createFileWithContent(g_filename, existingContent, sizeof(existingContent));
+    LONGS_EQUAL(0, chmod(g_filename, 0604));
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_StageWriteFileQueue(m_pBinaryBuffer, NULL);
+    BinaryBuffer_CommitStagedFiles(m_pBinaryBuffer);
+    validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
+    LONGS_EQUAL(0, stat(g_filename, &fileStat));
+    LONGS_EQUAL(0604, fileStat.st_mode & 07777);
+}
+
+TEST(BinaryBuffer, DiscardStagedFilesLeavesExistingFileAndNoTemporaryFile)
+{
+    static const unsigned char existingContent[] = "Original";
+    char                       tempFilename[256];
+    
+    snprintf(tempFilename, sizeof(tempFilename), "%s.%lu.0.tmp", g_filename, (unsigned long)getpid());
+    createFileWithContent(g_filename, existingContent, sizeof(existingContent));
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_StageWriteFileQueue(m_pBinaryBuffer, NULL);
+    m_pFile = fopen(tempFilename, "rb");
+    CHECK(m_pFile != NULL);
+    fclose(m_pFile);
+    
+    BinaryBuffer_DiscardStagedFiles(m_pBinaryBuffer);
+    validateWriteCounts(0, 0);
+    m_pFile = fopen(tempFilename, "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+    m_pFile = fopen(g_filename, "rb");
+    LONGS_EQUAL(sizeof(existingContent), getFileSize(m_pFile));
+}
+
+TEST(BinaryBuffer, StagingSameFileAgainComparesAgainstStagedContentAndCommitsLastOne)
+{
+    static const unsigned char testData1[2] = { 1, 2 };
+    static const unsigned char testData2[2] = { 3, 4 };
+    
+    m_pBinaryBuffer = BinaryBuffer_Create(4);
+    placeDataInBuffer(testData1, sizeof(testData1));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_StageWriteFileQueue(m_pBinaryBuffer, NULL);
+    BinaryBuffer_ReleaseWrittenSegments(m_pBinaryBuffer);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x0000);
+    placeDataInBuffer(testData1, sizeof(testData1));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_StageWriteFileQueue(m_pBinaryBuffer, NULL);
+    BinaryBuffer_ReleaseWrittenSegments(m_pBinaryBuffer);
+    validateWriteCounts(0, 1);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x0000);
+    placeDataInBuffer(testData2, sizeof(testData2));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_StageWriteFileQueue(m_pBinaryBuffer, NULL);
+    
+    BinaryBuffer_CommitStagedFiles(m_pBinaryBuffer);
+    validateWriteCounts(1, 1);
+    validateObjectFileContains(g_filename, 0x0000, testData2, sizeof(testData2));
+}
+
+TEST(BinaryBuffer, StagingFileBackToContentOnDiskDropsEarlierStagedFileAndSkipsRenameOnCommit)
+{
+    static const unsigned char testData1[2] = { 1, 2 };
+    static const unsigned char testData2[2] = { 3, 4 };
+    char                       tempFilename[256];
+    
+    m_pBinaryBuffer = BinaryBuffer_Create(4);
+    placeDataInBuffer(testData1, sizeof(testData1));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_ProcessWriteFileQueue(m_pBinaryBuffer, NULL);
+    BinaryBuffer_ReleaseWrittenSegments(m_pBinaryBuffer);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x0000);
+    placeDataInBuffer(testData2, sizeof(testData2));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_StageWriteFileQueue(m_pBinaryBuffer, NULL);
+    BinaryBuffer_ReleaseWrittenSegments(m_pBinaryBuffer);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x0000);
+    placeDataInBuffer(testData1, sizeof(testData1));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_StageWriteFileQueue(m_pBinaryBuffer, NULL);
+    snprintf(tempFilename, sizeof(tempFilename), "%s.%lu.0.tmp", g_filename, (unsigned long)getpid());
+    m_pFile = fopen(tempFilename, "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+    
+    renameFail(-1);
+        BinaryBuffer_CommitStagedFiles(m_pBinaryBuffer);
+    validateWriteCounts(1, 1);
+    validateObjectFileContains(g_filename, 0x0000, testData1, sizeof(testData1));
+}
+
+TEST(BinaryBuffer, ProcessEmptyQueueToBundleWritesNothing)
+{
+    m_pBinaryBuffer = BinaryBuffer_Create(64*1024);
+    BinaryBuffer_ProcessWriteFileQueueToBundle(m_pBinaryBuffer, NULL, g_bundleFilename);
+    validateWriteCounts(0, 0);
+    m_pFile = fopen(g_bundleFilename, "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+}
+
+TEST(BinaryBuffer, ProcessTwoWritesToBundle)
+{
+    static const unsigned char testData[4] = { 1, 2, 3, 4 };
+    ObjectBundleItem           item;
+    
+    m_pBinaryBuffer = BinaryBuffer_Create(2);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x800);
+    placeDataInBuffer(testData, 2);
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x900);
+    placeDataInBuffer(testData, 4);
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename2), NULL);
+    BinaryBuffer_ProcessWriteFileQueueToBundle(m_pBinaryBuffer, NULL, g_bundleFilename);
+    validateWriteCounts(1, 0);
+    
+    m_pBundle = ObjectBundle_Open(NULL, g_bundleFilename);
+    LONGS_EQUAL(2, ObjectBundle_GetEntryCount(m_pBundle));
+    CHECK_TRUE(ObjectBundle_Find(m_pBundle, g_filename2, &item));
+    LONGS_EQUAL(sizeof(SavFileHeader) + 4, item.length);
+    LONGS_EQUAL(sizeof(SavFileHeader) + 512, item.paddedLength);
+    CHECK(0 == memcmp(item.pData, BINARY_BUFFER_SAV_SIGNATURE, 4));
+    LONGS_EQUAL(0x900, ((SavFileHeader*)item.pData)->address);
+    CHECK(0 == memcmp(item.pData + sizeof(SavFileHeader), testData, 4));
+    CHECK_TRUE(item.pData[item.paddedLength - 1] == 0x00);
+    CHECK_TRUE(ObjectBundle_Find(m_pBundle, g_filename, &item));
+    LONGS_EQUAL(sizeof(SavFileHeader) + 2, item.length);
+    CHECK(0 == memcmp(item.pData + sizeof(SavFileHeader), testData, 2));
+    
+    m_pFile = fopen(g_filename, "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+}
+
+TEST(BinaryBuffer, SkipWriteOfUnchangedBundle)
+{
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_ProcessWriteFileQueueToBundle(m_pBinaryBuffer, NULL, g_bundleFilename);
+    validateWriteCounts(1, 0);
+    
+    writevFail(-1);
+    BinaryBuffer_ProcessWriteFileQueueToBundle(m_pBinaryBuffer, NULL, g_bundleFilename);
+    validateWriteCounts(0, 1);
+}
+
+TEST(BinaryBuffer, FailToBundleFilenameLongerThanIndexAllows)
+{
+    char longFilename[OBJECT_BUNDLE_NAME_LENGTH + 1];
+    memset(longFilename, 'A', sizeof(longFilename)-1);
+    longFilename[sizeof(longFilename)-1] = '\0';
+    
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(longFilename), NULL);
+    __try_and_catch( BinaryBuffer_ProcessWriteFileQueueToBundle(m_pBinaryBuffer, NULL, g_bundleFilename) );
+    validateExceptionThrown(invalidArgumentException);
+    m_pFile = fopen(g_bundleFilename, "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+}
+
+TEST(BinaryBuffer, FailWriteVDuringWriteToBundle)
+{
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    writevFail(-1);
+    __try_and_catch( BinaryBuffer_ProcessWriteFileQueueToBundle(m_pBinaryBuffer, NULL, g_bundleFilename) );
+    validateExceptionThrown(fileException);
+    m_pFile = fopen(g_bundleFilename, "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+}
+
+static void appendObjectToString(void* pContext, const BinaryBufferObject* pObject)
+{
+    char* pString = (char*)pContext;
+    char  object[64];
+    
+    snprintf(object, sizeof(object), "%s:%u:%u:%02x%02x;", 
+             pObject->pFilename, (unsigned int)pObject->headerLength, (unsigned int)pObject->dataLength,
+             pObject->pData[0], pObject->pData[pObject->dataLength - 1]);
+    strcat(pString, object);
+}
+
+static void throwFileException(void* pContext, const BinaryBufferObject* pObject)
+{
+    __throw(fileException);
+}
+
+TEST(BinaryBuffer, ProcessWriteFileQueueToHandlerPassesObjectsInQueueOrderWithoutWritingFiles)
+{
+    static const unsigned char testData[4] = { 1, 2, 3, 4 };
+    char                       objects[256] = "";
+    
+    m_pBinaryBuffer = BinaryBuffer_Create(2);
+    placeDataInBuffer(testData, 2);
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    BinaryBuffer_SetOrigin(m_pBinaryBuffer, 0x900);
+    placeDataInBuffer(testData, 2);
+    placeDataInBuffer(testData + 2, 2);
+    BinaryBuffer_QueueRW18WriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename2), NULL, 
+                                      RW18_SIDE_0, RW18_TRACK_1, RW18_OFFSET_0);
+    BinaryBuffer_ProcessWriteFileQueueToHandler(m_pBinaryBuffer, appendObjectToString, objects);
+    
+    STRCMP_EQUAL("BinaryBufferTest.test:8:2:0102;BinaryBufferTest2.test:12:4:0104;", objects);
+    validateWriteCounts(2, 0);
+    m_pFile = fopen(g_filename, "rb");
+    POINTERS_EQUAL(NULL, m_pFile);
+}
+
+TEST(BinaryBuffer, ProcessWriteFileQueueToHandlerPropagatesHandlerException)
+{
+    m_pBinaryBuffer = BinaryBuffer_Create(2);
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    placeDataInBuffer(g_testData, sizeof(g_testData));
+    BinaryBuffer_QueueWriteToFile(m_pBinaryBuffer, NULL, toSizedString(g_filename), NULL);
+    __try_and_catch( BinaryBuffer_ProcessWriteFileQueueToHandler(m_pBinaryBuffer, throwFileException, NULL) );
+    validateExceptionThrown(fileException);
+}
+
+TEST(BinaryBuffer, WriteObjectToFileWritesHeaderAndData)
+{
+    SavFileHeader      header = { { 'S', 'A', 'V', 0x1a }, 0x0000, sizeof(g_testData) };
+    BinaryBufferObject object = { g_filename, &header, sizeof(header), g_testData, sizeof(g_testData) };
+    
+    CHECK_TRUE(BinaryBuffer_WriteObjectToFile(NULL, &object));
+    validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
+}
+
+TEST(BinaryBuffer, WriteObjectToFileSkipsFileWithUnchangedContent)
+{
+    SavFileHeader      header = { { 'S', 'A', 'V', 0x1a }, 0x0000, sizeof(g_testData) };
+    BinaryBufferObject object = { g_filename, &header, sizeof(header), g_testData, sizeof(g_testData) };
+    
+    CHECK_TRUE(BinaryBuffer_WriteObjectToFile(NULL, &object));
+    writevFail(-1);
+        CHECK_FALSE(BinaryBuffer_WriteObjectToFile(NULL, &object));
+    validateObjectFileContains(g_filename, 0x0000, g_testData, sizeof(g_testData));
+}
+
+TEST(BinaryBuffer, FailRenameDuringWriteObjectToFileLeavesOriginalFile)
+{
+    static const unsigned char existingContent[] = "Original";
+    SavFileHeader              header = { { 'S', 'A', 'V', 0x1a }, 0x0000, sizeof(g_testData) };
+    BinaryBufferObject         object = { g_filename, &header, sizeof(header), g_testData, sizeof(g_testData) };
+    
+    createFileWithContent(g_filename, existingContent, sizeof(existingContent));
+    renameFail(-1);
+        __try_and_catch( BinaryBuffer_WriteObjectToFile(NULL, &object) );
+    validateExceptionThrown(fileException);
+    m_pFile = fopen(g_filename, "rb");
+    LONGS_EQUAL(sizeof(existingContent), getFileSize(m_pFile));
+}
@@ -157,6 +157,36 @@ TEST(SnapCommandLine, AllValidCommandLineParameters)
     validateParamsAndNoErrorMessage("SOURCE1.S", "SOURCE1.LST", "foo;bar", "foobar");
 }
 
+TEST(SnapCommandLine, OneSourceFilenameAndStreamFlag)
+{
+    addArg("--stream");
+    addArg("SOURCE1.S");
+    
+    SnapCommandLine_Init(&m_commandLine, m_argc, m_argv);
+    validateParamsAndNoErrorMessage("SOURCE1.S", NULL);
+    LONGS_EQUAL(1, m_commandLine.assemblerInitParams.streamListing);
+}
+
+TEST(SnapCommandLine, OneSourceFilenameAndBundleFilename)
+{
+    addArg("--bundle");
+    addArg("OBJECTS.SNB");
+    addArg("SOURCE1.S");
+    
+    SnapCommandLine_Init(&m_commandLine, m_argc, m_argv);
+    validateParamsAndNoErrorMessage("SOURCE1.S", NULL);
+    STRCMP_EQUAL("OBJECTS.SNB", m_commandLine.assemblerInitParams.pBundleFilename);
+}
+
+TEST(SnapCommandLine, FailOnBundleFlagWithNoFilename)
+{
+    addArg("SOURCE1.S");
+    addArg("--bundle");
+    
+    __try_and_catch( SnapCommandLine_Init(&m_commandLine, m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrownAndUsageStringDisplayed();
+}
+
 TEST(SnapCommandLine, FailOnTwoSourceFilenames)
 {
     addArg("SOURCE1.S");
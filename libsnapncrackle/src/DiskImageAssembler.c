@@ -0,0 +1,99 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include "DiskImageAssembler.h"
+#include "DiskImageAssemblerTest.h"
+#include "BinaryBuffer.h"
+#include "util.h"
+
+
+typedef struct ObjectHandlerContext
+{
+    DiskImage*                 pDiskImage;
+    Vfs*                       pVfs;
+    DiskImageAssemblerResults* pResults;
+} ObjectHandlerContext;
+
+
+static void handleObject(void* pvContext, const BinaryBufferObject* pObject);
+__throws void DiskImageAssembler_AssembleFile(DiskImage*                 pDiskImage, 
+                                              const char*                pSourceFilename, 
+                                              const AssemblerInitParams* pParams,
+                                              DiskImageAssemblerResults* pResults)
+{
+    AssemblerInitParams  params = *pParams;
+    ObjectHandlerContext context;
+    Assembler*           pAssembler = NULL;
+    
+    context.pDiskImage = pDiskImage;
+    context.pVfs = pParams->pVfs;
+    context.pResults = pResults;
+    params.objectHandler = handleObject;
+    params.pObjectHandlerContext = &context;
+    __try
+    {
+        pAssembler = Assembler_CreateFromFile(pSourceFilename, &params);
+        Assembler_Run(pAssembler);
+    }
+    __catch
+    {
+        Assembler_Free(pAssembler);
+        __rethrow;
+    }
+    
+    pResults->errorCount += Assembler_GetErrorCount(pAssembler);
+    pResults->warningCount += Assembler_GetWarningCount(pAssembler);
+    Assembler_Free(pAssembler);
+}
+
+static int isRW18Object(const BinaryBufferObject* pObject);
+static void insertRW18Object(DiskImage* pDiskImage, const BinaryBufferObject* pObject);
+static void handleObject(void* pvContext, const BinaryBufferObject* pObject)
+{
+    ObjectHandlerContext* pContext = (ObjectHandlerContext*)pvContext;
+    
+    if (isRW18Object(pObject))
+    {
+        insertRW18Object(pContext->pDiskImage, pObject);
+        pContext->pResults->insertedObjectCount++;
+    }
+    else if (BinaryBuffer_WriteObjectToFile(pContext->pVfs, pObject))
+    {
+        pContext->pResults->savedObjectCount++;
+    }
+    else
+    {
+        pContext->pResults->skippedObjectCount++;
+    }
+}
+
+static int isRW18Object(const BinaryBufferObject* pObject)
+{
+    return pObject->headerLength == sizeof(RW18SavFileHeader) && 
+           0 == memcmp(pObject->pHeader, BINARY_BUFFER_RW18SAV_SIGNATURE, 4);
+}
+
+static void insertRW18Object(DiskImage* pDiskImage, const BinaryBufferObject* pObject)
+{
+    const RW18SavFileHeader* pHeader = (const RW18SavFileHeader*)pObject->pHeader;
+    DiskImageInsert          insert;
+    
+    memset(&insert, 0, sizeof(insert));
+    insert.type = DISK_IMAGE_INSERTION_RW18;
+    insert.sourceOffset = 0;
+    insert.length = pObject->dataLength;
+    insert.side = pHeader->side;
+    insert.track = pHeader->track;
+    insert.intraTrackOffset = pHeader->offset;
+    DiskImage_InsertData(pDiskImage, pObject->pData, &insert);
+}
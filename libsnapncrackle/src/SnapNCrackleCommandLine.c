@@ -0,0 +1,177 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <stddef.h>
+#include "SnapNCrackleCommandLine.h"
+#include "SnapNCrackleCommandLineTest.h"
+#include "util.h"
+#include "version.h"
+
+static void displayCopyrightNotice(void)
+{
+    printf("snapncrackle - Assemble 6502 Sources Straight into Apple II Disk Images (" VERSION_STRING ")\n\n"
+           COPYRIGHT_NOTICE
+           "\n");
+}
+
+static void displayUsage(void)
+{
+    printf("Usage: snapncrackle --format image_format [--putdirs includeDir1;includeDir2...]\n"
+           "                    [--outdir outputDirectory] [--script scriptFilename] [--stream]\n"
+           "                    outputImageFilename sourceFilename...\n\n"
+           "Where: --format image_format indicates the type outputImage is to be\n"
+           "         created.  image_format can be one of:\n"
+           "           nib_5.25 - creates a .nib nibble image for a 5 1/4\" disk.\n"
+           "           hdv_3.5 - creates a .HDV block image for a 3 1/2\" disk.\n"
+           "       --putdirs sets the directories (semi-colon separated) in which\n"
+           "         files will be searched when including files with PUT directive.\n"
+           "       --outdir sets the directory where SAV output files should be stored.\n"
+           "       --script is an optional crackle script which is run after all of\n"
+           "         the sources have been assembled.\n"
+           "       --stream lists each source line as soon as it has no pending\n"
+           "         forward references and inserts USR output into the image as\n"
+           "         soon as possible.\n"
+           "       outputImageFilename is the name of the image to be created.\n"
+           "       sourceFilename... are the assembly language files to be assembled\n"
+           "         in order.  Output from their USR directives is inserted straight\n"
+           "         into the image at the side, track and offset given by the directive.\n");
+}
+
+
+static int parseArgument(SnapNCrackleCommandLine* pThis, int argc, const char** ppArgs);
+static int hasDoubleDashPrefix(const char* pArgument);
+static int parseFlagArgument(SnapNCrackleCommandLine* pThis, int argc, const char** ppArgs);
+static int parseBooleanFlagArgument(SnapNCrackleCommandLine* pThis, const char* pArgument);
+static void parseStringParameter(const char** ppDestField, int argc, const char* pSourceArgument);
+static void parseFormat(SnapNCrackleCommandLine* pThis, int argc, const char* pFormat);
+static int parseFilenameArguments(SnapNCrackleCommandLine* pThis, int argc, const char** ppArgs);
+static void throwIfRequiredArgumentNotSpecified(SnapNCrackleCommandLine* pThis);
+
+
+__throws void SnapNCrackleCommandLine_Init(SnapNCrackleCommandLine* pThis, int argc, const char** argv)
+{
+    __try
+    {
+        memset(pThis, 0, sizeof(*pThis));
+        while (argc)
+        {
+            int argumentsUsed = parseArgument(pThis, argc, argv);
+            argc -= argumentsUsed;
+            argv += argumentsUsed;
+        }
+        throwIfRequiredArgumentNotSpecified(pThis);
+    }
+    __catch
+    {
+        displayCopyrightNotice();
+        displayUsage();
+        __rethrow;
+    }
+}
+
+static int parseArgument(SnapNCrackleCommandLine* pThis, int argc, const char** ppArgs)
+{
+    if (hasDoubleDashPrefix(*ppArgs))
+        return parseFlagArgument(pThis, argc, ppArgs);
+    else
+        return parseFilenameArguments(pThis, argc, ppArgs);
+}
+
+static int hasDoubleDashPrefix(const char* pArgument)
+{
+    return pArgument[0] == '-' && pArgument[1] == '-';
+}
+
+static int parseFlagArgument(SnapNCrackleCommandLine* pThis, int argc, const char** ppArgs)
+{
+    static struct
+    {
+        const char* pFlag;
+        int         destStringOffsetInThis;
+    } const flagArguments[] =
+    {
+        { "--putdirs", offsetof(SnapNCrackleCommandLine, assemblerInitParams) + 
+                       offsetof(AssemblerInitParams, pPutDirectories) },
+        { "--outdir",  offsetof(SnapNCrackleCommandLine, assemblerInitParams) + 
+                       offsetof(AssemblerInitParams, pOutputDirectory) },
+        { "--script",  offsetof(SnapNCrackleCommandLine, pScriptFilename) }
+    };
+    size_t i;
+    
+    if (0 == strcasecmp(*ppArgs, "--format"))
+    {
+        parseFormat(pThis, argc - 1, ppArgs[1]);
+        return 2;
+    }
+    for (i = 0 ; i < ARRAYSIZE(flagArguments) ; i++)
+    {
+        if (0 == strcasecmp(*ppArgs, flagArguments[i].pFlag))
+        {
+            const char** ppDestField = (const char**)((char*)pThis + flagArguments[i].destStringOffsetInThis);
+            parseStringParameter(ppDestField, argc - 1, ppArgs[1]);
+            return 2;
+        }
+    }
+    
+    return parseBooleanFlagArgument(pThis, *ppArgs);
+}
+
+static int parseBooleanFlagArgument(SnapNCrackleCommandLine* pThis, const char* pArgument)
+{
+    if (0 == strcasecmp(pArgument, "--stream"))
+    {
+        pThis->assemblerInitParams.streamListing = 1;
+        return 1;
+    }
+    
+    __throw(invalidArgumentException);
+}
+
+static void parseStringParameter(const char** ppDestField, int argc, const char* pSourceArgument)
+{
+    if (argc < 1)
+        __throw(invalidArgumentException);
+    
+    *ppDestField = pSourceArgument;
+}
+
+static void parseFormat(SnapNCrackleCommandLine* pThis, int argc, const char* pFormat)
+{
+    if (argc < 1)
+        __throw(invalidArgumentException);
+    if (0 == strcasecmp(pFormat, "nib_5.25"))
+        pThis->imageFormat = FORMAT_NIB_5_25;
+    else if (0 == strcasecmp(pFormat, "hdv_3.5"))
+        pThis->imageFormat = FORMAT_HDV_3_5;
+    else
+        __throw(invalidArgumentException);
+}
+
+static int parseFilenameArguments(SnapNCrackleCommandLine* pThis, int argc, const char** ppArgs)
+{
+    /* The output image comes first and every argument after it is taken as a source file to be assembled. */
+    if (pThis->pOutputImageFilename)
+        __throw(invalidArgumentException);
+    pThis->pOutputImageFilename = ppArgs[0];
+    pThis->ppSourceFilenames = &ppArgs[1];
+    pThis->sourceFileCount = argc - 1;
+    
+    return argc;
+}
+
+static void throwIfRequiredArgumentNotSpecified(SnapNCrackleCommandLine* pThis)
+{
+    if (!pThis->pOutputImageFilename || pThis->sourceFileCount == 0 || pThis->imageFormat == FORMAT_UNKNOWN)
+        __throw(invalidArgumentException);
+}
@@ -0,0 +1,222 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "DiskImageAssembler.h"
+    #include "NibbleDiskImage.h"
+    #include "BlockDiskImage.h"
+    #include "MemoryVfs.h"
+    #include "printfSpy.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+static const char g_sourceFilename[] = "DiskImageAssemblerTest.S";
+
+
+TEST_GROUP(DiskImageAssembler)
+{
+    DiskImage*                m_pDiskImage;
+    MemoryVfs*                m_pVfs;
+    AssemblerInitParams       m_initParams;
+    DiskImageAssemblerResults m_results;
+    
+    void setup()
+    {
+        clearExceptionCode();
+        printfSpy_Hook(128);
+        m_pDiskImage = NULL;
+        m_pVfs = MemoryVfs_Create();
+        memset(&m_initParams, 0, sizeof(m_initParams));
+        m_initParams.pVfs = (Vfs*)m_pVfs;
+        memset(&m_results, 0, sizeof(m_results));
+    }
+    
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        printfSpy_Unhook();
+        DiskImage_Free(m_pDiskImage);
+        Vfs_Free((Vfs*)m_pVfs);
+    }
+    
+    void addSource(const char* pFilename, const char* pSource)
+    {
+        MemoryVfs_AddFile(m_pVfs, pFilename, pSource, strlen(pSource));
+    }
+    
+    void validateResults(unsigned int errorCount, unsigned int insertedCount, unsigned int savedCount)
+    {
+        LONGS_EQUAL(errorCount, m_results.errorCount);
+        LONGS_EQUAL(insertedCount, m_results.insertedObjectCount);
+        LONGS_EQUAL(savedCount, m_results.savedObjectCount);
+    }
+    
+    void assembleSavOf00ff()
+    {
+        addSource(g_sourceFilename, " org $800" LINE_ENDING
+                                    " hex 00,ff" LINE_ENDING
+                                    " sav DiskImageAssemblerTest.sav" LINE_ENDING);
+        m_pDiskImage = (DiskImage*)NibbleDiskImage_Create();
+        DiskImageAssembler_AssembleFile(m_pDiskImage, g_sourceFilename, &m_initParams, &m_results);
+    }
+};
+
+
+TEST(DiskImageAssembler, InsertUsrOutputIntoNibbleImageWithoutWritingObjectFile)
+{
+    unsigned char    expectedData[300];
+    NibbleDiskImage* pExpectedImage = NibbleDiskImage_Create();
+    DiskImageInsert  insert;
+    
+    addSource(g_sourceFilename, " org $800" LINE_ENDING
+                                " ds 300,$aa" LINE_ENDING
+                                " usr $a9,1,$0100,*-$800" LINE_ENDING);
+    m_pDiskImage = (DiskImage*)NibbleDiskImage_Create();
+    DiskImageAssembler_AssembleFile(m_pDiskImage, g_sourceFilename, &m_initParams, &m_results);
+    validateResults(0, 1, 0);
+    LONGS_EQUAL(1, MemoryVfs_GetFileCount(m_pVfs));
+    
+    memset(expectedData, 0xaa, sizeof(expectedData));
+    memset(&insert, 0, sizeof(insert));
+    insert.type = DISK_IMAGE_INSERTION_RW18;
+    insert.length = sizeof(expectedData);
+    insert.side = DISK_IMAGE_RW18_SIDE_0;
+    insert.track = 1;
+    insert.intraTrackOffset = 0x100;
+    NibbleDiskImage_InsertData(pExpectedImage, expectedData, &insert);
+    CHECK(0 == memcmp(NibbleDiskImage_GetImagePointer(pExpectedImage), 
+                      DiskImage_GetImagePointer(m_pDiskImage), 
+                      NIBBLE_DISK_IMAGE_SIZE));
+    DiskImage_Free((DiskImage*)pExpectedImage);
+}
+
+TEST(DiskImageAssembler, InsertUsrOutputFromTwoSourcesIntoBlockImage)
+{
+    const unsigned char* pImage;
+    
+    addSource("First.S", " org $800" LINE_ENDING
+                         " hex 11,22" LINE_ENDING
+                         " usr $a9,0,$0000,*-$800" LINE_ENDING);
+    addSource("Second.S", " org $800" LINE_ENDING
+                          " hex 33" LINE_ENDING
+                          " usr $a9,0,$0002,*-$800" LINE_ENDING);
+    m_pDiskImage = (DiskImage*)BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImageAssembler_AssembleFile(m_pDiskImage, "First.S", &m_initParams, &m_results);
+    DiskImageAssembler_AssembleFile(m_pDiskImage, "Second.S", &m_initParams, &m_results);
+    validateResults(0, 2, 0);
+    
+    pImage = DiskImage_GetImagePointer(m_pDiskImage) + 16 * DISK_IMAGE_BLOCK_SIZE;
+    LONGS_EQUAL(0x11, pImage[0]);
+    LONGS_EQUAL(0x22, pImage[1]);
+    LONGS_EQUAL(0x33, pImage[2]);
+}
+
+TEST(DiskImageAssembler, StreamModeInsertsUsrOutputSpanningSeveralSections)
+{
+    const unsigned char* pImage;
+    
+    addSource(g_sourceFilename, " org $800" LINE_ENDING
+                                " hex 11" LINE_ENDING
+                                " usr $a9,0,$0000,*-$800" LINE_ENDING
+                                " org $800" LINE_ENDING
+                                " hex 22" LINE_ENDING
+                                " usr $a9,0,$0001,*-$800" LINE_ENDING);
+    m_initParams.streamListing = 1;
+    m_pDiskImage = (DiskImage*)BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    DiskImageAssembler_AssembleFile(m_pDiskImage, g_sourceFilename, &m_initParams, &m_results);
+    validateResults(0, 2, 0);
+    
+    pImage = DiskImage_GetImagePointer(m_pDiskImage) + 16 * DISK_IMAGE_BLOCK_SIZE;
+    LONGS_EQUAL(0x11, pImage[0]);
+    LONGS_EQUAL(0x22, pImage[1]);
+}
+
+TEST(DiskImageAssembler, SavOutputIsStillWrittenToObjectFile)
+{
+    const unsigned char* pData;
+    size_t               dataSize = 0;
+    
+    assembleSavOf00ff();
+    validateResults(0, 0, 1);
+    
+    pData = (const unsigned char*)MemoryVfs_GetFileData(m_pVfs, "DiskImageAssemblerTest.sav", &dataSize);
+    CHECK(pData != NULL);
+    LONGS_EQUAL(sizeof(SavFileHeader) + 2, dataSize);
+    CHECK(0 == memcmp(pData, BINARY_BUFFER_SAV_SIGNATURE, 4));
+    CHECK(0 == memcmp(pData + sizeof(SavFileHeader), "\x00\xff", 2));
+}
+
+TEST(DiskImageAssembler, UnchangedSavObjectFileIsSkipped)
+{
+    static const unsigned char savFile[] = "SAV\x1a\x00\x08\x02\x00\x00\xff";
+    
+    MemoryVfs_AddFile(m_pVfs, "DiskImageAssemblerTest.sav", savFile, sizeof(savFile) - 1);
+    assembleSavOf00ff();
+    validateResults(0, 0, 0);
+    LONGS_EQUAL(1, m_results.skippedObjectCount);
+}
+
+TEST(DiskImageAssembler, StreamModeErrorOnLaterLineLeavesSavFileUnwritten)
+{
+    size_t dataSize = 0;
+    
+    addSource(g_sourceFilename, " org $800" LINE_ENDING
+                                " hex 00,ff" LINE_ENDING
+                                " sav DiskImageAssemblerTest.sav" LINE_ENDING
+                                " org $900" LINE_ENDING
+                                " hex 11" LINE_ENDING
+                                " foo" LINE_ENDING);
+    m_initParams.streamListing = 1;
+    m_pDiskImage = (DiskImage*)NibbleDiskImage_Create();
+    DiskImageAssembler_AssembleFile(m_pDiskImage, g_sourceFilename, &m_initParams, &m_results);
+    validateResults(1, 0, 0);
+    POINTERS_EQUAL(NULL, MemoryVfs_GetFileData(m_pVfs, "DiskImageAssemblerTest.sav", &dataSize));
+    LONGS_EQUAL(1, MemoryVfs_GetFileCount(m_pVfs));
+}
+
+TEST(DiskImageAssembler, AssemblyErrorsAreCountedAndNothingIsInserted)
+{
+    addSource(g_sourceFilename, " org $800" LINE_ENDING
+                                " foo" LINE_ENDING
+                                " usr $a9,0,$0000,*-$800" LINE_ENDING);
+    m_pDiskImage = (DiskImage*)NibbleDiskImage_Create();
+    DiskImageAssembler_AssembleFile(m_pDiskImage, g_sourceFilename, &m_initParams, &m_results);
+    validateResults(1, 0, 0);
+}
+
+TEST(DiskImageAssembler, FailToInsertUsrOutputWithInvalidTrack)
+{
+    addSource(g_sourceFilename, " org $800" LINE_ENDING
+                                " hex 00" LINE_ENDING
+                                " usr $a9,35,$0000,*-$800" LINE_ENDING);
+    m_pDiskImage = (DiskImage*)NibbleDiskImage_Create();
+    __try_and_catch( DiskImageAssembler_AssembleFile(m_pDiskImage, g_sourceFilename, &m_initParams, &m_results) );
+    LONGS_EQUAL(invalidTrackException, getExceptionCode());
+    clearExceptionCode();
+    validateResults(0, 0, 0);
+}
+
+TEST(DiskImageAssembler, FailToOpenSourceFile)
+{
+    m_pDiskImage = (DiskImage*)NibbleDiskImage_Create();
+    __try_and_catch( DiskImageAssembler_AssembleFile(m_pDiskImage, g_sourceFilename, &m_initParams, &m_results) );
+    LONGS_EQUAL(fileOpenException, getExceptionCode());
+    clearExceptionCode();
+}
@@ -0,0 +1,21 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+/* Used to redirect specific calls to stubs as necessary for testing. */
+#ifndef _DISK_IMAGE_ASSEMBLER_TEST_H_
+#define _DISK_IMAGE_ASSEMBLER_TEST_H_
+
+#include <MallocFailureInject.h>
+#include <FileFailureInject.h>
+#include <printfSpy.h>
+
+#endif /* _DISK_IMAGE_ASSEMBLER_TEST_H_ */
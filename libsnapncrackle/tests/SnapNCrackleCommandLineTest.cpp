@@ -0,0 +1,172 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+#include "SnapNCrackleCommandLine.h"
+#include "SnapNCrackleCommandLineTest.h"
+#include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+static const char g_usageString[] = "Usage:";
+
+
+TEST_GROUP(SnapNCrackleCommandLine)
+{
+    const char*             m_argv[16];
+    SnapNCrackleCommandLine m_commandLine;
+    int                     m_argc;
+    
+    void setup()
+    {
+        clearExceptionCode();
+    
+        memset(m_argv, 0, sizeof(m_argv));
+        memset(&m_commandLine, 0xff, sizeof(m_commandLine));
+        m_argc = 0;
+    
+        printfSpy_Hook(strlen(g_usageString));
+    }
+    
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        printfSpy_Unhook();
+    }
+    
+    void addArg(const char* pArg)
+    {
+        CHECK(m_argc < (int)ARRAYSIZE(m_argv));
+        m_argv[m_argc++] = pArg;
+    }
+    
+    void validateInvalidArgumentExceptionThrownAndUsageStringDisplayed(void)
+    {
+        LONGS_EQUAL(invalidArgumentException, getExceptionCode());
+        STRCMP_EQUAL(g_usageString, printfSpy_GetLastOutput());
+        clearExceptionCode();
+    }
+};
+
+
+TEST(SnapNCrackleCommandLine, NoParameters)
+{
+    __try_and_catch( SnapNCrackleCommandLine_Init(&m_commandLine, m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrownAndUsageStringDisplayed();
+}
+
+TEST(SnapNCrackleCommandLine, FormatImageAndOneSource)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop1.nib");
+    addArg("SOURCE1.S");
+    
+    SnapNCrackleCommandLine_Init(&m_commandLine, m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(FORMAT_NIB_5_25, m_commandLine.imageFormat);
+    STRCMP_EQUAL("pop1.nib", m_commandLine.pOutputImageFilename);
+    LONGS_EQUAL(1, m_commandLine.sourceFileCount);
+    STRCMP_EQUAL("SOURCE1.S", m_commandLine.ppSourceFilenames[0]);
+    POINTERS_EQUAL(NULL, m_commandLine.pScriptFilename);
+    POINTERS_EQUAL(NULL, m_commandLine.assemblerInitParams.pListFilename);
+    LONGS_EQUAL(0, m_commandLine.assemblerInitParams.streamListing);
+}
+
+TEST(SnapNCrackleCommandLine, AllValidCommandLineParametersAndSeveralSources)
+{
+    addArg("--format");
+    addArg("hdv_3.5");
+    addArg("--putdirs");
+    addArg("foo;bar");
+    addArg("--outdir");
+    addArg("foobar");
+    addArg("--script");
+    addArg("pop.crackle");
+    addArg("--stream");
+    addArg("pop.hdv");
+    addArg("SOURCE1.S");
+    addArg("SOURCE2.S");
+    addArg("--notAFlag.S");
+    
+    SnapNCrackleCommandLine_Init(&m_commandLine, m_argc, m_argv);
+    LONGS_EQUAL(0, printfSpy_GetCallCount());
+    LONGS_EQUAL(FORMAT_HDV_3_5, m_commandLine.imageFormat);
+    STRCMP_EQUAL("foo;bar", m_commandLine.assemblerInitParams.pPutDirectories);
+    STRCMP_EQUAL("foobar", m_commandLine.assemblerInitParams.pOutputDirectory);
+    STRCMP_EQUAL("pop.crackle", m_commandLine.pScriptFilename);
+    LONGS_EQUAL(1, m_commandLine.assemblerInitParams.streamListing);
+    STRCMP_EQUAL("pop.hdv", m_commandLine.pOutputImageFilename);
+    LONGS_EQUAL(3, m_commandLine.sourceFileCount);
+    STRCMP_EQUAL("SOURCE1.S", m_commandLine.ppSourceFilenames[0]);
+    STRCMP_EQUAL("SOURCE2.S", m_commandLine.ppSourceFilenames[1]);
+    STRCMP_EQUAL("--notAFlag.S", m_commandLine.ppSourceFilenames[2]);
+}
+
+TEST(SnapNCrackleCommandLine, FailOnMissingSourceFilename)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("pop1.nib");
+    
+    __try_and_catch( SnapNCrackleCommandLine_Init(&m_commandLine, m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrownAndUsageStringDisplayed();
+}
+
+TEST(SnapNCrackleCommandLine, FailOnMissingFormat)
+{
+    addArg("pop1.nib");
+    addArg("SOURCE1.S");
+    
+    __try_and_catch( SnapNCrackleCommandLine_Init(&m_commandLine, m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrownAndUsageStringDisplayed();
+}
+
+TEST(SnapNCrackleCommandLine, FailOnInvalidFormat)
+{
+    addArg("--format");
+    addArg("dsk_5.25");
+    addArg("pop1.nib");
+    addArg("SOURCE1.S");
+    
+    __try_and_catch( SnapNCrackleCommandLine_Init(&m_commandLine, m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrownAndUsageStringDisplayed();
+}
+
+TEST(SnapNCrackleCommandLine, FailOnScriptFlagWithNoFilename)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--script");
+    
+    __try_and_catch( SnapNCrackleCommandLine_Init(&m_commandLine, m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrownAndUsageStringDisplayed();
+}
+
+TEST(SnapNCrackleCommandLine, FailOnInvalidFlag)
+{
+    addArg("--format");
+    addArg("nib_5.25");
+    addArg("--list");
+    addArg("pop1.nib");
+    addArg("SOURCE1.S");
+    
+    __try_and_catch( SnapNCrackleCommandLine_Init(&m_commandLine, m_argc, m_argv) );
+    validateInvalidArgumentExceptionThrownAndUsageStringDisplayed();
+}
@@ -0,0 +1,339 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <string.h>
+
+// Include headers from C modules under test.
+extern "C"
+{
+    #include "Assembler.h"
+    #include "DiskImageCompress.h"
+    #include "printfSpy.h"
+    #include "util.h"
+}
+
+// Include C++ headers for test harness.
+#include "CppUTest/TestHarness.h"
+
+
+#define CODE_ADDRESS        0x0800
+#define COMPRESSED_ADDRESS  0x1000
+#define EXPANDED_ADDRESS    0x6000
+#define UNLZSRC             0xf0
+#define UNLZDST             0xf2
+#define RETURN_ADDRESS      0x0000
+#define MAX_INSTRUCTIONS    10000000
+
+
+/* Just enough of a 6502 to run asm/unlz.S, which is assembled with snap and then used to expand data compressed by
+   DiskImageCompress so that the two are known to agree on the format. */
+class Cpu6502
+{
+public:
+    unsigned char  m_memory[0x10000];
+    unsigned short m_pc;
+    unsigned char  m_a;
+    unsigned char  m_x;
+    unsigned char  m_y;
+    unsigned char  m_sp;
+    bool           m_carry;
+    bool           m_zero;
+    bool           m_negative;
+    unsigned int   m_instructionCount;
+
+    Cpu6502()
+    {
+        memset(m_memory, 0, sizeof(m_memory));
+        m_pc = 0;
+        m_a = m_x = m_y = 0;
+        m_sp = 0xff;
+        m_carry = m_zero = m_negative = false;
+        m_instructionCount = 0;
+    }
+
+    void setWord(unsigned short address, unsigned short value)
+    {
+        m_memory[address] = value & 0xff;
+        m_memory[(unsigned short)(address + 1)] = value >> 8;
+    }
+
+    unsigned short getWord(unsigned short address)
+    {
+        return m_memory[address] | (m_memory[(unsigned short)(address + 1)] << 8);
+    }
+
+    void call(unsigned short address)
+    {
+        /* RTS from the called routine lands on RETURN_ADDRESS which ends the run. */
+        push((RETURN_ADDRESS - 1) >> 8);
+        push((RETURN_ADDRESS - 1) & 0xff);
+        m_pc = address;
+        while (m_pc != RETURN_ADDRESS && m_instructionCount < MAX_INSTRUCTIONS)
+            step();
+    }
+
+private:
+    void push(unsigned char value)
+    {
+        m_memory[0x100 + m_sp--] = value;
+    }
+
+    unsigned char pull()
+    {
+        return m_memory[0x100 + ++m_sp];
+    }
+
+    unsigned char fetch()
+    {
+        return m_memory[m_pc++];
+    }
+
+    unsigned short indirectY()
+    {
+        return getWord(fetch()) + m_y;
+    }
+
+    unsigned char setFlags(unsigned char value)
+    {
+        m_zero = value == 0;
+        m_negative = (value & 0x80) != 0;
+        return value;
+    }
+
+    void branch(bool condition)
+    {
+        signed char offset = (signed char)fetch();
+
+        if (condition)
+            m_pc += offset;
+    }
+
+    void subtract(unsigned char value)
+    {
+        unsigned int result = m_a - value - (m_carry ? 0 : 1);
+
+        m_carry = result < 0x100;
+        m_a = setFlags(result & 0xff);
+    }
+
+    void step()
+    {
+        unsigned char  opcode = fetch();
+        unsigned short address;
+        unsigned int   sum;
+
+        m_instructionCount++;
+        switch (opcode)
+        {
+        case 0x09:  // ORA #imm
+            m_a = setFlags(m_a | fetch());
+            break;
+        case 0x10:  // BPL
+            branch(!m_negative);
+            break;
+        case 0x18:  // CLC
+            m_carry = false;
+            break;
+        case 0x20:  // JSR abs
+            address = fetch();
+            address |= fetch() << 8;
+            push((m_pc - 1) >> 8);
+            push((m_pc - 1) & 0xff);
+            m_pc = address;
+            break;
+        case 0x29:  // AND #imm
+            m_a = setFlags(m_a & fetch());
+            break;
+        case 0x38:  // SEC
+            m_carry = true;
+            break;
+        case 0x60:  // RTS
+            address = pull();
+            address |= pull() << 8;
+            m_pc = address + 1;
+            break;
+        case 0x69:  // ADC #imm
+            sum = m_a + fetch() + (m_carry ? 1 : 0);
+            m_carry = sum > 0xff;
+            m_a = setFlags(sum & 0xff);
+            break;
+        case 0x85:  // STA zp
+            m_memory[fetch()] = m_a;
+            break;
+        case 0x91:  // STA (zp),Y
+            m_memory[indirectY()] = m_a;
+            break;
+        case 0xa0:  // LDY #imm
+            m_y = setFlags(fetch());
+            break;
+        case 0xa5:  // LDA zp
+            m_a = setFlags(m_memory[fetch()]);
+            break;
+        case 0xaa:  // TAX
+            m_x = setFlags(m_a);
+            break;
+        case 0xb1:  // LDA (zp),Y
+            m_a = setFlags(m_memory[indirectY()]);
+            break;
+        case 0xca:  // DEX
+            m_x = setFlags(m_x - 1);
+            break;
+        case 0xd0:  // BNE
+            branch(!m_zero);
+            break;
+        case 0xe5:  // SBC zp
+            subtract(m_memory[fetch()]);
+            break;
+        case 0xe6:  // INC zp
+            address = fetch();
+            m_memory[address] = setFlags(m_memory[address] + 1);
+            break;
+        case 0xf0:  // BEQ
+            branch(m_zero);
+            break;
+        default:
+            FAIL("asm/unlz.S uses an opcode which Cpu6502 doesn't support.");
+            break;
+        }
+    }
+};
+
+
+static void saveObject(void* pContext, const BinaryBufferObject* pObject);
+
+TEST_GROUP(Unlz)
+{
+    Cpu6502*     m_pCpu;
+    ByteBuffer   m_compressed;
+    unsigned int m_codeSize;
+    char         m_source[64];
+
+    void setup()
+    {
+        clearExceptionCode();
+        printfSpy_Hook(128);
+        m_pCpu = new Cpu6502;
+        memset(&m_compressed, 0, sizeof(m_compressed));
+        m_codeSize = 0;
+        assembleUnlz();
+    }
+
+    void teardown()
+    {
+        LONGS_EQUAL(noException, getExceptionCode());
+        printfSpy_Unhook();
+        ByteBuffer_Free(&m_compressed);
+        delete m_pCpu;
+    }
+
+    void assembleUnlz()
+    {
+        AssemblerInitParams initParams;
+        Assembler*          pAssembler;
+
+        memset(&initParams, 0, sizeof(initParams));
+        initParams.pPutDirectories = "../asm";
+        initParams.objectHandler = saveObject;
+        initParams.pObjectHandlerContext = this;
+        pAssembler = Assembler_CreateFromString(dupe(" org $800" LINE_ENDING
+                                                     " put unlz" LINE_ENDING
+                                                     " sav unlz" LINE_ENDING), &initParams);
+        Assembler_Run(pAssembler);
+        LONGS_EQUAL(0, Assembler_GetErrorCount(pAssembler));
+        Assembler_Free(pAssembler);
+        CHECK_TRUE(m_codeSize > 0);
+    }
+
+    char* dupe(const char* pString)
+    {
+        /* The assembler parses the source text in place so it needs a writable copy. */
+        CHECK_TRUE(strlen(pString) < sizeof(m_source));
+        strcpy(m_source, pString);
+        return m_source;
+    }
+
+    void loadCode(const BinaryBufferObject* pObject)
+    {
+        CHECK_TRUE(CODE_ADDRESS + pObject->dataLength <= COMPRESSED_ADDRESS);
+        memcpy(&m_pCpu->m_memory[CODE_ADDRESS], pObject->pData, pObject->dataLength);
+        m_codeSize = pObject->dataLength;
+    }
+
+    unsigned int validateUnlzExpands(const unsigned char* pData, unsigned int dataSize)
+    {
+        unsigned int compressedSize = DiskImageCompress_Compress(&m_compressed, pData, dataSize);
+
+        CHECK_TRUE(COMPRESSED_ADDRESS + compressedSize <= EXPANDED_ADDRESS);
+        CHECK_TRUE(EXPANDED_ADDRESS + dataSize <= 0x10000);
+        memcpy(&m_pCpu->m_memory[COMPRESSED_ADDRESS], m_compressed.pBuffer, compressedSize);
+        m_pCpu->setWord(UNLZSRC, COMPRESSED_ADDRESS);
+        m_pCpu->setWord(UNLZDST, EXPANDED_ADDRESS);
+
+        m_pCpu->call(CODE_ADDRESS);
+
+        LONGS_EQUAL(RETURN_ADDRESS, m_pCpu->m_pc);
+        LONGS_EQUAL(COMPRESSED_ADDRESS + compressedSize, m_pCpu->getWord(UNLZSRC));
+        LONGS_EQUAL(EXPANDED_ADDRESS + dataSize, m_pCpu->getWord(UNLZDST));
+        CHECK_TRUE(0 == memcmp(pData, &m_pCpu->m_memory[EXPANDED_ADDRESS], dataSize));
+        return compressedSize;
+    }
+};
+
+static void saveObject(void* pContext, const BinaryBufferObject* pObject)
+{
+    ((TEST_GROUP_CppUTestGroupUnlz*)pContext)->loadCode(pObject);
+}
+
+
+TEST(Unlz, DecompressorIsSmall)
+{
+    CHECK_TRUE(m_codeSize < 128);
+}
+
+TEST(Unlz, ExpandEmptyData)
+{
+    validateUnlzExpands((const unsigned char*)"", 0);
+}
+
+TEST(Unlz, ExpandRunWhichOverlapsItsOwnOutput)
+{
+    unsigned char data[1000];
+
+    memset(data, 0xa5, sizeof(data));
+    validateUnlzExpands(data, sizeof(data));
+}
+
+TEST(Unlz, ExpandMixOfLiteralsAndMatchesAcrossPageBoundaries)
+{
+    static unsigned char data[0x5000];
+    unsigned int         seed = 1;
+    size_t               i = 0;
+
+    /* Alternate short runs of random literals with longer runs copied from as far as 1000 bytes back. */
+    while (i < sizeof(data))
+    {
+        size_t runLength;
+        size_t distance;
+
+        seed = seed * 1103515245 + 12345;
+        runLength = 4 + (seed >> 16) % 150;
+        distance = 1 + (seed >> 8) % 1000;
+        if (i + runLength > sizeof(data))
+            runLength = sizeof(data) - i;
+        for (size_t j = 0 ; j < runLength ; j++, i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            data[i] = (i >= distance && runLength > 20) ? data[i - distance] : (unsigned char)(seed >> 16);
+        }
+    }
+    CHECK_TRUE(validateUnlzExpands(data, sizeof(data)) < sizeof(data) / 2);
+}
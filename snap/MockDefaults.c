@@ -12,6 +12,8 @@
 */
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include "FileOpen.h"
 
 
@@ -30,3 +32,7 @@ int    (*hook_fseek)(FILE* stream, long offset, int whence) = fseek;
 long   (*hook_ftell)(FILE* stream) = ftell;
 size_t (*hook_fwrite)(const void* ptr, size_t size, size_t nitems, FILE* stream) = fwrite;
 size_t (*hook_fread)(void* ptr, size_t size, size_t nitems, FILE* stream) = fread;
+ssize_t (*hook_read)(int fildes, void* buf, size_t nbyte) = read;
+off_t  (*hook_lseek)(int fildes, off_t offset, int whence) = lseek;
+ssize_t (*hook_writev)(int fildes, const struct iovec* iov, int iovcnt) = writev;
+int    (*hook_rename)(const char* oldPath, const char* newPath) = rename;
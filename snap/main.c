@@ -15,6 +15,7 @@
 #include "Assembler.h"
 #include "util.h"
 
+static void displayObjectFileCountsIfAnyWereSaved(Assembler* pAssembler);
 static int displayAndReturnErrorCountIfAnyWereEncountered(Assembler* pAssembler);
 int main(int argc, const char** argv)
 {
@@ -27,6 +28,7 @@ int main(int argc, const char** argv)
         SnapCommandLine_Init(&commandLine, argc-1, argv+1);
         pAssembler = Assembler_CreateFromFile(commandLine.pSourceFilename, &commandLine.assemblerInitParams);
         Assembler_Run(pAssembler);
+        displayObjectFileCountsIfAnyWereSaved(pAssembler);
         returnValue = displayAndReturnErrorCountIfAnyWereEncountered(pAssembler);
     }
     __catch
@@ -41,6 +43,17 @@ int main(int argc, const char** argv)
     return returnValue;
 }
 
+static void displayObjectFileCountsIfAnyWereSaved(Assembler* pAssembler)
+{
+    unsigned int writtenCount = Assembler_GetWrittenFileCount(pAssembler);
+    unsigned int skippedCount = Assembler_GetSkippedFileCount(pAssembler);
+    
+    if (writtenCount || skippedCount)
+        fprintf(stderr, "Wrote %u object %s and skipped %u unchanged %s." LINE_ENDING,
+               writtenCount, writtenCount != 1 ? "files" : "file",
+               skippedCount, skippedCount != 1 ? "files" : "file");
+}
+
 static int displayAndReturnErrorCountIfAnyWereEncountered(Assembler* pAssembler)
 {
     unsigned int errorCount = Assembler_GetErrorCount(pAssembler);
@@ -0,0 +1,103 @@
+/*  Copyright (C) 2013  Adam Green (https://github.com/adamgreen)
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "SnapNCrackleCommandLine.h"
+#include "DiskImageAssembler.h"
+#include "NibbleDiskImage.h"
+#include "BlockDiskImage.h"
+#include "util.h"
+
+
+static DiskImage* allocateDiskImageObject(SnapNCrackleCommandLine* pCommandLine);
+static void assembleSourcesIntoDiskImage(SnapNCrackleCommandLine*   pCommandLine, 
+                                         DiskImage*                 pDiskImage, 
+                                         DiskImageAssemblerResults* pResults);
+static void displayResults(DiskImageAssemblerResults* pResults);
+int main(int argc, const char** argv)
+{
+    int                       returnValue = 0;
+    DiskImage*                pDiskImage = NULL;
+    SnapNCrackleCommandLine   commandLine;
+    DiskImageAssemblerResults results;
+    
+    memset(&commandLine, 0, sizeof(commandLine));
+    memset(&results, 0, sizeof(results));
+    __try
+    {
+        SnapNCrackleCommandLine_Init(&commandLine, argc-1, argv+1);
+        pDiskImage = allocateDiskImageObject(&commandLine);
+        assembleSourcesIntoDiskImage(&commandLine, pDiskImage, &results);
+        displayResults(&results);
+        if (results.errorCount)
+            __throw(invalidArgumentException);
+        if (commandLine.pScriptFilename)
+            DiskImage_ProcessScriptFile(pDiskImage, commandLine.pScriptFilename);
+        DiskImage_WriteImage(pDiskImage, commandLine.pOutputImageFilename);
+    }
+    __catch
+    {
+        printf("%s image build failed.\n", commandLine.pOutputImageFilename ? commandLine.pOutputImageFilename : "");
+        returnValue = 1;
+    }
+    
+    DiskImage_Free(pDiskImage);
+    
+    return returnValue;
+}
+
+static DiskImage* allocateDiskImageObject(SnapNCrackleCommandLine* pCommandLine)
+{
+    if (pCommandLine->imageFormat == FORMAT_NIB_5_25)
+        return (DiskImage*) NibbleDiskImage_Create();
+    else if (pCommandLine->imageFormat == FORMAT_HDV_3_5)
+        return (DiskImage*) BlockDiskImage_Create(BLOCK_DISK_IMAGE_3_5_BLOCK_COUNT);
+    else
+        return NULL;
+}
+
+static void assembleSourcesIntoDiskImage(SnapNCrackleCommandLine*   pCommandLine, 
+                                         DiskImage*                 pDiskImage, 
+                                         DiskImageAssemblerResults* pResults)
+{
+    size_t i;
+    
+    for (i = 0 ; i < pCommandLine->sourceFileCount ; i++)
+    {
+        const char* pSourceFilename = pCommandLine->ppSourceFilenames[i];
+        
+        __try
+        {
+            DiskImageAssembler_AssembleFile(pDiskImage, pSourceFilename, &pCommandLine->assemblerInitParams, pResults);
+        }
+        __catch
+        {
+            if (fileOpenException == getExceptionCode())
+                fprintf(stderr, "Failed to open %s" LINE_ENDING, pSourceFilename);
+            __rethrow;
+        }
+    }
+}
+
+static void displayResults(DiskImageAssemblerResults* pResults)
+{
+    if (pResults->insertedObjectCount || pResults->savedObjectCount || pResults->skippedObjectCount)
+        printf("Inserted %u USR %s into the image, wrote %u SAV %s and skipped %u unchanged %s." LINE_ENDING,
+               pResults->insertedObjectCount, pResults->insertedObjectCount != 1 ? "objects" : "object",
+               pResults->savedObjectCount, pResults->savedObjectCount != 1 ? "files" : "file",
+               pResults->skippedObjectCount, pResults->skippedObjectCount != 1 ? "files" : "file");
+    if (pResults->errorCount || pResults->warningCount)
+        printf("Encountered %u %s and %u %s during assembly." LINE_ENDING,
+               pResults->errorCount, pResults->errorCount != 1 ? "errors" : "error",
+               pResults->warningCount, pResults->warningCount != 1 ? "warnings" : "warning");
+}